@@ -23,6 +23,7 @@
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/s390x/adapter.h"
@@ -37,6 +38,8 @@
 #include "exec/address-spaces.h"
 #include "qemu/event_notifier.h"
 #include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "hw/irq.h"
 #include "sysemu/sev.h"
@@ -94,6 +97,11 @@ struct KVMState
     int intx_set_mask;
     bool sync_mmu;
     bool manual_dirty_log_protect;
+    /* Entries of each per-vCPU dirty ring, 0 if dirty rings are disabled */
+    uint32_t kvm_dirty_ring_size;
+    QemuThread dirty_ring_reaper;
+    /* Dirty pages per second allowed to each vCPU, 0 if unlimited */
+    uint64_t dirty_limit;
     /* The man page (and posix) say ioctl numbers are signed int, but
      * they're not.  Linux, glibc and *BSD all treat ioctl numbers as
      * unsigned, and treating them as signed here can break things */
@@ -109,6 +117,8 @@ struct KVMState
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
+    /* vCPUs may be created outside the BQL, see kvm_create_vcpu() */
+    QemuMutex kvm_parked_vcpus_lock;
 
     /* memory encryption */
     void *memcrypt_handle;
@@ -148,8 +158,15 @@ static const KVMCapabilityInfo kvm_required_capabilites[] = {
     KVM_CAP_LAST_INFO
 };
 
-#define kvm_slots_lock(kml)      qemu_mutex_lock(&(kml)->slots_lock)
-#define kvm_slots_unlock(kml)    qemu_mutex_unlock(&(kml)->slots_lock)
+/*
+ * Protects the slots of all KVMMemoryListeners, including their dirty
+ * bitmaps.  A single lock is used because dirty rings report pages of
+ * every address space at once.
+ */
+static QemuMutex kml_slots_lock;
+
+#define kvm_slots_lock()      qemu_mutex_lock(&kml_slots_lock)
+#define kvm_slots_unlock()    qemu_mutex_unlock(&kml_slots_lock)
 
 int kvm_get_max_memslots(void)
 {
@@ -178,7 +195,7 @@ int kvm_memcrypt_encrypt_data(uint8_t *ptr, uint64_t len)
     return 1;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 {
     KVMState *s = kvm_state;
@@ -199,14 +216,14 @@ bool kvm_has_free_slot(MachineState *ms)
     bool result;
     KVMMemoryListener *kml = &s->memory_listener;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     result = !!kvm_get_free_slot(kml);
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return result;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
 {
     KVMSlot *slot = kvm_get_free_slot(kml);
@@ -267,7 +284,7 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
     KVMMemoryListener *kml = &s->memory_listener;
     int i, ret = 0;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &kml->slots[i];
 
@@ -277,7 +294,7 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
             break;
         }
     }
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return ret;
 }
@@ -307,6 +324,84 @@ static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot, boo
     return ret;
 }
 
+#define KVM_EXIT_STATS_REASONS 32
+#define KVM_EXIT_STATS_BUCKETS 16
+
+typedef struct KVMExitCounter {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t histogram[KVM_EXIT_STATS_BUCKETS];
+} KVMExitCounter;
+
+/*
+ * Only the vCPU thread updates the statistics; the lock is uncontended
+ * except while query-vcpu-stats copies them out.
+ */
+typedef struct KVMExitStats {
+    QemuMutex lock;
+    /* Exits with a larger reason are accounted in the last entry */
+    KVMExitCounter reasons[KVM_EXIT_STATS_REASONS];
+    /* MemoryRegion name -> KVMExitCounter */
+    GHashTable *mmio;
+    /* port -> KVMExitCounter */
+    GHashTable *pio;
+} KVMExitStats;
+
+static const char *const kvm_exit_reason_names[KVM_EXIT_STATS_REASONS] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail-entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set-tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr-access",
+    [KVM_EXIT_S390_SIEIC] = "s390-sieic",
+    [KVM_EXIT_S390_RESET] = "s390-reset",
+    [KVM_EXIT_DCR] = "dcr",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+    [KVM_EXIT_OSI] = "osi",
+    [KVM_EXIT_PAPR_HCALL] = "papr-hcall",
+    [KVM_EXIT_S390_UCONTROL] = "s390-ucontrol",
+    [KVM_EXIT_WATCHDOG] = "watchdog",
+    [KVM_EXIT_S390_TSCH] = "s390-tsch",
+    [KVM_EXIT_EPR] = "epr",
+    [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    [KVM_EXIT_S390_STSI] = "s390-stsi",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic-eoi",
+    [KVM_EXIT_HYPERV] = "hyperv",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty-ring-full",
+};
+
+static KVMExitStats *kvm_exit_stats_new(void)
+{
+    KVMExitStats *st = g_new0(KVMExitStats, 1);
+
+    qemu_mutex_init(&st->lock);
+    st->mmio = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    st->pio = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    return st;
+}
+
+static void kvm_exit_stats_free(KVMExitStats *st)
+{
+    g_hash_table_destroy(st->mmio);
+    g_hash_table_destroy(st->pio);
+    qemu_mutex_destroy(&st->lock);
+    g_free(st);
+}
+
+static size_t kvm_dirty_ring_bytes(KVMState *s)
+{
+    return s->kvm_dirty_ring_size * sizeof(struct kvm_dirty_gfn);
+}
+
 int kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -333,10 +428,24 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        ret = munmap(cpu->kvm_dirty_gfns, kvm_dirty_ring_bytes(s));
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
+    /* The BQL is held, so query-vcpu-stats cannot be looking at them */
+    kvm_exit_stats_free(cpu->kvm_exit_stats);
+    cpu->kvm_exit_stats = NULL;
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    qemu_mutex_lock(&kvm_state->kvm_parked_vcpus_lock);
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
+    qemu_mutex_unlock(&kvm_state->kvm_parked_vcpus_lock);
 err:
     return ret;
 }
@@ -345,27 +454,35 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 {
     struct KVMParkedVcpu *cpu;
 
+    qemu_mutex_lock(&s->kvm_parked_vcpus_lock);
     QLIST_FOREACH(cpu, &s->kvm_parked_vcpus, node) {
         if (cpu->vcpu_id == vcpu_id) {
             int kvm_fd;
 
             QLIST_REMOVE(cpu, node);
+            qemu_mutex_unlock(&s->kvm_parked_vcpus_lock);
             kvm_fd = cpu->kvm_fd;
             g_free(cpu);
             return kvm_fd;
         }
     }
+    qemu_mutex_unlock(&s->kvm_parked_vcpus_lock);
 
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
-int kvm_init_vcpu(CPUState *cpu)
+/*
+ * Create the KVM vCPU and map its shared areas.  This only touches the
+ * vCPU itself, so the vCPU threads can do it in parallel and without
+ * the BQL; kvm_init_vcpu() then does the architecture setup.
+ */
+int kvm_create_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
     long mmap_size;
     int ret;
 
-    DPRINTF("kvm_init_vcpu\n");
+    DPRINTF("kvm_create_vcpu\n");
 
     ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
     if (ret < 0) {
@@ -376,6 +493,9 @@ int kvm_init_vcpu(CPUState *cpu)
     cpu->kvm_fd = ret;
     cpu->kvm_state = s;
     cpu->vcpu_dirty = true;
+    if (!cpu->kvm_exit_stats) {
+        atomic_store_release(&cpu->kvm_exit_stats, kvm_exit_stats_new());
+    }
 
     mmap_size = kvm_ioctl(s, KVM_GET_VCPU_MMAP_SIZE, 0);
     if (mmap_size < 0) {
@@ -392,16 +512,38 @@ int kvm_init_vcpu(CPUState *cpu)
         goto err;
     }
 
-    if (s->coalesced_mmio && !s->coalesced_mmio_ring) {
-        s->coalesced_mmio_ring =
-            (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
+    if (s->coalesced_mmio) {
+        atomic_cmpxchg(&s->coalesced_mmio_ring, NULL,
+                       (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE);
+    }
+
+    if (s->kvm_dirty_ring_size) {
+        /* Use MAP_SHARED to share pages with the kernel */
+        cpu->kvm_dirty_gfns = mmap(NULL, kvm_dirty_ring_bytes(s),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            ret = -errno;
+            cpu->kvm_dirty_gfns = NULL;
+            DPRINTF("mmap'ing vcpu dirty gfns failed\n");
+            goto err;
+        }
     }
 
-    ret = kvm_arch_init_vcpu(cpu);
+    ret = 0;
 err:
     return ret;
 }
 
+/* Called with the BQL held, after kvm_create_vcpu() */
+int kvm_init_vcpu(CPUState *cpu)
+{
+    DPRINTF("kvm_init_vcpu\n");
+
+    return kvm_arch_init_vcpu(cpu);
+}
+
 /*
  * dirty pages logging control
  */
@@ -420,7 +562,7 @@ static int kvm_mem_flags(MemoryRegion *mr)
     return flags;
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
+/* Called with kml_slots_lock held */
 static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
                                  MemoryRegion *mr)
 {
@@ -446,7 +588,7 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
         return 0;
     }
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     mem = kvm_lookup_matching_slot(kml, start_addr, size);
     if (!mem) {
@@ -457,7 +599,7 @@ static int kvm_section_update_flags(KVMMemoryListener *kml,
     ret = kvm_slot_update_flags(kml, mem, section->mr);
 
 out:
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
     return ret;
 }
 
@@ -509,13 +651,50 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
 
+/* Size in bytes of the dirty bitmap of @mem */
+static hwaddr kvm_slot_dirty_bitmap_size(KVMSlot *mem)
+{
+    /* XXX bad kernel interface alert
+     * For dirty bitmap, kernel allocates array of size aligned to
+     * bits-per-long.  But for case when the kernel is 64bits and
+     * the userspace is 32bits, userspace can't align to the same
+     * bits-per-long, since sizeof(long) is different between kernel
+     * and user space.  This way, userspace will provide buffer which
+     * may be 4 bytes less than the kernel will use, resulting in
+     * userspace memory corruption (which is not detectable by valgrind
+     * too, in most cases).
+     * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
+     * a hope that sizeof(long) won't become >8 any time soon.
+     */
+    return ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
+                 /*HOST_LONG_BITS*/ 64) / 8;
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_slot_init_dirty_bitmap(KVMSlot *mem)
+{
+    if (!mem->dirty_bmap) {
+        /* Allocate on first use, once and for all */
+        mem->dirty_bmap = g_malloc0(kvm_slot_dirty_bitmap_size(mem));
+    }
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_slot_sync_dirty_pages(KVMSlot *mem)
+{
+    ram_addr_t pages = mem->memory_size / getpagesize();
+
+    cpu_physical_memory_set_dirty_lebitmap(mem->dirty_bmap,
+                                           mem->ram_start_offset, pages);
+}
+
 /**
  * kvm_physical_sync_dirty_bitmap - Sync dirty bitmap from kernel space
  *
  * This function will first try to fetch dirty bitmap from the kernel,
  * and then updates qemu's dirty bitmap.
  *
- * NOTE: caller must be with kml->slots_lock held.
+ * NOTE: caller must be with kml_slots_lock held.
  *
  * @kml: the KVM memory listener object
  * @section: the memory section to sync the dirty bitmap with
@@ -537,24 +716,7 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
             goto out;
         }
 
-        /* XXX bad kernel interface alert
-         * For dirty bitmap, kernel allocates array of size aligned to
-         * bits-per-long.  But for case when the kernel is 64bits and
-         * the userspace is 32bits, userspace can't align to the same
-         * bits-per-long, since sizeof(long) is different between kernel
-         * and user space.  This way, userspace will provide buffer which
-         * may be 4 bytes less than the kernel will use, resulting in
-         * userspace memory corruption (which is not detectable by valgrind
-         * too, in most cases).
-         * So for now, let's align to 64 instead of HOST_LONG_BITS here, in
-         * a hope that sizeof(long) won't become >8 any time soon.
-         */
-        size = ALIGN(((mem->memory_size) >> TARGET_PAGE_BITS),
-                     /*HOST_LONG_BITS*/ 64) / 8;
-        if (!mem->dirty_bmap) {
-            /* Allocate on the first log_sync, once and for all */
-            mem->dirty_bmap = g_malloc0(size);
-        }
+        kvm_slot_init_dirty_bitmap(mem);
 
         d.dirty_bitmap = mem->dirty_bmap;
         d.slot = mem->slot | (kml->as_id << 16);
@@ -570,6 +732,249 @@ out:
     return ret;
 }
 
+static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
+{
+    return atomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
+}
+
+static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
+{
+    atomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml = NULL;
+    KVMSlot *mem;
+    int i;
+
+    for (i = 0; i < s->nr_as; i++) {
+        if (s->as[i].ml && s->as[i].ml->as_id == as_id) {
+            kml = s->as[i].ml;
+            break;
+        }
+    }
+    if (!kml || slot_id >= s->nr_slots) {
+        return;
+    }
+
+    mem = &kml->slots[slot_id];
+    if (!mem->memory_size || offset >= mem->memory_size / getpagesize()) {
+        /* The slot went away since the page was dirtied */
+        return;
+    }
+
+    kvm_slot_init_dirty_bitmap(mem);
+    set_bit(offset, mem->dirty_bmap);
+}
+
+/*
+ * Harvest the dirty ring of @cpu into the slot dirty bitmaps.
+ * Called with kml_slots_lock held.
+ */
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
+    uint32_t ring_size = s->kvm_dirty_ring_size;
+    uint32_t count = 0, fetch = cpu->kvm_fetch_index;
+
+    if (!dirty_gfns) {
+        /* The vCPU has not been created yet */
+        return 0;
+    }
+
+    while (true) {
+        cur = &dirty_gfns[fetch & (ring_size - 1)];
+        if (!dirty_gfn_is_dirtied(cur)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        dirty_gfn_set_collected(cur);
+        fetch++;
+        count++;
+    }
+    cpu->kvm_fetch_index = fetch;
+    cpu->kvm_dirty_pages += count;
+
+    return count;
+}
+
+/* Called with kml_slots_lock and the iothread lock held */
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
+{
+    CPUState *cpu;
+    uint64_t total = 0;
+    int ret;
+
+    CPU_FOREACH(cpu) {
+        total += kvm_dirty_ring_reap_one(s, cpu);
+    }
+
+    if (total) {
+        /* Give the collected entries back to the vCPUs */
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        assert(ret == total);
+    }
+
+    trace_kvm_dirty_ring_reap(total);
+    return total;
+}
+
+/* Called with the iothread lock held */
+static uint64_t kvm_dirty_ring_reap(KVMState *s)
+{
+    uint64_t total;
+
+    kvm_slots_lock();
+    total = kvm_dirty_ring_reap_locked(s);
+    kvm_slots_unlock();
+
+    return total;
+}
+
+static void do_kvm_cpu_synchronize_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+    /* Nothing to do, leaving the guest is all that was needed */
+}
+
+/*
+ * Collect every page dirtied so far.  The vCPUs are kicked out of the
+ * guest synchronously first, so that hardware buffers (e.g. Intel PML)
+ * are flushed into the dirty rings.
+ */
+static void kvm_dirty_ring_flush(KVMState *s)
+{
+    CPUState *cpu;
+
+    assert(qemu_mutex_iothread_locked());
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, do_kvm_cpu_synchronize_kick, RUN_ON_CPU_NULL);
+    }
+    kvm_dirty_ring_reap(s);
+}
+
+/* How often the rings are harvested while a dirty limit is set */
+#define KVM_DIRTY_LIMIT_PERIOD_US   (100 * 1000)
+
+/*
+ * Returns how many microseconds @cpu must sleep to get back under the
+ * dirty limit.  Each vCPU may dirty limit * elapsed time pages since the
+ * start of its window; an idle vCPU does not save up for more than one
+ * period's worth of burst.
+ * Called with the iothread lock held.
+ */
+static int64_t kvm_dirty_limit_delay(KVMState *s, CPUState *cpu)
+{
+    uint64_t limit = atomic_read(&s->dirty_limit);
+    int64_t now, elapsed, quota_us;
+
+    if (!limit) {
+        return 0;
+    }
+
+    now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    elapsed = now - cpu->kvm_dirty_limit_start;
+    quota_us = (cpu->kvm_dirty_pages - cpu->kvm_dirty_limit_base) *
+               G_USEC_PER_SEC / limit;
+    if (elapsed > quota_us + KVM_DIRTY_LIMIT_PERIOD_US) {
+        cpu->kvm_dirty_limit_start = now;
+        cpu->kvm_dirty_limit_base = cpu->kvm_dirty_pages;
+        return 0;
+    }
+
+    return MIN(quota_us - elapsed, KVM_DIRTY_LIMIT_PERIOD_US);
+}
+
+/* Called with the iothread lock held; drops it while sleeping */
+static void kvm_dirty_limit_throttle(KVMState *s, CPUState *cpu)
+{
+    int64_t delay = kvm_dirty_limit_delay(s, cpu);
+
+    if (delay <= 0) {
+        return;
+    }
+
+    trace_kvm_dirty_limit_throttle(cpu->cpu_index, delay);
+    qemu_mutex_unlock_iothread();
+    g_usleep(delay);
+    qemu_mutex_lock_iothread();
+}
+
+static void do_kvm_dirty_limit_throttle(CPUState *cpu, run_on_cpu_data arg)
+{
+    atomic_set(&cpu->kvm_dirty_limit_queued, false);
+    kvm_dirty_limit_throttle(kvm_state, cpu);
+}
+
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state && kvm_state->kvm_dirty_ring_size;
+}
+
+/*
+ * Limit the rate at which each vCPU may dirty guest memory to
+ * @bytes_per_sec, or lift the limit if it is 0.  vCPUs that dirty
+ * pages faster are put to sleep, either when their dirty ring fills up
+ * or when the ring is harvested; the others run at full speed.
+ * Setting a limit must be done with the iothread lock held.
+ */
+void kvm_dirty_limit_set(uint64_t bytes_per_sec)
+{
+    KVMState *s = kvm_state;
+    uint64_t limit = DIV_ROUND_UP(bytes_per_sec, qemu_real_host_page_size);
+    CPUState *cpu;
+
+    if (!kvm_dirty_ring_enabled() || atomic_read(&s->dirty_limit) == limit) {
+        return;
+    }
+
+    trace_kvm_dirty_limit_set(limit);
+    if (limit) {
+        CPU_FOREACH(cpu) {
+            cpu->kvm_dirty_limit_start = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+            cpu->kvm_dirty_limit_base = cpu->kvm_dirty_pages;
+        }
+    }
+    atomic_set(&s->dirty_limit, limit);
+}
+
+/*
+ * Harvests the dirty rings periodically, so that vCPUs seldom have to
+ * exit with KVM_EXIT_DIRTY_RING_FULL.  With a dirty limit, the rings
+ * are harvested more often and the vCPUs that went over their quota
+ * without filling their ring are told to sleep.
+ */
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+    CPUState *cpu;
+
+    rcu_register_thread();
+
+    while (true) {
+        g_usleep(atomic_read(&s->dirty_limit) ? KVM_DIRTY_LIMIT_PERIOD_US :
+                 G_USEC_PER_SEC);
+
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        CPU_FOREACH(cpu) {
+            if (kvm_dirty_limit_delay(s, cpu) > 0 &&
+                !atomic_xchg(&cpu->kvm_dirty_limit_queued, true)) {
+                async_run_on_cpu(cpu, do_kvm_dirty_limit_throttle,
+                                 RUN_ON_CPU_NULL);
+            }
+        }
+        qemu_mutex_unlock_iothread();
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
 /* Alignment requirement for KVM_CLEAR_DIRTY_LOG - 64 pages */
 #define KVM_CLEAR_LOG_SHIFT  6
 #define KVM_CLEAR_LOG_ALIGN  (qemu_real_host_page_size << KVM_CLEAR_LOG_SHIFT)
@@ -608,7 +1013,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
         return 0;
     }
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
 
     /* Find any possible slot that covers the section */
     for (i = 0; i < s->nr_slots; i++) {
@@ -718,7 +1123,7 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
     /* This handles the NULL case well */
     g_free(bmap_clear);
 
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
 
     return ret;
 }
@@ -953,66 +1358,102 @@ kvm_check_extension_list(KVMState *s, const KVMCapabilityInfo *list)
     return NULL;
 }
 
-static void kvm_set_phys_mem(KVMMemoryListener *kml,
-                             MemoryRegionSection *section, bool add)
+/*
+ * Compute the slot that @section maps to.  @add is cleared if the
+ * section must not have a slot even though it is being added.
+ * Returns false if the section is of no interest to KVM.
+ */
+static bool kvm_section_to_slot(MemoryRegionSection *section, bool *add,
+                                KVMSlot *slot)
 {
-    KVMSlot *mem;
-    int err;
     MemoryRegion *mr = section->mr;
     bool writeable = !mr->readonly && !mr->rom_device;
-    hwaddr start_addr, size;
-    void *ram;
+    hwaddr start_addr, size, delta;
 
     if (!memory_region_is_ram(mr)) {
         if (writeable || !kvm_readonly_mem_allowed) {
-            return;
+            return false;
         } else if (!mr->romd_mode) {
             /* If the memory device is not in romd_mode, then we actually want
              * to remove the kvm memory slot so all accesses will trap. */
-            add = false;
+            *add = false;
         }
     }
 
     size = kvm_align_section(section, &start_addr);
     if (!size) {
-        return;
+        return false;
     }
 
     /* use aligned delta to align the ram address */
-    ram = memory_region_get_ram_ptr(mr) + section->offset_within_region +
-          (start_addr - section->offset_within_address_space);
+    delta = section->offset_within_region +
+            (start_addr - section->offset_within_address_space);
 
-    kvm_slots_lock(kml);
+    memset(slot, 0, sizeof(*slot));
+    slot->start_addr = start_addr;
+    slot->memory_size = size;
+    slot->ram = memory_region_get_ram_ptr(mr) + delta;
+    slot->ram_start_offset = memory_region_get_ram_addr(mr) + delta;
+    slot->flags = kvm_mem_flags(mr);
+    return true;
+}
 
-    if (!add) {
-        mem = kvm_lookup_matching_slot(kml, start_addr, size);
-        if (!mem) {
-            goto out;
-        }
-        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+static bool kvm_slot_equal(KVMSlot *a, KVMSlot *b)
+{
+    return a->start_addr == b->start_addr &&
+           a->memory_size == b->memory_size &&
+           a->ram == b->ram &&
+           a->ram_start_offset == b->ram_start_offset &&
+           a->flags == b->flags;
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_slot_unregister(KVMMemoryListener *kml, KVMSlot *mem,
+                                MemoryRegionSection *section, bool *reaped)
+{
+    int err;
+
+    if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+        if (kvm_state->kvm_dirty_ring_size) {
+            /* The rings hold the pages of every slot, reap them once */
+            if (!*reaped) {
+                kvm_dirty_ring_reap_locked(kvm_state);
+                *reaped = true;
+            }
+            if (mem->dirty_bmap) {
+                kvm_slot_sync_dirty_pages(mem);
+            }
+        } else {
             kvm_physical_sync_dirty_bitmap(kml, section);
         }
+    }
 
-        /* unregister the slot */
-        g_free(mem->dirty_bmap);
-        mem->dirty_bmap = NULL;
-        mem->memory_size = 0;
-        mem->flags = 0;
-        err = kvm_set_user_memory_region(kml, mem, false);
-        if (err) {
-            fprintf(stderr, "%s: error unregistering slot: %s\n",
-                    __func__, strerror(-err));
-            abort();
-        }
-        goto out;
+    /* unregister the slot */
+    g_free(mem->dirty_bmap);
+    mem->dirty_bmap = NULL;
+    mem->memory_size = 0;
+    mem->flags = 0;
+    err = kvm_set_user_memory_region(kml, mem, false);
+    if (err) {
+        fprintf(stderr, "%s: error unregistering slot: %s\n",
+                __func__, strerror(-err));
+        abort();
     }
+}
+
+/* Called with kml_slots_lock held */
+static void kvm_slot_register(KVMMemoryListener *kml, KVMSlot *slot)
+{
+    KVMSlot *mem;
+    int err;
 
     /* register the new slot */
     mem = kvm_alloc_slot(kml);
-    mem->memory_size = size;
-    mem->start_addr = start_addr;
-    mem->ram = ram;
-    mem->flags = kvm_mem_flags(mr);
+    mem->memory_size = slot->memory_size;
+    mem->start_addr = slot->start_addr;
+    mem->ram = slot->ram;
+    mem->ram_start_offset = slot->ram_start_offset;
+    mem->flags = slot->flags;
 
     err = kvm_set_user_memory_region(kml, mem, true);
     if (err) {
@@ -1020,9 +1461,90 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 strerror(-err));
         abort();
     }
+}
 
-out:
-    kvm_slots_unlock(kml);
+/*
+ * Apply the slot changes queued during a memory transaction.  The
+ * memory core removes the old sections before adding the new ones,
+ * and a slot that is removed and added back unchanged (e.g. when a
+ * neighbouring BAR moves or a ROM toggles romd mode) is simply kept.
+ * Every other change still costs one KVM_SET_USER_MEMORY_REGION.
+ */
+static void kvm_apply_slot_updates(KVMMemoryListener *kml)
+{
+    KVMSlotUpdate *u, *a, *next;
+    bool reaped = false;
+    int kept = 0, applied = 0;
+
+    if (QSIMPLEQ_EMPTY(&kml->updates)) {
+        return;
+    }
+
+    kvm_slots_lock();
+
+    QSIMPLEQ_FOREACH(u, &kml->updates, next) {
+        if (!u->add) {
+            u->mem = kvm_lookup_matching_slot(kml, u->slot.start_addr,
+                                              u->slot.memory_size);
+        }
+    }
+
+    QSIMPLEQ_FOREACH(a, &kml->updates, next) {
+        if (!a->add) {
+            continue;
+        }
+        QSIMPLEQ_FOREACH(u, &kml->updates, next) {
+            if (!u->add && u->mem && kvm_slot_equal(u->mem, &a->slot)) {
+                u->mem = NULL;
+                a->add = false;
+                kept++;
+                break;
+            }
+        }
+    }
+
+    QSIMPLEQ_FOREACH(u, &kml->updates, next) {
+        if (!u->add && u->mem) {
+            kvm_slot_unregister(kml, u->mem, &u->section, &reaped);
+            applied++;
+        }
+    }
+    QSIMPLEQ_FOREACH(u, &kml->updates, next) {
+        if (u->add) {
+            kvm_slot_register(kml, &u->slot);
+            applied++;
+        }
+    }
+
+    kvm_slots_unlock();
+
+    QSIMPLEQ_FOREACH_SAFE(u, &kml->updates, next, next) {
+        memory_region_unref(u->section.mr);
+        g_free(u);
+    }
+    QSIMPLEQ_INIT(&kml->updates);
+
+    trace_kvm_apply_slot_updates(kml->as_id, applied, kept);
+}
+
+static void kvm_queue_slot_update(KVMMemoryListener *kml,
+                                  MemoryRegionSection *section, bool add)
+{
+    KVMSlotUpdate *u = g_new0(KVMSlotUpdate, 1);
+
+    u->add = add;
+    if (!kvm_section_to_slot(section, &u->add, &u->slot)) {
+        g_free(u);
+        return;
+    }
+
+    u->section = *section;
+    memory_region_ref(section->mr);
+    QSIMPLEQ_INSERT_TAIL(&kml->updates, u, next);
+
+    if (!kml->in_transaction) {
+        kvm_apply_slot_updates(kml);
+    }
 }
 
 static void kvm_region_add(MemoryListener *listener,
@@ -1031,7 +1553,7 @@ static void kvm_region_add(MemoryListener *listener,
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
     memory_region_ref(section->mr);
-    kvm_set_phys_mem(kml, section, true);
+    kvm_queue_slot_update(kml, section, true);
 }
 
 static void kvm_region_del(MemoryListener *listener,
@@ -1039,24 +1561,65 @@ static void kvm_region_del(MemoryListener *listener,
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
 
-    kvm_set_phys_mem(kml, section, false);
+    kvm_queue_slot_update(kml, section, false);
     memory_region_unref(section->mr);
 }
 
+static void kvm_region_begin(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+
+    kml->in_transaction = true;
+}
+
+static void kvm_region_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+
+    kml->in_transaction = false;
+    kvm_apply_slot_updates(kml);
+}
+
 static void kvm_log_sync(MemoryListener *listener,
                          MemoryRegionSection *section)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
     int r;
 
-    kvm_slots_lock(kml);
+    kvm_slots_lock();
     r = kvm_physical_sync_dirty_bitmap(kml, section);
-    kvm_slots_unlock(kml);
+    kvm_slots_unlock();
     if (r < 0) {
         abort();
     }
 }
 
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+    KVMState *s = kvm_state;
+    KVMSlot *mem;
+    int i;
+
+    /* Move everything the vCPUs dirtied into the slot dirty bitmaps */
+    kvm_dirty_ring_flush(s);
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_slots; i++) {
+        mem = &kml->slots[i];
+        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES &&
+            mem->dirty_bmap) {
+            kvm_slot_sync_dirty_pages(mem);
+            /*
+             * KVM_GET_DIRTY_LOG overwrites the whole bitmap, while the
+             * dirty rings only ever set bits, so clear them here.
+             */
+            memset(mem->dirty_bmap, 0, kvm_slot_dirty_bitmap_size(mem));
+        }
+    }
+    kvm_slots_unlock();
+}
+
 static void kvm_log_clear(MemoryListener *listener,
                           MemoryRegionSection *section)
 {
@@ -1151,7 +1714,6 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 {
     int i;
 
-    qemu_mutex_init(&kml->slots_lock);
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
     kml->as_id = as_id;
 
@@ -1159,11 +1721,19 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
         kml->slots[i].slot = i;
     }
 
+    QSIMPLEQ_INIT(&kml->updates);
+
+    kml->listener.begin = kvm_region_begin;
+    kml->listener.commit = kvm_region_commit;
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
+    if (s->kvm_dirty_ring_size) {
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    } else {
+        kml->listener.log_sync = kvm_log_sync;
+    }
     kml->listener.log_clear = kvm_log_clear;
     kml->listener.priority = 10;
 
@@ -1758,6 +2328,40 @@ bool kvm_vcpu_id_is_valid(int vcpu_id)
     return vcpu_id >= 0 && vcpu_id < kvm_max_vcpu_id(s);
 }
 
+static int kvm_dirty_ring_init(KVMState *s, uint32_t ring_size)
+{
+    uint64_t ring_bytes = (uint64_t)ring_size * sizeof(struct kvm_dirty_gfn);
+    int ret;
+
+    if (!KVM_DIRTY_LOG_PAGE_OFFSET) {
+        error_report("KVM dirty ring is not supported on this host");
+        return -EINVAL;
+    }
+
+    /* Returns the maximum ring size in bytes, or 0 if unsupported */
+    ret = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+    if (ret <= 0) {
+        error_report("KVM dirty ring not available, kernel lacks "
+                     "KVM_CAP_DIRTY_LOG_RING");
+        return -EINVAL;
+    }
+    if (ring_bytes > ret) {
+        error_report("KVM dirty ring size %" PRIu32 " too big "
+                     "(maximum is %zu entries)", ring_size,
+                     ret / sizeof(struct kvm_dirty_gfn));
+        return -EINVAL;
+    }
+
+    ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+    if (ret) {
+        error_report("Enabling of KVM dirty ring failed: %s", strerror(-ret));
+        return ret;
+    }
+
+    s->kvm_dirty_ring_size = ring_size;
+    return 0;
+}
+
 static int kvm_init(MachineState *ms)
 {
     MachineClass *mc = MACHINE_GET_CLASS(ms);
@@ -1789,12 +2393,15 @@ static int kvm_init(MachineState *ms)
      */
     assert(TARGET_PAGE_SIZE <= getpagesize());
 
+    qemu_mutex_init(&kml_slots_lock);
+
     s->sigmask_len = 8;
 
 #ifdef KVM_CAP_SET_GUEST_DEBUG
     QTAILQ_INIT(&s->kvm_sw_breakpoints);
 #endif
     QLIST_INIT(&s->kvm_parked_vcpus);
+    qemu_mutex_init(&s->kvm_parked_vcpus_lock);
     s->vmfd = -1;
     s->fd = qemu_open("/dev/kvm", O_RDWR);
     if (s->fd == -1) {
@@ -1903,7 +2510,19 @@ static int kvm_init(MachineState *ms)
     s->coalesced_pio = s->coalesced_mmio &&
                        kvm_check_extension(s, KVM_CAP_COALESCED_PIO);
 
-    s->manual_dirty_log_protect =
+    /*
+     * Enable the dirty ring before any vCPU is created.  It replaces
+     * the dirty bitmaps, so manual dirty log protection is not needed
+     * on top of it.
+     */
+    if (machine_kvm_dirty_ring_size(ms)) {
+        ret = kvm_dirty_ring_init(s, machine_kvm_dirty_ring_size(ms));
+        if (ret < 0) {
+            goto err;
+        }
+    }
+
+    s->manual_dirty_log_protect = !s->kvm_dirty_ring_size &&
         kvm_check_extension(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2);
     if (s->manual_dirty_log_protect) {
         ret = kvm_vm_enable_cap(s, KVM_CAP_MANUAL_DIRTY_LOG_PROTECT2, 0, 1);
@@ -2002,6 +2621,12 @@ static int kvm_init(MachineState *ms)
         qemu_balloon_inhibit(true);
     }
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     return 0;
 
 err:
@@ -2094,6 +2719,176 @@ void kvm_flush_coalesced_mmio_buffer(void)
     s->coalesced_flush_in_progress = false;
 }
 
+/*
+ * Posted writes sit in the coalesced MMIO ring until somebody flushes it;
+ * do it whenever a vCPU exits, so that their side effects are not delayed.
+ */
+static void kvm_flush_posted_writes(void)
+{
+    struct kvm_coalesced_mmio_ring *ring = kvm_state->coalesced_mmio_ring;
+
+    if (!memory_region_have_posted_writes() || !ring ||
+        atomic_read(&ring->first) == atomic_read(&ring->last)) {
+        return;
+    }
+
+    qemu_mutex_lock_iothread();
+    kvm_flush_coalesced_mmio_buffer();
+    qemu_mutex_unlock_iothread();
+}
+
+static void kvm_exit_counter_add(KVMExitCounter *c, uint64_t ns)
+{
+    uint64_t us = ns / SCALE_US;
+    int bucket = us ? 64 - clz64(us) : 0;
+
+    c->count++;
+    c->total_ns += ns;
+    c->histogram[MIN(bucket, KVM_EXIT_STATS_BUCKETS - 1)]++;
+}
+
+static KVMExitCounter *kvm_exit_stats_lookup(GHashTable *table, void *key,
+                                             void *(*dup)(void *key))
+{
+    KVMExitCounter *c = g_hash_table_lookup(table, key);
+
+    if (!c) {
+        c = g_new0(KVMExitCounter, 1);
+        g_hash_table_insert(table, dup ? dup(key) : key, c);
+    }
+    return c;
+}
+
+static void *kvm_exit_stats_strdup(void *key)
+{
+    return g_strdup(key);
+}
+
+/* Account an exit whose handling started at @start_ns */
+static void kvm_exit_stats_record(CPUState *cpu, struct kvm_run *run,
+                                  int64_t start_ns)
+{
+    KVMExitStats *st = cpu->kvm_exit_stats;
+    uint64_t ns = get_clock() - start_ns;
+    KVMExitCounter *c;
+
+    qemu_mutex_lock(&st->lock);
+    kvm_exit_counter_add(&st->reasons[MIN(run->exit_reason,
+                                          KVM_EXIT_STATS_REASONS - 1)], ns);
+
+    if (run->exit_reason == KVM_EXIT_MMIO) {
+        MemoryRegion *mr;
+        hwaddr xlat, len = run->mmio.len;
+        const char *name;
+
+        rcu_read_lock();
+        mr = address_space_translate(&address_space_memory,
+                                     run->mmio.phys_addr, &xlat, &len,
+                                     run->mmio.is_write,
+                                     MEMTXATTRS_UNSPECIFIED);
+        name = memory_region_name(mr);
+        c = kvm_exit_stats_lookup(st->mmio, (void *)(name ? name : ""),
+                                  kvm_exit_stats_strdup);
+        kvm_exit_counter_add(c, ns);
+        rcu_read_unlock();
+    } else if (run->exit_reason == KVM_EXIT_IO) {
+        c = kvm_exit_stats_lookup(st->pio, GUINT_TO_POINTER(run->io.port),
+                                  NULL);
+        kvm_exit_counter_add(c, ns);
+    }
+    qemu_mutex_unlock(&st->lock);
+}
+
+static VcpuExitStats *kvm_exit_counter_info(const char *name,
+                                            KVMExitCounter *c)
+{
+    VcpuExitStats *info = g_new0(VcpuExitStats, 1);
+    uint64List **tail = &info->histogram;
+    int i;
+
+    info->name = g_strdup(name);
+    info->count = c->count;
+    info->total_ns = c->total_ns;
+    for (i = 0; i < KVM_EXIT_STATS_BUCKETS; i++) {
+        uint64List *entry = g_new0(uint64List, 1);
+
+        entry->value = c->histogram[i];
+        *tail = entry;
+        tail = &entry->next;
+    }
+    return info;
+}
+
+static void kvm_exit_stats_append(VcpuExitStatsList ***tail,
+                                  const char *name, KVMExitCounter *c)
+{
+    VcpuExitStatsList *entry = g_new0(VcpuExitStatsList, 1);
+
+    entry->value = kvm_exit_counter_info(name, c);
+    **tail = entry;
+    *tail = &entry->next;
+}
+
+VcpuStatsList *qmp_query_vcpu_stats(Error **errp)
+{
+    VcpuStatsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        KVMExitStats *st = atomic_load_acquire(&cpu->kvm_exit_stats);
+        VcpuExitStatsList **exits_tail, **mmio_tail, **pio_tail;
+        VcpuStatsList *entry;
+        VcpuStats *info;
+        GHashTableIter iter;
+        gpointer key, value;
+        int i;
+
+        if (!st) {
+            continue;
+        }
+
+        info = g_new0(VcpuStats, 1);
+        info->cpu_index = cpu->cpu_index;
+        exits_tail = &info->exits;
+        mmio_tail = &info->mmio;
+        pio_tail = &info->pio;
+
+        qemu_mutex_lock(&st->lock);
+        for (i = 0; i < KVM_EXIT_STATS_REASONS; i++) {
+            g_autofree char *name = NULL;
+
+            if (!st->reasons[i].count) {
+                continue;
+            }
+            name = kvm_exit_reason_names[i] ?
+                   g_strdup(kvm_exit_reason_names[i]) :
+                   g_strdup_printf("reason-%d", i);
+            kvm_exit_stats_append(&exits_tail, name, &st->reasons[i]);
+        }
+
+        g_hash_table_iter_init(&iter, st->mmio);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            kvm_exit_stats_append(&mmio_tail, key, value);
+        }
+
+        g_hash_table_iter_init(&iter, st->pio);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_autofree char *name =
+                g_strdup_printf("0x%x", GPOINTER_TO_UINT(key));
+
+            kvm_exit_stats_append(&pio_tail, name, value);
+        }
+        qemu_mutex_unlock(&st->lock);
+
+        entry = g_new0(VcpuStatsList, 1);
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    return head;
+}
+
 static void do_kvm_cpu_synchronize_state(CPUState *cpu, run_on_cpu_data arg)
 {
     if (!cpu->vcpu_dirty) {
@@ -2199,6 +2994,7 @@ static void kvm_eat_signals(CPUState *cpu)
 int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
+    int64_t exit_ns;
     int ret, run_ret;
 
     DPRINTF("kvm_cpu_exec()\n");
@@ -2236,6 +3032,7 @@ int kvm_cpu_exec(CPUState *cpu)
         smp_rmb();
 
         run_ret = kvm_vcpu_ioctl(cpu, KVM_RUN, 0);
+        exit_ns = get_clock();
 
         attrs = kvm_arch_post_run(cpu, run);
 
@@ -2253,6 +3050,7 @@ int kvm_cpu_exec(CPUState *cpu)
             if (run_ret == -EINTR || run_ret == -EAGAIN) {
                 DPRINTF("io window exit\n");
                 kvm_eat_signals(cpu);
+                kvm_exit_stats_record(cpu, run, exit_ns);
                 ret = EXCP_INTERRUPT;
                 break;
             }
@@ -2309,6 +3107,18 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_INTERNAL_ERROR:
             ret = kvm_handle_internal_error(cpu, run);
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /*
+             * The vCPU cannot run again until its ring has been
+             * harvested and reset.
+             */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            kvm_dirty_limit_throttle(kvm_state, cpu);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SYSTEM_EVENT:
             switch (run->system_event.type) {
             case KVM_SYSTEM_EVENT_SHUTDOWN:
@@ -2337,6 +3147,9 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+
+        kvm_flush_posted_writes();
+        kvm_exit_stats_record(cpu, run, exit_ns);
     } while (ret == 0);
 
     cpu_exec_end(cpu);
@@ -2397,6 +3210,11 @@ int kvm_vcpu_ioctl(CPUState *cpu, int type, ...)
     arg = va_arg(ap, void *);
     va_end(ap);
 
+    if (!cpu->created && !qemu_cpu_is_self(cpu)) {
+        /* The vCPU thread may still be setting up the vCPU */
+        qemu_wait_vcpu_created(cpu);
+    }
+
     trace_kvm_vcpu_ioctl(cpu->cpu_index, type, arg);
     ret = ioctl(cpu->kvm_fd, type, arg);
     if (ret == -1) {
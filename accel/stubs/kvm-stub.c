@@ -16,6 +16,7 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "hw/pci/msi.h"
+#include "qapi/qapi-commands-machine.h"
 #endif
 
 KVMState *kvm_state;
@@ -37,6 +38,11 @@ int kvm_destroy_vcpu(CPUState *cpu)
     return -ENOSYS;
 }
 
+int kvm_create_vcpu(CPUState *cpu)
+{
+    return -ENOSYS;
+}
+
 int kvm_init_vcpu(CPUState *cpu)
 {
     return -ENOSYS;
@@ -160,6 +166,15 @@ bool kvm_has_free_slot(MachineState *ms)
     return false;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return false;
+}
+
+void kvm_dirty_limit_set(uint64_t bytes_per_sec)
+{
+}
+
 void kvm_init_cpu_signals(CPUState *cpu)
 {
     abort();
@@ -169,4 +184,9 @@ bool kvm_arm_supports_user_irq(void)
 {
     return false;
 }
+
+VcpuStatsList *qmp_query_vcpu_stats(Error **errp)
+{
+    return NULL;
+}
 #endif
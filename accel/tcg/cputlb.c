@@ -266,6 +266,70 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
+typedef struct TLBFlushSync {
+    run_on_cpu_func fn;
+    run_on_cpu_data data;
+    CPUState *src;
+} TLBFlushSync;
+
+static void tlb_flush_sync_work(CPUState *cpu, run_on_cpu_data data)
+{
+    TLBFlushSync *s = data.host_ptr;
+    CPUState *src = s->src;
+
+    s->fn(cpu, s->data);
+    g_free(s);
+
+    /*
+     * Work items run with the BQL held, and the source CPU checks
+     * tlb_sync_pending under the BQL before sleeping, so the kick
+     * cannot be lost.
+     */
+    if (atomic_fetch_dec(&src->tlb_sync_pending) == 1) {
+        qemu_cpu_kick(src);
+    }
+}
+
+/*
+ * flush_all_helper_synced: run fn across all cpus, then wait for them
+ *
+ * With MTTCG, rather than making every vCPU enter an exclusive section,
+ * only the source cpu waits: it flushes itself right away, stops at the
+ * end of the current TB and is not scheduled again until each of the
+ * other cpus has run fn at its next TB boundary.  Without MTTCG all
+ * cpus share a thread and the flushes are made a safe work item of
+ * the source cpu, as before.
+ */
+static void flush_all_helper_synced(CPUState *src, run_on_cpu_func fn,
+                                    run_on_cpu_data d)
+{
+    CPUState *cpu;
+
+    if (!qemu_tcg_mttcg_enabled()) {
+        flush_all_helper(src, fn, d);
+        async_safe_run_on_cpu(src, fn, d);
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src && cpu->created) {
+            TLBFlushSync *s = g_new(TLBFlushSync, 1);
+
+            s->fn = fn;
+            s->data = d;
+            s->src = src;
+            atomic_inc(&src->tlb_sync_pending);
+            async_run_on_cpu(cpu, tlb_flush_sync_work,
+                             RUN_ON_CPU_HOST_PTR(s));
+        }
+    }
+
+    fn(src, d);
+    if (atomic_read(&src->tlb_sync_pending)) {
+        cpu_exit(src);
+    }
+}
+
 void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -286,13 +350,22 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
 {
     tlb_table_flush_by_mmuidx(env, mmu_idx);
-    env_tlb(env)->d[mmu_idx].large_page_addr = -1;
-    env_tlb(env)->d[mmu_idx].large_page_mask = -1;
-    env_tlb(env)->d[mmu_idx].vindex = 0;
+    memset(env_tlb(env)->d[mmu_idx].large_page_addr, -1,
+           sizeof(env_tlb(env)->d[0].large_page_addr));
+    memset(env_tlb(env)->d[mmu_idx].large_page_mask, -1,
+           sizeof(env_tlb(env)->d[0].large_page_mask));
+    memset(env_tlb(env)->d[mmu_idx].vindex, 0,
+           sizeof(env_tlb(env)->d[0].vindex));
     memset(env_tlb(env)->d[mmu_idx].vtable, -1,
            sizeof(env_tlb(env)->d[0].vtable));
 }
 
+/* Index of the first victim tlb entry of the set that holds @page */
+static inline size_t vtlb_set(target_ulong page)
+{
+    return ((page >> TARGET_PAGE_BITS) & (CPU_VTLB_SETS - 1)) * CPU_VTLB_WAYS;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -371,8 +444,7 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
+    flush_all_helper_synced(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
 
 void tlb_flush_all_cpus_synced(CPUState *src_cpu)
@@ -413,11 +485,12 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
                                               target_ulong page)
 {
     CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
+    size_t set = vtlb_set(page);
     int k;
 
     assert_cpu_is_self(env_cpu(env));
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
-        if (tlb_flush_entry_locked(&d->vtable[k], page)) {
+    for (k = 0; k < CPU_VTLB_WAYS; k++) {
+        if (tlb_flush_entry_locked(&d->vtable[set + k], page)) {
             tlb_n_used_entries_dec(env, mmu_idx);
         }
     }
@@ -426,21 +499,23 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
-    target_ulong lp_addr = env_tlb(env)->d[midx].large_page_addr;
-    target_ulong lp_mask = env_tlb(env)->d[midx].large_page_mask;
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    int i;
 
     /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(env, midx);
-    } else {
-        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
-            tlb_n_used_entries_dec(env, midx);
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        if ((page & d->large_page_mask[i]) == d->large_page_addr[i]) {
+            tlb_debug("forcing full flush midx %d ("
+                      TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                      midx, d->large_page_addr[i], d->large_page_mask[i]);
+            tlb_flush_one_mmuidx_locked(env, midx);
+            return;
         }
-        tlb_flush_vtlb_page_locked(env, midx, page);
     }
+    if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+        tlb_n_used_entries_dec(env, midx);
+    }
+    tlb_flush_vtlb_page_locked(env, midx, page);
 }
 
 /* As we are going to hijack the bottom bits of the page address for a
@@ -531,8 +606,8 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     addr_and_mmu_idx = addr & TARGET_PAGE_MASK;
     addr_and_mmu_idx |= idxmap;
 
-    flush_all_helper(src_cpu, fn, RUN_ON_CPU_TARGET_PTR(addr_and_mmu_idx));
-    async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_TARGET_PTR(addr_and_mmu_idx));
+    flush_all_helper_synced(src_cpu, fn,
+                            RUN_ON_CPU_TARGET_PTR(addr_and_mmu_idx));
 }
 
 void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
@@ -655,36 +730,61 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBEntry *set = &env_tlb(env)->d[mmu_idx].vtable[vtlb_set(vaddr)];
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_set_dirty1_locked(&env_tlb(env)->d[mmu_idx].vtable[k], vaddr);
+
+        for (k = 0; k < CPU_VTLB_WAYS; k++) {
+            tlb_set_dirty1_locked(&set[k], vaddr);
         }
     }
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/*
+ * Our TLB does not support large pages, so remember the areas covered by
+ * large pages and trigger a full TLB flush if these are invalidated.
+ */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
                                target_ulong vaddr, target_ulong size)
 {
-    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
+    CPUTLBDesc *d = &env_tlb(env)->d[mmu_idx];
     target_ulong lp_mask = ~(size - 1);
-
-    if (lp_addr == (target_ulong)-1) {
-        /* No previous large page.  */
-        lp_addr = vaddr;
-    } else {
-        /* Extend the existing region to include the new page.
-           This is a compromise between unnecessary flushes and
-           the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
-        while (((lp_addr ^ vaddr) & lp_mask) != 0) {
-            lp_mask <<= 1;
+    target_ulong best_mask = 0;
+    int i, best = 0;
+
+    for (i = 0; i < CPU_TLB_LARGE_PAGES; i++) {
+        target_ulong lp_addr = d->large_page_addr[i];
+        target_ulong mask;
+
+        if (lp_addr == (target_ulong)-1) {
+            /* Unused region: track the new page on its own.  */
+            d->large_page_addr[i] = vaddr & lp_mask;
+            d->large_page_mask[i] = lp_mask;
+            return;
+        }
+        if ((d->large_page_mask[i] & ~lp_mask) == 0 &&
+            (vaddr & d->large_page_mask[i]) == lp_addr) {
+            /* Already covered.  */
+            return;
+        }
+        /* How much would this region have to grow to include the page?  */
+        mask = lp_mask & d->large_page_mask[i];
+        while (((lp_addr ^ vaddr) & mask) != 0) {
+            mask <<= 1;
+        }
+        if (mask > best_mask) {
+            best_mask = mask;
+            best = i;
         }
     }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+
+    /*
+     * Extend the region that grows least to include the new page.
+     * This is a compromise between unnecessary flushes and
+     * the cost of maintaining a full variable size TLB.
+     */
+    d->large_page_addr[best] &= best_mask;
+    d->large_page_mask[best] = best_mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -779,7 +879,10 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, vaddr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        target_ulong old_page = te->addr_read & te->addr_write & te->addr_code;
+        size_t set = vtlb_set(old_page);
+        unsigned vidx = set + desc->vindex[set / CPU_VTLB_WAYS]++ %
+                              CPU_VTLB_WAYS;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -994,10 +1097,11 @@ static inline target_ulong tlb_read_ofs(CPUTLBEntry *entry, size_t ofs)
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
+    size_t set = vtlb_set(page);
     size_t vidx;
 
     assert_cpu_is_self(env_cpu(env));
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (vidx = set; vidx < set + CPU_VTLB_WAYS; ++vidx) {
         CPUTLBEntry *vtlb = &env_tlb(env)->d[mmu_idx].vtable[vidx];
         target_ulong cmp;
 
@@ -1530,6 +1634,61 @@ tcg_target_ulong helper_be_ldsl_mmu(CPUArchState *env, target_ulong addr,
  * Store Helpers
  */
 
+static inline void __attribute__((always_inline))
+store_memop(void *haddr, uint64_t val, MemOp op)
+{
+    switch (op) {
+    case MO_UB:
+        stb_p(haddr, val);
+        break;
+    case MO_BEUW:
+        stw_be_p(haddr, val);
+        break;
+    case MO_LEUW:
+        stw_le_p(haddr, val);
+        break;
+    case MO_BEUL:
+        stl_be_p(haddr, val);
+        break;
+    case MO_LEUL:
+        stl_le_p(haddr, val);
+        break;
+    case MO_BEQ:
+        stq_be_p(haddr, val);
+        break;
+    case MO_LEQ:
+        stq_le_p(haddr, val);
+        break;
+    default:
+        g_assert_not_reached();
+        break;
+    }
+}
+
+/*
+ * First write to a clean RAM page.  Rather than dispatching to
+ * io_mem_notdirty through the I/O path, store to the host page directly
+ * and update the dirty bitmaps here.  Once the page is dirty for all
+ * clients, tlb_set_dirty() drops TLB_NOTDIRTY so further stores take the
+ * inline fast path until the next bitmap sync sets the flag again.
+ */
+static void notdirty_write(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
+                           CPUTLBEntry *entry, target_ulong addr,
+                           uint64_t val, uintptr_t retaddr, MemOp op)
+{
+    CPUState *cpu = env_cpu(env);
+    ram_addr_t ram_addr = (iotlbentry->addr & TARGET_PAGE_MASK) + addr;
+    NotDirtyInfo ndi;
+
+    /* tb_invalidate_phys_page_fast() looks for the current TB here */
+    cpu->mem_io_vaddr = addr;
+    cpu->mem_io_pc = retaddr;
+
+    memory_notdirty_write_prepare(&ndi, cpu, addr, ram_addr, memop_size(op));
+    store_memop((void *)((uintptr_t)addr + entry->addend), val, op);
+    memory_notdirty_write_complete(&ndi);
+}
+
 static inline void __attribute__((always_inline))
 store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
              TCGMemOpIdx oi, uintptr_t retaddr, MemOp op)
@@ -1585,6 +1744,12 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
             }
         }
 
+        /* Handle clean RAM.  */
+        if ((tlb_addr & ~TARGET_PAGE_MASK) == TLB_NOTDIRTY) {
+            notdirty_write(env, iotlbentry, entry, addr, val, retaddr, op);
+            return;
+        }
+
         /* Handle I/O access.  */
         io_writex(env, iotlbentry, mmu_idx, val, addr, retaddr, op);
         return;
@@ -1657,32 +1822,7 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
 
  do_aligned_access:
     haddr = (void *)((uintptr_t)addr + entry->addend);
-    switch (op) {
-    case MO_UB:
-        stb_p(haddr, val);
-        break;
-    case MO_BEUW:
-        stw_be_p(haddr, val);
-        break;
-    case MO_LEUW:
-        stw_le_p(haddr, val);
-        break;
-    case MO_BEUL:
-        stl_be_p(haddr, val);
-        break;
-    case MO_LEUL:
-        stl_le_p(haddr, val);
-        break;
-    case MO_BEQ:
-        stq_be_p(haddr, val);
-        break;
-    case MO_LEQ:
-        stq_le_p(haddr, val);
-        break;
-    default:
-        g_assert_not_reached();
-        break;
-    }
+    store_memop(haddr, val, op);
 }
 
 void helper_ret_stb_mmu(CPUArchState *env, target_ulong addr, uint8_t val,
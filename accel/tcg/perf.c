@@ -0,0 +1,45 @@
+/*
+ * perf map support for TCG-generated code
+ *
+ * Host profilers cannot resolve addresses in the code buffer on their
+ * own. With -perfmap, every translated block is listed in
+ * /tmp/perf-<pid>.map, which perf reads to name samples that land in
+ * anonymous executable memory.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "disas/disas.h"
+#include "sysemu/tcg.h"
+#include "translate-all.h"
+
+static FILE *perfmap;
+
+void tcg_perfmap_enable(void)
+{
+    g_autofree char *path = g_strdup_printf("/tmp/perf-%d.map", getpid());
+
+    perfmap = fopen(path, "w");
+    if (!perfmap) {
+        warn_report("Could not open %s: %s, perf map disabled",
+                    path, strerror(errno));
+    }
+}
+
+/* Called after @tb has been translated. Safe to call from any vCPU thread */
+void tcg_perfmap_report_tb(const TranslationBlock *tb)
+{
+    const char *symbol;
+
+    if (likely(!perfmap)) {
+        return;
+    }
+    symbol = lookup_symbol(tb->pc);
+    /* one fprintf per entry: stdio locking keeps the lines whole */
+    fprintf(perfmap, "%" PRIxPTR " %zx guest-0x" TARGET_FMT_lx "%s%s\n",
+            (uintptr_t)tb->tc.ptr, tb->tc.size, tb->pc,
+            *symbol ? " " : "", symbol);
+}
@@ -0,0 +1,329 @@
+/*
+ * Persistent translation cache for user-mode emulation
+ *
+ * Short-lived guest processes such as compilers and shell tools spend a
+ * large part of their run time translating the same dynamic loader and
+ * libc code on every invocation. With -tb-cache, the used part of
+ * code_gen_buffer is saved when the guest exits, and copied back at the
+ * same host address the next time the same binary is run. A cached TB is
+ * adopted the first time the guest reaches it, provided that the guest
+ * code it was translated from is byte-for-byte unchanged.
+ *
+ * Translated code embeds absolute host addresses (helpers, the epilogue,
+ * the TB itself, some CPU state), so it is not relocatable. The cache is
+ * therefore only reused when QEMU's host layout matches the one of the
+ * run that wrote it, e.g. with address space randomization disabled;
+ * any mismatch simply makes the whole file miss.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/log.h"
+#include "qemu-version.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "exec/tb-context.h"
+#include "exec/tb-hash.h"
+#include "tcg.h"
+#include "translate-all.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC1"
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    char layout[72];        /* hex digest returned by tb_cache_layout() */
+    uint64_t code_size;     /* bytes of code_gen_buffer that follow */
+    uint64_t nb_tbs;        /* number of TBCacheRecords after the code */
+} TBCacheHeader;
+
+/* Each record is followed by the TB's guest code, padded to 8 bytes */
+typedef struct TBCacheRecord {
+    uint64_t tb_offset;     /* from the start of the saved code */
+    uint64_t size;
+} TBCacheRecord;
+
+typedef struct TBCacheEntry {
+    TranslationBlock *tb;
+    const void *guest_code;
+} TBCacheEntry;
+
+typedef struct TBCacheWriter {
+    GByteArray *buf;
+    uint64_t nb_tbs;
+} TBCacheWriter;
+
+static struct {
+    char *path;
+    char *layout;
+    void *code_start;
+    /* contents of the file we loaded; owns the entries' guest_code */
+    char *contents;
+    /* TBs that have not been adopted yet. Protected by mmap_lock */
+    GHashTable *index;
+    /* tb_ctx_epoch() at load time; the cached code is gone once it changes */
+    unsigned epoch;
+} tb_cache;
+
+static guint tb_cache_hash(gconstpointer p)
+{
+    const TranslationBlock *tb = p;
+
+    return tb_hash_func(tb->pc, tb->pc, tb->flags, tb->cflags,
+                        tb->trace_vcpu_dstate);
+}
+
+static gboolean tb_cache_equal(gconstpointer ap, gconstpointer bp)
+{
+    const TranslationBlock *a = ap;
+    const TranslationBlock *b = bp;
+
+    return a->pc == b->pc &&
+        a->cs_base == b->cs_base &&
+        a->flags == b->flags &&
+        a->cflags == b->cflags &&
+        a->trace_vcpu_dstate == b->trace_vcpu_dstate;
+}
+
+/*
+ * Everything that translated code may depend on besides the guest code
+ * and the TB's own flags: the QEMU binary and where it is mapped, the
+ * position of code_gen_buffer and of the CPU state, guest_base, the CPU
+ * model and the options that change what is generated.
+ */
+static char *tb_cache_layout(CPUState *cpu, const char *cpu_type)
+{
+    g_autofree char *layout = NULL;
+    struct stat st;
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        return NULL;
+    }
+    layout = g_strdup_printf("%s %s %s exe %" PRIu64 ":%" PRIu64 ":%"
+                             PRId64 ":%" PRId64 " text %p ctx %p"
+                             " code %p prologue %p cpu %p guest_base %lx"
+                             " singlestep %d nochain %d profile %d",
+                             QEMU_FULL_VERSION, TARGET_NAME, cpu_type,
+                             (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                             (int64_t)st.st_size, (int64_t)st.st_mtime,
+                             (void *)tb_gen_code, tcg_ctx,
+                             tcg_ctx->code_gen_buffer,
+                             tcg_ctx->code_gen_prologue, cpu, guest_base,
+                             singlestep,
+                             qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN) != 0,
+                             tb_profile_enabled);
+    return g_compute_checksum_for_string(G_CHECKSUM_SHA256, layout, -1);
+}
+
+static void tb_cache_discard(void)
+{
+    g_hash_table_remove_all(tb_cache.index);
+    g_free(tb_cache.contents);
+    tb_cache.contents = NULL;
+    tcg_ctx->code_gen_ptr = tb_cache.code_start;
+}
+
+static void tb_cache_load(void)
+{
+    const TBCacheHeader *hdr;
+    size_t space = tcg_ctx->code_gen_highwater - tb_cache.code_start;
+    gsize len, pos;
+    uint64_t i;
+
+    if (!g_file_get_contents(tb_cache.path, &tb_cache.contents, &len, NULL)) {
+        return;
+    }
+    hdr = (const TBCacheHeader *)tb_cache.contents;
+    if (len < sizeof(*hdr) ||
+        memcmp(hdr->magic, TB_CACHE_MAGIC, sizeof(hdr->magic)) ||
+        strncmp(hdr->layout, tb_cache.layout, sizeof(hdr->layout)) ||
+        hdr->code_size > space || hdr->code_size > len - sizeof(*hdr)) {
+        tb_cache_discard();
+        return;
+    }
+
+    memcpy(tb_cache.code_start, hdr + 1, hdr->code_size);
+    flush_icache_range((uintptr_t)tb_cache.code_start,
+                       (uintptr_t)tb_cache.code_start + hdr->code_size);
+    tcg_ctx->code_gen_ptr = tb_cache.code_start + hdr->code_size;
+
+    pos = sizeof(*hdr) + hdr->code_size;
+    for (i = 0; i < hdr->nb_tbs; i++) {
+        const TBCacheRecord *rec = (void *)tb_cache.contents + pos;
+        TBCacheEntry *e;
+
+        if (len - pos < sizeof(*rec) ||
+            hdr->code_size < sizeof(TranslationBlock) ||
+            rec->tb_offset > hdr->code_size - sizeof(TranslationBlock) ||
+            len - pos - sizeof(*rec) < ROUND_UP(rec->size, 8)) {
+            tb_cache_discard();
+            return;
+        }
+        e = g_new(TBCacheEntry, 1);
+        e->tb = tb_cache.code_start + rec->tb_offset;
+        e->guest_code = rec + 1;
+        if (e->tb->size != rec->size) {
+            g_free(e);
+            tb_cache_discard();
+            return;
+        }
+        g_hash_table_insert(tb_cache.index, e->tb, e);
+        pos += sizeof(*rec) + ROUND_UP(rec->size, 8);
+    }
+}
+
+/*
+ * Set up the cache for the binary at @exec_path. Call once the guest has
+ * been loaded and code_gen_buffer initialized, before running any code.
+ */
+void tb_cache_init(const char *dir, const char *exec_path, CPUState *cpu,
+                   const char *cpu_type)
+{
+    g_autofree char *key = NULL;
+    g_autofree char *name = NULL;
+    struct stat st;
+
+    if (g_mkdir_with_parents(dir, 0700) < 0) {
+        warn_report("Could not create %s: %s, translation cache disabled",
+                    dir, strerror(errno));
+        return;
+    }
+    tb_cache.layout = tb_cache_layout(cpu, cpu_type);
+    if (stat(exec_path, &st) < 0 || !tb_cache.layout) {
+        warn_report("Could not identify %s, translation cache disabled",
+                    exec_path);
+        return;
+    }
+    key = g_strdup_printf("%s %" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64,
+                          TARGET_NAME, (uint64_t)st.st_dev,
+                          (uint64_t)st.st_ino, (int64_t)st.st_size,
+                          (int64_t)st.st_mtime);
+    name = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    tb_cache.path = g_strdup_printf("%s/%s.tbc", dir, name);
+    tb_cache.code_start = tcg_ctx->code_gen_ptr;
+    tb_cache.index = g_hash_table_new_full(tb_cache_hash, tb_cache_equal,
+                                           NULL, g_free);
+    tb_cache.epoch = tb_ctx_epoch();
+    tb_cache_load();
+}
+
+/*
+ * Return the cached TB for this lookup key if its guest code is still
+ * the one it was translated from, or NULL. The TB is not yet linked;
+ * the caller must do that. Call with mmap_lock held.
+ */
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags,
+                                  uint32_t cflags)
+{
+    TranslationBlock key;
+    TranslationBlock *tb;
+    TBCacheEntry *e;
+    bool valid;
+
+    if (likely(!tb_cache.index || !g_hash_table_size(tb_cache.index))) {
+        return NULL;
+    }
+    if (tb_ctx_epoch() != tb_cache.epoch) {
+        /* a flush or eviction has overwritten the cached code */
+        g_hash_table_remove_all(tb_cache.index);
+        return NULL;
+    }
+
+    key.pc = pc;
+    key.cs_base = cs_base;
+    key.flags = flags;
+    key.cflags = cflags;
+    key.trace_vcpu_dstate = *cpu->trace_dstate;
+    e = g_hash_table_lookup(tb_cache.index, &key);
+    if (!e) {
+        return NULL;
+    }
+    tb = e->tb;
+    valid = (page_get_flags(pc) & PAGE_VALID) &&
+            (page_get_flags(pc + tb->size - 1) & PAGE_VALID) &&
+            !memcmp(g2h(pc), e->guest_code, tb->size);
+    /* if the guest code has changed, the TB is of no use anymore either */
+    g_hash_table_remove(tb_cache.index, tb);
+    return valid ? tb : NULL;
+}
+
+static void tb_cache_append(TBCacheWriter *w, const TranslationBlock *tb,
+                            const void *guest_code)
+{
+    static const uint8_t pad[8];
+    TBCacheRecord rec = {
+        .tb_offset = (void *)tb - tb_cache.code_start,
+        .size = tb->size,
+    };
+
+    g_byte_array_append(w->buf, (const guint8 *)&rec, sizeof(rec));
+    g_byte_array_append(w->buf, guest_code, tb->size);
+    g_byte_array_append(w->buf, pad, ROUND_UP(tb->size, 8) - tb->size);
+    w->nb_tbs++;
+}
+
+static gboolean tb_cache_add_tb(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    if ((tb_cflags(tb) & (CF_INVALID | CF_NOCACHE)) ||
+        (void *)tb < tb_cache.code_start ||
+        !(page_get_flags(tb->pc) & PAGE_VALID) ||
+        !(page_get_flags(tb->pc + tb->size - 1) & PAGE_VALID)) {
+        return FALSE;
+    }
+    tb_cache_append(data, tb, g2h(tb->pc));
+    return FALSE;
+}
+
+static void tb_cache_add_entry(gpointer key, gpointer value, gpointer data)
+{
+    TBCacheEntry *e = value;
+
+    tb_cache_append(data, e->tb, e->guest_code);
+}
+
+/*
+ * Write the TBs that are currently valid, as well as the cached ones that
+ * were not needed during this run, back to the cache file.
+ */
+void tb_cache_save(void)
+{
+    static const uint8_t pad[8];
+    TBCacheHeader hdr = { .magic = TB_CACHE_MAGIC };
+    TBCacheWriter w;
+    GError *err = NULL;
+    size_t code_size;
+
+    if (!tb_cache.path) {
+        return;
+    }
+
+    mmap_lock();
+    code_size = tcg_ctx->code_gen_ptr - tb_cache.code_start;
+    g_strlcpy(hdr.layout, tb_cache.layout, sizeof(hdr.layout));
+    hdr.code_size = ROUND_UP(code_size, 8);
+
+    w.buf = g_byte_array_sized_new(sizeof(hdr) + hdr.code_size);
+    w.nb_tbs = 0;
+    g_byte_array_append(w.buf, (const guint8 *)&hdr, sizeof(hdr));
+    g_byte_array_append(w.buf, tb_cache.code_start, code_size);
+    g_byte_array_append(w.buf, pad, hdr.code_size - code_size);
+    tcg_tb_foreach(tb_cache_add_tb, &w);
+    if (tb_ctx_epoch() == tb_cache.epoch) {
+        g_hash_table_foreach(tb_cache.index, tb_cache_add_entry, &w);
+    }
+    mmap_unlock();
+
+    ((TBCacheHeader *)w.buf->data)->nb_tbs = w.nb_tbs;
+    if (!g_file_set_contents(tb_cache.path, (const char *)w.buf->data,
+                             w.buf->len, &err)) {
+        warn_report("Could not write translation cache: %s", err->message);
+        g_error_free(err);
+    }
+    g_byte_array_free(w.buf, TRUE);
+}
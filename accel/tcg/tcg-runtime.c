@@ -144,17 +144,37 @@ uint64_t HELPER(ctpop_i64)(uint64_t arg)
     return ctpop64(arg);
 }
 
-void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+/*
+ * @last is the TB making the indirect jump, or NULL. Its last destination
+ * is tried first, which saves the jump cache probe on the common case of
+ * a call site that keeps jumping to the same place.
+ */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env, void *last)
 {
     CPUState *cpu = env_cpu(env);
+    TranslationBlock *last_tb = last;
+    TranslationBlock *hint = NULL;
     TranslationBlock *tb;
     target_ulong cs_base, pc;
     uint32_t flags;
+    unsigned epoch = tb_ctx_epoch();
 
-    tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, curr_cflags());
+    if (last_tb && atomic_read(&last_tb->ind_epoch) == epoch) {
+        /* pairs with smp_wmb below: ind_dest is at least as new */
+        smp_rmb();
+        hint = atomic_read(&last_tb->ind_dest);
+    }
+    tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, curr_cflags(),
+                              hint);
     if (tb == NULL) {
         return tcg_ctx->code_gen_epilogue;
     }
+    if (last_tb && tb != hint) {
+        atomic_set(&last_tb->ind_dest, tb);
+        /* publish the destination before the epoch that validates it */
+        smp_wmb();
+        atomic_set(&last_tb->ind_epoch, epoch);
+    }
     qemu_log_mask_and_addr(CPU_LOG_EXEC, pc,
                            "Chain %d: %p ["
                            TARGET_FMT_lx "/" TARGET_FMT_lx "/%#x] %s\n",
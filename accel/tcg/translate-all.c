@@ -109,6 +109,7 @@ typedef struct PageDesc {
     unsigned long *code_bitmap;
     unsigned int code_write_count;
 #else
+    /* set with mmap_lock held, may be read locklessly with atomic_read */
     unsigned long flags;
 #endif
 #ifndef CONFIG_USER_ONLY
@@ -215,6 +216,9 @@ __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
 
+/* Whether TBs count their executions and exits, see tb_profile_enable() */
+bool tb_profile_enabled;
+
 static void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -1174,12 +1178,27 @@ static TranslationBlock *tb_alloc(target_ulong pc)
 }
 
 /* call with @p->lock held */
+/*
+ * Drop the code bitmap of @p because a TB has gone away. code_write_count
+ * is kept: a page that has already seen SMC_BITMAP_USE_THRESHOLD writes
+ * gets its bitmap rebuilt on the next write, rather than invalidating by
+ * walking all of its TBs for another SMC_BITMAP_USE_THRESHOLD writes.
+ * This matters for pages where a guest JIT keeps writing next to code.
+ */
 static inline void invalidate_page_bitmap(PageDesc *p)
 {
     assert_page_locked(p);
 #ifdef CONFIG_SOFTMMU
     g_free(p->code_bitmap);
     p->code_bitmap = NULL;
+#endif
+}
+
+/* Forget all the SMC state of @p, e.g. because it holds no code anymore */
+static inline void page_reset_code_state(PageDesc *p)
+{
+    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
     p->code_write_count = 0;
 #endif
 }
@@ -1198,7 +1217,7 @@ static void page_flush_tb_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
-            invalidate_page_bitmap(pd + i);
+            page_reset_code_state(pd + i);
             page_unlock(&pd[i]);
         }
     } else {
@@ -1273,6 +1292,42 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static void tb_evict_invalidate(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+}
+
+/* make room by recycling the oldest code region, or flush if there is none */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_evict_count)
+{
+    bool evicted;
+
+    mmap_lock();
+    /* If it is already been done on request of another CPU, just retry. */
+    if (tb_ctx.tb_evict_count != tb_evict_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+    evicted = tcg_region_evict_oldest(tb_evict_invalidate);
+    if (evicted) {
+        atomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    }
+    mmap_unlock();
+
+    if (!evicted) {
+        do_tb_flush(cpu,
+                    RUN_ON_CPU_HOST_INT(atomic_read(&tb_ctx.tb_flush_count)));
+    }
+}
+
+static void tb_evict(CPUState *cpu)
+{
+    unsigned tb_evict_count = atomic_mb_read(&tb_ctx.tb_evict_count);
+
+    async_safe_run_on_cpu(cpu, do_tb_evict,
+                          RUN_ON_CPU_HOST_INT(tb_evict_count));
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1463,8 +1518,13 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
-            atomic_set(&cpu->tb_jmp_cache[h], NULL);
+        TranslationBlock **set = tb_jmp_cache_set(cpu, h);
+        int way;
+
+        for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+            if (atomic_read(&set[way]) == tb) {
+                atomic_set(&set[way], NULL);
+            }
         }
     }
 
@@ -1501,29 +1561,39 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 
 #ifdef CONFIG_SOFTMMU
 /* call with @p->lock held */
+/* Mark the bytes of page @p that belong to part @n of @tb as code */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /*
+         * NOTE: tb_end may be after the end of the page, but
+         * it is not a problem
+         */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
     TranslationBlock *tb;
+    int n;
 
     assert_page_locked(p);
     p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
 
     PAGE_FOR_EACH_TB(p, tb, n) {
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-             }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
     }
 }
 #endif
@@ -1548,7 +1618,12 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
     page_already_protected = p->first_tb != (uintptr_t)NULL;
 #endif
     p->first_tb = (uintptr_t)tb | n;
-    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
+    /* adding code only sets bits, so the bitmap can be kept up to date */
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
+#endif
 
 #if defined(CONFIG_USER_ONLY)
     if (p->flags & PAGE_WRITE) {
@@ -1568,7 +1643,7 @@ static inline void tb_page_add(PageDesc *p, TranslationBlock *tb,
                 continue;
             }
             prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
+            atomic_set(&p2->flags, p2->flags & ~PAGE_WRITE);
           }
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
@@ -1666,6 +1741,51 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+#ifdef CONFIG_USER_ONLY
+/*
+ * Make a TB from the persistent translation cache visible, as tb_gen_code
+ * does with a freshly translated one. Its jumps start out unchained, since
+ * the TBs they pointed to may not have been adopted (yet).
+ */
+static TranslationBlock *tb_adopt_cached(CPUState *cpu, TranslationBlock *tb,
+                                         tb_page_addr_t phys_pc)
+{
+    TranslationBlock *existing_tb;
+    tb_page_addr_t phys_page2;
+    target_ulong virt_page2;
+
+    tb->ind_dest = NULL;
+    tb->exec_count = 0;
+    tb->exit_count = 0;
+
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+
+    virt_page2 = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+    phys_page2 = -1;
+    if ((tb->pc & TARGET_PAGE_MASK) != virt_page2) {
+        phys_page2 = get_page_addr_code(cpu->env_ptr, virt_page2);
+    }
+    existing_tb = tb_link_page(tb, phys_pc, phys_page2);
+    if (unlikely(existing_tb != tb)) {
+        return existing_tb;
+    }
+    tcg_tb_insert(tb);
+    tcg_perfmap_report_tb(tb);
+    return tb;
+}
+#endif
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -1694,6 +1814,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     cflags &= ~CF_CLUSTER_MASK;
     cflags |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
+#ifdef CONFIG_USER_ONLY
+    if (!(cflags & CF_NOCACHE)) {
+        tb = tb_cache_lookup(cpu, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb_adopt_cached(cpu, tb, phys_pc);
+        }
+    }
+#endif
+
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
         max_insns = CF_COUNT_MASK;
@@ -1708,10 +1837,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* the code cache is full: evict its oldest region, or flush it */
+        tb_evict(cpu);
         mmap_unlock();
-        /* Make the execution loop process the flush as soon as possible.  */
+        /* Make the execution loop process the eviction as soon as possible. */
         cpu->exception_index = EXCP_INTERRUPT;
         cpu_loop_exit(cpu);
     }
@@ -1723,6 +1852,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->ind_dest = NULL;
+    tb->exec_count = 0;
+    tb->exit_count = 0;
+    tb->helper_calls = 0;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1735,9 +1868,20 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tcg_func_start(tcg_ctx);
 
     tcg_ctx->cpu = env_cpu(env);
+    tcg_ctx->gen_tb = tb;
     gen_intermediate_code(cpu, tb, max_insns);
+    tcg_ctx->gen_tb = NULL;
     tcg_ctx->cpu = NULL;
 
+    if (tb_profile_enabled) {
+        TCGOp *op;
+
+        tb->helper_calls = 0;
+        QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+            tb->helper_calls += op->opc == INDEX_op_call;
+        }
+    }
+
     trace_translate_block(tb, tb->pc, tb->tc.ptr);
 
     /* generate machine code */
@@ -1797,6 +1941,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+    tcg_perfmap_report_tb(tb);
 
 #ifdef CONFIG_PROFILER
     atomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
@@ -1959,7 +2104,7 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
 #if !defined(CONFIG_USER_ONLY)
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
-        invalidate_page_bitmap(p);
+        page_reset_code_state(p);
         tlb_unprotect_code(start);
     }
 #endif
@@ -2240,9 +2385,11 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
 static void tb_jmp_cache_clear_page(CPUState *cpu, target_ulong page_addr)
 {
     unsigned int i, i0 = tb_jmp_cache_hash_page(page_addr);
+    TranslationBlock **set = tb_jmp_cache_set(cpu, i0);
 
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
-        atomic_set(&cpu->tb_jmp_cache[i0 + i], NULL);
+    /* the sets of a page are contiguous */
+    for (i = 0; i < TB_JMP_PAGE_SIZE * TB_JMP_CACHE_WAYS; i++) {
+        atomic_set(&set[i], NULL);
     }
 }
 
@@ -2329,6 +2476,8 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t jc_hits = 0, jc_misses = 0;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2363,9 +2512,21 @@ void dump_exec_info(void)
     qemu_printf("\nStatistics:\n");
     qemu_printf("TB flush count      %u\n",
                 atomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB evict count      %u\n",
+                atomic_read(&tb_ctx.tb_evict_count));
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
+    CPU_FOREACH(cpu) {
+        jc_hits += atomic_read(&cpu->tb_jmp_cache_hits);
+        jc_misses += atomic_read(&cpu->tb_jmp_cache_misses);
+    }
+    qemu_printf("TB jmp cache        %d sets x %d ways\n",
+                TB_JMP_CACHE_SETS, TB_JMP_CACHE_WAYS);
+    qemu_printf("TB jmp cache hits   %zu (%zu%%) misses=%zu\n", jc_hits,
+                jc_hits + jc_misses ? jc_hits * 100 / (jc_hits + jc_misses) : 0,
+                jc_misses);
+
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
@@ -2378,6 +2539,104 @@ void dump_opcount_info(void)
     tcg_dump_op_count();
 }
 
+/*
+ * Turn TB execution profiling on or off. The counter increment is part
+ * of the generated code, so the code cache is flushed in both cases.
+ */
+void tb_profile_enable(bool enable)
+{
+    if (tb_profile_enabled != enable) {
+        atomic_set(&tb_profile_enabled, enable);
+        tb_flush(first_cpu);
+    }
+}
+
+static gboolean tb_profile_reset_iter(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    tb->exec_count = 0;
+    tb->exit_count = 0;
+    return false;
+}
+
+void tb_profile_reset(void)
+{
+    tcg_tb_foreach(tb_profile_reset_iter, NULL);
+}
+
+struct tb_profile_entry {
+    target_ulong pc;
+    uint16_t size;
+    size_t host_size;
+    uint64_t exec_count;
+    uint64_t exit_count;
+    unsigned helper_calls;
+};
+
+static gboolean tb_profile_collect_iter(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    const TranslationBlock *tb = value;
+    struct tb_profile_entry e = {
+        .pc = tb->pc,
+        .size = tb->size,
+        .host_size = tb->tc.size,
+        .exec_count = tb->exec_count,
+        .exit_count = tb->exit_count,
+        .helper_calls = tb->helper_calls,
+    };
+
+    if (e.exec_count) {
+        g_array_append_val(data, e);
+    }
+    return false;
+}
+
+static gint tb_profile_cmp(gconstpointer a, gconstpointer b)
+{
+    const struct tb_profile_entry *ea = a;
+    const struct tb_profile_entry *eb = b;
+
+    if (ea->exec_count != eb->exec_count) {
+        return ea->exec_count < eb->exec_count ? 1 : -1;
+    }
+    return 0;
+}
+
+/* Print the @max most executed TBs */
+void dump_tb_profile(int max)
+{
+    GArray *entries = g_array_new(false, false,
+                                  sizeof(struct tb_profile_entry));
+    uint64_t total = 0;
+    guint i;
+
+    tcg_tb_foreach(tb_profile_collect_iter, entries);
+    g_array_sort(entries, tb_profile_cmp);
+    for (i = 0; i < entries->len; i++) {
+        total += g_array_index(entries, struct tb_profile_entry, i).exec_count;
+    }
+
+    qemu_printf("%-18s %10s %10s %20s %6s %20s %8s\n", "Guest PC",
+                "Size", "Host size", "Executions", "%", "Exits", "Helpers");
+    for (i = 0; i < entries->len && i < max; i++) {
+        struct tb_profile_entry *e;
+
+        e = &g_array_index(entries, struct tb_profile_entry, i);
+        qemu_printf("0x%016" PRIx64 " %10u %10zu %20" PRIu64 " %6.2f %20"
+                    PRIu64 " %8u\n", (uint64_t)e->pc, e->size, e->host_size,
+                    e->exec_count, e->exec_count * 100.0 / total,
+                    e->exit_count, e->helper_calls);
+    }
+    if (!entries->len) {
+        qemu_printf("No TB executions recorded%s\n",
+                    tb_profile_enabled ? "" : " (tb-profile is off)");
+    }
+    g_array_free(entries, true);
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -2499,6 +2758,11 @@ void page_dump(FILE *f)
     walk_memory_regions(f, dump_region);
 }
 
+/*
+ * Levels of the page table are never freed in user-mode, and the flags
+ * are updated atomically: page_get_flags and page_check_range do not need
+ * mmap_lock, which is only required to change the flags.
+ */
 int page_get_flags(target_ulong address)
 {
     PageDesc *p;
@@ -2507,7 +2771,7 @@ int page_get_flags(target_ulong address)
     if (!p) {
         return 0;
     }
-    return p->flags;
+    return atomic_read(&p->flags);
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -2545,7 +2809,7 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
             p->first_tb) {
             tb_invalidate_phys_page(addr, 0);
         }
-        p->flags = flags;
+        atomic_set(&p->flags, flags);
     }
 }
 
@@ -2554,6 +2818,7 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     PageDesc *p;
     target_ulong end;
     target_ulong addr;
+    int prot;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -2581,20 +2846,21 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
         if (!p) {
             return -1;
         }
-        if (!(p->flags & PAGE_VALID)) {
+        prot = atomic_read(&p->flags);
+        if (!(prot & PAGE_VALID)) {
             return -1;
         }
 
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
+        if ((flags & PAGE_READ) && !(prot & PAGE_READ)) {
             return -1;
         }
         if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
+            if (!(prot & PAGE_WRITE_ORG)) {
                 return -1;
             }
             /* unprotect the page if it was put read-only because it
                contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
+            if (!(prot & PAGE_WRITE)) {
                 if (!page_unprotect(addr, 0)) {
                     return -1;
                 }
@@ -2610,6 +2876,23 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
  * immediately exited. (We can only return 2 if the 'pc' argument is
  * non-zero.)
  */
+static int page_unprotect_raced(uintptr_t pc)
+{
+    /*
+     * The page is actually marked WRITE: assume this is because this
+     * thread raced with another one which got here first and set the page
+     * to PAGE_WRITE and did the TB invalidate for us.
+     */
+#ifdef TARGET_HAS_PRECISE_SMC
+    TranslationBlock *current_tb = tcg_tb_lookup(pc);
+
+    if (current_tb && (tb_cflags(current_tb) & CF_INVALID)) {
+        return 2;
+    }
+#endif
+    return 1;
+}
+
 int page_unprotect(target_ulong address, uintptr_t pc)
 {
     unsigned int prot;
@@ -2617,54 +2900,59 @@ int page_unprotect(target_ulong address, uintptr_t pc)
     PageDesc *p;
     target_ulong host_start, host_end, addr;
 
-    /* Technically this isn't safe inside a signal handler.  However we
-       know this only ever happens in a synchronous SEGV handler, so in
-       practice it seems to be ok.  */
-    mmap_lock();
-
     p = page_find(address >> TARGET_PAGE_BITS);
     if (!p) {
-        mmap_unlock();
         return 0;
     }
 
+    /*
+     * Threads that fault on the same code page all end up here; only the
+     * first one needs mmap_lock, the others can see locklessly that the
+     * page has been made writable already.
+     */
+    if ((atomic_read(&p->flags) & (PAGE_WRITE_ORG | PAGE_WRITE)) ==
+        (PAGE_WRITE_ORG | PAGE_WRITE)) {
+        return page_unprotect_raced(pc);
+    }
+
+    /*
+     * Technically this isn't safe inside a signal handler.  However we
+     * know this only ever happens in a synchronous SEGV handler, so in
+     * practice it seems to be ok.
+     */
+    mmap_lock();
+
     /* if the page was really writable, then we change its
        protection back to writable */
     if (p->flags & PAGE_WRITE_ORG) {
-        current_tb_invalidated = false;
         if (p->flags & PAGE_WRITE) {
-            /* If the page is actually marked WRITE then assume this is because
-             * this thread raced with another one which got here first and
-             * set the page to PAGE_WRITE and did the TB invalidate for us.
+            mmap_unlock();
+            return page_unprotect_raced(pc);
+        }
+
+        current_tb_invalidated = false;
+        host_start = address & qemu_host_page_mask;
+        host_end = host_start + qemu_host_page_size;
+
+        prot = 0;
+        for (addr = host_start; addr < host_end; addr += TARGET_PAGE_SIZE) {
+            p = page_find(addr >> TARGET_PAGE_BITS);
+            atomic_set(&p->flags, p->flags | PAGE_WRITE);
+            prot |= p->flags;
+
+            /*
+             * and since the content will be modified, we must invalidate
+             * the corresponding translated code.
              */
-#ifdef TARGET_HAS_PRECISE_SMC
-            TranslationBlock *current_tb = tcg_tb_lookup(pc);
-            if (current_tb) {
-                current_tb_invalidated = tb_cflags(current_tb) & CF_INVALID;
-            }
-#endif
-        } else {
-            host_start = address & qemu_host_page_mask;
-            host_end = host_start + qemu_host_page_size;
-
-            prot = 0;
-            for (addr = host_start; addr < host_end; addr += TARGET_PAGE_SIZE) {
-                p = page_find(addr >> TARGET_PAGE_BITS);
-                p->flags |= PAGE_WRITE;
-                prot |= p->flags;
-
-                /* and since the content will be modified, we must invalidate
-                   the corresponding translated code. */
-                current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
+            current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
 #ifdef CONFIG_USER_ONLY
-                if (DEBUG_TB_CHECK_GATE) {
-                    tb_invalidate_check(addr);
-                }
-#endif
+            if (DEBUG_TB_CHECK_GATE) {
+                tb_invalidate_check(addr);
             }
-            mprotect((void *)g2h(host_start), qemu_host_page_size,
-                     prot & PAGE_BITS);
+#endif
         }
+        mprotect((void *)g2h(host_start), qemu_host_page_size,
+                 prot & PAGE_BITS);
         mmap_unlock();
         /* If current TB was invalidated return to main loop */
         return current_tb_invalidated ? 2 : 1;
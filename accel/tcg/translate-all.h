@@ -36,4 +36,14 @@ void tb_check_watchpoint(CPUState *cpu);
 int page_unprotect(target_ulong address, uintptr_t pc);
 #endif
 
+#ifdef CONFIG_USER_ONLY
+/* tb-cache.c */
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, uint32_t flags,
+                                  uint32_t cflags);
+#endif
+
+/* perf.c */
+void tcg_perfmap_report_tb(const TranslationBlock *tb);
+
 #endif /* TRANSLATE_ALL_H */
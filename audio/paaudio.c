@@ -2,6 +2,8 @@
 
 #include "qemu/osdep.h"
 #include "qemu/module.h"
+#include "qemu/main-loop.h"
+#include "qemu/event_notifier.h"
 #include "audio.h"
 #include "qapi/opts-visitor.h"
 
@@ -32,6 +34,8 @@ typedef struct {
     pa_stream *stream;
     paaudio *g;
     size_t samples;
+    EventNotifier notifier;
+    bool has_notifier;
 } PAVoiceOut;
 
 typedef struct {
@@ -41,6 +45,8 @@ typedef struct {
     size_t read_length;
     paaudio *g;
     size_t samples;
+    EventNotifier notifier;
+    bool has_notifier;
 } PAVoiceIn;
 
 static void qpa_conn_fini(PAConnection *c);
@@ -253,6 +259,41 @@ static void stream_state_cb (pa_stream *s, void * userdata)
     }
 }
 
+/*
+ * Stream request callbacks run in the PulseAudio mainloop thread with the
+ * mainloop lock held.  They only kick the notifier; the mixing itself is
+ * done by audio_run() from the QEMU main loop.
+ */
+static void stream_request_cb(pa_stream *s, size_t nbytes, void *userdata)
+{
+    EventNotifier *notifier = userdata;
+
+    event_notifier_set(notifier);
+}
+
+static void qpa_event_handler(void *opaque, EventNotifier *notifier)
+{
+    AudioState *s = opaque;
+
+    if (event_notifier_test_and_clear(notifier)) {
+        audio_run(s, "pa event");
+    }
+}
+
+static void qpa_event_handler_out(void *opaque)
+{
+    PAVoiceOut *pa = opaque;
+
+    qpa_event_handler(pa->hw.s, &pa->notifier);
+}
+
+static void qpa_event_handler_in(void *opaque)
+{
+    PAVoiceIn *pa = opaque;
+
+    qpa_event_handler(pa->hw.s, &pa->notifier);
+}
+
 static pa_stream *qpa_simple_new (
         PAConnection *c,
         const char *name,
@@ -261,6 +302,7 @@ static pa_stream *qpa_simple_new (
         const pa_sample_spec *ss,
         const pa_channel_map *map,
         const pa_buffer_attr *attr,
+        EventNotifier *notifier,
         int *rerror)
 {
     int r;
@@ -276,6 +318,14 @@ static pa_stream *qpa_simple_new (
 
     pa_stream_set_state_callback(stream, stream_state_cb, c);
 
+    if (notifier) {
+        if (dir == PA_STREAM_PLAYBACK) {
+            pa_stream_set_write_callback(stream, stream_request_cb, notifier);
+        } else {
+            pa_stream_set_read_callback(stream, stream_request_cb, notifier);
+        }
+    }
+
     flags =
         PA_STREAM_INTERPOLATE_TIMING
         | PA_STREAM_AUTO_TIMING_UPDATE
@@ -336,6 +386,13 @@ static int qpa_init_out(HWVoiceOut *hw, struct audsettings *as,
 
     obt_as.fmt = pa_to_audfmt (ss.format, &obt_as.endianness);
 
+    if (ppdo->try_poll) {
+        pa->has_notifier = event_notifier_init(&pa->notifier, false) == 0;
+        if (!pa->has_notifier) {
+            dolog("Could not create playback notifier, using timer\n");
+        }
+    }
+
     pa->stream = qpa_simple_new (
         c,
         "qemu",
@@ -344,6 +401,7 @@ static int qpa_init_out(HWVoiceOut *hw, struct audsettings *as,
         &ss,
         NULL,                   /* channel map */
         &ba,                    /* buffering attributes */
+        pa->has_notifier ? &pa->notifier : NULL,
         &error
         );
     if (!pa->stream) {
@@ -359,6 +417,10 @@ static int qpa_init_out(HWVoiceOut *hw, struct audsettings *as,
     return 0;
 
  fail1:
+    if (pa->has_notifier) {
+        event_notifier_cleanup(&pa->notifier);
+        pa->has_notifier = false;
+    }
     return -1;
 }
 
@@ -385,6 +447,13 @@ static int qpa_init_in(HWVoiceIn *hw, struct audsettings *as, void *drv_opaque)
 
     obt_as.fmt = pa_to_audfmt (ss.format, &obt_as.endianness);
 
+    if (ppdo->try_poll) {
+        pa->has_notifier = event_notifier_init(&pa->notifier, false) == 0;
+        if (!pa->has_notifier) {
+            dolog("Could not create capture notifier, using timer\n");
+        }
+    }
+
     pa->stream = qpa_simple_new (
         c,
         "qemu",
@@ -393,6 +462,7 @@ static int qpa_init_in(HWVoiceIn *hw, struct audsettings *as, void *drv_opaque)
         &ss,
         NULL,                   /* channel map */
         &ba,                    /* buffering attributes */
+        pa->has_notifier ? &pa->notifier : NULL,
         &error
         );
     if (!pa->stream) {
@@ -408,6 +478,10 @@ static int qpa_init_in(HWVoiceIn *hw, struct audsettings *as, void *drv_opaque)
     return 0;
 
  fail1:
+    if (pa->has_notifier) {
+        event_notifier_cleanup(&pa->notifier);
+        pa->has_notifier = false;
+    }
     return -1;
 }
 
@@ -440,6 +514,33 @@ static void qpa_fini_out (HWVoiceOut *hw)
         qpa_simple_disconnect(pa->g->conn, pa->stream);
         pa->stream = NULL;
     }
+    if (pa->has_notifier) {
+        qemu_set_fd_handler(event_notifier_get_fd(&pa->notifier),
+                            NULL, NULL, NULL);
+        event_notifier_cleanup(&pa->notifier);
+        pa->has_notifier = false;
+    }
+}
+
+static void qpa_enable_out(HWVoiceOut *hw, bool enable)
+{
+    PAVoiceOut *pa = (PAVoiceOut *) hw;
+    int fd;
+
+    if (!pa->has_notifier) {
+        return;
+    }
+
+    fd = event_notifier_get_fd(&pa->notifier);
+    if (enable) {
+        /* pick up any request that arrived while the voice was disabled */
+        event_notifier_set(&pa->notifier);
+        qemu_set_fd_handler(fd, qpa_event_handler_out, NULL, pa);
+        hw->poll_mode = 1;
+    } else {
+        qemu_set_fd_handler(fd, NULL, NULL, NULL);
+        hw->poll_mode = 0;
+    }
 }
 
 static void qpa_fini_in (HWVoiceIn *hw)
@@ -450,6 +551,33 @@ static void qpa_fini_in (HWVoiceIn *hw)
         qpa_simple_disconnect(pa->g->conn, pa->stream);
         pa->stream = NULL;
     }
+    if (pa->has_notifier) {
+        qemu_set_fd_handler(event_notifier_get_fd(&pa->notifier),
+                            NULL, NULL, NULL);
+        event_notifier_cleanup(&pa->notifier);
+        pa->has_notifier = false;
+    }
+}
+
+static void qpa_enable_in(HWVoiceIn *hw, bool enable)
+{
+    PAVoiceIn *pa = (PAVoiceIn *) hw;
+    int fd;
+
+    if (!pa->has_notifier) {
+        return;
+    }
+
+    fd = event_notifier_get_fd(&pa->notifier);
+    if (enable) {
+        /* pick up any request that arrived while the voice was disabled */
+        event_notifier_set(&pa->notifier);
+        qemu_set_fd_handler(fd, qpa_event_handler_in, NULL, pa);
+        hw->poll_mode = 1;
+    } else {
+        qemu_set_fd_handler(fd, NULL, NULL, NULL);
+        hw->poll_mode = 0;
+    }
 }
 
 static void qpa_volume_out(HWVoiceOut *hw, struct mixeng_volume *vol)
@@ -543,6 +671,10 @@ static int qpa_validate_per_direction_opts(Audiodev *dev,
         pdo->has_latency = true;
         pdo->latency = 15000;
     }
+    if (!pdo->has_try_poll) {
+        pdo->has_try_poll = true;
+        pdo->try_poll = true;
+    }
     return 1;
 }
 
@@ -698,11 +830,13 @@ static struct audio_pcm_ops qpa_pcm_ops = {
     .init_out = qpa_init_out,
     .fini_out = qpa_fini_out,
     .write    = qpa_write,
+    .enable_out = qpa_enable_out,
     .volume_out = qpa_volume_out,
 
     .init_in  = qpa_init_in,
     .fini_in  = qpa_fini_in,
     .read     = qpa_read,
+    .enable_in = qpa_enable_in,
     .volume_in = qpa_volume_in
 };
 
@@ -26,6 +26,11 @@
 #include "qapi/error.h"
 #include "standard-headers/linux/virtio_crypto.h"
 #include "crypto/cipher.h"
+#include "block/aio.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 
 
 /**
@@ -45,9 +50,21 @@ typedef struct CryptoDevBackendBuiltinSession {
     QCryptoCipher *cipher;
     uint8_t direction; /* encryption or decryption */
     uint8_t type; /* cipher? hash? aead? */
+    /* Serializes the operations sharing @cipher in the thread pool */
+    QemuMutex lock;
+    /* Operations submitted to the thread pool, main loop only */
+    unsigned int inflight;
     QTAILQ_ENTRY(CryptoDevBackendBuiltinSession) next;
 } CryptoDevBackendBuiltinSession;
 
+typedef struct CryptoDevBackendBuiltinOp {
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendSymOpInfo *op_info;
+    CryptoDevCompletionFunc *cb;
+    void *opaque;
+    Error *err;
+} CryptoDevBackendBuiltinOp;
+
 /* Max number of symmetric sessions */
 #define MAX_NUM_SESSIONS 256
 
@@ -237,6 +254,7 @@ static int cryptodev_builtin_create_cipher_session(
     sess->cipher = cipher;
     sess->direction = sess_info->direction;
     sess->type = sess_info->op_type;
+    qemu_mutex_init(&sess->lock);
 
     builtin->sessions[index] = sess;
 
@@ -281,6 +299,7 @@ static int cryptodev_builtin_sym_close_session(
 {
     CryptoDevBackendBuiltin *builtin =
                       CRYPTODEV_BACKEND_BUILTIN(backend);
+    CryptoDevBackendBuiltinSession *sess;
 
     if (session_id >= MAX_NUM_SESSIONS ||
               builtin->sessions[session_id] == NULL) {
@@ -289,36 +308,46 @@ static int cryptodev_builtin_sym_close_session(
         return -1;
     }
 
-    qcrypto_cipher_free(builtin->sessions[session_id]->cipher);
-    g_free(builtin->sessions[session_id]);
+    sess = builtin->sessions[session_id];
+    /* Operations still in the thread pool use the cipher */
+    AIO_WAIT_WHILE(NULL, sess->inflight > 0);
+
+    qcrypto_cipher_free(sess->cipher);
+    qemu_mutex_destroy(&sess->lock);
+    g_free(sess);
     builtin->sessions[session_id] = NULL;
     return 0;
 }
 
-static int cryptodev_builtin_sym_operation(
-                 CryptoDevBackend *backend,
+static CryptoDevBackendBuiltinSession *cryptodev_builtin_get_session(
+                 CryptoDevBackendBuiltin *builtin,
                  CryptoDevBackendSymOpInfo *op_info,
-                 uint32_t queue_index, Error **errp)
+                 int *status, Error **errp)
 {
-    CryptoDevBackendBuiltin *builtin =
-                      CRYPTODEV_BACKEND_BUILTIN(backend);
-    CryptoDevBackendBuiltinSession *sess;
-    int ret;
-
     if (op_info->session_id >= MAX_NUM_SESSIONS ||
               builtin->sessions[op_info->session_id] == NULL) {
         error_setg(errp, "Cannot find a valid session id: %" PRIu64 "",
                    op_info->session_id);
-        return -VIRTIO_CRYPTO_INVSESS;
+        *status = -VIRTIO_CRYPTO_INVSESS;
+        return NULL;
     }
 
     if (op_info->op_type == VIRTIO_CRYPTO_SYM_OP_ALGORITHM_CHAINING) {
         error_setg(errp,
                "Algorithm chain is unsupported for cryptdoev-builtin");
-        return -VIRTIO_CRYPTO_NOTSUPP;
+        *status = -VIRTIO_CRYPTO_NOTSUPP;
+        return NULL;
     }
 
-    sess = builtin->sessions[op_info->session_id];
+    return builtin->sessions[op_info->session_id];
+}
+
+static int cryptodev_builtin_sym_do_cipher(
+                 CryptoDevBackendBuiltinSession *sess,
+                 CryptoDevBackendSymOpInfo *op_info,
+                 Error **errp)
+{
+    int ret;
 
     if (op_info->iv_len > 0) {
         ret = qcrypto_cipher_setiv(sess->cipher, op_info->iv,
@@ -344,6 +373,84 @@ static int cryptodev_builtin_sym_operation(
     return VIRTIO_CRYPTO_OK;
 }
 
+static int cryptodev_builtin_sym_operation(
+                 CryptoDevBackend *backend,
+                 CryptoDevBackendSymOpInfo *op_info,
+                 uint32_t queue_index, Error **errp)
+{
+    CryptoDevBackendBuiltin *builtin =
+                      CRYPTODEV_BACKEND_BUILTIN(backend);
+    CryptoDevBackendBuiltinSession *sess;
+    int ret;
+
+    sess = cryptodev_builtin_get_session(builtin, op_info, &ret, errp);
+    if (!sess) {
+        return ret;
+    }
+
+    qemu_mutex_lock(&sess->lock);
+    ret = cryptodev_builtin_sym_do_cipher(sess, op_info, errp);
+    qemu_mutex_unlock(&sess->lock);
+    return ret;
+}
+
+/* Runs in the thread pool */
+static int cryptodev_builtin_sym_op_worker(void *opaque)
+{
+    CryptoDevBackendBuiltinOp *op = opaque;
+    int ret;
+
+    qemu_mutex_lock(&op->sess->lock);
+    ret = cryptodev_builtin_sym_do_cipher(op->sess, op->op_info, &op->err);
+    qemu_mutex_unlock(&op->sess->lock);
+    return ret;
+}
+
+static void cryptodev_builtin_sym_op_complete(void *opaque, int ret)
+{
+    CryptoDevBackendBuiltinOp *op = opaque;
+
+    if (op->err) {
+        error_report_err(op->err);
+    }
+    op->sess->inflight--;
+    op->cb(op->opaque, ret);
+    g_free(op);
+}
+
+static void cryptodev_builtin_sym_operation_async(
+                 CryptoDevBackend *backend,
+                 CryptoDevBackendSymOpInfo *op_info,
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *opaque)
+{
+    CryptoDevBackendBuiltin *builtin =
+                      CRYPTODEV_BACKEND_BUILTIN(backend);
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendBuiltinOp *op;
+    Error *local_err = NULL;
+    ThreadPool *pool;
+    int ret;
+
+    sess = cryptodev_builtin_get_session(builtin, op_info, &ret, &local_err);
+    if (!sess) {
+        error_report_err(local_err);
+        cb(opaque, ret);
+        return;
+    }
+
+    op = g_new0(CryptoDevBackendBuiltinOp, 1);
+    op->sess = sess;
+    op->op_info = op_info;
+    op->cb = cb;
+    op->opaque = opaque;
+    sess->inflight++;
+
+    pool = aio_get_thread_pool(qemu_get_aio_context());
+    thread_pool_submit_aio(pool, cryptodev_builtin_sym_op_worker, op,
+                           cryptodev_builtin_sym_op_complete, op);
+}
+
 static void cryptodev_builtin_cleanup(
              CryptoDevBackend *backend,
              Error **errp)
@@ -382,6 +489,7 @@ cryptodev_builtin_class_init(ObjectClass *oc, void *data)
     bc->create_session = cryptodev_builtin_sym_create_session;
     bc->close_session = cryptodev_builtin_sym_close_session;
     bc->do_sym_op = cryptodev_builtin_sym_operation;
+    bc->do_sym_op_async = cryptodev_builtin_sym_operation_async;
 }
 
 static const TypeInfo cryptodev_builtin_info = {
@@ -25,6 +25,7 @@
 #include "sysemu/cryptodev.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
+#include "qemu/error-report.h"
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
 #include "hw/virtio/virtio-crypto.h"
@@ -139,6 +140,32 @@ int cryptodev_backend_crypto_operation(
     return -VIRTIO_CRYPTO_ERR;
 }
 
+void cryptodev_backend_crypto_operation_async(
+                 CryptoDevBackend *backend,
+                 void *opaque,
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *cb_opaque)
+{
+    CryptoDevBackendClass *bc =
+                      CRYPTODEV_BACKEND_GET_CLASS(backend);
+    VirtIOCryptoReq *req = opaque;
+    Error *local_err = NULL;
+    int ret;
+
+    if (req->flags == CRYPTODEV_BACKEND_ALG_SYM && bc->do_sym_op_async) {
+        bc->do_sym_op_async(backend, req->u.sym_op_info, queue_index,
+                            cb, cb_opaque);
+        return;
+    }
+
+    ret = cryptodev_backend_crypto_operation(backend, opaque, queue_index,
+                                             &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+    }
+    cb(cb_opaque, ret);
+}
+
 static void
 cryptodev_backend_get_queues(Object *obj, Visitor *v, const char *name,
                              void *opaque, Error **errp)
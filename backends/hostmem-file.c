@@ -37,6 +37,7 @@ struct HostMemoryBackendFile {
     uint64_t align;
     bool discard_data;
     bool is_pmem;
+    bool is_template;
 };
 
 static void
@@ -58,13 +59,29 @@ file_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
         return;
     }
 
+    if (fb->is_template) {
+        /*
+         * Writes to the template must stay private to this VM, and
+         * preallocation would copy every page of it.
+         */
+        if (backend->share) {
+            error_setg(errp, "'template' cannot be used with 'share'");
+            return;
+        }
+        if (backend->prealloc || mem_prealloc) {
+            error_setg(errp, "'template' cannot be used with preallocation");
+            return;
+        }
+    }
+
     backend->force_prealloc = mem_prealloc;
     name = host_memory_backend_get_name(backend);
     memory_region_init_ram_from_file(&backend->mr, OBJECT(backend),
                                      name,
                                      backend->size, fb->align,
                                      (backend->share ? RAM_SHARED : 0) |
-                                     (fb->is_pmem ? RAM_PMEM : 0),
+                                     (fb->is_pmem ? RAM_PMEM : 0) |
+                                     (fb->is_template ? RAM_TEMPLATE : 0),
                                      fb->mem_path, errp);
     g_free(name);
 #endif
@@ -170,6 +187,25 @@ static void file_memory_backend_set_pmem(Object *o, bool value, Error **errp)
     fb->is_pmem = value;
 }
 
+static bool file_memory_backend_get_template(Object *o, Error **errp)
+{
+    return MEMORY_BACKEND_FILE(o)->is_template;
+}
+
+static void file_memory_backend_set_template(Object *o, bool value,
+                                             Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(o);
+    HostMemoryBackendFile *fb = MEMORY_BACKEND_FILE(o);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property 'template' of %s",
+                   object_get_typename(o));
+        return;
+    }
+    fb->is_template = value;
+}
+
 static void file_backend_unparent(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -204,6 +240,9 @@ file_backend_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "pmem",
         file_memory_backend_get_pmem, file_memory_backend_set_pmem,
         &error_abort);
+    object_class_property_add_bool(oc, "template",
+        file_memory_backend_get_template, file_memory_backend_set_template,
+        &error_abort);
 }
 
 static void file_backend_instance_finalize(Object *o)
@@ -14,6 +14,7 @@
 #include "sysemu/hostmem.h"
 #include "sysemu/sysemu.h"
 #include "hw/boards.h"
+#include "hw/qdev-core.h"
 #include "qapi/error.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "qapi/visitor.h"
@@ -22,6 +23,7 @@
 #include "qemu/mmap-alloc.h"
 
 #ifdef CONFIG_NUMA
+#include <numa.h>
 #include <numaif.h>
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_DEFAULT != MPOL_DEFAULT);
 QEMU_BUILD_BUG_ON(HOST_MEM_POLICY_PREFERRED != MPOL_PREFERRED);
@@ -211,6 +213,103 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+/* Backends whose memory is being preallocated in the background */
+static GSList *prealloc_pending_backends;
+
+#ifdef CONFIG_NUMA
+/*
+ * Return the host CPUs of the nodes the memory is bound to, so that the
+ * pages are touched from these nodes; or NULL if there is no binding.
+ */
+static unsigned long *host_memory_backend_node_cpus(HostMemoryBackend *backend,
+                                                    long *nbits)
+{
+    struct bitmask *mask;
+    unsigned long *cpus;
+    long node, cpu;
+
+    if (backend->policy == MPOL_DEFAULT ||
+        bitmap_empty(backend->host_nodes, MAX_NODES) ||
+        numa_available() < 0) {
+        return NULL;
+    }
+
+    *nbits = numa_num_possible_cpus();
+    cpus = bitmap_new(*nbits);
+    mask = numa_allocate_cpumask();
+    for (node = find_first_bit(backend->host_nodes, MAX_NODES);
+         node < MAX_NODES;
+         node = find_next_bit(backend->host_nodes, MAX_NODES, node + 1)) {
+        if (numa_node_to_cpus(node, mask) < 0) {
+            continue;
+        }
+        for (cpu = 0; cpu < *nbits; cpu++) {
+            if (numa_bitmask_isbitset(mask, cpu)) {
+                set_bit(cpu, cpus);
+            }
+        }
+    }
+    numa_free_cpumask(mask);
+
+    if (bitmap_empty(cpus, *nbits)) {
+        g_free(cpus);
+        return NULL;
+    }
+    return cpus;
+}
+#endif
+
+static MemPrealloc *
+host_memory_backend_prealloc_start(HostMemoryBackend *backend, Error **errp)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    int fd = memory_region_get_fd(&backend->mr);
+    void *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+    int threads = backend->prealloc_threads ?: ms->smp.cpus;
+    unsigned long *cpus = NULL;
+    long nbits = 0;
+    MemPrealloc *mp;
+
+#ifdef CONFIG_NUMA
+    cpus = host_memory_backend_node_cpus(backend, &nbits);
+#endif
+    mp = os_mem_prealloc_start(fd, ptr, sz, threads, cpus, nbits, errp);
+    g_free(cpus);
+    return mp;
+}
+
+static bool host_memory_backend_prealloc_finish(HostMemoryBackend *backend,
+                                                Error **errp)
+{
+    MemPrealloc *mp = backend->prealloc_pending;
+
+    if (!mp) {
+        return true;
+    }
+    backend->prealloc_pending = NULL;
+    prealloc_pending_backends = g_slist_remove(prealloc_pending_backends,
+                                               backend);
+    return os_mem_prealloc_finish(mp, errp);
+}
+
+void host_memory_backend_prealloc_wait(Error **errp)
+{
+    while (prealloc_pending_backends) {
+        HostMemoryBackend *backend = prealloc_pending_backends->data;
+        Error *local_err = NULL;
+
+        if (!host_memory_backend_prealloc_finish(backend, &local_err)) {
+            char *path = object_get_canonical_path_component(OBJECT(backend));
+
+            error_propagate_prepend(errp, local_err,
+                                    "memory backend '%s': ", path);
+            g_free(path);
+            return;
+        }
+    }
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -223,7 +322,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
 {
     Error *local_err = NULL;
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
-    MachineState *ms = MACHINE(qdev_get_machine());
+    MemPrealloc *mp;
 
     if (backend->force_prealloc) {
         if (value) {
@@ -239,12 +338,8 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
-        void *ptr = memory_region_get_ram_ptr(&backend->mr);
-        uint64_t sz = memory_region_size(&backend->mr);
-
-        os_mem_prealloc(fd, ptr, sz, ms->smp.cpus, &local_err);
-        if (local_err) {
+        mp = host_memory_backend_prealloc_start(backend, &local_err);
+        if (!mp || !os_mem_prealloc_finish(mp, &local_err)) {
             error_propagate(errp, local_err);
             return;
         }
@@ -252,6 +347,34 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static void
+host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    visit_type_uint32(v, name, &backend->prealloc_threads, errp);
+}
+
+static void
+host_memory_backend_set_prealloc_threads(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    backend->prealloc_threads = value;
+out:
+    error_propagate(errp, local_err);
+}
+
 static void host_memory_backend_init(Object *obj)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -267,6 +390,14 @@ static void host_memory_backend_post_init(Object *obj)
     object_apply_compat_props(obj);
 }
 
+static void host_memory_backend_finalize(Object *obj)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    /* The memory goes away with the backend */
+    host_memory_backend_prealloc_finish(backend, NULL);
+}
+
 bool host_memory_backend_mr_inited(HostMemoryBackend *backend)
 {
     /*
@@ -313,7 +444,6 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(uc);
     HostMemoryBackendClass *bc = MEMORY_BACKEND_GET_CLASS(uc);
-    MachineState *ms = MACHINE(qdev_get_machine());
     Error *local_err = NULL;
     void *ptr;
     uint64_t sz;
@@ -377,9 +507,22 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            ms->smp.cpus, &local_err);
-            if (local_err) {
+            MemPrealloc *mp;
+
+            mp = host_memory_backend_prealloc_start(backend, &local_err);
+            if (!mp) {
+                goto out;
+            }
+            if (!qdev_hotplug) {
+                /*
+                 * During machine initialization, let the preallocation
+                 * overlap with the rest of it; the guest cannot run
+                 * before host_memory_backend_prealloc_wait().
+                 */
+                backend->prealloc_pending = mp;
+                prealloc_pending_backends =
+                    g_slist_prepend(prealloc_pending_backends, backend);
+            } else if (!os_mem_prealloc_finish(mp, &local_err)) {
                 goto out;
             }
         }
@@ -456,6 +599,13 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_prealloc, &error_abort);
     object_class_property_set_description(oc, "prealloc",
         "Preallocate memory", &error_abort);
+    object_class_property_add(oc, "prealloc-threads", "int",
+        host_memory_backend_get_prealloc_threads,
+        host_memory_backend_set_prealloc_threads,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "prealloc-threads",
+        "Number of CPU threads to use for prealloc (0 for default)",
+        &error_abort);
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -493,6 +643,7 @@ static const TypeInfo host_memory_backend_info = {
     .instance_size = sizeof(HostMemoryBackend),
     .instance_init = host_memory_backend_init,
     .instance_post_init = host_memory_backend_post_init,
+    .instance_finalize = host_memory_backend_finalize,
     .interfaces = (InterfaceInfo[]) {
         { TYPE_USER_CREATABLE },
         { }
@@ -27,6 +27,8 @@
 #include "qemu/error-report.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_MAX_WORKERS 64
+#define BACKUP_MAX_CHUNK (64 * 1024 * 1024)
 
 typedef struct CowRequest {
     int64_t start_byte;
@@ -58,8 +60,24 @@ typedef struct BackupBlockJob {
 
     BdrvRequestFlags write_flags;
     bool initializing_bitmap;
+
+    /* Copy requests issued by backup_loop() run in up to max_workers
+     * coroutines at a time, each copying at most max_chunk bytes. */
+    int max_workers;
+    int64_t max_chunk;
+    int nb_workers;
+    CoQueue worker_queue;
+    /* First error hit by a worker, handled by backup_loop() */
+    int worker_ret;
+    bool worker_error_is_read;
 } BackupBlockJob;
 
+typedef struct BackupWorker {
+    BackupBlockJob *job;
+    int64_t offset;
+    int64_t bytes;
+} BackupWorker;
+
 static const BlockJobDriver backup_job_driver;
 
 /* See if in-flight requests overlap and wait for them to complete */
@@ -111,13 +129,18 @@ static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
     int ret;
     BlockBackend *blk = job->common.blk;
     int nbytes;
+    int64_t dirty_bytes;
     int read_flags = is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0;
 
     assert(QEMU_IS_ALIGNED(start, job->cluster_size));
-    bdrv_reset_dirty_bitmap(job->copy_bitmap, start, job->cluster_size);
-    nbytes = MIN(job->cluster_size, job->len - start);
+    assert(QEMU_IS_ALIGNED(end, job->cluster_size));
+    /* @end stays the same for all calls from one backup_do_cow(), so the
+     * first call's buffer is large enough for the following ones. */
+    dirty_bytes = MIN(job->max_chunk, end - start);
+    bdrv_reset_dirty_bitmap(job->copy_bitmap, start, dirty_bytes);
+    nbytes = MIN(dirty_bytes, job->len - start);
     if (!*bounce_buffer) {
-        *bounce_buffer = blk_blockalign(blk, job->cluster_size);
+        *bounce_buffer = blk_blockalign(blk, dirty_bytes);
     }
 
     ret = blk_co_pread(blk, start, nbytes, *bounce_buffer, read_flags);
@@ -141,7 +164,7 @@ static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
 
     return nbytes;
 fail:
-    bdrv_set_dirty_bitmap(job->copy_bitmap, start, job->cluster_size);
+    bdrv_set_dirty_bitmap(job->copy_bitmap, start, dirty_bytes);
     return ret;
 
 }
@@ -315,9 +338,13 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
 
         /* Publish progress, guest I/O counts as progress too.  Note that the
          * offset field is an opaque progress value, it is not a disk offset.
+         * backup_loop() accounts its own requests for rate limiting when it
+         * issues them.
          */
         start += ret;
-        job->bytes_read += ret;
+        if (is_write_notifier) {
+            job->bytes_read += ret;
+        }
         job_progress_update(&job->common.job, ret);
         ret = 0;
     }
@@ -458,30 +485,108 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
     return false;
 }
 
+static void coroutine_fn backup_worker_entry(void *opaque)
+{
+    BackupWorker *w = opaque;
+    BackupBlockJob *job = w->job;
+    bool error_is_read = false;
+    int ret;
+
+    ret = backup_do_cow(job, w->offset, w->bytes, &error_is_read, false);
+    if (ret < 0 && !job->worker_ret) {
+        job->worker_ret = ret;
+        job->worker_error_is_read = error_is_read;
+    }
+    g_free(w);
+
+    job->nb_workers--;
+    qemu_co_queue_restart_all(&job->worker_queue);
+}
+
+static void coroutine_fn backup_start_worker(BackupBlockJob *job,
+                                             int64_t offset, int64_t bytes)
+{
+    BackupWorker *w = g_new(BackupWorker, 1);
+    Coroutine *co;
+
+    *w = (BackupWorker) {
+        .job    = job,
+        .offset = offset,
+        .bytes  = bytes,
+    };
+    job->nb_workers++;
+    co = qemu_coroutine_create(backup_worker_entry, w);
+    qemu_coroutine_enter(co);
+}
+
+/* Wait until fewer than @max_workers copy requests are in flight */
+static void coroutine_fn backup_wait_for_workers(BackupBlockJob *job,
+                                                 int max_workers)
+{
+    while (job->nb_workers >= max_workers) {
+        qemu_co_queue_wait(&job->worker_queue, NULL);
+    }
+}
+
 static int coroutine_fn backup_loop(BackupBlockJob *job)
 {
-    bool error_is_read;
-    int64_t offset;
+    int64_t offset, bytes, next_zero;
+    bool scanned = false;
     BdrvDirtyBitmapIter *bdbi;
     int ret = 0;
 
     bdbi = bdrv_dirty_iter_new(job->copy_bitmap);
-    while ((offset = bdrv_dirty_iter_next(bdbi)) != -1) {
-        do {
+    while (true) {
+        offset = scanned ? -1 : bdrv_dirty_iter_next(bdbi);
+        if (offset != -1) {
             if (yield_and_check(job)) {
                 goto out;
             }
-            ret = backup_do_cow(job, offset,
-                                job->cluster_size, &error_is_read, false);
-            if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
-                           BLOCK_ERROR_ACTION_REPORT)
+            backup_wait_for_workers(job, job->max_workers);
+        }
+        if (offset == -1 || job->worker_ret < 0) {
+            backup_wait_for_workers(job, 1);
+        }
+
+        if (job->worker_ret < 0) {
+            ret = job->worker_ret;
+            job->worker_ret = 0;
+            if (backup_error_action(job, job->worker_error_is_read, -ret) ==
+                BLOCK_ERROR_ACTION_REPORT)
             {
                 goto out;
             }
-        } while (ret < 0);
+            /* Failed requests marked their clusters dirty again, so start
+             * over from the beginning to retry them. */
+            ret = 0;
+            scanned = false;
+            bdrv_set_dirty_iter(bdbi, 0);
+            continue;
+        }
+        if (offset == -1) {
+            break;
+        }
+
+        /* The clusters only become clean once a worker has copied them, so
+         * claim the whole dirty run and move the iterator past it. */
+        bytes = MIN(job->max_chunk, job->len - offset);
+        next_zero = bdrv_dirty_bitmap_next_zero(job->copy_bitmap, offset,
+                                                bytes);
+        if (next_zero >= 0) {
+            bytes = next_zero - offset;
+        }
+        if (offset + bytes < job->len) {
+            bdrv_set_dirty_iter(bdbi, offset + bytes);
+        } else {
+            scanned = true;
+        }
+
+        job->bytes_read += bytes;
+        backup_start_worker(job, offset, bytes);
     }
 
  out:
+    backup_wait_for_workers(job, 1);
     bdrv_dirty_iter_free(bdbi);
     return ret;
 }
@@ -519,6 +624,7 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
 
     QLIST_INIT(&s->inflight_reqs);
     qemu_co_rwlock_init(&s->flush_rwlock);
+    qemu_co_queue_init(&s->worker_queue);
 
     backup_init_copy_bitmap(s);
 
@@ -620,7 +726,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, int64_t speed,
                   MirrorSyncMode sync_mode, BdrvDirtyBitmap *sync_bitmap,
                   BitmapSyncMode bitmap_mode,
-                  bool compress,
+                  bool compress, int max_workers, int64_t max_chunk,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   int creation_flags,
@@ -657,6 +763,18 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (max_workers < 0 || max_workers > BACKUP_MAX_WORKERS) {
+        error_setg(errp, "max-workers must be between 1 and %d",
+                   BACKUP_MAX_WORKERS);
+        return NULL;
+    }
+
+    if (max_chunk < 0 || max_chunk > BACKUP_MAX_CHUNK) {
+        error_setg(errp, "max-chunk must be between 1 and %d",
+                   BACKUP_MAX_CHUNK);
+        return NULL;
+    }
+
     if (compress && !block_driver_can_compress(target->drv)) {
         error_setg(errp, "Compression is not supported for this drive %s",
                    bdrv_get_device_name(target));
@@ -739,6 +857,8 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         (compress ? BDRV_REQ_WRITE_COMPRESSED : 0);
 
     job->cluster_size = cluster_size;
+    job->max_workers = max_workers ?: 1;
+    job->max_chunk = MAX(cluster_size, QEMU_ALIGN_UP(max_chunk, cluster_size));
     job->copy_bitmap = copy_bitmap;
     copy_bitmap = NULL;
     job->use_copy_range = !compress; /* compression isn't supported for it */
@@ -2313,6 +2313,24 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+int coroutine_fn blk_co_sendfile(BlockBackend *blk, int64_t offset, int bytes,
+                                 int out_fd)
+{
+    int r;
+
+    blk_wait_while_drained(blk);
+
+    r = blk_check_byte_request(blk, offset, bytes);
+    if (r) {
+        return r;
+    }
+    /* Throttled requests must go through the normal read path */
+    if (blk->public.throttle_group_member.throttle_state) {
+        return -ENOTSUP;
+    }
+    return bdrv_co_sendfile(blk->root, offset, bytes, out_fd);
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     return blk->root;
@@ -0,0 +1,732 @@
+/*
+ * Persistent local write-back cache for slow block devices
+ *
+ * Copyright (c) 2019 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * The cache node sits on top of a slow node ("file", e.g. rbd, nbd, iscsi or
+ * curl) and keeps a copy of the data that has been accessed in a local node
+ * ("cache-file").  Reads of cached clusters and all writes are served by the
+ * local node; a background coroutine writes dirty clusters back.
+ *
+ * Layout of the cache file:
+ *
+ *   0                   CacheHeader
+ *   state_offset        one state byte per cluster (CACHE_STATE_*)
+ *   data_offset         the cached copy of cluster i at
+ *                       data_offset + i * cluster_size (sparse)
+ *
+ * The state table on disk may lag behind the one in memory, but only in
+ * directions that are safe after a crash:
+ *
+ *  - A cluster becomes valid on disk only after a flush of the cache file
+ *    has made its data stable.  Until then, it is read from the slow node
+ *    again, which loses nothing but unflushed writes.
+ *  - A clean cluster is marked dirty on disk before new data is written to
+ *    it, so that no change is ever missed by the write-back.
+ *  - A dirty cluster is marked clean on disk only after its data has been
+ *    written back and flushed on the slow node; a stale dirty flag only
+ *    causes another write-back.
+ *
+ * Dirty data survives restarts: the slow node alone is only up to date once
+ * all dirty clusters have been written back.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/block_int.h"
+#include "qemu/bswap.h"
+#include "qemu/hbitmap.h"
+#include "qemu/host-utils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "trace.h"
+
+#define CACHE_MAGIC             "QEMUCACH"
+#define CACHE_VERSION           1
+#define CACHE_HEADER_SIZE       4096
+
+/* The state table is written in blocks of this many bytes (i.e. clusters) */
+#define CACHE_STATE_BLOCK       4096
+
+#define CACHE_STATE_VALID       0x1     /* cluster data is in the cache */
+#define CACHE_STATE_DIRTY       0x2     /* and newer than on the slow node */
+#define CACHE_STATE_MASK        (CACHE_STATE_VALID | CACHE_STATE_DIRTY)
+
+#define CACHE_DEFAULT_CLUSTER_SIZE  (64 * KiB)
+#define CACHE_MAX_REQUEST           (1 * MiB)
+
+#define CACHE_OPT_CLUSTER_SIZE  "cluster-size"
+
+typedef struct QEMU_PACKED CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cluster_bits;
+    uint64_t size;              /* size of the cached image in bytes */
+    uint64_t state_offset;
+    uint64_t data_offset;
+} CacheHeader;
+
+typedef struct BDRVCacheState {
+    BdrvChild *cache_file;
+
+    int cluster_bits;
+    uint64_t cluster_size;
+    uint64_t size;
+    uint64_t nb_clusters;
+    uint64_t state_offset;
+    uint64_t data_offset;
+
+    /* Protects the state table and serializes all changes to the cache */
+    CoMutex lock;
+
+    uint8_t *state;             /* CACHE_STATE_* for every cluster */
+    HBitmap *state_pending;     /* state blocks that differ from the disk */
+    HBitmap *dirty;             /* clusters that wait for write-back */
+
+    Coroutine *flusher_co;
+    bool flusher_waiting;
+    bool stopping;
+    int quiesce_counter;
+} BDRVCacheState;
+
+static QemuOptsList cache_runtime_opts = {
+    .name = "cache",
+    .head = QTAILQ_HEAD_INITIALIZER(cache_runtime_opts.head),
+    .desc = {
+        {
+            .name = CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Cache granularity in bytes",
+            .def_value_str = stringify(CACHE_DEFAULT_CLUSTER_SIZE),
+        },
+        { /* end of list */ }
+    },
+};
+
+static void cache_mark_state(BDRVCacheState *s, uint64_t cluster,
+                             uint8_t state)
+{
+    if (s->state[cluster] != state) {
+        s->state[cluster] = state;
+        hbitmap_set(s->state_pending, cluster, 1);
+    }
+}
+
+/*
+ * Writes all pending state table blocks, after making sure that the data
+ * they refer to is stable.  Called with s->lock held, or from open/close.
+ */
+static int cache_flush_state(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint64_t start = 0, count = s->nb_clusters;
+    int ret;
+
+    ret = bdrv_flush(s->cache_file->bs);
+    if (ret < 0 || !hbitmap_count(s->state_pending)) {
+        return ret;
+    }
+
+    while (hbitmap_next_dirty_area(s->state_pending, &start, &count)) {
+        uint64_t end = MIN(ROUND_UP(start + count, CACHE_STATE_BLOCK),
+                           s->nb_clusters);
+
+        start = QEMU_ALIGN_DOWN(start, CACHE_STATE_BLOCK);
+        ret = bdrv_pwrite(s->cache_file, s->state_offset + start,
+                          s->state + start, end - start);
+        if (ret < 0) {
+            return ret;
+        }
+        hbitmap_reset(s->state_pending, start, end - start);
+
+        start = end;
+        count = s->nb_clusters - end;
+        if (!count) {
+            break;
+        }
+    }
+
+    return bdrv_flush(s->cache_file->bs);
+}
+
+static void cache_wake_flusher(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+
+    if (s->flusher_co && s->flusher_waiting) {
+        s->flusher_waiting = false;
+        aio_co_enter(bdrv_get_aio_context(bs), s->flusher_co);
+    }
+}
+
+/*
+ * Reads [@offset, @offset + @bytes) of the image from the slow node and, if
+ * the cache is writable, stores the clusters that contain it in the cache.
+ * The data is copied to @qiov at @qiov_offset unless @qiov is NULL.
+ * Called with s->lock held for clusters that are not valid.
+ */
+static int coroutine_fn cache_fill(BlockDriverState *bs, uint64_t offset,
+                                   uint64_t bytes, QEMUIOVector *qiov,
+                                   size_t qiov_offset)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint64_t start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    uint64_t end = MIN(ROUND_UP(offset + bytes, s->cluster_size), s->size);
+    uint64_t i;
+    uint8_t *buf;
+    int ret;
+
+    buf = qemu_try_blockalign(bs, end - start);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    ret = bdrv_co_pread(bs->file, start, end - start, buf, 0);
+    if (ret < 0) {
+        goto out;
+    }
+
+    if (qiov) {
+        qemu_iovec_from_buf(qiov, qiov_offset, buf + offset - start, bytes);
+    }
+
+    if (bdrv_is_read_only(bs)) {
+        ret = 0;
+        goto out;
+    }
+
+    /* If storing fails, the data is just read from the slow node again */
+    ret = bdrv_co_pwrite(s->cache_file, s->data_offset + start, end - start,
+                         buf, 0);
+    if (ret < 0) {
+        trace_cache_fill_error(bs, start, ret);
+        ret = qiov ? 0 : ret;
+        goto out;
+    }
+
+    for (i = start >> s->cluster_bits; i << s->cluster_bits < end; i++) {
+        cache_mark_state(s, i, CACHE_STATE_VALID);
+    }
+    ret = 0;
+
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static bool cache_cluster_valid(BDRVCacheState *s, uint64_t cluster)
+{
+    return s->state[cluster] & CACHE_STATE_VALID;
+}
+
+static int coroutine_fn cache_co_preadv(BlockDriverState *bs,
+                                        uint64_t offset, uint64_t bytes,
+                                        QEMUIOVector *qiov, int flags)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint64_t first = offset >> s->cluster_bits;
+    uint64_t last = (offset + bytes - 1) >> s->cluster_bits;
+    size_t qiov_offset = 0;
+    uint64_t i;
+    int ret = 0;
+
+    /* Clusters never become invalid again, so hits need no lock */
+    for (i = first; i <= last && cache_cluster_valid(s, i); i++) {
+        /* nothing */
+    }
+    if (i > last) {
+        return bdrv_co_preadv(s->cache_file, s->data_offset + offset, bytes,
+                              qiov, 0);
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    while (bytes) {
+        bool valid = cache_cluster_valid(s, offset >> s->cluster_bits);
+        uint64_t start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+        uint64_t end = start + s->cluster_size;
+        uint64_t n;
+
+        /* Find the run of clusters with the same state */
+        while (end < offset + bytes && end - start < CACHE_MAX_REQUEST &&
+               cache_cluster_valid(s, end >> s->cluster_bits) == valid)
+        {
+            end += s->cluster_size;
+        }
+        n = MIN(end, offset + bytes) - offset;
+
+        if (valid) {
+            ret = bdrv_co_preadv_part(s->cache_file, s->data_offset + offset, n,
+                                      qiov, qiov_offset, 0);
+        } else {
+            ret = cache_fill(bs, offset, n, qiov, qiov_offset);
+        }
+        if (ret < 0) {
+            break;
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret < 0 ? ret : 0;
+}
+
+static int coroutine_fn cache_co_pwritev(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes,
+                                         QEMUIOVector *qiov, int flags)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint64_t first = offset >> s->cluster_bits;
+    uint64_t last = (offset + bytes - 1) >> s->cluster_bits;
+    uint64_t end = offset + bytes;
+    bool need_state_flush = false;
+    uint64_t i;
+    int ret;
+
+    qemu_co_mutex_lock(&s->lock);
+
+    /*
+     * Partially written clusters must be complete in the cache.  A cluster
+     * filled here is still invalid on disk, so it can be marked dirty in
+     * memory right away.
+     */
+    if ((offset & (s->cluster_size - 1)) && !cache_cluster_valid(s, first)) {
+        ret = cache_fill(bs, first << s->cluster_bits, s->cluster_size,
+                         NULL, 0);
+        if (ret < 0) {
+            goto out;
+        }
+        cache_mark_state(s, first, CACHE_STATE_VALID | CACHE_STATE_DIRTY);
+    }
+    if ((end & (s->cluster_size - 1)) && end < s->size &&
+        !cache_cluster_valid(s, last))
+    {
+        ret = cache_fill(bs, last << s->cluster_bits, s->cluster_size,
+                         NULL, 0);
+        if (ret < 0) {
+            goto out;
+        }
+        cache_mark_state(s, last, CACHE_STATE_VALID | CACHE_STATE_DIRTY);
+    }
+
+    /* Record on disk that clean clusters are about to change */
+    for (i = first; i <= last; i++) {
+        if (s->state[i] == CACHE_STATE_VALID) {
+            cache_mark_state(s, i, CACHE_STATE_VALID | CACHE_STATE_DIRTY);
+            need_state_flush = true;
+        }
+    }
+    if (need_state_flush) {
+        ret = cache_flush_state(bs);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    ret = bdrv_co_pwritev(s->cache_file, s->data_offset + offset, bytes,
+                          qiov, 0);
+    if (ret < 0) {
+        goto out;
+    }
+
+    for (i = first; i <= last; i++) {
+        cache_mark_state(s, i, CACHE_STATE_VALID | CACHE_STATE_DIRTY);
+    }
+    hbitmap_set(s->dirty, first, last - first + 1);
+    cache_wake_flusher(bs);
+    ret = 0;
+
+out:
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
+
+static int coroutine_fn cache_co_flush(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+    int ret;
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = cache_flush_state(bs);
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+/*
+ * Writes @count dirty clusters starting at @start back to the slow node and
+ * marks them clean unless they were written to again in the meantime.
+ */
+static int coroutine_fn cache_writeback(BlockDriverState *bs, uint64_t start,
+                                        uint64_t count)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint64_t offset = start << s->cluster_bits;
+    uint64_t bytes = MIN(count << s->cluster_bits, s->size - offset);
+    uint64_t i;
+    uint8_t *buf;
+    int ret;
+
+    trace_cache_writeback(bs, offset, bytes);
+
+    buf = qemu_try_blockalign(bs, bytes);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    /* Writes from now on set the bits again */
+    qemu_co_mutex_lock(&s->lock);
+    hbitmap_reset(s->dirty, start, count);
+    qemu_co_mutex_unlock(&s->lock);
+
+    ret = bdrv_co_pread(s->cache_file, s->data_offset + offset, bytes, buf, 0);
+    if (ret >= 0) {
+        ret = bdrv_co_pwrite(bs->file, offset, bytes, buf, 0);
+    }
+    if (ret >= 0) {
+        ret = bdrv_co_flush(bs->file->bs);
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    if (ret < 0) {
+        trace_cache_writeback_error(bs, offset, ret);
+        hbitmap_set(s->dirty, start, count);
+    } else {
+        for (i = start; i < start + count; i++) {
+            if (!hbitmap_get(s->dirty, i)) {
+                cache_mark_state(s, i, s->state[i] & ~CACHE_STATE_DIRTY);
+            }
+        }
+        if (!hbitmap_count(s->dirty)) {
+            /* Everything is written back, record it */
+            ret = cache_flush_state(bs);
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+static void coroutine_fn cache_flusher_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVCacheState *s = bs->opaque;
+    uint64_t max_clusters = CACHE_MAX_REQUEST >> s->cluster_bits;
+
+    while (!s->stopping) {
+        uint64_t start = 0, count = s->nb_clusters;
+        int ret;
+
+        if (s->quiesce_counter ||
+            !hbitmap_next_dirty_area(s->dirty, &start, &count))
+        {
+            s->flusher_waiting = true;
+            qemu_coroutine_yield();
+            continue;
+        }
+
+        bdrv_inc_in_flight(bs);
+        ret = cache_writeback(bs, start, MIN(count, MAX(max_clusters, 1)));
+        bdrv_dec_in_flight(bs);
+
+        if (ret < 0) {
+            /* Try again on the next write or flush instead of spinning */
+            s->flusher_waiting = true;
+            qemu_coroutine_yield();
+        }
+    }
+
+    s->flusher_co = NULL;
+    aio_wait_kick();
+}
+
+static int cache_create_header(BlockDriverState *bs, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    CacheHeader header;
+    int ret;
+
+    ret = bdrv_pwrite_zeroes(s->cache_file, s->state_offset,
+                             ROUND_UP(s->nb_clusters, CACHE_STATE_BLOCK), 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not initialize cache state");
+        return ret;
+    }
+
+    ret = bdrv_truncate(s->cache_file, s->data_offset + s->size,
+                        PREALLOC_MODE_OFF, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    header = (CacheHeader) {
+        .version        = cpu_to_be32(CACHE_VERSION),
+        .cluster_bits   = cpu_to_be32(s->cluster_bits),
+        .size           = cpu_to_be64(s->size),
+        .state_offset   = cpu_to_be64(s->state_offset),
+        .data_offset    = cpu_to_be64(s->data_offset),
+    };
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+
+    /* The header makes the (empty) state table valid, so write it last */
+    ret = bdrv_flush(s->cache_file->bs);
+    if (ret >= 0) {
+        ret = bdrv_pwrite_sync(s->cache_file, 0, &header, sizeof(header));
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write cache header");
+        return ret;
+    }
+
+    return 0;
+}
+
+static int cache_load_header(BlockDriverState *bs, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    CacheHeader header;
+    static const char zero_magic[sizeof(header.magic)];
+    uint64_t i;
+    int ret;
+
+    ret = bdrv_pread(s->cache_file, 0, &header, sizeof(header));
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read cache header");
+        return ret;
+    }
+
+    if (!memcmp(header.magic, zero_magic, sizeof(header.magic))) {
+        if (bdrv_is_read_only(bs)) {
+            error_setg(errp, "Cache file is not initialized and read-only");
+            return -EACCES;
+        }
+        return cache_create_header(bs, errp);
+    }
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic))) {
+        error_setg(errp, "Cache file has an unknown format");
+        return -EINVAL;
+    }
+    if (be32_to_cpu(header.version) != CACHE_VERSION) {
+        error_setg(errp, "Unsupported cache file version %" PRIu32,
+                   be32_to_cpu(header.version));
+        return -ENOTSUP;
+    }
+    if (be32_to_cpu(header.cluster_bits) != s->cluster_bits) {
+        error_setg(errp, "Cache file uses a cluster size of %" PRIu64
+                   " bytes, not %" PRIu64,
+                   (uint64_t) 1 << MIN(be32_to_cpu(header.cluster_bits), 63),
+                   s->cluster_size);
+        return -EINVAL;
+    }
+    if (be64_to_cpu(header.size) != s->size) {
+        error_setg(errp, "Cache file was set up for an image of %" PRIu64
+                   " bytes, but the image has %" PRIu64,
+                   be64_to_cpu(header.size), s->size);
+        return -EINVAL;
+    }
+    if (be64_to_cpu(header.state_offset) != s->state_offset ||
+        be64_to_cpu(header.data_offset) != s->data_offset)
+    {
+        error_setg(errp, "Cache file has an invalid layout");
+        return -EINVAL;
+    }
+
+    ret = bdrv_pread(s->cache_file, s->state_offset, s->state, s->nb_clusters);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read cache state");
+        return ret;
+    }
+
+    for (i = 0; i < s->nb_clusters; i++) {
+        if ((s->state[i] & ~CACHE_STATE_MASK) ||
+            s->state[i] == CACHE_STATE_DIRTY)
+        {
+            error_setg(errp, "Cache state of cluster %" PRIu64 " is corrupt",
+                       i);
+            return -EINVAL;
+        }
+        if (s->state[i] & CACHE_STATE_DIRTY) {
+            hbitmap_set(s->dirty, i, 1);
+        }
+    }
+
+    return 0;
+}
+
+static int cache_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    Error *local_err = NULL;
+    QemuOpts *opts;
+    uint64_t cluster_size;
+    int64_t size;
+    int ret;
+
+    qemu_co_mutex_init(&s->lock);
+
+    opts = qemu_opts_create(&cache_runtime_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    cluster_size = qemu_opt_get_size(opts, CACHE_OPT_CLUSTER_SIZE,
+                                     CACHE_DEFAULT_CLUSTER_SIZE);
+    if (cluster_size < BDRV_SECTOR_SIZE || cluster_size > 2 * MiB ||
+        !is_power_of_2(cluster_size))
+    {
+        error_setg(errp, "Cluster size must be a power of two between 512 "
+                   "and 2M");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->cluster_size = cluster_size;
+    s->cluster_bits = ctz64(cluster_size);
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_file, false,
+                               errp);
+    if (!bs->file) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->cache_file = bdrv_open_child(NULL, options, "cache-file", bs,
+                                    &child_file, false, errp);
+    if (!s->cache_file) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    size = bdrv_getlength(bs->file->bs);
+    if (size < 0) {
+        error_setg_errno(errp, -size, "Could not get the image size");
+        ret = size;
+        goto fail;
+    }
+    s->size = size;
+    s->nb_clusters = DIV_ROUND_UP(s->size, s->cluster_size);
+    s->state_offset = CACHE_HEADER_SIZE;
+    s->data_offset = ROUND_UP(s->state_offset +
+                              ROUND_UP(s->nb_clusters, CACHE_STATE_BLOCK),
+                              s->cluster_size);
+
+    s->state = g_try_malloc0(MAX(s->nb_clusters, 1));
+    if (s->state == NULL) {
+        error_setg(errp, "Could not allocate cache state");
+        ret = -ENOMEM;
+        goto fail;
+    }
+    s->state_pending = hbitmap_alloc(s->nb_clusters, ctz32(CACHE_STATE_BLOCK));
+    s->dirty = hbitmap_alloc(s->nb_clusters, 0);
+
+    ret = cache_load_header(bs, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    /* Start writing back dirty data once the node is fully set up */
+    if (!bdrv_is_read_only(bs)) {
+        s->flusher_co = qemu_coroutine_create(cache_flusher_entry, bs);
+        aio_co_schedule(bdrv_get_aio_context(bs), s->flusher_co);
+    }
+
+    ret = 0;
+fail:
+    if (ret < 0) {
+        g_free(s->state);
+        if (s->state_pending) {
+            hbitmap_free(s->state_pending);
+        }
+        if (s->dirty) {
+            hbitmap_free(s->dirty);
+        }
+        if (s->cache_file) {
+            bdrv_unref_child(bs, s->cache_file);
+            s->cache_file = NULL;
+        }
+    }
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void cache_close(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+
+    s->stopping = true;
+    cache_wake_flusher(bs);
+    BDRV_POLL_WHILE(bs, s->flusher_co != NULL);
+
+    /* Record clusters that have been filled or written back */
+    if (!bdrv_is_read_only(bs)) {
+        cache_flush_state(bs);
+    }
+
+    g_free(s->state);
+    hbitmap_free(s->state_pending);
+    hbitmap_free(s->dirty);
+
+    bdrv_unref_child(bs, s->cache_file);
+    s->cache_file = NULL;
+}
+
+static int64_t cache_getlength(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+
+    return s->size;
+}
+
+static void coroutine_fn cache_co_drain_begin(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+
+    s->quiesce_counter++;
+}
+
+static void coroutine_fn cache_co_drain_end(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+
+    assert(s->quiesce_counter > 0);
+    if (--s->quiesce_counter == 0) {
+        cache_wake_flusher(bs);
+    }
+}
+
+static BlockDriver bdrv_cache = {
+    .format_name            = "cache",
+    .instance_size          = sizeof(BDRVCacheState),
+
+    .bdrv_open              = cache_open,
+    .bdrv_close             = cache_close,
+    .bdrv_child_perm        = bdrv_format_default_perms,
+    .bdrv_getlength         = cache_getlength,
+
+    .bdrv_co_preadv         = cache_co_preadv,
+    .bdrv_co_pwritev        = cache_co_pwritev,
+    .bdrv_co_flush          = cache_co_flush,
+
+    .bdrv_co_drain_begin    = cache_co_drain_begin,
+    .bdrv_co_drain_end      = cache_co_drain_end,
+};
+
+static void bdrv_cache_init(void)
+{
+    bdrv_register(&bdrv_cache);
+}
+
+block_init(bdrv_cache_init);
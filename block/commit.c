@@ -29,8 +29,13 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Upper limit for the max-workers option */
+    COMMIT_MAX_WORKERS = 64,
 };
 
+typedef struct CommitWorker CommitWorker;
+
 typedef struct CommitBlockJob {
     BlockJob common;
     BlockDriverState *commit_top_bs;
@@ -41,8 +46,23 @@ typedef struct CommitBlockJob {
     bool base_read_only;
     bool chain_frozen;
     char *backing_file_str;
+
+    /* Copy requests run in up to max_workers coroutines at a time */
+    int max_workers;
+    int nb_workers;
+    CoQueue worker_queue;
+    /* First error hit by a worker; its range is queued in @failed */
+    int worker_ret;
+    QSIMPLEQ_HEAD(, CommitWorker) failed;
 } CommitBlockJob;
 
+struct CommitWorker {
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    QSIMPLEQ_ENTRY(CommitWorker) next;
+};
+
 static int coroutine_fn commit_populate(BlockBackend *bs, BlockBackend *base,
                                         int64_t offset, uint64_t bytes,
                                         void *buf)
@@ -64,6 +84,50 @@ static int coroutine_fn commit_populate(BlockBackend *bs, BlockBackend *base,
     return 0;
 }
 
+static void coroutine_fn commit_worker_entry(void *opaque)
+{
+    CommitWorker *w = opaque;
+    CommitBlockJob *s = w->s;
+    void *buf;
+    int ret;
+
+    buf = blk_blockalign(s->top, w->bytes);
+    ret = commit_populate(s->top, s->base, w->offset, w->bytes, buf);
+    qemu_vfree(buf);
+    if (ret < 0) {
+        /* Keep the range around so that it can be retried */
+        if (!s->worker_ret) {
+            s->worker_ret = ret;
+        }
+        QSIMPLEQ_INSERT_TAIL(&s->failed, w, next);
+    } else {
+        job_progress_update(&s->common.job, w->bytes);
+        g_free(w);
+    }
+
+    s->nb_workers--;
+    qemu_co_queue_restart_all(&s->worker_queue);
+}
+
+static void coroutine_fn commit_start_worker(CommitBlockJob *s,
+                                             CommitWorker *w)
+{
+    Coroutine *co;
+
+    s->nb_workers++;
+    co = qemu_coroutine_create(commit_worker_entry, w);
+    qemu_coroutine_enter(co);
+}
+
+/* Wait until fewer than @max_workers copy requests are in flight */
+static void coroutine_fn commit_wait_for_workers(CommitBlockJob *s,
+                                                 int max_workers)
+{
+    while (s->nb_workers >= max_workers) {
+        qemu_co_queue_wait(&s->worker_queue, NULL);
+    }
+}
+
 static int commit_prepare(Job *job)
 {
     CommitBlockJob *s = container_of(job, CommitBlockJob, common.job);
@@ -139,9 +203,8 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
     uint64_t delay_ns = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    void *buf = NULL;
-    int bytes_written = 0;
     int64_t len, base_len;
+    CommitWorker *w;
 
     ret = len = blk_getlength(s->top);
     if (len < 0) {
@@ -161,51 +224,88 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
-
-    for (offset = 0; offset < len; offset += n) {
+    offset = 0;
+    while (true) {
         bool copy;
 
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
+        delay_ns = 0;
+
+        commit_wait_for_workers(s, s->max_workers);
+        if (s->worker_ret < 0 || offset >= len) {
+            commit_wait_for_workers(s, 1);
+        }
+
+        if (s->worker_ret < 0) {
+            BlockErrorAction action =
+                block_job_error_action(&s->common, false, s->on_error,
+                                       -s->worker_ret);
+            ret = s->worker_ret;
+            s->worker_ret = 0;
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                goto out;
+            }
+            /* Otherwise the failed ranges are retried */
+            continue;
+        }
+
+        w = QSIMPLEQ_FIRST(&s->failed);
+        if (w) {
+            QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+            commit_start_worker(s, w);
+            delay_ns = block_job_ratelimit_get_delay(&s->common, w->bytes);
+            continue;
+        }
+
+        if (offset >= len) {
+            break;
+        }
+
         /* Copy if allocated above the base */
         ret = bdrv_is_allocated_above(blk_bs(s->top), blk_bs(s->base), false,
                                       offset, COMMIT_BUFFER_SIZE, &n);
         copy = (ret == 1);
         trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = commit_populate(s->top, s->base, offset, n, buf);
-            bytes_written += n;
-        }
         if (ret < 0) {
             BlockErrorAction action =
                 block_job_error_action(&s->common, false, s->on_error, -ret);
             if (action == BLOCK_ERROR_ACTION_REPORT) {
                 goto out;
             } else {
-                n = 0;
                 continue;
             }
         }
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
 
         if (copy) {
+            /* Progress is published once the copy has completed */
+            w = g_new(CommitWorker, 1);
+            *w = (CommitWorker) {
+                .s      = s,
+                .offset = offset,
+                .bytes  = n,
+            };
+            commit_start_worker(s, w);
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
-            delay_ns = 0;
+            job_progress_update(&s->common.job, n);
         }
+        offset += n;
     }
 
     ret = 0;
 
 out:
-    qemu_vfree(buf);
+    commit_wait_for_workers(s, 1);
+    while ((w = QSIMPLEQ_FIRST(&s->failed))) {
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(w);
+    }
 
     return ret;
 }
@@ -257,7 +357,7 @@ static BlockDriver bdrv_commit_top = {
 
 void commit_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, BlockDriverState *top,
-                  int creation_flags, int64_t speed,
+                  int creation_flags, int64_t speed, int max_workers,
                   BlockdevOnError on_error, const char *backing_file_str,
                   const char *filter_node_name, Error **errp)
 {
@@ -268,6 +368,11 @@ void commit_start(const char *job_id, BlockDriverState *bs,
     int ret;
 
     assert(top != bs);
+    if (max_workers < 0 || max_workers > COMMIT_MAX_WORKERS) {
+        error_setg(errp, "max-workers must be between 1 and %d",
+                   COMMIT_MAX_WORKERS);
+        return;
+    }
     if (top == base) {
         error_setg(errp, "Invalid files for merge: top and base are the same");
         return;
@@ -362,6 +467,9 @@ void commit_start(const char *job_id, BlockDriverState *bs,
 
     s->backing_file_str = g_strdup(backing_file_str);
     s->on_error = on_error;
+    s->max_workers = max_workers ?: 1;
+    qemu_co_queue_init(&s->worker_queue);
+    QSIMPLEQ_INIT(&s->failed);
 
     trace_commit_start(bs, base, top, s);
     job_start(&s->common.job);
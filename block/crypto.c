@@ -22,6 +22,7 @@
 
 #include "block/block_int.h"
 #include "block/qdict.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -34,8 +35,18 @@
 
 typedef struct BlockCrypto BlockCrypto;
 
+/* Number of encryption or decryption jobs that can run in parallel */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
+/* Bounce buffers are not split into slices smaller than this */
+#define BLOCK_CRYPTO_MIN_SLICE_SIZE (64 * 1024)
+
 struct BlockCrypto {
     QCryptoBlock *block;
+
+    /* Encryption and decryption jobs running in the thread pool */
+    int nb_threads;
+    CoQueue thread_task_queue;
 };
 
 
@@ -231,7 +242,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
-                                       1,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -240,6 +251,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     }
 
     bs->encrypted = true;
+    qemu_co_queue_init(&crypto->thread_task_queue);
 
     ret = 0;
  cleanup:
@@ -333,6 +345,114 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+/*
+ * BlockCryptoEncDecFunc: common prototype of qcrypto_block_encrypt() and
+ * qcrypto_block_decrypt() functions.
+ */
+typedef int (*BlockCryptoEncDecFunc)(QCryptoBlock *block, uint64_t offset,
+                                     uint8_t *buf, size_t len, Error **errp);
+
+typedef struct BlockCryptoEncDecData {
+    BlockDriverState *bs;
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    BlockCryptoEncDecFunc func;
+
+    /* Shared by all the slices of one request */
+    Coroutine *parent;
+    int *pending;
+    int *ret;
+} BlockCryptoEncDecData;
+
+static int block_crypto_encdec_pool_func(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+
+    return data->func(data->block, data->offset, data->buf, data->len, NULL);
+}
+
+static void coroutine_fn block_crypto_encdec_entry(void *opaque)
+{
+    BlockCryptoEncDecData *data = opaque;
+    BlockCrypto *crypto = data->bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(data->bs));
+    int ret;
+
+    /* Each job needs one of the ciphers allocated by qcrypto_block_open() */
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, NULL);
+    }
+    crypto->nb_threads++;
+
+    ret = thread_pool_submit_co(pool, block_crypto_encdec_pool_func, data);
+
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+
+    if (ret < 0) {
+        *data->ret = -EIO;
+    }
+    if (--*data->pending == 0) {
+        aio_co_wake(data->parent);
+    }
+}
+
+/*
+ * Encrypt or decrypt @len bytes of @buf in the thread pool, so that the
+ * AioContext keeps running meanwhile. The buffer is split into sector
+ * aligned slices that are processed in parallel.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset,
+                       uint8_t *buf, size_t len, BlockCryptoEncDecFunc func)
+{
+    BlockCrypto *crypto = bs->opaque;
+    uint64_t sector_size = qcrypto_block_get_sector_size(crypto->block);
+    BlockCryptoEncDecData data[BLOCK_CRYPTO_MAX_THREADS];
+    size_t slice_size, done;
+    int pending = 0;
+    int ret = 0;
+    int i, n;
+
+    assert(QEMU_IS_ALIGNED(offset, sector_size));
+    assert(QEMU_IS_ALIGNED(len, sector_size));
+
+    slice_size = MAX(BLOCK_CRYPTO_MIN_SLICE_SIZE,
+                     DIV_ROUND_UP(len, BLOCK_CRYPTO_MAX_THREADS));
+    slice_size = ROUND_UP(slice_size, sector_size);
+
+    for (n = 0, done = 0; done < len; n++, done += slice_size) {
+        data[n] = (BlockCryptoEncDecData) {
+            .bs         = bs,
+            .block      = crypto->block,
+            .offset     = offset + done,
+            .buf        = buf + done,
+            .len        = MIN(slice_size, len - done),
+            .func       = func,
+            .parent     = qemu_coroutine_self(),
+            .pending    = &pending,
+            .ret        = &ret,
+        };
+    }
+    assert(n <= BLOCK_CRYPTO_MAX_THREADS);
+
+    /* Count all slices first so that none of them wakes us up early */
+    pending = n;
+    for (i = 0; i < n; i++) {
+        Coroutine *co = qemu_coroutine_create(block_crypto_encdec_entry,
+                                              &data[i]);
+        qemu_coroutine_enter(co);
+    }
+
+    while (pending) {
+        qemu_coroutine_yield();
+    }
+
+    return ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -376,9 +496,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done, cipher_data,
+                                     cur_bytes, qcrypto_block_decrypt);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -432,9 +552,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done, cipher_data,
+                                     cur_bytes, qcrypto_block_encrypt);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -33,6 +33,7 @@
 #include "crypto/secret.h"
 #include <curl/curl.h>
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
 #include "trace.h"
 
 // #define DEBUG_VERBOSE
@@ -74,11 +75,22 @@ static CURLMcode __curl_multi_socket_action(CURLM *multi_handle,
 #define CURL_BLOCK_OPT_PASSWORD_SECRET "password-secret"
 #define CURL_BLOCK_OPT_PROXY_USERNAME "proxy-username"
 #define CURL_BLOCK_OPT_PROXY_PASSWORD_SECRET "proxy-password-secret"
+#define CURL_BLOCK_OPT_CACHE_DIR "cache-dir"
 
 #define CURL_BLOCK_OPT_READAHEAD_DEFAULT (256 * 1024)
 #define CURL_BLOCK_OPT_SSLVERIFY_DEFAULT true
 #define CURL_BLOCK_OPT_TIMEOUT_DEFAULT 5
 
+/* Granularity of the on-disk cache */
+#define CURL_CACHE_BLOCK_SIZE (64 * 1024)
+#define CURL_CACHE_MAGIC "QCURLMAP"
+
+typedef struct CURLCacheHeader {
+    char magic[8];
+    uint64_t len;
+    uint64_t block_size;
+} QEMU_PACKED CURLCacheHeader;
+
 struct BDRVCURLState;
 struct CURLState;
 
@@ -135,6 +147,15 @@ typedef struct BDRVCURLState {
     char *password;
     char *proxyusername;
     char *proxypassword;
+
+    /* Entity tag of the image, as reported by the server */
+    char *etag;
+
+    /* On-disk cache, see curl_cache_open(); cache_fd is -1 if disabled */
+    int cache_fd;
+    char *cache_map_path;
+    unsigned long *cache_map;
+    uint64_t cache_blocks;
 } BDRVCURLState;
 
 static void curl_clean_state(CURLState *s);
@@ -215,12 +236,25 @@ static size_t curl_header_cb(void *ptr, size_t size, size_t nmemb, void *opaque)
     BDRVCURLState *s = opaque;
     size_t realsize = size * nmemb;
     const char *accept_line = "Accept-Ranges: bytes";
+    const char *etag_line = "ETag:";
 
     if (realsize >= strlen(accept_line)
         && strncmp((char *)ptr, accept_line, strlen(accept_line)) == 0) {
         s->accept_range = true;
     }
 
+    /* With redirects there is a header block per response; keep the last */
+    if (realsize > strlen(etag_line)
+        && strncasecmp((char *)ptr, etag_line, strlen(etag_line)) == 0) {
+        g_free(s->etag);
+        s->etag = g_strstrip(g_strndup((char *)ptr + strlen(etag_line),
+                                       realsize - strlen(etag_line)));
+        if (!*s->etag) {
+            g_free(s->etag);
+            s->etag = NULL;
+        }
+    }
+
     return realsize;
 }
 
@@ -249,6 +283,167 @@ read_end:
     return size * nmemb;
 }
 
+/*
+ * The on-disk cache is a sparse file with the contents of the image, named
+ * after a hash of the URL and the ETag so that a changed image never hits
+ * stale data, and a map of the CURL_CACHE_BLOCK_SIZE blocks that are valid.
+ * The map is only written back by curl_cache_close(), after the data has
+ * been flushed, so an unclean shutdown loses the map but never leaves it
+ * pointing to blocks that were not written.
+ */
+static void curl_cache_open(BDRVCURLState *s, const char *cache_dir)
+{
+    char *key_str, *key, *path;
+    gchar *map_data = NULL;
+    gsize map_size;
+    size_t map_bytes;
+
+    if (!s->etag) {
+        warn_report("curl: server did not report an ETag for '%s', "
+                    "not using the cache", s->url);
+        return;
+    }
+
+    key_str = g_strdup_printf("%s\n%s", s->url, s->etag);
+    key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key_str, -1);
+    path = g_strdup_printf("%s/%s", cache_dir, key);
+    s->cache_map_path = g_strdup_printf("%s.map", path);
+    g_free(key_str);
+    g_free(key);
+
+    s->cache_fd = qemu_open(path, O_RDWR | O_CREAT | O_BINARY, 0600);
+    if (s->cache_fd < 0 || ftruncate(s->cache_fd, s->len) < 0) {
+        warn_report("curl: cannot use cache file '%s': %s",
+                    path, strerror(errno));
+        goto fail;
+    }
+    g_free(path);
+
+    s->cache_blocks = DIV_ROUND_UP(s->len, CURL_CACHE_BLOCK_SIZE);
+    s->cache_map = bitmap_new(s->cache_blocks);
+    map_bytes = BITS_TO_LONGS(s->cache_blocks) * sizeof(unsigned long);
+
+    if (g_file_get_contents(s->cache_map_path, &map_data, &map_size, NULL)) {
+        CURLCacheHeader *h = (CURLCacheHeader *)map_data;
+
+        if (map_size == sizeof(*h) + map_bytes &&
+            !memcmp(h->magic, CURL_CACHE_MAGIC, sizeof(h->magic)) &&
+            h->len == s->len && h->block_size == CURL_CACHE_BLOCK_SIZE) {
+            memcpy(s->cache_map, h + 1, map_bytes);
+        }
+        g_free(map_data);
+    }
+
+    /* The map is stale as soon as we start writing to the cache */
+    unlink(s->cache_map_path);
+    return;
+
+fail:
+    if (s->cache_fd >= 0) {
+        qemu_close(s->cache_fd);
+        s->cache_fd = -1;
+    }
+    g_free(path);
+    g_free(s->cache_map_path);
+    s->cache_map_path = NULL;
+}
+
+static void curl_cache_close(BDRVCURLState *s)
+{
+    size_t map_bytes = BITS_TO_LONGS(s->cache_blocks) * sizeof(unsigned long);
+    CURLCacheHeader *h;
+    GError *err = NULL;
+
+    if (s->cache_fd < 0) {
+        return;
+    }
+
+    if (qemu_fdatasync(s->cache_fd) == 0) {
+        h = g_malloc(sizeof(*h) + map_bytes);
+        memcpy(h->magic, CURL_CACHE_MAGIC, sizeof(h->magic));
+        h->len = s->len;
+        h->block_size = CURL_CACHE_BLOCK_SIZE;
+        memcpy(h + 1, s->cache_map, map_bytes);
+        if (!g_file_set_contents(s->cache_map_path, (gchar *)h,
+                                 sizeof(*h) + map_bytes, &err)) {
+            warn_report("curl: cannot write cache map: %s", err->message);
+            g_error_free(err);
+        }
+        g_free(h);
+    }
+
+    qemu_close(s->cache_fd);
+    s->cache_fd = -1;
+    g_free(s->cache_map);
+    s->cache_map = NULL;
+    g_free(s->cache_map_path);
+    s->cache_map_path = NULL;
+}
+
+/* Called with s->mutex held.  */
+static bool curl_cache_read(BDRVCURLState *s, uint64_t start, uint64_t len,
+                            CURLAIOCB *acb)
+{
+    uint64_t clamped_len = MIN(start + len, s->len) - start;
+    uint64_t first = start / CURL_CACHE_BLOCK_SIZE;
+    uint64_t last = DIV_ROUND_UP(start + clamped_len, CURL_CACHE_BLOCK_SIZE);
+    char *buf;
+
+    if (s->cache_fd < 0 || !clamped_len ||
+        find_next_zero_bit(s->cache_map, last, first) < last) {
+        return false;
+    }
+
+    buf = g_try_malloc(clamped_len);
+    if (!buf) {
+        return false;
+    }
+    if (pread(s->cache_fd, buf, clamped_len, start) != (ssize_t)clamped_len) {
+        g_free(buf);
+        return false;
+    }
+
+    qemu_iovec_from_buf(acb->qiov, 0, buf, clamped_len);
+    if (clamped_len < len) {
+        qemu_iovec_memset(acb->qiov, clamped_len, 0, len - clamped_len);
+    }
+    g_free(buf);
+    trace_curl_cache_read(start, clamped_len);
+    acb->ret = 0;
+    return true;
+}
+
+/* Store the complete cache blocks that a finished transfer has fetched.
+ * Called with s->mutex held.
+ */
+static void curl_cache_store(BDRVCURLState *s, CURLState *state)
+{
+    uint64_t start = state->buf_start;
+    uint64_t end = start + state->buf_off;
+    uint64_t first = DIV_ROUND_UP(start, CURL_CACHE_BLOCK_SIZE);
+    uint64_t last = end >= s->len ? s->cache_blocks
+                                  : end / CURL_CACHE_BLOCK_SIZE;
+    uint64_t i;
+
+    if (s->cache_fd < 0) {
+        return;
+    }
+
+    for (i = first; i < last; i++) {
+        uint64_t offset = i * CURL_CACHE_BLOCK_SIZE;
+        size_t n = MIN(CURL_CACHE_BLOCK_SIZE, s->len - offset);
+
+        if (test_bit(i, s->cache_map)) {
+            continue;
+        }
+        if (pwrite(s->cache_fd, state->orig_buf + (offset - start), n,
+                   offset) != (ssize_t)n) {
+            break;
+        }
+        set_bit(i, s->cache_map);
+    }
+}
+
 /* Called with s->mutex held.  */
 static bool curl_find_buf(BDRVCURLState *s, uint64_t start, uint64_t len,
                           CURLAIOCB *acb)
@@ -345,6 +540,10 @@ static void curl_multi_check_completion(BDRVCURLState *s)
                 }
             }
 
+            if (!error) {
+                curl_cache_store(s, state);
+            }
+
             for (i = 0; i < CURL_NUM_ACB; i++) {
                 CURLAIOCB *acb = state->acb[i];
 
@@ -468,6 +667,15 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
         curl_easy_setopt(state->curl, CURLOPT_NOSIGNAL, 1);
         curl_easy_setopt(state->curl, CURLOPT_ERRORBUFFER, state->errmsg);
         curl_easy_setopt(state->curl, CURLOPT_FAILONERROR, 1);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        /* Since 7.47.0; lets all states share one HTTP/2 connection */
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+        /* Since 7.43.0; wait for a connection that can multiplex */
+        curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
 
         if (s->username) {
             curl_easy_setopt(state->curl, CURLOPT_USERNAME, s->username);
@@ -574,6 +782,9 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     s->multi = curl_multi_init();
     s->aio_context = new_context;
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #ifdef NEED_CURL_TIMER_CALLBACK
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
@@ -634,6 +845,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of secret used as password for HTTP proxy auth",
         },
+        {
+            .name = CURL_BLOCK_OPT_CACHE_DIR,
+            .type = QEMU_OPT_STRING,
+            .help = "Directory for a persistent cache of the image contents",
+        },
         { /* end of list */ }
     },
 };
@@ -652,6 +868,7 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     double d;
     const char *secretid;
     const char *protocol_delimiter;
+    const char *cache_dir;
     int ret;
 
     ret = bdrv_apply_auto_read_only(bs, "curl driver does not support writes",
@@ -670,6 +887,7 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     qemu_mutex_init(&s->mutex);
+    s->cache_fd = -1;
     opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &local_err);
     if (local_err) {
@@ -809,6 +1027,11 @@ static int curl_open(BlockDriverState *bs, QDict *options, int flags,
     curl_easy_cleanup(state->curl);
     state->curl = NULL;
 
+    cache_dir = qemu_opt_get(opts, CURL_BLOCK_OPT_CACHE_DIR);
+    if (cache_dir) {
+        curl_cache_open(s, cache_dir);
+    }
+
     curl_attach_aio_context(bs, bdrv_get_aio_context(bs));
 
     qemu_opts_del(opts);
@@ -825,6 +1048,7 @@ out_noclean:
     g_free(s->username);
     g_free(s->proxyusername);
     g_free(s->proxypassword);
+    g_free(s->etag);
     qemu_opts_del(opts);
     return -EINVAL;
 }
@@ -847,6 +1071,11 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
         goto out;
     }
 
+    // Or maybe a previous run of QEMU has it in the on-disk cache
+    if (curl_cache_read(s, start, acb->bytes, acb)) {
+        goto out;
+    }
+
     // No cache found, so let's start a new request
     for (;;) {
         state = curl_find_state(s);
@@ -921,6 +1150,7 @@ static void curl_close(BlockDriverState *bs)
 
     trace_curl_close();
     curl_detach_aio_context(bs);
+    curl_cache_close(s);
     qemu_mutex_destroy(&s->mutex);
 
     g_free(s->cookie);
@@ -928,6 +1158,7 @@ static void curl_close(BlockDriverState *bs)
     g_free(s->username);
     g_free(s->proxyusername);
     g_free(s->proxypassword);
+    g_free(s->etag);
 }
 
 static int64_t curl_getlength(BlockDriverState *bs)
@@ -28,6 +28,7 @@
 #include "block/blockjob.h"
 
 struct BdrvDirtyBitmap {
+    BlockDriverState *bs;
     QemuMutex *mutex;
     HBitmap *bitmap;            /* Dirty bitmap implementation */
     HBitmap *meta;              /* Meta dirty bitmap */
@@ -51,6 +52,11 @@ struct BdrvDirtyBitmap {
     bool skip_store;            /* We are either migrating or deleting this
                                  * bitmap; it should not be stored on the next
                                  * inactivation. */
+    bool lazy;                  /* bitmap is persistent and its stored data
+                                   has not been read yet.  Only bits set since
+                                   the image was opened are in memory; call
+                                   bdrv_load_dirty_bitmap() before using the
+                                   contents. */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -59,24 +65,33 @@ struct BdrvDirtyBitmapIter {
     BdrvDirtyBitmap *bitmap;
 };
 
+/* Taking the dirty bitmap lock also waits for lock-free writers in
+ * bdrv_set_dirty() and keeps new ones out until the lock is released.
+ */
 static inline void bdrv_dirty_bitmaps_lock(BlockDriverState *bs)
 {
     qemu_mutex_lock(&bs->dirty_bitmap_mutex);
+    atomic_set(&bs->dirty_bitmap_locked, true);
+    smp_mb();
+    while (atomic_read(&bs->dirty_bitmap_writers)) {
+        cpu_relax();
+    }
 }
 
 static inline void bdrv_dirty_bitmaps_unlock(BlockDriverState *bs)
 {
+    atomic_store_release(&bs->dirty_bitmap_locked, false);
     qemu_mutex_unlock(&bs->dirty_bitmap_mutex);
 }
 
 void bdrv_dirty_bitmap_lock(BdrvDirtyBitmap *bitmap)
 {
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
 }
 
 void bdrv_dirty_bitmap_unlock(BdrvDirtyBitmap *bitmap)
 {
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
 }
 
 /* Called with BQL or dirty_bitmap lock taken.  */
@@ -115,6 +130,7 @@ BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
         return NULL;
     }
     bitmap = g_new0(BdrvDirtyBitmap, 1);
+    bitmap->bs = bs;
     bitmap->mutex = &bs->dirty_bitmap_mutex;
     bitmap->bitmap = hbitmap_alloc(bitmap_size, ctz32(granularity));
     bitmap->size = bitmap_size;
@@ -141,19 +157,56 @@ void bdrv_create_meta_dirty_bitmap(BdrvDirtyBitmap *bitmap,
                                    int chunk_size)
 {
     assert(!bitmap->meta);
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     bitmap->meta = hbitmap_create_meta(bitmap->bitmap,
                                        chunk_size * BITS_PER_BYTE);
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 void bdrv_release_meta_dirty_bitmap(BdrvDirtyBitmap *bitmap)
 {
     assert(bitmap->meta);
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     hbitmap_free_meta(bitmap->bitmap);
     bitmap->meta = NULL;
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
+}
+
+bool bdrv_dirty_bitmap_has_meta(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->meta;
+}
+
+/* Called within bdrv_dirty_bitmap_lock..unlock */
+static void bdrv_dirty_bitmap_set_meta_all(BdrvDirtyBitmap *bitmap)
+{
+    if (bitmap->meta && bitmap->size) {
+        hbitmap_set(bitmap->meta, 0, bitmap->size);
+    }
+}
+
+/*
+ * Replace the HBitmap of @bitmap with @hb and return the old one.  A meta
+ * bitmap moves over to @hb, with all bits set because the contents may be
+ * completely different now.
+ * Called within bdrv_dirty_bitmap_lock..unlock
+ */
+static HBitmap *bdrv_dirty_bitmap_replace_hbitmap(BdrvDirtyBitmap *bitmap,
+                                                  HBitmap *hb)
+{
+    HBitmap *old = bitmap->bitmap;
+
+    if (bitmap->meta) {
+        int chunk_size = 1 << (hbitmap_granularity(bitmap->meta) -
+                               hbitmap_granularity(old));
+
+        hbitmap_free_meta(old);
+        bitmap->meta = hbitmap_create_meta(hb, chunk_size);
+    }
+    bitmap->bitmap = hb;
+    bdrv_dirty_bitmap_set_meta_all(bitmap);
+
+    return old;
 }
 
 int64_t bdrv_dirty_bitmap_size(const BdrvDirtyBitmap *bitmap)
@@ -179,9 +232,9 @@ static bool bdrv_dirty_bitmap_busy(const BdrvDirtyBitmap *bitmap)
 
 void bdrv_dirty_bitmap_set_busy(BdrvDirtyBitmap *bitmap, bool busy)
 {
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     bitmap->busy = busy;
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 /* Called with BQL taken.  */
@@ -308,9 +361,9 @@ void bdrv_enable_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap)
 void bdrv_dirty_bitmap_enable_successor(BdrvDirtyBitmap *bitmap)
 {
     assert(bitmap->mutex == bitmap->successor->mutex);
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     bdrv_enable_dirty_bitmap_locked(bitmap->successor);
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 /* Called within bdrv_dirty_bitmap_lock..unlock and with BQL taken.  */
@@ -319,7 +372,9 @@ static void bdrv_release_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap)
     assert(!bitmap->active_iterators);
     assert(!bdrv_dirty_bitmap_busy(bitmap));
     assert(!bdrv_dirty_bitmap_has_successor(bitmap));
-    assert(!bitmap->meta);
+    if (bitmap->meta) {
+        hbitmap_free_meta(bitmap->bitmap);
+    }
     QLIST_REMOVE(bitmap, list);
     hbitmap_free(bitmap->bitmap);
     g_free(bitmap->name);
@@ -378,6 +433,7 @@ BdrvDirtyBitmap *bdrv_reclaim_dirty_bitmap_locked(BlockDriverState *bs,
         error_setg(errp, "Merging of parent and successor bitmap failed");
         return NULL;
     }
+    bdrv_dirty_bitmap_set_meta_all(parent);
 
     parent->disabled = successor->disabled;
     parent->busy = false;
@@ -394,9 +450,9 @@ BdrvDirtyBitmap *bdrv_reclaim_dirty_bitmap(BlockDriverState *bs,
 {
     BdrvDirtyBitmap *ret;
 
-    qemu_mutex_lock(parent->mutex);
+    bdrv_dirty_bitmap_lock(parent);
     ret = bdrv_reclaim_dirty_bitmap_locked(bs, parent, errp);
-    qemu_mutex_unlock(parent->mutex);
+    bdrv_dirty_bitmap_unlock(parent);
 
     return ret;
 }
@@ -484,6 +540,11 @@ BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
     BlockDirtyInfoList *list = NULL;
     BlockDirtyInfoList **plist = &list;
 
+    /* Counts are only meaningful with the stored data; errors show up later */
+    aio_context_acquire(bdrv_get_aio_context(bs));
+    bdrv_load_dirty_bitmaps(bs, NULL);
+    aio_context_release(bdrv_get_aio_context(bs));
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
         BlockDirtyInfo *info = g_new0(BlockDirtyInfo, 1);
@@ -619,20 +680,22 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
     bdrv_dirty_bitmap_lock(bitmap);
     if (!out) {
         hbitmap_reset_all(bitmap->bitmap);
+        bdrv_dirty_bitmap_set_meta_all(bitmap);
     } else {
-        HBitmap *backup = bitmap->bitmap;
-        bitmap->bitmap = hbitmap_alloc(bitmap->size,
-                                       hbitmap_granularity(backup));
-        *out = backup;
+        HBitmap *hb = hbitmap_alloc(bitmap->size,
+                                    hbitmap_granularity(bitmap->bitmap));
+        *out = bdrv_dirty_bitmap_replace_hbitmap(bitmap, hb);
     }
     bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 void bdrv_restore_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *backup)
 {
-    HBitmap *tmp = bitmap->bitmap;
+    HBitmap *tmp;
     assert(!bdrv_dirty_bitmap_readonly(bitmap));
-    bitmap->bitmap = backup;
+    bdrv_dirty_bitmap_lock(bitmap);
+    tmp = bdrv_dirty_bitmap_replace_hbitmap(bitmap, backup);
+    bdrv_dirty_bitmap_unlock(bitmap);
     hbitmap_free(tmp);
 }
 
@@ -654,6 +717,23 @@ void bdrv_dirty_bitmap_serialize_part(const BdrvDirtyBitmap *bitmap,
     hbitmap_serialize_part(bitmap->bitmap, buf, offset, bytes);
 }
 
+/**
+ * Like bdrv_dirty_bitmap_serialize_part(), but also reset the range in the
+ * meta bitmap, so that changes made after the data was taken mark it dirty
+ * again.  If the data cannot be written out, the meta bitmap no longer says
+ * what differs from the stored copy and should be released.
+ */
+void bdrv_dirty_bitmap_serialize_changed_part(BdrvDirtyBitmap *bitmap,
+                                              uint8_t *buf, uint64_t offset,
+                                              uint64_t bytes)
+{
+    assert(bitmap->meta);
+    bdrv_dirty_bitmap_lock(bitmap);
+    hbitmap_reset(bitmap->meta, offset, bytes);
+    hbitmap_serialize_part(bitmap->bitmap, buf, offset, bytes);
+    bdrv_dirty_bitmap_unlock(bitmap);
+}
+
 void bdrv_dirty_bitmap_deserialize_part(BdrvDirtyBitmap *bitmap,
                                         uint8_t *buf, uint64_t offset,
                                         uint64_t bytes, bool finish)
@@ -688,6 +768,27 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         return;
     }
 
+#ifdef CONFIG_ATOMIC64
+    /* Setting bits is the hot path, so concurrent writers only use atomic
+     * operations on the bitmaps.  Structural changes and all other bitmap
+     * updates still take the lock, which waits for the writers to leave.
+     * atomic_inc() is a full barrier, pairing with bdrv_dirty_bitmaps_lock().
+     */
+    atomic_inc(&bs->dirty_bitmap_writers);
+    if (!atomic_read(&bs->dirty_bitmap_locked)) {
+        QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+            if (!bdrv_dirty_bitmap_enabled(bitmap)) {
+                continue;
+            }
+            assert(!bdrv_dirty_bitmap_readonly(bitmap));
+            hbitmap_set_atomic(bitmap->bitmap, offset, bytes);
+        }
+        atomic_dec(&bs->dirty_bitmap_writers);
+        return;
+    }
+    atomic_dec(&bs->dirty_bitmap_writers);
+#endif
+
     bdrv_dirty_bitmaps_lock(bs);
     QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
         if (!bdrv_dirty_bitmap_enabled(bitmap)) {
@@ -725,9 +826,9 @@ bool bdrv_dirty_bitmap_readonly(const BdrvDirtyBitmap *bitmap)
 /* Called with BQL taken. */
 void bdrv_dirty_bitmap_set_readonly(BdrvDirtyBitmap *bitmap, bool value)
 {
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     bitmap->readonly = value;
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 bool bdrv_has_readonly_bitmaps(BlockDriverState *bs)
@@ -745,27 +846,107 @@ bool bdrv_has_readonly_bitmaps(BlockDriverState *bs)
 /* Called with BQL taken. */
 void bdrv_dirty_bitmap_set_persistence(BdrvDirtyBitmap *bitmap, bool persistent)
 {
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     bitmap->persistent = persistent;
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
+}
+
+/* Called with BQL taken. */
+void bdrv_dirty_bitmap_set_lazy(BdrvDirtyBitmap *bitmap, bool lazy)
+{
+    bdrv_dirty_bitmap_lock(bitmap);
+    bitmap->lazy = lazy;
+    bdrv_dirty_bitmap_unlock(bitmap);
+}
+
+bool bdrv_dirty_bitmap_lazy(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->lazy;
+}
+
+/**
+ * Read the stored data of a lazily loaded persistent bitmap and merge it
+ * into the in-memory bitmap, keeping the bits set by writes that happened
+ * in the meantime.  Does nothing if the data is already present.
+ *
+ * Called with BQL taken.
+ */
+int bdrv_load_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                           Error **errp)
+{
+    BdrvDirtyBitmap *tmp;
+    int ret;
+
+    if (!bitmap->lazy) {
+        return 0;
+    }
+
+    assert(bs->drv && bs->drv->bdrv_load_dirty_bitmap_data);
+
+    tmp = bdrv_create_dirty_bitmap(bs, bdrv_dirty_bitmap_granularity(bitmap),
+                                   NULL, errp);
+    if (!tmp) {
+        return -ENOMEM;
+    }
+    /* Keep writes from being recorded twice while we read the data */
+    bdrv_disable_dirty_bitmap(tmp);
+
+    ret = bs->drv->bdrv_load_dirty_bitmap_data(bs, bitmap, tmp, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    bdrv_dirty_bitmap_lock(bitmap);
+    if (bitmap->lazy) {
+        /*
+         * The merged bits are the stored ones, so they leave the meta
+         * bitmap alone: it keeps tracking what differs from the image.
+         */
+        hbitmap_merge(bitmap->bitmap, tmp->bitmap, bitmap->bitmap);
+        bitmap->lazy = false;
+    }
+    bdrv_dirty_bitmap_unlock(bitmap);
+
+out:
+    bdrv_release_dirty_bitmap(bs, tmp);
+    return ret;
+}
+
+/**
+ * Read the stored data of all lazily loaded bitmaps of @bs.
+ * Called with BQL taken.
+ */
+int bdrv_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
+{
+    BdrvDirtyBitmap *bm;
+    int ret;
+
+    QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
+        ret = bdrv_load_dirty_bitmap(bs, bm, errp);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
 }
 
 /* Called with BQL taken. */
 void bdrv_dirty_bitmap_set_inconsistent(BdrvDirtyBitmap *bitmap)
 {
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     assert(bitmap->persistent == true);
     bitmap->inconsistent = true;
     bitmap->disabled = true;
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 /* Called with BQL taken. */
 void bdrv_dirty_bitmap_skip_store(BdrvDirtyBitmap *bitmap, bool skip)
 {
-    qemu_mutex_lock(bitmap->mutex);
+    bdrv_dirty_bitmap_lock(bitmap);
     bitmap->skip_store = skip;
-    qemu_mutex_unlock(bitmap->mutex);
+    bdrv_dirty_bitmap_unlock(bitmap);
 }
 
 bool bdrv_dirty_bitmap_get_persistence(BdrvDirtyBitmap *bitmap)
@@ -825,9 +1006,9 @@ void bdrv_merge_dirty_bitmap(BdrvDirtyBitmap *dest, const BdrvDirtyBitmap *src,
 {
     bool ret;
 
-    qemu_mutex_lock(dest->mutex);
+    bdrv_dirty_bitmap_lock(dest);
     if (src->mutex != dest->mutex) {
-        qemu_mutex_lock(src->mutex);
+        bdrv_dirty_bitmap_lock(src);
     }
 
     if (bdrv_dirty_bitmap_check(dest, BDRV_BITMAP_DEFAULT, errp)) {
@@ -847,9 +1028,9 @@ void bdrv_merge_dirty_bitmap(BdrvDirtyBitmap *dest, const BdrvDirtyBitmap *src,
     assert(ret);
 
 out:
-    qemu_mutex_unlock(dest->mutex);
+    bdrv_dirty_bitmap_unlock(dest);
     if (src->mutex != dest->mutex) {
-        qemu_mutex_unlock(src->mutex);
+        bdrv_dirty_bitmap_unlock(src);
     }
 }
 
@@ -873,24 +1054,27 @@ bool bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
     assert(!bdrv_dirty_bitmap_inconsistent(src));
 
     if (lock) {
-        qemu_mutex_lock(dest->mutex);
+        bdrv_dirty_bitmap_lock(dest);
         if (src->mutex != dest->mutex) {
-            qemu_mutex_lock(src->mutex);
+            bdrv_dirty_bitmap_lock(src);
         }
     }
 
     if (backup) {
-        *backup = dest->bitmap;
-        dest->bitmap = hbitmap_alloc(dest->size, hbitmap_granularity(*backup));
+        HBitmap *hb = hbitmap_alloc(dest->size,
+                                    hbitmap_granularity(dest->bitmap));
+
+        *backup = bdrv_dirty_bitmap_replace_hbitmap(dest, hb);
         ret = hbitmap_merge(*backup, src->bitmap, dest->bitmap);
     } else {
         ret = hbitmap_merge(dest->bitmap, src->bitmap, dest->bitmap);
+        bdrv_dirty_bitmap_set_meta_all(dest);
     }
 
     if (lock) {
-        qemu_mutex_unlock(dest->mutex);
+        bdrv_dirty_bitmap_unlock(dest);
         if (src->mutex != dest->mutex) {
-            qemu_mutex_unlock(src->mutex);
+            bdrv_dirty_bitmap_unlock(src);
         }
     }
 
@@ -103,6 +103,10 @@
 #include <xfs/xfs.h>
 #endif
 
+#ifdef CONFIG_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #include "trace.h"
 
 /* OS X does not have O_DSYNC */
@@ -124,11 +128,31 @@
 
 #define MAX_BLOCKSIZE	4096
 
+#define RAW_SG_MAX_QUEUE_DEPTH  1024
+
 /* Posix file locking bytes. Libvirt takes byte 0, we start from higher bytes,
  * leaving a few more bytes for its future use. */
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+typedef struct RawDiscardReq {
+    int64_t offset;
+    int64_t bytes;
+    Coroutine *co;
+    int ret;
+    bool done;
+    QSIMPLEQ_ENTRY(RawDiscardReq) next;
+} RawDiscardReq;
+
+#if defined(__linux__)
+/* Extra /dev/sg descriptor used for asynchronous SG_IO */
+typedef struct RawSgFd {
+    BlockDriverState *bs;
+    int fd;
+    unsigned int inflight;
+} RawSgFd;
+#endif
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -156,6 +180,7 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool discard_zeroes:1;
     bool use_linux_aio:1;
+    bool use_linux_io_uring:1;
     bool page_cache_inconsistent:1;
     bool has_fallocate;
     bool needs_alignment;
@@ -163,6 +188,20 @@ typedef struct BDRVRawState {
     bool check_cache_dropped;
 
     PRManager *pr_mgr;
+
+    /* Discards waiting to be merged into the next batch */
+    QSIMPLEQ_HEAD(, RawDiscardReq) discard_queue;
+    bool discard_batch_pending;
+    int64_t discard_window_ns;
+
+#if defined(__linux__)
+    /* SCSI generic commands sent with write()/read(), see hdev_co_sg_io() */
+    uint32_t sg_queue_depth;
+    uint32_t sg_inflight;
+    RawSgFd *sg_fds;
+    int sg_nfds;
+    CoQueue sg_queue;
+#endif
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -196,6 +235,9 @@ typedef struct RawPosixAIOData {
             int aio_fd2;
             off_t aio_offset2;
         } copy_range;
+        struct {
+            int out_fd;
+        } sendfile;
         struct {
             PreallocMode prealloc;
             Error **errp;
@@ -439,7 +481,7 @@ static QemuOptsList raw_runtime_opts = {
         {
             .name = "aio",
             .type = QEMU_OPT_STRING,
-            .help = "host AIO implementation (threads, native)",
+            .help = "host AIO implementation (threads, native, io_uring)",
         },
         {
             .name = "locking",
@@ -463,6 +505,19 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+        {
+            .name = "discard-window-ns",
+            .type = QEMU_OPT_NUMBER,
+            .help = "time to wait for more discards to merge with (default: 0)",
+        },
+#if defined(__linux__)
+        {
+            .name = "sg-queue-depth",
+            .type = QEMU_OPT_NUMBER,
+            .help = "maximum number of asynchronous SCSI generic commands "
+                    "(default: 0, use the thread pool)",
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -498,9 +553,16 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
-    aio_default = (bdrv_flags & BDRV_O_NATIVE_AIO)
-                  ? BLOCKDEV_AIO_OPTIONS_NATIVE
-                  : BLOCKDEV_AIO_OPTIONS_THREADS;
+    if (bdrv_flags & BDRV_O_NATIVE_AIO) {
+        aio_default = BLOCKDEV_AIO_OPTIONS_NATIVE;
+#ifdef CONFIG_LINUX_IO_URING
+    } else if (bdrv_flags & BDRV_O_IO_URING) {
+        aio_default = BLOCKDEV_AIO_OPTIONS_IO_URING;
+#endif
+    } else {
+        aio_default = BLOCKDEV_AIO_OPTIONS_THREADS;
+    }
+
     aio = qapi_enum_parse(&BlockdevAioOptions_lookup,
                           qemu_opt_get(opts, "aio"),
                           aio_default, &local_err);
@@ -510,6 +572,9 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
+#ifdef CONFIG_LINUX_IO_URING
+    s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+#endif
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
@@ -552,6 +617,23 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->drop_cache = qemu_opt_get_bool(opts, "drop-cache", true);
     s->check_cache_dropped = qemu_opt_get_bool(opts, "x-check-cache-dropped",
                                                false);
+    s->discard_window_ns = qemu_opt_get_number(opts, "discard-window-ns", 0);
+    if (s->discard_window_ns > INT64_MAX / 2) {
+        error_setg(errp, "discard-window-ns is too large");
+        ret = -EINVAL;
+        goto fail;
+    }
+    QSIMPLEQ_INIT(&s->discard_queue);
+
+#if defined(__linux__)
+    s->sg_queue_depth = qemu_opt_get_number(opts, "sg-queue-depth", 0);
+    if (s->sg_queue_depth > RAW_SG_MAX_QUEUE_DEPTH) {
+        error_setg(errp, "sg-queue-depth must not exceed %d",
+                   RAW_SG_MAX_QUEUE_DEPTH);
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
 
     s->open_flags = open_flags;
     raw_parse_flags(bdrv_flags, &s->open_flags, false);
@@ -595,6 +677,16 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Unlike Linux AIO, io_uring handles buffered I/O asynchronously too */
+    if (s->use_linux_io_uring) {
+        if (!aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
+            error_prepend(errp, "Unable to use io_uring: ");
+            goto fail;
+        }
+    }
+#endif
+
     s->has_discard = true;
     s->has_write_zeroes = true;
     if ((bs->open_flags & BDRV_O_NOCACHE) != 0) {
@@ -684,6 +776,8 @@ static int raw_open(BlockDriverState *bs, QDict *options, int flags,
     BDRVRawState *s = bs->opaque;
 
     s->type = FTYPE_FILE;
+    /* Every block status query costs two lseek() calls */
+    bs->cache_block_status = true;
     return raw_open_common(bs, options, flags, 0, false, errp);
 }
 
@@ -1646,6 +1740,39 @@ static int handle_aiocb_copy_range(void *opaque)
     return 0;
 }
 
+#ifdef CONFIG_SENDFILE
+static int handle_aiocb_sendfile(void *opaque)
+{
+    RawPosixAIOData *aiocb = opaque;
+    off_t offset = aiocb->aio_offset;
+    ssize_t ret;
+
+    do {
+        ret = sendfile(aiocb->sendfile.out_fd, aiocb->aio_fildes, &offset,
+                       MIN(aiocb->aio_nbytes, INT_MAX));
+    } while (ret < 0 && errno == EINTR);
+    trace_file_sendfile(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                        aiocb->sendfile.out_fd, aiocb->aio_nbytes, ret);
+
+    if (ret == 0) {
+        /* No progress (e.g. when beyond EOF), let the caller fall back to
+         * buffer I/O. */
+        return -ENOSPC;
+    }
+    if (ret < 0) {
+        switch (errno) {
+        case ENOSYS:
+        case EINVAL:
+            /* Not supported for this pair of file descriptors */
+            return -ENOTSUP;
+        default:
+            return -errno;
+        }
+    }
+    return ret;
+}
+#endif
+
 static int handle_aiocb_discard(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -1876,16 +2003,20 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
      * If this is the case tell the low-level driver that it needs
      * to copy the buffer.
      */
-    if (s->needs_alignment) {
-        if (!bdrv_qiov_is_aligned(bs, qiov)) {
-            type |= QEMU_AIO_MISALIGNED;
+    if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
+        type |= QEMU_AIO_MISALIGNED;
+#ifdef CONFIG_LINUX_IO_URING
+    } else if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        assert(qiov->size == bytes);
+        return luring_co_submit(bs, aio, s->fd, offset, qiov, type);
+#endif
 #ifdef CONFIG_LINUX_AIO
-        } else if (s->use_linux_aio) {
-            LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
-            assert(qiov->size == bytes);
-            return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
+    } else if (s->needs_alignment && s->use_linux_aio) {
+        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
+        assert(qiov->size == bytes);
+        return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
 #endif
-        }
     }
 
     acb = (RawPosixAIOData) {
@@ -1921,24 +2052,58 @@ static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, uint64_t offset,
 
 static void raw_aio_plug(BlockDriverState *bs)
 {
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
 #ifdef CONFIG_LINUX_AIO
-    BDRVRawState *s = bs->opaque;
     if (s->use_linux_aio) {
         LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
         laio_io_plug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_io_plug(bs, aio);
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
 {
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
 #ifdef CONFIG_LINUX_AIO
-    BDRVRawState *s = bs->opaque;
     if (s->use_linux_aio) {
         LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
         laio_io_unplug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_io_unplug(bs, aio);
+    }
+#endif
+}
+
+static void raw_register_buf(BlockDriverState *bs, void *host, size_t size)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_register_buf(aio, host, size);
+    }
+#endif
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        luring_unregister_buf(aio, host);
+    }
+#endif
 }
 
 static int raw_co_flush_to_disk(BlockDriverState *bs)
@@ -1958,16 +2123,104 @@ static int raw_co_flush_to_disk(BlockDriverState *bs)
         .aio_type       = QEMU_AIO_FLUSH,
     };
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *aio = aio_get_linux_io_uring(bdrv_get_aio_context(bs));
+        return luring_co_submit(bs, aio, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+    }
+#endif
     return raw_thread_pool_submit(bs, handle_aiocb_flush, &acb);
 }
 
+#if defined(__linux__)
+typedef struct RawSgReq {
+    Coroutine *co;
+    struct sg_io_hdr *io_hdr;
+    int ret;
+} RawSgReq;
+
+static void hdev_sg_read_completions(void *opaque)
+{
+    RawSgFd *sgfd = opaque;
+    BDRVRawState *s = sgfd->bs->opaque;
+    struct sg_io_hdr hdr;
+    RawSgReq *req;
+    ssize_t len;
+
+    for (;;) {
+        memset(&hdr, 0, sizeof(hdr));
+        len = read(sgfd->fd, &hdr, sizeof(hdr));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len != sizeof(hdr)) {
+            /* -EAGAIN, nothing else has completed */
+            break;
+        }
+
+        /* Only the output fields, the sense data went to io_hdr->sbp */
+        req = hdr.usr_ptr;
+        req->io_hdr->status = hdr.status;
+        req->io_hdr->masked_status = hdr.masked_status;
+        req->io_hdr->msg_status = hdr.msg_status;
+        req->io_hdr->sb_len_wr = hdr.sb_len_wr;
+        req->io_hdr->host_status = hdr.host_status;
+        req->io_hdr->driver_status = hdr.driver_status;
+        req->io_hdr->resid = hdr.resid;
+        req->io_hdr->duration = hdr.duration;
+        req->io_hdr->info = hdr.info;
+        req->ret = 0;
+
+        sgfd->inflight--;
+        s->sg_inflight--;
+        aio_co_wake(req->co);
+        qemu_co_enter_next(&s->sg_queue, NULL);
+    }
+}
+
+static void hdev_sg_set_fd_handlers(BlockDriverState *bs, AioContext *ctx,
+                                    bool attach)
+{
+    BDRVRawState *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->sg_nfds; i++) {
+        aio_set_fd_handler(ctx, s->sg_fds[i].fd, false,
+                           attach ? hdev_sg_read_completions : NULL,
+                           NULL, NULL, &s->sg_fds[i]);
+    }
+}
+
+static void hdev_sg_close(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    int i;
+
+    hdev_sg_set_fd_handlers(bs, bdrv_get_aio_context(bs), false);
+    for (i = 0; i < s->sg_nfds; i++) {
+        qemu_close(s->sg_fds[i].fd);
+    }
+    g_free(s->sg_fds);
+    s->sg_fds = NULL;
+    s->sg_nfds = 0;
+}
+
+static void raw_aio_detach_aio_context(BlockDriverState *bs)
+{
+    hdev_sg_set_fd_handlers(bs, bdrv_get_aio_context(bs), false);
+}
+#endif
+
 static void raw_aio_attach_aio_context(BlockDriverState *bs,
                                        AioContext *new_context)
 {
+    BDRVRawState __attribute__((unused)) *s = bs->opaque;
+#if defined(__linux__)
+    hdev_sg_set_fd_handlers(bs, new_context, true);
+#endif
 #ifdef CONFIG_LINUX_AIO
-    BDRVRawState *s = bs->opaque;
     if (s->use_linux_aio) {
-        Error *local_err;
+        Error *local_err = NULL;
         if (!aio_setup_linux_aio(new_context, &local_err)) {
             error_reportf_err(local_err, "Unable to use native AIO, "
                                          "falling back to thread pool: ");
@@ -1975,12 +2228,25 @@ static void raw_aio_attach_aio_context(BlockDriverState *bs,
         }
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        Error *local_err = NULL;
+        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+            error_reportf_err(local_err, "Unable to use linux io_uring, "
+                                         "falling back to thread pool: ");
+            s->use_linux_io_uring = false;
+        }
+    }
+#endif
 }
 
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
 
+#if defined(__linux__)
+    hdev_sg_close(bs);
+#endif
     if (s->fd >= 0) {
         qemu_close(s->fd);
         s->fd = -1;
@@ -2661,7 +2927,8 @@ static void coroutine_fn raw_co_invalidate_cache(BlockDriverState *bs,
 }
 
 static coroutine_fn int
-raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
+raw_submit_discard(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                   bool blkdev)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
@@ -2681,6 +2948,111 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
     return raw_thread_pool_submit(bs, handle_aiocb_discard, &acb);
 }
 
+static int discard_req_cmp(const void *a, const void *b)
+{
+    const RawDiscardReq *ra = *(RawDiscardReq * const *)a;
+    const RawDiscardReq *rb = *(RawDiscardReq * const *)b;
+
+    return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+/*
+ * Merge adjacent and overlapping requests of a batch and submit each
+ * resulting range as a single discard.  Ranges are submitted one after
+ * another so that a trim storm occupies at most one worker thread.
+ */
+static coroutine_fn void
+raw_submit_discard_batch(BlockDriverState *bs, RawDiscardReq **reqs, int n,
+                         bool blkdev)
+{
+    int i, first, nb_ranges = 0;
+    int64_t start, end;
+    int ret;
+
+    qsort(reqs, n, sizeof(reqs[0]), discard_req_cmp);
+
+    for (first = 0; first < n; first = i) {
+        start = reqs[first]->offset;
+        end = start + reqs[first]->bytes;
+        for (i = first + 1; i < n && reqs[i]->offset <= end; i++) {
+            end = MAX(end, reqs[i]->offset + reqs[i]->bytes);
+        }
+
+        ret = raw_submit_discard(bs, start, end - start, blkdev);
+        nb_ranges++;
+
+        for (; first < i; first++) {
+            reqs[first]->ret = ret;
+        }
+    }
+
+    trace_file_discard_batch(bs, n, nb_ranges);
+}
+
+/*
+ * Discards are collected for the duration of one event loop iteration, or
+ * for discard-window-ns if it is set, and then submitted as a few large
+ * operations.  The first request of a batch does the submission, the
+ * others wait for it to complete their part.
+ */
+static coroutine_fn int
+raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int bytes, bool blkdev)
+{
+    BDRVRawState *s = bs->opaque;
+    RawDiscardReq req = {
+        .offset = offset,
+        .bytes  = bytes,
+        .co     = qemu_coroutine_self(),
+    };
+    RawDiscardReq *r, **reqs;
+    int i, n;
+
+    QSIMPLEQ_INSERT_TAIL(&s->discard_queue, &req, next);
+
+    if (s->discard_batch_pending) {
+        while (!req.done) {
+            qemu_coroutine_yield();
+        }
+        return req.ret;
+    }
+
+    s->discard_batch_pending = true;
+    if (s->discard_window_ns) {
+        qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, s->discard_window_ns);
+    } else {
+        aio_co_schedule(bdrv_get_aio_context(bs), qemu_coroutine_self());
+        qemu_coroutine_yield();
+    }
+
+    /* Discards that arrive from now on start the next batch */
+    s->discard_batch_pending = false;
+    n = 0;
+    QSIMPLEQ_FOREACH(r, &s->discard_queue, next) {
+        n++;
+    }
+    reqs = g_new(RawDiscardReq *, n);
+    for (i = 0; i < n; i++) {
+        reqs[i] = QSIMPLEQ_FIRST(&s->discard_queue);
+        QSIMPLEQ_REMOVE_HEAD(&s->discard_queue, next);
+    }
+
+    if (n == 1) {
+        req.ret = raw_submit_discard(bs, offset, bytes, blkdev);
+    } else {
+        raw_submit_discard_batch(bs, reqs, n, blkdev);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (reqs[i] != &req) {
+            reqs[i]->done = true;
+            aio_co_wake(reqs[i]->co);
+        }
+    }
+    g_free(reqs);
+
+    return req.ret;
+}
+
 static coroutine_fn int
 raw_co_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
 {
@@ -2906,6 +3278,40 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
     return raw_thread_pool_submit(bs, handle_aiocb_copy_range, &acb);
 }
 
+static int coroutine_fn raw_co_sendfile(BlockDriverState *bs,
+                                        uint64_t offset, uint64_t bytes,
+                                        int out_fd)
+{
+#ifdef CONFIG_SENDFILE
+    BDRVRawState *s = bs->opaque;
+    RawPosixAIOData acb;
+
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+    if (fd_open(bs) < 0) {
+        return -EIO;
+    }
+    if (!bytes) {
+        return 0;
+    }
+
+    acb = (RawPosixAIOData) {
+        .bs             = bs,
+        .aio_fildes     = s->fd,
+        .aio_offset     = offset,
+        .aio_nbytes     = bytes,
+        .sendfile       = {
+            .out_fd         = out_fd,
+        },
+    };
+
+    return raw_thread_pool_submit(bs, handle_aiocb_sendfile, &acb);
+#else
+    return -ENOTSUP;
+#endif
+}
+
 BlockDriver bdrv_file = {
     .format_name = "file",
     .protocol_name = "file",
@@ -2932,9 +3338,12 @@ BlockDriver bdrv_file = {
     .bdrv_co_pdiscard       = raw_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_co_sendfile       = raw_co_sendfile,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate = raw_co_truncate,
@@ -3152,6 +3561,38 @@ static bool hdev_is_sg(BlockDriverState *bs)
     return false;
 }
 
+#if defined(__linux__)
+/*
+ * The sg driver queues at most SG_MAX_QUEUE commands per file descriptor,
+ * so a deeper queue needs the device to be opened several times.
+ */
+static int hdev_sg_open(BlockDriverState *bs, Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+    int i, fd, ret;
+
+    s->sg_nfds = DIV_ROUND_UP(s->sg_queue_depth, SG_MAX_QUEUE);
+    s->sg_fds = g_new0(RawSgFd, s->sg_nfds);
+    for (i = 0; i < s->sg_nfds; i++) {
+        fd = qemu_open(bs->filename, (s->open_flags & O_ACCMODE) | O_NONBLOCK);
+        if (fd < 0) {
+            ret = -errno;
+            error_setg_errno(errp, errno, "Could not reopen '%s' for "
+                             "asynchronous SCSI commands", bs->filename);
+            s->sg_nfds = i;
+            hdev_sg_close(bs);
+            return ret;
+        }
+        s->sg_fds[i].bs = bs;
+        s->sg_fds[i].fd = fd;
+    }
+
+    qemu_co_queue_init(&s->sg_queue);
+    hdev_sg_set_fd_handlers(bs, bdrv_get_aio_context(bs), true);
+    return 0;
+}
+#endif
+
 static int hdev_open(BlockDriverState *bs, QDict *options, int flags,
                      Error **errp)
 {
@@ -3239,6 +3680,21 @@ hdev_open_Mac_error:
     /* Since this does ioctl the device must be already opened */
     bs->sg = hdev_is_sg(bs);
 
+#if defined(__linux__)
+    if (s->sg_queue_depth) {
+        if (!bs->sg) {
+            raw_close(bs);
+            error_setg(errp, "sg-queue-depth requires a SCSI generic device");
+            return -EINVAL;
+        }
+        ret = hdev_sg_open(bs, errp);
+        if (ret < 0) {
+            raw_close(bs);
+            return ret;
+        }
+    }
+#endif
+
     if (flags & BDRV_O_RDWR) {
         ret = check_hdev_writable(s);
         if (ret < 0) {
@@ -3252,6 +3708,56 @@ hdev_open_Mac_error:
 }
 
 #if defined(__linux__)
+/*
+ * Unlike the SG_IO ioctl, which keeps a thread pool worker busy until the
+ * command completes, write() only queues the command.  Completions are
+ * read() back from the fd handler, so up to sg-queue-depth commands are
+ * in flight without any thread switch.
+ */
+static int coroutine_fn
+hdev_co_sg_io(BlockDriverState *bs, struct sg_io_hdr *io_hdr)
+{
+    BDRVRawState *s = bs->opaque;
+    RawSgReq req = {
+        .co     = qemu_coroutine_self(),
+        .io_hdr = io_hdr,
+        .ret    = -EINPROGRESS,
+    };
+    struct sg_io_hdr hdr = *io_hdr;
+    RawSgFd *sgfd;
+    ssize_t len;
+    int i;
+
+    while (s->sg_inflight >= s->sg_queue_depth) {
+        qemu_co_queue_wait(&s->sg_queue, NULL);
+    }
+
+    sgfd = &s->sg_fds[0];
+    for (i = 1; i < s->sg_nfds; i++) {
+        if (s->sg_fds[i].inflight < sgfd->inflight) {
+            sgfd = &s->sg_fds[i];
+        }
+    }
+
+    hdr.usr_ptr = &req;
+    do {
+        len = write(sgfd->fd, &hdr, sizeof(hdr));
+    } while (len < 0 && errno == EINTR);
+    if (len < 0) {
+        req.ret = -errno;
+        /* We may have taken the wakeup meant for a free slot */
+        qemu_co_queue_next(&s->sg_queue);
+        return req.ret;
+    }
+
+    sgfd->inflight++;
+    s->sg_inflight++;
+    while (req.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return req.ret;
+}
+
 static int coroutine_fn
 hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
 {
@@ -3273,6 +3779,10 @@ hdev_co_ioctl(BlockDriverState *bs, unsigned long int req, void *buf)
         }
     }
 
+    if (req == SG_IO && s->sg_nfds) {
+        return hdev_co_sg_io(bs, buf);
+    }
+
     acb = (RawPosixAIOData) {
         .bs         = bs,
         .aio_type   = QEMU_AIO_IOCTL,
@@ -3408,9 +3918,15 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_pdiscard       = hdev_co_pdiscard,
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+    .bdrv_co_sendfile       = raw_co_sendfile,
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
+#if defined(__linux__)
+    .bdrv_detach_aio_context = raw_aio_detach_aio_context,
+#endif
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate       = raw_co_truncate,
@@ -3535,6 +4051,8 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
@@ -3667,6 +4185,8 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_refresh_limits = raw_refresh_limits,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_register_buf = raw_register_buf,
+    .bdrv_unregister_buf = raw_unregister_buf,
     .bdrv_attach_aio_context = raw_aio_attach_aio_context,
 
     .bdrv_co_truncate    = raw_co_truncate,
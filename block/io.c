@@ -30,6 +30,7 @@
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
 #include "qemu/cutils.h"
+#include "qemu/range.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
@@ -562,21 +563,54 @@ static void bdrv_drain_assert_idle(BlockDriverState *bs)
 
 unsigned int bdrv_drain_all_count = 0;
 
-static bool bdrv_drain_all_poll(void)
+static bool bdrv_drain_all_poll_one(BlockDriverState *bs)
+{
+    AioContext *aio_context = bdrv_get_aio_context(bs);
+    bool result;
+
+    aio_context_acquire(aio_context);
+    result = bdrv_drain_poll(bs, false, NULL, true);
+    aio_context_release(aio_context);
+    return result;
+}
+
+/*
+ * With hundreds of nodes, evaluating every one of them on each iteration of
+ * AIO_WAIT_WHILE() dominates the cost of a drain.  A full pass therefore
+ * records the nodes that are still busy in *@busy, and later calls only look
+ * at those until they have all settled.  Only then is another full pass made,
+ * which catches any node that became busy in the meantime; so the result is
+ * the same as always polling all nodes, but idle nodes are visited once per
+ * settled generation instead of once per event.
+ *
+ * *@generation guards against nodes in *@busy having been deleted.
+ */
+static bool bdrv_drain_all_poll(GSList **busy, unsigned int *generation)
 {
     BlockDriverState *bs = NULL;
-    bool result = false;
+
+    if (*busy && *generation == bdrv_states_generation) {
+        while (*busy && !bdrv_drain_all_poll_one((*busy)->data)) {
+            *busy = g_slist_delete_link(*busy, *busy);
+        }
+        if (*busy) {
+            return true;
+        }
+    }
+
+    g_slist_free(*busy);
+    *busy = NULL;
+    *generation = bdrv_states_generation;
 
     /* bdrv_drain_poll() can't make changes to the graph and we are holding the
      * main AioContext lock, so iterating bdrv_next_all_states() is safe. */
     while ((bs = bdrv_next_all_states(bs))) {
-        AioContext *aio_context = bdrv_get_aio_context(bs);
-        aio_context_acquire(aio_context);
-        result |= bdrv_drain_poll(bs, false, NULL, true);
-        aio_context_release(aio_context);
+        if (bdrv_drain_all_poll_one(bs)) {
+            *busy = g_slist_prepend(*busy, bs);
+        }
     }
 
-    return result;
+    return *busy != NULL;
 }
 
 /*
@@ -594,6 +628,8 @@ static bool bdrv_drain_all_poll(void)
 void bdrv_drain_all_begin(void)
 {
     BlockDriverState *bs = NULL;
+    GSList *busy = NULL;
+    unsigned int generation = 0;
 
     if (qemu_in_coroutine()) {
         bdrv_co_yield_to_drain(NULL, true, false, NULL, true, true, NULL);
@@ -617,7 +653,8 @@ void bdrv_drain_all_begin(void)
     }
 
     /* Now poll the in-flight requests */
-    AIO_WAIT_WHILE(NULL, bdrv_drain_all_poll());
+    AIO_WAIT_WHILE(NULL, bdrv_drain_all_poll(&busy, &generation));
+    assert(!busy);
 
     while ((bs = bdrv_next_all_states(bs))) {
         bdrv_drain_assert_idle(bs);
@@ -1502,6 +1539,59 @@ typedef struct BdrvRequestPadding {
     QEMUIOVector local_qiov;
 } BdrvRequestPadding;
 
+/*
+ * Returns an aligned buffer of at least 2 * request_alignment bytes for
+ * request padding, taken from the node's pool if possible.
+ */
+static uint8_t *bdrv_pad_buf_get(BlockDriverState *bs)
+{
+    size_t size = 2 * bs->bl.request_alignment;
+    size_t align = bdrv_opt_mem_align(bs);
+    void *buf = NULL;
+
+    qemu_mutex_lock(&bs->pad_buf_lock);
+    if (bs->pad_buf_size != size || bs->pad_buf_align != align) {
+        /* The limits have changed, the pooled buffers are of no use */
+        while (bs->nb_pad_bufs) {
+            qemu_vfree(bs->pad_bufs[--bs->nb_pad_bufs]);
+        }
+        bs->pad_buf_size = size;
+        bs->pad_buf_align = align;
+    } else if (bs->nb_pad_bufs) {
+        buf = bs->pad_bufs[--bs->nb_pad_bufs];
+    }
+    qemu_mutex_unlock(&bs->pad_buf_lock);
+
+    return buf ?: qemu_memalign(align, size);
+}
+
+static void bdrv_pad_buf_put(BlockDriverState *bs, uint8_t *buf)
+{
+    qemu_mutex_lock(&bs->pad_buf_lock);
+    if (bs->pad_buf_size == 2 * bs->bl.request_alignment &&
+        bs->pad_buf_align == bdrv_opt_mem_align(bs) &&
+        bs->nb_pad_bufs < BDRV_PAD_BUF_POOL_SIZE)
+    {
+        bs->pad_bufs[bs->nb_pad_bufs++] = buf;
+        buf = NULL;
+    }
+    qemu_mutex_unlock(&bs->pad_buf_lock);
+
+    qemu_vfree(buf);
+}
+
+/* Frees the pooled request padding buffers of @bs */
+void bdrv_drop_pad_bufs(BlockDriverState *bs)
+{
+    qemu_mutex_lock(&bs->pad_buf_lock);
+    while (bs->nb_pad_bufs) {
+        qemu_vfree(bs->pad_bufs[--bs->nb_pad_bufs]);
+    }
+    bs->pad_buf_size = 0;
+    bs->pad_buf_align = 0;
+    qemu_mutex_unlock(&bs->pad_buf_lock);
+}
+
 static bool bdrv_init_padding(BlockDriverState *bs,
                               int64_t offset, int64_t bytes,
                               BdrvRequestPadding *pad)
@@ -1523,7 +1613,7 @@ static bool bdrv_init_padding(BlockDriverState *bs,
 
     sum = pad->head + bytes + pad->tail;
     pad->buf_len = (sum > align && pad->head && pad->tail) ? 2 * align : align;
-    pad->buf = qemu_blockalign(bs, pad->buf_len);
+    pad->buf = bdrv_pad_buf_get(bs);
     pad->merge_reads = sum == pad->buf_len;
     if (pad->tail) {
         pad->tail_buf = pad->buf + pad->buf_len - align;
@@ -1594,10 +1684,10 @@ zero_mem:
     return 0;
 }
 
-static void bdrv_padding_destroy(BdrvRequestPadding *pad)
+static void bdrv_padding_destroy(BlockDriverState *bs, BdrvRequestPadding *pad)
 {
     if (pad->buf) {
-        qemu_vfree(pad->buf);
+        bdrv_pad_buf_put(bs, pad->buf);
         qemu_iovec_destroy(&pad->local_qiov);
     }
 }
@@ -1641,6 +1731,30 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
     return bdrv_co_preadv_part(child, offset, bytes, qiov, 0, flags);
 }
 
+static void bdrv_node_acct_start(BlockDriverState *bs, BlockAcctCookie *cookie,
+                                 int64_t bytes, enum BlockAcctType type)
+{
+    if (atomic_read(&bs->node_stats_enabled)) {
+        block_acct_start(&bs->node_stats, cookie, bytes, type);
+    } else {
+        cookie->type = BLOCK_MAX_IOTYPE;
+    }
+}
+
+static void bdrv_node_acct_done(BlockDriverState *bs, BlockAcctCookie *cookie,
+                                int ret)
+{
+    if (cookie->type == BLOCK_MAX_IOTYPE) {
+        return;
+    }
+
+    if (ret < 0) {
+        block_acct_failed(&bs->node_stats, cookie);
+    } else {
+        block_acct_done(&bs->node_stats, cookie);
+    }
+}
+
 int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     int64_t offset, unsigned int bytes,
     QEMUIOVector *qiov, size_t qiov_offset,
@@ -1649,6 +1763,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
     BdrvRequestPadding pad;
+    BlockAcctCookie acct;
     int ret;
 
     trace_bdrv_co_preadv(bs, offset, bytes, flags);
@@ -1658,6 +1773,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
         return ret;
     }
 
+    bdrv_node_acct_start(bs, &acct, bytes, BLOCK_ACCT_READ);
     bdrv_inc_in_flight(bs);
 
     /* Don't do copy-on-read if we read data before write operation */
@@ -1674,7 +1790,8 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
 
-    bdrv_padding_destroy(&pad);
+    bdrv_padding_destroy(bs, &pad);
+    bdrv_node_acct_done(bs, &acct, ret);
 
     return ret;
 }
@@ -1838,6 +1955,21 @@ bdrv_co_write_req_prepare(BdrvChild *child, int64_t offset, uint64_t bytes,
     }
 }
 
+/*
+ * Drops the cached block status if it overlaps [offset, offset + bytes).
+ * A request with bytes == 0 (e.g. shrinking truncate) always drops it.
+ */
+static void bdrv_block_status_cache_invalidate(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    if (bsc->valid &&
+        (!bytes || ranges_overlap(bsc->offset, bsc->bytes, offset, bytes))) {
+        bsc->valid = false;
+    }
+}
+
 static inline void coroutine_fn
 bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
                          BdrvTrackedRequest *req, int ret)
@@ -1846,6 +1978,7 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
     BlockDriverState *bs = child->bs;
 
     atomic_inc(&bs->write_gen);
+    bdrv_block_status_cache_invalidate(bs, offset, bytes);
 
     /*
      * Discard cannot extend the image, but in error handling cases, such as
@@ -2022,7 +2155,7 @@ static int coroutine_fn bdrv_co_do_zero_pwritev(BdrvChild *child,
     }
 
 out:
-    bdrv_padding_destroy(&pad);
+    bdrv_padding_destroy(bs, &pad);
 
     return ret;
 }
@@ -2045,6 +2178,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvTrackedRequest req;
     uint64_t align = bs->bl.request_alignment;
     BdrvRequestPadding pad;
+    BlockAcctCookie acct;
     int ret;
 
     trace_bdrv_co_pwritev(child->bs, offset, bytes, flags);
@@ -2058,6 +2192,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
         return ret;
     }
 
+    bdrv_node_acct_start(bs, &acct, bytes, BLOCK_ACCT_WRITE);
     bdrv_inc_in_flight(bs);
     /*
      * Align write if necessary by performing a read-modify-write cycle.
@@ -2080,11 +2215,12 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     ret = bdrv_aligned_pwritev(child, &req, offset, bytes, align,
                                qiov, qiov_offset, flags);
 
-    bdrv_padding_destroy(&pad);
+    bdrv_padding_destroy(bs, &pad);
 
 out:
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
+    bdrv_node_acct_done(bs, &acct, ret);
 
     return ret;
 }
@@ -2170,6 +2306,57 @@ int coroutine_fn bdrv_co_block_status_from_backing(BlockDriverState *bs,
     return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID;
 }
 
+/*
+ * Looks up @offset in the block status cache of @bs.  On a hit, sets *pnum
+ * (at most @bytes), *map and *status as the driver would have and returns
+ * true.
+ */
+static bool bdrv_block_status_cache_lookup(BlockDriverState *bs,
+                                           int64_t offset, int64_t bytes,
+                                           int64_t *pnum, int64_t *map,
+                                           int *status)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    if (!bsc->valid || offset < bsc->offset ||
+        offset >= bsc->offset + bsc->bytes)
+    {
+        return false;
+    }
+
+    *pnum = MIN(bsc->offset + bsc->bytes - offset, bytes);
+    *status = bsc->status;
+    *map = bsc->status & BDRV_BLOCK_OFFSET_VALID ?
+           bsc->map + (offset - bsc->offset) : 0;
+    return true;
+}
+
+/*
+ * Remembers a driver's block status result.  Only results that refer to @bs
+ * itself are cached, so that no reference to another node is kept.
+ */
+static void bdrv_block_status_cache_fill(BlockDriverState *bs,
+                                         int64_t offset, int64_t bytes,
+                                         int status, int64_t map,
+                                         BlockDriverState *file)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    if ((status & (BDRV_BLOCK_RAW | BDRV_BLOCK_RECURSE)) ||
+        ((status & BDRV_BLOCK_OFFSET_VALID) && file != bs))
+    {
+        return;
+    }
+
+    *bsc = (BdrvBlockStatusCache) {
+        .valid  = true,
+        .offset = offset,
+        .bytes  = bytes,
+        .status = status & ~BDRV_BLOCK_EOF,
+        .map    = map,
+    };
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2256,12 +2443,33 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_offset = QEMU_ALIGN_DOWN(offset, align);
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
-    ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
-                                        aligned_bytes, pnum, &local_map,
-                                        &local_file);
-    if (ret < 0) {
-        *pnum = 0;
-        goto out;
+    if (bs->cache_block_status &&
+        bdrv_block_status_cache_lookup(bs, aligned_offset, aligned_bytes,
+                                       pnum, &local_map, &ret))
+    {
+        local_file = ret & BDRV_BLOCK_OFFSET_VALID ? bs : NULL;
+    } else {
+        unsigned int write_gen = atomic_read(&bs->write_gen);
+
+        ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
+                                            aligned_bytes, pnum, &local_map,
+                                            &local_file);
+        if (ret < 0) {
+            *pnum = 0;
+            goto out;
+        }
+
+        /*
+         * Without want_zero, drivers may report everything as data, which
+         * must not be returned to callers that set it.  Also skip the result
+         * if a write completed while the driver was looking.
+         */
+        if (bs->cache_block_status && want_zero &&
+            write_gen == atomic_read(&bs->write_gen))
+        {
+            bdrv_block_status_cache_fill(bs, aligned_offset, *pnum, ret,
+                                         local_map, local_file);
+        }
     }
 
     /*
@@ -2685,9 +2893,11 @@ static void coroutine_fn bdrv_flush_co_entry(void *opaque)
 
 int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
 {
+    BlockAcctCookie acct;
     int current_gen;
     int ret = 0;
 
+    bdrv_node_acct_start(bs, &acct, 0, BLOCK_ACCT_FLUSH);
     bdrv_inc_in_flight(bs);
 
     if (!bdrv_is_inserted(bs) || bdrv_is_read_only(bs) ||
@@ -2792,6 +3002,7 @@ out:
 
 early_exit:
     bdrv_dec_in_flight(bs);
+    bdrv_node_acct_done(bs, &acct, ret);
     return ret;
 }
 
@@ -3231,6 +3442,42 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                    bytes, read_flags, write_flags);
 }
 
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, uint64_t offset,
+                                  uint64_t bytes, int out_fd)
+{
+    BlockDriverState *bs = child ? child->bs : NULL;
+    BdrvTrackedRequest req;
+    int ret;
+
+    if (!bs || !bs->drv) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_byte_request(bs, offset, bytes);
+    if (ret) {
+        return ret;
+    }
+
+    /*
+     * The data goes through the host page cache, which cache.direct=on asks
+     * us to avoid.  Copy-on-read needs the data in a buffer anyway.
+     */
+    if (!bs->drv->bdrv_co_sendfile || bs->encrypted || bs->copy_on_read ||
+        (bs->open_flags & BDRV_O_NOCACHE)) {
+        return -ENOTSUP;
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    wait_serialising_requests(&req);
+
+    ret = bs->drv->bdrv_co_sendfile(bs, offset, bytes, out_fd);
+
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
 static void bdrv_parent_cb_resize(BlockDriverState *bs)
 {
     BdrvChild *c;
@@ -61,14 +61,33 @@ QEMU_BUILD_BUG_ON((int)SCSI_XFER_NONE != (int)ISCSI_XFER_NONE);
 #include <scsi/sg.h>
 #endif
 
+/* Default number of READ/WRITE commands per session with sessions > 1 */
+#define ISCSI_DEFAULT_QUEUE_DEPTH 32
+#define ISCSI_MAX_SESSIONS 16
+
+typedef struct IscsiSession {
+    struct IscsiLun *iscsilun;
+    struct iscsi_context *iscsi;
+    int events;
+    /* READ and WRITE commands submitted on this session */
+    unsigned int in_flight;
+    bool request_timed_out;
+} IscsiSession;
+
 typedef struct IscsiLun {
+    /* The same as sessions[0].iscsi, used for everything but READ/WRITE */
     struct iscsi_context *iscsi;
+    IscsiSession *sessions;
+    int nb_sessions;
+    /* Maximum in_flight per session, 0 for no limit */
+    unsigned int queue_depth;
+    /* Coroutines waiting for a session below queue_depth */
+    CoQueue session_queue;
     AioContext *aio_context;
     int lun;
     enum scsi_inquiry_peripheral_device_type type;
     int block_size;
     uint64_t num_blocks;
-    int events;
     QEMUTimer *nop_timer;
     QEMUTimer *event_timer;
     QemuMutex mutex;
@@ -100,7 +119,6 @@ typedef struct IscsiLun {
     bool lbprz;
     bool dpofua;
     bool has_write_same;
-    bool request_timed_out;
 } IscsiLun;
 
 typedef struct IscsiTask {
@@ -111,6 +129,7 @@ typedef struct IscsiTask {
     struct scsi_task *task;
     Coroutine *co;
     IscsiLun *iscsilun;
+    IscsiSession *session;
     QEMUTimer retry_timer;
     int err_code;
     char *err_str;
@@ -253,7 +272,7 @@ iscsi_co_generic_cb(struct iscsi_context *iscsi, int status,
                     /* make sure the request is rescheduled AFTER the
                      * reconnect is initiated */
                     retry_time = EVENT_INTERVAL * 2;
-                    iTask->iscsilun->request_timed_out = true;
+                    iTask->session->request_timed_out = true;
                 }
                 error_report("iSCSI Busy/TaskSetFull/TimeOut"
                              " (retry #%u in %u ms): %s",
@@ -292,6 +311,7 @@ static void iscsi_co_init_iscsitask(IscsiLun *iscsilun, struct IscsiTask *iTask)
     *iTask = (struct IscsiTask) {
         .co         = qemu_coroutine_self(),
         .iscsilun   = iscsilun,
+        .session    = &iscsilun->sessions[0],
     };
 }
 
@@ -354,32 +374,41 @@ static void iscsi_process_write(void *arg);
 static void
 iscsi_set_events(IscsiLun *iscsilun)
 {
-    struct iscsi_context *iscsi = iscsilun->iscsi;
-    int ev = iscsi_which_events(iscsi);
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        IscsiSession *s = &iscsilun->sessions[i];
+        int ev = iscsi_which_events(s->iscsi);
 
-    if (ev != iscsilun->events) {
-        aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsi),
-                           false,
-                           (ev & POLLIN) ? iscsi_process_read : NULL,
-                           (ev & POLLOUT) ? iscsi_process_write : NULL,
-                           NULL,
-                           iscsilun);
-        iscsilun->events = ev;
+        if (ev != s->events) {
+            aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(s->iscsi),
+                               false,
+                               (ev & POLLIN) ? iscsi_process_read : NULL,
+                               (ev & POLLOUT) ? iscsi_process_write : NULL,
+                               NULL,
+                               s);
+            s->events = ev;
+        }
     }
 }
 
 static void iscsi_timed_check_events(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    int i;
 
     qemu_mutex_lock(&iscsilun->mutex);
 
-    /* check for timed out requests */
-    iscsi_service(iscsilun->iscsi, 0);
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        IscsiSession *s = &iscsilun->sessions[i];
+
+        /* check for timed out requests */
+        iscsi_service(s->iscsi, 0);
 
-    if (iscsilun->request_timed_out) {
-        iscsilun->request_timed_out = false;
-        iscsi_reconnect(iscsilun->iscsi);
+        if (s->request_timed_out) {
+            s->request_timed_out = false;
+            iscsi_reconnect(s->iscsi);
+        }
     }
 
     /* newer versions of libiscsi may return zero events. Ensure we are able
@@ -395,11 +424,11 @@ static void iscsi_timed_check_events(void *opaque)
 static void
 iscsi_process_read(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *s = arg;
+    IscsiLun *iscsilun = s->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLIN);
+    iscsi_service(s->iscsi, POLLIN);
     iscsi_set_events(iscsilun);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
@@ -407,11 +436,11 @@ iscsi_process_read(void *arg)
 static void
 iscsi_process_write(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *s = arg;
+    IscsiLun *iscsilun = s->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLOUT);
+    iscsi_service(s->iscsi, POLLOUT);
     iscsi_set_events(iscsilun);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
@@ -597,6 +626,46 @@ static void coroutine_fn iscsi_co_wait_for_task(IscsiTask *iTask,
     }
 }
 
+/*
+ * Pick the session with the fewest READ/WRITE commands in flight.  If all
+ * of them are at the queue depth, wait until a command completes.
+ *
+ * Called with QemuMutex held.
+ */
+static IscsiSession *coroutine_fn iscsi_co_get_session(IscsiLun *iscsilun)
+{
+    for (;;) {
+        IscsiSession *best = NULL;
+        int i;
+
+        for (i = 0; i < iscsilun->nb_sessions; i++) {
+            IscsiSession *s = &iscsilun->sessions[i];
+
+            if (iscsilun->queue_depth &&
+                s->in_flight >= iscsilun->queue_depth) {
+                continue;
+            }
+            if (!best || s->in_flight < best->in_flight) {
+                best = s;
+            }
+        }
+        if (best) {
+            best->in_flight++;
+            return best;
+        }
+        qemu_co_queue_wait(&iscsilun->session_queue, &iscsilun->mutex);
+    }
+}
+
+/* Called with QemuMutex held.  */
+static void coroutine_fn iscsi_co_put_session(IscsiLun *iscsilun,
+                                              IscsiSession *s)
+{
+    assert(s->in_flight > 0);
+    s->in_flight--;
+    qemu_co_queue_next(&iscsilun->session_queue);
+}
+
 static int coroutine_fn
 iscsi_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
                 QEMUIOVector *iov, int flags)
@@ -623,34 +692,40 @@ iscsi_co_writev(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
     num_sectors = sector_qemu2lun(nb_sectors, iscsilun);
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
+    iTask.session = iscsi_co_get_session(iscsilun);
 retry:
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_write16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_iov_task(iTask.session->iscsi,
+                                            iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_write10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_iov_task(iTask.session->iscsi,
+                                            iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_write16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_task(iTask.session->iscsi,
+                                        iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_write10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_task(iTask.session->iscsi,
+                                        iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     }
 #endif
     if (iTask.task == NULL) {
+        iscsi_co_put_session(iscsilun, iTask.session);
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
@@ -669,6 +744,7 @@ retry:
         iTask.complete = 0;
         goto retry;
     }
+    iscsi_co_put_session(iscsilun, iTask.session);
 
     if (iTask.status != SCSI_STATUS_GOOD) {
         iscsi_allocmap_set_invalid(iscsilun, sector_num * BDRV_SECTOR_SIZE,
@@ -857,16 +933,19 @@ static int coroutine_fn iscsi_co_readv(BlockDriverState *bs,
 
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
+    iTask.session = iscsi_co_get_session(iscsilun);
 retry:
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_read16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_iov_task(iTask.session->iscsi,
+                                           iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size, 0, 0, 0, 0, 0,
                                            iscsi_co_generic_cb, &iTask,
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_read10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_iov_task(iTask.session->iscsi,
+                                           iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size,
                                            0, 0, 0, 0, 0,
@@ -874,12 +953,14 @@ retry:
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_read16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_task(iTask.session->iscsi,
+                                       iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size, 0, 0, 0, 0, 0,
                                        iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_read10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_task(iTask.session->iscsi,
+                                       iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size,
                                        0, 0, 0, 0, 0,
@@ -887,6 +968,7 @@ retry:
     }
 #endif
     if (iTask.task == NULL) {
+        iscsi_co_put_session(iscsilun, iTask.session);
         qemu_mutex_unlock(&iscsilun->mutex);
         return -ENOMEM;
     }
@@ -904,6 +986,7 @@ retry:
         iTask.complete = 0;
         goto retry;
     }
+    iscsi_co_put_session(iscsilun, iTask.session);
 
     if (iTask.status != SCSI_STATUS_GOOD) {
         error_report("iSCSI READ10/16 failed at lba %" PRIu64 ": %s",
@@ -1392,14 +1475,20 @@ static char *get_initiator_name(QemuOpts *opts)
 static void iscsi_nop_timed_event(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    int i;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    if (iscsi_get_nops_in_flight(iscsilun->iscsi) >= MAX_NOP_FAILURES) {
-        error_report("iSCSI: NOP timeout. Reconnecting...");
-        iscsilun->request_timed_out = true;
-    } else if (iscsi_nop_out_async(iscsilun->iscsi, NULL, NULL, 0, NULL) != 0) {
-        error_report("iSCSI: failed to sent NOP-Out. Disabling NOP messages.");
-        goto out;
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        IscsiSession *s = &iscsilun->sessions[i];
+
+        if (iscsi_get_nops_in_flight(s->iscsi) >= MAX_NOP_FAILURES) {
+            error_report("iSCSI: NOP timeout. Reconnecting...");
+            s->request_timed_out = true;
+        } else if (iscsi_nop_out_async(s->iscsi, NULL, NULL, 0, NULL) != 0) {
+            error_report("iSCSI: failed to sent NOP-Out. "
+                         "Disabling NOP messages.");
+            goto out;
+        }
     }
 
     timer_mod(iscsilun->nop_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + NOP_INTERVAL);
@@ -1520,10 +1609,15 @@ fail_with_err:
 static void iscsi_detach_aio_context(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        IscsiSession *s = &iscsilun->sessions[i];
 
-    aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsilun->iscsi),
-                       false, NULL, NULL, NULL, NULL);
-    iscsilun->events = 0;
+        aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(s->iscsi),
+                           false, NULL, NULL, NULL, NULL);
+        s->events = 0;
+    }
 
     if (iscsilun->nop_timer) {
         timer_del(iscsilun->nop_timer);
@@ -1748,6 +1842,14 @@ static QemuOptsList runtime_opts = {
             .name = "timeout",
             .type = QEMU_OPT_NUMBER,
         },
+        {
+            .name = "sessions",
+            .type = QEMU_OPT_NUMBER,
+        },
+        {
+            .name = "queue-depth",
+            .type = QEMU_OPT_NUMBER,
+        },
         { /* end of list */ }
     },
 };
@@ -1776,11 +1878,106 @@ static void iscsi_save_designator(IscsiLun *lun,
     }
 }
 
+/*
+ * Create an iSCSI context for the target in @opts and log in.  @opts must
+ * have been validated by iscsi_open() already.
+ */
+static int iscsi_connect_session(QemuOpts *opts, const char *initiator_name,
+                                 struct iscsi_context **piscsi, Error **errp)
+{
+    struct iscsi_context *iscsi;
+    Error *local_err = NULL;
+    const char *portal = qemu_opt_get(opts, "portal");
+    const char *target = qemu_opt_get(opts, "target");
+    int lun = qemu_opt_get_number(opts, "lun", 0);
+#if LIBISCSI_API_VERSION >= (20160603)
+    enum iscsi_transport_type transport =
+        strcmp(qemu_opt_get(opts, "transport"), "iser") ? TCP_TRANSPORT
+                                                        : ISER_TRANSPORT;
+#endif
+
+    iscsi = iscsi_create_context(initiator_name);
+    if (iscsi == NULL) {
+        error_setg(errp, "iSCSI: Failed to create iSCSI context.");
+        return -ENOMEM;
+    }
+#if LIBISCSI_API_VERSION >= (20160603)
+    if (iscsi_init_transport(iscsi, transport)) {
+        error_setg(errp, ("Error initializing transport."));
+        goto fail;
+    }
+#endif
+    if (iscsi_set_targetname(iscsi, target)) {
+        error_setg(errp, "iSCSI: Failed to set target name.");
+        goto fail;
+    }
+
+    /* check if we got CHAP username/password via the options */
+    apply_chap(iscsi, opts, &local_err);
+    if (local_err != NULL) {
+        error_propagate(errp, local_err);
+        goto fail;
+    }
+
+    if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
+        error_setg(errp, "iSCSI: Failed to set session type to normal.");
+        goto fail;
+    }
+
+    /* check if we got HEADER_DIGEST via the options */
+    apply_header_digest(iscsi, opts, &local_err);
+    if (local_err != NULL) {
+        error_propagate(errp, local_err);
+        goto fail;
+    }
+
+#if LIBISCSI_API_VERSION >= 20150621
+    iscsi_set_timeout(iscsi, qemu_opt_get_number(opts, "timeout", 0));
+#endif
+
+    if (iscsi_full_connect_sync(iscsi, portal, lun) != 0) {
+        error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
+            iscsi_get_error(iscsi));
+        goto fail;
+    }
+
+    *piscsi = iscsi;
+    return 0;
+
+fail:
+    if (iscsi_is_logged_in(iscsi)) {
+        iscsi_logout_sync(iscsi);
+    }
+    iscsi_destroy_context(iscsi);
+    return -EINVAL;
+}
+
+/* Log out of and destroy all sessions of @iscsilun */
+static void iscsi_free_sessions(IscsiLun *iscsilun)
+{
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        struct iscsi_context *iscsi = iscsilun->sessions[i].iscsi;
+
+        if (iscsi == NULL) {
+            continue;
+        }
+        if (iscsi_is_logged_in(iscsi)) {
+            iscsi_logout_sync(iscsi);
+        }
+        iscsi_destroy_context(iscsi);
+    }
+    g_free(iscsilun->sessions);
+    iscsilun->sessions = NULL;
+    iscsilun->nb_sessions = 0;
+    iscsilun->iscsi = NULL;
+}
+
 static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
                       Error **errp)
 {
     IscsiLun *iscsilun = bs->opaque;
-    struct iscsi_context *iscsi = NULL;
     struct scsi_task *task = NULL;
     struct scsi_inquiry_standard *inq = NULL;
     struct scsi_inquiry_supported_pages *inq_vpd;
@@ -1788,10 +1985,8 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     QemuOpts *opts;
     Error *local_err = NULL;
     const char *transport_name, *portal, *target;
-#if LIBISCSI_API_VERSION >= (20160603)
-    enum iscsi_transport_type transport;
-#endif
-    int i, ret = 0, timeout = 0, lun;
+    uint64_t nb_sessions, queue_depth;
+    int i, ret = 0, lun;
 
     opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
     qemu_opts_absorb_qdict(opts, options, &local_err);
@@ -1813,12 +2008,10 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     if (!strcmp(transport_name, "tcp")) {
+        /* TCP is what older libiscsi versions always use */
 #if LIBISCSI_API_VERSION >= (20160603)
-        transport = TCP_TRANSPORT;
     } else if (!strcmp(transport_name, "iser")) {
-        transport = ISER_TRANSPORT;
-#else
-        /* TCP is what older libiscsi versions always use */
+        /* iSER is supported since libiscsi 1.17 */
 #endif
     } else {
         error_setg(errp, "Unknown transport: %s", transport_name);
@@ -1828,67 +2021,45 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
 
     memset(iscsilun, 0, sizeof(IscsiLun));
 
-    initiator_name = get_initiator_name(opts);
-
-    iscsi = iscsi_create_context(initiator_name);
-    if (iscsi == NULL) {
-        error_setg(errp, "iSCSI: Failed to create iSCSI context.");
-        ret = -ENOMEM;
-        goto out;
-    }
-#if LIBISCSI_API_VERSION >= (20160603)
-    if (iscsi_init_transport(iscsi, transport)) {
-        error_setg(errp, ("Error initializing transport."));
+    nb_sessions = qemu_opt_get_number(opts, "sessions", 1);
+    if (nb_sessions == 0 || nb_sessions > ISCSI_MAX_SESSIONS) {
+        error_setg(errp, "sessions must be between 1 and %d",
+                   ISCSI_MAX_SESSIONS);
         ret = -EINVAL;
         goto out;
     }
-#endif
-    if (iscsi_set_targetname(iscsi, target)) {
-        error_setg(errp, "iSCSI: Failed to set target name.");
-        ret = -EINVAL;
-        goto out;
-    }
-
-    /* check if we got CHAP username/password via the options */
-    apply_chap(iscsi, opts, &local_err);
-    if (local_err != NULL) {
-        error_propagate(errp, local_err);
-        ret = -EINVAL;
-        goto out;
-    }
-
-    if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
-        error_setg(errp, "iSCSI: Failed to set session type to normal.");
-        ret = -EINVAL;
-        goto out;
-    }
-
-    /* check if we got HEADER_DIGEST via the options */
-    apply_header_digest(iscsi, opts, &local_err);
-    if (local_err != NULL) {
-        error_propagate(errp, local_err);
+    queue_depth = qemu_opt_get_number(opts, "queue-depth",
+                                      nb_sessions > 1 ?
+                                      ISCSI_DEFAULT_QUEUE_DEPTH : 0);
+    if (queue_depth > INT_MAX) {
+        error_setg(errp, "queue-depth must not exceed %d", INT_MAX);
         ret = -EINVAL;
         goto out;
     }
 
+#if LIBISCSI_API_VERSION < 20150621
     /* timeout handling is broken in libiscsi before 1.15.0 */
-    timeout = qemu_opt_get_number(opts, "timeout", 0);
-#if LIBISCSI_API_VERSION >= 20150621
-    iscsi_set_timeout(iscsi, timeout);
-#else
-    if (timeout) {
+    if (qemu_opt_get_number(opts, "timeout", 0)) {
         warn_report("iSCSI: ignoring timeout value for libiscsi <1.15.0");
     }
 #endif
 
-    if (iscsi_full_connect_sync(iscsi, portal, lun) != 0) {
-        error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
-            iscsi_get_error(iscsi));
-        ret = -EINVAL;
-        goto out;
+    initiator_name = get_initiator_name(opts);
+
+    iscsilun->sessions = g_new0(IscsiSession, nb_sessions);
+    iscsilun->nb_sessions = nb_sessions;
+    iscsilun->queue_depth = queue_depth;
+    for (i = 0; i < nb_sessions; i++) {
+        IscsiSession *s = &iscsilun->sessions[i];
+
+        s->iscsilun = iscsilun;
+        ret = iscsi_connect_session(opts, initiator_name, &s->iscsi, errp);
+        if (ret < 0) {
+            goto out;
+        }
     }
 
-    iscsilun->iscsi = iscsi;
+    iscsilun->iscsi = iscsilun->sessions[0].iscsi;
     iscsilun->aio_context = bdrv_get_aio_context(bs);
     iscsilun->lun = lun;
     iscsilun->has_write_same = true;
@@ -1990,6 +2161,7 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     task = NULL;
 
     qemu_mutex_init(&iscsilun->mutex);
+    qemu_co_queue_init(&iscsilun->session_queue);
     iscsi_attach_aio_context(bs, iscsilun->aio_context);
 
     /* Guess the internal cluster (page) size of the iscsi target by the means
@@ -2016,12 +2188,7 @@ out:
     }
 
     if (ret) {
-        if (iscsi != NULL) {
-            if (iscsi_is_logged_in(iscsi)) {
-                iscsi_logout_sync(iscsi);
-            }
-            iscsi_destroy_context(iscsi);
-        }
+        iscsi_free_sessions(iscsilun);
         memset(iscsilun, 0, sizeof(IscsiLun));
     }
 
@@ -2031,13 +2198,9 @@ out:
 static void iscsi_close(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
 
     iscsi_detach_aio_context(bs);
-    if (iscsi_is_logged_in(iscsi)) {
-        iscsi_logout_sync(iscsi);
-    }
-    iscsi_destroy_context(iscsi);
+    iscsi_free_sessions(iscsilun);
     if (iscsilun->dd) {
         g_free(iscsilun->dd->designator);
         g_free(iscsilun->dd);
@@ -2199,9 +2362,7 @@ static int coroutine_fn iscsi_co_create_opts(const char *filename, QemuOpts *opt
 
     ret = 0;
 out:
-    if (iscsilun->iscsi != NULL) {
-        iscsi_destroy_context(iscsilun->iscsi);
-    }
+    iscsi_free_sessions(iscsilun);
     g_free(bs->opaque);
     bs->opaque = NULL;
     bdrv_unref(bs);
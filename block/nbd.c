@@ -44,9 +44,10 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
 
-#define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
-#define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
+#define HANDLE_TO_INDEX(conn, handle) ((handle) ^ (uint64_t)(intptr_t)(conn))
+#define INDEX_TO_HANDLE(conn, index)  ((index)  ^ (uint64_t)(intptr_t)(conn))
 
 typedef struct {
     Coroutine *coroutine;
@@ -59,7 +60,7 @@ typedef enum NBDClientState {
     NBD_CLIENT_QUIT
 } NBDClientState;
 
-typedef struct BDRVNBDState {
+typedef struct NBDConnection {
     QIOChannelSocket *sioc; /* The master data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
     NBDExportInfo info;
@@ -73,6 +74,19 @@ typedef struct BDRVNBDState {
     NBDClientRequest requests[MAX_NBD_REQUESTS];
     NBDReply reply;
     BlockDriverState *bs;
+} NBDConnection;
+
+typedef struct BDRVNBDState {
+    /*
+     * Requests are spread round-robin over all connections; this is only
+     * done if the server advertises NBD_FLAG_CAN_MULTI_CONN.
+     */
+    NBDConnection conns[MAX_NBD_CONNECTIONS];
+    int num_conns;
+    unsigned int next_conn;
+
+    /* Export information as negotiated on the first connection */
+    NBDExportInfo info;
 
     /* Connection parameters */
     uint32_t reconnect_delay;
@@ -81,20 +95,21 @@ typedef struct BDRVNBDState {
     QCryptoTLSCreds *tlscreds;
     const char *hostname;
     char *x_dirty_bitmap;
+    uint32_t multi_conn;
 } BDRVNBDState;
 
 /* @ret will be used for reconnect in future */
-static void nbd_channel_error(BDRVNBDState *s, int ret)
+static void nbd_channel_error(NBDConnection *conn, int ret)
 {
-    s->state = NBD_CLIENT_QUIT;
+    conn->state = NBD_CLIENT_QUIT;
 }
 
-static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
+static void nbd_recv_coroutines_wake_all(NBDConnection *conn)
 {
     int i;
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        NBDClientRequest *req = &s->requests[i];
+        NBDClientRequest *req = &conn->requests[i];
 
         if (req->coroutine && req->receiving) {
             aio_co_wake(req->coroutine);
@@ -105,22 +120,31 @@ static void nbd_recv_coroutines_wake_all(BDRVNBDState *s)
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+    for (i = 0; i < s->num_conns; i++) {
+        qio_channel_detach_aio_context(QIO_CHANNEL(s->conns[i].ioc));
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
     BlockDriverState *bs = opaque;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
     /*
-     * The node is still drained, so we know the coroutine has yielded in
-     * nbd_read_eof(), the only place where bs->in_flight can reach 0, or it is
-     * entered for the first time. Both places are safe for entering the
-     * coroutine.
+     * The node is still drained, so we know the coroutines have yielded in
+     * nbd_read_eof(), the only place where bs->in_flight can reach 0, or they
+     * are entered for the first time. Both places are safe for entering the
+     * coroutines.
      */
-    qemu_aio_coroutine_enter(bs->aio_context, s->connection_co);
+    for (i = 0; i < s->num_conns; i++) {
+        if (s->conns[i].connection_co) {
+            qemu_aio_coroutine_enter(bs->aio_context,
+                                     s->conns[i].connection_co);
+        }
+    }
     bdrv_dec_in_flight(bs);
 }
 
@@ -128,8 +152,12 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
                                           AioContext *new_context)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    qio_channel_attach_aio_context(QIO_CHANNEL(s->ioc), new_context);
+    for (i = 0; i < s->num_conns; i++) {
+        qio_channel_attach_aio_context(QIO_CHANNEL(s->conns[i].ioc),
+                                       new_context);
+    }
 
     bdrv_inc_in_flight(bs);
 
@@ -141,33 +169,31 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
 }
 
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(NBDConnection *conn)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
-
-    assert(s->ioc);
+    assert(conn->ioc);
 
     /* finish any pending coroutines */
-    qio_channel_shutdown(s->ioc,
+    qio_channel_shutdown(conn->ioc,
                          QIO_CHANNEL_SHUTDOWN_BOTH,
                          NULL);
-    BDRV_POLL_WHILE(bs, s->connection_co);
+    BDRV_POLL_WHILE(conn->bs, conn->connection_co);
 
-    nbd_client_detach_aio_context(bs);
-    object_unref(OBJECT(s->sioc));
-    s->sioc = NULL;
-    object_unref(OBJECT(s->ioc));
-    s->ioc = NULL;
+    qio_channel_detach_aio_context(QIO_CHANNEL(conn->ioc));
+    object_unref(OBJECT(conn->sioc));
+    conn->sioc = NULL;
+    object_unref(OBJECT(conn->ioc));
+    conn->ioc = NULL;
 }
 
 static coroutine_fn void nbd_connection_entry(void *opaque)
 {
-    BDRVNBDState *s = opaque;
+    NBDConnection *conn = opaque;
     uint64_t i;
     int ret = 0;
     Error *local_err = NULL;
 
-    while (s->state != NBD_CLIENT_QUIT) {
+    while (conn->state != NBD_CLIENT_QUIT) {
         /*
          * The NBD client can only really be considered idle when it has
          * yielded from qio_channel_readv_all_eof(), waiting for data. This is
@@ -177,15 +203,15 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * Therefore we keep an additional in_flight reference all the time and
          * only drop it temporarily here.
          */
-        assert(s->reply.handle == 0);
-        ret = nbd_receive_reply(s->bs, s->ioc, &s->reply, &local_err);
+        assert(conn->reply.handle == 0);
+        ret = nbd_receive_reply(conn->bs, conn->ioc, &conn->reply, &local_err);
 
         if (local_err) {
             trace_nbd_read_reply_entry_fail(ret, error_get_pretty(local_err));
             error_free(local_err);
         }
         if (ret <= 0) {
-            nbd_channel_error(s, ret ? ret : -EIO);
+            nbd_channel_error(conn, ret ? ret : -EIO);
             break;
         }
 
@@ -194,13 +220,14 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          * handler acts as a synchronization point and ensures that only
          * one coroutine is called until the reply finishes.
          */
-        i = HANDLE_TO_INDEX(s, s->reply.handle);
+        i = HANDLE_TO_INDEX(conn, conn->reply.handle);
         if (i >= MAX_NBD_REQUESTS ||
-            !s->requests[i].coroutine ||
-            !s->requests[i].receiving ||
-            (nbd_reply_is_structured(&s->reply) && !s->info.structured_reply))
+            !conn->requests[i].coroutine ||
+            !conn->requests[i].receiving ||
+            (nbd_reply_is_structured(&conn->reply) &&
+             !conn->info.structured_reply))
         {
-            nbd_channel_error(s, -EINVAL);
+            nbd_channel_error(conn, -EINVAL);
             break;
         }
 
@@ -216,38 +243,37 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
          *   connection_co happens through a bottom half, which can only
          *   run after we yield.
          */
-        aio_co_wake(s->requests[i].coroutine);
+        aio_co_wake(conn->requests[i].coroutine);
         qemu_coroutine_yield();
     }
 
-    nbd_recv_coroutines_wake_all(s);
-    bdrv_dec_in_flight(s->bs);
+    nbd_recv_coroutines_wake_all(conn);
+    bdrv_dec_in_flight(conn->bs);
 
-    s->connection_co = NULL;
+    conn->connection_co = NULL;
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+static int nbd_co_send_request(NBDConnection *conn,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
-    qemu_co_mutex_lock(&s->send_mutex);
-    while (s->in_flight == MAX_NBD_REQUESTS) {
-        qemu_co_queue_wait(&s->free_sema, &s->send_mutex);
+    qemu_co_mutex_lock(&conn->send_mutex);
+    while (conn->in_flight == MAX_NBD_REQUESTS) {
+        qemu_co_queue_wait(&conn->free_sema, &conn->send_mutex);
     }
 
-    if (s->state != NBD_CLIENT_CONNECTED) {
+    if (conn->state != NBD_CLIENT_CONNECTED) {
         rc = -EIO;
         goto err;
     }
 
-    s->in_flight++;
+    conn->in_flight++;
 
     for (i = 0; i < MAX_NBD_REQUESTS; i++) {
-        if (s->requests[i].coroutine == NULL) {
+        if (conn->requests[i].coroutine == NULL) {
             break;
         }
     }
@@ -255,40 +281,40 @@ static int nbd_co_send_request(BlockDriverState *bs,
     g_assert(qemu_in_coroutine());
     assert(i < MAX_NBD_REQUESTS);
 
-    s->requests[i].coroutine = qemu_coroutine_self();
-    s->requests[i].offset = request->from;
-    s->requests[i].receiving = false;
+    conn->requests[i].coroutine = qemu_coroutine_self();
+    conn->requests[i].offset = request->from;
+    conn->requests[i].receiving = false;
 
-    request->handle = INDEX_TO_HANDLE(s, i);
+    request->handle = INDEX_TO_HANDLE(conn, i);
 
-    assert(s->ioc);
+    assert(conn->ioc);
 
     if (qiov) {
-        qio_channel_set_cork(s->ioc, true);
-        rc = nbd_send_request(s->ioc, request);
-        if (rc >= 0 && s->state == NBD_CLIENT_CONNECTED) {
-            if (qio_channel_writev_all(s->ioc, qiov->iov, qiov->niov,
+        qio_channel_set_cork(conn->ioc, true);
+        rc = nbd_send_request(conn->ioc, request);
+        if (rc >= 0 && conn->state == NBD_CLIENT_CONNECTED) {
+            if (qio_channel_writev_all(conn->ioc, qiov->iov, qiov->niov,
                                        NULL) < 0) {
                 rc = -EIO;
             }
         } else if (rc >= 0) {
             rc = -EIO;
         }
-        qio_channel_set_cork(s->ioc, false);
+        qio_channel_set_cork(conn->ioc, false);
     } else {
-        rc = nbd_send_request(s->ioc, request);
+        rc = nbd_send_request(conn->ioc, request);
     }
 
 err:
     if (rc < 0) {
-        nbd_channel_error(s, rc);
+        nbd_channel_error(conn, rc);
         if (i != -1) {
-            s->requests[i].coroutine = NULL;
-            s->in_flight--;
+            conn->requests[i].coroutine = NULL;
+            conn->in_flight--;
         }
-        qemu_co_queue_next(&s->free_sema);
+        qemu_co_queue_next(&conn->free_sema);
     }
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_unlock(&conn->send_mutex);
     return rc;
 }
 
@@ -310,7 +336,7 @@ static inline uint64_t payload_advance64(uint8_t **payload)
     return ldq_be_p(*payload - 8);
 }
 
-static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
+static int nbd_parse_offset_hole_payload(NBDConnection *conn,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_offset,
                                          QEMUIOVector *qiov, Error **errp)
@@ -333,8 +359,8 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block &&
-        !QEMU_IS_ALIGNED(hole_size, s->info.min_block)) {
+    if (conn->info.min_block &&
+        !QEMU_IS_ALIGNED(hole_size, conn->info.min_block)) {
         trace_nbd_structured_read_compliance("hole");
     }
 
@@ -348,7 +374,7 @@ static int nbd_parse_offset_hole_payload(BDRVNBDState *s,
  * Based on our request, we expect only one extent in reply, for the
  * base:allocation context.
  */
-static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
+static int nbd_parse_blockstatus_payload(NBDConnection *conn,
                                          NBDStructuredReplyChunk *chunk,
                                          uint8_t *payload, uint64_t orig_length,
                                          NBDExtent *extent, Error **errp)
@@ -363,11 +389,11 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
     }
 
     context_id = payload_advance32(&payload);
-    if (s->info.context_id != context_id) {
+    if (conn->info.context_id != context_id) {
         error_setg(errp, "Protocol error: unexpected context id %d for "
                          "NBD_REPLY_TYPE_BLOCK_STATUS, when negotiated context "
                          "id is %d", context_id,
-                         s->info.context_id);
+                         conn->info.context_id);
         return -EINVAL;
     }
 
@@ -392,14 +418,14 @@ static int nbd_parse_blockstatus_payload(BDRVNBDState *s,
      * up to the full block and change the status to fully-allocated
      * (always a safe status, even if it loses information).
      */
-    if (s->info.min_block && !QEMU_IS_ALIGNED(extent->length,
-                                                   s->info.min_block)) {
+    if (conn->info.min_block && !QEMU_IS_ALIGNED(extent->length,
+                                                   conn->info.min_block)) {
         trace_nbd_parse_blockstatus_compliance("extent length is unaligned");
-        if (extent->length > s->info.min_block) {
+        if (extent->length > conn->info.min_block) {
             extent->length = QEMU_ALIGN_DOWN(extent->length,
-                                             s->info.min_block);
+                                             conn->info.min_block);
         } else {
-            extent->length = s->info.min_block;
+            extent->length = conn->info.min_block;
             extent->flags = 0;
         }
     }
@@ -465,7 +491,7 @@ static int nbd_parse_error_payload(NBDStructuredReplyChunk *chunk,
     return 0;
 }
 
-static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
+static int nbd_co_receive_offset_data_payload(NBDConnection *conn,
                                               uint64_t orig_offset,
                                               QEMUIOVector *qiov, Error **errp)
 {
@@ -473,9 +499,9 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
     uint64_t offset;
     size_t data_size;
     int ret;
-    NBDStructuredReplyChunk *chunk = &s->reply.structured;
+    NBDStructuredReplyChunk *chunk = &conn->reply.structured;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&conn->reply));
 
     /* The NBD spec requires at least one byte of payload */
     if (chunk->length <= sizeof(offset)) {
@@ -484,7 +510,7 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
         return -EINVAL;
     }
 
-    if (nbd_read64(s->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
+    if (nbd_read64(conn->ioc, &offset, "OFFSET_DATA offset", errp) < 0) {
         return -EIO;
     }
 
@@ -496,13 +522,14 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
                          " region");
         return -EINVAL;
     }
-    if (s->info.min_block && !QEMU_IS_ALIGNED(data_size, s->info.min_block)) {
+    if (conn->info.min_block &&
+        !QEMU_IS_ALIGNED(data_size, conn->info.min_block)) {
         trace_nbd_structured_read_compliance("data");
     }
 
     qemu_iovec_init(&sub_qiov, qiov->niov);
     qemu_iovec_concat(&sub_qiov, qiov, offset - orig_offset, data_size);
-    ret = qio_channel_readv_all(s->ioc, sub_qiov.iov, sub_qiov.niov, errp);
+    ret = qio_channel_readv_all(conn->ioc, sub_qiov.iov, sub_qiov.niov, errp);
     qemu_iovec_destroy(&sub_qiov);
 
     return ret < 0 ? -EIO : 0;
@@ -510,14 +537,14 @@ static int nbd_co_receive_offset_data_payload(BDRVNBDState *s,
 
 #define NBD_MAX_MALLOC_PAYLOAD 1000
 static coroutine_fn int nbd_co_receive_structured_payload(
-        BDRVNBDState *s, void **payload, Error **errp)
+        NBDConnection *conn, void **payload, Error **errp)
 {
     int ret;
     uint32_t len;
 
-    assert(nbd_reply_is_structured(&s->reply));
+    assert(nbd_reply_is_structured(&conn->reply));
 
-    len = s->reply.structured.length;
+    len = conn->reply.structured.length;
 
     if (len == 0) {
         return 0;
@@ -534,7 +561,7 @@ static coroutine_fn int nbd_co_receive_structured_payload(
     }
 
     *payload = g_new(char, len);
-    ret = nbd_read(s->ioc, *payload, len, "structured payload", errp);
+    ret = nbd_read(conn->ioc, *payload, len, "structured payload", errp);
     if (ret < 0) {
         g_free(*payload);
         *payload = NULL;
@@ -560,11 +587,11 @@ static coroutine_fn int nbd_co_receive_structured_payload(
  * corresponding to the server's error reply), and errp is unchanged.
  */
 static coroutine_fn int nbd_co_do_receive_one_chunk(
-        BDRVNBDState *s, uint64_t handle, bool only_structured,
+        NBDConnection *conn, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, void **payload, Error **errp)
 {
     int ret;
-    int i = HANDLE_TO_INDEX(s, handle);
+    int i = HANDLE_TO_INDEX(conn, handle);
     void *local_payload = NULL;
     NBDStructuredReplyChunk *chunk;
 
@@ -574,36 +601,36 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
     *request_ret = 0;
 
     /* Wait until we're woken up by nbd_connection_entry.  */
-    s->requests[i].receiving = true;
+    conn->requests[i].receiving = true;
     qemu_coroutine_yield();
-    s->requests[i].receiving = false;
-    if (s->state != NBD_CLIENT_CONNECTED) {
+    conn->requests[i].receiving = false;
+    if (conn->state != NBD_CLIENT_CONNECTED) {
         error_setg(errp, "Connection closed");
         return -EIO;
     }
-    assert(s->ioc);
+    assert(conn->ioc);
 
-    assert(s->reply.handle == handle);
+    assert(conn->reply.handle == handle);
 
-    if (nbd_reply_is_simple(&s->reply)) {
+    if (nbd_reply_is_simple(&conn->reply)) {
         if (only_structured) {
             error_setg(errp, "Protocol error: simple reply when structured "
                              "reply chunk was expected");
             return -EINVAL;
         }
 
-        *request_ret = -nbd_errno_to_system_errno(s->reply.simple.error);
+        *request_ret = -nbd_errno_to_system_errno(conn->reply.simple.error);
         if (*request_ret < 0 || !qiov) {
             return 0;
         }
 
-        return qio_channel_readv_all(s->ioc, qiov->iov, qiov->niov,
+        return qio_channel_readv_all(conn->ioc, qiov->iov, qiov->niov,
                                      errp) < 0 ? -EIO : 0;
     }
 
     /* handle structured reply chunk */
-    assert(s->info.structured_reply);
-    chunk = &s->reply.structured;
+    assert(conn->info.structured_reply);
+    chunk = &conn->reply.structured;
 
     if (chunk->type == NBD_REPLY_TYPE_NONE) {
         if (!(chunk->flags & NBD_REPLY_FLAG_DONE)) {
@@ -625,7 +652,8 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
             return -EINVAL;
         }
 
-        return nbd_co_receive_offset_data_payload(s, s->requests[i].offset,
+        return nbd_co_receive_offset_data_payload(conn,
+                                                  conn->requests[i].offset,
                                                   qiov, errp);
     }
 
@@ -633,7 +661,7 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
         payload = &local_payload;
     }
 
-    ret = nbd_co_receive_structured_payload(s, payload, errp);
+    ret = nbd_co_receive_structured_payload(conn, payload, errp);
     if (ret < 0) {
         return ret;
     }
@@ -649,28 +677,28 @@ static coroutine_fn int nbd_co_do_receive_one_chunk(
 
 /*
  * nbd_co_receive_one_chunk
- * Read reply, wake up connection_co and set s->quit if needed.
+ * Read reply, wake up connection_co and set conn->quit if needed.
  * Return value is a fatal error code or normal nbd reply error code
  */
 static coroutine_fn int nbd_co_receive_one_chunk(
-        BDRVNBDState *s, uint64_t handle, bool only_structured,
+        NBDConnection *conn, uint64_t handle, bool only_structured,
         int *request_ret, QEMUIOVector *qiov, NBDReply *reply, void **payload,
         Error **errp)
 {
-    int ret = nbd_co_do_receive_one_chunk(s, handle, only_structured,
+    int ret = nbd_co_do_receive_one_chunk(conn, handle, only_structured,
                                           request_ret, qiov, payload, errp);
 
     if (ret < 0) {
         memset(reply, 0, sizeof(*reply));
-        nbd_channel_error(s, ret);
+        nbd_channel_error(conn, ret);
     } else {
         /* For assert at loop start in nbd_connection_entry */
-        *reply = s->reply;
-        s->reply.handle = 0;
+        *reply = conn->reply;
+        conn->reply.handle = 0;
     }
 
-    if (s->connection_co) {
-        aio_co_wake(s->connection_co);
+    if (conn->connection_co) {
+        aio_co_wake(conn->connection_co);
     }
 
     return ret;
@@ -711,16 +739,17 @@ static void nbd_iter_request_error(NBDReplyChunkIter *iter, int ret)
  * NBD_FOREACH_REPLY_CHUNK
  * The pointer stored in @payload requires g_free() to free it.
  */
-#define NBD_FOREACH_REPLY_CHUNK(s, iter, handle, structured, \
+#define NBD_FOREACH_REPLY_CHUNK(conn, iter, handle, structured, \
                                 qiov, reply, payload) \
     for (iter = (NBDReplyChunkIter) { .only_structured = structured }; \
-         nbd_reply_chunk_iter_receive(s, &iter, handle, qiov, reply, payload);)
+         nbd_reply_chunk_iter_receive(conn, &iter, handle, qiov, reply, \
+                                      payload);)
 
 /*
  * nbd_reply_chunk_iter_receive
  * The pointer stored in @payload requires g_free() to free it.
  */
-static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
+static bool nbd_reply_chunk_iter_receive(NBDConnection *conn,
                                          NBDReplyChunkIter *iter,
                                          uint64_t handle,
                                          QEMUIOVector *qiov, NBDReply *reply,
@@ -730,7 +759,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     NBDReply local_reply;
     NBDStructuredReplyChunk *chunk;
     Error *local_err = NULL;
-    if (s->state != NBD_CLIENT_CONNECTED) {
+    if (conn->state != NBD_CLIENT_CONNECTED) {
         error_setg(&local_err, "Connection closed");
         nbd_iter_channel_error(iter, -EIO, &local_err);
         goto break_loop;
@@ -745,7 +774,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
         reply = &local_reply;
     }
 
-    ret = nbd_co_receive_one_chunk(s, handle, iter->only_structured,
+    ret = nbd_co_receive_one_chunk(conn, handle, iter->only_structured,
                                    &request_ret, qiov, reply, payload,
                                    &local_err);
     if (ret < 0) {
@@ -755,7 +784,7 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     }
 
     /* Do not execute the body of NBD_FOREACH_REPLY_CHUNK for simple reply. */
-    if (nbd_reply_is_simple(reply) || s->state != NBD_CLIENT_CONNECTED) {
+    if (nbd_reply_is_simple(reply) || conn->state != NBD_CLIENT_CONNECTED) {
         goto break_loop;
     }
 
@@ -777,22 +806,22 @@ static bool nbd_reply_chunk_iter_receive(BDRVNBDState *s,
     return true;
 
 break_loop:
-    s->requests[HANDLE_TO_INDEX(s, handle)].coroutine = NULL;
+    conn->requests[HANDLE_TO_INDEX(conn, handle)].coroutine = NULL;
 
-    qemu_co_mutex_lock(&s->send_mutex);
-    s->in_flight--;
-    qemu_co_queue_next(&s->free_sema);
-    qemu_co_mutex_unlock(&s->send_mutex);
+    qemu_co_mutex_lock(&conn->send_mutex);
+    conn->in_flight--;
+    qemu_co_queue_next(&conn->free_sema);
+    qemu_co_mutex_unlock(&conn->send_mutex);
 
     return false;
 }
 
-static int nbd_co_receive_return_code(BDRVNBDState *s, uint64_t handle,
+static int nbd_co_receive_return_code(NBDConnection *conn, uint64_t handle,
                                       int *request_ret, Error **errp)
 {
     NBDReplyChunkIter iter;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, false, NULL, NULL, NULL) {
+    NBD_FOREACH_REPLY_CHUNK(conn, iter, handle, false, NULL, NULL, NULL) {
         /* nbd_reply_chunk_iter_receive does all the work */
     }
 
@@ -801,7 +830,7 @@ static int nbd_co_receive_return_code(BDRVNBDState *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
+static int nbd_co_receive_cmdread_reply(NBDConnection *conn, uint64_t handle,
                                         uint64_t offset, QEMUIOVector *qiov,
                                         int *request_ret, Error **errp)
 {
@@ -810,7 +839,7 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
     void *payload = NULL;
     Error *local_err = NULL;
 
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->info.structured_reply,
+    NBD_FOREACH_REPLY_CHUNK(conn, iter, handle, conn->info.structured_reply,
                             qiov, &reply, &payload)
     {
         int ret;
@@ -826,17 +855,18 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
              */
             break;
         case NBD_REPLY_TYPE_OFFSET_HOLE:
-            ret = nbd_parse_offset_hole_payload(s, &reply.structured, payload,
-                                                offset, qiov, &local_err);
+            ret = nbd_parse_offset_hole_payload(conn, &reply.structured,
+                                                payload, offset, qiov,
+                                                &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(conn, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
                 /* not allowed reply type */
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(conn, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) for CMD_READ",
                            chunk->type, nbd_reply_type_lookup(chunk->type));
@@ -853,7 +883,7 @@ static int nbd_co_receive_cmdread_reply(BDRVNBDState *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
+static int nbd_co_receive_blockstatus_reply(NBDConnection *conn,
                                             uint64_t handle, uint64_t length,
                                             NBDExtent *extent,
                                             int *request_ret, Error **errp)
@@ -865,7 +895,7 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     bool received = false;
 
     assert(!extent->length);
-    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, false, NULL, &reply, &payload) {
+    NBD_FOREACH_REPLY_CHUNK(conn, iter, handle, false, NULL, &reply, &payload) {
         int ret;
         NBDStructuredReplyChunk *chunk = &reply.structured;
 
@@ -874,23 +904,23 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
         switch (chunk->type) {
         case NBD_REPLY_TYPE_BLOCK_STATUS:
             if (received) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(conn, -EINVAL);
                 error_setg(&local_err, "Several BLOCK_STATUS chunks in reply");
                 nbd_iter_channel_error(&iter, -EINVAL, &local_err);
             }
             received = true;
 
-            ret = nbd_parse_blockstatus_payload(s, &reply.structured,
+            ret = nbd_parse_blockstatus_payload(conn, &reply.structured,
                                                 payload, length, extent,
                                                 &local_err);
             if (ret < 0) {
-                nbd_channel_error(s, ret);
+                nbd_channel_error(conn, ret);
                 nbd_iter_channel_error(&iter, ret, &local_err);
             }
             break;
         default:
             if (!nbd_reply_type_is_error(chunk->type)) {
-                nbd_channel_error(s, -EINVAL);
+                nbd_channel_error(conn, -EINVAL);
                 error_setg(&local_err,
                            "Unexpected reply type: %d (%s) "
                            "for CMD_BLOCK_STATUS",
@@ -913,12 +943,36 @@ static int nbd_co_receive_blockstatus_reply(BDRVNBDState *s,
     return iter.ret;
 }
 
+/*
+ * Pick the connection for a new request: the least busy of those that are
+ * still usable, starting the search at a different connection each time.
+ */
+static NBDConnection *nbd_get_connection(BDRVNBDState *s)
+{
+    NBDConnection *best = NULL;
+    int i;
+
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnection *conn = &s->conns[(s->next_conn + i) % s->num_conns];
+
+        if (conn->state == NBD_CLIENT_CONNECTED &&
+            (!best || conn->in_flight < best->in_flight)) {
+            best = conn;
+        }
+    }
+    s->next_conn++;
+
+    /* If all connections are gone, let the request fail on the first one */
+    return best ?: &s->conns[0];
+}
+
 static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *conn = nbd_get_connection(s);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -927,12 +981,12 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     } else {
         assert(request->type != NBD_CMD_WRITE);
     }
-    ret = nbd_co_send_request(bs, request, write_qiov);
+    ret = nbd_co_send_request(conn, request, write_qiov);
     if (ret < 0) {
         return ret;
     }
 
-    ret = nbd_co_receive_return_code(s, request->handle,
+    ret = nbd_co_receive_return_code(conn, request->handle,
                                      &request_ret, &local_err);
     if (local_err) {
         trace_nbd_co_request_fail(request->from, request->len, request->handle,
@@ -950,6 +1004,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *conn;
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -981,12 +1036,13 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
         request.len -= slop;
     }
 
-    ret = nbd_co_send_request(bs, &request, NULL);
+    conn = nbd_get_connection(s);
+    ret = nbd_co_send_request(conn, &request, NULL);
     if (ret < 0) {
         return ret;
     }
 
-    ret = nbd_co_receive_cmdread_reply(s, request.handle, offset, qiov,
+    ret = nbd_co_receive_cmdread_reply(conn, request.handle, offset, qiov,
                                        &request_ret, &local_err);
     if (local_err) {
         trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -1095,6 +1151,7 @@ static int coroutine_fn nbd_client_co_block_status(
     int ret, request_ret;
     NBDExtent extent = { 0 };
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    NBDConnection *conn;
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1131,12 +1188,13 @@ static int coroutine_fn nbd_client_co_block_status(
     if (s->info.min_block) {
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
-    ret = nbd_co_send_request(bs, &request, NULL);
+    conn = nbd_get_connection(s);
+    ret = nbd_co_send_request(conn, &request, NULL);
     if (ret < 0) {
         return ret;
     }
 
-    ret = nbd_co_receive_blockstatus_reply(s, request.handle, bytes,
+    ret = nbd_co_receive_blockstatus_reply(conn, request.handle, bytes,
                                            &extent, &request_ret, &local_err);
     if (local_err) {
         trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -1162,12 +1220,18 @@ static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
 
-    assert(s->ioc);
+    for (i = 0; i < s->num_conns; i++) {
+        NBDConnection *conn = &s->conns[i];
 
-    nbd_send_request(s->ioc, &request);
+        assert(conn->ioc);
 
-    nbd_teardown_connection(bs);
+        nbd_send_request(conn->ioc, &request);
+
+        nbd_teardown_connection(conn);
+    }
+    s->num_conns = 0;
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -1191,7 +1255,8 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
     return sioc;
 }
 
-static int nbd_client_connect(BlockDriverState *bs, Error **errp)
+static int nbd_client_connect(BlockDriverState *bs, NBDConnection *conn,
+                              Error **errp)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     AioContext *aio_context = bdrv_get_aio_context(bs);
@@ -1212,31 +1277,49 @@ static int nbd_client_connect(BlockDriverState *bs, Error **errp)
     qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
     qio_channel_attach_aio_context(QIO_CHANNEL(sioc), aio_context);
 
-    s->info.request_sizes = true;
-    s->info.structured_reply = true;
-    s->info.base_allocation = true;
-    s->info.x_dirty_bitmap = g_strdup(s->x_dirty_bitmap);
-    s->info.name = g_strdup(s->export ?: "");
+    conn->info.request_sizes = true;
+    conn->info.structured_reply = true;
+    conn->info.base_allocation = true;
+    conn->info.x_dirty_bitmap = g_strdup(s->x_dirty_bitmap);
+    conn->info.name = g_strdup(s->export ?: "");
     ret = nbd_receive_negotiate(aio_context, QIO_CHANNEL(sioc), s->tlscreds,
-                                s->hostname, &s->ioc, &s->info, errp);
-    g_free(s->info.x_dirty_bitmap);
-    g_free(s->info.name);
+                                s->hostname, &conn->ioc, &conn->info, errp);
+    g_free(conn->info.x_dirty_bitmap);
+    g_free(conn->info.name);
+    conn->info.x_dirty_bitmap = NULL;
+    conn->info.name = NULL;
     if (ret < 0) {
         object_unref(OBJECT(sioc));
         return ret;
     }
-    if (s->x_dirty_bitmap && !s->info.base_allocation) {
+    if (s->x_dirty_bitmap && !conn->info.base_allocation) {
         error_setg(errp, "requested x-dirty-bitmap %s not found",
                    s->x_dirty_bitmap);
         ret = -EINVAL;
         goto fail;
     }
+    if (conn == &s->conns[0]) {
+        s->info = conn->info;
+    } else if (conn->info.size != s->info.size ||
+               conn->info.flags != s->info.flags ||
+               conn->info.structured_reply != s->info.structured_reply ||
+               conn->info.base_allocation != s->info.base_allocation) {
+        /* Additional connections must see the very same export */
+        error_setg(errp, "NBD export changed between connections");
+        ret = -EINVAL;
+        goto fail;
+    }
     if (s->info.flags & NBD_FLAG_READ_ONLY) {
         ret = bdrv_apply_auto_read_only(bs, "NBD export is read-only", errp);
         if (ret < 0) {
             goto fail;
         }
     }
+    /*
+     * A dirty bitmap reported instead of the allocation status can change
+     * without any write through this node
+     */
+    bs->cache_block_status = !s->x_dirty_bitmap;
     if (s->info.flags & NBD_FLAG_SEND_FUA) {
         bs->supported_write_flags = BDRV_REQ_FUA;
         bs->supported_zero_flags |= BDRV_REQ_FUA;
@@ -1248,11 +1331,11 @@ static int nbd_client_connect(BlockDriverState *bs, Error **errp)
         }
     }
 
-    s->sioc = sioc;
+    conn->sioc = sioc;
 
-    if (!s->ioc) {
-        s->ioc = QIO_CHANNEL(sioc);
-        object_ref(OBJECT(s->ioc));
+    if (!conn->ioc) {
+        conn->ioc = QIO_CHANNEL(sioc);
+        object_ref(OBJECT(conn->ioc));
     }
 
     trace_nbd_client_connect_success(s->export);
@@ -1267,8 +1350,12 @@ static int nbd_client_connect(BlockDriverState *bs, Error **errp)
     {
         NBDRequest request = { .type = NBD_CMD_DISC };
 
-        nbd_send_request(s->ioc ?: QIO_CHANNEL(sioc), &request);
+        nbd_send_request(conn->ioc ?: QIO_CHANNEL(sioc), &request);
 
+        if (conn->ioc) {
+            object_unref(OBJECT(conn->ioc));
+            conn->ioc = NULL;
+        }
         object_unref(OBJECT(sioc));
 
         return ret;
@@ -1590,6 +1677,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to spread requests over, if the "
+                    "server allows it (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -1637,6 +1730,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
         s->hostname = s->saddr->u.inet.host;
     }
 
+    s->multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (s->multi_conn < 1 || s->multi_conn > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+
     s->x_dirty_bitmap = g_strdup(qemu_opt_get(opts, "x-dirty-bitmap"));
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
@@ -1656,7 +1756,8 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
-    int ret;
+    int ret, i;
+    int num_conns = 1;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
 
     ret = nbd_process_options(bs, options, errp);
@@ -1664,22 +1765,46 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         return ret;
     }
 
-    s->bs = bs;
-    qemu_co_mutex_init(&s->send_mutex);
-    qemu_co_queue_init(&s->free_sema);
+    for (i = 0; i < num_conns; i++) {
+        NBDConnection *conn = &s->conns[i];
 
-    ret = nbd_client_connect(bs, errp);
-    if (ret < 0) {
-        return ret;
-    }
-    /* successfully connected */
-    s->state = NBD_CLIENT_CONNECTED;
+        conn->bs = bs;
+        qemu_co_mutex_init(&conn->send_mutex);
+        qemu_co_queue_init(&conn->free_sema);
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+        ret = nbd_client_connect(bs, conn, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+        /* successfully connected */
+        conn->state = NBD_CLIENT_CONNECTED;
+        s->num_conns++;
+
+        conn->connection_co = qemu_coroutine_create(nbd_connection_entry,
+                                                    conn);
+        bdrv_inc_in_flight(bs);
+        aio_co_schedule(bdrv_get_aio_context(bs), conn->connection_co);
+
+        if (i == 0) {
+            /*
+             * Without NBD_FLAG_CAN_MULTI_CONN, a flush on one connection
+             * need not cover writes made on the others.
+             */
+            num_conns = s->multi_conn;
+            if (num_conns > 1 && !(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+                trace_nbd_client_multi_conn_unsupported(s->multi_conn);
+                num_conns = 1;
+            }
+        }
+    }
 
     return 0;
+
+ fail:
+    if (s->num_conns) {
+        nbd_client_close(bs);
+    }
+    return ret;
 }
 
 static int nbd_co_flush(BlockDriverState *bs)
@@ -30,6 +30,7 @@
 #define NVME_SQ_ENTRY_BYTES 64
 #define NVME_CQ_ENTRY_BYTES 16
 #define NVME_QUEUE_SIZE 128
+#define NVME_MAX_BOUNCE_BUFS 8
 #define NVME_BAR_SIZE 8192
 
 typedef struct {
@@ -98,6 +99,8 @@ typedef struct {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    /* Where nvme_get_io_queue() starts looking for the least busy queue. */
+    unsigned next_io_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -117,12 +120,24 @@ typedef struct {
     /* Total size of mapped qiov, accessed under dma_map_lock */
     int dma_map_count;
 
+    /* Bounce buffers of max_transfer bytes for unaligned requests.  They are
+     * allocated on demand and stay DMA mapped until close, so that buffered
+     * requests don't eat temporary IOVA space.  Entries [0, nr_free_bounce)
+     * are free. */
+    void *bounce_bufs[NVME_MAX_BOUNCE_BUFS];
+    int nr_bounce_bufs;
+    int nr_free_bounce;
+
     /* PCI address (required for nvme_refresh_filename()) */
     char *device;
 } BDRVNVMeState;
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
+
+/* Upper bound for the number of I/O queue pairs requested from the device */
+#define NVME_MAX_IO_QUEUES 64
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -138,6 +153,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -555,6 +575,45 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     return true;
 }
 
+/* Ask the controller to allocate @nr_io_queues I/O queue pairs.  The
+ * controller may grant fewer than requested; nvme_init() copes with that by
+ * stopping at the first queue that fails to be created. */
+static void nvme_set_num_queues(BlockDriverState *bs, int nr_io_queues)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((nr_io_queues - 1) << 16) |
+                             (nr_io_queues - 1)),
+    };
+
+    if (nvme_cmd_sync(bs, s->queues[0], &cmd)) {
+        trace_nvme_set_num_queues_failed(s, nr_io_queues);
+    }
+}
+
+/* Pick the I/O queue pair with the fewest outstanding requests, starting at a
+ * rotating index so that idle queues are used in turn. */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    int nr_io_queues = s->nr_queues - 1;
+    int start = s->next_io_queue++ % nr_io_queues;
+    NVMeQueuePair *best = NULL;
+    int i;
+
+    assert(nr_io_queues > 0);
+    for (i = 0; i < nr_io_queues; i++) {
+        NVMeQueuePair *q = s->queues[1 + (start + i) % nr_io_queues];
+
+        if (!best ||
+            q->inflight + q->need_kick < best->inflight + best->need_kick) {
+            best = q;
+        }
+    }
+    return best;
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -567,7 +626,7 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     int num_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     int ret;
@@ -674,8 +733,19 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
+    nvme_set_num_queues(bs, num_queues);
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->nr_queues - 1 < num_queues) {
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            /* The controller granted fewer queues; use what we have. */
+            trace_nvme_add_io_queue_limit(s, s->nr_queues - 1, num_queues);
+            error_free(local_err);
+            local_err = NULL;
+            break;
+        }
     }
 out:
     /* Cleaning up is done in nvme_file_open() upon error. */
@@ -742,6 +812,12 @@ static void nvme_close(BlockDriverState *bs)
     int i;
     BDRVNVMeState *s = bs->opaque;
 
+    assert(s->nr_free_bounce == s->nr_bounce_bufs);
+    for (i = 0; i < s->nr_bounce_bufs; i++) {
+        qemu_vfio_dma_unmap(s->vfio, s->bounce_bufs[i]);
+        qemu_vfree(s->bounce_bufs[i]);
+    }
+
     for (i = 0; i < s->nr_queues; ++i) {
         nvme_free_queue_pair(bs, s->queues[i]);
     }
@@ -761,6 +837,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    int64_t num_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -774,7 +851,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    num_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    if (num_queues < 1 || num_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between 1 "
+                   "and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, num_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -946,7 +1030,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -965,6 +1049,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 
     trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1010,12 +1095,45 @@ static inline bool nvme_qiov_aligned(BlockDriverState *bs,
     return true;
 }
 
+/* Take a pre-mapped bounce buffer of s->max_transfer bytes from the pool,
+ * growing it if needed.  Returns NULL if the pool is exhausted. */
+static void *nvme_get_bounce_buf(BlockDriverState *bs)
+{
+    BDRVNVMeState *s = bs->opaque;
+    void *buf;
+
+    if (s->nr_free_bounce) {
+        return s->bounce_bufs[--s->nr_free_bounce];
+    }
+    if (s->nr_bounce_bufs == NVME_MAX_BOUNCE_BUFS) {
+        return NULL;
+    }
+    buf = qemu_try_blockalign(bs, s->max_transfer);
+    if (!buf) {
+        return NULL;
+    }
+    if (qemu_vfio_dma_map(s->vfio, buf, s->max_transfer, false, NULL)) {
+        qemu_vfree(buf);
+        return NULL;
+    }
+    /* Busy buffers are not tracked; all are back once requests drained. */
+    s->nr_bounce_bufs++;
+    return buf;
+}
+
+static void nvme_put_bounce_buf(BDRVNVMeState *s, void *buf)
+{
+    assert(s->nr_free_bounce < s->nr_bounce_bufs);
+    s->bounce_bufs[s->nr_free_bounce++] = buf;
+}
+
 static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, bool is_write, int flags)
 {
     BDRVNVMeState *s = bs->opaque;
     int r;
     uint8_t *buf = NULL;
+    bool pooled = true;
     QEMUIOVector local_qiov;
 
     assert(QEMU_IS_ALIGNED(offset, s->page_size));
@@ -1025,7 +1143,12 @@ static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
         return nvme_co_prw_aligned(bs, offset, bytes, qiov, is_write, flags);
     }
     trace_nvme_prw_buffered(s, offset, bytes, qiov->niov, is_write);
-    buf = qemu_try_blockalign(bs, bytes);
+    buf = nvme_get_bounce_buf(bs);
+    if (!buf) {
+        /* Fall back to a temporarily mapped buffer. */
+        pooled = false;
+        buf = qemu_try_blockalign(bs, bytes);
+    }
 
     if (!buf) {
         return -ENOMEM;
@@ -1040,7 +1163,11 @@ static int nvme_co_prw(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
     if (!r && !is_write) {
         qemu_iovec_from_buf(qiov, 0, buf, bytes);
     }
-    qemu_vfree(buf);
+    if (pooled) {
+        nvme_put_bounce_buf(s, buf);
+    } else {
+        qemu_vfree(buf);
+    }
     return r;
 }
 
@@ -1061,7 +1188,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1073,6 +1200,7 @@ static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
     };
 
     assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(s, ioq, req, &cmd, nvme_rw_cb, &data);
@@ -510,6 +510,38 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
                                  &ds->flush_latency_histogram);
 }
 
+static BlockNodeStats *bdrv_query_node_stats(BlockDriverState *bs)
+{
+    BlockAcctStats *stats = &bs->node_stats;
+    BlockNodeStats *ns = g_new0(BlockNodeStats, 1);
+
+    qemu_mutex_lock(&stats->lock);
+    ns->rd_operations = stats->nr_ops[BLOCK_ACCT_READ];
+    ns->wr_operations = stats->nr_ops[BLOCK_ACCT_WRITE];
+    ns->flush_operations = stats->nr_ops[BLOCK_ACCT_FLUSH];
+    ns->failed_rd_operations = stats->failed_ops[BLOCK_ACCT_READ];
+    ns->failed_wr_operations = stats->failed_ops[BLOCK_ACCT_WRITE];
+    ns->failed_flush_operations = stats->failed_ops[BLOCK_ACCT_FLUSH];
+    ns->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
+    ns->wr_bytes = stats->nr_bytes[BLOCK_ACCT_WRITE];
+    ns->rd_total_time_ns = stats->total_time_ns[BLOCK_ACCT_READ];
+    ns->wr_total_time_ns = stats->total_time_ns[BLOCK_ACCT_WRITE];
+    ns->flush_total_time_ns = stats->total_time_ns[BLOCK_ACCT_FLUSH];
+
+    bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_READ],
+                                 &ns->has_rd_latency_histogram,
+                                 &ns->rd_latency_histogram);
+    bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_WRITE],
+                                 &ns->has_wr_latency_histogram,
+                                 &ns->wr_latency_histogram);
+    bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_FLUSH],
+                                 &ns->has_flush_latency_histogram,
+                                 &ns->flush_latency_histogram);
+    qemu_mutex_unlock(&stats->lock);
+
+    return ns;
+}
+
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
                                         bool blk_level)
 {
@@ -537,6 +569,11 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    if (atomic_read(&bs->node_stats_enabled)) {
+        s->has_node_stats = true;
+        s->node_stats = bdrv_query_node_stats(bs);
+    }
+
     if (bs->file) {
         s->has_parent = true;
         s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level);
@@ -84,6 +84,7 @@ typedef struct Qcow2Bitmap {
     char *name;
 
     BdrvDirtyBitmap *dirty_bitmap;
+    bool in_place; /* keep the table, rewrite only the changed clusters */
 
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
@@ -338,8 +339,10 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
                                     Qcow2Bitmap *bm, Error **errp)
 {
     int ret;
+    BDRVQcow2State *s = bs->opaque;
     uint64_t *bitmap_table = NULL;
     uint32_t granularity;
+    uint64_t bm_size, tab_size;
     BdrvDirtyBitmap *bitmap = NULL;
 
     granularity = 1U << bm->granularity_bits;
@@ -347,6 +350,7 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
     if (bitmap == NULL) {
         goto fail;
     }
+    bm_size = bdrv_dirty_bitmap_size(bitmap);
 
     if (bm->flags & BME_FLAG_IN_USE) {
         /* Data is unusable, skip loading it */
@@ -361,13 +365,28 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
         goto fail;
     }
 
-    ret = load_bitmap_data(bs, bitmap_table, bm->table.size, bitmap);
-    if (ret < 0) {
-        error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
+    tab_size = size_to_clusters(s,
+        bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
+    if (tab_size != bm->table.size || tab_size > BME_MAX_TABLE_SIZE) {
+        error_setg_errno(errp, EINVAL, "Could not read bitmap '%s' from image",
                          bm->name);
         goto fail;
     }
 
+    /*
+     * The bitmap table is valid, so the data can be read later.  Defer it
+     * until somebody actually needs the bitmap contents: with many large
+     * bitmaps, reading them all would dominate the time needed to open the
+     * image.  See qcow2_load_dirty_bitmap_data().
+     */
+    bdrv_dirty_bitmap_set_lazy(bitmap, true);
+
+    /*
+     * Track which clusters of bitmap data change from now on, so that only
+     * those have to be written back.  See update_bitmap_in_place().
+     */
+    bdrv_create_meta_dirty_bitmap(bitmap, s->cluster_size);
+
     g_free(bitmap_table);
     return bitmap;
 
@@ -1213,6 +1232,12 @@ int qcow2_truncate_bitmaps_check(BlockDriverState *bs, Error **errp)
             ret = -ENOTSUP;
             goto out;
         }
+
+        /* Resizing drops the on-disk data, so it must be in memory now */
+        ret = bdrv_load_dirty_bitmap(bs, bitmap, errp);
+        if (ret < 0) {
+            goto out;
+        }
     }
 
 out:
@@ -1390,6 +1415,194 @@ fail:
     return ret;
 }
 
+/*
+ * Check whether @bm, which is marked in use in the image, can be brought up
+ * to date by update_bitmap_in_place().  This needs the meta bitmap that was
+ * created when the stored data was loaded or last written, and a table that
+ * still fits @bitmap.
+ */
+static bool can_update_bitmap_in_place(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                       BdrvDirtyBitmap *bitmap)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+
+    return bdrv_dirty_bitmap_has_meta(bitmap) &&
+           (bm->flags & BME_FLAG_IN_USE) && bm->table.offset != 0 &&
+           bm->granularity_bits ==
+               ctz32(bdrv_dirty_bitmap_granularity(bitmap)) &&
+           bm->table.size ==
+               size_to_clusters(s, bdrv_dirty_bitmap_serialization_size(
+                                       bitmap, 0, bm_size));
+}
+
+/* Free the data clusters of @tb that are not used by @keep any more */
+static void free_replaced_clusters(BlockDriverState *bs, const uint64_t *tb,
+                                   const uint64_t *keep, uint32_t size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        uint64_t addr = tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+
+        if (addr && addr != (keep[i] & BME_TABLE_ENTRY_OFFSET_MASK)) {
+            qcow2_free_clusters(bs, addr, s->cluster_size,
+                                QCOW2_DISCARD_ALWAYS);
+        }
+    }
+}
+
+/*
+ * Write the clusters of bm->dirty_bitmap that changed since they were last
+ * read from or written to the image, reusing the existing bitmap table.
+ * The bitmap is marked in use in the image, so overwriting its data in
+ * place is safe: nobody trusts it until the directory is updated.
+ *
+ * If the data is still lazy, only the bits set since the image was opened
+ * are in memory; they are merged with the stored cluster before writing it.
+ *
+ * On failure the meta bitmap is dropped, so that the next store writes the
+ * bitmap in full.
+ */
+static int update_bitmap_in_place(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                  Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
+    const char *bm_name = bdrv_dirty_bitmap_name(bitmap);
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+    bool lazy = bdrv_dirty_bitmap_lazy(bitmap);
+    BdrvDirtyBitmapIter *iter = NULL;
+    uint64_t *tb = NULL, *old_tb = NULL;
+    uint8_t *buf = NULL, *old_buf = NULL;
+    uint64_t limit;
+    int64_t offset;
+    int ret;
+
+    if (!bdrv_get_meta_dirty_count(bitmap)) {
+        return 0;
+    }
+
+    ret = bitmap_table_load(bs, &bm->table, &tb);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Could not read bitmap_table table from image for "
+                         "bitmap '%s'", bm_name);
+        goto fail;
+    }
+    old_tb = g_memdup(tb, bm->table.size * sizeof(tb[0]));
+
+    buf = g_malloc(s->cluster_size);
+    if (lazy) {
+        old_buf = g_malloc(s->cluster_size);
+    }
+    limit = bytes_covered_by_bitmap_cluster(s, bitmap);
+
+    iter = bdrv_dirty_meta_iter_new(bitmap);
+    while ((offset = bdrv_dirty_iter_next(iter)) >= 0) {
+        uint64_t cluster = offset / limit;
+        uint64_t data_offset = tb[cluster] & BME_TABLE_ENTRY_OFFSET_MASK;
+        uint64_t end, write_size, i;
+
+        assert(QEMU_IS_ALIGNED(offset, limit) && cluster < bm->table.size);
+        end = MIN(bm_size, offset + limit);
+        write_size = bdrv_dirty_bitmap_serialization_size(bitmap, offset,
+                                                          end - offset);
+        assert(write_size <= s->cluster_size);
+
+        bdrv_dirty_bitmap_serialize_changed_part(bitmap, buf, offset,
+                                                 end - offset);
+        memset(buf + write_size, 0, s->cluster_size - write_size);
+
+        if (lazy && (tb[cluster] & BME_TABLE_ENTRY_FLAG_ALL_ONES)) {
+            memset(buf, 0xff, write_size);
+        } else if (lazy && data_offset) {
+            ret = bdrv_pread(bs->file, data_offset, old_buf, s->cluster_size);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Could not read bitmap '%s' "
+                                 "from image", bm_name);
+                goto fail;
+            }
+            for (i = 0; i < write_size; i++) {
+                buf[i] |= old_buf[i];
+            }
+        }
+
+        if (buffer_is_zero(buf, s->cluster_size)) {
+            /* The cluster is freed once the table no longer points to it */
+            tb[cluster] = 0;
+            continue;
+        }
+
+        if (!data_offset) {
+            int64_t off = qcow2_alloc_clusters(bs, s->cluster_size);
+            if (off < 0) {
+                ret = off;
+                error_setg_errno(errp, -ret,
+                                 "Failed to allocate clusters for bitmap '%s'",
+                                 bm_name);
+                goto fail;
+            }
+            data_offset = off;
+            tb[cluster] = data_offset;
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, data_offset,
+                                            s->cluster_size, false);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+            goto fail;
+        }
+
+        ret = bdrv_pwrite(bs->file, data_offset, buf, s->cluster_size);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
+                             bm_name);
+            goto fail;
+        }
+    }
+
+    if (memcmp(tb, old_tb, bm->table.size * sizeof(tb[0]))) {
+        uint64_t *be_tb;
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, bm->table.offset,
+                                            bm->table.size * sizeof(tb[0]),
+                                            false);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+            goto fail;
+        }
+
+        be_tb = g_memdup(tb, bm->table.size * sizeof(tb[0]));
+        bitmap_table_to_be(be_tb, bm->table.size);
+        ret = bdrv_pwrite(bs->file, bm->table.offset, be_tb,
+                          bm->table.size * sizeof(tb[0]));
+        g_free(be_tb);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
+                             bm_name);
+            goto fail;
+        }
+        free_replaced_clusters(bs, old_tb, tb, bm->table.size);
+    }
+    ret = 0;
+
+fail:
+    bdrv_dirty_iter_free(iter);
+    if (ret < 0) {
+        if (tb) {
+            free_replaced_clusters(bs, tb, old_tb, bm->table.size);
+        }
+        bdrv_release_meta_dirty_bitmap(bitmap);
+    }
+    g_free(old_buf);
+    g_free(buf);
+    g_free(old_tb);
+    g_free(tb);
+    return ret;
+}
+
 static Qcow2Bitmap *find_bitmap_by_name(Qcow2BitmapList *bm_list,
                                         const char *name)
 {
@@ -1404,6 +1617,59 @@ static Qcow2Bitmap *find_bitmap_by_name(Qcow2BitmapList *bm_list,
     return NULL;
 }
 
+/*
+ * Read the on-disk contents of the persistent bitmap @bitmap into @target,
+ * which must be a cleared bitmap of the same size and granularity.
+ */
+int qcow2_load_dirty_bitmap_data(BlockDriverState *bs, BdrvDirtyBitmap *bitmap,
+                                 BdrvDirtyBitmap *target, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    const char *name = bdrv_dirty_bitmap_name(bitmap);
+    Qcow2BitmapList *bm_list;
+    Qcow2Bitmap *bm;
+    uint64_t *bitmap_table = NULL;
+    int ret;
+
+    if (s->nb_bitmaps == 0) {
+        error_setg(errp, "Bitmap '%s' not found in the image", name);
+        return -ENOENT;
+    }
+
+    bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
+                               s->bitmap_directory_size, errp);
+    if (bm_list == NULL) {
+        return -EINVAL;
+    }
+
+    bm = find_bitmap_by_name(bm_list, name);
+    if (bm == NULL) {
+        error_setg(errp, "Bitmap '%s' not found in the image", name);
+        ret = -ENOENT;
+        goto out;
+    }
+
+    ret = bitmap_table_load(bs, &bm->table, &bitmap_table);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Could not read bitmap_table table from image for "
+                         "bitmap '%s'", name);
+        goto out;
+    }
+
+    ret = load_bitmap_data(bs, bitmap_table, bm->table.size, target);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
+                         name);
+        goto out;
+    }
+
+out:
+    g_free(bitmap_table);
+    bitmap_list_free(bm_list);
+    return ret;
+}
+
 void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
                                           const char *name,
                                           Error **errp)
@@ -1521,11 +1787,20 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
                            name);
                 goto fail;
             }
-            tb = g_memdup(&bm->table, sizeof(bm->table));
-            bm->table.offset = 0;
-            bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            bm->in_place = can_update_bitmap_in_place(bs, bm, bitmap);
+            if (!bm->in_place) {
+                tb = g_memdup(&bm->table, sizeof(bm->table));
+                bm->table.offset = 0;
+                bm->table.size = 0;
+                QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            }
+        }
+
+        /* The old on-disk data is about to be dropped, read it first */
+        if (!bm->in_place && bdrv_load_dirty_bitmap(bs, bitmap, errp) < 0) {
+            goto fail;
         }
+
         bm->flags = bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
         bm->dirty_bitmap = bitmap;
@@ -1537,7 +1812,11 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
             continue;
         }
 
-        ret = store_bitmap(bs, bm, errp);
+        if (bm->in_place) {
+            ret = update_bitmap_in_place(bs, bm, errp);
+        } else {
+            ret = store_bitmap(bs, bm, errp);
+        }
         if (ret < 0) {
             goto fail;
         }
@@ -1577,7 +1856,8 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
 
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
-        if (bm->dirty_bitmap == NULL || bm->table.offset == 0) {
+        if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
+            bm->in_place) {
             continue;
         }
 
@@ -1591,6 +1871,102 @@ fail:
     bitmap_list_free(bm_list);
 }
 
+/*
+ * Write the changed clusters of the persistent bitmaps that are in use in
+ * the image, without updating the bitmap directory.  The bitmaps stay marked
+ * in use, but qcow2_store_persistent_dirty_bitmaps() has less work left.
+ * Called with s->lock held.
+ */
+static int coroutine_fn qcow2_co_flush_dirty_bitmaps(BlockDriverState *bs,
+                                                     Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2BitmapList *bm_list;
+    Qcow2Bitmap *bm;
+    int ret = 0;
+
+    bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
+                               s->bitmap_directory_size, errp);
+    if (bm_list == NULL) {
+        return -EINVAL;
+    }
+
+    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+        BdrvDirtyBitmap *bitmap = bdrv_find_dirty_bitmap(bs, bm->name);
+
+        if (bitmap == NULL || !bdrv_dirty_bitmap_get_persistence(bitmap) ||
+            bdrv_dirty_bitmap_readonly(bitmap) ||
+            !can_update_bitmap_in_place(bs, bm, bitmap)) {
+            continue;
+        }
+
+        bm->dirty_bitmap = bitmap;
+        ret = update_bitmap_in_place(bs, bm, errp);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    bitmap_list_free(bm_list);
+    return ret;
+}
+
+typedef struct Qcow2FlushBitmapsCo {
+    BlockDriverState *bs;
+    Error **errp;
+    int ret;
+} Qcow2FlushBitmapsCo;
+
+static void coroutine_fn qcow2_flush_dirty_bitmaps_entry(void *opaque)
+{
+    Qcow2FlushBitmapsCo *fbc = opaque;
+    BDRVQcow2State *s = fbc->bs->opaque;
+
+    qemu_co_mutex_lock(&s->lock);
+    fbc->ret = qcow2_co_flush_dirty_bitmaps(fbc->bs, fbc->errp);
+    qemu_co_mutex_unlock(&s->lock);
+    aio_wait_kick();
+}
+
+/*
+ * Write back what changed in the persistent bitmaps of @bs since they were
+ * loaded or last written, while the image stays in use.  Called periodically
+ * if bitmap-flush-interval is set.
+ * Called with BQL taken.
+ */
+int qcow2_flush_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap;
+    Qcow2FlushBitmapsCo fbc = {
+        .bs = bs,
+        .errp = errp,
+        .ret = -EINPROGRESS,
+    };
+
+    if (s->nb_bitmaps == 0 || !can_write(bs)) {
+        return 0;
+    }
+
+    for (bitmap = bdrv_dirty_bitmap_next(bs, NULL); bitmap != NULL;
+         bitmap = bdrv_dirty_bitmap_next(bs, bitmap))
+    {
+        if (bdrv_dirty_bitmap_has_meta(bitmap) &&
+            bdrv_get_meta_dirty_count(bitmap)) {
+            break;
+        }
+    }
+    if (bitmap == NULL) {
+        /* Nothing changed */
+        return 0;
+    }
+
+    bdrv_coroutine_enter(bs, qemu_coroutine_create(
+                                 qcow2_flush_dirty_bitmaps_entry, &fbc));
+    BDRV_POLL_WHILE(bs, fbc.ret == -EINPROGRESS);
+    return fbc.ret;
+}
+
 int qcow2_reopen_bitmaps_ro(BlockDriverState *bs, Error **errp)
 {
     BdrvDirtyBitmap *bitmap;
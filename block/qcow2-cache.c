@@ -23,6 +23,11 @@
  */
 
 #include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qom/object_interfaces.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
 #include "qcow2.h"
 #include "trace.h"
 
@@ -42,8 +47,34 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+    BlockDriverState       *bs;
+    Qcow2CacheGroup        *group;
+    QLIST_ENTRY(Qcow2Cache) group_next;
 };
 
+/*
+ * A cache group gives the caches of several nodes, e.g. all images of a
+ * backing chain, one memory budget.  Each cache may grow up to its own size,
+ * but once the tables cached by all members reach the budget, loading a new
+ * table evicts the least recently used one in the whole group.  This way the
+ * memory ends up with the nodes that actually see I/O.
+ *
+ * Only clean tables of other nodes in the same AioContext are evicted: their
+ * owner cannot be running concurrently then, and writing a dirty table would
+ * need its lock.  The budget may therefore be exceeded for a while.
+ */
+struct Qcow2CacheGroup {
+    Object parent_obj;
+
+    QemuMutex lock;
+    uint64_t size;                      /* budget in bytes */
+    uint64_t used;                      /* bytes in cached tables */
+    QLIST_HEAD(, Qcow2Cache) caches;
+};
+
+#define QCOW2_CACHE_GROUP(obj) \
+    OBJECT_CHECK(Qcow2CacheGroup, (obj), TYPE_QCOW2_CACHE_GROUP)
+
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
 {
     return (uint8_t *) c->table_array + (size_t) table * c->table_size;
@@ -84,6 +115,31 @@ static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 #endif
 }
 
+/*
+ * LRU stamps of caches in a group are compared with each other, so they come
+ * from a clock rather than from a per-cache counter.
+ */
+static inline uint64_t qcow2_cache_lru_stamp(Qcow2Cache *c)
+{
+    return c->group ? get_clock() : ++c->lru_counter;
+}
+
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CacheGroup *g = c->group;
+
+    if (g && !c->entries[i].offset != !offset) {
+        qemu_mutex_lock(&g->lock);
+        if (offset) {
+            g->used += c->table_size;
+        } else {
+            g->used -= c->table_size;
+        }
+        qemu_mutex_unlock(&g->lock);
+    }
+    c->entries[i].offset = offset;
+}
+
 static inline bool can_clean_entry(Qcow2Cache *c, int i)
 {
     Qcow2CachedTable *t = &c->entries[i];
@@ -104,7 +160,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
             i++;
             to_clean++;
@@ -115,11 +171,11 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
         }
     }
 
-    c->cache_clean_lru_counter = c->lru_counter;
+    c->cache_clean_lru_counter = c->group ? get_clock() : c->lru_counter;
 }
 
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
-                               unsigned table_size)
+                               unsigned table_size, Qcow2CacheGroup *group)
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
@@ -140,7 +196,16 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
         qemu_vfree(c->table_array);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    c->bs = bs;
+    if (group) {
+        object_ref(OBJECT(group));
+        qemu_mutex_lock(&group->lock);
+        QLIST_INSERT_HEAD(&group->caches, c, group_next);
+        c->group = group;
+        qemu_mutex_unlock(&group->lock);
     }
 
     return c;
@@ -148,12 +213,25 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 
 int qcow2_cache_destroy(Qcow2Cache *c)
 {
+    Qcow2CacheGroup *g = c->group;
     int i;
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
     }
 
+    if (g) {
+        qemu_mutex_lock(&g->lock);
+        for (i = 0; i < c->size; i++) {
+            if (c->entries[i].offset) {
+                g->used -= c->table_size;
+            }
+        }
+        QLIST_REMOVE(c, group_next);
+        qemu_mutex_unlock(&g->lock);
+        object_unref(OBJECT(g));
+    }
+
     qemu_vfree(c->table_array);
     g_free(c->entries);
     g_free(c);
@@ -305,7 +383,7 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_set_offset(c, i, 0);
         c->entries[i].lru_counter = 0;
     }
 
@@ -316,6 +394,57 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+/*
+ * Make room in the group budget before an empty entry of @c is filled.
+ * Returns the index of an entry of @c that should be replaced instead, or
+ * -1 if the empty entry can be used.
+ */
+static int qcow2_cache_group_make_room(Qcow2Cache *c)
+{
+    Qcow2CacheGroup *g = c->group;
+    AioContext *ctx = bdrv_get_aio_context(c->bs);
+    int ret = -1;
+
+    qemu_mutex_lock(&g->lock);
+    while (g->used + c->table_size > g->size) {
+        Qcow2Cache *other, *victim_cache = NULL;
+        uint64_t min_lru_counter = UINT64_MAX;
+        int i, victim = -1;
+
+        QLIST_FOREACH(other, &g->caches, group_next) {
+            if (other != c && bdrv_get_aio_context(other->bs) != ctx) {
+                continue;
+            }
+            for (i = 0; i < other->size; i++) {
+                const Qcow2CachedTable *t = &other->entries[i];
+                if (t->offset && t->ref == 0 && (!t->dirty || other == c) &&
+                    t->lru_counter < min_lru_counter) {
+                    min_lru_counter = t->lru_counter;
+                    victim_cache = other;
+                    victim = i;
+                }
+            }
+        }
+
+        if (victim_cache == c) {
+            ret = victim;
+            break;
+        } else if (!victim_cache) {
+            /* Everything is in use, go over budget for now */
+            break;
+        }
+
+        trace_qcow2_cache_group_evict(victim_cache->bs, victim);
+        victim_cache->entries[victim].offset = 0;
+        victim_cache->entries[victim].lru_counter = 0;
+        g->used -= victim_cache->table_size;
+        qcow2_cache_table_release(victim_cache, victim, 1);
+    }
+    qemu_mutex_unlock(&g->lock);
+
+    return ret;
+}
+
 static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
@@ -362,6 +491,12 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     /* Cache miss: write a table back and replace it */
     i = min_lru_index;
+    if (c->group && c->entries[i].offset == 0) {
+        int victim = qcow2_cache_group_make_room(c);
+        if (victim >= 0) {
+            i = victim;
+        }
+    }
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -372,7 +507,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -386,7 +521,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
@@ -419,7 +554,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
     *table = NULL;
 
     if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
+        c->entries[i].lru_counter = qcow2_cache_lru_stamp(c);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -432,6 +567,36 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
     c->entries[i].dirty = true;
 }
 
+/*
+ * Returns the table at @offset if it is cached, or NULL.  No reference is
+ * taken and no I/O is performed, so the pointer is only valid until the
+ * calling coroutine yields.  This is used by lookups that run without
+ * s->lock and must never wait for metadata I/O.
+ */
+void *qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i, lookup_index;
+
+    if (offset == 0 || !QEMU_IS_ALIGNED(offset, c->table_size)) {
+        return NULL;
+    }
+
+    i = lookup_index = (offset / c->table_size * 4) % c->size;
+    do {
+        if (c->entries[i].offset == offset) {
+            if (c->entries[i].ref == 0) {
+                c->entries[i].lru_counter = qcow2_cache_lru_stamp(c);
+            }
+            return qcow2_cache_get_table_addr(c, i);
+        }
+        if (++i == c->size) {
+            i = 0;
+        }
+    } while (i != lookup_index);
+
+    return NULL;
+}
+
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
     int i;
@@ -450,9 +615,135 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+Qcow2CacheGroup *qcow2_cache_group_find(const char *id, Error **errp)
+{
+    Object *obj = object_resolve_path_component(object_get_objects_root(), id);
+    Qcow2CacheGroup *g;
+
+    g = (Qcow2CacheGroup *)object_dynamic_cast(obj, TYPE_QCOW2_CACHE_GROUP);
+    if (!g) {
+        error_setg(errp, "No qcow2 cache group with id '%s'", id);
+    }
+    return g;
+}
+
+uint64_t qcow2_cache_group_size(Qcow2CacheGroup *g)
+{
+    uint64_t size;
+
+    qemu_mutex_lock(&g->lock);
+    size = g->size;
+    qemu_mutex_unlock(&g->lock);
+
+    return size;
+}
+
+static void qcow2_cache_group_get_size(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    Qcow2CacheGroup *g = QCOW2_CACHE_GROUP(obj);
+    uint64_t value = qcow2_cache_group_size(g);
+
+    visit_type_size(v, name, &value, errp);
+}
+
+static void qcow2_cache_group_set_size(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    Qcow2CacheGroup *g = QCOW2_CACHE_GROUP(obj);
+    Error *local_err = NULL;
+    uint64_t value;
+
+    visit_type_size(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    if (value == 0) {
+        error_setg(errp, "Cache group size must be greater than 0");
+        return;
+    }
+
+    /* A smaller budget takes effect as tables are replaced */
+    qemu_mutex_lock(&g->lock);
+    g->size = value;
+    qemu_mutex_unlock(&g->lock);
+}
+
+static void qcow2_cache_group_complete(UserCreatable *uc, Error **errp)
+{
+    Qcow2CacheGroup *g = QCOW2_CACHE_GROUP(uc);
+
+#ifndef CONFIG_LINUX
+    /* Evicted tables can only be returned to the host on Linux */
+    error_setg(errp, TYPE_QCOW2_CACHE_GROUP " not supported on this host");
+#else
+    if (!g->size) {
+        error_setg(errp, "Parameter 'size' is missing");
+    }
+#endif
+}
+
+static bool qcow2_cache_group_can_be_deleted(UserCreatable *uc)
+{
+    return OBJECT(uc)->ref == 1;
+}
+
+static void qcow2_cache_group_init(Object *obj)
+{
+    Qcow2CacheGroup *g = QCOW2_CACHE_GROUP(obj);
+
+    qemu_mutex_init(&g->lock);
+    QLIST_INIT(&g->caches);
+}
+
+static void qcow2_cache_group_finalize(Object *obj)
+{
+    Qcow2CacheGroup *g = QCOW2_CACHE_GROUP(obj);
+
+    assert(QLIST_EMPTY(&g->caches));
+    qemu_mutex_destroy(&g->lock);
+}
+
+static void qcow2_cache_group_class_init(ObjectClass *klass, void *class_data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
+
+    ucc->complete = qcow2_cache_group_complete;
+    ucc->can_be_deleted = qcow2_cache_group_can_be_deleted;
+
+    object_class_property_add(klass, "size", "size",
+                              qcow2_cache_group_get_size,
+                              qcow2_cache_group_set_size,
+                              NULL, NULL, &error_abort);
+}
+
+static const TypeInfo qcow2_cache_group_info = {
+    .name = TYPE_QCOW2_CACHE_GROUP,
+    .parent = TYPE_OBJECT,
+    .class_init = qcow2_cache_group_class_init,
+    .instance_size = sizeof(Qcow2CacheGroup),
+    .instance_init = qcow2_cache_group_init,
+    .instance_finalize = qcow2_cache_group_finalize,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    },
+};
+
+static void qcow2_cache_group_register_types(void)
+{
+    type_register_static(&qcow2_cache_group_info);
+}
+
+type_init(qcow2_cache_group_register_types)
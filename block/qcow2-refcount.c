@@ -133,6 +133,39 @@ void qcow2_refcount_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
     g_free(s->refcount_table);
+    qcow2_drop_free_cluster_bitmap(bs);
+}
+
+/*
+ * Frees the in-memory free cluster index. It is rebuilt from the refcount
+ * blocks on the next cluster allocation. This must be called whenever the
+ * refcount structures are replaced without going through update_refcount().
+ */
+void qcow2_drop_free_cluster_bitmap(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->free_cluster_bitmap) {
+        hbitmap_free(s->free_cluster_bitmap);
+        s->free_cluster_bitmap = NULL;
+    }
+    s->free_cluster_bitmap_size = 0;
+}
+
+static void update_free_cluster_bitmap(BDRVQcow2State *s,
+                                       uint64_t cluster_index, bool is_free)
+{
+    if (!s->free_cluster_bitmap ||
+        cluster_index >= s->free_cluster_bitmap_size)
+    {
+        return;
+    }
+
+    if (is_free) {
+        hbitmap_set(s->free_cluster_bitmap, cluster_index, 1);
+    } else {
+        hbitmap_reset(s->free_cluster_bitmap, cluster_index, 1);
+    }
 }
 
 
@@ -881,6 +914,7 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
             s->free_cluster_index = cluster_index;
         }
         s->set_refcount(refcount_block, block_index, refcount);
+        update_free_cluster_bitmap(s, cluster_index, refcount == 0);
 
         if (refcount == 0) {
             void *table;
@@ -960,12 +994,124 @@ int qcow2_update_cluster_refcount(BlockDriverState *bs,
 
 
 
+/*
+ * Makes sure that s->free_cluster_bitmap covers all refcount blocks that are
+ * currently in use, creating it if necessary. Clusters described by refcount
+ * blocks that were not covered yet are added by scanning those blocks once.
+ *
+ * Returns 0 on success and -errno on failure, in which case the bitmap is
+ * dropped.
+ */
+static int extend_free_cluster_bitmap(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t first_block, nb_blocks, i;
+    int ret;
+
+    nb_blocks = s->refcount_table_size ? s->max_refcount_table_index + 1 : 0;
+    first_block = s->free_cluster_bitmap_size >> s->refcount_block_bits;
+    if (s->free_cluster_bitmap && nb_blocks <= first_block) {
+        return 0;
+    }
+
+    s->free_cluster_bitmap_size = nb_blocks << s->refcount_block_bits;
+    if (!s->free_cluster_bitmap) {
+        s->free_cluster_bitmap = hbitmap_alloc(s->free_cluster_bitmap_size, 0);
+    } else {
+        hbitmap_truncate(s->free_cluster_bitmap, s->free_cluster_bitmap_size);
+    }
+
+    for (i = first_block; i < nb_blocks; i++) {
+        uint64_t first_cluster = i << s->refcount_block_bits;
+        uint64_t refblock_offset = s->refcount_table[i] & REFT_OFFSET_MASK;
+        void *refblock;
+        uint64_t j, k;
+
+        if (!refblock_offset) {
+            hbitmap_set(s->free_cluster_bitmap, first_cluster,
+                        s->refcount_block_size);
+            continue;
+        }
+
+        if (offset_into_cluster(s, refblock_offset)) {
+            qcow2_signal_corruption(bs, true, -1, -1, "Refblock offset %#"
+                                    PRIx64 " unaligned (reftable index: %#"
+                                    PRIx64 ")", refblock_offset, i);
+            ret = -EIO;
+            goto fail;
+        }
+
+        ret = load_refcount_block(bs, refblock_offset, &refblock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        j = 0;
+        while (j < s->refcount_block_size) {
+            if (s->get_refcount(refblock, j) != 0) {
+                j++;
+                continue;
+            }
+
+            k = j + 1;
+            while (k < s->refcount_block_size &&
+                   s->get_refcount(refblock, k) == 0)
+            {
+                k++;
+            }
+            hbitmap_set(s->free_cluster_bitmap, first_cluster + j, k - j);
+            j = k;
+        }
+
+        qcow2_cache_put(s->refcount_block_cache, &refblock);
+    }
+
+    return 0;
+
+fail:
+    qcow2_drop_free_cluster_bitmap(bs);
+    return ret;
+}
+
+/*
+ * Returns the index of the first cluster at or after @start that begins a run
+ * of at least @nb_clusters clusters that are free according to
+ * s->free_cluster_bitmap. A run may continue past the end of the bitmap,
+ * where no refcount blocks exist yet.
+ */
+static uint64_t find_free_cluster_run(BDRVQcow2State *s, uint64_t start,
+                                      uint64_t nb_clusters)
+{
+    uint64_t bitmap_size = s->free_cluster_bitmap_size;
+
+    while (start < bitmap_size) {
+        uint64_t run_start = start;
+        uint64_t run_length = bitmap_size - start;
+
+        if (!hbitmap_next_dirty_area(s->free_cluster_bitmap,
+                                     &run_start, &run_length))
+        {
+            return bitmap_size;
+        }
+
+        if (run_length >= nb_clusters ||
+            run_start + run_length == bitmap_size)
+        {
+            return run_start;
+        }
+
+        start = run_start + run_length;
+    }
+
+    return start;
+}
+
 /* return < 0 if error */
 static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
                                     uint64_t max)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t i, nb_clusters, refcount;
+    uint64_t i, nb_clusters, refcount, start, search_start;
     int ret;
 
     /* We can't allocate clusters if they may still be queued for discard. */
@@ -973,33 +1119,47 @@ static int64_t alloc_clusters_noref(BlockDriverState *bs, uint64_t size,
         qcow2_process_discards(bs, 0);
     }
 
+    ret = extend_free_cluster_bitmap(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     nb_clusters = size_to_clusters(s, size);
+    search_start = s->free_cluster_index;
 retry:
+    start = find_free_cluster_run(s, search_start, nb_clusters);
+
+    /* Refcount blocks may have been written without going through
+     * update_refcount(), so the bitmap is only a hint */
     for(i = 0; i < nb_clusters; i++) {
-        uint64_t next_cluster_index = s->free_cluster_index++;
-        ret = qcow2_get_refcount(bs, next_cluster_index, &refcount);
+        ret = qcow2_get_refcount(bs, start + i, &refcount);
 
         if (ret < 0) {
             return ret;
         } else if (refcount != 0) {
+            update_free_cluster_bitmap(s, start + i, false);
+            search_start = start + i + 1;
             goto retry;
         }
     }
 
+    if (start == s->free_cluster_index) {
+        s->free_cluster_index = start + nb_clusters;
+    }
+
     /* Make sure that all offsets in the "allocated" range are representable
      * in the requested max */
-    if (s->free_cluster_index > 0 &&
-        s->free_cluster_index - 1 > (max >> s->cluster_bits))
+    if (start + nb_clusters > 0 &&
+        start + nb_clusters - 1 > (max >> s->cluster_bits))
     {
         return -EFBIG;
     }
 
 #ifdef DEBUG_ALLOC2
     fprintf(stderr, "alloc_clusters: size=%" PRId64 " -> %" PRId64 "\n",
-            size,
-            (s->free_cluster_index - nb_clusters) << s->cluster_bits);
+            size, start << s->cluster_bits);
 #endif
-    return (s->free_cluster_index - nb_clusters) << s->cluster_bits;
+    return start << s->cluster_bits;
 }
 
 int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size)
@@ -1236,6 +1396,21 @@ int coroutine_fn qcow2_flush_caches(BlockDriverState *bs)
 
 
 
+/*
+ * Adds @addend to the refcount of the @bytes long run of clusters starting at
+ * @offset.  Does nothing for an empty run.
+ */
+static int update_snapshot_refcount_run(BlockDriverState *bs, uint64_t offset,
+                                        uint64_t bytes, int addend)
+{
+    if (bytes == 0) {
+        return 0;
+    }
+
+    return update_refcount(bs, offset, bytes, abs(addend), addend < 0,
+                           QCOW2_DISCARD_SNAPSHOT);
+}
+
 /* update the refcounts of snapshots and the copied flag */
 int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend)
@@ -1244,6 +1419,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     uint64_t *l1_table, *l2_slice, l2_offset, entry, l1_size2, refcount;
     bool l1_allocated = false;
     int64_t old_entry, old_l2_offset;
+    uint64_t run_offset, run_bytes;
     unsigned slice, slice_size2, n_slices;
     int i, j, l1_modified = 0, nb_csectors;
     int ret;
@@ -1253,7 +1429,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     l2_slice = NULL;
     l1_table = NULL;
     l1_size2 = l1_size * sizeof(uint64_t);
-    slice_size2 = s->l2_slice_size * sizeof(uint64_t);
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
     n_slices = s->cluster_size / slice_size2;
 
     s->cache_discards = true;
@@ -1305,13 +1481,18 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                     goto fail;
                 }
 
+                /*
+                 * First pass: update the refcounts.  Data clusters that are
+                 * contiguous in the image file are updated with a single
+                 * update_refcount() call, which touches every refcount block
+                 * only once instead of once per cluster.
+                 */
+                run_offset = 0;
+                run_bytes = 0;
                 for (j = 0; j < s->l2_slice_size; j++) {
-                    uint64_t cluster_index;
                     uint64_t offset;
 
-                    entry = be64_to_cpu(l2_slice[j]);
-                    old_entry = entry;
-                    entry &= ~QCOW_OFLAG_COPIED;
+                    entry = get_l2_entry(s, l2_slice, j) & ~QCOW_OFLAG_COPIED;
                     offset = entry & L2E_OFFSET_MASK;
 
                     switch (qcow2_get_cluster_type(bs, entry)) {
@@ -1330,8 +1511,6 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                                 goto fail;
                             }
                         }
-                        /* compressed clusters are never modified */
-                        refcount = 2;
                         break;
 
                     case QCOW2_CLUSTER_NORMAL:
@@ -1349,18 +1528,58 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                             goto fail;
                         }
 
-                        cluster_index = offset >> s->cluster_bits;
-                        assert(cluster_index);
-                        if (addend != 0) {
-                            ret = qcow2_update_cluster_refcount(
-                                bs, cluster_index, abs(addend), addend < 0,
-                                QCOW2_DISCARD_SNAPSHOT);
-                            if (ret < 0) {
-                                goto fail;
-                            }
+                        assert(offset >> s->cluster_bits);
+                        if (addend == 0) {
+                            break;
+                        }
+
+                        if (run_bytes && offset == run_offset + run_bytes) {
+                            run_bytes += s->cluster_size;
+                            break;
+                        }
+                        ret = update_snapshot_refcount_run(bs, run_offset,
+                                                           run_bytes, addend);
+                        if (ret < 0) {
+                            goto fail;
                         }
+                        run_offset = offset;
+                        run_bytes = s->cluster_size;
+                        break;
+
+                    case QCOW2_CLUSTER_ZERO_PLAIN:
+                    case QCOW2_CLUSTER_UNALLOCATED:
+                        break;
+
+                    default:
+                        abort();
+                    }
+                }
+
+                ret = update_snapshot_refcount_run(bs, run_offset, run_bytes,
+                                                   addend);
+                if (ret < 0) {
+                    goto fail;
+                }
+
+                /* Second pass: update QCOW_OFLAG_COPIED */
+                for (j = 0; j < s->l2_slice_size; j++) {
+                    uint64_t offset;
+
+                    entry = get_l2_entry(s, l2_slice, j);
+                    old_entry = entry;
+                    entry &= ~QCOW_OFLAG_COPIED;
+                    offset = entry & L2E_OFFSET_MASK;
 
-                        ret = qcow2_get_refcount(bs, cluster_index, &refcount);
+                    switch (qcow2_get_cluster_type(bs, entry)) {
+                    case QCOW2_CLUSTER_COMPRESSED:
+                        /* compressed clusters are never modified */
+                        refcount = 2;
+                        break;
+
+                    case QCOW2_CLUSTER_NORMAL:
+                    case QCOW2_CLUSTER_ZERO_ALLOC:
+                        ret = qcow2_get_refcount(bs, offset >> s->cluster_bits,
+                                                 &refcount);
                         if (ret < 0) {
                             goto fail;
                         }
@@ -1383,7 +1602,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                             qcow2_cache_set_dependency(bs, s->l2_table_cache,
                                                        s->refcount_block_cache);
                         }
-                        l2_slice[j] = cpu_to_be64(entry);
+                        set_l2_entry(s, l2_slice, j, entry);
                         qcow2_cache_entry_mark_dirty(s->l2_table_cache,
                                                      l2_slice);
                     }
@@ -1585,10 +1804,17 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/*
+ * check_refcounts_l1() reads up to this many L2 tables in parallel, using no
+ * more than CHECK_L2_READ_BATCH_BYTES of memory for them.
+ */
+#define CHECK_L2_READ_BATCH 16
+#define CHECK_L2_READ_BATCH_BYTES (8 * MiB)
+
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table @l2_table, which has been read from @l2_offset.
+ * While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
@@ -1596,27 +1822,18 @@ enum {
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                               void **refcount_table,
                               int64_t *refcount_table_size, int64_t l2_offset,
-                              int flags, BdrvCheckMode fix, bool active)
+                              uint64_t *l2_table, int flags, BdrvCheckMode fix,
+                              bool active)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry, l2_bitmap;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * sizeof(uint64_t);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
-        l2_entry = be64_to_cpu(l2_table[i]);
+        l2_entry = get_l2_entry(s, l2_table, i);
+        l2_bitmap = get_l2_bitmap(s, l2_table, i);
 
         switch (qcow2_get_cluster_type(bs, l2_entry)) {
         case QCOW2_CLUSTER_COMPRESSED:
@@ -1636,6 +1853,14 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                 break;
             }
 
+            if (l2_bitmap) {
+                fprintf(stderr, "ERROR compressed cluster %d with non-zero "
+                        "subcluster allocation bitmap, entry=0x%" PRIx64 "\n",
+                        i, l2_entry);
+                res->corruptions++;
+                break;
+            }
+
             /* Mark cluster as used */
             nb_csectors = ((l2_entry >> s->csize_shift) &
                            s->csize_mask) + 1;
@@ -1666,6 +1891,13 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         {
             uint64_t offset = l2_entry & L2E_OFFSET_MASK;
 
+            if ((l2_bitmap >> 32) & l2_bitmap) {
+                res->corruptions++;
+                fprintf(stderr, "ERROR offset=%" PRIx64 ": Allocated "
+                        "cluster has corrupted subcluster allocation bitmap\n",
+                        offset);
+            }
+
             /* Correct offsets are cluster aligned */
             if (offset_into_cluster(s, offset)) {
                 res->corruptions++;
@@ -1679,15 +1911,16 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                             fix & BDRV_FIX_ERRORS ? "Repairing" : "ERROR",
                             offset);
                     if (fix & BDRV_FIX_ERRORS) {
+                        int idx = i * (l2_entry_size(s) / sizeof(uint64_t));
                         uint64_t l2e_offset =
-                            l2_offset + (uint64_t)i * sizeof(uint64_t);
+                            l2_offset + (uint64_t)i * l2_entry_size(s);
                         int ign = active ? QCOW2_OL_ACTIVE_L2 :
                                            QCOW2_OL_INACTIVE_L2;
 
                         l2_entry = QCOW_OFLAG_ZERO;
-                        l2_table[i] = cpu_to_be64(l2_entry);
+                        set_l2_entry(s, l2_table, i, l2_entry);
                         ret = qcow2_pre_write_overlap_check(bs, ign,
-                                l2e_offset, sizeof(uint64_t), false);
+                                l2e_offset, l2_entry_size(s), false);
                         if (ret < 0) {
                             fprintf(stderr, "ERROR: Overlap check failed\n");
                             res->check_errors++;
@@ -1697,7 +1930,8 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                         }
 
                         ret = bdrv_pwrite_sync(bs->file, l2e_offset,
-                                               &l2_table[i], sizeof(uint64_t));
+                                               &l2_table[idx],
+                                               l2_entry_size(s));
                         if (ret < 0) {
                             fprintf(stderr, "ERROR: Failed to overwrite L2 "
                                     "table entry: %s\n", strerror(-ret));
@@ -1740,7 +1974,16 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         case QCOW2_CLUSTER_ZERO_PLAIN:
+            /* Impossible when image has subclusters */
+            assert(!l2_bitmap);
+            break;
+
         case QCOW2_CLUSTER_UNALLOCATED:
+            if (l2_bitmap & QCOW_L2_BITMAP_ALL_ALLOC) {
+                res->corruptions++;
+                fprintf(stderr, "ERROR: Unallocated "
+                        "cluster has non-zero subcluster allocation map\n");
+            }
             break;
 
         default:
@@ -1748,14 +1991,74 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
 
 fail:
-    g_free(l2_table);
     return ret;
 }
 
+typedef struct CheckL2ReadBatch {
+    BdrvChild *file;
+    int in_flight;
+    Coroutine *waiter;
+} CheckL2ReadBatch;
+
+typedef struct CheckL2Read {
+    CheckL2ReadBatch *batch;
+    uint64_t offset;
+    int bytes;
+    void *buf;
+    int ret;
+} CheckL2Read;
+
+static void coroutine_fn check_l2_read_entry(void *opaque)
+{
+    CheckL2Read *rd = opaque;
+    CheckL2ReadBatch *batch = rd->batch;
+
+    rd->ret = bdrv_co_pread(batch->file, rd->offset, rd->bytes, rd->buf, 0);
+
+    if (--batch->in_flight == 0 && batch->waiter) {
+        aio_co_wake(batch->waiter);
+    }
+}
+
+/*
+ * Reads the L2 tables listed in @reads (entries with offset 0 are skipped).
+ * In coroutine context the reads are issued in parallel.
+ */
+static void check_l2_read_batch(BlockDriverState *bs, CheckL2Read *reads,
+                                int nb_reads)
+{
+    CheckL2ReadBatch batch = {
+        .file = bs->file,
+    };
+    int i;
+
+    for (i = 0; i < nb_reads; i++) {
+        reads[i].batch = &batch;
+        if (!reads[i].offset) {
+            reads[i].ret = 0;
+            continue;
+        }
+
+        if (!qemu_in_coroutine()) {
+            reads[i].ret = bdrv_pread(bs->file, reads[i].offset, reads[i].buf,
+                                      reads[i].bytes);
+            continue;
+        }
+
+        batch.in_flight++;
+        qemu_coroutine_enter(qemu_coroutine_create(check_l2_read_entry,
+                                                   &reads[i]));
+    }
+
+    while (batch.in_flight) {
+        batch.waiter = qemu_coroutine_self();
+        qemu_coroutine_yield();
+    }
+}
+
 /*
  * Increases the refcount for the L1 table, its L2 tables and all referenced
  * clusters in the given refcount table. While doing so, performs some checks
@@ -1773,7 +2076,12 @@ static int check_refcounts_l1(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l1_table = NULL, l2_offset, l1_size2;
-    int i, ret;
+    CheckL2Read reads[CHECK_L2_READ_BATCH];
+    uint8_t *l2_buf = NULL;
+    int l2_bytes = s->l2_size * l2_entry_size(s);
+    int batch_size = MAX(1, MIN(CHECK_L2_READ_BATCH,
+                                CHECK_L2_READ_BATCH_BYTES / l2_bytes));
+    int i, j, ret;
 
     l1_size2 = l1_size * sizeof(uint64_t);
 
@@ -1802,10 +2110,45 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
+    /*
+     * Repairing L2 entries writes to the tables, so a table that is
+     * referenced twice must be read again after the first pass over it.
+     * Only read ahead if nothing will be written.
+     */
+    if (fix & BDRV_FIX_ERRORS) {
+        batch_size = 1;
+    }
+    l2_buf = g_try_malloc((size_t) batch_size * l2_bytes);
+    if (l2_buf == NULL && batch_size > 1) {
+        batch_size = 1;
+        l2_buf = g_try_malloc(l2_bytes);
+    }
+    if (l2_buf == NULL && l1_size > 0) {
+        ret = -ENOMEM;
+        res->check_errors++;
+        goto fail;
+    }
+
     /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
+    for (i = 0; i < l1_size; i += batch_size) {
+        int nb_reads = MIN(batch_size, l1_size - i);
+
+        /* Read the next batch of L2 tables while nothing else is going on */
+        for (j = 0; j < nb_reads; j++) {
+            reads[j] = (CheckL2Read) {
+                .offset = l1_table[i + j] & L1E_OFFSET_MASK,
+                .bytes  = l2_bytes,
+                .buf    = l2_buf + (size_t) j * l2_bytes,
+            };
+        }
+        check_l2_read_batch(bs, reads, nb_reads);
+
+        for (j = 0; j < nb_reads; j++) {
+            l2_offset = l1_table[i + j];
+            if (!l2_offset) {
+                continue;
+            }
+
             /* Mark L2 table as used */
             l2_offset &= L1E_OFFSET_MASK;
             ret = qcow2_inc_refcounts_imrt(bs, res,
@@ -1822,19 +2165,28 @@ static int check_refcounts_l1(BlockDriverState *bs,
                 res->corruptions++;
             }
 
+            ret = reads[j].ret;
+            if (ret < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                goto fail;
+            }
+
             /* Process and check L2 entries */
             ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags,
-                                     fix, active);
+                                     refcount_table_size, l2_offset,
+                                     reads[j].buf, flags, fix, active);
             if (ret < 0) {
                 goto fail;
             }
         }
     }
+    g_free(l2_buf);
     g_free(l1_table);
     return 0;
 
 fail:
+    g_free(l2_buf);
     g_free(l1_table);
     return ret;
 }
@@ -1904,7 +2256,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         ret = bdrv_pread(bs->file, l2_offset, l2_table,
-                         s->l2_size * sizeof(uint64_t));
+                         s->l2_size * l2_entry_size(s));
         if (ret < 0) {
             fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
                     strerror(-ret));
@@ -1913,7 +2265,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
         }
 
         for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
+            uint64_t l2_entry = get_l2_entry(s, l2_table, j);
             uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
             QCow2ClusterType cluster_type = qcow2_get_cluster_type(bs, l2_entry);
 
@@ -1936,9 +2288,9 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
                             "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
                             repair ? "Repairing" : "ERROR", l2_entry, refcount);
                     if (repair) {
-                        l2_table[j] = cpu_to_be64(refcount == 1
-                                    ? l2_entry |  QCOW_OFLAG_COPIED
-                                    : l2_entry & ~QCOW_OFLAG_COPIED);
+                        set_l2_entry(s, l2_table, j, refcount == 1
+                                     ? l2_entry |  QCOW_OFLAG_COPIED
+                                     : l2_entry & ~QCOW_OFLAG_COPIED);
                         l2_dirty++;
                     }
                 }
@@ -2510,6 +2862,7 @@ write_refblocks:
     s->refcount_table_offset = reftable_offset;
     s->refcount_table_size = reftable_size;
     update_max_refcount_table_index(s);
+    qcow2_drop_free_cluster_bitmap(bs);
 
     return 0;
 
@@ -3242,6 +3595,7 @@ int qcow2_change_refcount_order(BlockDriverState *bs, int refcount_order,
     old_reftable = s->refcount_table;
     s->refcount_table = new_reftable;
     update_max_refcount_table_index(s);
+    qcow2_drop_free_cluster_bitmap(bs);
 
     s->refcount_bits = 1 << refcount_order;
     s->refcount_max = UINT64_C(1) << (s->refcount_bits - 1);
@@ -3340,6 +3694,7 @@ static int qcow2_discard_refcount_block(BlockDriverState *bs,
         return -EINVAL;
     }
     s->set_refcount(refblock, block_index, 0);
+    update_free_cluster_bitmap(s, cluster_index, true);
 
     qcow2_cache_entry_mark_dirty(s->refcount_block_cache, refblock);
 
@@ -33,6 +33,15 @@
 #define QUORUM_OPT_BLKVERIFY      "blkverify"
 #define QUORUM_OPT_REWRITE        "rewrite-corrupted"
 #define QUORUM_OPT_READ_PATTERN   "read-pattern"
+#define QUORUM_OPT_HEDGED_READS   "hedged-reads"
+
+/* Every so many reads, read-pattern=latency probes another child so that
+ * the latency estimates of the slower children do not go stale.
+ */
+#define QUORUM_LATENCY_PROBE_INTERVAL 64
+
+/* Hedged reads never wait less than this before trying another child */
+#define QUORUM_HEDGE_MIN_NS (1 * SCALE_MS)
 
 /* This union holds a vote hash value */
 typedef union QuorumVoteValue {
@@ -65,6 +74,14 @@ typedef struct QuorumVotes {
     bool (*compare)(QuorumVoteValue *a, QuorumVoteValue *b);
 } QuorumVotes;
 
+/* Smoothed latency of successful reads from a child and its mean
+ * deviation, computed like the round-trip time estimates of RFC 6298.
+ */
+typedef struct QuorumChildLatency {
+    int64_t srtt_ns;
+    int64_t rttvar_ns;
+} QuorumChildLatency;
+
 /* the following structure holds the state of one quorum instance */
 typedef struct BDRVQuorumState {
     BdrvChild **children;  /* children BlockDriverStates */
@@ -88,6 +105,13 @@ typedef struct BDRVQuorumState {
                             */
 
     QuorumReadPattern read_pattern;
+
+    /* For read-pattern=latency */
+    QuorumChildLatency *latency; /* one entry per child */
+    unsigned reads;              /* counter for the latency probes */
+    bool hedged_reads;           /* start a read on another child if the
+                                  * first one is slower than usual
+                                  */
 } BDRVQuorumState;
 
 typedef struct QuorumAIOCB QuorumAIOCB;
@@ -660,6 +684,246 @@ static int read_fifo_child(QuorumAIOCB *acb)
     return ret;
 }
 
+static void quorum_update_latency(BDRVQuorumState *s, int i, int64_t ns)
+{
+    QuorumChildLatency *l = &s->latency[i];
+
+    if (!l->srtt_ns) {
+        l->srtt_ns = ns;
+        l->rttvar_ns = ns / 2;
+    } else {
+        int64_t delta = ns - l->srtt_ns;
+
+        l->rttvar_ns += (ABS(delta) - l->rttvar_ns) / 4;
+        l->srtt_ns += delta / 8;
+    }
+}
+
+/* How long to wait for a read from child @i before hedging */
+static int64_t quorum_hedge_timeout(BDRVQuorumState *s, int i)
+{
+    QuorumChildLatency *l = &s->latency[i];
+
+    return MAX(l->srtt_ns + 4 * l->rttvar_ns, QUORUM_HEDGE_MIN_NS);
+}
+
+/* Fill @order with the indices of the children, fastest first */
+static void quorum_latency_order(BDRVQuorumState *s, int *order)
+{
+    int i, j;
+
+    for (i = 0; i < s->num_children; i++) {
+        int64_t srtt = s->latency[i].srtt_ns;
+
+        for (j = i; j > 0 && s->latency[order[j - 1]].srtt_ns > srtt; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    if (s->num_children > 1 &&
+        ++s->reads % QUORUM_LATENCY_PROBE_INTERVAL == 0) {
+        unsigned probe = s->reads / QUORUM_LATENCY_PROBE_INTERVAL;
+        int k = 1 + probe % (s->num_children - 1);
+        int tmp = order[0];
+
+        order[0] = order[k];
+        order[k] = tmp;
+    }
+}
+
+/* State shared by the reads of a hedged request.  The reads that lost the
+ * race may still be running after the request has completed, so this is
+ * reference counted and they read into their own buffers.
+ */
+typedef struct QuorumHedgedRead {
+    BlockDriverState *bs;
+    QuorumAIOCB *acb;           /* NULL once the request has completed */
+    QEMUTimer *timer;
+    bool waiting;               /* acb->co has yielded */
+    int refcnt;
+    int pending;                /* reads in flight for acb */
+    bool done;                  /* a read has succeeded */
+    int ret;                    /* last error */
+} QuorumHedgedRead;
+
+typedef struct QuorumHedgedChildRead {
+    QuorumHedgedRead *hr;
+    int idx;
+} QuorumHedgedChildRead;
+
+static void quorum_hedged_wake(QuorumHedgedRead *hr)
+{
+    if (hr->waiting) {
+        hr->waiting = false;
+        aio_co_wake(hr->acb->co);
+    }
+}
+
+static void quorum_hedge_timer_cb(void *opaque)
+{
+    quorum_hedged_wake(opaque);
+}
+
+static void quorum_hedged_read_entry(void *opaque)
+{
+    QuorumHedgedChildRead *cr = opaque;
+    QuorumHedgedRead *hr = cr->hr;
+    BlockDriverState *bs = hr->bs;
+    BDRVQuorumState *s = bs->opaque;
+    int i = cr->idx;
+    uint64_t offset = hr->acb->offset;
+    uint64_t bytes = hr->acb->bytes;
+    QEMUIOVector qiov;
+    int64_t start;
+    uint8_t *buf;
+    int ret;
+
+    buf = qemu_try_blockalign(s->children[i]->bs, bytes);
+    if (!buf) {
+        ret = -ENOMEM;
+    } else {
+        qemu_iovec_init_buf(&qiov, buf, bytes);
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        ret = bdrv_co_preadv(s->children[i], offset, bytes, &qiov, 0);
+        if (ret == 0) {
+            quorum_update_latency(s, i,
+                qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+        }
+    }
+
+    if (hr->acb) {
+        QuorumChildRequest *sacb = &hr->acb->qcrs[i];
+
+        sacb->bs = s->children[i]->bs;
+        if (ret < 0) {
+            quorum_report_bad_acb(sacb, ret);
+            hr->ret = ret;
+        } else if (!hr->done) {
+            qemu_iovec_from_buf(hr->acb->qiov, 0, buf, bytes);
+            hr->done = true;
+        }
+        hr->pending--;
+        quorum_hedged_wake(hr);
+    }
+
+    qemu_vfree(buf);
+    g_free(cr);
+    if (--hr->refcnt == 0) {
+        g_free(hr);
+    }
+    bdrv_dec_in_flight(bs);
+}
+
+static void quorum_start_hedged_read(QuorumHedgedRead *hr, int i)
+{
+    QuorumHedgedChildRead *cr = g_new(QuorumHedgedChildRead, 1);
+    Coroutine *co;
+
+    *cr = (QuorumHedgedChildRead) {
+        .hr     = hr,
+        .idx    = i,
+    };
+    hr->refcnt++;
+    hr->pending++;
+
+    /* The read may outlive the request, so it must keep the node busy */
+    bdrv_inc_in_flight(hr->bs);
+    co = qemu_coroutine_create(quorum_hedged_read_entry, cr);
+    qemu_coroutine_enter(co);
+}
+
+/* Read from the fastest child, and also from the next one if the first
+ * read takes much longer than that child usually needs.  The first
+ * successful read completes the request.
+ */
+static int read_hedged_children(QuorumAIOCB *acb, int *order)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    QuorumHedgedRead *hr = g_new(QuorumHedgedRead, 1);
+    int next = 0;
+    int ret;
+
+    *hr = (QuorumHedgedRead) {
+        .bs     = acb->bs,
+        .acb    = acb,
+        .refcnt = 1,
+        .ret    = -EIO,
+    };
+    hr->timer = aio_timer_new(bdrv_get_aio_context(acb->bs),
+                              QEMU_CLOCK_REALTIME, SCALE_NS,
+                              quorum_hedge_timer_cb, hr);
+
+    quorum_start_hedged_read(hr, order[next++]);
+    for (;;) {
+        if (!hr->done && hr->pending) {
+            if (next < s->num_children) {
+                timer_mod(hr->timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                          quorum_hedge_timeout(s, order[next - 1]));
+            }
+            hr->waiting = true;
+            qemu_coroutine_yield();
+            timer_del(hr->timer);
+        }
+
+        if (hr->done) {
+            ret = 0;
+            break;
+        }
+        if (next == s->num_children) {
+            if (!hr->pending) {
+                ret = hr->ret;
+                break;
+            }
+            continue;
+        }
+
+        /* Timed out, or a read failed: try the next child */
+        quorum_start_hedged_read(hr, order[next++]);
+    }
+
+    timer_free(hr->timer);
+    hr->acb = NULL;
+    if (--hr->refcnt == 0) {
+        g_free(hr);
+    }
+    return ret;
+}
+
+static int read_latency_child(QuorumAIOCB *acb)
+{
+    BDRVQuorumState *s = acb->bs->opaque;
+    int *order = g_new(int, s->num_children);
+    int64_t start;
+    int i, n, ret;
+
+    quorum_latency_order(s, order);
+
+    if (s->hedged_reads && s->num_children > 1) {
+        ret = read_hedged_children(acb, order);
+        goto out;
+    }
+
+    /* Like read_fifo_child(), but in order of latency */
+    for (i = 0; i < s->num_children; i++) {
+        n = order[i];
+        acb->qcrs[n].bs = s->children[n]->bs;
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        ret = bdrv_co_preadv(s->children[n], acb->offset, acb->bytes,
+                             acb->qiov, 0);
+        if (ret == 0) {
+            quorum_update_latency(s, n,
+                qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+            break;
+        }
+        quorum_report_bad_acb(&acb->qcrs[n], ret);
+    }
+
+out:
+    g_free(order);
+    return ret;
+}
+
 static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
                             uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
@@ -670,10 +934,16 @@ static int quorum_co_preadv(BlockDriverState *bs, uint64_t offset,
     acb->is_read = true;
     acb->children_read = 0;
 
-    if (s->read_pattern == QUORUM_READ_PATTERN_QUORUM) {
+    switch (s->read_pattern) {
+    case QUORUM_READ_PATTERN_QUORUM:
         ret = read_quorum_children(acb);
-    } else {
+        break;
+    case QUORUM_READ_PATTERN_LATENCY:
+        ret = read_latency_child(acb);
+        break;
+    default:
         ret = read_fifo_child(acb);
+        break;
     }
     quorum_aio_finalize(acb);
 
@@ -852,7 +1122,13 @@ static QemuOptsList quorum_runtime_opts = {
         {
             .name = QUORUM_OPT_READ_PATTERN,
             .type = QEMU_OPT_STRING,
-            .help = "Allowed pattern: quorum, fifo. Quorum is default",
+            .help = "Allowed pattern: quorum, fifo, latency. Quorum is default",
+        },
+        {
+            .name = QUORUM_OPT_HEDGED_READS,
+            .type = QEMU_OPT_BOOL,
+            .help = "Also read from the next fastest child if a read is slow "
+                    "(read-pattern=latency only)",
         },
         { /* end of list */ }
     },
@@ -907,7 +1183,8 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
                               -EINVAL, NULL);
     }
     if (ret < 0) {
-        error_setg(&local_err, "Please set read-pattern as fifo or quorum");
+        error_setg(&local_err,
+                   "Please set read-pattern as fifo, latency or quorum");
         goto exit;
     }
     s->read_pattern = ret;
@@ -931,8 +1208,17 @@ static int quorum_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    s->hedged_reads = qemu_opt_get_bool(opts, QUORUM_OPT_HEDGED_READS, false);
+    if (s->hedged_reads && s->read_pattern != QUORUM_READ_PATTERN_LATENCY) {
+        error_setg(&local_err, "hedged-reads=on can only be used with "
+                   "read-pattern=latency");
+        ret = -EINVAL;
+        goto exit;
+    }
+
     /* allocate the children array */
     s->children = g_new0(BdrvChild *, s->num_children);
+    s->latency = g_new0(QuorumChildLatency, s->num_children);
     opened = g_new0(bool, s->num_children);
 
     for (i = 0; i < s->num_children; i++) {
@@ -965,6 +1251,7 @@ close_exit:
         bdrv_unref_child(bs, s->children[i]);
     }
     g_free(s->children);
+    g_free(s->latency);
     g_free(opened);
 exit:
     qemu_opts_del(opts);
@@ -983,6 +1270,7 @@ static void quorum_close(BlockDriverState *bs)
     }
 
     g_free(s->children);
+    g_free(s->latency);
 }
 
 static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
@@ -1023,6 +1311,8 @@ static void quorum_add_child(BlockDriverState *bs, BlockDriverState *child_bs,
         goto out;
     }
     s->children = g_renew(BdrvChild *, s->children, s->num_children + 1);
+    s->latency = g_renew(QuorumChildLatency, s->latency, s->num_children + 1);
+    s->latency[s->num_children] = (QuorumChildLatency) { 0 };
     s->children[s->num_children++] = child;
 
 out:
@@ -1059,7 +1349,10 @@ static void quorum_del_child(BlockDriverState *bs, BdrvChild *child,
     /* We can safely remove this child now */
     memmove(&s->children[i], &s->children[i + 1],
             (s->num_children - i - 1) * sizeof(BdrvChild *));
+    memmove(&s->latency[i], &s->latency[i + 1],
+            (s->num_children - i - 1) * sizeof(QuorumChildLatency));
     s->children = g_renew(BdrvChild *, s->children, --s->num_children);
+    s->latency = g_renew(QuorumChildLatency, s->latency, s->num_children);
     bdrv_unref_child(bs, child);
 
     bdrv_drained_end(bs);
@@ -1119,6 +1412,7 @@ static const char *const quorum_strong_runtime_opts[] = {
     QUORUM_OPT_BLKVERIFY,
     QUORUM_OPT_REWRITE,
     QUORUM_OPT_READ_PATTERN,
+    QUORUM_OPT_HEDGED_READS,
 
     NULL
 };
@@ -95,6 +95,7 @@ typedef struct RADOSCB {
     int64_t size;
     char *buf;
     int64_t ret;
+    struct RADOSCB *next;
 } RADOSCB;
 
 typedef struct BDRVRBDState {
@@ -104,6 +105,16 @@ typedef struct BDRVRBDState {
     char *image_name;
     char *snap;
     uint64_t image_size;
+
+    /*
+     * Requests completed by librbd, pushed from its callback thread with
+     * atomic operations.  completion_notifier is set when the list goes
+     * from empty to non-empty, and the AioContext can also pick up the
+     * completions by polling.
+     */
+    RADOSCB *completions;
+    EventNotifier completion_notifier;
+    AioContext *aio_context;
 } BDRVRBDState;
 
 static int qemu_rbd_connect(rados_t *cluster, rados_ioctx_t *io_ctx,
@@ -486,8 +497,8 @@ exit:
 }
 
 /*
- * This aio completion is being called from rbd_finish_bh() and runs in qemu
- * BH context.
+ * This aio completion is being called from qemu_rbd_process_completions()
+ * and runs in the AioContext of the BlockDriverState.
  */
 static void qemu_rbd_complete_aio(RADOSCB *rcb)
 {
@@ -520,7 +531,7 @@ static void qemu_rbd_complete_aio(RADOSCB *rcb)
 
     g_free(rcb);
 
-    if (!LIBRBD_USE_IOVEC) {
+    if (!LIBRBD_USE_IOVEC && acb->bounce) {
         if (acb->cmd == RBD_AIO_READ) {
             qemu_iovec_from_buf(acb->qiov, 0, acb->bounce, acb->qiov->size);
         }
@@ -532,6 +543,68 @@ static void qemu_rbd_complete_aio(RADOSCB *rcb)
     qemu_aio_unref(acb);
 }
 
+/* Complete the requests that librbd has queued.  Returns true if any. */
+static bool qemu_rbd_process_completions(BDRVRBDState *s)
+{
+    RADOSCB *rcb, *next, *list = NULL;
+
+    if (!atomic_read(&s->completions)) {
+        return false;
+    }
+
+    /* Reverse the list so that requests complete in order */
+    rcb = atomic_xchg(&s->completions, NULL);
+    while (rcb) {
+        next = rcb->next;
+        rcb->next = list;
+        list = rcb;
+        rcb = next;
+    }
+
+    for (rcb = list; rcb; rcb = next) {
+        next = rcb->next;
+        qemu_rbd_complete_aio(rcb);
+    }
+    return true;
+}
+
+static void qemu_rbd_completion_read(EventNotifier *n)
+{
+    BDRVRBDState *s = container_of(n, BDRVRBDState, completion_notifier);
+
+    /* Clear first, so that a completion queued now sets it again */
+    event_notifier_test_and_clear(n);
+    qemu_rbd_process_completions(s);
+}
+
+static bool qemu_rbd_completion_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    BDRVRBDState *s = container_of(n, BDRVRBDState, completion_notifier);
+
+    return qemu_rbd_process_completions(s);
+}
+
+static void qemu_rbd_attach_aio_context(BlockDriverState *bs,
+                                        AioContext *new_context)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    s->aio_context = new_context;
+    aio_set_event_notifier(new_context, &s->completion_notifier, false,
+                           qemu_rbd_completion_read,
+                           qemu_rbd_completion_poll);
+}
+
+static void qemu_rbd_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    aio_set_event_notifier(s->aio_context, &s->completion_notifier, false,
+                           NULL, NULL);
+    s->aio_context = NULL;
+}
+
 static char *qemu_rbd_mon_host(BlockdevOptionsRbd *opts, Error **errp)
 {
     const char **vals;
@@ -797,6 +870,14 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    r = event_notifier_init(&s->completion_notifier, 0);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "error initializing event notifier");
+        rbd_close(s->image);
+        goto failed_open;
+    }
+    qemu_rbd_attach_aio_context(bs, bdrv_get_aio_context(bs));
+
     r = 0;
     goto out;
 
@@ -836,6 +917,8 @@ static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
 
+    qemu_rbd_detach_aio_context(bs);
+    event_notifier_cleanup(&s->completion_notifier);
     rbd_close(s->image);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
@@ -863,29 +946,31 @@ static const AIOCBInfo rbd_aiocb_info = {
     .aiocb_size = sizeof(RBDAIOCB),
 };
 
-static void rbd_finish_bh(void *opaque)
-{
-    RADOSCB *rcb = opaque;
-    qemu_rbd_complete_aio(rcb);
-}
-
 /*
  * This is the callback function for rbd_aio_read and _write
  *
  * Note: this function is being called from a non qemu thread so
- * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from rbd_finish_bh() which runs in a qemu context.
+ * we need to be careful about what we do here. We only queue the
+ * request, and do the rest of the io completion handling from
+ * qemu_rbd_process_completions() which runs in a qemu context.
  */
 static void rbd_finish_aiocb(rbd_completion_t c, RADOSCB *rcb)
 {
-    RBDAIOCB *acb = rcb->acb;
+    BDRVRBDState *s = rcb->s;
+    RADOSCB *old;
 
     rcb->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
 
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(acb->common.bs),
-                            rbd_finish_bh, rcb);
+    do {
+        old = atomic_read(&s->completions);
+        rcb->next = old;
+    } while (atomic_cmpxchg(&s->completions, old, rcb) != old);
+
+    /* If the list was not empty, the AioContext has not seen it yet */
+    if (!old) {
+        event_notifier_set(&s->completion_notifier);
+    }
 }
 
 static int rbd_aio_discard_wrapper(rbd_image_t image,
@@ -935,16 +1020,22 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     if (!LIBRBD_USE_IOVEC) {
         if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH) {
             acb->bounce = NULL;
+        } else if (qiov->niov == 1) {
+            /* A single buffer can be passed to librbd as is */
+            acb->bounce = NULL;
+            rcb->buf = qiov->iov[0].iov_base;
         } else {
             acb->bounce = qemu_try_blockalign(bs, qiov->size);
             if (acb->bounce == NULL) {
                 goto failed;
             }
         }
-        if (cmd == RBD_AIO_WRITE) {
-            qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
+        if (acb->bounce) {
+            if (cmd == RBD_AIO_WRITE) {
+                qemu_iovec_to_buf(acb->qiov, 0, acb->bounce, qiov->size);
+            }
+            rcb->buf = acb->bounce;
         }
-        rcb->buf = acb->bounce;
     }
 
     acb->ret = 0;
@@ -1285,6 +1376,8 @@ static BlockDriver bdrv_rbd = {
     .bdrv_file_open         = qemu_rbd_open,
     .bdrv_close             = qemu_rbd_close,
     .bdrv_reopen_prepare    = qemu_rbd_reopen_prepare,
+    .bdrv_attach_aio_context = qemu_rbd_attach_aio_context,
+    .bdrv_detach_aio_context = qemu_rbd_detach_aio_context,
     .bdrv_co_create         = qemu_rbd_co_create,
     .bdrv_co_create_opts    = qemu_rbd_co_create_opts,
     .bdrv_has_zero_init     = bdrv_has_zero_init_1,
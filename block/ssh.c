@@ -52,6 +52,14 @@
  */
 #define TRACE_LIBSSH  0 /* see: SSH_LOG_* */
 
+/*
+ * The size of SFTP packets is limited to 32K bytes, so reads are split
+ * into requests of this size, and large reads keep up to
+ * SSH_MAX_READS_IN_FLIGHT of them outstanding.
+ */
+#define SSH_READ_CHUNK_SIZE     16384
+#define SSH_MAX_READS_IN_FLIGHT 16
+
 typedef struct BDRVSSHState {
     /* Coroutine. */
     CoMutex lock;
@@ -1098,7 +1106,7 @@ static coroutine_fn int ssh_read(BDRVSSHState *s, BlockDriverState *bs,
          * the amount of data requested to 16K, as libssh currently
          * does not handle multiple requests on its own.
          */
-        request_read_size = MIN(end_of_vec - buf, 16384);
+        request_read_size = MIN(end_of_vec - buf, SSH_READ_CHUNK_SIZE);
         trace_ssh_read_buf(buf, end_of_vec - buf, request_read_size);
         r = sftp_read(s->sftp_handle, buf, request_read_size);
         trace_ssh_read_return(r, sftp_get_error(s->sftp));
@@ -1129,6 +1137,118 @@ static coroutine_fn int ssh_read(BDRVSSHState *s, BlockDriverState *bs,
     return 0;
 }
 
+/*
+ * Read a large range with several SFTP read requests in flight, so that
+ * a transfer is not limited to one 16K packet per round trip.  Replies
+ * are collected in the order the requests were sent; libssh queues the
+ * ones that arrive out of order until they are asked for.
+ */
+static coroutine_fn int ssh_read_pipelined(BDRVSSHState *s,
+                                           BlockDriverState *bs,
+                                           int64_t offset, size_t size,
+                                           QEMUIOVector *qiov)
+{
+    struct {
+        uint32_t id;
+        size_t start;
+        size_t len;
+    } reqs[SSH_MAX_READS_IN_FLIGHT];
+    int head = 0, in_flight = 0;
+    size_t next = 0;
+    bool eof = false;
+    char *buf;
+    int ret = 0;
+
+    trace_ssh_read(offset, size);
+
+    buf = g_try_malloc(size);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    trace_ssh_seek(offset);
+    sftp_seek64(s->sftp_handle, offset);
+    sftp_file_set_nonblocking(s->sftp_handle);
+
+    for (;;) {
+        ssize_t r;
+        int i;
+
+        while (!eof && next < size && in_flight < SSH_MAX_READS_IN_FLIGHT) {
+            size_t len = MIN(size - next, SSH_READ_CHUNK_SIZE);
+            int id = sftp_async_read_begin(s->sftp_handle, len);
+
+            if (id < 0) {
+                sftp_error_trace(s, "read");
+                ret = -EIO;
+                goto out;
+            }
+
+            i = (head + in_flight) % SSH_MAX_READS_IN_FLIGHT;
+            reqs[i].id = id;
+            reqs[i].start = next;
+            reqs[i].len = len;
+            in_flight++;
+            next += len;
+        }
+
+        if (!in_flight) {
+            break;
+        }
+
+        i = head;
+        do {
+            r = sftp_async_read(s->sftp_handle, buf + reqs[i].start,
+                                reqs[i].len, reqs[i].id);
+            trace_ssh_read_return(r, sftp_get_error(s->sftp));
+            if (r == SSH_AGAIN) {
+                co_yield(s, bs);
+            }
+        } while (r == SSH_AGAIN);
+
+        if (r < 0) {
+            sftp_error_trace(s, "read");
+            ret = -EIO;
+            goto out;
+        }
+
+        head = (head + 1) % SSH_MAX_READS_IN_FLIGHT;
+        in_flight--;
+
+        if (r == 0) {
+            /*
+             * EOF: Short read so pad the buffer with zeroes and return it.
+             * Replies to the requests past EOF stay in libssh's queue
+             * until the session is closed; only the last read of an
+             * image that is not sector aligned gets here.
+             */
+            memset(buf + reqs[i].start, 0, size - reqs[i].start);
+            eof = true;
+            break;
+        }
+
+        if (r < reqs[i].len) {
+            /* The server may send less than asked for; fetch the rest */
+            QEMUIOVector gap;
+            size_t gap_start = reqs[i].start + r;
+
+            qemu_iovec_init_buf(&gap, buf + gap_start, reqs[i].len - r);
+            ret = ssh_read(s, bs, offset + gap_start, reqs[i].len - r, &gap);
+            if (ret < 0) {
+                goto out;
+            }
+            sftp_seek64(s->sftp_handle, offset + next);
+        }
+    }
+
+    qemu_iovec_from_buf(qiov, 0, buf, size);
+
+out:
+    sftp_file_set_blocking(s->sftp_handle);
+    g_free(buf);
+    return ret;
+}
+
 static coroutine_fn int ssh_co_readv(BlockDriverState *bs,
                                      int64_t sector_num,
                                      int nb_sectors, QEMUIOVector *qiov)
@@ -1137,8 +1257,13 @@ static coroutine_fn int ssh_co_readv(BlockDriverState *bs,
     int ret;
 
     qemu_co_mutex_lock(&s->lock);
-    ret = ssh_read(s, bs, sector_num * BDRV_SECTOR_SIZE,
-                   nb_sectors * BDRV_SECTOR_SIZE, qiov);
+    if (nb_sectors * BDRV_SECTOR_SIZE > SSH_READ_CHUNK_SIZE) {
+        ret = ssh_read_pipelined(s, bs, sector_num * BDRV_SECTOR_SIZE,
+                                 nb_sectors * BDRV_SECTOR_SIZE, qiov);
+    } else {
+        ret = ssh_read(s, bs, sector_num * BDRV_SECTOR_SIZE,
+                       nb_sectors * BDRV_SECTOR_SIZE, qiov);
+    }
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
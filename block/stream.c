@@ -27,8 +27,13 @@ enum {
      * that populating contiguous regions of the image is efficient.
      */
     STREAM_CHUNK = 512 * 1024, /* in bytes */
+
+    /* Upper limit for the max-workers option */
+    STREAM_MAX_WORKERS = 64,
 };
 
+typedef struct StreamWorker StreamWorker;
+
 typedef struct StreamBlockJob {
     BlockJob common;
     BlockDriverState *bottom;
@@ -36,8 +41,23 @@ typedef struct StreamBlockJob {
     char *backing_file_str;
     bool bs_read_only;
     bool chain_frozen;
+
+    /* Copy requests run in up to max_workers coroutines at a time */
+    int max_workers;
+    int nb_workers;
+    CoQueue worker_queue;
+    /* First error hit by a worker; its range is queued in @failed */
+    int worker_ret;
+    QSIMPLEQ_HEAD(, StreamWorker) failed;
 } StreamBlockJob;
 
+struct StreamWorker {
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+    QSIMPLEQ_ENTRY(StreamWorker) next;
+};
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes)
 {
@@ -47,6 +67,47 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
                          BDRV_REQ_COPY_ON_READ | BDRV_REQ_PREFETCH);
 }
 
+static void coroutine_fn stream_worker_entry(void *opaque)
+{
+    StreamWorker *w = opaque;
+    StreamBlockJob *s = w->s;
+    int ret;
+
+    ret = stream_populate(s->common.blk, w->offset, w->bytes);
+    if (ret < 0) {
+        /* Keep the range around so that it can be retried */
+        if (!s->worker_ret) {
+            s->worker_ret = ret;
+        }
+        QSIMPLEQ_INSERT_TAIL(&s->failed, w, next);
+    } else {
+        job_progress_update(&s->common.job, w->bytes);
+        g_free(w);
+    }
+
+    s->nb_workers--;
+    qemu_co_queue_restart_all(&s->worker_queue);
+}
+
+static void coroutine_fn stream_start_worker(StreamBlockJob *s,
+                                             StreamWorker *w)
+{
+    Coroutine *co;
+
+    s->nb_workers++;
+    co = qemu_coroutine_create(stream_worker_entry, w);
+    qemu_coroutine_enter(co);
+}
+
+/* Wait until fewer than @max_workers copy requests are in flight */
+static void coroutine_fn stream_wait_for_workers(StreamBlockJob *s,
+                                                 int max_workers)
+{
+    while (s->nb_workers >= max_workers) {
+        qemu_co_queue_wait(&s->worker_queue, NULL);
+    }
+}
+
 static void stream_abort(Job *job)
 {
     StreamBlockJob *s = container_of(job, StreamBlockJob, common.job);
@@ -137,16 +198,57 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
         bdrv_enable_copy_on_read(bs);
     }
 
-    for ( ; offset < len; offset += n) {
+    while (true) {
+        StreamWorker *w;
         bool copy;
 
         /* Note that even when no rate limit is applied we need to yield
-         * with no pending I/O here so that bdrv_drain_all() returns.
+         * here so that bdrv_drain_all() returns.
          */
         job_sleep_ns(&s->common.job, delay_ns);
         if (job_is_cancelled(&s->common.job)) {
             break;
         }
+        delay_ns = 0;
+
+        stream_wait_for_workers(s, s->max_workers);
+        if (s->worker_ret < 0 || offset >= len) {
+            stream_wait_for_workers(s, 1);
+        }
+
+        if (s->worker_ret < 0) {
+            BlockErrorAction action =
+                block_job_error_action(&s->common, s->on_error, true,
+                                       -s->worker_ret);
+            if (action != BLOCK_ERROR_ACTION_STOP && error == 0) {
+                error = s->worker_ret;
+            }
+            s->worker_ret = 0;
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                break;
+            }
+            if (action == BLOCK_ERROR_ACTION_IGNORE) {
+                while ((w = QSIMPLEQ_FIRST(&s->failed))) {
+                    QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+                    job_progress_update(&s->common.job, w->bytes);
+                    g_free(w);
+                }
+            }
+            /* On stop, the failed ranges are retried after resuming */
+            continue;
+        }
+
+        w = QSIMPLEQ_FIRST(&s->failed);
+        if (w) {
+            QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+            stream_start_worker(s, w);
+            delay_ns = block_job_ratelimit_get_delay(&s->common, w->bytes);
+            continue;
+        }
+
+        if (offset >= len) {
+            break;
+        }
 
         copy = false;
 
@@ -166,14 +268,10 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             copy = (ret == 1);
         }
         trace_stream_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = stream_populate(blk, offset, n);
-        }
         if (ret < 0) {
             BlockErrorAction action =
                 block_job_error_action(&s->common, s->on_error, true, -ret);
             if (action == BLOCK_ERROR_ACTION_STOP) {
-                n = 0;
                 continue;
             }
             if (error == 0) {
@@ -182,16 +280,32 @@ static int coroutine_fn stream_run(Job *job, Error **errp)
             if (action == BLOCK_ERROR_ACTION_REPORT) {
                 break;
             }
+            copy = false;
         }
         ret = 0;
 
-        /* Publish progress */
-        job_progress_update(&s->common.job, n);
         if (copy) {
+            /* Progress is published once the copy has completed */
+            w = g_new(StreamWorker, 1);
+            *w = (StreamWorker) {
+                .s      = s,
+                .offset = offset,
+                .bytes  = n,
+            };
+            stream_start_worker(s, w);
             delay_ns = block_job_ratelimit_get_delay(&s->common, n);
         } else {
-            delay_ns = 0;
+            job_progress_update(&s->common.job, n);
         }
+        offset += n;
+    }
+
+    stream_wait_for_workers(s, 1);
+    while (!QSIMPLEQ_EMPTY(&s->failed)) {
+        StreamWorker *w = QSIMPLEQ_FIRST(&s->failed);
+
+        QSIMPLEQ_REMOVE_HEAD(&s->failed, next);
+        g_free(w);
     }
 
     if (enable_cor) {
@@ -217,7 +331,7 @@ static const BlockJobDriver stream_job_driver = {
 
 void stream_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, const char *backing_file_str,
-                  int creation_flags, int64_t speed,
+                  int creation_flags, int64_t speed, int max_workers,
                   BlockdevOnError on_error, Error **errp)
 {
     StreamBlockJob *s;
@@ -226,6 +340,12 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     int basic_flags = BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE_UNCHANGED;
     BlockDriverState *bottom = bdrv_find_overlay(bs, base);
 
+    if (max_workers < 0 || max_workers > STREAM_MAX_WORKERS) {
+        error_setg(errp, "max-workers must be between 1 and %d",
+                   STREAM_MAX_WORKERS);
+        return;
+    }
+
     if (bdrv_freeze_backing_chain(bs, bottom, errp) < 0) {
         return;
     }
@@ -269,6 +389,9 @@ void stream_start(const char *job_id, BlockDriverState *bs,
     s->chain_frozen = true;
 
     s->on_error = on_error;
+    s->max_workers = max_workers ?: 1;
+    qemu_co_queue_init(&s->worker_queue);
+    QSIMPLEQ_INIT(&s->failed);
     trace_stream_start(bs, base, s);
     job_start(&s->common.job);
     return;
@@ -35,6 +35,11 @@
 #include "qom/object.h"
 #include "qom/object_interfaces.h"
 
+/* All leases together cover at most this fraction of one second's worth
+ * of the group's average limits for reads and for writes, i.e. 10ms of
+ * I/O each. */
+#define THROTTLE_LEASE_DIVISOR 100
+
 static void throttle_group_obj_init(Object *obj);
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
 static void timer_cb(ThrottleGroupMember *tgm, bool is_write);
@@ -70,13 +75,18 @@ typedef struct ThrottleGroup {
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* This lock protects the following fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
+    unsigned nb_members;
     ThrottleGroupMember *tokens[2];
     bool any_timer_armed[2];
     QEMUClockType clock_type;
 
+    /* Bumped under the lock whenever the configuration changes, which
+     * voids all leases. Members read it with atomic operations. */
+    unsigned lease_generation;
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 } ThrottleGroup;
@@ -349,10 +359,141 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
     }
 }
 
+/* Return the size of a lease for the buckets @total and @rw: a fraction
+ * of the lowest of their average limits, split among the members of the
+ * group, or 0 if neither is limited.
+ *
+ * This assumes that tg->lock is held.
+ */
+static double throttle_group_lease_amount(ThrottleState *ts,
+                                          BucketType total, BucketType rw)
+{
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    uint64_t avg_total = ts->cfg.buckets[total].avg;
+    uint64_t avg_rw = ts->cfg.buckets[rw].avg;
+    uint64_t avg;
+
+    if (!avg_total || !avg_rw) {
+        avg = avg_total ?: avg_rw;
+    } else {
+        avg = MIN(avg_total, avg_rw);
+    }
+
+    return (double) avg / THROTTLE_LEASE_DIVISOR / tg->nb_members;
+}
+
+/* Top up the lease of a ThrottleGroupMember, accounting the new tokens in
+ * the group right away. Leftovers from a lease taken before the last
+ * configuration change are discarded, since throttle_config() resets the
+ * bucket levels anyway.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_refill_lease(ThrottleGroupMember *tgm,
+                                        bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleLease *lease = &tgm->lease[is_write];
+    double bytes, units;
+
+    if (!lease->valid || lease->generation != tg->lease_generation) {
+        *lease = (ThrottleLease) {
+            .generation = tg->lease_generation,
+        };
+    }
+
+    bytes = throttle_group_lease_amount(ts, THROTTLE_BPS_TOTAL,
+                                        is_write ? THROTTLE_BPS_WRITE
+                                                 : THROTTLE_BPS_READ);
+    units = throttle_group_lease_amount(ts, THROTTLE_OPS_TOTAL,
+                                        is_write ? THROTTLE_OPS_WRITE
+                                                 : THROTTLE_OPS_READ);
+
+    lease->bytes_limited = bytes > 0;
+    lease->units_limited = units > 0;
+    lease->op_size = ts->cfg.op_size;
+
+    bytes = MAX(bytes - lease->bytes, 0);
+    units = MAX(units - lease->units, 0);
+    throttle_account_units(ts, is_write, bytes, units);
+    lease->bytes += bytes;
+    lease->units += units;
+    lease->valid = true;
+}
+
+/* Try to start an I/O request using tokens that were leased earlier,
+ * without taking tg->lock.
+ *
+ * This must be called from the member's AioContext.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ * @ret:       whether the request can be started right away
+ */
+static bool throttle_group_consume_lease(ThrottleGroupMember *tgm,
+                                         unsigned int bytes,
+                                         bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleLease *lease = &tgm->lease[is_write];
+    double units = 1.0;
+
+    /* Requests of this member that are already queued go first */
+    if (!lease->valid ||
+        lease->generation != atomic_read(&tg->lease_generation) ||
+        atomic_read(&tgm->pending_reqs[is_write])) {
+        return false;
+    }
+
+    if (lease->op_size && bytes > lease->op_size) {
+        units = (double) bytes / lease->op_size;
+    }
+
+    if ((lease->bytes_limited && bytes > lease->bytes) ||
+        (lease->units_limited && units > lease->units)) {
+        return false;
+    }
+
+    if (lease->bytes_limited) {
+        lease->bytes -= bytes;
+    }
+    if (lease->units_limited) {
+        lease->units -= units;
+    }
+    return true;
+}
+
+/* Give the unused part of a lease back to the group.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_return_lease(ThrottleGroupMember *tgm,
+                                        bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleLease *lease = &tgm->lease[is_write];
+
+    if (lease->valid && lease->generation == tg->lease_generation) {
+        throttle_account_units(ts, is_write, -lease->bytes, -lease->units);
+    }
+    *lease = (ThrottleLease) {};
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
  *
+ * Requests that fit in the member's lease start without taking the
+ * group lock. When a request goes through the group and no other member
+ * is waiting, the lease is topped up so that the next few requests can
+ * take the fast path as well.
+ *
  * @tgm:       the current ThrottleGroupMember
  * @bytes:     the number of bytes for this I/O
  * @is_write:  the type of operation (read/write)
@@ -361,9 +502,14 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
                                                         unsigned int bytes,
                                                         bool is_write)
 {
-    bool must_wait;
+    bool must_wait, waited = false;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    if (throttle_group_consume_lease(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -372,6 +518,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
+        waited = true;
         tgm->pending_reqs[is_write]++;
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
@@ -385,6 +532,11 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, is_write, bytes);
 
+    /* Lease more tokens unless other members are waiting for them */
+    if (!waited && token == tgm && !atomic_read(&tgm->io_limits_disabled)) {
+        throttle_group_refill_lease(tgm, is_write);
+    }
+
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
@@ -472,6 +624,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    atomic_inc(&tg->lease_generation);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -545,6 +698,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
     atomic_set(&tgm->restart_pending, 0);
+    memset(tgm->lease, 0, sizeof(tgm->lease));
 
     qemu_mutex_lock(&tg->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
@@ -555,6 +709,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
+    tg->nb_members++;
 
     throttle_timers_init(&tgm->throttle_timers,
                          tgm->aio_context,
@@ -599,6 +754,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
         assert(tgm->pending_reqs[i] == 0);
         assert(qemu_co_queue_empty(&tgm->throttled_reqs[i]));
         assert(!timer_pending(tgm->throttle_timers.timers[i]));
+        throttle_group_return_lease(tgm, i);
         if (tg->tokens[i] == tgm) {
             token = throttle_group_next_tgm(tgm);
             /* Take care of the case where this is the last tgm in the group */
@@ -611,6 +767,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
 
     /* remove the current tgm from the list */
     QLIST_REMOVE(tgm, round_robin);
+    tg->nb_members--;
     throttle_timers_destroy(&tgm->throttle_timers);
     qemu_mutex_unlock(&tg->lock);
 
@@ -187,7 +187,7 @@ void qmp_nbd_server_add(const char *device, bool has_name, const char *name,
         writable = false;
     }
 
-    exp = nbd_export_new(bs, 0, len, name, NULL, bitmap, !writable, !writable,
+    exp = nbd_export_new(bs, 0, len, name, NULL, bitmap, !writable, true,
                          NULL, false, on_eject_blk, errp);
     if (!exp) {
         return;
@@ -385,13 +385,9 @@ static void extract_common_blockdev_options(QemuOpts *opts, int *bdrv_flags,
         }
 
         if ((aio = qemu_opt_get(opts, "aio")) != NULL) {
-            if (!strcmp(aio, "native")) {
-                *bdrv_flags |= BDRV_O_NATIVE_AIO;
-            } else if (!strcmp(aio, "threads")) {
-                /* this is the default */
-            } else {
-               error_setg(errp, "invalid aio option");
-               return;
+            if (bdrv_parse_aio(aio, bdrv_flags) < 0) {
+                error_setg(errp, "invalid aio option");
+                return;
             }
         }
     }
@@ -1291,6 +1287,18 @@ static BdrvDirtyBitmap *block_dirty_bitmap_lookup(const char *node,
         return NULL;
     }
 
+    if (bdrv_dirty_bitmap_lazy(bitmap)) {
+        AioContext *aio_context = bdrv_get_aio_context(bs);
+        int ret;
+
+        aio_context_acquire(aio_context);
+        ret = bdrv_load_dirty_bitmap(bs, bitmap, errp);
+        aio_context_release(aio_context);
+        if (ret < 0) {
+            return NULL;
+        }
+    }
+
     if (pbs) {
         *pbs = bs;
     }
@@ -3037,6 +3045,7 @@ static BdrvDirtyBitmap *do_block_dirty_bitmap_merge(
     BdrvDirtyBitmap *dst, *src, *anon;
     BlockDirtyBitmapMergeSourceList *lst;
     Error *local_err = NULL;
+    int ret;
 
     dst = block_dirty_bitmap_lookup(node, target, &bs, errp);
     if (!dst) {
@@ -3060,6 +3069,13 @@ static BdrvDirtyBitmap *do_block_dirty_bitmap_merge(
                 dst = NULL;
                 goto out;
             }
+            aio_context_acquire(bdrv_get_aio_context(bs));
+            ret = bdrv_load_dirty_bitmap(bs, src, errp);
+            aio_context_release(bdrv_get_aio_context(bs));
+            if (ret < 0) {
+                dst = NULL;
+                goto out;
+            }
             break;
         case QTYPE_QDICT:
             node = lst->value->u.external.node;
@@ -3238,6 +3254,7 @@ void qmp_block_stream(bool has_job_id, const char *job_id, const char *device,
                       bool has_base_node, const char *base_node,
                       bool has_backing_file, const char *backing_file,
                       bool has_speed, int64_t speed,
+                      bool has_max_workers, int64_t max_workers,
                       bool has_on_error, BlockdevOnError on_error,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
@@ -3319,7 +3336,8 @@ void qmp_block_stream(bool has_job_id, const char *job_id, const char *device,
     }
 
     stream_start(has_job_id ? job_id : NULL, bs, base_bs, base_name,
-                 job_flags, has_speed ? speed : 0, on_error, &local_err);
+                 job_flags, has_speed ? speed : 0,
+                 has_max_workers ? max_workers : 0, on_error, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         goto out;
@@ -3338,6 +3356,7 @@ void qmp_block_commit(bool has_job_id, const char *job_id, const char *device,
                       bool has_top, const char *top,
                       bool has_backing_file, const char *backing_file,
                       bool has_speed, int64_t speed,
+                      bool has_max_workers, int64_t max_workers,
                       bool has_filter_node_name, const char *filter_node_name,
                       bool has_auto_finalize, bool auto_finalize,
                       bool has_auto_dismiss, bool auto_dismiss,
@@ -3478,7 +3497,8 @@ void qmp_block_commit(bool has_job_id, const char *job_id, const char *device,
             goto out;
         }
         commit_start(has_job_id ? job_id : NULL, bs, base_bs, top_bs, job_flags,
-                     speed, on_error, has_backing_file ? backing_file : NULL,
+                     speed, has_max_workers ? max_workers : 0, on_error,
+                     has_backing_file ? backing_file : NULL,
                      filter_node_name, &local_err);
     }
     if (local_err != NULL) {
@@ -3523,6 +3543,12 @@ static BlockJob *do_backup_common(BackupCommon *backup,
     if (!backup->has_compress) {
         backup->compress = false;
     }
+    if (!backup->has_max_workers) {
+        backup->max_workers = 0;
+    }
+    if (!backup->has_max_chunk) {
+        backup->max_chunk = 0;
+    }
 
     ret = bdrv_try_set_aio_context(target_bs, aio_context, errp);
     if (ret < 0) {
@@ -3567,6 +3593,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (bdrv_dirty_bitmap_check(bmap, BDRV_BITMAP_ALLOW_RO, errp)) {
             return NULL;
         }
+        if (bdrv_load_dirty_bitmap(bs, bmap, errp) < 0) {
+            return NULL;
+        }
 
         /* This does not produce a useful bitmap artifact: */
         if (backup->sync == MIRROR_SYNC_MODE_NONE) {
@@ -3600,7 +3629,8 @@ static BlockJob *do_backup_common(BackupCommon *backup,
 
     job = backup_job_create(backup->job_id, bs, target_bs, backup->speed,
                             backup->sync, bmap, backup->bitmap_mode,
-                            backup->compress,
+                            backup->compress, backup->max_workers,
+                            backup->max_chunk,
                             backup->on_source_error,
                             backup->on_target_error,
                             job_flags, NULL, NULL, txn, errp);
@@ -4595,26 +4625,48 @@ void qmp_x_blockdev_set_iothread(const char *node_name, StrOrNull *iothread,
 }
 
 void qmp_block_latency_histogram_set(
-    const char *id,
+    bool has_id, const char *id,
+    bool has_node_name, const char *node_name,
     bool has_boundaries, uint64List *boundaries,
     bool has_boundaries_read, uint64List *boundaries_read,
     bool has_boundaries_write, uint64List *boundaries_write,
     bool has_boundaries_flush, uint64List *boundaries_flush,
     Error **errp)
 {
-    BlockBackend *blk = qmp_get_blk(NULL, id, errp);
+    BlockDriverState *bs = NULL;
     BlockAcctStats *stats;
+    const char *name;
     int ret;
 
-    if (!blk) {
+    if (has_id == has_node_name) {
+        error_setg(errp, "Exactly one of 'id' and 'node-name' must be given");
         return;
     }
 
-    stats = blk_get_stats(blk);
+    if (has_id) {
+        BlockBackend *blk = qmp_get_blk(NULL, id, errp);
+
+        if (!blk) {
+            return;
+        }
+        stats = blk_get_stats(blk);
+        name = id;
+    } else {
+        bs = bdrv_find_node(node_name);
+        if (!bs) {
+            error_setg(errp, "Cannot find node %s", node_name);
+            return;
+        }
+        stats = &bs->node_stats;
+        name = node_name;
+    }
 
     if (!has_boundaries && !has_boundaries_read && !has_boundaries_write &&
         !has_boundaries_flush)
     {
+        if (bs) {
+            atomic_set(&bs->node_stats_enabled, false);
+        }
         block_latency_histograms_clear(stats);
         return;
     }
@@ -4624,7 +4676,7 @@ void qmp_block_latency_histogram_set(
             stats, BLOCK_ACCT_READ,
             has_boundaries_read ? boundaries_read : boundaries);
         if (ret) {
-            error_setg(errp, "Device '%s' set read boundaries fail", id);
+            error_setg(errp, "Device '%s' set read boundaries fail", name);
             return;
         }
     }
@@ -4634,7 +4686,7 @@ void qmp_block_latency_histogram_set(
             stats, BLOCK_ACCT_WRITE,
             has_boundaries_write ? boundaries_write : boundaries);
         if (ret) {
-            error_setg(errp, "Device '%s' set write boundaries fail", id);
+            error_setg(errp, "Device '%s' set write boundaries fail", name);
             return;
         }
     }
@@ -4644,10 +4696,14 @@ void qmp_block_latency_histogram_set(
             stats, BLOCK_ACCT_FLUSH,
             has_boundaries_flush ? boundaries_flush : boundaries);
         if (ret) {
-            error_setg(errp, "Device '%s' set flush boundaries fail", id);
+            error_setg(errp, "Device '%s' set flush boundaries fail", name);
             return;
         }
     }
+
+    if (bs) {
+        atomic_set(&bs->node_stats_enabled, true);
+    }
 }
 
 QemuOptsList qemu_common_drive_opts = {
@@ -92,10 +92,10 @@ static void fd_chr_update_read_handler(Chardev *chr)
 
     remove_fd_in_watch(chr);
     if (s->ioc_in) {
-        chr->gsource = io_add_watch_poll(chr, s->ioc_in,
-                                           fd_chr_read_poll,
-                                           fd_chr_read, chr,
-                                           chr->gcontext);
+        chr->watch = io_add_watch_poll(chr, s->ioc_in,
+                                       fd_chr_read_poll,
+                                       fd_chr_read, chr,
+                                       chr->gcontext);
     }
 }
 
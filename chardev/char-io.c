@@ -22,9 +22,20 @@
  * THE SOFTWARE.
  */
 #include "qemu/osdep.h"
+#include "qemu/queue.h"
 #include "chardev/char-io.h"
 
-typedef struct IOWatchPoll {
+/*
+ * Read watches are gated by the frontend's can_read callback.  For
+ * chardevs serviced by the main loop this is done with a plain fd handler
+ * on the iohandler AioContext, which is enabled and disabled once per
+ * main loop iteration from a poll notifier; this keeps the sources out of
+ * glib's prepare/check/dispatch cycle, and glib's poll array only changes
+ * when a watch actually toggles.  Chardevs running in another
+ * GMainContext, and channels that cannot register AioContext handlers,
+ * use a GSource that checks can_read in its prepare callback.
+ */
+typedef struct IOWatchSource {
     GSource parent;
 
     QIOChannel *ioc;
@@ -33,17 +44,37 @@ typedef struct IOWatchPoll {
     IOCanReadHandler *fd_can_read;
     GSourceFunc fd_read;
     void *opaque;
-} IOWatchPoll;
+} IOWatchSource;
 
-static IOWatchPoll *io_watch_poll_from_source(GSource *source)
+struct IOWatchPoll {
+    /* GMainContext watches */
+    GSource *source;
+
+    /* main loop watches */
+    QIOChannel *ioc;
+    IOCanReadHandler *fd_can_read;
+    QIOChannelFunc fd_read;
+    void *opaque;
+    bool active;            /* fd handler registered */
+    bool stopped;           /* fd_read returned FALSE */
+    bool dispatching;       /* inside fd_read */
+    bool removed;           /* removed from within fd_read */
+    QTAILQ_ENTRY(IOWatchPoll) next;
+};
+
+static QTAILQ_HEAD(, IOWatchPoll) io_watches =
+    QTAILQ_HEAD_INITIALIZER(io_watches);
+static Notifier io_watch_poll_notifier;
+
+static IOWatchSource *io_watch_poll_from_source(GSource *source)
 {
-    return container_of(source, IOWatchPoll, parent);
+    return container_of(source, IOWatchSource, parent);
 }
 
 static gboolean io_watch_poll_prepare(GSource *source,
                                       gint *timeout)
 {
-    IOWatchPoll *iwp = io_watch_poll_from_source(source);
+    IOWatchSource *iwp = io_watch_poll_from_source(source);
     bool now_active = iwp->fd_can_read(iwp->opaque) > 0;
     bool was_active = iwp->src != NULL;
     if (was_active == now_active) {
@@ -74,18 +105,18 @@ static GSourceFuncs io_watch_poll_funcs = {
     .dispatch = io_watch_poll_dispatch,
 };
 
-GSource *io_add_watch_poll(Chardev *chr,
-                        QIOChannel *ioc,
-                        IOCanReadHandler *fd_can_read,
-                        QIOChannelFunc fd_read,
-                        gpointer user_data,
-                        GMainContext *context)
+static GSource *io_add_watch_source(Chardev *chr,
+                                   QIOChannel *ioc,
+                                   IOCanReadHandler *fd_can_read,
+                                   QIOChannelFunc fd_read,
+                                   gpointer user_data,
+                                   GMainContext *context)
 {
-    IOWatchPoll *iwp;
+    IOWatchSource *iwp;
     char *name;
 
-    iwp = (IOWatchPoll *) g_source_new(&io_watch_poll_funcs,
-                                       sizeof(IOWatchPoll));
+    iwp = (IOWatchSource *) g_source_new(&io_watch_poll_funcs,
+                                         sizeof(IOWatchSource));
     iwp->fd_can_read = fd_can_read;
     iwp->opaque = user_data;
     iwp->ioc = ioc;
@@ -101,11 +132,121 @@ GSource *io_add_watch_poll(Chardev *chr,
     return (GSource *)iwp;
 }
 
+static void io_watch_poll_read(void *opaque);
+
+static void io_watch_poll_set_active(IOWatchPoll *iwp, bool active)
+{
+    if (iwp->active != active) {
+        qio_channel_set_aio_fd_handler(iwp->ioc, iohandler_get_aio_context(),
+                                       active ? io_watch_poll_read : NULL,
+                                       NULL, iwp);
+        iwp->active = active;
+    }
+}
+
+static void io_watch_poll_free(IOWatchPoll *iwp)
+{
+    object_unref(OBJECT(iwp->ioc));
+    g_free(iwp);
+}
+
+static void io_watch_poll_read(void *opaque)
+{
+    IOWatchPoll *iwp = opaque;
+    gboolean ret;
+
+    iwp->dispatching = true;
+    ret = iwp->fd_read(iwp->ioc, G_IO_IN, iwp->opaque);
+    iwp->dispatching = false;
+
+    if (iwp->removed) {
+        io_watch_poll_free(iwp);
+    } else if (!ret) {
+        /* like a GSource callback returning FALSE, stop watching the fd */
+        iwp->stopped = true;
+        io_watch_poll_set_active(iwp, false);
+    }
+}
+
+static void io_watch_poll_update(Notifier *notifier, void *opaque)
+{
+    MainLoopPoll *mlpoll = opaque;
+    IOWatchPoll *iwp, *next;
+
+    if (mlpoll->state != MAIN_LOOP_POLL_FILL) {
+        return;
+    }
+
+    QTAILQ_FOREACH_SAFE(iwp, &io_watches, next, next) {
+        io_watch_poll_set_active(iwp, !iwp->stopped &&
+                                      iwp->fd_can_read(iwp->opaque) > 0);
+    }
+}
+
+static bool io_watch_poll_use_aio(QIOChannel *ioc, GMainContext *context)
+{
+#ifdef _WIN32
+    /* the iohandler AioContext only supports sockets on Windows */
+    return false;
+#else
+    return !context && QIO_CHANNEL_GET_CLASS(ioc)->io_set_aio_fd_handler;
+#endif
+}
+
+IOWatchPoll *io_add_watch_poll(Chardev *chr,
+                               QIOChannel *ioc,
+                               IOCanReadHandler *fd_can_read,
+                               QIOChannelFunc fd_read,
+                               gpointer user_data,
+                               GMainContext *context)
+{
+    IOWatchPoll *iwp = g_new0(IOWatchPoll, 1);
+
+    if (!io_watch_poll_use_aio(ioc, context)) {
+        iwp->source = io_add_watch_source(chr, ioc, fd_can_read, fd_read,
+                                          user_data, context);
+        return iwp;
+    }
+
+    if (!io_watch_poll_notifier.notify) {
+        io_watch_poll_notifier.notify = io_watch_poll_update;
+        main_loop_poll_add_notifier(&io_watch_poll_notifier);
+    }
+
+    object_ref(OBJECT(ioc));
+    iwp->ioc = ioc;
+    iwp->fd_can_read = fd_can_read;
+    iwp->fd_read = fd_read;
+    iwp->opaque = user_data;
+    QTAILQ_INSERT_TAIL(&io_watches, iwp, next);
+
+    /* make the main loop pick up the new watch */
+    qemu_notify_event();
+    return iwp;
+}
+
 void remove_fd_in_watch(Chardev *chr)
 {
-    if (chr->gsource) {
-        g_source_destroy(chr->gsource);
-        chr->gsource = NULL;
+    IOWatchPoll *iwp = chr->watch;
+
+    if (!iwp) {
+        return;
+    }
+    chr->watch = NULL;
+
+    if (iwp->source) {
+        g_source_destroy(iwp->source);
+        g_free(iwp);
+        return;
+    }
+
+    io_watch_poll_set_active(iwp, false);
+    QTAILQ_REMOVE(&io_watches, iwp, next);
+    if (iwp->dispatching) {
+        /* freed by io_watch_poll_read once fd_read returns */
+        iwp->removed = true;
+    } else {
+        io_watch_poll_free(iwp);
     }
 }
 
@@ -122,7 +263,7 @@ int io_channel_send_full(QIOChannel *ioc,
 
         ret = qio_channel_writev_full(
             ioc, &iov, 1,
-            fds, nfds, NULL);
+            fds, nfds, 0, NULL);
         if (ret == QIO_CHANNEL_ERR_BLOCK) {
             if (offset) {
                 return offset;
@@ -174,11 +174,11 @@ static void pty_chr_state(Chardev *chr, int connected)
             s->connected = 1;
             qemu_chr_be_event(chr, CHR_EVENT_OPENED);
         }
-        if (!chr->gsource) {
-            chr->gsource = io_add_watch_poll(chr, s->ioc,
-                                               pty_chr_read_poll,
-                                               pty_chr_read,
-                                               chr, chr->gcontext);
+        if (!chr->watch) {
+            chr->watch = io_add_watch_poll(chr, s->ioc,
+                                           pty_chr_read_poll,
+                                           pty_chr_read,
+                                           chr, chr->gcontext);
         }
     }
 }
@@ -604,10 +604,10 @@ static void update_ioc_handlers(SocketChardev *s)
     }
 
     remove_fd_in_watch(chr);
-    chr->gsource = io_add_watch_poll(chr, s->ioc,
-                                     tcp_chr_read_poll,
-                                     tcp_chr_read, chr,
-                                     chr->gcontext);
+    chr->watch = io_add_watch_poll(chr, s->ioc,
+                                   tcp_chr_read_poll,
+                                   tcp_chr_read, chr,
+                                   chr->gcontext);
 
     remove_hup_source(s);
     s->hup_source = qio_channel_create_watch(s->ioc, G_IO_HUP);
@@ -100,6 +100,153 @@ static void qemu_chr_write_log(Chardev *s, const uint8_t *buf, size_t len)
     }
 }
 
+/*
+ * Output buffer, written to the backend by its own thread.  Guest output
+ * only waits for the buffer, never for the file or socket behind it.
+ */
+struct ChardevOutbuf {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond data_cond;
+    QemuCond space_cond;
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t len;
+    bool drop;
+    bool stop;
+};
+
+static void *qemu_chr_outbuf_thread(void *opaque)
+{
+    Chardev *s = opaque;
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    ChardevOutbuf *ob = s->outbuf;
+    size_t chunk;
+    int res;
+
+    qemu_mutex_lock(&ob->lock);
+    for (;;) {
+        while (!ob->len && !ob->stop) {
+            qemu_cond_wait(&ob->data_cond, &ob->lock);
+        }
+        if (!ob->len) {
+            break;
+        }
+
+        /* Writers only fill the free space, this part stays untouched */
+        chunk = MIN(ob->len, ob->size - ob->head);
+        qemu_mutex_unlock(&ob->lock);
+
+        qemu_mutex_lock(&s->chr_write_lock);
+        res = cc->chr_write(s, ob->buf + ob->head, chunk);
+        qemu_mutex_unlock(&s->chr_write_lock);
+
+        qemu_mutex_lock(&ob->lock);
+        if (res < 0 && errno == EAGAIN) {
+            if (ob->stop) {
+                break;
+            }
+            qemu_mutex_unlock(&ob->lock);
+            g_usleep(100);
+            qemu_mutex_lock(&ob->lock);
+            continue;
+        }
+        if (res <= 0) {
+            /* Lost, like any write to a broken backend */
+            res = chunk;
+        }
+        ob->head = (ob->head + res) % ob->size;
+        ob->len -= res;
+        qemu_cond_broadcast(&ob->space_cond);
+    }
+    qemu_mutex_unlock(&ob->lock);
+
+    return NULL;
+}
+
+static void qemu_chr_outbuf_init(Chardev *s, size_t size, bool drop)
+{
+    ChardevOutbuf *ob = g_new0(ChardevOutbuf, 1);
+
+    qemu_mutex_init(&ob->lock);
+    qemu_cond_init(&ob->data_cond);
+    qemu_cond_init(&ob->space_cond);
+    ob->buf = g_malloc(size);
+    ob->size = size;
+    ob->drop = drop;
+    s->outbuf = ob;
+
+    qemu_thread_create(&ob->thread, "chardev-out", qemu_chr_outbuf_thread,
+                       s, QEMU_THREAD_JOINABLE);
+}
+
+/*
+ * With @flush, writes out what is still buffered unless the backend cannot
+ * take it right now.  Without it, the buffered output is discarded.
+ */
+static void qemu_chr_outbuf_cleanup(Chardev *s, bool flush)
+{
+    ChardevOutbuf *ob = s->outbuf;
+
+    if (!ob) {
+        return;
+    }
+
+    qemu_mutex_lock(&ob->lock);
+    if (!flush) {
+        ob->len = 0;
+    }
+    ob->stop = true;
+    qemu_cond_signal(&ob->data_cond);
+    qemu_mutex_unlock(&ob->lock);
+    qemu_thread_join(&ob->thread);
+
+    s->outbuf = NULL;
+    qemu_cond_destroy(&ob->space_cond);
+    qemu_cond_destroy(&ob->data_cond);
+    qemu_mutex_destroy(&ob->lock);
+    g_free(ob->buf);
+    g_free(ob);
+}
+
+static int qemu_chr_outbuf_write(Chardev *s, const uint8_t *buf, int len,
+                                 int *offset, bool write_all)
+{
+    ChardevOutbuf *ob = s->outbuf;
+    size_t tail, n;
+
+    *offset = 0;
+    qemu_mutex_lock(&ob->lock);
+    while (*offset < len) {
+        if (ob->len == ob->size) {
+            if (ob->drop) {
+                /* Report it as written, the guest must not see a stall */
+                *offset = len;
+                break;
+            }
+            if (*offset && !write_all) {
+                break;
+            }
+            qemu_cond_wait(&ob->space_cond, &ob->lock);
+            continue;
+        }
+
+        /* Contiguous free space after the data */
+        tail = (ob->head + ob->len) % ob->size;
+        n = tail >= ob->head ? ob->size - tail : ob->head - tail;
+        n = MIN(n, len - *offset);
+        memcpy(ob->buf + tail, buf + *offset, n);
+        qemu_chr_write_log(s, buf + *offset, n);
+        ob->len += n;
+        *offset += n;
+        qemu_cond_signal(&ob->data_cond);
+    }
+    qemu_mutex_unlock(&ob->lock);
+
+    return *offset;
+}
+
 static int qemu_chr_write_buffer(Chardev *s,
                                  const uint8_t *buf, int len,
                                  int *offset, bool write_all)
@@ -108,6 +255,10 @@ static int qemu_chr_write_buffer(Chardev *s,
     int res = 0;
     *offset = 0;
 
+    if (s->outbuf) {
+        return qemu_chr_outbuf_write(s, buf, len, offset, write_all);
+    }
+
     qemu_mutex_lock(&s->chr_write_lock);
     while (*offset < len) {
     retry:
@@ -215,6 +366,7 @@ static void qemu_char_open(Chardev *chr, ChardevBackend *backend,
     ChardevClass *cc = CHARDEV_GET_CLASS(chr);
     /* Any ChardevCommon member would work */
     ChardevCommon *common = backend ? backend->u.null.data : NULL;
+    Error *local_err = NULL;
 
     if (common && common->has_logfile) {
         int flags = O_WRONLY | O_CREAT;
@@ -234,7 +386,16 @@ static void qemu_char_open(Chardev *chr, ChardevBackend *backend,
     }
 
     if (cc->open) {
-        cc->open(chr, backend, be_opened, errp);
+        cc->open(chr, backend, be_opened, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+
+    if (common && common->has_outbuf_size && common->outbuf_size) {
+        qemu_chr_outbuf_init(chr, common->outbuf_size,
+                             common->has_outbuf_drop && common->outbuf_drop);
     }
 }
 
@@ -264,14 +425,23 @@ static void char_class_init(ObjectClass *oc, void *data)
 {
     ChardevClass *cc = CHARDEV_CLASS(oc);
 
+    oc->unparent = char_unparent;
     cc->chr_write = null_chr_write;
     cc->chr_be_event = chr_be_event;
 }
 
+static void char_unparent(Object *obj)
+{
+    /* Flush before the backend is torn down by its finalizer */
+    qemu_chr_outbuf_cleanup(CHARDEV(obj), true);
+}
+
 static void char_finalize(Object *obj)
 {
     Chardev *chr = CHARDEV(obj);
 
+    /* Never parented: the backend is already gone, nothing can be flushed */
+    qemu_chr_outbuf_cleanup(chr, false);
     if (chr->be) {
         chr->be->chr = NULL;
     }
@@ -508,6 +678,11 @@ void qemu_chr_parse_common(QemuOpts *opts, ChardevCommon *backend)
 
     backend->has_logappend = true;
     backend->logappend = qemu_opt_get_bool(opts, "logappend", false);
+
+    backend->has_outbuf_size = true;
+    backend->outbuf_size = qemu_opt_get_size(opts, "outbuf-size", 0);
+    backend->has_outbuf_drop = true;
+    backend->outbuf_drop = qemu_opt_get_bool(opts, "outbuf-drop", false);
 }
 
 static const ChardevClass *char_get_class(const char *driver, Error **errp)
@@ -927,6 +1102,12 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "logappend",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "outbuf-size",
+            .type = QEMU_OPT_SIZE,
+        },{
+            .name = "outbuf-drop",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
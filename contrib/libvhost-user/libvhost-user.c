@@ -26,6 +26,7 @@
 #include <sys/socket.h>
 #include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <time.h>
 #include "qemu/compiler.h"
 
 #if defined(__linux__)
@@ -136,6 +137,9 @@ vu_request_to_string(unsigned int req)
         REQ(VHOST_USER_GET_INFLIGHT_FD),
         REQ(VHOST_USER_SET_INFLIGHT_FD),
         REQ(VHOST_USER_GPU_SET_SOCKET),
+        REQ(VHOST_USER_GET_MAX_MEM_SLOTS),
+        REQ(VHOST_USER_ADD_MEM_REG),
+        REQ(VHOST_USER_REM_MEM_REG),
         REQ(VHOST_USER_MAX),
     };
 #undef REQ
@@ -759,6 +763,115 @@ vu_set_mem_table_exec(VuDev *dev, VhostUserMsg *vmsg)
     return false;
 }
 
+static bool
+vu_get_max_mem_slots(VuDev *dev, VhostUserMsg *vmsg)
+{
+    vmsg_set_reply_u64(vmsg, VHOST_USER_MAX_RAM_SLOTS);
+    return true;
+}
+
+static bool
+vu_add_mem_reg(VuDev *dev, VhostUserMsg *vmsg)
+{
+    VhostUserMemoryRegion *msg_region = &vmsg->payload.mem_reg.region;
+    VuDevRegion *dev_region;
+    void *mmap_addr;
+
+    if (vmsg->fd_num != 1 ||
+        vmsg->size != sizeof(vmsg->payload.mem_reg)) {
+        vmsg_close_fds(vmsg);
+        vu_panic(dev, "Invalid add_mem_reg message");
+        return false;
+    }
+
+    if (dev->postcopy_listening) {
+        close(vmsg->fds[0]);
+        vu_panic(dev, "Adding memory regions during postcopy is not "
+                 "supported");
+        return false;
+    }
+
+    if (dev->nregions == VHOST_USER_MAX_RAM_SLOTS) {
+        close(vmsg->fds[0]);
+        vu_panic(dev, "No free memory slots");
+        return false;
+    }
+
+    DPRINT("Adding region %d\n", dev->nregions);
+    DPRINT("    guest_phys_addr: 0x%016"PRIx64"\n",
+           msg_region->guest_phys_addr);
+    DPRINT("    memory_size:     0x%016"PRIx64"\n",
+           msg_region->memory_size);
+    DPRINT("    userspace_addr   0x%016"PRIx64"\n",
+           msg_region->userspace_addr);
+    DPRINT("    mmap_offset      0x%016"PRIx64"\n",
+           msg_region->mmap_offset);
+
+    /* See vu_set_mem_table_exec() for why the offset is not used here */
+    mmap_addr = mmap(0, msg_region->memory_size + msg_region->mmap_offset,
+                     PROT_READ | PROT_WRITE, MAP_SHARED, vmsg->fds[0], 0);
+    close(vmsg->fds[0]);
+
+    if (mmap_addr == MAP_FAILED) {
+        vu_panic(dev, "region mmap error: %s", strerror(errno));
+        return false;
+    }
+
+    dev_region = &dev->regions[dev->nregions++];
+    dev_region->gpa = msg_region->guest_phys_addr;
+    dev_region->size = msg_region->memory_size;
+    dev_region->qva = msg_region->userspace_addr;
+    dev_region->mmap_offset = msg_region->mmap_offset;
+    dev_region->mmap_addr = (uint64_t)(uintptr_t)mmap_addr;
+    DPRINT("    mmap_addr:       0x%016"PRIx64"\n", dev_region->mmap_addr);
+
+    if (vmsg->flags & VHOST_USER_NEED_REPLY_MASK) {
+        vmsg_set_reply_u64(vmsg, 0);
+        return true;
+    }
+    return false;
+}
+
+static bool
+vu_rem_mem_reg(VuDev *dev, VhostUserMsg *vmsg)
+{
+    VhostUserMemoryRegion *msg_region = &vmsg->payload.mem_reg.region;
+    int i;
+
+    vmsg_close_fds(vmsg);
+    if (vmsg->size != sizeof(vmsg->payload.mem_reg)) {
+        vu_panic(dev, "Invalid rem_mem_reg message");
+        return false;
+    }
+
+    for (i = 0; i < dev->nregions; i++) {
+        VuDevRegion *r = &dev->regions[i];
+
+        if (r->gpa == msg_region->guest_phys_addr &&
+            r->size == msg_region->memory_size &&
+            r->qva == msg_region->userspace_addr) {
+            break;
+        }
+    }
+
+    if (i == dev->nregions) {
+        vu_panic(dev, "Removing unknown memory region 0x%016"PRIx64,
+                 msg_region->guest_phys_addr);
+        return false;
+    }
+
+    DPRINT("Removing region %d\n", i);
+    munmap((void *)(uintptr_t)dev->regions[i].mmap_addr,
+           dev->regions[i].size + dev->regions[i].mmap_offset);
+    dev->regions[i] = dev->regions[--dev->nregions];
+
+    if (vmsg->flags & VHOST_USER_NEED_REPLY_MASK) {
+        vmsg_set_reply_u64(vmsg, 0);
+        return true;
+    }
+    return false;
+}
+
 static bool
 vu_set_log_base_exec(VuDev *dev, VhostUserMsg *vmsg)
 {
@@ -1168,7 +1281,8 @@ vu_get_protocol_features_exec(VuDev *dev, VhostUserMsg *vmsg)
                         1ULL << VHOST_USER_PROTOCOL_F_LOG_SHMFD |
                         1ULL << VHOST_USER_PROTOCOL_F_SLAVE_REQ |
                         1ULL << VHOST_USER_PROTOCOL_F_HOST_NOTIFIER |
-                        1ULL << VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD;
+                        1ULL << VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD |
+                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
 
     if (have_userfault()) {
         features |= 1ULL << VHOST_USER_PROTOCOL_F_PAGEFAULT;
@@ -1537,6 +1651,12 @@ vu_process_message(VuDev *dev, VhostUserMsg *vmsg)
         return vu_get_inflight_fd(dev, vmsg);
     case VHOST_USER_SET_INFLIGHT_FD:
         return vu_set_inflight_fd(dev, vmsg);
+    case VHOST_USER_GET_MAX_MEM_SLOTS:
+        return vu_get_max_mem_slots(dev, vmsg);
+    case VHOST_USER_ADD_MEM_REG:
+        return vu_add_mem_reg(dev, vmsg);
+    case VHOST_USER_REM_MEM_REG:
+        return vu_rem_mem_reg(dev, vmsg);
     default:
         vmsg_close_fds(vmsg);
         vu_panic(dev, "Unhandled request: %d", vmsg->request);
@@ -1963,6 +2083,88 @@ vu_queue_empty(VuDev *dev, VuVirtq *vq)
     return vring_avail_idx(vq) == vq->last_avail_idx;
 }
 
+static uint64_t
+vu_get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+vu_queue_poll_init(VuQueuePoll *poll, uint64_t max_ns,
+                   uint64_t grow, uint64_t shrink)
+{
+    memset(poll, 0, sizeof(*poll));
+    poll->max_ns = max_ns;
+    poll->grow = grow;
+    poll->shrink = shrink;
+}
+
+/* Same policy as the AioContext polling in QEMU */
+static void
+vu_queue_poll_adjust(VuQueuePoll *poll, uint64_t block_ns)
+{
+    if (block_ns <= poll->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > poll->max_ns) {
+        /* We'd have to poll for too long, poll less */
+        if (poll->shrink) {
+            poll->poll_ns /= poll->shrink;
+        } else {
+            poll->poll_ns = 0;
+        }
+    } else if (poll->poll_ns < poll->max_ns) {
+        /* There is room to grow, poll longer */
+        uint64_t grow = poll->grow ? poll->grow : 2;
+
+        if (poll->poll_ns) {
+            poll->poll_ns *= grow;
+        } else {
+            poll->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+        if (poll->poll_ns > poll->max_ns) {
+            poll->poll_ns = poll->max_ns;
+        }
+    }
+}
+
+bool
+vu_queue_poll(VuDev *dev, VuVirtq *vq, VuQueuePoll *poll)
+{
+    uint64_t start = vu_get_time_ns();
+
+    if (poll->blocked) {
+        poll->blocked = false;
+        vu_queue_poll_adjust(poll, start - poll->block_start);
+    }
+
+    if (poll->max_ns && poll->poll_ns) {
+        uint64_t now = start;
+
+        vu_queue_set_notification(dev, vq, 0);
+        do {
+            if (!vu_queue_empty(dev, vq)) {
+                return true;
+            }
+            now = vu_get_time_ns();
+        } while (now - start < poll->poll_ns);
+    }
+
+    /* Fall back to the kick eventfd, but do not miss a late request */
+    vu_queue_set_notification(dev, vq, 1);
+    if (!vu_queue_empty(dev, vq)) {
+        return true;
+    }
+
+    if (poll->max_ns) {
+        poll->blocked = true;
+        poll->block_start = start;
+    }
+    return false;
+}
+
 static bool
 vring_notify(VuDev *dev, VuVirtq *vq)
 {
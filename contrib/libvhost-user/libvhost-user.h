@@ -28,6 +28,8 @@
 #define VIRTQUEUE_MAX_SIZE 1024
 
 #define VHOST_MEMORY_MAX_NREGIONS 8
+/* Regions accepted one at a time with VHOST_USER_ADD_MEM_REG */
+#define VHOST_USER_MAX_RAM_SLOTS 32
 
 typedef enum VhostSetConfigType {
     VHOST_SET_CONFIG_TYPE_MASTER = 0,
@@ -53,6 +55,7 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD = 10,
     VHOST_USER_PROTOCOL_F_HOST_NOTIFIER = 11,
     VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
+    VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 13,
 
     VHOST_USER_PROTOCOL_F_MAX
 };
@@ -94,6 +97,9 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_INFLIGHT_FD = 31,
     VHOST_USER_SET_INFLIGHT_FD = 32,
     VHOST_USER_GPU_SET_SOCKET = 33,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 34,
+    VHOST_USER_ADD_MEM_REG = 35,
+    VHOST_USER_REM_MEM_REG = 36,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -118,6 +124,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
@@ -170,6 +181,7 @@ typedef struct VhostUserMsg {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
         VhostUserConfig config;
         VhostUserVringArea area;
@@ -351,7 +363,7 @@ typedef struct VuDevInflightInfo {
 struct VuDev {
     int sock;
     uint32_t nregions;
-    VuDevRegion regions[VHOST_MEMORY_MAX_NREGIONS];
+    VuDevRegion regions[VHOST_USER_MAX_RAM_SLOTS];
     VuVirtq *vq;
     VuDevInflightInfo inflight_info;
     int log_call_fd;
@@ -380,6 +392,26 @@ struct VuDev {
     bool postcopy_listening;
 };
 
+/*
+ * Adaptive busy polling of a virtqueue, see vu_queue_poll().  The polling
+ * time grows while requests arrive shortly after the backend went idle,
+ * and shrinks when it would have to spin for longer than @max_ns.
+ */
+typedef struct VuQueuePoll {
+    /* maximum time to spin in nanoseconds, 0 disables polling */
+    uint64_t max_ns;
+    /* factor to grow the polling time by, 0 means 2 */
+    uint64_t grow;
+    /* divisor to shrink the polling time by, 0 stops polling at once */
+    uint64_t shrink;
+
+    /* current polling time */
+    uint64_t poll_ns;
+    /* the caller went to sleep on the kick eventfd at block_start */
+    bool blocked;
+    uint64_t block_start;
+} VuQueuePoll;
+
 typedef struct VuVirtqElement {
     unsigned int index;
     unsigned int out_num;
@@ -513,6 +545,35 @@ bool vu_queue_started(const VuDev *dev, const VuVirtq *vq);
  */
 bool vu_queue_empty(VuDev *dev, VuVirtq *vq);
 
+/**
+ * vu_queue_poll_init:
+ * @poll: a VuQueuePoll
+ * @max_ns: maximum polling time in nanoseconds, 0 to disable polling
+ * @grow: polling time growth factor, 0 for the default
+ * @shrink: polling time shrink divisor, 0 for the default
+ *
+ * Initialize @poll with the given parameters.
+ */
+void vu_queue_poll_init(VuQueuePoll *poll, uint64_t max_ns,
+                        uint64_t grow, uint64_t shrink);
+
+/**
+ * vu_queue_poll:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @poll: the polling state of @vq
+ *
+ * Call when the queue ran out of requests, before waiting for a kick.
+ * Spins on the avail index for up to the current polling time with guest
+ * notifications suppressed.
+ *
+ * Returns: true if requests became available, in which case notifications
+ * may stay suppressed and vu_queue_poll() must be called again before the
+ * caller sleeps.  false if the queue is still empty; notifications are
+ * then enabled again and the caller must wait for the kick eventfd.
+ */
+bool vu_queue_poll(VuDev *dev, VuVirtq *vq, VuQueuePoll *poll);
+
 /**
  * vu_queue_notify:
  * @dev: a VuDev context
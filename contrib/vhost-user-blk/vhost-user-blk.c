@@ -16,32 +16,79 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
 #include "standard-headers/linux/virtio_blk.h"
 #include "contrib/libvhost-user/libvhost-user-glib.h"
 #include "contrib/libvhost-user/libvhost-user.h"
 
+#include <poll.h>
+#include <sys/eventfd.h>
+
 #if defined(__linux__)
 #include <linux/fs.h>
 #include <sys/ioctl.h>
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
+
 enum {
     VHOST_USER_BLK_MAX_QUEUES = 8,
 };
 
+/* Requests in flight per queue when using io_uring */
+#define VUB_RING_SIZE 128
+
+/* user_data of the poll requests, requests use their address */
+#define VUB_TAG_KICK 1
+#define VUB_TAG_STOP 2
+
 struct virtio_blk_inhdr {
     unsigned char status;
 };
 
+typedef struct VubDev VubDev;
+
+/*
+ * Each started virtqueue is served by its own thread, which waits for
+ * kicks and submits the requests to io_uring if available, or runs them
+ * synchronously otherwise.  libvhost-user allows different queues to be
+ * processed from different threads; everything else runs in the main
+ * loop, which stops the threads while the guest memory or the backing
+ * file change.
+ */
+typedef struct VubQueue {
+    VubDev *vdev_blk;
+    int idx;
+    /* Started by the master; the thread may be paused nevertheless */
+    bool started;
+    GThread *thread;
+    int stop_fd;
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_ring;
+    struct io_uring ring;
+#endif
+    bool stopping;
+    /* Only accessed by the queue thread */
+    unsigned int inflight;
+    bool need_notify;
+    VuQueuePoll poll;
+} VubQueue;
+
 /* vhost user block device */
-typedef struct VubDev {
+struct VubDev {
     VugDev parent;
     int blk_fd;
     struct virtio_blk_config blkcfg;
     bool enable_ro;
     char *blk_name;
     GMainLoop *loop;
-} VubDev;
+    uint16_t num_queues;
+    uint64_t poll_max_ns;
+    VubQueue queues[VHOST_USER_BLK_MAX_QUEUES];
+    guint resume_id;
+};
 
 typedef struct VubReq {
     VuVirtqElement *elem;
@@ -50,6 +97,7 @@ typedef struct VubReq {
     struct virtio_blk_inhdr *in;
     struct virtio_blk_outhdr *out;
     VubDev *vdev_blk;
+    VubQueue *q;
     struct VuVirtq *vq;
 } VubReq;
 
@@ -97,6 +145,7 @@ static void vub_panic_cb(VuDev *vu_dev, const char *buf)
     g_main_loop_quit(vdev_blk->loop);
 }
 
+/* The guest is notified once per batch, see vub_queue_notify() */
 static void vub_req_complete(VubReq *req)
 {
     VugDev *gdev = &req->vdev_blk->parent;
@@ -105,7 +154,7 @@ static void vub_req_complete(VubReq *req)
     /* IO size with 1 extra status byte */
     vu_queue_push(vu_dev, req->vq, req->elem,
                   req->size + 1);
-    vu_queue_notify(vu_dev, req->vq);
+    req->q->need_notify = true;
 
     if (req->elem) {
         free(req->elem);
@@ -133,50 +182,83 @@ static int vub_open(const char *file_name, bool wce)
     return fd;
 }
 
-static ssize_t
-vub_readv(VubReq *req, struct iovec *iov, uint32_t iovcnt)
+static void vub_queue_notify(VubQueue *q)
 {
-    VubDev *vdev_blk = req->vdev_blk;
-    ssize_t rc;
+    VuDev *vu_dev = &q->vdev_blk->parent.parent;
 
-    if (!iovcnt) {
-        fprintf(stderr, "Invalid Read IOV count\n");
-        return -1;
+    if (q->need_notify) {
+        q->need_notify = false;
+        vu_queue_notify(vu_dev, vu_get_queue(vu_dev, q->idx));
     }
+}
 
-    req->size = vub_iov_size(iov, iovcnt);
-    rc = preadv(vdev_blk->blk_fd, iov, iovcnt, req->sector_num * 512);
+static void vub_rw_complete(VubReq *req, ssize_t rc)
+{
     if (rc < 0) {
         fprintf(stderr, "%s, Sector %"PRIu64", Size %lu failed with %s\n",
-                vdev_blk->blk_name, req->sector_num, req->size,
-                strerror(errno));
-        return -1;
+                req->vdev_blk->blk_name, req->sector_num, req->size,
+                strerror(-rc));
+        req->in->status = VIRTIO_BLK_S_IOERR;
+    } else {
+        req->in->status = VIRTIO_BLK_S_OK;
     }
+    vub_req_complete(req);
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static struct io_uring_sqe *vub_get_sqe(VubQueue *q)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&q->ring);
 
-    return rc;
+    if (!sqe) {
+        /* Make room, the ring is larger than the requests in flight */
+        io_uring_submit(&q->ring);
+        sqe = io_uring_get_sqe(&q->ring);
+        assert(sqe);
+    }
+    return sqe;
 }
+#endif
 
-static ssize_t
-vub_writev(VubReq *req, struct iovec *iov, uint32_t iovcnt)
+/* Completes the request, either now or from vub_queue_thread() */
+static void
+vub_rw(VubReq *req, struct iovec *iov, uint32_t iovcnt, bool is_write)
 {
     VubDev *vdev_blk = req->vdev_blk;
     ssize_t rc;
 
     if (!iovcnt) {
-        fprintf(stderr, "Invalid Write IOV count\n");
-        return -1;
+        fprintf(stderr, "Invalid %s IOV count\n", is_write ? "Write" : "Read");
+        req->in->status = VIRTIO_BLK_S_IOERR;
+        vub_req_complete(req);
+        return;
     }
 
     req->size = vub_iov_size(iov, iovcnt);
-    rc = pwritev(vdev_blk->blk_fd, iov, iovcnt, req->sector_num * 512);
-    if (rc < 0) {
-        fprintf(stderr, "%s, Sector %"PRIu64", Size %lu failed with %s\n",
-                vdev_blk->blk_name, req->sector_num, req->size,
-                strerror(errno));
-        return -1;
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (req->q->use_ring) {
+        struct io_uring_sqe *sqe = vub_get_sqe(req->q);
+
+        if (is_write) {
+            io_uring_prep_writev(sqe, vdev_blk->blk_fd, iov, iovcnt,
+                                 req->sector_num * 512);
+        } else {
+            io_uring_prep_readv(sqe, vdev_blk->blk_fd, iov, iovcnt,
+                                req->sector_num * 512);
+        }
+        io_uring_sqe_set_data(sqe, req);
+        req->q->inflight++;
+        return;
     }
+#endif
 
-    return rc;
+    if (is_write) {
+        rc = pwritev(vdev_blk->blk_fd, iov, iovcnt, req->sector_num * 512);
+    } else {
+        rc = preadv(vdev_blk->blk_fd, iov, iovcnt, req->sector_num * 512);
+    }
+    vub_rw_complete(req, rc < 0 ? -errno : rc);
 }
 
 static int
@@ -222,11 +304,24 @@ vub_flush(VubReq *req)
 {
     VubDev *vdev_blk = req->vdev_blk;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (req->q->use_ring) {
+        struct io_uring_sqe *sqe = vub_get_sqe(req->q);
+
+        io_uring_prep_fsync(sqe, vdev_blk->blk_fd, IORING_FSYNC_DATASYNC);
+        io_uring_sqe_set_data(sqe, req);
+        req->q->inflight++;
+        return;
+    }
+#endif
+
     fdatasync(vdev_blk->blk_fd);
+    req->in->status = VIRTIO_BLK_S_OK;
+    vub_req_complete(req);
 }
 
-static int vub_virtio_process_req(VubDev *vdev_blk,
-                                     VuVirtq *vq)
+static int vub_virtio_process_req(VubDev *vdev_blk, VubQueue *q,
+                                  VuVirtq *vq)
 {
     VugDev *gdev = &vdev_blk->parent;
     VuDev *vu_dev = &gdev->parent;
@@ -250,6 +345,7 @@ static int vub_virtio_process_req(VubDev *vdev_blk,
 
     req = g_new0(VubReq, 1);
     req->vdev_blk = vdev_blk;
+    req->q = q;
     req->vq = vq;
     req->elem = elem;
 
@@ -275,26 +371,17 @@ static int vub_virtio_process_req(VubDev *vdev_blk,
     switch (type & ~VIRTIO_BLK_T_BARRIER) {
     case VIRTIO_BLK_T_IN:
     case VIRTIO_BLK_T_OUT: {
-        ssize_t ret = 0;
         bool is_write = type & VIRTIO_BLK_T_OUT;
         req->sector_num = le64toh(req->out->sector);
         if (is_write) {
-            ret  = vub_writev(req, &elem->out_sg[1], out_num);
-        } else {
-            ret = vub_readv(req, &elem->in_sg[0], in_num);
-        }
-        if (ret >= 0) {
-            req->in->status = VIRTIO_BLK_S_OK;
+            vub_rw(req, &elem->out_sg[1], out_num, true);
         } else {
-            req->in->status = VIRTIO_BLK_S_IOERR;
+            vub_rw(req, &elem->in_sg[0], in_num, false);
         }
-        vub_req_complete(req);
         break;
     }
     case VIRTIO_BLK_T_FLUSH:
         vub_flush(req);
-        req->in->status = VIRTIO_BLK_S_OK;
-        vub_req_complete(req);
         break;
     case VIRTIO_BLK_T_GET_ID: {
         size_t size = MIN(vub_iov_size(&elem->in_sg[0], in_num),
@@ -331,36 +418,268 @@ err:
     return -1;
 }
 
-static void vub_process_vq(VuDev *vu_dev, int idx)
+static void vub_process_queue(VubQueue *q)
 {
-    VugDev *gdev;
-    VubDev *vdev_blk;
-    VuVirtq *vq;
-    int ret;
+    VubDev *vdev_blk = q->vdev_blk;
+    VuDev *vu_dev = &vdev_blk->parent.parent;
+    VuVirtq *vq = vu_get_queue(vu_dev, q->idx);
+
+    for (;;) {
+#ifdef CONFIG_LINUX_IO_URING
+        /* Leave the rest for when requests complete */
+        if (q->use_ring && q->inflight >= VUB_RING_SIZE) {
+            break;
+        }
+#endif
+        if (vub_virtio_process_req(vdev_blk, q, vq)) {
+            break;
+        }
+    }
+}
 
-    gdev = container_of(vu_dev, VugDev, parent);
-    vdev_blk = container_of(gdev, VubDev, parent);
-    assert(vdev_blk);
+#ifdef CONFIG_LINUX_IO_URING
+static void vub_ring_poll(VubQueue *q, int fd, uintptr_t tag)
+{
+    struct io_uring_sqe *sqe = vub_get_sqe(q);
+
+    io_uring_prep_poll_add(sqe, fd, POLLIN);
+    io_uring_sqe_set_data(sqe, (void *)tag);
+}
+
+static void vub_ring_loop(VubQueue *q, int kick_fd)
+{
+    VuDev *vu_dev = &q->vdev_blk->parent.parent;
+    VuVirtq *vq = vu_get_queue(vu_dev, q->idx);
+    bool stopping = false;
+
+    vub_ring_poll(q, kick_fd, VUB_TAG_KICK);
+    vub_ring_poll(q, q->stop_fd, VUB_TAG_STOP);
+
+    /* Drain requests in flight before leaving */
+    while (!stopping || q->inflight) {
+        struct io_uring_cqe *cqe;
+        unsigned int head, n = 0;
+        bool kicked = false;
+
+        /*
+         * Only poll when idle, completions would wait for the spinning.
+         * Notifications may be left off while requests are in flight,
+         * the next completion picks up new requests.
+         */
+        if (!stopping && !q->inflight && !atomic_read(&q->stopping) &&
+            vu_queue_poll(vu_dev, vq, &q->poll)) {
+            vub_process_queue(q);
+            vub_queue_notify(q);
+            if (!q->inflight) {
+                continue;
+            }
+        }
+
+        io_uring_submit_and_wait(&q->ring, 1);
+
+        io_uring_for_each_cqe(&q->ring, head, cqe) {
+            uintptr_t tag = (uintptr_t)io_uring_cqe_get_data(cqe);
+
+            n++;
+            if (tag == VUB_TAG_KICK) {
+                kicked = true;
+            } else if (tag == VUB_TAG_STOP) {
+                stopping = true;
+            } else {
+                VubReq *req = (VubReq *)tag;
+
+                q->inflight--;
+                vub_rw_complete(req, cqe->res);
+            }
+        }
+        io_uring_cq_advance(&q->ring, n);
+
+        if (kicked) {
+            eventfd_t val;
+
+            eventfd_read(kick_fd, &val);
+            if (!stopping) {
+                vub_ring_poll(q, kick_fd, VUB_TAG_KICK);
+            }
+        }
+        if (!stopping) {
+            vub_process_queue(q);
+        }
+        vub_queue_notify(q);
+    }
+}
+#endif
+
+static gpointer vub_queue_thread(gpointer opaque)
+{
+    VubQueue *q = opaque;
+    VuDev *vu_dev = &q->vdev_blk->parent.parent;
+    int kick_fd = vu_get_queue(vu_dev, q->idx)->kick_fd;
+    struct pollfd fds[2] = {
+        { .fd = kick_fd, .events = POLLIN },
+        { .fd = q->stop_fd, .events = POLLIN },
+    };
+
+    /* Requests left from before a pause did not kick again */
+    vub_process_queue(q);
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (q->use_ring) {
+        vub_ring_loop(q, kick_fd);
+        return NULL;
+    }
+#endif
 
-    vq = vu_get_queue(vu_dev, idx);
-    assert(vq);
+    vub_queue_notify(q);
 
-    while (1) {
-        ret = vub_virtio_process_req(vdev_blk, vq);
-        if (ret) {
+    while (!(fds[1].revents & POLLIN)) {
+        if (vu_queue_poll(vu_dev, vu_get_queue(vu_dev, q->idx), &q->poll)) {
+            if (atomic_read(&q->stopping)) {
+                break;
+            }
+            vub_process_queue(q);
+            vub_queue_notify(q);
+            continue;
+        }
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             break;
         }
+        if (fds[0].revents & POLLIN) {
+            eventfd_t val;
+
+            eventfd_read(kick_fd, &val);
+            vub_process_queue(q);
+            vub_queue_notify(q);
+        }
+    }
+
+    return NULL;
+}
+
+static void vub_queue_start(VubQueue *q)
+{
+    char *name;
+
+    if (q->thread) {
+        return;
+    }
+
+    q->stop_fd = eventfd(0, EFD_CLOEXEC);
+    assert(q->stop_fd >= 0);
+    q->stopping = false;
+    q->inflight = 0;
+    vu_queue_poll_init(&q->poll, q->vdev_blk->poll_max_ns, 0, 0);
+
+#ifdef CONFIG_LINUX_IO_URING
+    /* Room for the two polls on top of the requests */
+    q->use_ring = io_uring_queue_init(VUB_RING_SIZE + 2, &q->ring, 0) == 0;
+    if (!q->use_ring) {
+        fprintf(stderr, "io_uring unavailable, queue %d uses blocking I/O\n",
+                q->idx);
+    }
+#endif
+
+    name = g_strdup_printf("vub-queue-%d", q->idx);
+    q->thread = g_thread_new(name, vub_queue_thread, q);
+    g_free(name);
+}
+
+/* Returns once the requests in flight have completed */
+static void vub_queue_stop(VubQueue *q)
+{
+    if (!q->thread) {
+        return;
+    }
+
+    atomic_set(&q->stopping, true);
+    eventfd_write(q->stop_fd, 1);
+    g_thread_join(q->thread);
+    q->thread = NULL;
+    close(q->stop_fd);
+    q->stop_fd = -1;
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (q->use_ring) {
+        io_uring_queue_exit(&q->ring);
+        q->use_ring = false;
+    }
+#endif
+}
+
+static void vub_pause_queues(VubDev *vdev_blk)
+{
+    int i;
+
+    for (i = 0; i < vdev_blk->num_queues; i++) {
+        vub_queue_stop(&vdev_blk->queues[i]);
     }
 }
 
+static void vub_resume_queues(VubDev *vdev_blk)
+{
+    int i;
+
+    for (i = 0; i < vdev_blk->num_queues; i++) {
+        if (vdev_blk->queues[i].started) {
+            vub_queue_start(&vdev_blk->queues[i]);
+        }
+    }
+}
+
+static gboolean vub_resume_queues_cb(gpointer opaque)
+{
+    VubDev *vdev_blk = opaque;
+
+    vdev_blk->resume_id = 0;
+    vub_resume_queues(vdev_blk);
+
+    return G_SOURCE_REMOVE;
+}
+
 static void vub_queue_set_started(VuDev *vu_dev, int idx, bool started)
 {
-    VuVirtq *vq;
+    VugDev *gdev = container_of(vu_dev, VugDev, parent);
+    VubDev *vdev_blk = container_of(gdev, VubDev, parent);
+    VubQueue *q;
 
-    assert(vu_dev);
+    if (idx >= vdev_blk->num_queues) {
+        vu_panic(vu_dev, "Invalid queue index %d", idx);
+        return;
+    }
+
+    q = &vdev_blk->queues[idx];
+    q->started = started;
+    if (started) {
+        vub_queue_start(q);
+    } else {
+        vub_queue_stop(q);
+    }
+}
 
-    vq = vu_get_queue(vu_dev, idx);
-    vu_set_queue_handler(vu_dev, vq, started ? vub_process_vq : NULL);
+static int vub_process_msg(VuDev *vu_dev, VhostUserMsg *vmsg, int *do_reply)
+{
+    VugDev *gdev = container_of(vu_dev, VugDev, parent);
+    VubDev *vdev_blk = container_of(gdev, VubDev, parent);
+
+    /*
+     * The queue threads must not touch guest memory while it is remapped.
+     * Stop them now and restart them once libvhost-user is done with the
+     * message; the high priority makes this happen before the next one.
+     */
+    if (vmsg->request == VHOST_USER_SET_MEM_TABLE) {
+        vub_pause_queues(vdev_blk);
+        if (!vdev_blk->resume_id) {
+            vdev_blk->resume_id = g_idle_add_full(G_PRIORITY_HIGH,
+                                                  vub_resume_queues_cb,
+                                                  vdev_blk, NULL);
+        }
+    }
+
+    return 0;
 }
 
 static uint64_t
@@ -383,6 +702,7 @@ vub_get_features(VuDev *dev)
                1ull << VIRTIO_BLK_F_WRITE_ZEROES |
                #endif
                1ull << VIRTIO_BLK_F_CONFIG_WCE |
+               1ull << VIRTIO_BLK_F_MQ |
                1ull << VIRTIO_F_VERSION_1 |
                1ull << VHOST_USER_F_PROTOCOL_FEATURES;
 
@@ -443,6 +763,9 @@ vub_set_config(VuDev *vu_dev, const uint8_t *data,
 
     vdev_blk->blkcfg.wce = wce;
     fprintf(stdout, "Write Cache Policy Changed\n");
+
+    /* Let requests in flight complete on the old file descriptor */
+    vub_pause_queues(vdev_blk);
     if (vdev_blk->blk_fd >= 0) {
         close(vdev_blk->blk_fd);
         vdev_blk->blk_fd = -1;
@@ -455,12 +778,14 @@ vub_set_config(VuDev *vu_dev, const uint8_t *data,
         return -1;
     }
     vdev_blk->blk_fd = fd;
+    vub_resume_queues(vdev_blk);
 
     return 0;
 }
 
 static const VuDevIface vub_iface = {
     .get_features = vub_get_features,
+    .process_msg = vub_process_msg,
     .queue_set_started = vub_queue_set_started,
     .get_protocol_features = vub_get_protocol_features,
     .get_config = vub_get_config,
@@ -532,7 +857,8 @@ vub_get_blocksize(int fd)
 }
 
 static void
-vub_initialize_config(int fd, struct virtio_blk_config *config)
+vub_initialize_config(int fd, struct virtio_blk_config *config,
+                      uint16_t num_queues)
 {
     off64_t capacity;
 
@@ -543,7 +869,7 @@ vub_initialize_config(int fd, struct virtio_blk_config *config)
     config->seg_max = 128 - 2;
     config->min_io_size = 1;
     config->opt_io_size = 1;
-    config->num_queues = 1;
+    config->num_queues = num_queues;
     #if defined(__linux__) && defined(BLKDISCARD) && defined(BLKZEROOUT)
     config->max_discard_sectors = 32768;
     config->max_discard_seg = 1;
@@ -554,9 +880,10 @@ vub_initialize_config(int fd, struct virtio_blk_config *config)
 }
 
 static VubDev *
-vub_new(char *blk_file)
+vub_new(char *blk_file, uint16_t num_queues)
 {
     VubDev *vdev_blk;
+    int i;
 
     vdev_blk = g_new0(VubDev, 1);
     vdev_blk->loop = g_main_loop_new(NULL, FALSE);
@@ -569,23 +896,38 @@ vub_new(char *blk_file)
     vdev_blk->enable_ro = false;
     vdev_blk->blkcfg.wce = 0;
     vdev_blk->blk_name = blk_file;
+    vdev_blk->num_queues = num_queues;
+    for (i = 0; i < num_queues; i++) {
+        vdev_blk->queues[i].vdev_blk = vdev_blk;
+        vdev_blk->queues[i].idx = i;
+        vdev_blk->queues[i].stop_fd = -1;
+    }
 
     /* fill virtio_blk_config with block parameters */
-    vub_initialize_config(vdev_blk->blk_fd, &vdev_blk->blkcfg);
+    vub_initialize_config(vdev_blk->blk_fd, &vdev_blk->blkcfg, num_queues);
 
     return vdev_blk;
 }
 
+static void vub_usage(const char *prog)
+{
+    printf("Usage: %s [ -b block device or file, -s UNIX domain socket"
+           " | -r Enable read-only | -n number of queues"
+           " | -p maximum polling time in ns ] | [ -h ]\n", prog);
+}
+
 int main(int argc, char **argv)
 {
     int opt;
     char *unix_socket = NULL;
     char *blk_file = NULL;
     bool enable_ro = false;
+    int num_queues = 1;
+    uint64_t poll_max_ns = 0;
     int lsock = -1, csock = -1;
     VubDev *vdev_blk = NULL;
 
-    while ((opt = getopt(argc, argv, "b:rs:h")) != -1) {
+    while ((opt = getopt(argc, argv, "b:rs:n:p:h")) != -1) {
         switch (opt) {
         case 'b':
             blk_file = g_strdup(optarg);
@@ -596,17 +938,26 @@ int main(int argc, char **argv)
         case 'r':
             enable_ro = true;
             break;
+        case 'n':
+            num_queues = atoi(optarg);
+            if (num_queues < 1 || num_queues > VHOST_USER_BLK_MAX_QUEUES) {
+                fprintf(stderr, "Number of queues must be between 1 and %d\n",
+                        VHOST_USER_BLK_MAX_QUEUES);
+                return -1;
+            }
+            break;
+        case 'p':
+            poll_max_ns = strtoull(optarg, NULL, 10);
+            break;
         case 'h':
         default:
-            printf("Usage: %s [ -b block device or file, -s UNIX domain socket"
-                   " | -r Enable read-only ] | [ -h ]\n", argv[0]);
+            vub_usage(argv[0]);
             return 0;
         }
     }
 
     if (!unix_socket || !blk_file) {
-        printf("Usage: %s [ -b block device or file, -s UNIX domain socket"
-               " | -r Enable read-only ] | [ -h ]\n", argv[0]);
+        vub_usage(argv[0]);
         return -1;
     }
 
@@ -615,29 +966,51 @@ int main(int argc, char **argv)
         goto err;
     }
 
-    csock = accept(lsock, (void *)0, (void *)0);
-    if (csock < 0) {
-        fprintf(stderr, "Accept error %s\n", strerror(errno));
-        goto err;
-    }
-
-    vdev_blk = vub_new(blk_file);
+    vdev_blk = vub_new(blk_file, num_queues);
     if (!vdev_blk) {
         goto err;
     }
     if (enable_ro) {
         vdev_blk->enable_ro = true;
     }
+    vdev_blk->poll_max_ns = poll_max_ns;
+
+    /*
+     * Serve one master at a time and wait for it to reconnect when it goes
+     * away.  Requests that were in flight are resubmitted by libvhost-user
+     * from the inflight area the master hands over again.
+     */
+    for (;;) {
+        int i;
+
+        csock = accept(lsock, (void *)0, (void *)0);
+        if (csock < 0) {
+            fprintf(stderr, "Accept error %s\n", strerror(errno));
+            goto err;
+        }
 
-    if (!vug_init(&vdev_blk->parent, VHOST_USER_BLK_MAX_QUEUES, csock,
-                  vub_panic_cb, &vub_iface)) {
-        fprintf(stderr, "Failed to initialized libvhost-user-glib\n");
-        goto err;
-    }
+        if (!vug_init(&vdev_blk->parent, num_queues, csock,
+                      vub_panic_cb, &vub_iface)) {
+            fprintf(stderr, "Failed to initialized libvhost-user-glib\n");
+            goto err;
+        }
 
-    g_main_loop_run(vdev_blk->loop);
+        g_main_loop_run(vdev_blk->loop);
 
-    vug_deinit(&vdev_blk->parent);
+        if (vdev_blk->resume_id) {
+            g_source_remove(vdev_blk->resume_id);
+            vdev_blk->resume_id = 0;
+        }
+        for (i = 0; i < num_queues; i++) {
+            vdev_blk->queues[i].started = false;
+            vub_queue_stop(&vdev_blk->queues[i]);
+        }
+        vug_deinit(&vdev_blk->parent);
+
+        close(csock);
+        csock = -1;
+        fprintf(stdout, "Disconnected, waiting for reconnection\n");
+    }
 
 err:
     vub_free(vdev_blk);
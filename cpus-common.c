@@ -71,6 +71,10 @@ static int cpu_get_free_index(void)
 
 void cpu_list_add(CPUState *cpu)
 {
+    if (!cpu->qom_path) {
+        cpu->qom_path = object_get_canonical_path(OBJECT(cpu));
+    }
+
     qemu_mutex_lock(&qemu_cpu_list_lock);
     if (cpu->cpu_index == UNASSIGNED_CPU_INDEX) {
         cpu->cpu_index = cpu_get_free_index();
@@ -103,6 +103,9 @@ static bool cpu_thread_is_idle(CPUState *cpu)
     if (cpu_is_stopped(cpu)) {
         return true;
     }
+    if (atomic_read(&cpu->tlb_sync_pending)) {
+        return true;
+    }
     if (!cpu->halted || cpu_has_work(cpu) ||
         kvm_halt_in_kernel()) {
         return false;
@@ -1119,6 +1122,9 @@ static bool cpu_can_run(CPUState *cpu)
     if (cpu_is_stopped(cpu)) {
         return false;
     }
+    if (atomic_read(&cpu->tlb_sync_pending)) {
+        return false;
+    }
     return true;
 }
 
@@ -1275,12 +1281,19 @@ static void *qemu_kvm_cpu_thread_fn(void *arg)
 
     rcu_register_thread();
 
-    qemu_mutex_lock_iothread();
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
     cpu->can_do_io = 1;
     current_cpu = cpu;
 
+    /* Outside the BQL, so that the vCPUs can be created in parallel */
+    r = kvm_create_vcpu(cpu);
+    if (r < 0) {
+        error_report("kvm_create_vcpu failed: %s", strerror(-r));
+        exit(1);
+    }
+
+    qemu_mutex_lock_iothread();
     r = kvm_init_vcpu(cpu);
     if (r < 0) {
         error_report("kvm_init_vcpu failed: %s", strerror(-r));
@@ -2124,11 +2137,35 @@ void qemu_init_vcpu(CPUState *cpu)
         qemu_dummy_start_vcpu(cpu);
     }
 
+    /*
+     * With kvm-parallel-vcpu-init, the vCPUs of the initial machine set
+     * themselves up concurrently and are waited for in
+     * qemu_wait_all_vcpus_created().
+     */
+    if (kvm_enabled() && machine_kvm_parallel_vcpu_init(ms) &&
+        !qdev_hotplug) {
+        return;
+    }
+
+    qemu_wait_vcpu_created(cpu);
+}
+
+void qemu_wait_vcpu_created(CPUState *cpu)
+{
     while (!cpu->created) {
         qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
     }
 }
 
+void qemu_wait_all_vcpus_created(void)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        qemu_wait_vcpu_created(cpu);
+    }
+}
+
 void cpu_stop_current(void)
 {
     if (current_cpu) {
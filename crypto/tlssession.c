@@ -548,6 +548,144 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#ifdef CONFIG_KTLS
+
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/*
+ * TLS 1.2 only derives a 4 byte salt, the explicit part of the nonce
+ * is the record sequence number; TLS 1.3 derives the whole 12 bytes.
+ */
+#define QCRYPTO_TLS_KTLS_FILL(ci, tls12, iv, key, seq)                      \
+    do {                                                                    \
+        memcpy((ci).salt, (iv)->data, sizeof((ci).salt));                   \
+        if (tls12) {                                                        \
+            memcpy((ci).iv, (seq), sizeof((ci).iv));                        \
+        } else {                                                            \
+            memcpy((ci).iv, (iv)->data + sizeof((ci).salt),                 \
+                   sizeof((ci).iv));                                        \
+        }                                                                   \
+        memcpy((ci).key, (key)->data, sizeof((ci).key));                    \
+        memcpy((ci).rec_seq, (seq), sizeof((ci).rec_seq));                  \
+    } while (0)
+
+int
+qcrypto_tls_session_offload_send(QCryptoTLSSession *session,
+                                 int fd,
+                                 Error **errp)
+{
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes128;
+#ifdef TLS_CIPHER_AES_GCM_256
+        struct tls12_crypto_info_aes_gcm_256 aes256;
+#endif
+    } ci;
+    socklen_t ci_len;
+    gnutls_protocol_t version;
+    gnutls_cipher_algorithm_t cipher;
+    gnutls_datum_t iv, key;
+    unsigned char seq[8];
+    bool tls12;
+    int ret = -1;
+
+    if (!session->handshakeComplete) {
+        error_setg(errp, "TLS handshake is not complete");
+        return -1;
+    }
+
+    memset(&ci, 0, sizeof(ci));
+    version = gnutls_protocol_get_version(session->handle);
+    switch (version) {
+    case GNUTLS_TLS1_2:
+        ci.info.version = TLS_1_2_VERSION;
+        break;
+#if defined(TLS_1_3_VERSION) && GNUTLS_VERSION_NUMBER >= 0x030603
+    case GNUTLS_TLS1_3:
+        ci.info.version = TLS_1_3_VERSION;
+        break;
+#endif
+    default:
+        error_setg(errp, "Kernel TLS does not support %s",
+                   gnutls_protocol_get_name(version));
+        return -1;
+    }
+    tls12 = version == GNUTLS_TLS1_2;
+
+    if (gnutls_record_get_state(session->handle, 0, NULL,
+                                &iv, &key, seq) < 0 ||
+        iv.size < (tls12 ? 4 : 12)) {
+        error_setg(errp, "Cannot get TLS session keys");
+        return -1;
+    }
+
+    cipher = gnutls_cipher_get(session->handle);
+    switch (cipher) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        if (key.size != sizeof(ci.aes128.key)) {
+            goto bad_cipher;
+        }
+        ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        QCRYPTO_TLS_KTLS_FILL(ci.aes128, tls12, &iv, &key, seq);
+        ci_len = sizeof(ci.aes128);
+        break;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case GNUTLS_CIPHER_AES_256_GCM:
+        if (key.size != sizeof(ci.aes256.key)) {
+            goto bad_cipher;
+        }
+        ci.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        QCRYPTO_TLS_KTLS_FILL(ci.aes256, tls12, &iv, &key, seq);
+        ci_len = sizeof(ci.aes256);
+        break;
+#endif
+    default:
+        goto bad_cipher;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        goto cleanup;
+    }
+    if (setsockopt(fd, SOL_TLS, TLS_TX, &ci, ci_len) < 0) {
+        error_setg_errno(errp, errno, "Cannot set kernel TLS keys");
+        goto cleanup;
+    }
+
+    trace_qcrypto_tls_session_offload_send(session, fd);
+    ret = 0;
+    goto cleanup;
+
+ bad_cipher:
+    error_setg(errp, "Kernel TLS does not support cipher %s",
+               gnutls_cipher_get_name(cipher));
+ cleanup:
+    memset(&ci, 0, sizeof(ci));
+    return ret;
+}
+
+#else /* ! CONFIG_KTLS */
+
+int
+qcrypto_tls_session_offload_send(QCryptoTLSSession *session,
+                                 int fd,
+                                 Error **errp)
+{
+    error_setg(errp, "Kernel TLS is not supported on this platform");
+    return -1;
+}
+
+#endif /* CONFIG_KTLS */
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -639,4 +777,14 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+int
+qcrypto_tls_session_offload_send(QCryptoTLSSession *sess,
+                                 int fd,
+                                 Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
 #endif
@@ -100,11 +100,13 @@ static void dma_blk_unmap(DMAAIOCB *dbs)
 {
     int i;
 
+    cpu_physical_memory_dirty_batch_begin();
     for (i = 0; i < dbs->iov.niov; ++i) {
         dma_memory_unmap(dbs->sg->as, dbs->iov.iov[i].iov_base,
                          dbs->iov.iov[i].iov_len, dbs->dir,
                          dbs->iov.iov[i].iov_len);
     }
+    cpu_physical_memory_dirty_batch_end();
     qemu_iovec_reset(&dbs->iov);
 }
 
@@ -280,6 +282,7 @@ static uint64_t dma_buf_rw(uint8_t *ptr, int32_t len, QEMUSGList *sg,
     resid = sg->size;
     sg_cur_index = 0;
     len = MIN(len, resid);
+    cpu_physical_memory_dirty_batch_begin();
     while (len > 0) {
         ScatterGatherEntry entry = sg->sg[sg_cur_index++];
         int32_t xfer = MIN(len, entry.len);
@@ -288,6 +291,7 @@ static uint64_t dma_buf_rw(uint8_t *ptr, int32_t len, QEMUSGList *sg,
         len -= xfer;
         resid -= xfer;
     }
+    cpu_physical_memory_dirty_batch_end();
 
     return resid;
 }
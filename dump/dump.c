@@ -1301,173 +1301,377 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
-static void write_dump_pages(DumpState *s, Error **errp)
+/*
+ * compress a page into buf_out with the format in s->flag_compress, and
+ * return the size of the result.  If compression fails or does not shrink
+ * the page, *flags is set to 0 and the page should be saved in plaintext.
+ */
+static size_t compress_page(DumpState *s, const uint8_t *buf,
+                            uint8_t *buf_out, size_t len_buf_out,
+                            void *wrkmem, uint32_t *flags)
+{
+    size_t size_out = len_buf_out;
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(buf_out, (uLongf *)&size_out, buf,
+                   s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
+        (size_out < s->dump_info.page_size)) {
+        *flags = DUMP_DH_COMPRESSED_ZLIB;
+        return size_out;
+    }
+#ifdef CONFIG_LZO
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+        (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
+                          (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
+        (size_out < s->dump_info.page_size)) {
+        *flags = DUMP_DH_COMPRESSED_LZO;
+        return size_out;
+    }
+#endif
+#ifdef CONFIG_SNAPPY
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+        (snappy_compress((char *)buf, s->dump_info.page_size,
+                         (char *)buf_out, &size_out) == SNAPPY_OK) &&
+        (size_out < s->dump_info.page_size)) {
+        *flags = DUMP_DH_COMPRESSED_SNAPPY;
+        return size_out;
+    }
+#endif
+
+    *flags = 0;
+    return s->dump_info.page_size;
+}
+
+typedef struct DumpPageWriter {
+    DataCache page_desc;
+    DataCache page_data;
+    off_t offset_data;          /* offset of the next page data in vmcore */
+    PageDescriptor pd_zero;     /* shared by all the zero pages */
+} DumpPageWriter;
+
+/*
+ * write the page desc and page data of a page.  A size of 0 stands for a
+ * zero page, whose data is already in the first page of page section.
+ */
+static int write_page(DumpState *s, DumpPageWriter *w, const uint8_t *data,
+                      uint32_t flags, size_t size, Error **errp)
+{
+    PageDescriptor pd;
+
+    if (!size) {
+        pd = w->pd_zero;
+    } else {
+        if (write_cache(&w->page_data, data, size, false) < 0) {
+            error_setg(errp, "dump: failed to write page data");
+            return -1;
+        }
+        pd.flags = cpu_to_dump32(s, flags);
+        pd.size = cpu_to_dump32(s, size);
+        pd.page_flags = cpu_to_dump64(s, 0);
+        pd.offset = cpu_to_dump64(s, w->offset_data);
+        w->offset_data += size;
+    }
+
+    if (write_cache(&w->page_desc, &pd, sizeof(PageDescriptor), false) < 0) {
+        error_setg(errp, "dump: failed to write page desc");
+        return -1;
+    }
+    s->written_size += s->dump_info.page_size;
+    return 0;
+}
+
+/*
+ * With several threads, pages are handed to the compression threads in
+ * batches.  The dump thread fills the batches in page order and writes
+ * them out in the same order once they are compressed, so the vmcore is
+ * identical to the one produced by a single thread.
+ */
+#define DUMP_BATCH_PAGES 256
+#define DUMP_MAX_THREADS 256
+
+typedef struct DumpBatch {
+    const uint8_t *pages[DUMP_BATCH_PAGES];
+    uint32_t flags[DUMP_BATCH_PAGES];
+    uint32_t sizes[DUMP_BATCH_PAGES];   /* 0 for zero pages */
+    unsigned nr_pages;
+    uint8_t *out;                       /* data of the non-zero pages */
+    bool done;
+} DumpBatch;
+
+typedef struct DumpCompress {
+    DumpState *s;
+    size_t len_buf_out;
+    QemuMutex lock;
+    QemuCond cond;
+    DumpBatch *batches;
+    unsigned nr_batches;
+    /* batches filled, taken by a compression thread and written so far */
+    uint64_t filled;
+    uint64_t taken;
+    uint64_t written;
+    bool quit;
+} DumpCompress;
+
+static void compress_batch(DumpCompress *dc, DumpBatch *batch, void *wrkmem)
+{
+    DumpState *s = dc->s;
+    uint8_t *out = batch->out;
+    unsigned i;
+
+    for (i = 0; i < batch->nr_pages; i++) {
+        const uint8_t *buf = batch->pages[i];
+        size_t size_out;
+
+        if (is_zero_page(buf, s->dump_info.page_size)) {
+            batch->sizes[i] = 0;
+            continue;
+        }
+        size_out = compress_page(s, buf, out, dc->len_buf_out, wrkmem,
+                                 &batch->flags[i]);
+        if (!batch->flags[i]) {
+            memcpy(out, buf, size_out);
+        }
+        batch->sizes[i] = size_out;
+        out += size_out;
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompress *dc = opaque;
+    void *wrkmem = NULL;
+    DumpBatch *batch;
+
+#ifdef CONFIG_LZO
+    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+
+    qemu_mutex_lock(&dc->lock);
+    for (;;) {
+        while (!dc->quit && dc->taken == dc->filled) {
+            qemu_cond_wait(&dc->cond, &dc->lock);
+        }
+        if (dc->quit) {
+            break;
+        }
+        batch = &dc->batches[dc->taken++ % dc->nr_batches];
+        qemu_mutex_unlock(&dc->lock);
+
+        compress_batch(dc, batch, wrkmem);
+
+        qemu_mutex_lock(&dc->lock);
+        batch->done = true;
+        qemu_cond_broadcast(&dc->cond);
+    }
+    qemu_mutex_unlock(&dc->lock);
+
+    g_free(wrkmem);
+    return NULL;
+}
+
+static int write_batch(DumpState *s, DumpPageWriter *w, DumpBatch *batch,
+                       Error **errp)
+{
+    const uint8_t *data = batch->out;
+    unsigned i;
+
+    for (i = 0; i < batch->nr_pages; i++) {
+        if (write_page(s, w, data, batch->flags[i], batch->sizes[i],
+                       errp) < 0) {
+            return -1;
+        }
+        data += batch->sizes[i];
+    }
+    return 0;
+}
+
+static int write_dump_pages_threaded(DumpState *s, DumpPageWriter *w,
+                                     size_t len_buf_out, Error **errp)
+{
+    DumpCompress dc = {
+        .s = s,
+        .len_buf_out = len_buf_out,
+        .nr_batches = 2 * s->nr_threads,
+    };
+    QemuThread *threads = g_new(QemuThread, s->nr_threads);
+    GuestPhysBlock *block_iter = NULL;
+    uint64_t pfn_iter;
+    uint8_t *buf;
+    bool more = true;
+    unsigned i;
+    int ret = 0;
+
+    qemu_mutex_init(&dc.lock);
+    qemu_cond_init(&dc.cond);
+    dc.batches = g_new0(DumpBatch, dc.nr_batches);
+    for (i = 0; i < dc.nr_batches; i++) {
+        dc.batches[i].out = g_malloc(DUMP_BATCH_PAGES * len_buf_out);
+    }
+    for (i = 0; i < s->nr_threads; i++) {
+        qemu_thread_create(&threads[i], "dump_compress", dump_compress_thread,
+                           &dc, QEMU_THREAD_JOINABLE);
+    }
+
+    while (more || dc.written < dc.filled) {
+        DumpBatch *batch;
+
+        /* keep all the batches busy */
+        while (more && dc.filled - dc.written < dc.nr_batches) {
+            batch = &dc.batches[dc.filled % dc.nr_batches];
+            batch->nr_pages = 0;
+            batch->done = false;
+            while (batch->nr_pages < DUMP_BATCH_PAGES &&
+                   (more = get_next_page(&block_iter, &pfn_iter, &buf, s))) {
+                batch->pages[batch->nr_pages++] = buf;
+            }
+            if (!batch->nr_pages) {
+                break;
+            }
+            qemu_mutex_lock(&dc.lock);
+            dc.filled++;
+            qemu_cond_broadcast(&dc.cond);
+            qemu_mutex_unlock(&dc.lock);
+        }
+        if (dc.written == dc.filled) {
+            break;
+        }
+
+        batch = &dc.batches[dc.written % dc.nr_batches];
+        qemu_mutex_lock(&dc.lock);
+        while (!batch->done) {
+            qemu_cond_wait(&dc.cond, &dc.lock);
+        }
+        qemu_mutex_unlock(&dc.lock);
+
+        ret = write_batch(s, w, batch, errp);
+        if (ret < 0) {
+            break;
+        }
+        dc.written++;
+    }
+
+    qemu_mutex_lock(&dc.lock);
+    dc.quit = true;
+    qemu_cond_broadcast(&dc.cond);
+    qemu_mutex_unlock(&dc.lock);
+    for (i = 0; i < s->nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    for (i = 0; i < dc.nr_batches; i++) {
+        g_free(dc.batches[i].out);
+    }
+    g_free(dc.batches);
+    g_free(threads);
+    qemu_cond_destroy(&dc.cond);
+    qemu_mutex_destroy(&dc.lock);
+    return ret;
+}
+
+static int write_dump_pages_serial(DumpState *s, DumpPageWriter *w,
+                                   size_t len_buf_out, Error **errp)
 {
     int ret = 0;
-    DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
+    size_t size_out;
 #ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
+    lzo_bytep wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#else
+    void *wrkmem = NULL;
 #endif
-    uint8_t *buf_out = NULL;
-    off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    uint8_t *buf_out = g_malloc(len_buf_out);
+    uint32_t flags;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
 
+    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
+        if (is_zero_page(buf, s->dump_info.page_size)) {
+            ret = write_page(s, w, NULL, 0, 0, errp);
+        } else {
+            /*
+             * only one compression format will be used here, for
+             * s->flag_compress is set. But when compression fails to work,
+             * we fall back to save in plaintext.
+             */
+            size_out = compress_page(s, buf, buf_out, len_buf_out, wrkmem,
+                                     &flags);
+            ret = write_page(s, w, flags ? buf_out : buf, flags, size_out,
+                             errp);
+        }
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    g_free(wrkmem);
+    g_free(buf_out);
+    return ret;
+}
+
+static void write_dump_pages(DumpState *s, Error **errp)
+{
+    int ret = 0;
+    DumpPageWriter w;
+    size_t len_buf_out;
+    off_t offset_desc;
+    uint8_t *buf;
+
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
-    offset_data = offset_desc + sizeof(PageDescriptor) * s->num_dumpable;
+    w.offset_data = offset_desc + sizeof(PageDescriptor) * s->num_dumpable;
 
-    prepare_data_cache(&page_desc, s, offset_desc);
-    prepare_data_cache(&page_data, s, offset_data);
+    prepare_data_cache(&w.page_desc, s, offset_desc);
+    prepare_data_cache(&w.page_data, s, w.offset_data);
 
     /* prepare buffer to store compressed data */
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
-
     /*
      * init zero page's page_desc and page_data, because every zero page
      * uses the same page_data
      */
-    pd_zero.size = cpu_to_dump32(s, s->dump_info.page_size);
-    pd_zero.flags = cpu_to_dump32(s, 0);
-    pd_zero.offset = cpu_to_dump64(s, offset_data);
-    pd_zero.page_flags = cpu_to_dump64(s, 0);
+    w.pd_zero.size = cpu_to_dump32(s, s->dump_info.page_size);
+    w.pd_zero.flags = cpu_to_dump32(s, 0);
+    w.pd_zero.offset = cpu_to_dump64(s, w.offset_data);
+    w.pd_zero.page_flags = cpu_to_dump64(s, 0);
     buf = g_malloc0(s->dump_info.page_size);
-    ret = write_cache(&page_data, buf, s->dump_info.page_size, false);
+    ret = write_cache(&w.page_data, buf, s->dump_info.page_size, false);
     g_free(buf);
     if (ret < 0) {
         error_setg(errp, "dump: failed to write page data (zero page)");
         goto out;
     }
 
-    offset_data += s->dump_info.page_size;
+    w.offset_data += s->dump_info.page_size;
 
     /*
      * dump memory to vmcore page by page. zero page will all be resided in the
      * first page of page section
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
-
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
-
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        }
-        s->written_size += s->dump_info.page_size;
+    if (s->nr_threads > 1) {
+        ret = write_dump_pages_threaded(s, &w, len_buf_out, errp);
+    } else {
+        ret = write_dump_pages_serial(s, &w, len_buf_out, errp);
+    }
+    if (ret < 0) {
+        goto out;
     }
 
-    ret = write_cache(&page_desc, NULL, 0, true);
+    ret = write_cache(&w.page_desc, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_desc");
         goto out;
     }
-    ret = write_cache(&page_data, NULL, 0, true);
+    ret = write_cache(&w.page_data, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_data");
         goto out;
     }
 
 out:
-    free_data_cache(&page_desc);
-    free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
+    free_data_cache(&w.page_desc);
+    free_data_cache(&w.page_data);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1923,7 +2127,8 @@ void qmp_dump_guest_memory(bool paging, const char *file,
                            bool has_detach, bool detach,
                            bool has_begin, int64_t begin, bool has_length,
                            int64_t length, bool has_format,
-                           DumpGuestMemoryFormat format, Error **errp)
+                           DumpGuestMemoryFormat format, bool has_threads,
+                           int64_t threads, Error **errp)
 {
     const char *p;
     int fd = -1;
@@ -1964,6 +2169,11 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     if (has_detach) {
         detach_p = detach;
     }
+    if (has_threads && (threads < 1 || threads > DUMP_MAX_THREADS)) {
+        error_setg(errp, "threads must be between 1 and %d",
+                   DUMP_MAX_THREADS);
+        return;
+    }
 
     /* check whether lzo/snappy is supported */
 #ifndef CONFIG_LZO
@@ -2011,6 +2221,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
 
     s = &dump_state_global;
     dump_state_prepare(s);
+    s->nr_threads = has_threads ? threads : 1;
 
     dump_init(s, fd, has_format, format, paging, has_begin,
               begin, length, &local_err);
@@ -174,6 +174,8 @@ typedef struct PhysPageMap {
 } PhysPageMap;
 
 struct AddressSpaceDispatch {
+    /* Unique for the lifetime of QEMU, keys the per-thread section cache */
+    uint64_t id;
     MemoryRegionSection *mru_section;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
@@ -385,17 +387,67 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
 }
 
 /* Called from RCU critical section */
+/*
+ * Sections recently looked up by this thread.  MMIO-heavy exits tend to
+ * hit the same few device registers over and over, and this saves them
+ * both the walk of the dispatch radix tree and a write to the shared
+ * mru_section.  An entry is valid as long as its dispatch is, which the
+ * dispatch id guarantees since ids are never reused.
+ */
+#define SECTION_CACHE_SIZE 4
+
+typedef struct SectionCacheEntry {
+    uint64_t dispatch_id;
+    MemoryRegionSection *section;
+} SectionCacheEntry;
+
+static __thread SectionCacheEntry section_cache[SECTION_CACHE_SIZE];
+static __thread unsigned section_cache_next;
+
+static MemoryRegionSection *section_cache_find(AddressSpaceDispatch *d,
+                                               hwaddr addr)
+{
+    int i;
+
+    for (i = 0; i < SECTION_CACHE_SIZE; i++) {
+        SectionCacheEntry *e = &section_cache[i];
+
+        if (e->dispatch_id == d->id && section_covers_addr(e->section, addr)) {
+            return e->section;
+        }
+    }
+    return NULL;
+}
+
+static void section_cache_insert(AddressSpaceDispatch *d,
+                                 MemoryRegionSection *section)
+{
+    SectionCacheEntry *e = &section_cache[section_cache_next];
+
+    e->dispatch_id = d->id;
+    e->section = section;
+    section_cache_next = (section_cache_next + 1) % SECTION_CACHE_SIZE;
+}
+
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = atomic_read(&d->mru_section);
+    MemoryRegionSection *section = section_cache_find(d, addr);
     subpage_t *subpage;
 
-    if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
-        !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
-        atomic_set(&d->mru_section, section);
+    if (!section) {
+        section = atomic_read(&d->mru_section);
+        if (!section ||
+            section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
+            !section_covers_addr(section, addr)) {
+            section = phys_page_find(d, addr);
+            atomic_set(&d->mru_section, section);
+        }
+        /* The unassigned section covers everything, never cache it */
+        if (section != &d->map.sections[PHYS_SECTION_UNASSIGNED]) {
+            section_cache_insert(d, section);
+        }
     }
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
@@ -1832,6 +1884,7 @@ static int64_t get_file_size(int fd)
 
 static int file_ram_open(const char *path,
                          const char *region_name,
+                         bool readonly,
                          bool *created,
                          Error **errp)
 {
@@ -1841,6 +1894,14 @@ static int file_ram_open(const char *path,
     int fd = -1;
 
     *created = false;
+    if (readonly) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            error_setg_errno(errp, errno,
+                             "can't open template %s for guest RAM", path);
+        }
+        return fd;
+    }
     for (;;) {
         fd = open(path, O_RDWR);
         if (fd >= 0) {
@@ -2342,7 +2403,8 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
     int64_t file_size;
 
     /* Just support these ram flags by now. */
-    assert((ram_flags & ~(RAM_SHARED | RAM_PMEM)) == 0);
+    assert((ram_flags & ~(RAM_SHARED | RAM_PMEM | RAM_TEMPLATE)) == 0);
+    assert(!(ram_flags & RAM_SHARED) || !(ram_flags & RAM_TEMPLATE));
 
     if (xen_enabled()) {
         error_setg(errp, "-mem-path not supported with Xen");
@@ -2374,6 +2436,12 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
                    mem_path, file_size, size);
         return NULL;
     }
+    if ((ram_flags & RAM_TEMPLATE) && file_size < (int64_t)size) {
+        error_setg(errp, "template size 0x%" PRIx64
+                   " is smaller than 'size' option 0x" RAM_ADDR_FMT,
+                   MAX(file_size, 0), size);
+        return NULL;
+    }
 
     new_block = g_malloc0(sizeof(*new_block));
     new_block->mr = mr;
@@ -2405,7 +2473,8 @@ RAMBlock *qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
     bool created;
     RAMBlock *block;
 
-    fd = file_ram_open(mem_path, memory_region_name(mr), &created, errp);
+    fd = file_ram_open(mem_path, memory_region_name(mr),
+                       ram_flags & RAM_TEMPLATE, &created, errp);
     if (fd < 0) {
         return NULL;
     }
@@ -3059,9 +3128,13 @@ static void io_mem_init(void)
 
 AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
 {
+    static uint64_t next_dispatch_id = 1;
     AddressSpaceDispatch *d = g_new0(AddressSpaceDispatch, 1);
     uint16_t n;
 
+    /* Called with the BQL held; 0 never matches the section cache */
+    d->id = next_dispatch_id++;
+
     n = dummy_section(&d->map, fv, &io_mem_unassigned);
     assert(n == PHYS_SECTION_UNASSIGNED);
     n = dummy_section(&d->map, fv, &io_mem_notdirty);
@@ -3196,12 +3269,112 @@ int cpu_memory_rw_debug(CPUState *cpu, target_ulong addr,
 
 #else
 
+/*
+ * Dirty memory batching.  A DMA request usually writes guest memory through
+ * many small address_space_write() or unmap calls; marking each of them
+ * dirty separately costs a walk of the dirty bitmaps and a few atomic ORs
+ * every time.  Between cpu_physical_memory_dirty_batch_begin() and _end()
+ * the ranges are collected per thread, adjacent ones are merged and the
+ * result is applied to the bitmaps once.  Both calls must happen within
+ * the same critical section of the caller, so that nobody can synchronize
+ * the dirty log while ranges are still pending.
+ */
+#define DIRTY_BATCH_RANGES 16
+
+typedef struct DirtyBatchRange {
+    ram_addr_t start;
+    ram_addr_t length;
+    uint8_t mask;
+} DirtyBatchRange;
+
+typedef struct DirtyBatch {
+    int depth;
+    int count;
+    DirtyBatchRange ranges[DIRTY_BATCH_RANGES];
+} DirtyBatch;
+
+static __thread DirtyBatch dirty_batch;
+
+static void cpu_physical_memory_dirty_batch_flush(DirtyBatch *batch)
+{
+    int i;
+
+    rcu_read_lock();
+    for (i = 0; i < batch->count; i++) {
+        DirtyBatchRange *r = &batch->ranges[i];
+        uint8_t mask;
+
+        mask = cpu_physical_memory_range_includes_clean(r->start, r->length,
+                                                        r->mask);
+        cpu_physical_memory_set_dirty_range(r->start, r->length, mask);
+    }
+    rcu_read_unlock();
+    batch->count = 0;
+}
+
+static void cpu_physical_memory_dirty_batch_add(DirtyBatch *batch,
+                                                ram_addr_t start,
+                                                ram_addr_t length,
+                                                uint8_t mask)
+{
+    DirtyBatchRange *r;
+
+    if (batch->count) {
+        r = &batch->ranges[batch->count - 1];
+        if (r->mask == mask && r->start + r->length == start) {
+            r->length += length;
+            return;
+        }
+    }
+    if (batch->count == DIRTY_BATCH_RANGES) {
+        cpu_physical_memory_dirty_batch_flush(batch);
+    }
+    r = &batch->ranges[batch->count++];
+    r->start = start;
+    r->length = length;
+    r->mask = mask;
+}
+
+void cpu_physical_memory_dirty_batch_begin(void)
+{
+    dirty_batch.depth++;
+}
+
+void cpu_physical_memory_dirty_batch_end(void)
+{
+    assert(dirty_batch.depth > 0);
+    if (--dirty_batch.depth == 0 && dirty_batch.count) {
+        cpu_physical_memory_dirty_batch_flush(&dirty_batch);
+    }
+}
+
 static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
                                      hwaddr length)
 {
     uint8_t dirty_log_mask = memory_region_get_dirty_log_mask(mr);
     addr += memory_region_get_ram_addr(mr);
 
+    /*
+     * Translated code must be invalidated right away; everything else can
+     * wait for the end of the batch.  Xen is told about modified memory
+     * from cpu_physical_memory_set_dirty_range, so never batch there.
+     */
+    if (dirty_batch.depth && !xen_enabled()) {
+        if (dirty_log_mask & (1 << DIRTY_MEMORY_CODE)) {
+            if (cpu_physical_memory_range_includes_clean(addr, length,
+                                                1 << DIRTY_MEMORY_CODE)) {
+                assert(tcg_enabled());
+                tb_invalidate_phys_range(addr, addr + length);
+            }
+            dirty_log_mask &= ~(1 << DIRTY_MEMORY_CODE);
+        }
+        if (dirty_log_mask) {
+            cpu_physical_memory_dirty_batch_add(&dirty_batch, addr, length,
+                                                dirty_log_mask);
+        }
+        return;
+    }
+
     /* No early return if dirty_log_mask is or becomes 0, because
      * cpu_physical_memory_set_dirty_range will still call
      * xen_modified_memory.
@@ -3527,7 +3700,16 @@ void cpu_flush_icache_range(hwaddr start, hwaddr len)
                                      NULL, len, FLUSH_CACHE);
 }
 
+/*
+ * Bounce buffers are shared by all address spaces, but each address
+ * space may only use part of them so that one busy device cannot starve
+ * the others.  Each buffer holds at most one target page.
+ */
+#define MAX_BOUNCE_BUFFERS 64
+#define MAX_BOUNCE_BUFFERS_PER_AS 16
+
 typedef struct {
+    AddressSpace *as;
     MemoryRegion *mr;
     void *buffer;
     hwaddr addr;
@@ -3535,7 +3717,53 @@ typedef struct {
     bool in_use;
 } BounceBuffer;
 
-static BounceBuffer bounce;
+static BounceBuffer bounce[MAX_BOUNCE_BUFFERS];
+static unsigned bounce_in_use;
+
+static BounceBuffer *bounce_buffer_get(AddressSpace *as)
+{
+    int i;
+
+    if (atomic_fetch_inc(&as->bounce_buffers) >= MAX_BOUNCE_BUFFERS_PER_AS) {
+        atomic_dec(&as->bounce_buffers);
+        return NULL;
+    }
+    for (i = 0; i < MAX_BOUNCE_BUFFERS; i++) {
+        if (!atomic_xchg(&bounce[i].in_use, true)) {
+            atomic_inc(&bounce_in_use);
+            bounce[i].as = as;
+            return &bounce[i];
+        }
+    }
+    atomic_dec(&as->bounce_buffers);
+    return NULL;
+}
+
+static BounceBuffer *bounce_buffer_find(void *buffer)
+{
+    int i;
+
+    if (!atomic_read(&bounce_in_use)) {
+        return NULL;
+    }
+    for (i = 0; i < MAX_BOUNCE_BUFFERS; i++) {
+        if (atomic_read(&bounce[i].in_use) && bounce[i].buffer == buffer) {
+            return &bounce[i];
+        }
+    }
+    return NULL;
+}
+
+static void bounce_buffer_put(BounceBuffer *b)
+{
+    qemu_vfree(b->buffer);
+    b->buffer = NULL;
+    memory_region_unref(b->mr);
+    atomic_dec(&b->as->bounce_buffers);
+    b->as = NULL;
+    atomic_dec(&bounce_in_use);
+    atomic_mb_set(&b->in_use, false);
+}
 
 typedef struct MapClient {
     QEMUBH *bh;
@@ -3570,7 +3798,8 @@ void cpu_register_map_client(QEMUBH *bh)
     qemu_mutex_lock(&map_client_list_lock);
     client->bh = bh;
     QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!atomic_read(&bounce.in_use)) {
+    /* Otherwise the next bounce buffer to be released notifies us */
+    if (!atomic_read(&bounce_in_use)) {
         cpu_notify_map_clients_locked();
     }
     qemu_mutex_unlock(&map_client_list_lock);
@@ -3705,26 +3934,28 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write, attrs);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (atomic_xchg(&bounce.in_use, true)) {
+        BounceBuffer *b = bounce_buffer_get(as);
+
+        if (!b) {
             rcu_read_unlock();
             return NULL;
         }
         /* Avoid unbounded allocations */
         l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+        b->buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
+        b->addr = addr;
+        b->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        b->mr = mr;
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                               b->buffer, l);
         }
 
         rcu_read_unlock();
         *plen = l;
-        return bounce.buffer;
+        return b->buffer;
     }
 
 
@@ -3744,7 +3975,9 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *b = bounce_buffer_find(buffer);
+
+    if (!b) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -3760,13 +3993,14 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
+        /* Write back through the address space the buffer was mapped
+         * from, which need not be @as if the caller translated the
+         * address itself.
+         */
+        address_space_write(b->as, b->addr, MEMTXATTRS_UNSPECIFIED,
+                            b->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    atomic_mb_set(&bounce.in_use, false);
+    bounce_buffer_put(b);
     cpu_notify_map_clients();
 }
 
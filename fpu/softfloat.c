@@ -2211,14 +2211,53 @@ int16_t float32_to_int16(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
-int32_t float32_to_int32(float32 a, float_status *s)
+/*
+ * Hardfloat float to integer conversions.  With the rounding mode at
+ * nearest-even and inexact already raised, the only other exception a
+ * conversion can raise is invalid, which the range checks leave to
+ * softfloat, together with NaNs.  Truncating conversions do not depend
+ * on the rounding mode at all.  The range limits are powers of 2 and so
+ * are exact in either format.
+ */
+static inline bool can_use_fpu_trunc(const float_status *s)
 {
-    return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_exception_flags & float_flag_inexact);
 }
 
-int64_t float32_to_int64(float32 a, float_status *s)
+int32_t QEMU_FLATTEN float32_to_int32(float32 a, float_status *s)
 {
-    return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
+    union_float32 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    float32_input_flush1(&ua.s, s);
+    if (likely(ua.h >= -0x1p31f && ua.h < 0x1p31f)) {
+        /* Rounding cannot overflow as 2**31 - 1 is not a float32.  */
+        return lrintf(ua.h);
+    }
+ soft:
+    return float32_to_int32_scalbn(ua.s, s->float_rounding_mode, 0, s);
+}
+
+int64_t QEMU_FLATTEN float32_to_int64(float32 a, float_status *s)
+{
+    union_float32 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    float32_input_flush1(&ua.s, s);
+    if (likely(ua.h >= -0x1p63f && ua.h < 0x1p63f)) {
+        return llrintf(ua.h);
+    }
+ soft:
+    return float32_to_int64_scalbn(ua.s, s->float_rounding_mode, 0, s);
 }
 
 int16_t float64_to_int16(float64 a, float_status *s)
@@ -2226,14 +2265,37 @@ int16_t float64_to_int16(float64 a, float_status *s)
     return float64_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
-int32_t float64_to_int32(float64 a, float_status *s)
+int32_t QEMU_FLATTEN float64_to_int32(float64 a, float_status *s)
 {
-    return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
+    union_float64 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    float64_input_flush1(&ua.s, s);
+    if (likely(ua.h > -0x1p31 - 0.5 && ua.h < 0x1p31 - 0.5)) {
+        return lrint(ua.h);
+    }
+ soft:
+    return float64_to_int32_scalbn(ua.s, s->float_rounding_mode, 0, s);
 }
 
-int64_t float64_to_int64(float64 a, float_status *s)
+int64_t QEMU_FLATTEN float64_to_int64(float64 a, float_status *s)
 {
-    return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
+    union_float64 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+    float64_input_flush1(&ua.s, s);
+    if (likely(ua.h >= -0x1p63 && ua.h < 0x1p63)) {
+        /* Rounding cannot overflow as 2**63 - 1 is not a float64.  */
+        return llrint(ua.h);
+    }
+ soft:
+    return float64_to_int64_scalbn(ua.s, s->float_rounding_mode, 0, s);
 }
 
 int16_t float16_to_int16_round_to_zero(float16 a, float_status *s)
@@ -2256,14 +2318,36 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, float_round_to_zero, 0, s);
 }
 
-int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
+int32_t QEMU_FLATTEN float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
-    return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
+    union_float32 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu_trunc(s))) {
+        goto soft;
+    }
+    float32_input_flush1(&ua.s, s);
+    if (likely(ua.h >= -0x1p31f && ua.h < 0x1p31f)) {
+        return (int32_t)ua.h;
+    }
+ soft:
+    return float32_to_int32_scalbn(ua.s, float_round_to_zero, 0, s);
 }
 
-int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
+int64_t QEMU_FLATTEN float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
-    return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
+    union_float32 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu_trunc(s))) {
+        goto soft;
+    }
+    float32_input_flush1(&ua.s, s);
+    if (likely(ua.h >= -0x1p63f && ua.h < 0x1p63f)) {
+        return (int64_t)ua.h;
+    }
+ soft:
+    return float32_to_int64_scalbn(ua.s, float_round_to_zero, 0, s);
 }
 
 int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
@@ -2271,14 +2355,36 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
     return float64_to_int16_scalbn(a, float_round_to_zero, 0, s);
 }
 
-int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
+int32_t QEMU_FLATTEN float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
-    return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
+    union_float64 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu_trunc(s))) {
+        goto soft;
+    }
+    float64_input_flush1(&ua.s, s);
+    if (likely(ua.h > -0x1p31 - 1 && ua.h < 0x1p31)) {
+        return (int32_t)ua.h;
+    }
+ soft:
+    return float64_to_int32_scalbn(ua.s, float_round_to_zero, 0, s);
 }
 
-int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
+int64_t QEMU_FLATTEN float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
-    return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
+    union_float64 ua;
+
+    ua.s = a;
+    if (unlikely(!can_use_fpu_trunc(s))) {
+        goto soft;
+    }
+    float64_input_flush1(&ua.s, s);
+    if (likely(ua.h >= -0x1p63 && ua.h < 0x1p63)) {
+        return (int64_t)ua.h;
+    }
+ soft:
+    return float64_to_int64_scalbn(ua.s, float_round_to_zero, 0, s);
 }
 
 /*
@@ -2573,14 +2679,29 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float32_scalbn(a, scale, status);
 }
 
-float32 int64_to_float32(int64_t a, float_status *status)
+/*
+ * Hardfloat integer to float conversions: these are exact, raising
+ * nothing, when the integer fits in the significand, and otherwise
+ * only raise inexact, so can use the host under can_use_fpu().
+ */
+float32 QEMU_FLATTEN int64_to_float32(int64_t a, float_status *status)
 {
+    union_float32 ur;
+
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+    if (likely((a >= -(1 << 24) && a <= 1 << 24) || can_use_fpu(status))) {
+        ur.h = a;
+        return ur.s;
+    }
+ soft:
     return int64_to_float32_scalbn(a, 0, status);
 }
 
-float32 int32_to_float32(int32_t a, float_status *status)
+float32 QEMU_FLATTEN int32_to_float32(int32_t a, float_status *status)
 {
-    return int64_to_float32_scalbn(a, 0, status);
+    return int64_to_float32(a, status);
 }
 
 float32 int16_to_float32(int16_t a, float_status *status)
@@ -2604,14 +2725,24 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float64_scalbn(a, scale, status);
 }
 
-float64 int64_to_float64(int64_t a, float_status *status)
+float64 QEMU_FLATTEN int64_to_float64(int64_t a, float_status *status)
 {
+    union_float64 ur;
+
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+    if (likely((a >= -(1LL << 53) && a <= 1LL << 53) || can_use_fpu(status))) {
+        ur.h = a;
+        return ur.s;
+    }
+ soft:
     return int64_to_float64_scalbn(a, 0, status);
 }
 
-float64 int32_to_float64(int32_t a, float_status *status)
+float64 QEMU_FLATTEN int32_to_float64(int32_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    return int64_to_float64(a, status);
 }
 
 float64 int16_to_float64(int16_t a, float_status *status)
@@ -2849,22 +2980,134 @@ MINMAX(16, max, false, false, false)
 MINMAX(16, maxnum, false, true, false)
 MINMAX(16, maxnummag, false, true, true)
 
-MINMAX(32, min, true, false, false)
-MINMAX(32, minnum, true, true, false)
 MINMAX(32, minnummag, true, true, true)
-MINMAX(32, max, false, false, false)
-MINMAX(32, maxnum, false, true, false)
 MINMAX(32, maxnummag, false, true, true)
 
-MINMAX(64, min, true, false, false)
-MINMAX(64, minnum, true, true, false)
 MINMAX(64, minnummag, true, true, true)
-MINMAX(64, max, false, false, false)
-MINMAX(64, maxnum, false, true, false)
 MINMAX(64, maxnummag, false, true, true)
 
 #undef MINMAX
 
+#define SOFT_MINMAX(sz, name, ismin, isiee)                              \
+static float ## sz QEMU_SOFTFLOAT_ATTR                                  \
+soft_f ## sz ## _ ## name(float ## sz a, float ## sz b, float_status *s) \
+{                                                                       \
+    FloatParts pa = float ## sz ## _unpack_canonical(a, s);             \
+    FloatParts pb = float ## sz ## _unpack_canonical(b, s);             \
+    FloatParts pr = minmax_floats(pa, pb, ismin, isiee, false, s);      \
+                                                                        \
+    return float ## sz ## _round_pack_canonical(pr, s);                 \
+}
+
+SOFT_MINMAX(32, min, true, false)
+SOFT_MINMAX(32, minnum, true, true)
+SOFT_MINMAX(32, max, false, false)
+SOFT_MINMAX(32, maxnum, false, true)
+
+SOFT_MINMAX(64, min, true, false)
+SOFT_MINMAX(64, minnum, true, true)
+SOFT_MINMAX(64, max, false, false)
+SOFT_MINMAX(64, maxnum, false, true)
+
+#undef SOFT_MINMAX
+
+/*
+ * For two ordered inputs that compare unequal, min and max are exact and
+ * raise no exceptions, whatever the rounding mode, so the host can make
+ * the choice.  NaNs and equal inputs (where the sign of zero matters)
+ * are left to softfloat, as are denormals so that they are output the
+ * way softfloat would flush them.
+ */
+static inline float32
+f32_minmax(float32 xa, float32 xb, bool ismin, float_status *s,
+           soft_f32_op2_fn soft)
+{
+    union_float32 ua, ub;
+
+    ua.s = xa;
+    ub.s = xb;
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+
+    float32_input_flush2(&ua.s, &ub.s, s);
+    if (likely(f32_is_zon2(ua, ub))) {
+        if (isless(ua.h, ub.h)) {
+            return ismin ? ua.s : ub.s;
+        }
+        if (isgreater(ua.h, ub.h)) {
+            return ismin ? ub.s : ua.s;
+        }
+    }
+ soft:
+    return soft(ua.s, ub.s, s);
+}
+
+static inline float64
+f64_minmax(float64 xa, float64 xb, bool ismin, float_status *s,
+           soft_f64_op2_fn soft)
+{
+    union_float64 ua, ub;
+
+    ua.s = xa;
+    ub.s = xb;
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+
+    float64_input_flush2(&ua.s, &ub.s, s);
+    if (likely(f64_is_zon2(ua, ub))) {
+        if (isless(ua.h, ub.h)) {
+            return ismin ? ua.s : ub.s;
+        }
+        if (isgreater(ua.h, ub.h)) {
+            return ismin ? ub.s : ua.s;
+        }
+    }
+ soft:
+    return soft(ua.s, ub.s, s);
+}
+
+float32 QEMU_FLATTEN float32_min(float32 a, float32 b, float_status *s)
+{
+    return f32_minmax(a, b, true, s, soft_f32_min);
+}
+
+float32 QEMU_FLATTEN float32_minnum(float32 a, float32 b, float_status *s)
+{
+    return f32_minmax(a, b, true, s, soft_f32_minnum);
+}
+
+float32 QEMU_FLATTEN float32_max(float32 a, float32 b, float_status *s)
+{
+    return f32_minmax(a, b, false, s, soft_f32_max);
+}
+
+float32 QEMU_FLATTEN float32_maxnum(float32 a, float32 b, float_status *s)
+{
+    return f32_minmax(a, b, false, s, soft_f32_maxnum);
+}
+
+float64 QEMU_FLATTEN float64_min(float64 a, float64 b, float_status *s)
+{
+    return f64_minmax(a, b, true, s, soft_f64_min);
+}
+
+float64 QEMU_FLATTEN float64_minnum(float64 a, float64 b, float_status *s)
+{
+    return f64_minmax(a, b, true, s, soft_f64_minnum);
+}
+
+float64 QEMU_FLATTEN float64_max(float64 a, float64 b, float_status *s)
+{
+    return f64_minmax(a, b, false, s, soft_f64_max);
+}
+
+float64 QEMU_FLATTEN float64_maxnum(float64 a, float64 b, float_status *s)
+{
+    return f64_minmax(a, b, false, s, soft_f64_maxnum);
+}
+
 /* Floating point compare */
 static int compare_floats(FloatParts a, FloatParts b, bool is_quiet,
                           float_status *s)
@@ -297,6 +297,26 @@ STEXI
 Show dynamic compiler info.
 ETEXI
 
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the max (default: 10) most executed translation "
+                      "blocks",
+        .cmd        = hmp_info_tb_profile,
+    },
+#endif
+
+STEXI
+@item info tb-profile [@var{max}]
+@findex info tb-profile
+Show the @var{max} (default: 10) most executed translation blocks, with their
+guest PC, guest and host code size, execution count, number of exits to the
+main loop and number of helper calls in their code. Requires
+@code{tb-profile on}.
+ETEXI
+
 #if defined(CONFIG_TCG)
     {
         .name       = "opcount",
@@ -315,22 +335,25 @@ ETEXI
 
     {
         .name       = "sync-profile",
-        .args_type  = "mean:-m,no_coalesce:-n,max:i?",
-        .params     = "[-m] [-n] [max]",
+        .args_type  = "mean:-m,no_coalesce:-n,hold:-h,max:i?",
+        .params     = "[-m] [-n] [-h] [max]",
         .help       = "show synchronization profiling info, up to max entries "
                       "(default: 10), sorted by total wait time. (-m: sort by "
                       "mean wait time; -n: do not coalesce objects with the "
-                      "same call site)",
+                      "same call site; -h: sort by mutex hold time instead)",
         .cmd        = hmp_info_sync_profile,
     },
 
 STEXI
-@item info sync-profile [-m|-n] [@var{max}]
+@item info sync-profile [-m|-n|-h] [@var{max}]
 @findex info sync-profile
 Show synchronization profiling info, up to @var{max} entries (default: 10),
 sorted by total wait time.
         -m: sort by mean wait time
         -n: do not coalesce objects with the same call site
+        -h: sort by (total or, with -m, mean) mutex hold time
+Hold times are attributed to the call site that acquired the mutex; they are
+only tracked for mutexes, including the BQL.
 When different objects that share the same call site are coalesced, the "Object"
 field shows---enclosed in brackets---the number of objects being coalesced.
 ETEXI
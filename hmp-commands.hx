@@ -681,6 +681,25 @@ STEXI
 @findex sync-profile
 Enable, disable or reset synchronization profiling. With no arguments, prints
 whether profiling is on or off.
+ETEXI
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "op:s?",
+        .params     = "[on|off|reset]",
+        .help       = "enable, disable or reset translation block profiling. "
+                      "With no arguments, prints whether profiling is on or off.",
+        .cmd        = hmp_tb_profile,
+    },
+#endif
+
+STEXI
+@item tb-profile [on|off|reset]
+@findex tb-profile
+Enable, disable or reset the counting of translation block executions and
+exits, see @code{info tb-profile}. Enabling or disabling it flushes the
+translated code. With no arguments, prints whether profiling is on or off.
 ETEXI
 
     {
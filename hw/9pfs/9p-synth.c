@@ -578,6 +578,18 @@ static int synth_init(FsContext *ctx, Error **errp)
                                        NULL, v9fs_synth_qtest_flush_write,
                                        ctx);
         assert(!ret);
+
+        /* Directory for READDIR test */
+        ret = qemu_v9fs_synth_mkdir(NULL, 0700, QTEST_V9FS_SYNTH_READDIR_DIR,
+                                    &node);
+        assert(!ret);
+        for (i = 0; i < QTEST_V9FS_SYNTH_READDIR_NFILES; i++) {
+            char *name = g_strdup_printf(QTEST_V9FS_SYNTH_READDIR_FILE, i);
+
+            ret = qemu_v9fs_synth_add_file(node, 0, name, NULL, NULL, ctx);
+            assert(!ret);
+            g_free(name);
+        }
     }
 
     return 0;
@@ -1853,6 +1853,10 @@ static void coroutine_fn v9fs_read(void *opaque)
         QEMUIOVector qiov;
         int32_t len;
 
+        if (max_count > s->msize - 11) {
+            /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
+            max_count = s->msize - 11;
+        }
         v9fs_init_qiov_from_pdu(&qiov_full, pdu, offset + 4, max_count, false);
         qemu_iovec_init(&qiov, qiov_full.niov);
         do {
@@ -1861,9 +1865,13 @@ static void coroutine_fn v9fs_read(void *opaque)
             if (0) {
                 print_sg(qiov.iov, qiov.niov);
             }
-            /* Loop in case of EINTR */
+            /*
+             * Loop in case of EINTR.  Large msize guest buffers may span
+             * more than IOV_MAX pages: the rest is read by the next pass.
+             */
             do {
-                len = v9fs_co_preadv(pdu, fidp, qiov.iov, qiov.niov, off);
+                len = v9fs_co_preadv(pdu, fidp, qiov.iov,
+                                     MIN(qiov.niov, IOV_MAX), off);
                 if (len >= 0) {
                     off   += len;
                     count += len;
@@ -1895,7 +1903,7 @@ out_nofid:
     pdu_complete(pdu, err);
 }
 
-static size_t v9fs_readdir_data_size(V9fsString *name)
+size_t v9fs_readdir_data_size(V9fsString *name)
 {
     /*
      * Size of each dirent on the wire: size of qid (13) + size of offset (8)
@@ -1904,40 +1912,38 @@ static size_t v9fs_readdir_data_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
+static void v9fs_free_dirents(V9fsDirEnt *e)
+{
+    V9fsDirEnt *next;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e);
+    }
+}
+
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
-                                        int32_t max_count)
+                                        off_t offset, int32_t max_count)
 {
     size_t size;
     V9fsQID qid;
     V9fsString name;
-    int len, err = 0;
+    int len, err;
     int32_t count = 0;
-    off_t saved_dir_pos;
     struct dirent *dent;
+    V9fsDirEnt *entries = NULL, *e;
 
-    /* save the directory position */
-    saved_dir_pos = v9fs_co_telldir(pdu, fidp);
-    if (saved_dir_pos < 0) {
-        return saved_dir_pos;
+    err = v9fs_co_readdir_many(pdu, fidp, &entries, offset, max_count);
+    if (err < 0) {
+        goto out;
     }
+    err = 0;
 
-    while (1) {
-        v9fs_readdir_lock(&fidp->fs.dir);
-
-        err = v9fs_co_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
-        }
+    for (e = entries; e; e = e->next) {
+        dent = e->dent;
         v9fs_string_init(&name);
         v9fs_string_sprintf(&name, "%s", dent->d_name);
-        if ((count + v9fs_readdir_data_size(&name)) > max_count) {
-            v9fs_readdir_unlock(&fidp->fs.dir);
-
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            return count;
-        }
         /*
          * Fill up just the path field of qid because the client uses
          * only that. To fill the entire qid structure we will have
@@ -1953,21 +1959,16 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
         len = pdu_marshal(pdu, 11 + count, "Qqbs",
                           &qid, dent->d_off,
                           dent->d_type, &name);
-
-        v9fs_readdir_unlock(&fidp->fs.dir);
-
+        v9fs_string_free(&name);
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            return len;
+            err = len;
+            break;
         }
         count += len;
-        v9fs_string_free(&name);
-        saved_dir_pos = dent->d_off;
     }
 
-    v9fs_readdir_unlock(&fidp->fs.dir);
-
+out:
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -2001,12 +2002,11 @@ static void coroutine_fn v9fs_readdir(void *opaque)
         retval = -EINVAL;
         goto out;
     }
-    if (initial_offset == 0) {
-        v9fs_co_rewinddir(pdu, fidp);
-    } else {
-        v9fs_co_seekdir(pdu, fidp, initial_offset);
+    if (max_count > pdu->s->msize - 11) {
+        /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
+        max_count = pdu->s->msize - 11;
     }
-    count = v9fs_do_readdir(pdu, fidp, max_count);
+    count = v9fs_do_readdir(pdu, fidp, (off_t)initial_offset, max_count);
     if (count < 0) {
         retval = count;
         goto out;
@@ -2117,9 +2117,13 @@ static void coroutine_fn v9fs_write(void *opaque)
         if (0) {
             print_sg(qiov.iov, qiov.niov);
         }
-        /* Loop in case of EINTR */
+        /*
+         * Loop in case of EINTR.  Large msize guest buffers may span more
+         * than IOV_MAX pages: the rest is written by the next pass.
+         */
         do {
-            len = v9fs_co_pwritev(pdu, fidp, qiov.iov, qiov.niov, off);
+            len = v9fs_co_pwritev(pdu, fidp, qiov.iov,
+                                  MIN(qiov.niov, IOV_MAX), off);
             if (len >= 0) {
                 off   += len;
                 total += len;
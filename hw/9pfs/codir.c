@@ -43,6 +43,82 @@ int coroutine_fn v9fs_co_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
     return err;
 }
 
+/*
+ * Read as many entries as fit in @maxsize bytes of a Rreaddir response,
+ * starting at @offset.  Runs in the worker thread with the readdir lock
+ * held.
+ */
+static int do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
+                           V9fsDirEnt **entries, off_t offset,
+                           int32_t maxsize)
+{
+    V9fsState *s = pdu->s;
+    V9fsString name;
+    V9fsDirEnt **tail = entries;
+    struct dirent *dent;
+    off_t saved_dir_pos;
+    int32_t size = 0;
+    size_t len;
+
+    if (offset == 0) {
+        s->ops->rewinddir(&s->ctx, &fidp->fs);
+    } else {
+        s->ops->seekdir(&s->ctx, &fidp->fs, offset);
+    }
+
+    saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
+    if (saved_dir_pos < 0) {
+        return -errno;
+    }
+
+    while (true) {
+        errno = 0;
+        dent = s->ops->readdir(&s->ctx, &fidp->fs);
+        if (!dent) {
+            return errno ? -errno : size;
+        }
+
+        v9fs_string_init(&name);
+        v9fs_string_sprintf(&name, "%s", dent->d_name);
+        len = v9fs_readdir_data_size(&name);
+        v9fs_string_free(&name);
+        if (size + len > maxsize) {
+            /* Ran out of buffer, leave this entry for the next request */
+            s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+            return size;
+        }
+        size += len;
+
+        *tail = g_new0(V9fsDirEnt, 1);
+        (*tail)->dent = g_memdup(dent, sizeof(*dent));
+        tail = &(*tail)->next;
+        saved_dir_pos = dent->d_off;
+    }
+}
+
+/*
+ * Fetch the entries for a whole Treaddir request with a single dispatch to
+ * the worker thread.  Returns the response size of the entries added to
+ * @entries, or a negative errno; the caller frees @entries in both cases.
+ */
+int coroutine_fn v9fs_co_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
+                                      V9fsDirEnt **entries, off_t offset,
+                                      int32_t maxsize)
+{
+    int err;
+
+    if (v9fs_request_cancelled(pdu)) {
+        return -EINTR;
+    }
+    v9fs_co_run_in_worker(
+        {
+            v9fs_readdir_lock(&fidp->fs.dir);
+            err = do_readdir_many(pdu, fidp, entries, offset, maxsize);
+            v9fs_readdir_unlock(&fidp->fs.dir);
+        });
+    return err;
+}
+
 off_t v9fs_co_telldir(V9fsPDU *pdu, V9fsFidState *fidp)
 {
     off_t err;
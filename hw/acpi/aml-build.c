@@ -401,6 +401,14 @@ void aml_append(Aml *parent_ctx, Aml *child)
     build_free_array(buf);
 }
 
+Aml *aml_raw(const uint8_t *data, unsigned len)
+{
+    Aml *var = aml_alloc();
+
+    g_array_append_vals(var->buf, data, len);
+    return var;
+}
+
 /* ACPI 1.0b: 16.2.5.1 Namespace Modifier Objects Encoding: DefScope */
 Aml *aml_scope(const char *name_format, ...)
 {
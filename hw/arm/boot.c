@@ -794,7 +794,8 @@ static void do_cpu_reset(void *opaque)
  * @size_key:       The firmware config key to store the size of the loaded
  *                  data under, with fw_cfg_add_i32().
  * @data_key:       The firmware config key to store the loaded data under,
- *                  with fw_cfg_add_bytes().
+ *                  with fw_cfg_add_bytes() or, for images that are not
+ *                  decompressed, fw_cfg_add_mapped_file().
  * @image_name:     The name of the image file to load. If it is NULL, the
  *                  function returns without doing anything.
  * @try_decompress: Whether the image should be decompressed (gunzipped) before
@@ -821,19 +822,13 @@ static void load_image_to_fw_cfg(FWCfgState *fw_cfg, uint16_t size_key,
     }
 
     if (size == (size_t)-1) {
-        gchar *contents;
-        gsize length;
-
-        if (!g_file_get_contents(image_name, &contents, &length, NULL)) {
-            error_report("failed to load \"%s\"", image_name);
-            exit(1);
-        }
-        size = length;
-        data = (uint8_t *)contents;
+        fw_cfg_add_mapped_file(fw_cfg, data_key, image_name, 0, &size,
+                               &error_fatal);
+    } else {
+        fw_cfg_add_bytes(fw_cfg, data_key, data, size);
     }
 
     fw_cfg_add_i32(fw_cfg, size_key, size);
-    fw_cfg_add_bytes(fw_cfg, data_key, data, size);
 }
 
 static int do_arm_linux_init(Object *obj, void *opaque)
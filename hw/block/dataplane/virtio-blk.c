@@ -43,6 +43,17 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * IOThreads from the iothread-vq-mapping property and the AioContext
+     * that handles each virtqueue.  Without the property every virtqueue
+     * runs in @ctx.  Requests are always submitted to and completed in the
+     * BlockBackend's AioContext, which is @ctx, so only virtqueue
+     * processing moves to the other threads.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    AioContext **vq_ctx;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -88,10 +99,17 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread && conf->iothread_vq_mapping) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties "
+                   "cannot be used together");
+        return false;
+    }
+
+    if (conf->iothread || conf->iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -120,13 +138,59 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->vdev = vdev;
     s->conf = conf;
 
+    if (conf->iothread_vq_mapping) {
+        char **ids = g_strsplit(conf->iothread_vq_mapping, ":", -1);
+        unsigned n = g_strv_length(ids);
+
+        if (n == 0) {
+            error_setg(errp, "iothread-vq-mapping must not be empty");
+            g_strfreev(ids);
+            g_free(s);
+            return false;
+        }
+
+        s->vq_iothreads = g_new0(IOThread *, n);
+        for (i = 0; i < n; i++) {
+            IOThread *iothread = iothread_by_id(ids[i]);
+
+            if (!iothread) {
+                error_setg(errp, "iothread '%s' in iothread-vq-mapping "
+                           "not found", ids[i]);
+                while (i--) {
+                    object_unref(OBJECT(s->vq_iothreads[i]));
+                }
+                g_free(s->vq_iothreads);
+                g_strfreev(ids);
+                g_free(s);
+                return false;
+            }
+            object_ref(OBJECT(iothread));
+            s->vq_iothreads[i] = iothread;
+        }
+        s->num_vq_iothreads = n;
+        g_strfreev(ids);
+    }
+
     if (conf->iothread) {
         s->iothread = conf->iothread;
         object_ref(OBJECT(s->iothread));
         s->ctx = iothread_get_aio_context(s->iothread);
+    } else if (s->num_vq_iothreads) {
+        s->ctx = iothread_get_aio_context(s->vq_iothreads[0]);
     } else {
         s->ctx = qemu_get_aio_context();
     }
+
+    s->vq_ctx = g_new(AioContext *, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        if (s->num_vq_iothreads) {
+            IOThread *iothread = s->vq_iothreads[i % s->num_vq_iothreads];
+            s->vq_ctx[i] = iothread_get_aio_context(iothread);
+        } else {
+            s->vq_ctx[i] = s->ctx;
+        }
+    }
+
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
@@ -139,6 +203,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -151,6 +216,11 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
     if (s->iothread) {
         object_unref(OBJECT(s->iothread));
     }
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_ctx);
     g_free(s);
 }
 
@@ -228,14 +298,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(s->vq_ctx[i]);
+        virtio_queue_aio_set_host_notifier_handler(vq, s->vq_ctx[i],
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(s->vq_ctx[i]);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -245,20 +315,16 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/* Stop notifications for new requests from guest on one virtqueue.
  *
- * Context: BH in IOThread
+ * Context: BH in the IOThread that handles the virtqueue
  */
-static void virtio_blk_data_plane_stop_bh(void *opaque)
+static void virtio_blk_data_plane_stop_vq_bh(void *opaque)
 {
-    VirtIOBlockDataPlane *s = opaque;
-    unsigned i;
+    VirtQueue *vq = opaque;
 
-    for (i = 0; i < s->conf->num_queues; i++) {
-        VirtQueue *vq = virtio_get_queue(s->vdev, i);
-
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
-    }
+    virtio_queue_aio_set_host_notifier_handler(vq,
+            qemu_get_current_aio_context(), NULL);
 }
 
 /* Context: QEMU global mutex held */
@@ -284,8 +350,16 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(s->vdev, i);
+
+        aio_context_acquire(s->vq_ctx[i]);
+        aio_wait_bh_oneshot(s->vq_ctx[i], virtio_blk_data_plane_stop_vq_bh,
+                            vq);
+        aio_context_release(s->vq_ctx[i]);
+    }
+
     aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
@@ -19,10 +19,25 @@
  *      -drive file=<file>,if=none,id=<drive_id>
  *      -device nvme,drive=<drive_id>,serial=<serial>,id=<id[optional]>, \
  *              cmb_size_mb=<cmb_size_mb[optional]>, \
- *              num_queues=<N[optional]>
+ *              num_queues=<N[optional]>, \
+ *              x-posted-doorbells=<on|off[optional]>, \
+ *              ioeventfd=<on|off[optional]>, \
+ *              iothread=<iothread_id[optional]>
  *
  * Note cmb_size_mb denotes size of CMB in MB. CMB is assumed to be at
  * offset 0 in BAR2 and supports only WDS, RDS and SQS for now.
+ *
+ * With x-posted-doorbells, doorbell writes are batched by the accelerator
+ * instead of exiting to QEMU each; see memory_region_add_posted_writes().
+ *
+ * The controller supports the Doorbell Buffer Config admin command.  Once
+ * the host has set up shadow doorbells, queue positions are read from guest
+ * memory and EventIdx tells the host when an MMIO doorbell write is needed.
+ * With ioeventfd, the remaining submission queue doorbell writes of I/O
+ * queues are signalled through an eventfd instead of an MMIO exit.
+ *
+ * With iothread, I/O queues are processed in that IOThread; the admin queue
+ * and interrupt delivery stay in the main loop.
  */
 
 #include "qemu/osdep.h"
@@ -36,6 +51,7 @@
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "sysemu/block-backend.h"
+#include "qemu/main-loop.h"
 
 #include "qemu/log.h"
 #include "qemu/module.h"
@@ -96,6 +112,77 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
+static bool nvme_sq_has_notifier(NvmeCtrl *n, uint16_t sqid)
+{
+    return sqid && (n->iothread || n->ioeventfd);
+}
+
+static void nvme_kick_sq(NvmeSQueue *sq)
+{
+    if (sq->timer) {
+        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    } else {
+        event_notifier_set(&sq->notifier);
+    }
+}
+
+static void nvme_kick_cq(NvmeCQueue *cq)
+{
+    if (cq->timer) {
+        timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    } else {
+        qemu_bh_schedule(cq->bh);
+    }
+}
+
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t tail;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &tail, sizeof(tail));
+    tail = le32_to_cpu(tail);
+    if (unlikely(tail >= sq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_sqtail,
+                       "shadow submission queue doorbell value"
+                       " beyond queue size, sqid=%"PRIu32","
+                       " new_tail=%"PRIu16", ignoring",
+                       (uint32_t)sq->sqid, (uint16_t)tail);
+        return;
+    }
+    sq->tail = tail;
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    uint32_t ei = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &ei, sizeof(ei));
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t head;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &head, sizeof(head));
+    head = le32_to_cpu(head);
+    if (unlikely(head >= cq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_cqhead,
+                       "shadow completion queue doorbell value"
+                       " beyond queue size, cqid=%"PRIu32","
+                       " new_head=%"PRIu16", ignoring",
+                       (uint32_t)cq->cqid, (uint16_t)head);
+        return;
+    }
+    cq->head = head;
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    uint32_t ei = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &ei, sizeof(ei));
+}
+
 static void nvme_irq_check(NvmeCtrl *n)
 {
     if (msix_enabled(&(n->parent_obj))) {
@@ -273,18 +360,44 @@ static uint16_t nvme_dma_read_prp(NvmeCtrl *n, uint8_t *ptr, uint32_t len,
     return status;
 }
 
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    NvmeCtrl *n = cq->ctrl;
+
+    aio_context_acquire(n->ctx);
+    if (cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    }
+    aio_context_release(n->ctx);
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
 
+    aio_context_acquire(n->ctx);
+    if (cq->db_addr) {
+        nvme_update_cq_head(cq);
+    }
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
 
         if (nvme_cq_full(cq)) {
-            break;
+            if (!cq->db_addr) {
+                break;
+            }
+            /* Ask for a doorbell write once the host consumes an entry */
+            nvme_update_cq_eventidx(cq);
+            smp_mb(); /* order EventIdx store before shadow head load */
+            nvme_update_cq_head(cq);
+            if (nvme_cq_full(cq)) {
+                break;
+            }
         }
 
         QTAILQ_REMOVE(&cq->req_list, req, entry);
@@ -299,8 +412,13 @@ static void nvme_post_cqes(void *opaque)
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
     if (cq->tail != cq->head) {
-        nvme_irq_assert(n, cq);
+        if (cq->irq_bh) {
+            qemu_bh_schedule(cq->irq_bh);
+        } else {
+            nvme_irq_assert(n, cq);
+        }
     }
+    aio_context_release(n->ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -308,7 +426,7 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
     assert(cq->cqid == req->sq->cqid);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
-    timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    nvme_kick_cq(cq);
 }
 
 static void nvme_rw_cb(void *opaque, int ret)
@@ -318,6 +436,7 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeCtrl *n = sq->ctrl;
     NvmeCQueue *cq = n->cq[sq->cqid];
 
+    aio_context_acquire(n->ctx);
     if (!ret) {
         block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
         req->status = NVME_SUCCESS;
@@ -329,6 +448,7 @@ static void nvme_rw_cb(void *opaque, int ret)
         qemu_sglist_destroy(&req->qsg);
     }
     nvme_enqueue_req_completion(cq, req);
+    aio_context_release(n->ctx);
 }
 
 static uint16_t nvme_flush(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -440,11 +560,52 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     }
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
+    }
+}
+
+static void nvme_init_sq_dbbuf(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+
+    /*
+     * The doorbell value is lost with an ioeventfd, so only use one once
+     * the tail can be read back from the shadow doorbell.
+     */
+    if (n->ioeventfd && !sq->ioeventfd_enabled) {
+        memory_region_add_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                  false, 0, &sq->notifier);
+        sq->ioeventfd_enabled = true;
+    }
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    if (sq->timer) {
+        timer_del(sq->timer);
+        timer_free(sq->timer);
+    }
+    if (nvme_sq_has_notifier(n, sq->sqid)) {
+        if (sq->ioeventfd_enabled) {
+            memory_region_del_eventfd(&n->iomem, 0x1000 + (sq->sqid << 3), 4,
+                                      false, 0, &sq->notifier);
+        }
+        if (n->iothread) {
+            aio_set_event_notifier(n->ctx, &sq->notifier, true, NULL, NULL);
+        } else {
+            event_notifier_set_handler(&sq->notifier, NULL);
+        }
+        event_notifier_cleanup(&sq->notifier);
+    }
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -509,7 +670,19 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    if (n->iothread && sqid) {
+        sq->timer = NULL;
+        aio_set_event_notifier(n->ctx, &sq->notifier, true,
+                               nvme_sq_notifier, NULL);
+    } else {
+        sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+        if (nvme_sq_has_notifier(n, sqid)) {
+            event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+        }
+    }
+    if (n->dbbuf_enabled && sqid) {
+        nvme_init_sq_dbbuf(sq);
+    }
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
@@ -551,15 +724,33 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_FIELD | NVME_DNR;
     }
     sq = g_malloc0(sizeof(*sq));
+    if (nvme_sq_has_notifier(n, sqid) &&
+        event_notifier_init(&sq->notifier, 0) < 0) {
+        g_free(sq);
+        return NVME_INTERNAL_DEV_ERROR;
+    }
     nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1);
     return NVME_SUCCESS;
 }
 
+static void nvme_init_cq_dbbuf(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
-    timer_del(cq->timer);
-    timer_free(cq->timer);
+    if (cq->timer) {
+        timer_del(cq->timer);
+        timer_free(cq->timer);
+    } else {
+        qemu_bh_delete(cq->bh);
+        qemu_bh_delete(cq->irq_bh);
+    }
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -603,7 +794,17 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    if (n->iothread && cqid) {
+        cq->timer = NULL;
+        cq->bh = aio_bh_new(n->ctx, nvme_post_cqes, cq);
+        cq->irq_bh = qemu_bh_new(nvme_irq_bh, cq);
+    } else {
+        cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+        cq->bh = cq->irq_bh = NULL;
+    }
+    if (n->dbbuf_enabled && cqid) {
+        nvme_init_cq_dbbuf(cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -844,6 +1045,36 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    int i;
+
+    trace_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    if (unlikely(!dbs_addr || dbs_addr & (n->page_size - 1) ||
+                 !eis_addr || eis_addr & (n->page_size - 1))) {
+        trace_nvme_err_invalid_dbbuf_addr(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    /* Shadow doorbells only cover the I/O queues */
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n->sq[i]);
+        }
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n->cq[i]);
+        }
+    }
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     switch (cmd->opcode) {
@@ -861,6 +1092,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         trace_nvme_err_invalid_admin_opc(cmd->opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
@@ -878,6 +1111,12 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    aio_context_acquire(n->ctx);
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
+
+process:
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
@@ -896,12 +1135,27 @@ static void nvme_process_sq(void *opaque)
             nvme_enqueue_req_completion(cq, req);
         }
     }
+
+    if (sq->db_addr) {
+        /*
+         * Ask for a doorbell write on the next submission, then catch any
+         * entry the host added before it could see the new EventIdx.
+         */
+        nvme_update_sq_eventidx(sq);
+        smp_mb(); /* order EventIdx store before shadow tail load */
+        nvme_update_sq_tail(sq);
+        if (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
+            goto process;
+        }
+    }
+    aio_context_release(n->ctx);
 }
 
 static void nvme_clear_ctrl(NvmeCtrl *n)
 {
     int i;
 
+    aio_context_acquire(n->ctx);
     blk_drain(n->conf.blk);
 
     for (i = 0; i < n->num_queues; i++) {
@@ -916,6 +1170,11 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
     }
 
     blk_flush(n->conf.blk);
+    aio_context_release(n->ctx);
+
+    n->dbbuf_enabled = false;
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
     n->bar.cc = 0;
 }
 
@@ -1221,9 +1480,9 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+                nvme_kick_sq(sq);
             }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+            nvme_kick_cq(cq);
         }
 
         if (cq->tail == cq->head) {
@@ -1255,7 +1514,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         }
 
         sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        nvme_kick_sq(sq);
     }
 }
 
@@ -1266,7 +1525,9 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
     if (addr < sizeof(n->bar)) {
         nvme_write_bar(n, addr, data, size);
     } else if (addr >= 0x1000) {
+        aio_context_acquire(n->ctx);
         nvme_process_db(n, addr, data);
+        aio_context_release(n->ctx);
     }
 }
 
@@ -1338,6 +1599,15 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         return;
     }
 
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+        if (blk_set_aio_context(n->conf.blk, n->ctx, errp) < 0) {
+            return;
+        }
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
+
     pci_conf = pci_dev->config;
     pci_conf[PCI_INTERRUPT_PIN] = 1;
     pci_config_set_prog_interface(pci_dev->config, 0x2);
@@ -1354,6 +1624,11 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
 
     memory_region_init_io(&n->iomem, OBJECT(n), &nvme_mmio_ops, n,
                           "nvme", n->reg_size);
+    if (n->posted_doorbells) {
+        /* Doorbells only kick the queue timers, they can be posted */
+        memory_region_add_posted_writes(&n->iomem, 0x1000,
+                                        n->reg_size - 0x1000);
+    }
     pci_register_bar(pci_dev, 0,
         PCI_BASE_ADDRESS_SPACE_MEMORY | PCI_BASE_ADDRESS_MEM_TYPE_64,
         &n->iomem);
@@ -1368,7 +1643,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
@@ -1438,6 +1713,11 @@ static void nvme_exit(PCIDevice *pci_dev)
     NvmeCtrl *n = NVME(pci_dev);
 
     nvme_clear_ctrl(n);
+    if (n->iothread) {
+        aio_context_acquire(n->ctx);
+        blk_set_aio_context(n->conf.blk, qemu_get_aio_context(), NULL);
+        aio_context_release(n->ctx);
+    }
     g_free(n->namespaces);
     g_free(n->cq);
     g_free(n->sq);
@@ -1453,6 +1733,10 @@ static Property nvme_props[] = {
     DEFINE_PROP_STRING("serial", NvmeCtrl, serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, num_queues, 64),
+    DEFINE_PROP_BOOL("x-posted-doorbells", NvmeCtrl, posted_doorbells, false),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
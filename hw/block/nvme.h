@@ -1,6 +1,7 @@
 #ifndef HW_NVME_H
 #define HW_NVME_H
 #include "block/nvme.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeAsyncEvent {
     QSIMPLEQ_ENTRY(NvmeAsyncEvent) entry;
@@ -27,7 +28,11 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
     QEMUTimer   *timer;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
     NvmeRequest *io_req;
     QTAILQ_HEAD(, NvmeRequest) req_list;
     QTAILQ_HEAD(, NvmeRequest) out_req_list;
@@ -44,7 +49,11 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
     QEMUTimer   *timer;
+    QEMUBH      *bh;
+    QEMUBH      *irq_bh;
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -75,6 +84,13 @@ typedef struct NvmeCtrl {
     uint32_t    max_q_ents;
     uint64_t    ns_size;
     uint32_t    cmb_size_mb;
+    bool        posted_doorbells;
+    bool        ioeventfd;
+    IOThread    *iothread;
+    AioContext  *ctx;
+    bool        dbbuf_enabled;
+    uint64_t    dbbuf_dbs;
+    uint64_t    dbbuf_eis;
     uint32_t    cmbsz;
     uint32_t    cmbloc;
     uint8_t     *cmbuf;
@@ -71,6 +71,15 @@ static void virtio_blk_free_request(VirtIOBlockReq *req)
     g_free(req);
 }
 
+static void virtio_blk_notify(VirtIOBlock *s, VirtQueue *vq)
+{
+    if (s->dataplane_started && !s->dataplane_disabled) {
+        virtio_blk_data_plane_notify(s->dataplane, vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(s), vq);
+    }
+}
+
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
@@ -80,10 +89,38 @@ static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 
     stb_p(&req->in->status, status);
     virtqueue_push(req->vq, &req->elem, req->in_len);
-    if (s->dataplane_started && !s->dataplane_disabled) {
-        virtio_blk_data_plane_notify(s->dataplane, req->vq);
-    } else {
-        virtio_notify(vdev, req->vq);
+    virtio_blk_notify(s, req->vq);
+}
+
+/* Complete successful requests from the same virtqueue with a single used
+ * index update and notification, then free them.
+ */
+static void virtio_blk_req_complete_batch(VirtIOBlock *s,
+                                          VirtIOBlockReq **reqs,
+                                          unsigned int n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtQueueElement *elems[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int lens[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int i;
+
+    if (!n) {
+        return;
+    }
+
+    assert(n <= VIRTIO_BLK_MAX_MERGE_REQS);
+    for (i = 0; i < n; i++) {
+        trace_virtio_blk_req_complete(vdev, reqs[i], VIRTIO_BLK_S_OK);
+        stb_p(&reqs[i]->in->status, VIRTIO_BLK_S_OK);
+        elems[i] = &reqs[i]->elem;
+        lens[i] = reqs[i]->in_len;
+    }
+    virtqueue_push_batch(reqs[0]->vq, elems, lens, n);
+    virtio_blk_notify(s, reqs[0]->vq);
+
+    for (i = 0; i < n; i++) {
+        block_acct_done(blk_get_stats(s->blk), &reqs[i]->acct);
+        virtio_blk_free_request(reqs[i]);
     }
 }
 
@@ -116,6 +153,8 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
     VirtIOBlockReq *next = opaque;
     VirtIOBlock *s = next->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtIOBlockReq *done[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_done = 0;
 
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     while (next) {
@@ -146,10 +185,15 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
             }
         }
 
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        block_acct_done(blk_get_stats(s->blk), &req->acct);
-        virtio_blk_free_request(req);
+        /* Merged requests may come from different virtqueues */
+        if (num_done == ARRAY_SIZE(done) ||
+            (num_done && done[0]->vq != req->vq)) {
+            virtio_blk_req_complete_batch(s, done, num_done);
+            num_done = 0;
+        }
+        done[num_done++] = req;
     }
+    virtio_blk_req_complete_batch(s, done, num_done);
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
 }
 
@@ -250,14 +294,17 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, n;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -761,9 +808,10 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
     MultiReqBuffer mrb = {};
     bool progress = false;
+    unsigned int i, n;
 
     aio_context_acquire(blk_get_aio_context(s->blk));
     blk_io_plug(s->blk);
@@ -771,11 +819,21 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     do {
         virtio_queue_set_notification(vq, 0);
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while ((n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                virtio_blk_free_request(reqs[i]);
+                /* Give back the requests that were popped but not handled */
+                while (--n > i) {
+                    virtqueue_unpop(vq, &reqs[n]->elem, 0);
+                    virtio_blk_free_request(reqs[n]);
+                }
                 break;
             }
         }
@@ -1051,7 +1109,7 @@ static void virtio_blk_save_device(VirtIODevice *vdev, QEMUFile *f)
             qemu_put_be32(f, virtio_get_queue_index(req->vq));
         }
 
-        qemu_put_virtqueue_element(f, &req->elem);
+        qemu_put_virtqueue_element(vdev, f, &req->elem);
         req = req->next;
     }
     qemu_put_sbyte(f, 0);
@@ -1180,6 +1238,8 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    qemu_coroutine_increase_pool_batch_size(conf->num_queues *
+                                            conf->queue_size / 2);
 
     s->change = qemu_add_vm_change_state_handler(virtio_blk_dma_restart_cb, s);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
@@ -1192,7 +1252,10 @@ static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
+    VirtIOBlkConf *conf = &s->conf;
 
+    qemu_coroutine_decrease_pool_batch_size(conf->num_queues *
+                                            conf->queue_size / 2);
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
     qemu_del_vm_change_state_handler(s->change);
@@ -1236,6 +1299,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 128),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOBlock,
+                       conf.iothread_vq_mapping),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BIT64("write-zeroes", VirtIOBlock, host_features,
@@ -381,6 +381,7 @@ static void cpu_common_finalize(Object *obj)
     CPUState *cpu = CPU(obj);
 
     qemu_mutex_destroy(&cpu->work_mutex);
+    g_free(cpu->qom_path);
 }
 
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
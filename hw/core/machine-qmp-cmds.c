@@ -161,6 +161,12 @@ static void cpustate_to_cpuinfo_s390(CpuInfoS390 *info, const CPUState *cpu)
 /*
  * fast means: we NEVER interrupt vCPU threads to retrieve
  * information from KVM.
+ *
+ * This may run out-of-band in the monitor I/O thread, without the BQL.
+ * The CPU list is walked under cpu_list_lock, which keeps CPUs from being
+ * unplugged under our feet, and only fields that do not change once the
+ * CPU is on the list (or single words read racily) are looked at; the QOM
+ * tree itself must not be walked here.
  */
 CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
 {
@@ -171,13 +177,14 @@ CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
                                           -1, &error_abort);
     CPUState *cpu;
 
+    cpu_list_lock();
     CPU_FOREACH(cpu) {
         CpuInfoFastList *info = g_malloc0(sizeof(*info));
         info->value = g_malloc0(sizeof(*info->value));
 
         info->value->cpu_index = cpu->cpu_index;
-        info->value->qom_path = object_get_canonical_path(OBJECT(cpu));
-        info->value->thread_id = cpu->thread_id;
+        info->value->qom_path = g_strdup(cpu->qom_path ?: "");
+        info->value->thread_id = atomic_read(&cpu->thread_id);
 
         info->value->has_props = !!mc->cpu_index_to_instance_props;
         if (info->value->has_props) {
@@ -200,6 +207,7 @@ CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
             cur_item = info;
         }
     }
+    cpu_list_unlock();
 
     return head;
 }
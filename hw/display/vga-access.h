@@ -22,6 +22,23 @@
  * THE SOFTWARE.
  */
 
+/*
+ * Return a host pointer to the @len bytes of video memory starting at @addr,
+ * or NULL if they wrap around the end of video memory or @addr is not
+ * aligned to @align bytes.
+ */
+static inline const uint8_t *vga_vram_span(VGACommonState *vga, uint32_t addr,
+                                           uint32_t len, uint32_t align)
+{
+    uint32_t offset = addr & vga->vbe_size_mask;
+
+    if ((offset & (align - 1)) ||
+        (uint64_t)offset + len > (uint64_t)vga->vbe_size_mask + 1) {
+        return NULL;
+    }
+    return vga->vram_ptr + offset;
+}
+
 static inline uint8_t vga_read_byte(VGACommonState *vga, uint32_t addr)
 {
     return vga->vram_ptr[addr & vga->vbe_size_mask];
@@ -22,6 +22,10 @@
  * THE SOFTWARE.
  */
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static inline void vga_draw_glyph_line(uint8_t *d, uint32_t font_data,
                                        uint32_t xorcol, uint32_t bgcol)
 {
@@ -278,15 +282,69 @@ static void vga_draw_line8(VGACommonState *vga, uint8_t *d,
     }
 }
 
+/*
+ * Convert a contiguous line of 15 or 16 bit pixels.  The scanline loops
+ * below go through vga_read_word_*() for every pixel, which is only needed
+ * when the line wraps around the end of video memory.
+ */
+static void vga_convert_line_hicolor(uint8_t *d, const uint8_t *s, int width,
+                                     bool rgb565, bool big_endian)
+{
+    int rshift = rgb565 ? 8 : 7;
+    int gshift = rgb565 ? 3 : 2;
+    uint32_t gmask = rgb565 ? 0xfc : 0xf8;
+    uint32_t v, r, g, b;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i rbmask = _mm_set1_epi16(0xf8);
+    const __m128i gmask8 = _mm_set1_epi16(gmask);
+
+    for (; i + 8 <= width; i += 8) {
+        __m128i pix = _mm_loadu_si128((const __m128i *)(s + i * 2));
+        __m128i r8, g8, b8, bg;
+
+        if (big_endian) {
+            pix = _mm_or_si128(_mm_slli_epi16(pix, 8), _mm_srli_epi16(pix, 8));
+        }
+        r8 = _mm_and_si128(_mm_srl_epi16(pix, _mm_cvtsi32_si128(rshift)),
+                           rbmask);
+        g8 = _mm_and_si128(_mm_srl_epi16(pix, _mm_cvtsi32_si128(gshift)),
+                           gmask8);
+        b8 = _mm_and_si128(_mm_slli_epi16(pix, 3), rbmask);
+
+        /* 16-bit lanes of b | g << 8 and r, interleaved into 0x00rrggbb */
+        bg = _mm_or_si128(b8, _mm_slli_epi16(g8, 8));
+        _mm_storeu_si128((__m128i *)(d + i * 4), _mm_unpacklo_epi16(bg, r8));
+        _mm_storeu_si128((__m128i *)(d + i * 4 + 16),
+                         _mm_unpackhi_epi16(bg, r8));
+    }
+#endif
+
+    for (; i < width; i++) {
+        v = big_endian ? lduw_be_p(s + i * 2) : lduw_le_p(s + i * 2);
+        r = (v >> rshift) & 0xf8;
+        g = (v >> gshift) & gmask;
+        b = (v << 3) & 0xf8;
+        ((uint32_t *)d)[i] = rgb_to_pixel32(r, g, b);
+    }
+}
+
 /*
  * 15 bit color
  */
 static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s = vga_vram_span(vga, addr, width * 2, 2);
     int w;
     uint32_t v, r, g, b;
 
+    if (s) {
+        vga_convert_line_hicolor(d, s, width, false, false);
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -302,9 +360,15 @@ static void vga_draw_line15_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s = vga_vram_span(vga, addr, width * 2, 2);
     int w;
     uint32_t v, r, g, b;
 
+    if (s) {
+        vga_convert_line_hicolor(d, s, width, false, true);
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -323,9 +387,15 @@ static void vga_draw_line15_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s = vga_vram_span(vga, addr, width * 2, 2);
     int w;
     uint32_t v, r, g, b;
 
+    if (s) {
+        vga_convert_line_hicolor(d, s, width, true, false);
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_le(vga, addr);
@@ -341,9 +411,15 @@ static void vga_draw_line16_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
+    const uint8_t *s = vga_vram_span(vga, addr, width * 2, 2);
     int w;
     uint32_t v, r, g, b;
 
+    if (s) {
+        vga_convert_line_hicolor(d, s, width, true, true);
+        return;
+    }
+
     w = width;
     do {
         v = vga_read_word_be(vga, addr);
@@ -362,9 +438,18 @@ static void vga_draw_line16_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_vram_span(vga, addr, width * 3, 1);
+    int i, w;
     uint32_t r, g, b;
 
+    if (s) {
+        for (i = 0; i < width; i++) {
+            ((uint32_t *)d)[i] = rgb_to_pixel32(s[2], s[1], s[0]);
+            s += 3;
+        }
+        return;
+    }
+
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -379,9 +464,18 @@ static void vga_draw_line24_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_vram_span(vga, addr, width * 3, 1);
+    int i, w;
     uint32_t r, g, b;
 
+    if (s) {
+        for (i = 0; i < width; i++) {
+            ((uint32_t *)d)[i] = rgb_to_pixel32(s[0], s[1], s[2]);
+            s += 3;
+        }
+        return;
+    }
+
     w = width;
     do {
         r = vga_read_byte(vga, addr + 0);
@@ -399,9 +493,18 @@ static void vga_draw_line24_be(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_vram_span(vga, addr, width * 4, 1);
+    int i, w;
     uint32_t r, g, b;
 
+    if (s) {
+        for (i = 0; i < width; i++) {
+            ((uint32_t *)d)[i] = ldl_le_p(s) & 0xffffff;
+            s += 4;
+        }
+        return;
+    }
+
     w = width;
     do {
         b = vga_read_byte(vga, addr + 0);
@@ -416,9 +519,18 @@ static void vga_draw_line32_le(VGACommonState *vga, uint8_t *d,
 static void vga_draw_line32_be(VGACommonState *vga, uint8_t *d,
                                uint32_t addr, int width)
 {
-    int w;
+    const uint8_t *s = vga_vram_span(vga, addr, width * 4, 1);
+    int i, w;
     uint32_t r, g, b;
 
+    if (s) {
+        for (i = 0; i < width; i++) {
+            ((uint32_t *)d)[i] = ldl_be_p(s) & 0xffffff;
+            s += 4;
+        }
+        return;
+    }
+
     w = width;
     do {
         r = vga_read_byte(vga, addr + 1);
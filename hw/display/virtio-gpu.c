@@ -361,6 +361,9 @@ static void virtio_gpu_resource_destroy(VirtIOGPU *g,
     }
 
     pixman_image_unref(res->image);
+    if (res->host_image) {
+        pixman_image_unref(res->host_image);
+    }
     virtio_gpu_cleanup_mapping(g, res);
     QTAILQ_REMOVE(&g->reslist, res, next);
     g->hostmem -= res->hostmem;
@@ -423,6 +426,11 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
         return;
     }
 
+    if (res->host_image) {
+        /* The image is the guest backing, nothing to copy */
+        return;
+    }
+
     format = pixman_image_get_format(res->image);
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
@@ -517,14 +525,143 @@ static void virtio_unref_resource(pixman_image_t *image, void *data)
     pixman_image_unref(data);
 }
 
+/*
+ * Point the surface of scanout @scanout_id at rectangle @r of the image of
+ * @res, unless it already shows it.  Returns false if the surface could not
+ * be created.
+ */
+static bool
+virtio_gpu_update_scanout_surface(VirtIOGPU *g, uint32_t scanout_id,
+                                  struct virtio_gpu_simple_resource *res,
+                                  struct virtio_gpu_rect *r)
+{
+    struct virtio_gpu_scanout *scanout = &g->parent_obj.scanout[scanout_id];
+    pixman_format_code_t format;
+    uint32_t offset;
+    int bpp;
+
+    format = pixman_image_get_format(res->image);
+    bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
+    offset = (r->x * bpp) + r->y * pixman_image_get_stride(res->image);
+    if (!scanout->ds || surface_data(scanout->ds)
+        != ((uint8_t *)pixman_image_get_data(res->image) + offset) ||
+        scanout->width != r->width ||
+        scanout->height != r->height) {
+        pixman_image_t *rect;
+        void *ptr = (uint8_t *)pixman_image_get_data(res->image) + offset;
+        rect = pixman_image_create_bits(format, r->width, r->height, ptr,
+                                        pixman_image_get_stride(res->image));
+        pixman_image_ref(res->image);
+        pixman_image_set_destroy_function(rect, virtio_unref_resource,
+                                          res->image);
+        /* realloc the surface ptr */
+        scanout->ds = qemu_create_displaysurface_pixman(rect);
+        if (!scanout->ds) {
+            return false;
+        }
+        pixman_image_unref(rect);
+        dpy_gfx_replace_surface(scanout->con, scanout->ds);
+    }
+    return true;
+}
+
+/* Switch @res over to @image and move its scanouts along */
+static void
+virtio_gpu_resource_replace_image(VirtIOGPU *g,
+                                  struct virtio_gpu_simple_resource *res,
+                                  pixman_image_t *image)
+{
+    pixman_image_t *old = res->image;
+    int i;
+
+    res->image = image;
+    for (i = 0; i < g->parent_obj.conf.max_outputs; i++) {
+        struct virtio_gpu_scanout *scanout = &g->parent_obj.scanout[i];
+        struct virtio_gpu_rect r = {
+            .x = scanout->x,
+            .y = scanout->y,
+            .width = scanout->width,
+            .height = scanout->height,
+        };
+
+        if (!(res->scanout_bitmask & (1 << i))) {
+            continue;
+        }
+        if (!virtio_gpu_update_scanout_surface(g, i, res, &r)) {
+            virtio_gpu_disable_scanout(g, i);
+        }
+    }
+    pixman_image_unref(old);
+}
+
+/*
+ * With zero-copy enabled, use the guest backing of @res as its image when
+ * it is contiguous in host memory, so that transfers need no copy and the
+ * scanout surfaces show the guest pages directly.  The backing has the
+ * layout of the image already, transfers use the image stride.
+ */
+static void
+virtio_gpu_resource_map_image(VirtIOGPU *g,
+                              struct virtio_gpu_simple_resource *res)
+{
+    int stride = pixman_image_get_stride(res->image);
+    pixman_image_t *image;
+    uint8_t *base;
+    int i;
+
+    if (!virtio_gpu_zero_copy_enabled(g->parent_obj.conf) ||
+        res->host_image || !res->iov_cnt) {
+        return;
+    }
+
+    base = res->iov[0].iov_base;
+    if ((uintptr_t)base % sizeof(uint32_t)) {
+        return;
+    }
+    for (i = 1; i < res->iov_cnt; i++) {
+        if ((uint8_t *)res->iov[i - 1].iov_base + res->iov[i - 1].iov_len !=
+            res->iov[i].iov_base) {
+            return;
+        }
+    }
+    if (iov_size(res->iov, res->iov_cnt) < (size_t)stride * res->height) {
+        return;
+    }
+
+    image = pixman_image_create_bits(pixman_image_get_format(res->image),
+                                     res->width, res->height,
+                                     (uint32_t *)base, stride);
+    if (!image) {
+        return;
+    }
+
+    /* Keep the host copy for when the backing goes away */
+    res->host_image = pixman_image_ref(res->image);
+    virtio_gpu_resource_replace_image(g, res, image);
+}
+
+/* Copy the guest backing of @res back into its host image */
+static void
+virtio_gpu_resource_unmap_image(VirtIOGPU *g,
+                                struct virtio_gpu_simple_resource *res)
+{
+    pixman_image_t *image = res->host_image;
+
+    if (!image) {
+        return;
+    }
+
+    memcpy(pixman_image_get_data(image), pixman_image_get_data(res->image),
+           pixman_image_get_stride(image) * res->height);
+    res->host_image = NULL;
+    virtio_gpu_resource_replace_image(g, res, image);
+}
+
 static void virtio_gpu_set_scanout(VirtIOGPU *g,
                                    struct virtio_gpu_ctrl_command *cmd)
 {
     struct virtio_gpu_simple_resource *res, *ores;
     struct virtio_gpu_scanout *scanout;
-    pixman_format_code_t format;
-    uint32_t offset;
-    int bpp;
     struct virtio_gpu_set_scanout ss;
 
     VIRTIO_GPU_FILL_CMD(ss);
@@ -572,29 +709,9 @@ static void virtio_gpu_set_scanout(VirtIOGPU *g,
 
     scanout = &g->parent_obj.scanout[ss.scanout_id];
 
-    format = pixman_image_get_format(res->image);
-    bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
-    offset = (ss.r.x * bpp) + ss.r.y * pixman_image_get_stride(res->image);
-    if (!scanout->ds || surface_data(scanout->ds)
-        != ((uint8_t *)pixman_image_get_data(res->image) + offset) ||
-        scanout->width != ss.r.width ||
-        scanout->height != ss.r.height) {
-        pixman_image_t *rect;
-        void *ptr = (uint8_t *)pixman_image_get_data(res->image) + offset;
-        rect = pixman_image_create_bits(format, ss.r.width, ss.r.height, ptr,
-                                        pixman_image_get_stride(res->image));
-        pixman_image_ref(res->image);
-        pixman_image_set_destroy_function(rect, virtio_unref_resource,
-                                          res->image);
-        /* realloc the surface ptr */
-        scanout->ds = qemu_create_displaysurface_pixman(rect);
-        if (!scanout->ds) {
-            cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
-            return;
-        }
-        pixman_image_unref(rect);
-        dpy_gfx_replace_surface(g->parent_obj.scanout[ss.scanout_id].con,
-                                scanout->ds);
+    if (!virtio_gpu_update_scanout_surface(g, ss.scanout_id, res, &ss.r)) {
+        cmd->error = VIRTIO_GPU_RESP_ERR_UNSPEC;
+        return;
     }
 
     ores = virtio_gpu_find_resource(g, scanout->resource_id);
@@ -726,6 +843,7 @@ virtio_gpu_resource_attach_backing(VirtIOGPU *g,
     }
 
     res->iov_cnt = ab.nr_entries;
+    virtio_gpu_resource_map_image(g, res);
 }
 
 static void
@@ -746,6 +864,7 @@ virtio_gpu_resource_detach_backing(VirtIOGPU *g,
         cmd->error = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
         return;
     }
+    virtio_gpu_resource_unmap_image(g, res);
     virtio_gpu_cleanup_mapping(g, res);
 }
 
@@ -1071,6 +1190,7 @@ static int virtio_gpu_load(QEMUFile *f, void *opaque, size_t size,
 
         QTAILQ_INSERT_HEAD(&g->reslist, res, next);
         g->hostmem += res->hostmem;
+        virtio_gpu_resource_map_image(g, res);
 
         resource_id = qemu_get_be32(f);
     }
@@ -1232,6 +1352,8 @@ static Property virtio_gpu_properties[] = {
     VIRTIO_GPU_BASE_PROPERTIES(VirtIOGPU, parent_obj.conf),
     DEFINE_PROP_SIZE("max_hostmem", VirtIOGPU, conf_max_hostmem,
                      256 * MiB),
+    DEFINE_PROP_BIT("zero-copy", VirtIOGPU, parent_obj.conf.flags,
+                    VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED, false),
 #ifdef CONFIG_VIRGL
     DEFINE_PROP_BIT("virgl", VirtIOGPU, parent_obj.conf.flags,
                     VIRTIO_GPU_FLAG_VIRGL_ENABLED, true),
@@ -1821,6 +1821,78 @@ static void build_smb0(Aml *table, I2CBus *smbus, int devnr, int func)
     aml_append(table, scope);
 }
 
+/*
+ * For guests with many vCPUs or memory slots, the CPU and memory hotplug
+ * AML is the bulk of the DSDT, and the tables are rebuilt after every reset
+ * and hotplug.  That AML describes all possible CPUs and slots, so besides
+ * the machine configuration it only depends on which CPUs are present:
+ * keep the encoded bytes and reuse them until that changes.
+ */
+static struct {
+    GByteArray *key;
+    GArray *aml;
+} hotplug_aml_cache;
+
+static GByteArray *build_hotplug_aml_key(MachineState *machine,
+                                         AcpiPmInfo *pm, uint32_t nr_mem)
+{
+    MachineClass *mc = MACHINE_GET_CLASS(machine);
+    const CPUArchIdList *arch_ids = mc->possible_cpu_arch_ids(machine);
+    GByteArray *key = g_byte_array_new();
+    int i;
+
+    g_byte_array_append(key, (guint8 *)&pm->cpu_hp_io_base,
+                        sizeof(pm->cpu_hp_io_base));
+    g_byte_array_append(key, (guint8 *)&nr_mem, sizeof(nr_mem));
+    for (i = 0; i < arch_ids->len; i++) {
+        guint8 present = arch_ids->cpus[i].cpu != NULL;
+
+        g_byte_array_append(key, (guint8 *)&arch_ids->cpus[i].arch_id,
+                            sizeof(arch_ids->cpus[i].arch_id));
+        g_byte_array_append(key, &present, 1);
+    }
+    return key;
+}
+
+static void build_hotplug_aml(Aml *table, MachineState *machine,
+                              AcpiPmInfo *pm, uint32_t nr_mem)
+{
+    PCMachineClass *pcmc = PC_MACHINE_GET_CLASS(machine);
+    GByteArray *key = build_hotplug_aml_key(machine, pm, nr_mem);
+    GByteArray *old_key = hotplug_aml_cache.key;
+    Aml *aml;
+
+    if (!old_key || old_key->len != key->len ||
+        memcmp(old_key->data, key->data, key->len)) {
+        aml = aml_raw(NULL, 0);
+        if (pcmc->legacy_cpu_hotplug) {
+            build_legacy_cpu_hotplug_aml(aml, machine, pm->cpu_hp_io_base);
+        } else {
+            CPUHotplugFeatures opts = {
+                .acpi_1_compatible = true, .has_legacy_cphp = true
+            };
+            build_cpus_aml(aml, machine, opts, pm->cpu_hp_io_base,
+                           "\\_SB.PCI0", "\\_GPE._E02");
+        }
+        build_memory_hotplug_aml(aml, nr_mem, "\\_SB.PCI0", "\\_GPE._E03");
+
+        if (old_key) {
+            g_byte_array_free(old_key, true);
+            g_array_free(hotplug_aml_cache.aml, true);
+        }
+        hotplug_aml_cache.key = key;
+        hotplug_aml_cache.aml = g_array_sized_new(false, false, 1,
+                                                  aml->buf->len);
+        g_array_append_vals(hotplug_aml_cache.aml, aml->buf->data,
+                            aml->buf->len);
+    } else {
+        g_byte_array_free(key, true);
+    }
+
+    aml_append(table, aml_raw((uint8_t *)hotplug_aml_cache.aml->data,
+                              hotplug_aml_cache.aml->len));
+}
+
 static void
 build_dsdt(GArray *table_data, BIOSLinker *linker,
            AcpiPmInfo *pm, AcpiMiscInfo *misc,
@@ -1879,16 +1951,7 @@ build_dsdt(GArray *table_data, BIOSLinker *linker,
         }
     }
 
-    if (pcmc->legacy_cpu_hotplug) {
-        build_legacy_cpu_hotplug_aml(dsdt, machine, pm->cpu_hp_io_base);
-    } else {
-        CPUHotplugFeatures opts = {
-            .acpi_1_compatible = true, .has_legacy_cphp = true
-        };
-        build_cpus_aml(dsdt, machine, opts, pm->cpu_hp_io_base,
-                       "\\_SB.PCI0", "\\_GPE._E02");
-    }
-    build_memory_hotplug_aml(dsdt, nr_mem, "\\_SB.PCI0", "\\_GPE._E03");
+    build_hotplug_aml(dsdt, machine, pm, nr_mem);
 
     scope =  aml_scope("_GPE");
     {
@@ -110,6 +110,12 @@ static const char *AHCIPortIRQ_lookup[AHCI_PORT_IRQ__COUNT] = {
     [AHCI_PORT_IRQ_BIT_CPDS] = "CPDS"
 };
 
+AioContext *ahci_get_aio_context(AHCIState *s)
+{
+    return s->iothread ? iothread_get_aio_context(s->iothread) :
+                         qemu_get_aio_context();
+}
+
 static uint32_t ahci_port_read(AHCIState *s, int port, int offset)
 {
     uint32_t val;
@@ -456,20 +462,9 @@ static uint64_t ahci_mem_read(void *opaque, hwaddr addr, unsigned size)
 }
 
 
-static void ahci_mem_write(void *opaque, hwaddr addr,
-                           uint64_t val, unsigned size)
+static void ahci_mem_write_locked(AHCIState *s, hwaddr addr,
+                                  uint64_t val, unsigned size)
 {
-    AHCIState *s = opaque;
-
-    trace_ahci_mem_write(s, size, addr, val);
-
-    /* Only aligned reads are allowed on AHCI */
-    if (addr & 3) {
-        fprintf(stderr, "ahci: Mis-aligned write to addr 0x"
-                TARGET_FMT_plx "\n", addr);
-        return;
-    }
-
     if (addr < AHCI_GENERIC_HOST_CONTROL_REGS_MAX_ADDR) {
         enum AHCIHostReg regnum = addr / 4;
         assert(regnum < AHCI_HOST_REG__COUNT);
@@ -520,6 +515,26 @@ static void ahci_mem_write(void *opaque, hwaddr addr,
     }
 }
 
+static void ahci_mem_write(void *opaque, hwaddr addr,
+                           uint64_t val, unsigned size)
+{
+    AHCIState *s = opaque;
+    AioContext *ctx = ahci_get_aio_context(s);
+
+    trace_ahci_mem_write(s, size, addr, val);
+
+    /* Only aligned reads are allowed on AHCI */
+    if (addr & 3) {
+        fprintf(stderr, "ahci: Mis-aligned write to addr 0x"
+                TARGET_FMT_plx "\n", addr);
+        return;
+    }
+
+    aio_context_acquire(ctx);
+    ahci_mem_write_locked(s, addr, val, size);
+    aio_context_release(ctx);
+}
+
 static const MemoryRegionOps ahci_mem_ops = {
     .read = ahci_mem_read,
     .write = ahci_mem_write,
@@ -599,11 +614,14 @@ static void check_cmd(AHCIState *s, int port)
 static void ahci_check_cmd_bh(void *opaque)
 {
     AHCIDevice *ad = opaque;
+    AioContext *ctx = ahci_get_aio_context(ad->hba);
 
     qemu_bh_delete(ad->check_bh);
     ad->check_bh = NULL;
 
+    aio_context_acquire(ctx);
     check_cmd(ad->hba, ad->port_no);
+    aio_context_release(ctx);
 }
 
 static void ahci_init_d2h(AHCIDevice *ad)
@@ -672,11 +690,11 @@ static void ahci_reset_port(AHCIState *s, int port)
         }
 
         if (ncq_tfs->aiocb) {
-            blk_aio_cancel(ncq_tfs->aiocb);
+            ide_aio_cancel(ide_state->blk, ncq_tfs->aiocb);
             ncq_tfs->aiocb = NULL;
         }
 
-        /* Maybe we just finished the request thanks to blk_aio_cancel() */
+        /* Maybe we just finished the request thanks to ide_aio_cancel() */
         if (!ncq_tfs->used) {
             continue;
         }
@@ -1065,6 +1083,7 @@ static void execute_ncq_command(NCQTransferState *ncq_tfs)
 {
     AHCIDevice *ad = ncq_tfs->drive;
     IDEState *ide_state = &ad->port.ifs[0];
+    BlockCompletionFunc *cb = ncq_cb;
     int port = ad->port_no;
 
     g_assert(is_ncq(ncq_tfs->cmd));
@@ -1078,8 +1097,9 @@ static void execute_ncq_command(NCQTransferState *ncq_tfs)
                        &ncq_tfs->sglist, BLOCK_ACCT_READ);
         ncq_tfs->aiocb = dma_blk_read(ide_state->blk, &ncq_tfs->sglist,
                                       ncq_tfs->lba << BDRV_SECTOR_BITS,
-                                      BDRV_SECTOR_SIZE,
-                                      ncq_cb, ncq_tfs);
+                                      BDRV_SECTOR_SIZE, cb,
+                                      ide_wrap_completion(ide_state->blk,
+                                                          &cb, ncq_tfs));
         break;
     case WRITE_FPDMA_QUEUED:
         trace_execute_ncq_command_read(ad->hba, port, ncq_tfs->tag,
@@ -1088,8 +1108,9 @@ static void execute_ncq_command(NCQTransferState *ncq_tfs)
                        &ncq_tfs->sglist, BLOCK_ACCT_WRITE);
         ncq_tfs->aiocb = dma_blk_write(ide_state->blk, &ncq_tfs->sglist,
                                        ncq_tfs->lba << BDRV_SECTOR_BITS,
-                                       BDRV_SECTOR_SIZE,
-                                       ncq_cb, ncq_tfs);
+                                       BDRV_SECTOR_SIZE, cb,
+                                       ide_wrap_completion(ide_state->blk,
+                                                           &cb, ncq_tfs));
         break;
     default:
         trace_execute_ncq_command_unsup(ad->hba, port,
@@ -1557,12 +1578,53 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
     g_free(irqs);
 }
 
+/*
+ * Move the BlockBackends of the attached disks into the IOThread.  Drives
+ * are attached after the HBA is realized, so this runs on device reset.
+ * CD-ROMs stay in the main loop.
+ */
+void ahci_attach_iothread(AHCIState *s)
+{
+    AioContext *ctx;
+    Error *local_err = NULL;
+    int i;
+
+    if (!s->iothread) {
+        return;
+    }
+
+    ctx = iothread_get_aio_context(s->iothread);
+    for (i = 0; i < s->ports; i++) {
+        IDEState *ide_state = &s->dev[i].port.ifs[0];
+
+        if (!ide_state->blk || ide_state->drive_kind != IDE_HD ||
+            blk_get_aio_context(ide_state->blk) == ctx) {
+            continue;
+        }
+        if (blk_set_aio_context(ide_state->blk, ctx, &local_err) < 0) {
+            warn_reportf_err(local_err, "ahci: port %d stays in the main "
+                             "loop: ", i);
+            local_err = NULL;
+        }
+    }
+}
+
 void ahci_uninit(AHCIState *s)
 {
     int i, j;
 
     for (i = 0; i < s->ports; i++) {
         AHCIDevice *ad = &s->dev[i];
+        IDEState *ide_state = &ad->port.ifs[0];
+
+        if (ide_state->blk &&
+            blk_get_aio_context(ide_state->blk) != qemu_get_aio_context()) {
+            AioContext *ctx = blk_get_aio_context(ide_state->blk);
+
+            aio_context_acquire(ctx);
+            blk_set_aio_context(ide_state->blk, qemu_get_aio_context(), NULL);
+            aio_context_release(ctx);
+        }
 
         for (j = 0; j < 2; j++) {
             IDEState *s = &ad->port.ifs[j];
@@ -1719,7 +1781,9 @@ static int ahci_state_post_load(void *opaque, int version_id)
          * and we should check to see if there are additional commands waiting.
          */
         if (ad->busy_slot == -1) {
+            aio_context_acquire(ahci_get_aio_context(s));
             check_cmd(s, i);
+            aio_context_release(ahci_get_aio_context(s));
         } else {
             /* We are in the middle of a command, and may need to access
              * the command header in guest memory again. */
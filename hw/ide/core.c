@@ -625,6 +625,72 @@ static void ide_rw_error(IDEState *s) {
     ide_set_irq(s->bus);
 }
 
+/*
+ * IDE state is only touched in the main loop.  When the BlockBackend lives
+ * in an IOThread, completions are forwarded to the main loop; the request
+ * stays in flight until the callback has run, so that draining the
+ * BlockBackend also waits for its callback.
+ */
+typedef struct IDECompletion {
+    BlockBackend *blk;
+    BlockCompletionFunc *cb;
+    void *opaque;
+    int ret;
+} IDECompletion;
+
+static void ide_completion_bh(void *opaque)
+{
+    IDECompletion *c = opaque;
+    AioContext *ctx = blk_get_aio_context(c->blk);
+
+    aio_context_acquire(ctx);
+    c->cb(c->opaque, c->ret);
+    aio_context_release(ctx);
+    blk_dec_in_flight(c->blk);
+    g_free(c);
+}
+
+static void ide_completion_cb(void *opaque, int ret)
+{
+    IDECompletion *c = opaque;
+
+    c->ret = ret;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), ide_completion_bh, c);
+}
+
+void *ide_wrap_completion(BlockBackend *blk, BlockCompletionFunc **cb,
+                          void *opaque)
+{
+    IDECompletion *c;
+
+    if (blk_get_aio_context(blk) == qemu_get_aio_context()) {
+        return opaque;
+    }
+
+    c = g_new(IDECompletion, 1);
+    c->blk = blk;
+    c->cb = *cb;
+    c->opaque = opaque;
+    blk_inc_in_flight(blk);
+    *cb = ide_completion_cb;
+    return c;
+}
+
+void ide_aio_cancel(BlockBackend *blk, BlockAIOCB *acb)
+{
+    if (!blk || blk_get_aio_context(blk) == qemu_get_aio_context()) {
+        blk_aio_cancel(acb);
+        return;
+    }
+
+    /*
+     * Requests running in an IOThread cannot be cancelled synchronously
+     * from here, wait for them instead.  Their callbacks run as if the
+     * request had completed before it could be cancelled.
+     */
+    blk_drain(blk);
+}
+
 static void ide_buffered_readv_cb(void *opaque, int ret)
 {
     IDEBufferedRequest *req = opaque;
@@ -648,6 +714,7 @@ BlockAIOCB *ide_buffered_readv(IDEState *s, int64_t sector_num,
                                QEMUIOVector *iov, int nb_sectors,
                                BlockCompletionFunc *cb, void *opaque)
 {
+    BlockCompletionFunc *readv_cb = ide_buffered_readv_cb;
     BlockAIOCB *aioreq;
     IDEBufferedRequest *req;
     int c = 0;
@@ -656,6 +723,7 @@ BlockAIOCB *ide_buffered_readv(IDEState *s, int64_t sector_num,
         c++;
     }
     if (c > MAX_BUFFERED_REQS) {
+        opaque = ide_wrap_completion(s->blk, &cb, opaque);
         return blk_abort_aio_request(s->blk, cb, opaque, -EIO);
     }
 
@@ -667,7 +735,8 @@ BlockAIOCB *ide_buffered_readv(IDEState *s, int64_t sector_num,
                         iov->size);
 
     aioreq = blk_aio_preadv(s->blk, sector_num << BDRV_SECTOR_BITS,
-                            &req->qiov, 0, ide_buffered_readv_cb, req);
+                            &req->qiov, 0, readv_cb,
+                            ide_wrap_completion(s->blk, &readv_cb, req));
 
     QLIST_INSERT_HEAD(&s->buffered_requests, req, list);
     return aioreq;
@@ -833,6 +902,8 @@ int ide_handle_rw_error(IDEState *s, int error, int op)
 static void ide_dma_cb(void *opaque, int ret)
 {
     IDEState *s = opaque;
+    BlockCompletionFunc *cb = ide_dma_cb;
+    void *cb_opaque;
     int n;
     int64_t sector_num;
     uint64_t offset;
@@ -898,19 +969,20 @@ static void ide_dma_cb(void *opaque, int ret)
     }
 
     offset = sector_num << BDRV_SECTOR_BITS;
+    cb_opaque = ide_wrap_completion(s->blk, &cb, s);
     switch (s->dma_cmd) {
     case IDE_DMA_READ:
         s->bus->dma->aiocb = dma_blk_read(s->blk, &s->sg, offset,
-                                          BDRV_SECTOR_SIZE, ide_dma_cb, s);
+                                          BDRV_SECTOR_SIZE, cb, cb_opaque);
         break;
     case IDE_DMA_WRITE:
         s->bus->dma->aiocb = dma_blk_write(s->blk, &s->sg, offset,
-                                           BDRV_SECTOR_SIZE, ide_dma_cb, s);
+                                           BDRV_SECTOR_SIZE, cb, cb_opaque);
         break;
     case IDE_DMA_TRIM:
         s->bus->dma->aiocb = dma_blk_io(blk_get_aio_context(s->blk),
                                         &s->sg, offset, BDRV_SECTOR_SIZE,
-                                        ide_issue_trim, s, ide_dma_cb, s,
+                                        ide_issue_trim, s, cb, cb_opaque,
                                         DMA_DIRECTION_TO_DEVICE);
         break;
     default:
@@ -1015,6 +1087,7 @@ static void ide_sector_write_cb(void *opaque, int ret)
 
 static void ide_sector_write(IDEState *s)
 {
+    BlockCompletionFunc *cb = ide_sector_write_cb;
     int64_t sector_num;
     int n;
 
@@ -1039,7 +1112,8 @@ static void ide_sector_write(IDEState *s)
     block_acct_start(blk_get_stats(s->blk), &s->acct,
                      n * BDRV_SECTOR_SIZE, BLOCK_ACCT_WRITE);
     s->pio_aiocb = blk_aio_pwritev(s->blk, sector_num << BDRV_SECTOR_BITS,
-                                   &s->qiov, 0, ide_sector_write_cb, s);
+                                   &s->qiov, 0, cb,
+                                   ide_wrap_completion(s->blk, &cb, s));
 }
 
 static void ide_flush_cb(void *opaque, int ret)
@@ -1065,6 +1139,8 @@ static void ide_flush_cb(void *opaque, int ret)
 
 static void ide_flush_cache(IDEState *s)
 {
+    BlockCompletionFunc *cb = ide_flush_cb;
+
     if (s->blk == NULL) {
         ide_flush_cb(s, 0);
         return;
@@ -1073,7 +1149,8 @@ static void ide_flush_cache(IDEState *s)
     s->status |= BUSY_STAT;
     ide_set_retry(s);
     block_acct_start(blk_get_stats(s->blk), &s->acct, 0, BLOCK_ACCT_FLUSH);
-    s->pio_aiocb = blk_aio_flush(s->blk, ide_flush_cb, s);
+    s->pio_aiocb = blk_aio_flush(s->blk, cb,
+                                 ide_wrap_completion(s->blk, &cb, s));
 }
 
 static void ide_cfata_metadata_inquiry(IDEState *s)
@@ -1289,7 +1366,7 @@ static void ide_reset(IDEState *s)
     trace_ide_reset(s);
 
     if (s->pio_aiocb) {
-        blk_aio_cancel(s->pio_aiocb);
+        ide_aio_cancel(s->blk, s->pio_aiocb);
         s->pio_aiocb = NULL;
     }
 
@@ -2391,6 +2468,8 @@ static void ide_dummy_transfer_stop(IDEState *s)
 
 void ide_bus_reset(IDEBus *bus)
 {
+    IDEState *active = idebus_active_if(bus);
+
     bus->unit = 0;
     bus->cmd = 0;
     ide_reset(&bus->ifs[0]);
@@ -2400,7 +2479,7 @@ void ide_bus_reset(IDEBus *bus)
     /* pending async DMA */
     if (bus->dma->aiocb) {
         trace_ide_bus_reset_aio();
-        blk_aio_cancel(bus->dma->aiocb);
+        ide_aio_cancel(active->blk, bus->dma->aiocb);
         bus->dma->aiocb = NULL;
     }
 
@@ -2579,6 +2658,7 @@ static void ide_restart_bh(void *opaque)
 {
     IDEBus *bus = opaque;
     IDEState *s;
+    AioContext *ctx;
     bool is_read;
     int error_status;
 
@@ -2591,6 +2671,8 @@ static void ide_restart_bh(void *opaque)
     }
 
     s = idebus_active_if(bus);
+    ctx = s->blk ? blk_get_aio_context(s->blk) : qemu_get_aio_context();
+    aio_context_acquire(ctx);
     is_read = (bus->error_status & IDE_RETRY_READ) != 0;
 
     /* The error status must be cleared before resubmitting the request: The
@@ -2623,6 +2705,7 @@ static void ide_restart_bh(void *opaque)
     } else {
         abort();
     }
+    aio_context_release(ctx);
 }
 
 static void ide_restart_cb(void *opaque, int running, RunState state)
@@ -129,10 +129,12 @@ typedef struct E1000State_st {
 #define E1000_FLAG_MIT_BIT 1
 #define E1000_FLAG_MAC_BIT 2
 #define E1000_FLAG_TSO_BIT 3
+#define E1000_FLAG_POSTED_TDT_BIT 4
 #define E1000_FLAG_AUTONEG (1 << E1000_FLAG_AUTONEG_BIT)
 #define E1000_FLAG_MIT (1 << E1000_FLAG_MIT_BIT)
 #define E1000_FLAG_MAC (1 << E1000_FLAG_MAC_BIT)
 #define E1000_FLAG_TSO (1 << E1000_FLAG_TSO_BIT)
+#define E1000_FLAG_POSTED_TDT (1 << E1000_FLAG_POSTED_TDT_BIT)
     uint32_t compat_flags;
     bool received_tx_tso;
     bool use_tso_for_migration;
@@ -1638,6 +1640,10 @@ e1000_mmio_setup(E1000State *d)
     for (i = 0; excluded_regs[i] != PNPMMIO_SIZE; i++)
         memory_region_add_coalescing(&d->mmio, excluded_regs[i] + 4,
                                      excluded_regs[i+1] - excluded_regs[i] - 4);
+    if (d->compat_flags & E1000_FLAG_POSTED_TDT) {
+        /* Transmission may start a little late, but without an exit */
+        memory_region_add_posted_writes(&d->mmio, E1000_TDT, 4);
+    }
     memory_region_init_io(&d->io, OBJECT(d), &e1000_io_ops, d, "e1000-io", IOPORT_SIZE);
 }
 
@@ -1735,6 +1741,8 @@ static Property e1000_properties[] = {
                     compat_flags, E1000_FLAG_MAC_BIT, true),
     DEFINE_PROP_BIT("migrate_tso_props", E1000State,
                     compat_flags, E1000_FLAG_TSO_BIT, true),
+    DEFINE_PROP_BIT("x-posted-tdt", E1000State,
+                    compat_flags, E1000_FLAG_POSTED_TDT_BIT, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
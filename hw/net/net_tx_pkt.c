@@ -594,12 +594,112 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     return true;
 }
 
+#define NET_TX_PKT_TCP_MAX_HDR_LEN (60)
+
+/*
+ * Split a TSO packet into MSS sized TCP segments for peers that do not
+ * take a virtio-net header.  Each segment gets its own copy of the TCP
+ * header, and the IP header is rewritten in place between segments; the
+ * payload is sent straight from the guest fragments.
+ */
+static bool net_tx_pkt_do_sw_segmentation(struct NetTxPkt *pkt,
+    NetClientState *nc)
+{
+    struct iovec seg[NET_MAX_FRAG_SG_LIST];
+    struct iovec *l3_hdr = &pkt->vec[NET_TX_PKT_L3HDR_FRAG];
+    struct iovec *payload = &pkt->vec[NET_TX_PKT_PL_START_FRAG];
+    union {
+        struct tcp_hdr hdr;
+        uint8_t buf[NET_TX_PKT_TCP_MAX_HDR_LEN];
+    } l4;
+    size_t l4_len = pkt->virt_hdr.hdr_len - pkt->hdr_len;
+    size_t gso_size = pkt->virt_hdr.gso_size;
+    bool is_ip4 = (pkt->virt_hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN) ==
+                  VIRTIO_NET_HDR_GSO_TCPV4;
+    size_t data_len, seg_len, offset = 0;
+    uint16_t ip_id = 0;
+    uint32_t seq;
+    uint8_t flags;
+
+    if (l4_len < sizeof(struct tcp_hdr) || l4_len > sizeof(l4) ||
+        !gso_size || pkt->payload_len < l4_len ||
+        iov_to_buf(payload, pkt->payload_frags, 0, &l4, l4_len) < l4_len) {
+        return false;
+    }
+
+    data_len = pkt->payload_len - l4_len;
+    seq = be32_to_cpu(l4.hdr.th_seq);
+    flags = l4.hdr.th_flags;
+    if (is_ip4) {
+        ip_id = be16_to_cpu(((struct ip_header *)l3_hdr->iov_base)->ip_id);
+    }
+
+    seg[0] = pkt->vec[NET_TX_PKT_L2HDR_FRAG];
+    seg[1] = *l3_hdr;
+    seg[2].iov_base = &l4;
+    seg[2].iov_len = l4_len;
+
+    do {
+        uint32_t csum_cntr, cso;
+        uint16_t csl;
+        int cnt;
+
+        cnt = iov_copy(&seg[3], ARRAY_SIZE(seg) - 3,
+                       payload, pkt->payload_frags, l4_len + offset,
+                       MIN(gso_size, data_len - offset));
+        seg_len = iov_size(&seg[3], cnt);
+        csl = l4_len + seg_len;
+
+        l4.hdr.th_seq = cpu_to_be32(seq + offset);
+        l4.hdr.th_flags = flags;
+        if (offset + seg_len < data_len) {
+            l4.hdr.th_flags &= ~(TH_FIN | TH_PUSH);
+        }
+        if (offset) {
+            l4.hdr.th_flags &= ~TH_CWR;
+        }
+        l4.hdr.th_sum = 0;
+
+        if (is_ip4) {
+            struct ip_header *iphdr = l3_hdr->iov_base;
+
+            iphdr->ip_len = cpu_to_be16(l3_hdr->iov_len + csl);
+            iphdr->ip_id = cpu_to_be16(ip_id++);
+            eth_fix_ip4_checksum(iphdr, l3_hdr->iov_len);
+            csum_cntr = eth_calc_ip4_pseudo_hdr_csum(iphdr, csl, &cso);
+        } else {
+            struct ip6_header *ip6hdr = l3_hdr->iov_base;
+
+            ip6hdr->ip6_ctlun.ip6_un1.ip6_un1_plen =
+                cpu_to_be16(l3_hdr->iov_len - sizeof(*ip6hdr) + csl);
+            csum_cntr = eth_calc_ip6_pseudo_hdr_csum(ip6hdr, csl,
+                                                     IP_PROTO_TCP, &cso);
+        }
+
+        csum_cntr += net_checksum_add_iov(&seg[2], cnt + 1, 0, csl, cso);
+        l4.hdr.th_sum = cpu_to_be16(net_checksum_finish_nozero(csum_cntr));
+
+        net_tx_pkt_sendv(pkt, nc, seg, cnt + 3);
+
+        offset += seg_len;
+    } while (seg_len && offset < data_len);
+
+    return true;
+}
+
 bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
 {
+    uint8_t gso_type;
+
     assert(pkt);
 
+    gso_type = pkt->virt_hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+
+    /* TSO segments are checksummed one by one below */
     if (!pkt->has_virt_hdr &&
-        pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM &&
+        gso_type != VIRTIO_NET_HDR_GSO_TCPV4 &&
+        gso_type != VIRTIO_NET_HDR_GSO_TCPV6) {
         net_tx_pkt_do_sw_csum(pkt);
     }
 
@@ -622,6 +722,11 @@ bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
         return true;
     }
 
+    if (gso_type == VIRTIO_NET_HDR_GSO_TCPV4 ||
+        gso_type == VIRTIO_NET_HDR_GSO_TCPV6) {
+        return net_tx_pkt_do_sw_segmentation(pkt, nc);
+    }
+
     return net_tx_pkt_do_sw_fragmentation(pkt, nc);
 }
 
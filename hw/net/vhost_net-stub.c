@@ -61,6 +61,18 @@ uint64_t vhost_net_get_acked_features(VHostNetState *net)
     return 0;
 }
 
+int vhost_net_get_config(struct vhost_net *net, uint8_t *config,
+                         uint32_t config_len)
+{
+    return -1;
+}
+
+int vhost_net_set_config(struct vhost_net *net, const uint8_t *data,
+                         uint32_t offset, uint32_t size, uint32_t flags)
+{
+    return 0;
+}
+
 bool vhost_net_virtqueue_pending(VHostNetState *net, int idx)
 {
     return false;
@@ -33,6 +33,7 @@
 #include "standard-headers/linux/ethtool.h"
 #include "sysemu/sysemu.h"
 #include "trace.h"
+#include "net_rx_pkt.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -47,6 +48,9 @@
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
 
+/* Transmitted buffers returned to the guest with one used index update */
+#define VIRTIO_NET_TX_PUSH_BATCH 32
+
 #define VIRTIO_NET_IP4_ADDR_SIZE   8        /* ipv4 saddr + daddr */
 
 #define VIRTIO_NET_TCP_FLAG         0x3F
@@ -88,6 +92,16 @@ static inline __virtio16 *virtio_net_rsc_ext_num_dupacks(
 
 #endif
 
+#define VIRTIO_NET_RSS_SUPPORTED_HASHES (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv4 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDPv6 | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_IP_EX | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_TCP_EX | \
+                                         VIRTIO_NET_RSS_HASH_TYPE_UDP_EX)
+
 static VirtIOFeature feature_sizes[] = {
     {.flags = 1ULL << VIRTIO_NET_F_MAC,
      .end = virtio_endof(struct virtio_net_config, mac)},
@@ -99,6 +113,8 @@ static VirtIOFeature feature_sizes[] = {
      .end = virtio_endof(struct virtio_net_config, mtu)},
     {.flags = 1ULL << VIRTIO_NET_F_SPEED_DUPLEX,
      .end = virtio_endof(struct virtio_net_config, duplex)},
+    {.flags = (1ULL << VIRTIO_NET_F_RSS) | (1ULL << VIRTIO_NET_F_HASH_REPORT),
+     .end = virtio_endof(struct virtio_net_config, supported_hash_types)},
     {}
 };
 
@@ -122,6 +138,7 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     struct virtio_net_config netcfg;
+    NetClientState *nc = qemu_get_queue(n->nic);
 
     virtio_stw_p(vdev, &netcfg.status, n->status);
     virtio_stw_p(vdev, &netcfg.max_virtqueue_pairs, n->max_queues);
@@ -129,13 +146,28 @@ static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
     memcpy(netcfg.mac, n->mac, ETH_ALEN);
     virtio_stl_p(vdev, &netcfg.speed, n->net_conf.speed);
     netcfg.duplex = n->net_conf.duplex;
+    netcfg.rss_max_key_size = VIRTIO_NET_RSS_MAX_KEY_SIZE;
+    virtio_stw_p(vdev, &netcfg.rss_max_indirection_table_length,
+                 virtio_host_has_feature(vdev, VIRTIO_NET_F_RSS) ?
+                 VIRTIO_NET_RSS_MAX_TABLE_LEN : 1);
+    virtio_stl_p(vdev, &netcfg.supported_hash_types,
+                 VIRTIO_NET_RSS_SUPPORTED_HASHES);
     memcpy(config, &netcfg, n->config_size);
+
+    /* vDPA devices expose their own MAC address, link status and MTU */
+    if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_VHOST_VDPA) {
+        if (vhost_net_get_config(get_vhost_net(nc->peer), (uint8_t *)&netcfg,
+                                 n->config_size) == 0) {
+            memcpy(config, &netcfg, n->config_size);
+        }
+    }
 }
 
 static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     struct virtio_net_config netcfg = {};
+    NetClientState *nc = qemu_get_queue(n->nic);
 
     memcpy(&netcfg, config, n->config_size);
 
@@ -145,6 +177,12 @@ static void virtio_net_set_config(VirtIODevice *vdev, const uint8_t *config)
         memcpy(n->mac, netcfg.mac, ETH_ALEN);
         qemu_format_nic_info_str(qemu_get_queue(n->nic), n->mac);
     }
+
+    if (nc->peer && nc->peer->info->type == NET_CLIENT_DRIVER_VHOST_VDPA) {
+        vhost_net_set_config(get_vhost_net(nc->peer), (uint8_t *)&netcfg,
+                             0, n->config_size,
+                             VHOST_SET_CONFIG_TYPE_MASTER);
+    }
 }
 
 static bool virtio_net_started(VirtIONet *n, uint8_t status)
@@ -501,6 +539,7 @@ static void virtio_net_reset(VirtIODevice *vdev)
     n->nobcast = 0;
     /* multiqueue is disabled by default */
     n->curr_queues = 1;
+    n->rss_data.enabled = false;
     timer_del(n->announce_timer.tm);
     n->announce_timer.round = 0;
     n->status &= ~VIRTIO_NET_S_ANNOUNCE;
@@ -552,7 +591,7 @@ static int peer_has_ufo(VirtIONet *n)
 }
 
 static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
-                                       int version_1)
+                                       int version_1, int hash_report)
 {
     int i;
     NetClientState *nc;
@@ -560,7 +599,10 @@ static void virtio_net_set_mrg_rx_bufs(VirtIONet *n, int mergeable_rx_bufs,
     n->mergeable_rx_bufs = mergeable_rx_bufs;
 
     if (version_1) {
-        n->guest_hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+        n->guest_hdr_len = hash_report ?
+            sizeof(struct virtio_net_hdr_v1_hash) :
+            sizeof(struct virtio_net_hdr_mrg_rxbuf);
+        n->rss_data.populate_hash = !!hash_report;
     } else {
         n->guest_hdr_len = n->mergeable_rx_bufs ?
             sizeof(struct virtio_net_hdr_mrg_rxbuf) :
@@ -688,10 +730,19 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_UFO);
     }
 
+    /* The guest configures hashing through the control queue */
+    if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VQ)) {
+        virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+        virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
+    }
+
     if (!get_vhost_net(nc->peer)) {
         return features;
     }
 
+    /* vhost delivers packets without going through virtio_net_receive() */
+    virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
+    virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
     features = vhost_net_get_features(get_vhost_net(nc->peer), features);
     vdev->backend_features = features;
 
@@ -757,13 +808,16 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
     }
 
     virtio_net_set_multiqueue(n,
+                              virtio_has_feature(features, VIRTIO_NET_F_RSS) ||
                               virtio_has_feature(features, VIRTIO_NET_F_MQ));
 
     virtio_net_set_mrg_rx_bufs(n,
                                virtio_has_feature(features,
                                                   VIRTIO_NET_F_MRG_RXBUF),
                                virtio_has_feature(features,
-                                                  VIRTIO_F_VERSION_1));
+                                                  VIRTIO_F_VERSION_1),
+                               virtio_has_feature(features,
+                                                  VIRTIO_NET_F_HASH_REPORT));
 
     n->rsc4_enabled = virtio_has_feature(features, VIRTIO_NET_F_RSC_EXT) &&
         virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO4);
@@ -1011,6 +1065,142 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static void virtio_net_disable_rss(VirtIONet *n)
+{
+    if (n->rss_data.enabled) {
+        trace_virtio_net_rss_disable();
+    }
+    n->rss_data.enabled = false;
+}
+
+/*
+ * Parse a VIRTIO_NET_CTRL_MQ_RSS_CONFIG (@do_rss) or
+ * VIRTIO_NET_CTRL_MQ_HASH_CONFIG command.  Returns the number of queue
+ * pairs to use, or 0 if the command is invalid.
+ */
+static uint16_t virtio_net_handle_rss(VirtIONet *n, struct iovec *iov,
+                                      unsigned int iov_cnt, bool do_rss)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtioNetRssData *rss = &n->rss_data;
+    struct virtio_net_rss_config cfg;
+    size_t s, offset = 0, size_get;
+    uint16_t queues, i;
+    struct {
+        uint16_t max_tx_vq;
+        uint8_t hash_key_length;
+    } QEMU_PACKED temp;
+    const char *err_msg;
+    uint32_t err_value = 0;
+
+    if (do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_RSS)) {
+        err_msg = "RSS is not negotiated";
+        goto error;
+    }
+    if (!do_rss && !virtio_vdev_has_feature(vdev, VIRTIO_NET_F_HASH_REPORT)) {
+        err_msg = "Hash report is not negotiated";
+        goto error;
+    }
+
+    size_get = offsetof(struct virtio_net_rss_config, indirection_table);
+    s = iov_to_buf(iov, iov_cnt, offset, &cfg, size_get);
+    if (s != size_get) {
+        err_msg = "Short command buffer";
+        err_value = s;
+        goto error;
+    }
+    offset += size_get;
+
+    rss->hash_types = virtio_ldl_p(vdev, &cfg.hash_types);
+    if (rss->hash_types & ~VIRTIO_NET_RSS_SUPPORTED_HASHES) {
+        err_msg = "Unsupported hash types";
+        err_value = rss->hash_types;
+        goto error;
+    }
+    rss->indirections_len = do_rss ?
+        virtio_lduw_p(vdev, &cfg.indirection_table_mask) + 1 : 1;
+    if (!is_power_of_2(rss->indirections_len) ||
+        rss->indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN) {
+        err_msg = "Invalid size of indirection table";
+        err_value = rss->indirections_len;
+        goto error;
+    }
+    rss->default_queue = do_rss ?
+        virtio_lduw_p(vdev, &cfg.unclassified_queue) : 0;
+
+    size_get = sizeof(uint16_t) * rss->indirections_len;
+    s = iov_to_buf(iov, iov_cnt, offset, rss->indirections_table, size_get);
+    if (s != size_get) {
+        err_msg = "Short indirection table buffer";
+        err_value = s;
+        goto error;
+    }
+    offset += size_get;
+
+    size_get = sizeof(temp);
+    s = iov_to_buf(iov, iov_cnt, offset, &temp, size_get);
+    if (s != size_get) {
+        err_msg = "Can't get queues";
+        err_value = s;
+        goto error;
+    }
+    offset += size_get;
+
+    queues = do_rss ? virtio_lduw_p(vdev, &temp.max_tx_vq) : n->curr_queues;
+    if (queues == 0 || queues > n->max_queues) {
+        err_msg = "Invalid number of queues";
+        err_value = queues;
+        goto error;
+    }
+    if (rss->default_queue >= queues) {
+        err_msg = "Invalid default queue";
+        err_value = rss->default_queue;
+        goto error;
+    }
+    for (i = 0; i < rss->indirections_len; i++) {
+        /* HASH_CONFIG has reserved fields in place of the table */
+        rss->indirections_table[i] = do_rss ?
+            virtio_lduw_p(vdev, &rss->indirections_table[i]) : 0;
+        if (rss->indirections_table[i] >= queues) {
+            err_msg = "Invalid queue in indirection table";
+            err_value = rss->indirections_table[i];
+            goto error;
+        }
+    }
+
+    if (temp.hash_key_length > VIRTIO_NET_RSS_MAX_KEY_SIZE) {
+        err_msg = "Invalid key size";
+        err_value = temp.hash_key_length;
+        goto error;
+    }
+    if (!temp.hash_key_length && rss->hash_types) {
+        err_msg = "No key provided";
+        goto error;
+    }
+    if (!rss->hash_types) {
+        /* Hashing turned off, steer by the backend queue again */
+        return queues;
+    }
+
+    memset(rss->key, 0, sizeof(rss->key));
+    s = iov_to_buf(iov, iov_cnt, offset, rss->key, temp.hash_key_length);
+    if (s != temp.hash_key_length) {
+        err_msg = "Short key buffer";
+        err_value = s;
+        goto error;
+    }
+
+    rss->redirect = do_rss;
+    rss->enabled = true;
+    trace_virtio_net_rss_enable(rss->hash_types, rss->indirections_len,
+                                temp.hash_key_length);
+    return queues;
+
+error:
+    trace_virtio_net_rss_error(err_msg, err_value);
+    return 0;
+}
+
 static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
                                 struct iovec *iov, unsigned int iov_cnt)
 {
@@ -1019,17 +1209,23 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
     size_t s;
     uint16_t queues;
 
-    s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
-    if (s != sizeof(mq)) {
-        return VIRTIO_NET_ERR;
-    }
+    virtio_net_disable_rss(n);
 
-    if (cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+    if (cmd == VIRTIO_NET_CTRL_MQ_HASH_CONFIG) {
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, false);
+        return queues ? VIRTIO_NET_OK : VIRTIO_NET_ERR;
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_RSS_CONFIG) {
+        queues = virtio_net_handle_rss(n, iov, iov_cnt, true);
+    } else if (cmd == VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) {
+        s = iov_to_buf(iov, iov_cnt, 0, &mq, sizeof(mq));
+        if (s != sizeof(mq)) {
+            return VIRTIO_NET_ERR;
+        }
+        queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
+    } else {
         return VIRTIO_NET_ERR;
     }
 
-    queues = virtio_lduw_p(vdev, &mq.virtqueue_pairs);
-
     if (queues < VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN ||
         queues > VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX ||
         queues > n->max_queues ||
@@ -1105,6 +1301,18 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    int i;
+
+    if (n->rss_data.redirect && n->rss_data.enabled) {
+        /*
+         * Packets steered to this queue wait on the backend queue they
+         * arrived on, which may be any of them.
+         */
+        for (i = 0; i < n->curr_queues; i++) {
+            qemu_flush_queued_packets(qemu_get_subqueue(n->nic, i));
+        }
+        return;
+    }
 
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
@@ -1262,21 +1470,136 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
     return 0;
 }
 
+static void receive_hash(VirtIONet *n, const struct iovec *iov, int iov_cnt,
+                         uint32_t hash, uint16_t report)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_hdr_v1_hash hdr;
+    size_t hash_offset = offsetof(struct virtio_net_hdr_v1_hash, hash_value);
+
+    virtio_stl_p(vdev, &hdr.hash_value, hash);
+    virtio_stw_p(vdev, &hdr.hash_report, report);
+    hdr.padding = 0;
+    iov_from_buf(iov, iov_cnt, hash_offset, (uint8_t *)&hdr + hash_offset,
+                 sizeof(hdr) - hash_offset);
+}
+
+static int virtio_net_get_hash_type(bool isip4, bool isip6, bool isudp,
+                                    bool istcp, uint32_t types)
+{
+    if (isip4) {
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv4)) {
+            return NetPktRssIpV4Tcp;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv4)) {
+            return NetPktRssIpV4Udp;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv4) {
+            return NetPktRssIpV4;
+        }
+    } else if (isip6) {
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCP_EX)) {
+            return NetPktRssIpV6TcpEx;
+        }
+        if (istcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv6)) {
+            return NetPktRssIpV6Tcp;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDP_EX)) {
+            return NetPktRssIpV6UdpEx;
+        }
+        if (isudp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv6)) {
+            return NetPktRssIpV6Udp;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IP_EX) {
+            return NetPktRssIpV6Ex;
+        }
+        if (types & VIRTIO_NET_RSS_HASH_TYPE_IPv6) {
+            return NetPktRssIpV6;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Compute the Toeplitz hash of an incoming packet.  Returns the index of
+ * the queue the packet should be steered to, or -1 to keep it on the
+ * queue it arrived on.
+ */
+static int virtio_net_process_rss(VirtIONet *n, const uint8_t *buf,
+                                  size_t size, uint32_t *hash,
+                                  uint16_t *report)
+{
+    static const uint16_t reports[] = {
+        [NetPktRssIpV4] = VIRTIO_NET_HASH_REPORT_IPv4,
+        [NetPktRssIpV4Tcp] = VIRTIO_NET_HASH_REPORT_TCPv4,
+        [NetPktRssIpV6Tcp] = VIRTIO_NET_HASH_REPORT_TCPv6,
+        [NetPktRssIpV6] = VIRTIO_NET_HASH_REPORT_IPv6,
+        [NetPktRssIpV6Ex] = VIRTIO_NET_HASH_REPORT_IPv6_EX,
+        [NetPktRssIpV6TcpEx] = VIRTIO_NET_HASH_REPORT_TCPv6_EX,
+        [NetPktRssIpV4Udp] = VIRTIO_NET_HASH_REPORT_UDPv4,
+        [NetPktRssIpV6Udp] = VIRTIO_NET_HASH_REPORT_UDPv6,
+        [NetPktRssIpV6UdpEx] = VIRTIO_NET_HASH_REPORT_UDPv6_EX,
+    };
+    VirtioNetRssData *rss = &n->rss_data;
+    struct NetRxPkt *pkt = n->rx_pkt;
+    bool isip4, isip6, isudp, istcp;
+    int type;
+
+    net_rx_pkt_set_protocols(pkt, buf + n->host_hdr_len,
+                             size - n->host_hdr_len);
+    net_rx_pkt_get_protocols(pkt, &isip4, &isip6, &isudp, &istcp);
+    if ((isip4 && net_rx_pkt_get_ip4_info(pkt)->fragment) ||
+        (isip6 && net_rx_pkt_get_ip6_info(pkt)->fragment)) {
+        istcp = isudp = false;
+    }
+
+    type = virtio_net_get_hash_type(isip4, isip6, isudp, istcp,
+                                    rss->hash_types);
+    if (type < 0) {
+        return rss->redirect ? rss->default_queue : -1;
+    }
+
+    *hash = net_rx_pkt_calc_rss_hash(pkt, type, rss->key);
+    *report = reports[type];
+
+    if (!rss->redirect) {
+        return -1;
+    }
+    return rss->indirections_table[*hash & (rss->indirections_len - 1)];
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
-    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIONetQueue *q;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
     struct virtio_net_hdr_mrg_rxbuf mhdr;
     unsigned mhdr_cnt = 0;
     size_t offset, i, guest_offset;
+    uint32_t hash = 0;
+    uint16_t hash_report = VIRTIO_NET_HASH_REPORT_NONE;
 
     if (!virtio_net_can_receive(nc)) {
         return -1;
     }
 
+    if (n->rss_data.enabled) {
+        int index = virtio_net_process_rss(n, buf, size, &hash,
+                                           &hash_report);
+
+        if (index >= 0 && index != nc->queue_index) {
+            NetClientState *target = qemu_get_subqueue(n->nic, index);
+
+            /* Keep the packet where it is if the guest broke the target */
+            if (virtio_net_can_receive(target)) {
+                nc = target;
+            }
+        }
+    }
+    q = virtio_net_get_subqueue(nc);
+
     /* hdr_len refers to the header we supply to the guest */
     if (!virtio_net_has_buffers(q, size + n->guest_hdr_len - n->host_hdr_len)) {
         return 0;
@@ -1327,6 +1650,9 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
             }
 
             receive_header(n, sg, elem->in_num, buf, size);
+            if (n->rss_data.populate_hash) {
+                receive_hash(n, sg, elem->in_num, hash, hash_report);
+            }
             offset = n->host_hdr_len;
             total += n->guest_hdr_len;
             guest_offset = n->guest_hdr_len;
@@ -1349,7 +1675,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         }
 
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elem, total, i++);
+        virtqueue_fill(q->rx_vq, elem, total, q->rx_pending + i++);
         g_free(elem);
     }
 
@@ -1360,12 +1686,52 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                      &mhdr.num_buffers, sizeof mhdr.num_buffers);
     }
 
+    if (n->rx_plugged) {
+        /* Made visible to the guest by virtio_net_io_unplug() */
+        q->rx_pending += i;
+        return size;
+    }
+
     virtqueue_flush(q->rx_vq, i);
     virtio_notify(vdev, q->rx_vq);
 
     return size;
 }
 
+/*
+ * The backend is about to deliver a burst of packets; flush the used
+ * ring and notify the guest once at the end instead of per packet.
+ */
+static void virtio_net_io_plug(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+
+    n->rx_plugged++;
+}
+
+static void virtio_net_io_unplug(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int i;
+
+    assert(n->rx_plugged);
+    if (--n->rx_plugged) {
+        return;
+    }
+
+    /* With RSS the burst may have been spread over several queues */
+    for (i = 0; i < n->max_queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (q->rx_pending) {
+            virtqueue_flush(q->rx_vq, q->rx_pending);
+            q->rx_pending = 0;
+            virtio_notify(vdev, q->rx_vq);
+        }
+    }
+}
+
 static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
@@ -2002,13 +2368,35 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_push(VirtIONetQueue *q, VirtQueueElement **elems,
+                               unsigned int num)
+{
+    static const unsigned int lens[VIRTIO_NET_TX_PUSH_BATCH];
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    virtqueue_push_batch(q->tx_vq, elems, lens, num);
+    virtio_notify(VIRTIO_DEVICE(q->n), q->tx_vq);
+    for (i = 0; i < num; i++) {
+        g_free(elems[i]);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *done[VIRTIO_NET_TX_PUSH_BATCH];
+    unsigned int num_done = 0;
     int32_t num_packets = 0;
+    int32_t ret_packets;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2018,6 +2406,9 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
+    /* Let the backend write the whole burst at once */
+    qemu_net_io_plug(nc->peer);
+
     for (;;) {
         ssize_t ret;
         unsigned int out_num;
@@ -2035,7 +2426,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
-            return -EINVAL;
+            ret_packets = -EINVAL;
+            goto out;
         }
 
         if (n->has_vnet_hdr) {
@@ -2044,7 +2436,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
-                return -EINVAL;
+                ret_packets = -EINVAL;
+                goto out;
             }
             if (n->needs_vnet_hdr_swap) {
                 virtio_net_hdr_swap(vdev, (void *) &mhdr);
@@ -2077,24 +2470,43 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        /*
+         * The element stays mapped until virtio_net_tx_complete(), so a
+         * queued packet can reference guest memory unless it includes
+         * the swapped header on the stack.
+         */
+        if (n->needs_vnet_hdr_swap) {
+            ret = qemu_sendv_packet_async(nc, out_sg, out_num,
+                                          virtio_net_tx_complete);
+        } else {
+            ret = qemu_sendv_packet_async_nocopy(nc, out_sg, out_num,
+                                                 virtio_net_tx_complete);
+        }
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
-            return -EBUSY;
+            ret_packets = -EBUSY;
+            goto out;
         }
 
 drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        /* Completed buffers are returned to the guest in batches */
+        done[num_done++] = elem;
+        if (num_done == ARRAY_SIZE(done)) {
+            virtio_net_tx_push(q, done, num_done);
+            num_done = 0;
+        }
 
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
-    return num_packets;
+    ret_packets = num_packets;
+
+out:
+    virtio_net_tx_push(q, done, num_done);
+    qemu_net_io_unplug(nc->peer);
+    return ret_packets;
 }
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
@@ -2322,7 +2734,9 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
     trace_virtio_net_post_load_device();
     virtio_net_set_mrg_rx_bufs(n, n->mergeable_rx_bufs,
                                virtio_vdev_has_feature(vdev,
-                                                       VIRTIO_F_VERSION_1));
+                                                       VIRTIO_F_VERSION_1),
+                               virtio_vdev_has_feature(vdev,
+                                               VIRTIO_NET_F_HASH_REPORT));
 
     /* MAC_TABLE_ENTRIES may be different from the saved image */
     if (n->mac_table.in_use > MAC_TABLE_ENTRIES) {
@@ -2528,6 +2942,58 @@ static const VMStateDescription vmstate_virtio_net_has_vnet = {
     },
 };
 
+static bool virtio_net_rss_needed(void *opaque)
+{
+    return VIRTIO_NET(opaque)->rss_data.enabled;
+}
+
+static int virtio_net_rss_post_load(void *opaque, int version_id)
+{
+    VirtIONet *n = opaque;
+    VirtioNetRssData *rss = &n->rss_data;
+    int i;
+
+    if (!is_power_of_2(rss->indirections_len) ||
+        rss->indirections_len > VIRTIO_NET_RSS_MAX_TABLE_LEN) {
+        error_report("virtio-net: invalid RSS indirection table size %u",
+                     rss->indirections_len);
+        return -EINVAL;
+    }
+    if (rss->default_queue >= n->max_queues) {
+        error_report("virtio-net: invalid RSS default queue %u",
+                     rss->default_queue);
+        return -EINVAL;
+    }
+    for (i = 0; i < rss->indirections_len; i++) {
+        if (rss->indirections_table[i] >= n->max_queues) {
+            error_report("virtio-net: invalid RSS indirection entry %u",
+                         rss->indirections_table[i]);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_virtio_net_rss = {
+    .name = "virtio-net-device/rss",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_rss_needed,
+    .post_load = virtio_net_rss_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_BOOL(rss_data.enabled, VirtIONet),
+        VMSTATE_BOOL(rss_data.redirect, VirtIONet),
+        VMSTATE_UINT32(rss_data.hash_types, VirtIONet),
+        VMSTATE_UINT8_ARRAY(rss_data.key, VirtIONet,
+                            VIRTIO_NET_RSS_MAX_KEY_SIZE),
+        VMSTATE_UINT16(rss_data.indirections_len, VirtIONet),
+        VMSTATE_UINT16_ARRAY(rss_data.indirections_table, VirtIONet,
+                             VIRTIO_NET_RSS_MAX_TABLE_LEN),
+        VMSTATE_UINT16(rss_data.default_queue, VirtIONet),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_virtio_net_device = {
     .name = "virtio-net-device",
     .version_id = VIRTIO_NET_VM_VERSION,
@@ -2578,6 +3044,10 @@ static const VMStateDescription vmstate_virtio_net_device = {
                             has_ctrl_guest_offloads),
         VMSTATE_END_OF_LIST()
    },
+    .subsections = (const VMStateDescription * []) {
+        &vmstate_virtio_net_rss,
+        NULL
+    }
 };
 
 static NetClientInfo net_virtio_info = {
@@ -2588,6 +3058,8 @@ static NetClientInfo net_virtio_info = {
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .io_plug = virtio_net_io_plug,
+    .io_unplug = virtio_net_io_unplug,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -2751,7 +3223,7 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     n->vqs[0].tx_waiting = 0;
     n->tx_burst = n->net_conf.txburst;
-    virtio_net_set_mrg_rx_bufs(n, 0, 0);
+    virtio_net_set_mrg_rx_bufs(n, 0, 0, 0);
     n->promisc = 1; /* for compatibility */
 
     n->mac_table.macs = g_malloc0(MAC_TABLE_ENTRIES * ETH_ALEN);
@@ -2763,6 +3235,8 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 
     QTAILQ_INIT(&n->rsc_chains);
     n->qdev = dev;
+
+    net_rx_pkt_init(&n->rx_pkt, false);
 }
 
 static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
@@ -2791,6 +3265,7 @@ static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
     g_free(n->vqs);
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
+    net_rx_pkt_uninit(n->rx_pkt);
     virtio_cleanup(vdev);
 }
 
@@ -2875,6 +3350,10 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_RSC_EXT, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
                        VIRTIO_NET_RSC_DEFAULT_INTERVAL),
+    DEFINE_PROP_BIT64("rss", VirtIONet, host_features,
+                    VIRTIO_NET_F_RSS, false),
+    DEFINE_PROP_BIT64("hash", VirtIONet, host_features,
+                    VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_NIC_PROPERTIES(VirtIONet, nic_conf),
     DEFINE_PROP_UINT32("x-txtimer", VirtIONet, net_conf.txtimer,
                        TX_TIMER_INTERVAL),
@@ -622,6 +622,7 @@ static const VMStateDescription vmstate_fw_cfg = {
     .name = "fw_cfg",
     .version_id = 2,
     .minimum_version_id = 1,
+    .parallel_load = true,
     .fields = (VMStateField[]) {
         VMSTATE_UINT16(cur_entry, FWCfgState),
         VMSTATE_UINT16_HACK(cur_offset, FWCfgState, is_version_1),
@@ -682,6 +683,34 @@ void fw_cfg_add_bytes(FWCfgState *s, uint16_t key, void *data, size_t len)
     fw_cfg_add_bytes_callback(s, key, NULL, NULL, NULL, data, len, true);
 }
 
+int fw_cfg_add_mapped_file(FWCfgState *s, uint16_t key, const char *filename,
+                           size_t offset, size_t *len, Error **errp)
+{
+    GMappedFile *mapped_file;
+    GError *gerr = NULL;
+    gsize length;
+
+    mapped_file = g_mapped_file_new(filename, false, &gerr);
+    if (!mapped_file) {
+        error_setg(errp, "failed to map \"%s\": %s", filename, gerr->message);
+        g_error_free(gerr);
+        return -1;
+    }
+
+    length = g_mapped_file_get_length(mapped_file);
+    if (offset > length) {
+        error_setg(errp, "\"%s\" is too short", filename);
+        g_mapped_file_unref(mapped_file);
+        return -1;
+    }
+
+    /* the reference is intentionally never dropped, like the item itself */
+    *len = length - offset;
+    fw_cfg_add_bytes(s, key, g_mapped_file_get_contents(mapped_file) + offset,
+                     *len);
+    return 0;
+}
+
 void fw_cfg_add_string(FWCfgState *s, uint16_t key, const char *value)
 {
     size_t sz = strlen(value) + 1;
@@ -34,6 +34,7 @@
 #include "sysemu/qtest.h"
 #include "sysemu/reset.h"
 #include "sysemu/runstate.h"
+#include "qemu/bitmap.h"
 #include "qemu/log.h"
 #include "hw/fw-path-provider.h"
 #include "elf.h"
@@ -1462,6 +1463,38 @@ static void spapr_get_pate(PPCVirtualHypervisor *vhyp, ppc_v3_pate_t *entry)
 #define CLEAN_HPTE(_hpte)  ((*(uint64_t *)(_hpte)) &= tswap64(~HPTE64_V_HPTE_DIRTY))
 #define DIRTY_HPTE(_hpte)  ((*(uint64_t *)(_hpte)) |= tswap64(HPTE64_V_HPTE_DIRTY))
 
+#define HTAB_GROUPS(spapr) (HTAB_SIZE(spapr) / HASH_PTEG_SIZE_64)
+
+/*
+ * While the HPT is migrated, remember which HPTE groups were written, so
+ * that later passes do not have to look at every HPTE to find the dirty
+ * ones and the amount of HPT left to send is known.
+ */
+static void spapr_htab_mark_dirty(SpaprMachineState *spapr, hwaddr ptex)
+{
+    unsigned long group = ptex / HPTES_PER_GROUP;
+    unsigned long mask = BIT_MASK(group);
+
+    if (!spapr->htab_dirty_map) {
+        return;
+    }
+    if (!(atomic_fetch_or(&spapr->htab_dirty_map[BIT_WORD(group)], mask) &
+          mask)) {
+        atomic_inc(&spapr->htab_dirty_groups);
+    }
+}
+
+void spapr_htab_dirty_map_reset(SpaprMachineState *spapr)
+{
+    if (!spapr->htab_dirty_map) {
+        return;
+    }
+    g_free(spapr->htab_dirty_map);
+    spapr->htab_dirty_map = bitmap_new(HTAB_GROUPS(spapr));
+    bitmap_fill(spapr->htab_dirty_map, HTAB_GROUPS(spapr));
+    spapr->htab_dirty_groups = HTAB_GROUPS(spapr);
+}
+
 /*
  * Get the fd to access the kernel htab, re-opening it if necessary
  */
@@ -1572,6 +1605,9 @@ void spapr_store_hpte(PowerPCCPU *cpu, hwaddr ptex,
             smp_wmb();
             stq_p(spapr->htab + offset + HASH_PTE_SIZE_64 / 2, pte1);
         }
+        if (pte0 & HPTE64_V_HPTE_DIRTY) {
+            spapr_htab_mark_dirty(spapr, ptex);
+        }
     }
 }
 
@@ -2162,16 +2198,19 @@ static int htab_save_setup(QEMUFile *f, void *opaque)
         qemu_put_be32(f, spapr->htab_shift);
     }
 
+    spapr->htab_first_pass = true;
     if (spapr->htab) {
         spapr->htab_save_index = 0;
-        spapr->htab_first_pass = true;
+        /* The first pass looks at every HPTE anyway */
+        g_free(spapr->htab_dirty_map);
+        spapr->htab_dirty_map = bitmap_new(HTAB_GROUPS(spapr));
+        spapr->htab_dirty_groups = 0;
     } else {
         if (spapr->htab_shift) {
             assert(kvm_enabled());
         }
     }
 
-
     return 0;
 }
 
@@ -2240,6 +2279,23 @@ static void htab_save_first_pass(QEMUFile *f, SpaprMachineState *spapr,
     spapr->htab_save_index = index;
 }
 
+/*
+ * Start looking at the HPTEs of the group of @index, unless that is
+ * already the case.  Returns false if the group has no dirty HPTE.
+ */
+static bool htab_enter_group(SpaprMachineState *spapr, int index, int *group)
+{
+    if (index / HPTES_PER_GROUP == *group) {
+        return true;
+    }
+    *group = index / HPTES_PER_GROUP;
+    if (!bitmap_test_and_clear_atomic(spapr->htab_dirty_map, *group, 1)) {
+        return false;
+    }
+    atomic_dec(&spapr->htab_dirty_groups);
+    return true;
+}
+
 static int htab_save_later_pass(QEMUFile *f, SpaprMachineState *spapr,
                                 int64_t max_ns)
 {
@@ -2247,6 +2303,8 @@ static int htab_save_later_pass(QEMUFile *f, SpaprMachineState *spapr,
     int htabslots = HTAB_SIZE(spapr) / HASH_PTE_SIZE_64;
     int examined = 0, sent = 0;
     int index = spapr->htab_save_index;
+    /* A group we stopped in the middle of was entered already */
+    int group = index % HPTES_PER_GROUP ? index / HPTES_PER_GROUP : -1;
     int64_t starttime = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     assert(!spapr->htab_first_pass);
@@ -2254,9 +2312,20 @@ static int htab_save_later_pass(QEMUFile *f, SpaprMachineState *spapr,
     do {
         int chunkstart, invalidstart;
 
-        /* Consume non-dirty HPTEs */
-        while ((index < htabslots)
-               && !HPTE_DIRTY(HPTE(spapr->htab, index))) {
+        /* Consume non-dirty HPTEs, skipping the groups without any */
+        while (index < htabslots) {
+            if (!htab_enter_group(spapr, index, &group)) {
+                int next = find_next_bit(spapr->htab_dirty_map,
+                                         HTAB_GROUPS(spapr), group + 1);
+
+                next *= HPTES_PER_GROUP;
+                examined += next - index;
+                index = next;
+                continue;
+            }
+            if (HPTE_DIRTY(HPTE(spapr->htab, index))) {
+                break;
+            }
             index++;
             examined++;
         }
@@ -2264,6 +2333,7 @@ static int htab_save_later_pass(QEMUFile *f, SpaprMachineState *spapr,
         chunkstart = index;
         /* Consume valid dirty HPTEs */
         while ((index < htabslots) && (index - chunkstart < USHRT_MAX)
+               && htab_enter_group(spapr, index, &group)
                && HPTE_DIRTY(HPTE(spapr->htab, index))
                && HPTE_VALID(HPTE(spapr->htab, index))) {
             CLEAN_HPTE(HPTE(spapr->htab, index));
@@ -2274,6 +2344,7 @@ static int htab_save_later_pass(QEMUFile *f, SpaprMachineState *spapr,
         invalidstart = index;
         /* Consume invalid dirty HPTEs */
         while ((index < htabslots) && (index - invalidstart < USHRT_MAX)
+               && htab_enter_group(spapr, index, &group)
                && HPTE_DIRTY(HPTE(spapr->htab, index))
                && !HPTE_VALID(HPTE(spapr->htab, index))) {
             CLEAN_HPTE(HPTE(spapr->htab, index));
@@ -2314,7 +2385,7 @@ static int htab_save_later_pass(QEMUFile *f, SpaprMachineState *spapr,
 }
 
 #define MAX_ITERATION_NS    5000000 /* 5 ms */
-#define MAX_KVM_BUF_SIZE    2048
+#define MAX_KVM_BUF_SIZE    (64 * KiB)
 
 static int htab_save_iterate(QEMUFile *f, void *opaque)
 {
@@ -2342,6 +2413,10 @@ static int htab_save_iterate(QEMUFile *f, void *opaque)
         if (rc < 0) {
             return rc;
         }
+        if (rc) {
+            /* The kernel went through the whole HPT */
+            spapr->htab_first_pass = false;
+        }
     } else  if (spapr->htab_first_pass) {
         htab_save_first_pass(f, spapr, MAX_ITERATION_NS);
     } else {
@@ -2483,16 +2558,51 @@ static int htab_load(QEMUFile *f, void *opaque, int version_id)
     return 0;
 }
 
+static void htab_save_pending(QEMUFile *f, void *opaque,
+                              uint64_t threshold_size,
+                              uint64_t *res_precopy_only,
+                              uint64_t *res_compatible,
+                              uint64_t *res_postcopy_only)
+{
+    SpaprMachineState *spapr = opaque;
+    uint64_t remaining = 0;
+
+    if (!spapr->htab_shift) {
+        return;
+    }
+
+    if (spapr->htab) {
+        if (spapr->htab_first_pass) {
+            remaining = HTAB_SIZE(spapr) -
+                        (uint64_t)spapr->htab_save_index * HASH_PTE_SIZE_64;
+        }
+        remaining += atomic_read(&spapr->htab_dirty_groups) *
+                     HASH_PTEG_SIZE_64;
+    } else if (spapr->htab_first_pass) {
+        /* The kernel does not tell how far it got */
+        remaining = HTAB_SIZE(spapr);
+    }
+
+    /*
+     * Without this, the HPT does not hold back convergence and whatever
+     * is left of it is sent while the guest is stopped.
+     */
+    *res_precopy_only += remaining;
+}
+
 static void htab_save_cleanup(void *opaque)
 {
     SpaprMachineState *spapr = opaque;
 
+    g_free(spapr->htab_dirty_map);
+    spapr->htab_dirty_map = NULL;
     close_htab_fd(spapr);
 }
 
 static SaveVMHandlers savevm_htab_handlers = {
     .save_setup = htab_save_setup,
     .save_live_iterate = htab_save_iterate,
+    .save_live_pending = htab_save_pending,
     .save_live_complete_precopy = htab_save_complete,
     .save_cleanup = htab_save_cleanup,
     .load_state = htab_load,
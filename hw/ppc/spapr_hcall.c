@@ -748,6 +748,7 @@ static target_ulong h_resize_hpt_commit(PowerPCCPU *cpu,
         qemu_vfree(spapr->htab);
         spapr->htab = pending->hpt;
         spapr->htab_shift = pending->shift;
+        spapr_htab_dirty_map_reset(spapr);
 
         push_sregs_to_kvm_pr(spapr);
 
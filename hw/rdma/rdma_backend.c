@@ -88,18 +88,22 @@ static void clean_recv_mads(RdmaBackendDev *backend_dev)
     } while (cqe_ctx_id != -ENOENT);
 }
 
-static int rdma_poll_cq(RdmaDeviceResources *rdma_dev_res, struct ibv_cq *ibcq)
+static int rdma_poll_cq(RdmaDeviceResources *rdma_dev_res, RdmaBackendCQ *cq)
 {
     int i, ne, total_ne = 0;
     BackendCtx *bctx;
     struct ibv_wc wc[2];
     RdmaProtectedGSList *cqe_ctx_list;
 
-    qemu_mutex_lock(&rdma_dev_res->lock);
+    /*
+     * Only this CQ is locked, CQs served by other completion threads are
+     * polled in parallel
+     */
+    qemu_mutex_lock(&cq->lock);
     do {
-        ne = ibv_poll_cq(ibcq, ARRAY_SIZE(wc), wc);
+        ne = ibv_poll_cq(cq->ibcq, ARRAY_SIZE(wc), wc);
 
-        trace_rdma_poll_cq(ne, ibcq);
+        trace_rdma_poll_cq(ne, cq->ibcq);
 
         for (i = 0; i < ne; i++) {
             bctx = rdma_rm_get_cqe_ctx(rdma_dev_res, wc[i].wr_id);
@@ -124,49 +128,41 @@ static int rdma_poll_cq(RdmaDeviceResources *rdma_dev_res, struct ibv_cq *ibcq)
         total_ne += ne;
     } while (ne > 0);
     atomic_sub(&rdma_dev_res->stats.missing_cqe, total_ne);
-    qemu_mutex_unlock(&rdma_dev_res->lock);
+    qemu_mutex_unlock(&cq->lock);
 
     if (ne < 0) {
         rdma_error_report("ibv_poll_cq fail, rc=%d, errno=%d", ne, errno);
     }
 
-    rdma_dev_res->stats.completions += total_ne;
+    atomic_add(&rdma_dev_res->stats.completions, total_ne);
 
     return total_ne;
 }
 
 static void *comp_handler_thread(void *arg)
 {
-    RdmaBackendDev *backend_dev = (RdmaBackendDev *)arg;
+    RdmaBackendCompChannel *comp = arg;
+    RdmaBackendDev *backend_dev = comp->backend_dev;
     int rc;
     struct ibv_cq *ev_cq;
     void *ev_ctx;
-    int flags;
     GPollFD pfds[1];
 
-    /* Change to non-blocking mode */
-    flags = fcntl(backend_dev->channel->fd, F_GETFL);
-    rc = fcntl(backend_dev->channel->fd, F_SETFL, flags | O_NONBLOCK);
-    if (rc < 0) {
-        rdma_error_report("Failed to change backend channel FD to non-blocking");
-        return NULL;
-    }
-
-    pfds[0].fd = backend_dev->channel->fd;
+    pfds[0].fd = comp->channel->fd;
     pfds[0].events = G_IO_IN | G_IO_HUP | G_IO_ERR;
 
-    backend_dev->comp_thread.is_running = true;
+    comp->thread.is_running = true;
 
-    while (backend_dev->comp_thread.run) {
+    while (comp->thread.run) {
         do {
             rc = qemu_poll_ns(pfds, 1, THR_POLL_TO * (int64_t)SCALE_MS);
             if (!rc) {
-                backend_dev->rdma_dev_res->stats.poll_cq_ppoll_to++;
+                atomic_inc(&backend_dev->rdma_dev_res->stats.poll_cq_ppoll_to);
             }
-        } while (!rc && backend_dev->comp_thread.run);
+        } while (!rc && comp->thread.run);
 
-        if (backend_dev->comp_thread.run) {
-            rc = ibv_get_cq_event(backend_dev->channel, &ev_cq, &ev_ctx);
+        if (comp->thread.run) {
+            rc = ibv_get_cq_event(comp->channel, &ev_cq, &ev_ctx);
             if (unlikely(rc)) {
                 rdma_error_report("ibv_get_cq_event fail, rc=%d, errno=%d", rc,
                                   errno);
@@ -179,14 +175,15 @@ static void *comp_handler_thread(void *arg)
                                   errno);
             }
 
-            backend_dev->rdma_dev_res->stats.poll_cq_from_bk++;
-            rdma_poll_cq(backend_dev->rdma_dev_res, ev_cq);
+            atomic_inc(&backend_dev->rdma_dev_res->stats.poll_cq_from_bk);
+            /* ev_ctx is the RdmaBackendCQ given to ibv_create_cq() */
+            rdma_poll_cq(backend_dev->rdma_dev_res, ev_ctx);
 
             ibv_ack_cq_events(ev_cq, 1);
         }
     }
 
-    backend_dev->comp_thread.is_running = false;
+    comp->thread.is_running = false;
 
     qemu_thread_exit(0);
 
@@ -271,17 +268,83 @@ static void stop_backend_thread(RdmaBackendThread *thread)
     }
 }
 
-static void start_comp_thread(RdmaBackendDev *backend_dev)
+static void start_comp_threads(RdmaBackendDev *backend_dev)
 {
     char thread_name[THR_NAME_LEN] = {};
+    RdmaBackendCompChannel *comp;
+    int i;
 
-    stop_backend_thread(&backend_dev->comp_thread);
+    for (i = 0; i < backend_dev->num_comp_channels; i++) {
+        comp = &backend_dev->comp_channels[i];
 
-    snprintf(thread_name, sizeof(thread_name), "rdma_comp_%s",
-             ibv_get_device_name(backend_dev->ib_dev));
-    backend_dev->comp_thread.run = true;
-    qemu_thread_create(&backend_dev->comp_thread.thread, thread_name,
-                       comp_handler_thread, backend_dev, QEMU_THREAD_DETACHED);
+        stop_backend_thread(&comp->thread);
+
+        snprintf(thread_name, sizeof(thread_name), "rdma_comp%d_%s", i,
+                 ibv_get_device_name(backend_dev->ib_dev));
+        comp->thread.run = true;
+        qemu_thread_create(&comp->thread.thread, thread_name,
+                           comp_handler_thread, comp, QEMU_THREAD_DETACHED);
+    }
+}
+
+static void stop_comp_threads(RdmaBackendDev *backend_dev)
+{
+    int i;
+
+    for (i = 0; i < backend_dev->num_comp_channels; i++) {
+        stop_backend_thread(&backend_dev->comp_channels[i].thread);
+    }
+}
+
+static void destroy_comp_channels(RdmaBackendDev *backend_dev)
+{
+    int i;
+
+    for (i = 0; i < backend_dev->num_comp_channels; i++) {
+        if (backend_dev->comp_channels[i].channel) {
+            ibv_destroy_comp_channel(backend_dev->comp_channels[i].channel);
+        }
+    }
+    g_free(backend_dev->comp_channels);
+    backend_dev->comp_channels = NULL;
+}
+
+static int create_comp_channels(RdmaBackendDev *backend_dev,
+                                uint8_t num_comp_channels)
+{
+    RdmaBackendCompChannel *comp;
+    int i, flags, rc;
+
+    backend_dev->num_comp_channels = num_comp_channels;
+    backend_dev->next_comp_channel = 0;
+    backend_dev->comp_channels = g_new0(RdmaBackendCompChannel,
+                                        num_comp_channels);
+
+    for (i = 0; i < num_comp_channels; i++) {
+        comp = &backend_dev->comp_channels[i];
+        comp->backend_dev = backend_dev;
+
+        comp->channel = ibv_create_comp_channel(backend_dev->context);
+        if (!comp->channel) {
+            rdma_error_report("Failed to create IB communication channel");
+            goto err;
+        }
+
+        /* Change to non-blocking mode */
+        flags = fcntl(comp->channel->fd, F_GETFL);
+        rc = fcntl(comp->channel->fd, F_SETFL, flags | O_NONBLOCK);
+        if (rc < 0) {
+            rdma_error_report("Failed to change backend channel FD to "
+                              "non-blocking");
+            goto err;
+        }
+    }
+
+    return 0;
+
+err:
+    destroy_comp_channels(backend_dev);
+    return -EIO;
 }
 
 void rdma_backend_register_comp_handler(void (*handler)(void *ctx,
@@ -313,10 +376,10 @@ void rdma_backend_poll_cq(RdmaDeviceResources *rdma_dev_res, RdmaBackendCQ *cq)
 {
     int polled;
 
-    rdma_dev_res->stats.poll_cq_from_guest++;
-    polled = rdma_poll_cq(rdma_dev_res, cq->ibcq);
+    atomic_inc(&rdma_dev_res->stats.poll_cq_from_guest);
+    polled = rdma_poll_cq(rdma_dev_res, cq);
     if (!polled) {
-        rdma_dev_res->stats.poll_cq_from_guest_empty++;
+        atomic_inc(&rdma_dev_res->stats.poll_cq_from_guest_empty);
     }
 }
 
@@ -759,12 +822,20 @@ void rdma_backend_destroy_mr(RdmaBackendMR *mr)
 int rdma_backend_create_cq(RdmaBackendDev *backend_dev, RdmaBackendCQ *cq,
                            int cqe)
 {
+    RdmaBackendCompChannel *comp;
     int rc;
 
-    cq->ibcq = ibv_create_cq(backend_dev->context, cqe + 1, NULL,
-                             backend_dev->channel, 0);
+    /* Round robin, so that busy CQs are spread over the comp threads */
+    comp = &backend_dev->comp_channels[backend_dev->next_comp_channel++ %
+                                       backend_dev->num_comp_channels];
+
+    qemu_mutex_init(&cq->lock);
+
+    cq->ibcq = ibv_create_cq(backend_dev->context, cqe + 1, cq,
+                             comp->channel, 0);
     if (!cq->ibcq) {
         rdma_error_report("ibv_create_cq fail, errno=%d", errno);
+        qemu_mutex_destroy(&cq->lock);
         return -EIO;
     }
 
@@ -782,6 +853,7 @@ void rdma_backend_destroy_cq(RdmaBackendCQ *cq)
 {
     if (cq->ibcq) {
         ibv_destroy_cq(cq->ibcq);
+        qemu_mutex_destroy(&cq->lock);
     }
 }
 
@@ -1270,7 +1342,8 @@ int rdma_backend_del_gid(RdmaBackendDev *backend_dev, const char *ifname,
 int rdma_backend_init(RdmaBackendDev *backend_dev, PCIDevice *pdev,
                       RdmaDeviceResources *rdma_dev_res,
                       const char *backend_device_name, uint8_t port_num,
-                      struct ibv_device_attr *dev_attr, CharBackend *mad_chr_be)
+                      struct ibv_device_attr *dev_attr, CharBackend *mad_chr_be,
+                      uint8_t num_comp_threads)
 {
     int i;
     int ret = 0;
@@ -1326,10 +1399,8 @@ int rdma_backend_init(RdmaBackendDev *backend_dev, PCIDevice *pdev,
         goto out;
     }
 
-    backend_dev->channel = ibv_create_comp_channel(backend_dev->context);
-    if (!backend_dev->channel) {
-        rdma_error_report("Failed to create IB communication channel");
-        ret = -EIO;
+    ret = create_comp_channels(backend_dev, num_comp_threads);
+    if (ret) {
         goto out_close_device;
     }
 
@@ -1348,15 +1419,12 @@ int rdma_backend_init(RdmaBackendDev *backend_dev, PCIDevice *pdev,
         goto out_destroy_comm_channel;
     }
 
-    backend_dev->comp_thread.run = false;
-    backend_dev->comp_thread.is_running = false;
-
     ah_cache_init();
 
     goto out_free_dev_list;
 
 out_destroy_comm_channel:
-    ibv_destroy_comp_channel(backend_dev->channel);
+    destroy_comp_channels(backend_dev);
 
 out_close_device:
     ibv_close_device(backend_dev->context);
@@ -1371,19 +1439,19 @@ out:
 
 void rdma_backend_start(RdmaBackendDev *backend_dev)
 {
-    start_comp_thread(backend_dev);
+    start_comp_threads(backend_dev);
 }
 
 void rdma_backend_stop(RdmaBackendDev *backend_dev)
 {
     mad_stop(backend_dev);
-    stop_backend_thread(&backend_dev->comp_thread);
+    stop_comp_threads(backend_dev);
 }
 
 void rdma_backend_fini(RdmaBackendDev *backend_dev)
 {
     mad_fini(backend_dev);
     g_hash_table_destroy(ah_hash);
-    ibv_destroy_comp_channel(backend_dev->channel);
+    destroy_comp_channels(backend_dev);
     ibv_close_device(backend_dev->context);
 }
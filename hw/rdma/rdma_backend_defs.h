@@ -30,18 +30,26 @@ typedef struct RdmaBackendThread {
     bool is_running; /* Set by the thread to report its status */
 } RdmaBackendThread;
 
+typedef struct RdmaBackendCompChannel {
+    RdmaBackendThread thread;
+    struct ibv_comp_channel *channel;
+    struct RdmaBackendDev *backend_dev;
+} RdmaBackendCompChannel;
+
 typedef struct RdmaCmMux {
     CharBackend *chr_be;
     int can_receive;
 } RdmaCmMux;
 
 typedef struct RdmaBackendDev {
-    RdmaBackendThread comp_thread;
+    /* Each channel is polled by its own thread, CQs are spread over them */
+    RdmaBackendCompChannel *comp_channels;
+    uint8_t num_comp_channels;
+    unsigned int next_comp_channel;
     PCIDevice *dev;
     RdmaDeviceResources *rdma_dev_res;
     struct ibv_device *ib_dev;
     struct ibv_context *context;
-    struct ibv_comp_channel *channel;
     uint8_t port_num;
     RdmaProtectedQList recv_mads_list;
     RdmaCmMux rdmacm_mux;
@@ -59,6 +67,7 @@ typedef struct RdmaBackendMR {
 typedef struct RdmaBackendCQ {
     RdmaBackendDev *backend_dev;
     struct ibv_cq *ibcq;
+    QemuMutex lock; /* Serializes polling from guest and comp thread */
 } RdmaBackendCQ;
 
 typedef struct RdmaBackendQP {
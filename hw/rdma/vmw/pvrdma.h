@@ -92,6 +92,7 @@ typedef struct PVRDMADev {
     char *backend_eth_device_name;
     char *backend_device_name;
     uint8_t backend_port_num;
+    uint8_t comp_threads;
     RdmaBackendDev backend_dev;
     RdmaDeviceResources rdma_dev_res;
     CharBackend mad_chr;
@@ -132,7 +133,7 @@ static inline void post_interrupt(PVRDMADev *dev, unsigned vector)
     PCIDevice *pci_dev = PCI_DEVICE(dev);
 
     if (likely(!dev->interrupt_mask)) {
-        dev->stats.interrupts++;
+        atomic_inc(&dev->stats.interrupts);
         msix_notify(pci_dev, vector);
     }
 }
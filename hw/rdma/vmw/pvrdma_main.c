@@ -54,6 +54,7 @@ static Property pvrdma_dev_properties[] = {
     DEFINE_PROP_INT32("dev-caps-max-ah", PVRDMADev, dev_attr.max_ah, MAX_AH),
     DEFINE_PROP_INT32("dev-caps-max-srq", PVRDMADev, dev_attr.max_srq, MAX_SRQ),
     DEFINE_PROP_CHR("mad-chardev", PVRDMADev, mad_chr),
+    DEFINE_PROP_UINT8("comp-threads", PVRDMADev, comp_threads, 1),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -606,6 +607,11 @@ static void pvrdma_realize(PCIDevice *pdev, Error **errp)
         return;
     }
 
+    if (!dev->comp_threads) {
+        error_setg(errp, "comp-threads must be at least 1");
+        return;
+    }
+
     func0 = pci_get_function_0(pdev);
     /* Break if not vmxnet3 device in slot 0 */
     if (strcmp(object_get_typename(OBJECT(func0)), TYPE_VMXNET3)) {
@@ -642,7 +648,7 @@ static void pvrdma_realize(PCIDevice *pdev, Error **errp)
 
     rc = rdma_backend_init(&dev->backend_dev, pdev, &dev->rdma_dev_res,
                            dev->backend_device_name, dev->backend_port_num,
-                           &dev->dev_attr, &dev->mad_chr);
+                           &dev->dev_attr, &dev->mad_chr, dev->comp_threads);
     if (rc) {
         goto out;
     }
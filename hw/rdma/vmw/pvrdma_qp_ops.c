@@ -84,14 +84,20 @@ static int pvrdma_post_cqe(PVRDMADev *dev, uint32_t cq_handle,
 
     pvrdma_ring_write_inc(ring);
 
-    /* Step #2: Put CQ number on dsr completion ring */
+    /*
+     * Step #2: Put CQ number on dsr completion ring, it is shared by all
+     * CQs and so by all completion threads
+     */
+    qemu_mutex_lock(&dev->rdma_dev_res.lock);
     cqne = pvrdma_ring_next_elem_write(&dev->dsr_info.cq);
     if (unlikely(!cqne)) {
+        qemu_mutex_unlock(&dev->rdma_dev_res.lock);
         return -EINVAL;
     }
 
     cqne->info = cq_handle;
     pvrdma_ring_write_inc(&dev->dsr_info.cq);
+    qemu_mutex_unlock(&dev->rdma_dev_res.lock);
 
     if (cq->notify != CNT_CLEAR) {
         if (cq->notify == CNT_ARM) {
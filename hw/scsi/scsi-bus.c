@@ -1572,6 +1572,32 @@ SCSIDevice *scsi_device_find(SCSIBus *bus, int channel, int id, int lun)
     return target_dev;
 }
 
+/*
+ * Return the AioContext in which requests for @dev are submitted and
+ * completed.  HBAs that spread their queues over several IOThreads must hold
+ * this context while creating and enqueuing requests for the LUN.
+ */
+AioContext *scsi_device_get_aio_context(SCSIDevice *dev)
+{
+    if (!dev->conf.blk) {
+        return qemu_get_aio_context();
+    }
+    return blk_get_aio_context(dev->conf.blk);
+}
+
+/*
+ * Bind the LUN to @ctx.  Different LUNs of one HBA may live in different
+ * AioContexts so that they do not serialize on a single IOThread.
+ */
+int scsi_device_set_aio_context(SCSIDevice *dev, AioContext *ctx,
+                                Error **errp)
+{
+    if (!dev->conf.blk) {
+        return 0;
+    }
+    return blk_set_aio_context(dev->conf.blk, ctx, errp);
+}
+
 /* SCSI request list.  For simplicity, pv points to the whole device */
 
 static int put_scsi_requests(QEMUFile *f, void *pv, size_t size,
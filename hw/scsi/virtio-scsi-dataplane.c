@@ -21,6 +21,93 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Context: QEMU global mutex held */
+static bool virtio_scsi_dataplane_setup_vq_iothreads(VirtIOSCSI *s,
+                                                     Error **errp)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    char **ids = g_strsplit(vs->conf.iothread_vq_mapping, ":", -1);
+    unsigned n = g_strv_length(ids);
+    unsigned nvqs = vs->conf.num_queues + 2;
+    unsigned i;
+
+    if (vs->conf.iothread) {
+        error_setg(errp, "iothread and iothread-vq-mapping properties "
+                   "cannot be used together");
+        goto fail;
+    }
+    if (n == 0) {
+        error_setg(errp, "iothread-vq-mapping must not be empty");
+        goto fail;
+    }
+
+    s->vq_iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "iothread '%s' in iothread-vq-mapping not found",
+                       ids[i]);
+            while (i--) {
+                object_unref(OBJECT(s->vq_iothreads[i]));
+            }
+            g_free(s->vq_iothreads);
+            s->vq_iothreads = NULL;
+            goto fail;
+        }
+        object_ref(OBJECT(iothread));
+        s->vq_iothreads[i] = iothread;
+    }
+    s->num_vq_iothreads = n;
+    g_strfreev(ids);
+
+    /* Control and event queues stay in the first IOThread */
+    s->ctx = iothread_get_aio_context(s->vq_iothreads[0]);
+    s->vq_ctx = g_new(AioContext *, nvqs);
+    s->vq_completions = g_new0(VirtIOSCSIVqCompletions, nvqs);
+    for (i = 0; i < nvqs; i++) {
+        if (i < 2) {
+            s->vq_ctx[i] = s->ctx;
+        } else {
+            IOThread *iothread = s->vq_iothreads[(i - 2) % n];
+            s->vq_ctx[i] = iothread_get_aio_context(iothread);
+        }
+        s->vq_completions[i].s = s;
+        s->vq_completions[i].vq = virtio_get_queue(VIRTIO_DEVICE(s), i);
+        qemu_mutex_init(&s->vq_completions[i].lock);
+        QTAILQ_INIT(&s->vq_completions[i].reqs);
+    }
+    return true;
+
+fail:
+    g_strfreev(ids);
+    return false;
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    unsigned i;
+
+    if (s->vq_completions) {
+        for (i = 0; i < vs->conf.num_queues + 2; i++) {
+            assert(QTAILQ_EMPTY(&s->vq_completions[i].reqs));
+            qemu_mutex_destroy(&s->vq_completions[i].lock);
+        }
+    }
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_ctx);
+    g_free(s->vq_completions);
+    s->vq_iothreads = NULL;
+    s->num_vq_iothreads = 0;
+    s->vq_ctx = NULL;
+    s->vq_completions = NULL;
+}
+
 /* Context: QEMU global mutex held */
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
 {
@@ -29,7 +116,7 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothread || vs->conf.iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -40,6 +127,10 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
             error_setg(errp, "ioeventfd is required for iothread");
             return;
         }
+        if (vs->conf.iothread_vq_mapping) {
+            virtio_scsi_dataplane_setup_vq_iothreads(s, errp);
+            return;
+        }
         s->ctx = iothread_get_aio_context(vs->conf.iothread);
     } else {
         if (!virtio_device_ioeventfd_enabled(vdev)) {
@@ -55,6 +146,12 @@ static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
     bool progress;
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
 
+    if (s->num_vq_iothreads) {
+        /* LUN AioContexts are acquired per request */
+        assert(s->dataplane_started);
+        return virtio_scsi_handle_cmd_vq(s, vq);
+    }
+
     virtio_scsi_acquire(s);
     assert(s->ctx && s->dataplane_started);
     progress = virtio_scsi_handle_cmd_vq(s, vq);
@@ -92,6 +189,7 @@ static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
                                   VirtIOHandleAIOOutput fn)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s)));
+    AioContext *ctx = virtio_scsi_vq_ctx(s, vq);
     int rc;
 
     /* Set up virtqueue notify */
@@ -103,7 +201,13 @@ static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
         return rc;
     }
 
-    virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, fn);
+    if (s->num_vq_iothreads) {
+        aio_context_acquire(ctx);
+    }
+    virtio_queue_aio_set_host_notifier_handler(vq, ctx, fn);
+    if (s->num_vq_iothreads) {
+        aio_context_release(ctx);
+    }
     return 0;
 }
 
@@ -121,6 +225,43 @@ static void virtio_scsi_dataplane_stop_bh(void *opaque)
     }
 }
 
+/*
+ * Stop notifications and push completions deferred by other IOThreads for
+ * one request queue when iothread-vq-mapping is used.
+ *
+ * Context: BH in the IOThread that handles the virtqueue
+ */
+static void virtio_scsi_dataplane_stop_vq_bh(void *opaque)
+{
+    VirtIOSCSIVqCompletions *c = opaque;
+
+    virtio_queue_aio_set_host_notifier_handler(c->vq,
+            virtio_scsi_vq_ctx(c->s, c->vq), NULL);
+    virtio_scsi_flush_vq_completions(c->s, c->vq);
+}
+
+static void virtio_scsi_dataplane_stop_vqs(VirtIOSCSI *s)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    int i;
+
+    if (!s->num_vq_iothreads) {
+        aio_context_acquire(s->ctx);
+        aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
+        aio_context_release(s->ctx);
+        return;
+    }
+
+    for (i = 0; i < vs->conf.num_queues + 2; i++) {
+        VirtIOSCSIVqCompletions *c = &s->vq_completions[i];
+        AioContext *ctx = virtio_scsi_vq_ctx(s, c->vq);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_scsi_dataplane_stop_vq_bh, c);
+        aio_context_release(ctx);
+    }
+}
+
 /* Context: QEMU global mutex held */
 int virtio_scsi_dataplane_start(VirtIODevice *vdev)
 {
@@ -147,7 +288,9 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
         goto fail_guest_notifiers;
     }
 
-    aio_context_acquire(s->ctx);
+    if (!s->num_vq_iothreads) {
+        aio_context_acquire(s->ctx);
+    }
     rc = virtio_scsi_vring_init(s, vs->ctrl_vq, 0,
                                 virtio_scsi_data_plane_handle_ctrl);
     if (rc) {
@@ -168,12 +311,16 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
 
     s->dataplane_starting = false;
     s->dataplane_started = true;
-    aio_context_release(s->ctx);
+    if (!s->num_vq_iothreads) {
+        aio_context_release(s->ctx);
+    }
     return 0;
 
 fail_vrings:
-    aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
-    aio_context_release(s->ctx);
+    if (!s->num_vq_iothreads) {
+        aio_context_release(s->ctx);
+    }
+    virtio_scsi_dataplane_stop_vqs(s);
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
@@ -207,12 +354,17 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     }
     s->dataplane_stopping = true;
 
-    aio_context_acquire(s->ctx);
-    aio_wait_bh_oneshot(s->ctx, virtio_scsi_dataplane_stop_bh, s);
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_stop_vqs(s);
 
     blk_drain_all(); /* ensure there are no in-flight requests */
 
+    if (s->num_vq_iothreads) {
+        /* Completions of the drained requests may have been deferred */
+        for (i = 0; i < vs->conf.num_queues + 2; i++) {
+            virtio_scsi_flush_vq_completions(s, virtio_get_queue(vdev, i));
+        }
+    }
+
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
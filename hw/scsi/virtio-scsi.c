@@ -28,6 +28,9 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Number of requests moved to or from a virtqueue at once */
+#define VIRTIO_SCSI_BATCH 32
+
 static inline int virtio_scsi_get_lun(uint8_t *lun)
 {
     return ((lun[2] << 8) | lun[3]) & 0x3FFF;
@@ -64,25 +67,127 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req)
     g_free(req);
 }
 
+/*
+ * Return the AioContext that owns @vq.  Only that context may touch the
+ * vring while dataplane is running.
+ */
+AioContext *virtio_scsi_vq_ctx(VirtIOSCSI *s, VirtQueue *vq)
+{
+    if (!s->vq_ctx) {
+        return s->ctx;
+    }
+    if (s->dataplane_fenced) {
+        return qemu_get_aio_context();
+    }
+    return s->vq_ctx[virtio_get_queue_index(vq)];
+}
+
+static void virtio_scsi_push_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                  VirtIOSCSIReq **reqs, unsigned int n);
+static void virtio_scsi_push_req(VirtIOSCSIReq *req);
+
+void virtio_scsi_flush_vq_completions(VirtIOSCSI *s, VirtQueue *vq)
+{
+    VirtIOSCSIVqCompletions *c =
+        &s->vq_completions[virtio_get_queue_index(vq)];
+    VirtIOSCSIReq *reqs[VIRTIO_SCSI_BATCH];
+    unsigned int n;
+
+    do {
+        n = 0;
+        qemu_mutex_lock(&c->lock);
+        while (n < ARRAY_SIZE(reqs) && !QTAILQ_EMPTY(&c->reqs)) {
+            reqs[n] = QTAILQ_FIRST(&c->reqs);
+            QTAILQ_REMOVE(&c->reqs, reqs[n], next);
+            n++;
+        }
+        qemu_mutex_unlock(&c->lock);
+
+        virtio_scsi_push_reqs(s, vq, reqs, n);
+    } while (n == ARRAY_SIZE(reqs));
+}
+
+static void virtio_scsi_vq_completion_bh(void *opaque)
+{
+    VirtIOSCSIVqCompletions *c = opaque;
+
+    virtio_scsi_flush_vq_completions(c->s, c->vq);
+}
+
 static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
 {
     VirtIOSCSI *s = req->dev;
-    VirtQueue *vq = req->vq;
+    AioContext *ctx;
+    VirtIOSCSIVqCompletions *c;
+    bool kick;
+
+    if (!s->vq_completions) {
+        virtio_scsi_push_req(req);
+        return;
+    }
+
+    /*
+     * Requests complete in the AioContext of their LUN.  Hand them over to
+     * the thread that owns the virtqueue instead of taking its lock, so
+     * that no thread ever holds two IOThread AioContexts at once.
+     */
+    ctx = virtio_scsi_vq_ctx(s, req->vq);
+    if (ctx == qemu_get_current_aio_context()) {
+        virtio_scsi_push_req(req);
+        return;
+    }
+
+    c = &s->vq_completions[virtio_get_queue_index(req->vq)];
+    qemu_mutex_lock(&c->lock);
+    kick = QTAILQ_EMPTY(&c->reqs);
+    QTAILQ_INSERT_TAIL(&c->reqs, req, next);
+    qemu_mutex_unlock(&c->lock);
+
+    if (kick) {
+        aio_bh_schedule_oneshot(ctx, virtio_scsi_vq_completion_bh, c);
+    }
+}
+
+/* Return @n requests of @vq to the guest with one used index update */
+static void virtio_scsi_push_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                  VirtIOSCSIReq **reqs, unsigned int n)
+{
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    VirtQueueElement *elems[VIRTIO_SCSI_BATCH];
+    unsigned int lens[VIRTIO_SCSI_BATCH];
+    unsigned int i;
 
-    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
-    virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
+    if (!n) {
+        return;
+    }
+
+    assert(n <= VIRTIO_SCSI_BATCH);
+    for (i = 0; i < n; i++) {
+        VirtIOSCSIReq *req = reqs[i];
+
+        qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
+        elems[i] = &req->elem;
+        lens[i] = req->qsgl.size + req->resp_iov.size;
+    }
+    virtqueue_push_batch(vq, elems, lens, n);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
 
-    if (req->sreq) {
-        req->sreq->hba_private = NULL;
-        scsi_req_unref(req->sreq);
+    for (i = 0; i < n; i++) {
+        if (reqs[i]->sreq) {
+            reqs[i]->sreq->hba_private = NULL;
+            scsi_req_unref(reqs[i]->sreq);
+        }
+        virtio_scsi_free_req(reqs[i]);
     }
-    virtio_scsi_free_req(req);
+}
+
+static void virtio_scsi_push_req(VirtIOSCSIReq *req)
+{
+    virtio_scsi_push_reqs(req->dev, req->vq, &req, 1);
 }
 
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
@@ -186,6 +291,21 @@ static VirtIOSCSIReq *virtio_scsi_pop_req(VirtIOSCSI *s, VirtQueue *vq)
     return req;
 }
 
+static unsigned int virtio_scsi_pop_reqs(VirtIOSCSI *s, VirtQueue *vq,
+                                         VirtIOSCSIReq **reqs,
+                                         unsigned int max)
+{
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    unsigned int i, n;
+
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                            (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_scsi_init_req(s, vq, reqs[i]);
+    }
+    return n;
+}
+
 static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 {
     VirtIOSCSIReq *req = sreq->hba_private;
@@ -194,7 +314,7 @@ static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 
     assert(n < vs->conf.num_queues);
     qemu_put_be32s(f, &n);
-    qemu_put_virtqueue_element(f, &req->elem);
+    qemu_put_virtqueue_element(VIRTIO_DEVICE(req->dev), f, &req->elem);
 }
 
 static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
@@ -245,7 +365,8 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
 
 static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
 {
-    if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
+    if (s->dataplane_started && !s->num_vq_iothreads &&
+        d && blk_is_available(d->conf.blk)) {
         assert(blk_get_aio_context(d->conf.blk) == s->ctx);
     }
 }
@@ -258,10 +379,15 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
     SCSIDevice *d = virtio_scsi_device_find(s, req->req.tmf.lun);
     SCSIRequest *r, *next;
     BusChild *kid;
+    AioContext *lun_ctx = NULL;
     int target;
     int ret = 0;
 
     virtio_scsi_ctx_check(s, d);
+    if (s->num_vq_iothreads && d) {
+        lun_ctx = scsi_device_get_aio_context(d);
+        aio_context_acquire(lun_ctx);
+    }
     /* Here VIRTIO_SCSI_S_OK means "FUNCTION COMPLETE".  */
     req->resp.tmf.response = VIRTIO_SCSI_S_OK;
 
@@ -369,7 +495,15 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         QTAILQ_FOREACH(kid, &s->bus.qbus.children, sibling) {
              d = SCSI_DEVICE(kid->child);
              if (d->channel == 0 && d->id == target) {
+                AioContext *ctx = scsi_device_get_aio_context(d);
+
+                if (s->num_vq_iothreads) {
+                    aio_context_acquire(ctx);
+                }
                 qdev_reset_all(&d->qdev);
+                if (s->num_vq_iothreads) {
+                    aio_context_release(ctx);
+                }
              }
         }
         s->resetting--;
@@ -380,15 +514,19 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         req->resp.tmf.response = VIRTIO_SCSI_S_FUNCTION_REJECTED;
         break;
     }
-
-    return ret;
+    goto out;
 
 incorrect_lun:
     req->resp.tmf.response = VIRTIO_SCSI_S_INCORRECT_LUN;
-    return ret;
+    goto out;
 
 fail:
     req->resp.tmf.response = VIRTIO_SCSI_S_BAD_TARGET;
+
+out:
+    if (lun_ctx) {
+        aio_context_release(lun_ctx);
+    }
     return ret;
 }
 
@@ -566,6 +704,14 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
         return -ENOENT;
     }
     virtio_scsi_ctx_check(s, d);
+
+    /*
+     * With several IOThreads the LUN's AioContext is held from here until
+     * virtio_scsi_handle_cmd_req_submit() returns.
+     */
+    if (s->num_vq_iothreads) {
+        aio_context_acquire(scsi_device_get_aio_context(d));
+    }
     req->sreq = scsi_req_new(d, req->req.cmd.tag,
                              virtio_scsi_get_lun(req->req.cmd.lun),
                              req->req.cmd.cdb, req);
@@ -575,6 +721,9 @@ static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
             req->sreq->cmd.xfer > req->qsgl.size)) {
         req->resp.cmd.response = VIRTIO_SCSI_S_OVERRUN;
         virtio_scsi_complete_cmd_req(req);
+        if (s->num_vq_iothreads) {
+            aio_context_release(scsi_device_get_aio_context(d));
+        }
         return -ENOBUFS;
     }
     scsi_req_ref(req->sreq);
@@ -594,7 +743,9 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
 
 bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSIReq *batch[VIRTIO_SCSI_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, n;
     int ret = 0;
     bool progress = false;
 
@@ -603,12 +754,28 @@ bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
     do {
         virtio_queue_set_notification(vq, 0);
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
+        while (ret != -EINVAL &&
+               (n = virtio_scsi_pop_reqs(s, vq, batch, ARRAY_SIZE(batch)))) {
             progress = true;
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
+            for (i = 0; i < n && ret != -EINVAL; i++) {
+                req = batch[i];
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret && s->num_vq_iothreads) {
+                    /*
+                     * Submit right away: batching would mean holding the
+                     * AioContexts of several LUNs at the same time.
+                     */
+                    AioContext *ctx =
+                        scsi_device_get_aio_context(req->sreq->dev);
+
+                    virtio_scsi_handle_cmd_req_submit(s, req);
+                    aio_context_release(ctx);
+                } else if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                }
+            }
+
+            if (ret == -EINVAL) {
                 /* The device is broken and shouldn't process any request */
                 while (!QTAILQ_EMPTY(&reqs)) {
                     req = QTAILQ_FIRST(&reqs);
@@ -618,6 +785,12 @@ bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
                     virtqueue_detach_element(req->vq, &req->elem, 0);
                     virtio_scsi_free_req(req);
                 }
+                /* Give back the requests that were popped but not parsed */
+                while (n > i) {
+                    req = batch[--n];
+                    virtqueue_unpop(vq, &req->elem, 0);
+                    virtio_scsi_free_req(req);
+                }
             }
         }
 
@@ -805,15 +978,22 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     VirtIODevice *vdev = VIRTIO_DEVICE(hotplug_dev);
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
     SCSIDevice *sd = SCSI_DEVICE(dev);
+    AioContext *ctx = s->ctx;
     int ret;
 
     if (s->ctx && !s->dataplane_fenced) {
         if (blk_op_is_blocked(sd->conf.blk, BLOCK_OP_TYPE_DATAPLANE, errp)) {
             return;
         }
-        virtio_scsi_acquire(s);
-        ret = blk_set_aio_context(sd->conf.blk, s->ctx, errp);
-        virtio_scsi_release(s);
+        if (s->num_vq_iothreads) {
+            /* Spread LUNs over the IOThreads in plug order */
+            IOThread *iothread =
+                s->vq_iothreads[s->next_lun_iothread++ % s->num_vq_iothreads];
+            ctx = iothread_get_aio_context(iothread);
+        }
+        aio_context_acquire(ctx);
+        ret = scsi_device_set_aio_context(sd, ctx, errp);
+        aio_context_release(ctx);
         if (ret < 0) {
             return;
         }
@@ -849,10 +1029,12 @@ static void virtio_scsi_hotunplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     aio_enable_external(ctx);
 
     if (s->ctx) {
-        virtio_scsi_acquire(s);
+        AioContext *lun_ctx = scsi_device_get_aio_context(sd);
+
+        aio_context_acquire(lun_ctx);
         /* If other users keep the BlockBackend in the iothread, that's ok */
-        blk_set_aio_context(sd->conf.blk, qemu_get_aio_context(), NULL);
-        virtio_scsi_release(s);
+        scsi_device_set_aio_context(sd, qemu_get_aio_context(), NULL);
+        aio_context_release(lun_ctx);
     }
 }
 
@@ -941,6 +1123,7 @@ static void virtio_scsi_device_unrealize(DeviceState *dev, Error **errp)
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL, &error_abort);
+    virtio_scsi_dataplane_cleanup(s);
     virtio_scsi_common_unrealize(dev);
 }
 
@@ -958,6 +1141,8 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOSCSI,
+                       parent_obj.conf.iothread_vq_mapping),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -31,6 +31,7 @@
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
+#include "qemu/main-loop.h"
 #include "hw/timer/hpet.h"
 #include "hw/sysbus.h"
 #include "hw/timer/mc146818rtc.h"
@@ -70,6 +71,11 @@ typedef struct HPETState {
     /*< public >*/
 
     MemoryRegion iomem;
+    /*
+     * Guest accesses only take this lock, code running under the BQL
+     * takes it as well when it touches the registers below.
+     */
+    QemuMutex lock;
     uint64_t hpet_offset;
     bool hpet_offset_saved;
     qemu_irq irqs[HPET_NUM_IRQ_ROUTES];
@@ -357,9 +363,12 @@ static void hpet_timer(void *opaque)
 {
     HPETTimer *t = opaque;
     uint64_t diff;
+    uint64_t period;
+    uint64_t cur_tick;
 
-    uint64_t period = t->period;
-    uint64_t cur_tick = hpet_get_ticks(t->state);
+    qemu_mutex_lock(&t->state->lock);
+    period = t->period;
+    cur_tick = hpet_get_ticks(t->state);
 
     if (timer_is_periodic(t) && period != 0) {
         if (t->config & HPET_TN_32BIT) {
@@ -383,6 +392,7 @@ static void hpet_timer(void *opaque)
         }
     }
     update_irq(t, 1);
+    qemu_mutex_unlock(&t->state->lock);
 }
 
 static void hpet_set_timer(HPETTimer *t)
@@ -501,16 +511,14 @@ static uint64_t hpet_ram_read(void *opaque, hwaddr addr,
     return 0;
 }
 
-static void hpet_ram_write(void *opaque, hwaddr addr,
-                           uint64_t value, unsigned size)
+static void hpet_ram_do_write(HPETState *s, hwaddr addr, uint64_t value)
 {
     int i;
-    HPETState *s = opaque;
     uint64_t old_val, new_val, val, index;
 
     DPRINTF("qemu: Enter hpet_ram_writel at %" PRIx64 " = %#x\n", addr, value);
     index = addr;
-    old_val = hpet_ram_read(opaque, addr, 4);
+    old_val = hpet_ram_read(s, addr, 4);
     new_val = value;
 
     /*address range of all TN regs*/
@@ -669,6 +677,19 @@ static void hpet_ram_write(void *opaque, hwaddr addr,
     }
 }
 
+static void hpet_ram_write(void *opaque, hwaddr addr,
+                           uint64_t value, unsigned size)
+{
+    HPETState *s = opaque;
+    /* Writes arm timers and change interrupt lines, which needs the BQL */
+    bool unlock = memory_region_lock_iothread(&s->iomem);
+
+    hpet_ram_do_write(s, addr, value);
+    if (unlock) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static const MemoryRegionOps hpet_ram_ops = {
     .read = hpet_ram_read,
     .write = hpet_ram_write,
@@ -685,6 +706,7 @@ static void hpet_reset(DeviceState *d)
     SysBusDevice *sbd = SYS_BUS_DEVICE(d);
     int i;
 
+    qemu_mutex_lock(&s->lock);
     for (i = 0; i < s->num_timers; i++) {
         HPETTimer *timer = &s->timer[i];
 
@@ -709,6 +731,7 @@ static void hpet_reset(DeviceState *d)
 
     /* to document that the RTC lowers its output on reset as well */
     s->rtc_irq_level = 0;
+    qemu_mutex_unlock(&s->lock);
 }
 
 static void hpet_handle_legacy_irq(void *opaque, int n, int level)
@@ -733,7 +756,10 @@ static void hpet_init(Object *obj)
     HPETState *s = HPET(obj);
 
     /* HPET Area */
+    qemu_mutex_init(&s->lock);
     memory_region_init_io(&s->iomem, obj, &hpet_ram_ops, s, "hpet", HPET_LEN);
+    /* Reads of the main counter are frequent and do not need the BQL */
+    memory_region_set_lock(&s->iomem, &s->lock);
     sysbus_init_mmio(sbd, &s->iomem);
 }
 
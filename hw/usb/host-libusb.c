@@ -87,6 +87,7 @@ struct USBHostDevice {
     uint32_t                         loglevel;
     bool                             needs_autoscan;
     bool                             allow_guest_reset;
+    bool                             event_thread;
     /* state */
     QTAILQ_ENTRY(USBHostDevice)      next;
     int                              seen, errcount;
@@ -124,6 +125,7 @@ struct USBHostRequest {
     unsigned int                     clen;
     bool                             usb3ep0quirk;
     QTAILQ_ENTRY(USBHostRequest)     next;
+    QSIMPLEQ_ENTRY(USBHostRequest)   done_next;
 };
 
 struct USBHostIsoXfer {
@@ -141,11 +143,26 @@ struct USBHostIsoRing {
     QTAILQ_HEAD(, USBHostIsoXfer)    inflight;
     QTAILQ_HEAD(, USBHostIsoXfer)    copy;
     QTAILQ_ENTRY(USBHostIsoRing)     next;
+    bool                             wakeup_pending;
+    QTAILQ_ENTRY(USBHostIsoRing)     wakeup_next;
 };
 
 static QTAILQ_HEAD(, USBHostDevice) hostdevs =
     QTAILQ_HEAD_INITIALIZER(hostdevs);
 
+/*
+ * With the event thread, libusb completions arrive without the BQL.  ISO
+ * completions only move transfers between ring lists, under usb_host_lock.
+ * Everything that needs the BQL is handed to usb_host_done_bh.
+ */
+static QemuMutex usb_host_lock;
+static QEMUBH *usb_host_done_bh;
+static QSIMPLEQ_HEAD(, USBHostRequest) usb_host_done =
+    QSIMPLEQ_HEAD_INITIALIZER(usb_host_done);
+static QTAILQ_HEAD(, USBHostIsoRing) usb_host_iso_wakeups =
+    QTAILQ_HEAD_INITIALIZER(usb_host_iso_wakeups);
+static bool usb_host_event_thread_running;
+
 static void usb_host_auto_check(void *unused);
 static void usb_host_release_interfaces(USBHostDevice *s);
 static void usb_host_nodev(USBHostDevice *s);
@@ -164,6 +181,9 @@ static void usb_host_attach_kernel(USBHostDevice *s);
 #define BULK_TIMEOUT         0        /* unlimited */
 #define INTR_TIMEOUT         0        /* unlimited */
 
+#define ISO_MAX_URB_COUNT    256
+#define ISO_MAX_URB_FRAMES   1024
+
 #ifndef LIBUSB_API_VERSION
 # define LIBUSB_API_VERSION LIBUSBX_API_VERSION
 #endif
@@ -238,6 +258,86 @@ static void usb_host_del_fd(int fd, void *user_data)
 
 #endif /* !CONFIG_WIN32 */
 
+static void usb_host_done_bh_cb(void *opaque)
+{
+    USBHostRequest *r;
+    USBHostIsoRing *ring;
+
+    qemu_mutex_lock(&usb_host_lock);
+    while ((ring = QTAILQ_FIRST(&usb_host_iso_wakeups)) != NULL) {
+        QTAILQ_REMOVE(&usb_host_iso_wakeups, ring, wakeup_next);
+        ring->wakeup_pending = false;
+        qemu_mutex_unlock(&usb_host_lock);
+        usb_wakeup(ring->ep, 0);
+        qemu_mutex_lock(&usb_host_lock);
+    }
+    while ((r = QSIMPLEQ_FIRST(&usb_host_done)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&usb_host_done, done_next);
+        qemu_mutex_unlock(&usb_host_lock);
+        /* Runs the completion again, this time with the BQL held */
+        r->xfer->callback(r->xfer);
+        qemu_mutex_lock(&usb_host_lock);
+    }
+    qemu_mutex_unlock(&usb_host_lock);
+}
+
+/* Returns true if the completion was queued for usb_host_done_bh */
+static bool usb_host_defer_completion(struct libusb_transfer *xfer)
+{
+    USBHostRequest *r = xfer->user_data;
+
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+
+    qemu_mutex_lock(&usb_host_lock);
+    QSIMPLEQ_INSERT_TAIL(&usb_host_done, r, done_next);
+    qemu_mutex_unlock(&usb_host_lock);
+    qemu_bh_schedule(usb_host_done_bh);
+    return true;
+}
+
+static void *usb_host_event_thread_fn(void *opaque)
+{
+    for (;;) {
+        libusb_handle_events(ctx);
+    }
+    return NULL;
+}
+
+/*
+ * libusb has one context for all usb-host devices, so once any of them
+ * asks for it, all events are handled in the thread instead of the main
+ * loop.
+ */
+static void usb_host_start_event_thread(void)
+{
+    static QemuThread thread;
+#ifndef CONFIG_WIN32
+    const struct libusb_pollfd **poll;
+    int i;
+#endif
+
+    if (usb_host_event_thread_running) {
+        return;
+    }
+    usb_host_event_thread_running = true;
+
+#ifndef CONFIG_WIN32
+    libusb_set_pollfd_notifiers(ctx, NULL, NULL, NULL);
+    poll = libusb_get_pollfds(ctx);
+    if (poll) {
+        for (i = 0; poll[i] != NULL; i++) {
+            usb_host_del_fd(poll[i]->fd, ctx);
+        }
+    }
+    free(poll);
+#endif
+
+    qemu_thread_create(&thread, "usb-host-events", usb_host_event_thread_fn,
+                       NULL, QEMU_THREAD_DETACHED);
+}
+
 static int usb_host_init(void)
 {
 #ifndef CONFIG_WIN32
@@ -252,6 +352,8 @@ static int usb_host_init(void)
     if (rc != 0) {
         return -1;
     }
+    qemu_mutex_init(&usb_host_lock);
+    usb_host_done_bh = qemu_bh_new(usb_host_done_bh_cb, NULL);
 #if LIBUSB_API_VERSION >= 0x01000106
     libusb_set_option(ctx, LIBUSB_OPTION_LOG_LEVEL, loglevel);
 #else
@@ -374,9 +476,14 @@ static USBHostRequest *usb_host_req_find(USBHostDevice *s, USBPacket *p)
 static void LIBUSB_CALL usb_host_req_complete_ctrl(struct libusb_transfer *xfer)
 {
     USBHostRequest *r = xfer->user_data;
-    USBHostDevice  *s = r->host;
+    USBHostDevice  *s;
     bool disconnect = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE);
 
+    if (usb_host_defer_completion(xfer)) {
+        return;
+    }
+    s = r->host;
+
     if (r->p == NULL) {
         goto out; /* request was canceled */
     }
@@ -407,9 +514,14 @@ out:
 static void LIBUSB_CALL usb_host_req_complete_data(struct libusb_transfer *xfer)
 {
     USBHostRequest *r = xfer->user_data;
-    USBHostDevice  *s = r->host;
+    USBHostDevice  *s;
     bool disconnect = (xfer->status == LIBUSB_TRANSFER_NO_DEVICE);
 
+    if (usb_host_defer_completion(xfer)) {
+        return;
+    }
+    s = r->host;
+
     if (r->p == NULL) {
         goto out; /* request was canceled */
     }
@@ -463,26 +575,43 @@ static void usb_host_req_abort(USBHostRequest *r)
 static void LIBUSB_CALL
 usb_host_req_complete_iso(struct libusb_transfer *transfer)
 {
-    USBHostIsoXfer *xfer = transfer->user_data;
+    USBHostIsoXfer *xfer;
+    USBHostIsoRing *ring;
 
+    qemu_mutex_lock(&usb_host_lock);
+    xfer = transfer->user_data;
     if (!xfer) {
         /* USBHostIsoXfer released while inflight */
+        qemu_mutex_unlock(&usb_host_lock);
         g_free(transfer->buffer);
         libusb_free_transfer(transfer);
         return;
     }
 
-    QTAILQ_REMOVE(&xfer->ring->inflight, xfer, next);
-    if (QTAILQ_EMPTY(&xfer->ring->inflight)) {
-        USBHostDevice *s = xfer->ring->host;
-        trace_usb_host_iso_stop(s->bus_num, s->addr, xfer->ring->ep->nr);
+    ring = xfer->ring;
+    QTAILQ_REMOVE(&ring->inflight, xfer, next);
+    if (QTAILQ_EMPTY(&ring->inflight)) {
+        USBHostDevice *s = ring->host;
+        trace_usb_host_iso_stop(s->bus_num, s->addr, ring->ep->nr);
     }
-    if (xfer->ring->ep->pid == USB_TOKEN_IN) {
-        QTAILQ_INSERT_TAIL(&xfer->ring->copy, xfer, next);
-        usb_wakeup(xfer->ring->ep, 0);
-    } else {
-        QTAILQ_INSERT_TAIL(&xfer->ring->unused, xfer, next);
+    if (ring->ep->pid != USB_TOKEN_IN) {
+        QTAILQ_INSERT_TAIL(&ring->unused, xfer, next);
+        qemu_mutex_unlock(&usb_host_lock);
+        return;
+    }
+
+    QTAILQ_INSERT_TAIL(&ring->copy, xfer, next);
+    if (qemu_mutex_iothread_locked()) {
+        qemu_mutex_unlock(&usb_host_lock);
+        usb_wakeup(ring->ep, 0);
+        return;
     }
+    if (!ring->wakeup_pending) {
+        ring->wakeup_pending = true;
+        QTAILQ_INSERT_TAIL(&usb_host_iso_wakeups, ring, wakeup_next);
+        qemu_bh_schedule(usb_host_done_bh);
+    }
+    qemu_mutex_unlock(&usb_host_lock);
 }
 
 static USBHostIsoRing *usb_host_iso_alloc(USBHostDevice *s, USBEndpoint *ep)
@@ -559,6 +688,10 @@ static void usb_host_iso_free(USBHostIsoRing *ring)
 {
     USBHostIsoXfer *xfer;
 
+    qemu_mutex_lock(&usb_host_lock);
+    if (ring->wakeup_pending) {
+        QTAILQ_REMOVE(&usb_host_iso_wakeups, ring, wakeup_next);
+    }
     while ((xfer = QTAILQ_FIRST(&ring->inflight)) != NULL) {
         QTAILQ_REMOVE(&ring->inflight, xfer, next);
         usb_host_iso_free_xfer(xfer, true);
@@ -571,6 +704,7 @@ static void usb_host_iso_free(USBHostIsoRing *ring)
         QTAILQ_REMOVE(&ring->copy, xfer, next);
         usb_host_iso_free_xfer(xfer, false);
     }
+    qemu_mutex_unlock(&usb_host_lock);
 
     QTAILQ_REMOVE(&ring->host->isorings, ring, next);
     g_free(ring);
@@ -623,6 +757,8 @@ static void usb_host_iso_data_in(USBHostDevice *s, USBPacket *p)
         ring = usb_host_iso_alloc(s, p->ep);
     }
 
+    qemu_mutex_lock(&usb_host_lock);
+
     /* copy data to guest */
     xfer = QTAILQ_FIRST(&ring->copy);
     if (xfer != NULL) {
@@ -651,6 +787,8 @@ static void usb_host_iso_data_in(USBHostDevice *s, USBPacket *p)
         QTAILQ_INSERT_TAIL(&ring->inflight, xfer, next);
     }
 
+    qemu_mutex_unlock(&usb_host_lock);
+
     if (disconnect) {
         usb_host_nodev(s);
     }
@@ -668,6 +806,8 @@ static void usb_host_iso_data_out(USBHostDevice *s, USBPacket *p)
         ring = usb_host_iso_alloc(s, p->ep);
     }
 
+    qemu_mutex_lock(&usb_host_lock);
+
     /* copy data from guest */
     xfer = QTAILQ_FIRST(&ring->copy);
     while (xfer != NULL && xfer->copy_complete) {
@@ -678,6 +818,7 @@ static void usb_host_iso_data_out(USBHostDevice *s, USBPacket *p)
         xfer = QTAILQ_FIRST(&ring->unused);
         if (xfer == NULL) {
             trace_usb_host_iso_out_of_bufs(s->bus_num, s->addr, p->ep->nr);
+            qemu_mutex_unlock(&usb_host_lock);
             return;
         }
         QTAILQ_REMOVE(&ring->unused, xfer, next);
@@ -690,6 +831,7 @@ static void usb_host_iso_data_out(USBHostDevice *s, USBPacket *p)
         /* wait until half of our buffers are filled
            before kicking the iso out stream */
         if (filled*2 < s->iso_urb_count) {
+            qemu_mutex_unlock(&usb_host_lock);
             return;
         }
     }
@@ -713,6 +855,8 @@ static void usb_host_iso_data_out(USBHostDevice *s, USBPacket *p)
         QTAILQ_INSERT_TAIL(&ring->inflight, xfer, next);
     }
 
+    qemu_mutex_unlock(&usb_host_lock);
+
     if (disconnect) {
         usb_host_nodev(s);
     }
@@ -1037,6 +1181,16 @@ static void usb_host_realize(USBDevice *udev, Error **errp)
         error_setg(errp, "hostaddr out of range");
         return;
     }
+    if (!s->iso_urb_count || s->iso_urb_count > ISO_MAX_URB_COUNT) {
+        error_setg(errp, "isobufs must be between 1 and %d",
+                   ISO_MAX_URB_COUNT);
+        return;
+    }
+    if (!s->iso_urb_frames || s->iso_urb_frames > ISO_MAX_URB_FRAMES) {
+        error_setg(errp, "isobsize must be between 1 and %d",
+                   ISO_MAX_URB_FRAMES);
+        return;
+    }
 
     loglevel = s->loglevel;
     udev->flags |= (1 << USB_DEV_FLAG_IS_HOST);
@@ -1044,6 +1198,14 @@ static void usb_host_realize(USBDevice *udev, Error **errp)
     QTAILQ_INIT(&s->requests);
     QTAILQ_INIT(&s->isorings);
 
+    if (s->event_thread) {
+        if (usb_host_init() != 0) {
+            error_setg(errp, "failed to initialize libusb");
+            return;
+        }
+        usb_host_start_event_thread();
+    }
+
     if (s->match.addr && s->match.bus_num &&
         !s->match.vendor_id &&
         !s->match.product_id &&
@@ -1587,6 +1749,7 @@ static Property usb_host_dev_properties[] = {
     DEFINE_PROP_UINT32("isobufs",  USBHostDevice, iso_urb_count,    4),
     DEFINE_PROP_UINT32("isobsize", USBHostDevice, iso_urb_frames,   32),
     DEFINE_PROP_BOOL("guest-reset", USBHostDevice, allow_guest_reset, true),
+    DEFINE_PROP_BOOL("event-thread", USBHostDevice, event_thread, false),
     DEFINE_PROP_UINT32("loglevel",  USBHostDevice, loglevel,
                        LIBUSB_LOG_LEVEL_WARNING),
     DEFINE_PROP_BIT("pipeline",    USBHostDevice, options,
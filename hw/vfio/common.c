@@ -30,12 +30,15 @@
 #include "exec/address-spaces.h"
 #include "exec/memory.h"
 #include "hw/hw.h"
+#include "hw/qdev-core.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/range.h"
+#include "qemu/thread.h"
 #include "sysemu/balloon.h"
 #include "sysemu/kvm.h"
 #include "sysemu/reset.h"
+#include "sysemu/sysemu.h"
 #include "trace.h"
 #include "qapi/error.h"
 
@@ -356,6 +359,133 @@ static int vfio_dma_map(VFIOContainer *container, hwaddr iova,
     return -errno;
 }
 
+/*
+ * Pinning the pages of a large guest inside VFIO_IOMMU_MAP_DMA takes a
+ * long time.  While the machine is being created, large RAM sections are
+ * therefore split into chunks that worker threads map in the background,
+ * overlapping with the rest of startup and with the preallocation of
+ * memory backends.  Everything is mapped before the machine is started.
+ */
+#define VFIO_DMA_MAP_CHUNK   (1ULL << 30)
+#define VFIO_DMA_MAP_THREADS 4
+
+typedef struct VFIODMAMapJob {
+    VFIOContainer *container;
+    hwaddr iova;
+    ram_addr_t size;
+    void *vaddr;
+    bool readonly;
+    QSIMPLEQ_ENTRY(VFIODMAMapJob) next;
+} VFIODMAMapJob;
+
+static QemuMutex vfio_dma_map_lock;
+static QemuCond vfio_dma_map_cond;
+static QSIMPLEQ_HEAD(, VFIODMAMapJob) vfio_dma_map_jobs =
+    QSIMPLEQ_HEAD_INITIALIZER(vfio_dma_map_jobs);
+static int vfio_dma_map_threads;
+static Notifier vfio_dma_map_done;
+
+static void *vfio_dma_map_thread(void *opaque)
+{
+    VFIODMAMapJob *job;
+
+    qemu_mutex_lock(&vfio_dma_map_lock);
+    while ((job = QSIMPLEQ_FIRST(&vfio_dma_map_jobs))) {
+        VFIOContainer *container = job->container;
+        int ret;
+
+        QSIMPLEQ_REMOVE_HEAD(&vfio_dma_map_jobs, next);
+        qemu_mutex_unlock(&vfio_dma_map_lock);
+
+        ret = vfio_dma_map(container, job->iova, job->size, job->vaddr,
+                           job->readonly);
+        trace_vfio_dma_map_async_done(job->iova, job->size, ret);
+        g_free(job);
+
+        qemu_mutex_lock(&vfio_dma_map_lock);
+        if (ret && !container->dma_map_error) {
+            container->dma_map_error = ret;
+        }
+        if (!--container->dma_map_pending) {
+            qemu_cond_broadcast(&vfio_dma_map_cond);
+        }
+    }
+    vfio_dma_map_threads--;
+    qemu_mutex_unlock(&vfio_dma_map_lock);
+    return NULL;
+}
+
+/* Wait for the background mappings of @container */
+static void vfio_dma_map_wait(VFIOContainer *container)
+{
+    /* Only the main thread queues mappings */
+    if (!atomic_read(&container->dma_map_pending)) {
+        return;
+    }
+
+    qemu_mutex_lock(&vfio_dma_map_lock);
+    while (container->dma_map_pending) {
+        qemu_cond_wait(&vfio_dma_map_cond, &vfio_dma_map_lock);
+    }
+    qemu_mutex_unlock(&vfio_dma_map_lock);
+
+    /* The machine is not running yet, so this is still part of startup */
+    if (container->dma_map_error) {
+        error_report("vfio: DMA mapping failed: %s",
+                     strerror(-container->dma_map_error));
+        exit(1);
+    }
+}
+
+static void vfio_dma_map_machine_done(Notifier *notifier, void *data)
+{
+    VFIOAddressSpace *space;
+    VFIOContainer *container;
+
+    QLIST_FOREACH(space, &vfio_address_spaces, list) {
+        QLIST_FOREACH(container, &space->containers, next) {
+            vfio_dma_map_wait(container);
+        }
+    }
+}
+
+static void vfio_dma_map_async(VFIOContainer *container, hwaddr iova,
+                               ram_addr_t size, void *vaddr, bool readonly)
+{
+    ram_addr_t chunk;
+
+    if (!vfio_dma_map_done.notify) {
+        qemu_mutex_init(&vfio_dma_map_lock);
+        qemu_cond_init(&vfio_dma_map_cond);
+        vfio_dma_map_done.notify = vfio_dma_map_machine_done;
+        qemu_add_machine_init_done_notifier(&vfio_dma_map_done);
+    }
+
+    qemu_mutex_lock(&vfio_dma_map_lock);
+    for (; size; iova += chunk, vaddr += chunk, size -= chunk) {
+        VFIODMAMapJob *job = g_new0(VFIODMAMapJob, 1);
+
+        chunk = MIN(size, QEMU_ALIGN_UP(iova + 1, VFIO_DMA_MAP_CHUNK) - iova);
+        job->container = container;
+        job->iova = iova;
+        job->size = chunk;
+        job->vaddr = vaddr;
+        job->readonly = readonly;
+        QSIMPLEQ_INSERT_TAIL(&vfio_dma_map_jobs, job, next);
+        container->dma_map_pending++;
+        trace_vfio_dma_map_async(iova, chunk);
+
+        if (vfio_dma_map_threads < VFIO_DMA_MAP_THREADS) {
+            QemuThread thread;
+
+            vfio_dma_map_threads++;
+            qemu_thread_create(&thread, "vfio-dma-map", vfio_dma_map_thread,
+                               NULL, QEMU_THREAD_DETACHED);
+        }
+    }
+    qemu_mutex_unlock(&vfio_dma_map_lock);
+}
+
 static void vfio_host_win_add(VFIOContainer *container,
                               hwaddr min_iova, hwaddr max_iova,
                               uint64_t iova_pgsizes)
@@ -661,6 +791,15 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (!qdev_hotplug && !memory_region_is_ram_device(section->mr) &&
+        (container->iommu_type == VFIO_TYPE1_IOMMU ||
+         container->iommu_type == VFIO_TYPE1v2_IOMMU) &&
+        int128_get64(llsize) > VFIO_DMA_MAP_CHUNK) {
+        vfio_dma_map_async(container, iova, int128_get64(llsize),
+                           vaddr, section->readonly);
+        return;
+    }
+
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
@@ -704,6 +843,9 @@ static void vfio_listener_region_del(MemoryListener *listener,
     int ret;
     bool try_unmap = true;
 
+    /* Keep the unmap ordered after any pending map */
+    vfio_dma_map_wait(container);
+
     if (vfio_listener_skipped_section(section)) {
         trace_vfio_listener_region_del_skip(
                 section->offset_within_address_space,
@@ -12,6 +12,7 @@
 #include "qapi/error.h"
 #include "hw/virtio/vhost.h"
 #include "hw/virtio/vhost-user.h"
+#include "hw/virtio/vhost-user-fs.h"
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio.h"
 #include "hw/virtio/virtio-net.h"
@@ -36,6 +37,8 @@
 #endif
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
+/* Upper bound for backends that take regions one at a time */
+#define VHOST_USER_MAX_RAM_SLOTS     512
 #define VHOST_USER_F_PROTOCOL_FEATURES 30
 #define VHOST_USER_SLAVE_MAX_FDS     8
 
@@ -58,6 +61,7 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD = 10,
     VHOST_USER_PROTOCOL_F_HOST_NOTIFIER = 11,
     VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
+    VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 13,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
@@ -98,6 +102,9 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_INFLIGHT_FD = 31,
     VHOST_USER_SET_INFLIGHT_FD = 32,
     VHOST_USER_GPU_SET_SOCKET = 33,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 34,
+    VHOST_USER_ADD_MEM_REG = 35,
+    VHOST_USER_REM_MEM_REG = 36,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -106,6 +113,9 @@ typedef enum VhostUserSlaveRequest {
     VHOST_USER_SLAVE_IOTLB_MSG = 1,
     VHOST_USER_SLAVE_CONFIG_CHANGE_MSG = 2,
     VHOST_USER_SLAVE_VRING_HOST_NOTIFIER_MSG = 3,
+    VHOST_USER_SLAVE_FS_MAP = 4,
+    VHOST_USER_SLAVE_FS_UNMAP = 5,
+    VHOST_USER_SLAVE_FS_SYNC = 6,
     VHOST_USER_SLAVE_MAX
 }  VhostUserSlaveRequest;
 
@@ -122,6 +132,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
@@ -180,12 +195,14 @@ typedef union {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
         struct vhost_iotlb_msg iotlb;
         VhostUserConfig config;
         VhostUserCryptoSession session;
         VhostUserVringArea area;
         VhostUserInflight inflight;
+        VhostUserFSSlaveMsg fs;
 } VhostUserPayload;
 
 typedef struct VhostUserMsg {
@@ -220,6 +237,12 @@ struct vhost_user {
 
     /* True once we've entered postcopy_listen */
     bool               postcopy_listen;
+
+    /* Number of memory regions the backend accepts */
+    uint64_t           memory_slots;
+    /* Regions the backend has been told about, in no particular order */
+    VhostUserMemoryRegion shadow_regions[VHOST_USER_MAX_RAM_SLOTS];
+    int                num_shadow_regions;
 };
 
 static bool ioeventfd_enabled(void)
@@ -314,6 +337,8 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     case VHOST_USER_SET_OWNER:
     case VHOST_USER_RESET_OWNER:
     case VHOST_USER_SET_MEM_TABLE:
+    case VHOST_USER_ADD_MEM_REG:
+    case VHOST_USER_REM_MEM_REG:
     case VHOST_USER_GET_QUEUE_NUM:
     case VHOST_USER_NET_SET_MTU:
         return true;
@@ -441,6 +466,10 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
                                      &offset);
         fd = memory_region_get_fd(mr);
         if (fd > 0) {
+            if (fd_num == VHOST_MEMORY_MAX_NREGIONS) {
+                error_report("Failed preparing vhost-user memory table msg");
+                return -1;
+            }
             trace_vhost_user_set_mem_table_withfd(fd_num, mr->name,
                                                   reg->memory_size,
                                                   reg->guest_phys_addr,
@@ -453,7 +482,6 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
             msg.payload.memory.regions[fd_num].guest_phys_addr =
                 reg->guest_phys_addr;
             msg.payload.memory.regions[fd_num].mmap_offset = offset;
-            assert(fd_num < VHOST_MEMORY_MAX_NREGIONS);
             fds[fd_num++] = fd;
         } else {
             u->region_rb_offset[i] = 0;
@@ -528,6 +556,11 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
      * because now we're in the position to be able to deal with any faults
      * it generates.
      */
+    /* The table replaced whatever was added region by region */
+    memcpy(u->shadow_regions, msg.payload.memory.regions,
+           fd_num * sizeof(VhostUserMemoryRegion));
+    u->num_shadow_regions = fd_num;
+
     /* TODO: Use this for failure cases as well with a bad value */
     msg.hdr.size = sizeof(msg.payload.u64);
     msg.payload.u64 = 0; /* OK */
@@ -538,12 +571,162 @@ static int vhost_user_set_mem_table_postcopy(struct vhost_dev *dev,
     return 0;
 }
 
+/*
+ * Collect the regions of the memory table that can be shared with the
+ * backend, i.e. those backed by a file descriptor.
+ */
+static int vhost_user_fill_mem_regions(struct vhost_dev *dev,
+                                       VhostUserMemoryRegion *regions,
+                                       int *fds, size_t max_regions,
+                                       size_t *nr_regions)
+{
+    size_t fd_num = 0;
+    int i, fd;
+
+    for (i = 0; i < dev->mem->nregions; ++i) {
+        struct vhost_memory_region *reg = dev->mem->regions + i;
+        ram_addr_t offset;
+        MemoryRegion *mr;
+
+        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
+        mr = memory_region_from_host((void *)(uintptr_t)reg->userspace_addr,
+                                     &offset);
+        fd = memory_region_get_fd(mr);
+        if (fd > 0) {
+            if (fd_num == max_regions) {
+                error_report("Failed preparing vhost-user memory table msg");
+                return -1;
+            }
+            regions[fd_num].userspace_addr = reg->userspace_addr;
+            regions[fd_num].memory_size  = reg->memory_size;
+            regions[fd_num].guest_phys_addr = reg->guest_phys_addr;
+            regions[fd_num].mmap_offset = offset;
+            fds[fd_num++] = fd;
+        }
+    }
+
+    if (!fd_num) {
+        error_report("Failed initializing vhost-user memory map, "
+                     "consider using -object memory-backend-file share=on");
+        return -1;
+    }
+
+    *nr_regions = fd_num;
+    return 0;
+}
+
+static bool vhost_user_mem_region_equal(const VhostUserMemoryRegion *a,
+                                        const VhostUserMemoryRegion *b)
+{
+    return a->guest_phys_addr == b->guest_phys_addr &&
+           a->memory_size == b->memory_size &&
+           a->userspace_addr == b->userspace_addr &&
+           a->mmap_offset == b->mmap_offset;
+}
+
+static int vhost_user_send_mem_reg(struct vhost_dev *dev,
+                                   VhostUserRequest request,
+                                   const VhostUserMemoryRegion *region,
+                                   int fd)
+{
+    bool reply_supported = virtio_has_feature(dev->protocol_features,
+                                              VHOST_USER_PROTOCOL_F_REPLY_ACK);
+    VhostUserMsg msg = {
+        .hdr.request = request,
+        .hdr.flags = VHOST_USER_VERSION,
+        .payload.mem_reg.region = *region,
+        .hdr.size = sizeof(msg.payload.mem_reg),
+    };
+
+    if (reply_supported) {
+        msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
+    }
+
+    trace_vhost_user_send_mem_reg(request, region->guest_phys_addr,
+                                  region->memory_size,
+                                  region->userspace_addr);
+    if (vhost_user_write(dev, &msg, &fd, fd >= 0 ? 1 : 0) < 0) {
+        return -1;
+    }
+
+    if (reply_supported) {
+        return process_message_reply(dev, &msg);
+    }
+
+    return 0;
+}
+
+/*
+ * Send only the difference between the new memory table and what the
+ * backend already has, so that plugging a DIMM does not make the backend
+ * unmap and remap all of guest memory.  Regions are removed first to
+ * make room for the new ones.
+ */
+static int vhost_user_update_mem_slots(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserMemoryRegion *regions;
+    size_t nr_regions, j;
+    int *fds;
+    int i, ret = -1;
+
+    regions = g_new(VhostUserMemoryRegion, u->memory_slots);
+    fds = g_new(int, u->memory_slots);
+    if (vhost_user_fill_mem_regions(dev, regions, fds, u->memory_slots,
+                                    &nr_regions) < 0) {
+        goto out;
+    }
+
+    for (i = 0; i < u->num_shadow_regions; ) {
+        VhostUserMemoryRegion *shadow = &u->shadow_regions[i];
+
+        for (j = 0; j < nr_regions; j++) {
+            if (vhost_user_mem_region_equal(shadow, &regions[j])) {
+                break;
+            }
+        }
+        if (j < nr_regions) {
+            i++;
+            continue;
+        }
+
+        if (vhost_user_send_mem_reg(dev, VHOST_USER_REM_MEM_REG,
+                                    shadow, -1) < 0) {
+            goto out;
+        }
+        *shadow = u->shadow_regions[--u->num_shadow_regions];
+    }
+
+    for (j = 0; j < nr_regions; j++) {
+        for (i = 0; i < u->num_shadow_regions; i++) {
+            if (vhost_user_mem_region_equal(&u->shadow_regions[i],
+                                            &regions[j])) {
+                break;
+            }
+        }
+        if (i < u->num_shadow_regions) {
+            continue;
+        }
+
+        if (vhost_user_send_mem_reg(dev, VHOST_USER_ADD_MEM_REG,
+                                    &regions[j], fds[j]) < 0) {
+            goto out;
+        }
+        u->shadow_regions[u->num_shadow_regions++] = regions[j];
+    }
+    ret = 0;
+
+out:
+    g_free(regions);
+    g_free(fds);
+    return ret;
+}
+
 static int vhost_user_set_mem_table(struct vhost_dev *dev,
                                     struct vhost_memory *mem)
 {
     struct vhost_user *u = dev->opaque;
     int fds[VHOST_MEMORY_MAX_NREGIONS];
-    int i, fd;
     size_t fd_num = 0;
     bool do_postcopy = u->postcopy_listen && u->postcopy_fd.handler;
     bool reply_supported = virtio_has_feature(dev->protocol_features,
@@ -556,6 +739,11 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         return vhost_user_set_mem_table_postcopy(dev, mem);
     }
 
+    if (virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+        return vhost_user_update_mem_slots(dev);
+    }
+
     VhostUserMsg msg = {
         .hdr.request = VHOST_USER_SET_MEM_TABLE,
         .hdr.flags = VHOST_USER_VERSION,
@@ -565,37 +753,11 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
     }
 
-    for (i = 0; i < dev->mem->nregions; ++i) {
-        struct vhost_memory_region *reg = dev->mem->regions + i;
-        ram_addr_t offset;
-        MemoryRegion *mr;
-
-        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
-        mr = memory_region_from_host((void *)(uintptr_t)reg->userspace_addr,
-                                     &offset);
-        fd = memory_region_get_fd(mr);
-        if (fd > 0) {
-            if (fd_num == VHOST_MEMORY_MAX_NREGIONS) {
-                error_report("Failed preparing vhost-user memory table msg");
-                return -1;
-            }
-            msg.payload.memory.regions[fd_num].userspace_addr =
-                reg->userspace_addr;
-            msg.payload.memory.regions[fd_num].memory_size  = reg->memory_size;
-            msg.payload.memory.regions[fd_num].guest_phys_addr =
-                reg->guest_phys_addr;
-            msg.payload.memory.regions[fd_num].mmap_offset = offset;
-            fds[fd_num++] = fd;
-        }
-    }
-
-    msg.payload.memory.nregions = fd_num;
-
-    if (!fd_num) {
-        error_report("Failed initializing vhost-user memory map, "
-                     "consider using -object memory-backend-file share=on");
+    if (vhost_user_fill_mem_regions(dev, msg.payload.memory.regions, fds,
+                                    VHOST_MEMORY_MAX_NREGIONS, &fd_num) < 0) {
         return -1;
     }
+    msg.payload.memory.nregions = fd_num;
 
     msg.hdr.size = sizeof(msg.payload.memory.nregions);
     msg.hdr.size += sizeof(msg.payload.memory.padding);
@@ -1054,6 +1216,15 @@ static void slave_read(void *opaque)
         ret = vhost_user_slave_handle_vring_host_notifier(dev, &payload.area,
                                                           fd[0]);
         break;
+    case VHOST_USER_SLAVE_FS_MAP:
+        ret = vhost_user_fs_slave_map(dev, &payload.fs, fd[0]);
+        break;
+    case VHOST_USER_SLAVE_FS_UNMAP:
+        ret = vhost_user_fs_slave_unmap(dev, &payload.fs);
+        break;
+    case VHOST_USER_SLAVE_FS_SYNC:
+        ret = vhost_user_fs_slave_sync(dev, &payload.fs);
+        break;
     default:
         error_report("Received unexpected msg type.");
         ret = -EINVAL;
@@ -1390,6 +1561,7 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque)
     u->user = opaque;
     u->slave_fd = -1;
     u->dev = dev;
+    u->memory_slots = VHOST_MEMORY_MAX_NREGIONS;
     dev->opaque = u;
 
     err = vhost_user_get_features(dev, &features);
@@ -1433,6 +1605,23 @@ static int vhost_user_backend_init(struct vhost_dev *dev, void *opaque)
             }
         }
 
+        if (virtio_has_feature(dev->protocol_features,
+                               VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+            uint64_t ram_slots;
+
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_MAX_MEM_SLOTS,
+                                     &ram_slots);
+            if (err < 0) {
+                return err;
+            }
+            if (!ram_slots) {
+                error_report("vhost-user backend does not accept any "
+                             "memory regions");
+                return -1;
+            }
+            u->memory_slots = MIN(ram_slots, VHOST_USER_MAX_RAM_SLOTS);
+        }
+
         if (virtio_has_feature(features, VIRTIO_F_IOMMU_PLATFORM) &&
                 !(virtio_has_feature(dev->protocol_features,
                     VHOST_USER_PROTOCOL_F_SLAVE_REQ) &&
@@ -1505,7 +1694,9 @@ static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
 
 static int vhost_user_memslots_limit(struct vhost_dev *dev)
 {
-    return VHOST_MEMORY_MAX_NREGIONS;
+    struct vhost_user *u = dev->opaque;
+
+    return u->memory_slots;
 }
 
 static bool vhost_user_requires_shm_log(struct vhost_dev *dev)
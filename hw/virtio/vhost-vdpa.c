@@ -0,0 +1,436 @@
+/*
+ * vhost-vdpa
+ *
+ * Drives the vhost-vdpa character devices of the Linux kernel.  The
+ * virtqueues are set up with the usual vhost ioctls, but the datapath runs
+ * in the vDPA device itself; guest memory is made visible to the device
+ * by sending IOTLB messages that map guest physical addresses to the
+ * corresponding QEMU virtual addresses.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <linux/vhost.h>
+#include <sys/ioctl.h>
+#include "standard-headers/linux/vhost_types.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "exec/address-spaces.h"
+#include "hw/virtio/vhost.h"
+#include "hw/virtio/vhost-backend.h"
+#include "hw/virtio/vhost-vdpa.h"
+#include "hw/virtio/virtio.h"
+#include "qemu/error-report.h"
+#include "trace.h"
+
+static bool vhost_vdpa_listener_skipped_section(MemoryRegionSection *section)
+{
+    return (!memory_region_is_ram(section->mr) &&
+            !memory_region_is_iommu(section->mr)) ||
+           /* the device cannot DMA to MMIO regions of other devices */
+           memory_region_is_ram_device(section->mr) ||
+           /*
+            * Sizing an enabled 64-bit BAR can cause spurious mappings to
+            * addresses in the upper part of the 64-bit address space.
+            * These are never accessed by the CPU and beyond the address
+            * width of the IOMMU of most devices.
+            */
+           section->offset_within_address_space & (1ULL << 63);
+}
+
+static int vhost_vdpa_dma_map(struct vhost_vdpa *v, hwaddr iova, hwaddr size,
+                              void *vaddr, bool readonly)
+{
+    struct vhost_msg_v2 msg = {
+        .type = v->msg_type,
+        .iotlb.iova = iova,
+        .iotlb.size = size,
+        .iotlb.uaddr = (uint64_t)(uintptr_t)vaddr,
+        .iotlb.perm = readonly ? VHOST_ACCESS_RO : VHOST_ACCESS_RW,
+        .iotlb.type = VHOST_IOTLB_UPDATE,
+    };
+
+    trace_vhost_vdpa_dma_map(v, iova, size, vaddr, readonly);
+    if (write(v->device_fd, &msg, sizeof(msg)) != sizeof(msg)) {
+        error_report("vhost-vdpa: failed to map 0x%" HWADDR_PRIx
+                     "+0x%" HWADDR_PRIx ": %s", iova, size, strerror(errno));
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int vhost_vdpa_dma_unmap(struct vhost_vdpa *v, hwaddr iova,
+                                hwaddr size)
+{
+    struct vhost_msg_v2 msg = {
+        .type = v->msg_type,
+        .iotlb.iova = iova,
+        .iotlb.size = size,
+        .iotlb.type = VHOST_IOTLB_INVALIDATE,
+    };
+
+    trace_vhost_vdpa_dma_unmap(v, iova, size);
+    if (write(v->device_fd, &msg, sizeof(msg)) != sizeof(msg)) {
+        error_report("vhost-vdpa: failed to unmap 0x%" HWADDR_PRIx
+                     "+0x%" HWADDR_PRIx ": %s", iova, size, strerror(errno));
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Compute the host page aligned part of @section; returns false if
+ * nothing is left.
+ */
+static bool vhost_vdpa_section_range(MemoryRegionSection *section,
+                                     hwaddr *iova, hwaddr *size)
+{
+    Int128 llend;
+
+    *iova = ROUND_UP(section->offset_within_address_space,
+                     qemu_real_host_page_size);
+    llend = int128_make64(section->offset_within_address_space);
+    llend = int128_add(llend, section->size);
+    llend = int128_and(llend, int128_exts64(qemu_real_host_page_mask));
+
+    if (int128_ge(int128_make64(*iova), llend)) {
+        return false;
+    }
+    *size = int128_get64(int128_sub(llend, int128_make64(*iova)));
+    return true;
+}
+
+static void vhost_vdpa_listener_region_add(MemoryListener *listener,
+                                           MemoryRegionSection *section)
+{
+    struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
+    hwaddr iova, size;
+    void *vaddr;
+
+    if (vhost_vdpa_listener_skipped_section(section)) {
+        return;
+    }
+
+    if ((section->offset_within_address_space & ~qemu_real_host_page_mask) !=
+        (section->offset_within_region & ~qemu_real_host_page_mask)) {
+        error_report("vhost-vdpa: received unaligned region");
+        return;
+    }
+
+    if (!vhost_vdpa_section_range(section, &iova, &size)) {
+        return;
+    }
+
+    vaddr = memory_region_get_ram_ptr(section->mr) +
+            section->offset_within_region +
+            (iova - section->offset_within_address_space);
+
+    memory_region_ref(section->mr);
+    if (vhost_vdpa_dma_map(v, iova, size, vaddr, section->readonly)) {
+        /*
+         * There is no way to report this to the guest, which will see
+         * DMA errors from the device.
+         */
+        error_report("vhost-vdpa: DMA mapping failed, device will not work");
+    }
+}
+
+static void vhost_vdpa_listener_region_del(MemoryListener *listener,
+                                           MemoryRegionSection *section)
+{
+    struct vhost_vdpa *v = container_of(listener, struct vhost_vdpa, listener);
+    hwaddr iova, size;
+
+    if (vhost_vdpa_listener_skipped_section(section)) {
+        return;
+    }
+
+    if ((section->offset_within_address_space & ~qemu_real_host_page_mask) !=
+        (section->offset_within_region & ~qemu_real_host_page_mask)) {
+        return;
+    }
+
+    if (!vhost_vdpa_section_range(section, &iova, &size)) {
+        return;
+    }
+
+    vhost_vdpa_dma_unmap(v, iova, size);
+    memory_region_unref(section->mr);
+}
+
+/*
+ * The vDPA device translates addresses with its own IOMMU or with the
+ * platform IOMMU; both are programmed through the IOTLB messages above.
+ */
+static const MemoryListener vhost_vdpa_memory_listener = {
+    .region_add = vhost_vdpa_listener_region_add,
+    .region_del = vhost_vdpa_listener_region_del,
+};
+
+static int vhost_vdpa_call(struct vhost_dev *dev, unsigned long int request,
+                           void *arg)
+{
+    struct vhost_vdpa *v = dev->opaque;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
+
+    return ioctl(v->device_fd, request, arg);
+}
+
+static int vhost_vdpa_add_status(struct vhost_dev *dev, uint8_t status)
+{
+    uint8_t s;
+
+    if (vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &s)) {
+        return -errno;
+    }
+
+    s |= status;
+    if (vhost_vdpa_call(dev, VHOST_VDPA_SET_STATUS, &s)) {
+        return -errno;
+    }
+
+    /* the device may refuse some bits, e.g. FEATURES_OK */
+    if (vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &s)) {
+        return -errno;
+    }
+    return (s & status) == status ? 0 : -EIO;
+}
+
+static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque)
+{
+    struct vhost_vdpa *v = opaque;
+    uint64_t backend_features;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
+
+    dev->opaque = v;
+    v->listener = vhost_vdpa_memory_listener;
+    v->msg_type = VHOST_IOTLB_MSG_V2;
+
+    if (!vhost_vdpa_call(dev, VHOST_GET_BACKEND_FEATURES, &backend_features)) {
+        backend_features &= 1ULL << VHOST_BACKEND_F_IOTLB_MSG_V2;
+        vhost_vdpa_call(dev, VHOST_SET_BACKEND_FEATURES, &backend_features);
+    }
+
+    return vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+                                      VIRTIO_CONFIG_S_DRIVER);
+}
+
+static int vhost_vdpa_cleanup(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+
+    assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
+
+    /* the file descriptor belongs to the caller of vhost_dev_init */
+    memory_listener_unregister(&v->listener);
+    dev->opaque = NULL;
+    return 0;
+}
+
+static int vhost_vdpa_memslots_limit(struct vhost_dev *dev)
+{
+    /* guest memory is mapped region by region, without a table */
+    return INT_MAX;
+}
+
+static int vhost_vdpa_set_mem_table(struct vhost_dev *dev,
+                                    struct vhost_memory *mem)
+{
+    /* the memory listener keeps the device IOTLB up to date */
+    return 0;
+}
+
+static int vhost_vdpa_set_features(struct vhost_dev *dev, uint64_t features)
+{
+    int ret;
+
+    /*
+     * Guest memory is mapped with guest physical addresses as IOVAs;
+     * addresses translated by a virtual IOMMU would not match.
+     */
+    if (virtio_has_feature(features, VIRTIO_F_IOMMU_PLATFORM) &&
+        dev->vdev && dev->vdev->dma_as != &address_space_memory) {
+        error_report("vhost-vdpa does not support a virtual IOMMU");
+        return -ENOTSUP;
+    }
+
+    trace_vhost_vdpa_set_features(dev, features);
+    ret = vhost_vdpa_call(dev, VHOST_SET_FEATURES, &features);
+    if (ret) {
+        return ret;
+    }
+
+    return vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_FEATURES_OK);
+}
+
+static int vhost_vdpa_get_features(struct vhost_dev *dev, uint64_t *features)
+{
+    return vhost_vdpa_call(dev, VHOST_GET_FEATURES, features);
+}
+
+static int vhost_vdpa_set_owner(struct vhost_dev *dev)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_OWNER, NULL);
+}
+
+static int vhost_vdpa_reset_device(struct vhost_dev *dev)
+{
+    uint8_t status = 0;
+
+    return vhost_vdpa_call(dev, VHOST_VDPA_SET_STATUS, &status);
+}
+
+static int vhost_vdpa_get_vq_index(struct vhost_dev *dev, int idx)
+{
+    assert(idx >= dev->vq_index && idx < dev->vq_index + dev->nvqs);
+
+    return idx - dev->vq_index;
+}
+
+static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
+                                     struct vhost_vring_addr *addr)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_VRING_ADDR, addr);
+}
+
+static int vhost_vdpa_set_vring_endian(struct vhost_dev *dev,
+                                       struct vhost_vring_state *ring)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_VRING_ENDIAN, ring);
+}
+
+static int vhost_vdpa_set_vring_num(struct vhost_dev *dev,
+                                    struct vhost_vring_state *ring)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_VRING_NUM, ring);
+}
+
+static int vhost_vdpa_set_vring_base(struct vhost_dev *dev,
+                                     struct vhost_vring_state *ring)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, ring);
+}
+
+static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
+                                     struct vhost_vring_state *ring)
+{
+    return vhost_vdpa_call(dev, VHOST_GET_VRING_BASE, ring);
+}
+
+static int vhost_vdpa_set_vring_kick(struct vhost_dev *dev,
+                                     struct vhost_vring_file *file)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, file);
+}
+
+static int vhost_vdpa_set_vring_call(struct vhost_dev *dev,
+                                     struct vhost_vring_file *file)
+{
+    return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, file);
+}
+
+static int vhost_vdpa_set_vring_ready(struct vhost_dev *dev)
+{
+    int i;
+
+    for (i = 0; i < dev->nvqs; ++i) {
+        struct vhost_vring_state state = {
+            .index = dev->vq_index + i,
+            .num = 1,
+        };
+
+        if (vhost_vdpa_call(dev, VHOST_VDPA_SET_VRING_ENABLE, &state)) {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+static int vhost_vdpa_get_config(struct vhost_dev *dev, uint8_t *config,
+                                 uint32_t config_len)
+{
+    struct vhost_vdpa_config *v_config;
+    int ret;
+
+    v_config = g_malloc(sizeof(*v_config) + config_len);
+    v_config->off = 0;
+    v_config->len = config_len;
+    ret = vhost_vdpa_call(dev, VHOST_VDPA_GET_CONFIG, v_config);
+    if (!ret) {
+        memcpy(config, v_config->buf, config_len);
+    }
+    g_free(v_config);
+    return ret;
+}
+
+static int vhost_vdpa_set_config(struct vhost_dev *dev, const uint8_t *data,
+                                 uint32_t offset, uint32_t size,
+                                 uint32_t flags)
+{
+    struct vhost_vdpa_config *v_config;
+    int ret;
+
+    v_config = g_malloc(sizeof(*v_config) + size);
+    v_config->off = offset;
+    v_config->len = size;
+    memcpy(v_config->buf, data, size);
+    ret = vhost_vdpa_call(dev, VHOST_VDPA_SET_CONFIG, v_config);
+    g_free(v_config);
+    return ret;
+}
+
+static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int r;
+
+    trace_vhost_vdpa_dev_start(dev, started);
+    if (!started) {
+        vhost_vdpa_reset_device(dev);
+        vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+                                   VIRTIO_CONFIG_S_DRIVER);
+        memory_listener_unregister(&v->listener);
+        return 0;
+    }
+
+    /* map guest memory before the device can start accessing it */
+    memory_listener_register(&v->listener, &address_space_memory);
+
+    r = vhost_vdpa_set_vring_ready(dev);
+    if (!r) {
+        r = vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
+    }
+    if (r) {
+        error_report("vhost-vdpa: failed to start the device");
+        memory_listener_unregister(&v->listener);
+    }
+    return r;
+}
+
+const VhostOps vdpa_ops = {
+        .backend_type = VHOST_BACKEND_TYPE_VDPA,
+        .vhost_backend_init = vhost_vdpa_init,
+        .vhost_backend_cleanup = vhost_vdpa_cleanup,
+        .vhost_backend_memslots_limit = vhost_vdpa_memslots_limit,
+        .vhost_set_mem_table = vhost_vdpa_set_mem_table,
+        .vhost_set_vring_addr = vhost_vdpa_set_vring_addr,
+        .vhost_set_vring_endian = vhost_vdpa_set_vring_endian,
+        .vhost_set_vring_num = vhost_vdpa_set_vring_num,
+        .vhost_set_vring_base = vhost_vdpa_set_vring_base,
+        .vhost_get_vring_base = vhost_vdpa_get_vring_base,
+        .vhost_set_vring_kick = vhost_vdpa_set_vring_kick,
+        .vhost_set_vring_call = vhost_vdpa_set_vring_call,
+        .vhost_set_features = vhost_vdpa_set_features,
+        .vhost_get_features = vhost_vdpa_get_features,
+        .vhost_set_owner = vhost_vdpa_set_owner,
+        .vhost_reset_device = vhost_vdpa_reset_device,
+        .vhost_get_vq_index = vhost_vdpa_get_vq_index,
+        .vhost_get_config = vhost_vdpa_get_config,
+        .vhost_set_config = vhost_vdpa_set_config,
+        .vhost_dev_start = vhost_vdpa_dev_start,
+};
@@ -17,6 +17,7 @@
 #include "qemu/module.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "block/aio-wait.h"
 
 #include "hw/virtio/virtio.h"
 #include "hw/virtio/virtio-crypto.h"
@@ -573,6 +574,17 @@ virtio_crypto_handle_sym_req(VirtIOCrypto *vcrypto,
     return 0;
 }
 
+static void virtio_crypto_req_done(void *opaque, int ret)
+{
+    VirtIOCryptoReq *request = opaque;
+    VirtIOCrypto *vcrypto = request->vcrypto;
+
+    /* ret is VIRTIO_CRYPTO_OK or -VIRTIO_CRYPTO_* */
+    virtio_crypto_req_complete(request, ret < 0 ? -ret : ret);
+    virtio_crypto_free_request(request);
+    vcrypto->inflight--;
+}
+
 static int
 virtio_crypto_handle_request(VirtIOCryptoReq *request)
 {
@@ -587,10 +599,8 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
     unsigned in_num;
     unsigned out_num;
     uint32_t opcode;
-    uint8_t status = VIRTIO_CRYPTO_ERR;
     uint64_t session_id;
     CryptoDevBackendSymOpInfo *sym_op_info = NULL;
-    Error *local_err = NULL;
 
     if (elem->out_num < 1 || elem->in_num < 1) {
         virtio_error(vdev, "virtio-crypto dataq missing headers");
@@ -649,18 +659,10 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
             /* Set request's parameter */
             request->flags = CRYPTODEV_BACKEND_ALG_SYM;
             request->u.sym_op_info = sym_op_info;
-            ret = cryptodev_backend_crypto_operation(vcrypto->cryptodev,
-                                    request, queue_index, &local_err);
-            if (ret < 0) {
-                status = -ret;
-                if (local_err) {
-                    error_report_err(local_err);
-                }
-            } else { /* ret == VIRTIO_CRYPTO_OK */
-                status = ret;
-            }
-            virtio_crypto_req_complete(request, status);
-            virtio_crypto_free_request(request);
+            vcrypto->inflight++;
+            cryptodev_backend_crypto_operation_async(vcrypto->cryptodev,
+                                    request, queue_index,
+                                    virtio_crypto_req_done, request);
         }
         break;
     case VIRTIO_CRYPTO_HASH:
@@ -745,6 +747,10 @@ static uint64_t virtio_crypto_get_features(VirtIODevice *vdev,
 static void virtio_crypto_reset(VirtIODevice *vdev)
 {
     VirtIOCrypto *vcrypto = VIRTIO_CRYPTO(vdev);
+
+    /* Requests still in the backend hold virtqueue elements */
+    AIO_WAIT_WHILE(NULL, vcrypto->inflight > 0);
+
     /* multiqueue is disabled by default */
     vcrypto->curr_queues = 1;
     if (!cryptodev_backend_is_ready(vcrypto->cryptodev)) {
@@ -829,6 +835,8 @@ static void virtio_crypto_device_unrealize(DeviceState *dev, Error **errp)
     VirtIOCryptoQueue *q;
     int i, max_queues;
 
+    AIO_WAIT_WHILE(NULL, vcrypto->inflight > 0);
+
     max_queues = vcrypto->multiqueue ? vcrypto->max_queues : 1;
     for (i = 0; i < max_queues; i++) {
         virtio_del_queue(vdev, i);
@@ -43,6 +43,19 @@ void qemu_aio_ref(void *p);
 
 typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
+
+/*
+ * Event loop statistics.  They are only updated by the thread that runs
+ * aio_poll() and can be read from any thread with aio_context_get_poll_stats().
+ */
+typedef struct AioPollStats {
+    uint64_t poll_hits;     /* busy polling found work */
+    uint64_t poll_misses;   /* busy polling timed out */
+    uint64_t poll_ns;       /* total time spent busy polling */
+    uint64_t block_ns;      /* total time spent waiting for file descriptors */
+    uint64_t dispatches;    /* file descriptor handlers invoked */
+    uint64_t cur_poll_ns;   /* current polling time */
+} AioPollStats;
 typedef bool AioPollFn(void *opaque);
 typedef void IOHandler(void *opaque);
 
@@ -116,12 +129,26 @@ struct AioContext {
      */
     struct ThreadPool *thread_pool;
 
+    /* Size limits for thread_pool, see aio_context_set_thread_pool_params */
+    int thread_pool_min;
+    int thread_pool_max;
+
 #ifdef CONFIG_LINUX_AIO
     /* State for native Linux AIO.  Uses aio_context_acquire/release for
      * locking.
      */
     struct LinuxAioState *linux_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * State for Linux io_uring.  Uses aio_context_acquire/release for
+     * locking.
+     */
+    struct LuringState *linux_io_uring;
+
+    /* Whether the io_uring ring is created with a kernel submission thread */
+    bool linux_io_uring_sqpoll;
+#endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
      * locking.
@@ -142,10 +169,24 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    AioPollStats poll_stats;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
     bool epoll_enabled;
     bool epoll_available;
+
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * io_uring(7) fd monitoring ring, used in preference to epoll(7) and
+     * ppoll(2) when the kernel supports it.  Only accessed by the home
+     * thread.
+     */
+    struct io_uring *io_uring;
+
+    /* Removed handlers whose POLL_ADD request is still in flight */
+    QSLIST_HEAD(, AioHandler) io_uring_deleted;
+#endif
 };
 
 /**
@@ -386,6 +427,32 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Setup the LuringState bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+
+/* Return the LuringState bound to this AioContext */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/**
+ * aio_context_set_io_uring_sqpoll:
+ * @ctx: the aio context
+ * @sqpoll: whether to let a kernel thread poll the submission queue
+ *
+ * Only takes effect if the io_uring ring of @ctx has not been created yet.
+ */
+void aio_context_set_io_uring_sqpoll(AioContext *ctx, bool sqpoll);
+
+/**
+ * aio_context_set_thread_pool_params:
+ * @ctx: the aio context
+ * @min: number of worker threads that are kept even when idle
+ * @max: maximum number of worker threads
+ *
+ * Also applies to the thread pool of @ctx if it has been created already.
+ */
+void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
+                                        int64_t max, Error **errp);
+
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -622,4 +689,14 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @stats: filled with a snapshot of the event loop statistics
+ *
+ * Can be called from any thread.  The counters are read one by one, so
+ * they may be slightly inconsistent with each other.
+ */
+void aio_context_get_poll_stats(AioContext *ctx, AioPollStats *stats);
+
 #endif
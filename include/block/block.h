@@ -126,6 +126,7 @@ typedef struct HDGeometry {
                                       ignoring the format layer */
 #define BDRV_O_NO_IO       0x10000 /* don't initialize for I/O */
 #define BDRV_O_AUTO_RDONLY 0x20000 /* degrade to read-only if opening read-write fails */
+#define BDRV_O_IO_URING    0x40000 /* use io_uring instead of the thread pool */
 
 #define BDRV_O_CACHE_MASK  (BDRV_O_NOCACHE | BDRV_O_NO_FLUSH)
 
@@ -301,6 +302,7 @@ void bdrv_replace_node(BlockDriverState *from, BlockDriverState *to,
 
 int bdrv_parse_cache_mode(const char *mode, int *flags, bool *writethrough);
 int bdrv_parse_discard_flags(const char *mode, int *flags);
+int bdrv_parse_aio(const char *mode, int *flags);
 BdrvChild *bdrv_open_child(const char *filename,
                            QDict *options, const char *bdref_key,
                            BlockDriverState* parent,
@@ -746,4 +748,30 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                     BdrvChild *dst, uint64_t dst_offset,
                                     uint64_t bytes, BdrvRequestFlags read_flags,
                                     BdrvRequestFlags write_flags);
+
+/**
+ *
+ * bdrv_co_sendfile:
+ *
+ * Send data of @child to the file descriptor @out_fd without copying it
+ * through a buffer in QEMU (e.g. using sendfile(2)).  Only raw data paths
+ * down to a protocol driver that keeps its data in a file support this.
+ *
+ * Like for bdrv_co_copy_range, the block layer does not fall back to a
+ * bounce buffer; callers are expected to do a normal read instead if this
+ * fails.
+ *
+ * @child: Child to read data from
+ * @offset: offset in @child image to read data
+ * @bytes: number of bytes to send; with 0, only check whether the whole
+ *         path supports sending data this way
+ * @out_fd: file descriptor (usually a non-blocking socket) to send data to
+ *
+ * Returns: the number of bytes sent, which may be less than @bytes;
+ *          -EAGAIN if @out_fd cannot take more data at the moment;
+ *          -ENOTSUP if the operation is not supported, in which case nothing
+ *          has been sent; other negative error codes on failure.
+ **/
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, uint64_t offset,
+                                  uint64_t bytes, int out_fd);
 #endif
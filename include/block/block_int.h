@@ -57,6 +57,8 @@
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
 #define BLOCK_OPT_DATA_FILE         "data_file"
 #define BLOCK_OPT_DATA_FILE_RAW     "data_file_raw"
+#define BLOCK_OPT_EXTL2             "extended_l2"
+#define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -280,6 +282,17 @@ struct BlockDriver {
                                               BdrvRequestFlags read_flags,
                                               BdrvRequestFlags write_flags);
 
+    /* Map [offset, offset + bytes) range onto a child of @bs and invoke
+     * bdrv_co_sendfile(child, ...), or transfer the data to @out_fd if @bs
+     * is the leaf.
+     *
+     * See the comment of bdrv_co_sendfile for the parameter and return value
+     * semantics.
+     */
+    int coroutine_fn (*bdrv_co_sendfile)(BlockDriverState *bs,
+                                         uint64_t offset, uint64_t bytes,
+                                         int out_fd);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -559,6 +572,14 @@ struct BlockDriver {
     void (*bdrv_remove_persistent_dirty_bitmap)(BlockDriverState *bs,
                                                 const char *name,
                                                 Error **errp);
+    /**
+     * Read the stored contents of a persistent bitmap that was created
+     * without its data (see bdrv_dirty_bitmap_set_lazy()) into @target.
+     */
+    int (*bdrv_load_dirty_bitmap_data)(BlockDriverState *bs,
+                                       BdrvDirtyBitmap *bitmap,
+                                       BdrvDirtyBitmap *target,
+                                       Error **errp);
 
     /**
      * Register/unregister a buffer for I/O. For example, when the driver is
@@ -639,6 +660,21 @@ typedef struct BlockLimits {
 
 typedef struct BdrvOpBlocker BdrvOpBlocker;
 
+/* Maximum number of request padding buffers kept per node for reuse */
+#define BDRV_PAD_BUF_POOL_SIZE 16
+
+/*
+ * The last extent reported by .bdrv_co_block_status(), see
+ * BlockDriverState.cache_block_status
+ */
+typedef struct BdrvBlockStatusCache {
+    bool valid;
+    int64_t offset;
+    int64_t bytes;
+    int status;                 /* BDRV_BLOCK_* flags, without EOF */
+    int64_t map;                /* host offset of @offset if OFFSET_VALID */
+} BdrvBlockStatusCache;
+
 typedef struct BdrvAioNotifier {
     void (*attached_aio_context)(AioContext *new_context, void *opaque);
     void (*detach_aio_context)(void *opaque);
@@ -833,6 +869,15 @@ struct BlockDriverState {
      * BDRV_REQ_MAY_UNMAP, BDRV_REQ_WRITE_UNCHANGED) */
     unsigned int supported_zero_flags;
 
+    /*
+     * Set by the driver on open if querying the block status is expensive
+     * (e.g. a system call or a network round trip) and the data layout only
+     * changes through writes to this node.  The generic block layer then
+     * remembers the last extent returned by .bdrv_co_block_status() and
+     * answers overlapping queries from it.
+     */
+    bool cache_block_status;
+
     /* the following member gives a name to every node on the bs graph. */
     char node_name[32];
     /* element of the list of named nodes building the graph */
@@ -878,13 +923,25 @@ struct BlockDriverState {
     /* Writing to the list requires the BQL _and_ the dirty_bitmap_mutex.
      * Reading from the list can be done with either the BQL or the
      * dirty_bitmap_mutex.  Modifying a bitmap only requires
-     * dirty_bitmap_mutex.  */
+     * dirty_bitmap_mutex.  bdrv_set_dirty() sets bits without the mutex,
+     * counting itself in dirty_bitmap_writers; holders of the mutex set
+     * dirty_bitmap_locked and wait for the count to drop to zero.  */
     QemuMutex dirty_bitmap_mutex;
+    int dirty_bitmap_writers;
+    bool dirty_bitmap_locked;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /* Per-node latency accounting, enabled by setting a latency histogram
+     * for the node.  A request is accounted for the whole time it spends
+     * in this node, including the time spent in the child nodes.
+     * node_stats_enabled is accessed with atomic ops.
+     */
+    BlockAcctStats node_stats;
+    bool node_stats_enabled;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -911,6 +968,21 @@ struct BlockDriverState {
 
     unsigned int write_gen;               /* Current data generation */
 
+    /* Only accessed from the node's AioContext.  */
+    BdrvBlockStatusCache block_status_cache;
+
+    /*
+     * Aligned bounce buffers for the head and tail of unaligned requests,
+     * kept for reuse so that the padding path does not allocate.  All of
+     * them are pad_buf_size bytes long and aligned to pad_buf_align.
+     * Protected by pad_buf_lock.
+     */
+    QemuMutex pad_buf_lock;
+    void *pad_bufs[BDRV_PAD_BUF_POOL_SIZE];
+    int nb_pad_bufs;
+    size_t pad_buf_size;
+    size_t pad_buf_align;
+
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
@@ -986,6 +1058,7 @@ static inline int coroutine_fn bdrv_co_pwrite(BdrvChild *child,
 }
 
 extern unsigned int bdrv_drain_all_count;
+extern unsigned int bdrv_states_generation;
 void bdrv_apply_subtree_drain(BdrvChild *child, BlockDriverState *new_parent);
 void bdrv_unapply_subtree_drain(BdrvChild *child, BlockDriverState *old_parent);
 
@@ -1065,6 +1138,7 @@ int is_windows_drive(const char *filename);
  * @creation_flags: Flags that control the behavior of the Job lifetime.
  *                  See @BlockJobCreateFlags
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
+ * @max_workers: Maximum number of concurrent copy requests, or 0 for one.
  * @on_error: The action to take upon error.
  * @errp: Error object.
  *
@@ -1077,7 +1151,7 @@ int is_windows_drive(const char *filename);
  */
 void stream_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, const char *backing_file_str,
-                  int creation_flags, int64_t speed,
+                  int creation_flags, int64_t speed, int max_workers,
                   BlockdevOnError on_error, Error **errp);
 
 /**
@@ -1090,6 +1164,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
  * @creation_flags: Flags that control the behavior of the Job lifetime.
  *                  See @BlockJobCreateFlags
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
+ * @max_workers: Maximum number of concurrent copy requests, or 0 for one.
  * @on_error: The action to take upon error.
  * @backing_file_str: String to use as the backing file in @top's overlay
  * @filter_node_name: The node name that should be assigned to the filter
@@ -1100,7 +1175,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
  */
 void commit_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *base, BlockDriverState *top,
-                  int creation_flags, int64_t speed,
+                  int creation_flags, int64_t speed, int max_workers,
                   BlockdevOnError on_error, const char *backing_file_str,
                   const char *filter_node_name, Error **errp);
 /**
@@ -1179,6 +1254,9 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
  * @sync_mode: What parts of the disk image should be copied to the destination.
  * @sync_bitmap: The dirty bitmap if sync_mode is 'bitmap' or 'incremental'
  * @bitmap_mode: The bitmap synchronization policy to use.
+ * @compress: Whether to write compressed data to @target.
+ * @max_workers: Maximum number of concurrent copy requests, or 0 for one.
+ * @max_chunk: Maximum size of one copy request, or 0 for the cluster size.
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
  * @creation_flags: Flags that control the behavior of the Job lifetime.
@@ -1195,7 +1273,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                             MirrorSyncMode sync_mode,
                             BdrvDirtyBitmap *sync_bitmap,
                             BitmapSyncMode bitmap_mode,
-                            bool compress,
+                            bool compress, int max_workers, int64_t max_chunk,
                             BlockdevOnError on_source_error,
                             BlockdevOnError on_target_error,
                             int creation_flags,
@@ -1290,6 +1368,8 @@ bool bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
 void bdrv_inc_in_flight(BlockDriverState *bs);
 void bdrv_dec_in_flight(BlockDriverState *bs);
 
+void bdrv_drop_pad_bufs(BlockDriverState *bs);
+
 void blockdev_close_all_bdrv_states(void);
 
 int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, uint64_t src_offset,
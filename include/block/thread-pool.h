@@ -20,12 +20,24 @@
 
 #include "block/block.h"
 
+#define THREAD_POOL_MAX_THREADS_DEFAULT 64
+
 typedef int ThreadPoolFunc(void *opaque);
 
 typedef struct ThreadPool ThreadPool;
 
+typedef struct ThreadPoolStats {
+    int threads;            /* worker threads, including those being spawned */
+    int idle_threads;
+    int queue_depth;        /* requests waiting for a worker */
+    uint64_t completed;     /* requests run to completion */
+    uint64_t total_ns;      /* total submission-to-completion time */
+} ThreadPoolStats;
+
 ThreadPool *thread_pool_new(struct AioContext *ctx);
 void thread_pool_free(ThreadPool *pool);
+void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
 
 BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg,
@@ -28,6 +28,20 @@
 #include "qemu/throttle.h"
 #include "block/block_int.h"
 
+/* Tokens that a ThrottleGroupMember has taken from its group in advance,
+ * so that it can start requests without taking the group lock. The
+ * tokens are already accounted in the group's ThrottleState.
+ */
+typedef struct ThrottleLease {
+    double bytes;
+    double units;
+    bool bytes_limited;     /* false if no bps limit applies */
+    bool units_limited;     /* false if no iops limit applies */
+    uint64_t op_size;       /* copy of the group's cfg.op_size */
+    unsigned generation;    /* the lease is void if the group's differs */
+    bool valid;
+} ThrottleLease;
+
 /* The ThrottleGroupMember structure indicates membership in a ThrottleGroup
  * and holds related data.
  */
@@ -48,6 +62,11 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Tokens leased from the group for reads and writes. These are only
+     * accessed from the member's AioContext, or while it is drained.
+     */
+    ThrottleLease lease[2];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -28,13 +28,16 @@
 #include "chardev/char.h"
 #include "qemu/main-loop.h"
 
-/* Can only be used for read */
-GSource *io_add_watch_poll(Chardev *chr,
-                        QIOChannel *ioc,
-                        IOCanReadHandler *fd_can_read,
-                        QIOChannelFunc fd_read,
-                        gpointer user_data,
-                        GMainContext *context);
+/*
+ * Can only be used for read.  The watch is stored in chr->watch and
+ * removed with remove_fd_in_watch().
+ */
+IOWatchPoll *io_add_watch_poll(Chardev *chr,
+                               QIOChannel *ioc,
+                               IOCanReadHandler *fd_can_read,
+                               QIOChannelFunc fd_read,
+                               gpointer user_data,
+                               GMainContext *context);
 
 void remove_fd_in_watch(Chardev *chr);
 
@@ -56,6 +56,9 @@ typedef enum {
 
 #define qemu_chr_replay(chr) qemu_chr_has_feature(chr, QEMU_CHAR_FEATURE_REPLAY)
 
+typedef struct ChardevOutbuf ChardevOutbuf;
+typedef struct IOWatchPoll IOWatchPoll;
+
 struct Chardev {
     Object parent_obj;
 
@@ -64,8 +67,9 @@ struct Chardev {
     char *label;
     char *filename;
     int logfd;
+    ChardevOutbuf *outbuf;
     int be_open;
-    GSource *gsource;
+    IOWatchPoll *watch;
     GMainContext *gcontext;
     DECLARE_BITMAP(features, QEMU_CHAR_FEATURE_LAST);
 };
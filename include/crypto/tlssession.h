@@ -321,4 +321,32 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_offload_send:
+ * @sess: the TLS session object
+ * @fd: the TCP socket carrying the session
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Hand the sending direction of the session over to the
+ * kernel TLS layer of @fd. Afterwards plain data written
+ * to @fd is sent as TLS records by the kernel (or by the
+ * NIC, if it supports TLS offload), and the session must
+ * no longer be used for qcrypto_tls_session_write().
+ * Receiving keeps going through the session.
+ *
+ * Only AES-GCM cipher suites on TLS 1.2 and 1.3 can be
+ * offloaded, and the kernel does not renegotiate or update
+ * keys.
+ *
+ * It is an error to call this before
+ * qcrypto_tls_session_get_handshake_status() returns
+ * QCRYPTO_TLS_HANDSHAKE_COMPLETE
+ *
+ * Returns: 0 on success, -1 if the session could not be
+ * offloaded; the session is then still usable as before
+ */
+int qcrypto_tls_session_offload_send(QCryptoTLSSession *sess,
+                                     int fd,
+                                     Error **errp);
+
 #endif /* QCRYPTO_TLSSESSION_H */
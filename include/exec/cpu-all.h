@@ -363,6 +363,9 @@ static inline bool tlb_hit(target_ulong tlb_addr, target_ulong addr)
 
 void dump_exec_info(void);
 void dump_opcount_info(void);
+void dump_tb_profile(int max);
+void tb_profile_enable(bool enable);
+void tb_profile_reset(void);
 #endif /* !CONFIG_USER_ONLY */
 
 int cpu_memory_rw_debug(CPUState *cpu, target_ulong addr,
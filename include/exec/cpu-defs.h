@@ -79,8 +79,21 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/*
+ * The victim tlb has CPU_VTLB_SETS sets of CPU_VTLB_WAYS entries, a page
+ * being looked up only in the set selected by its low page number bits.
+ * Both can be overridden at build time.
+ */
+#ifndef CPU_VTLB_SETS
+#define CPU_VTLB_SETS 8
+#endif
+#ifndef CPU_VTLB_WAYS
+#define CPU_VTLB_WAYS 8
+#endif
+#define CPU_VTLB_SIZE (CPU_VTLB_SETS * CPU_VTLB_WAYS)
+
+/* number of separately tracked large page regions, per MMU mode */
+#define CPU_TLB_LARGE_PAGES 4
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -154,20 +167,21 @@ typedef struct CPUIOTLBEntry {
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * Describe regions covering all of the large pages allocated
+     * into the tlb.  When any page within these regions is flushed,
+     * we must flush the entire tlb.  Region i is matched if
+     * (addr & large_page_mask[i]) == large_page_addr[i]; unused
+     * regions have both set to -1.
      */
-    target_ulong large_page_addr;
-    target_ulong large_page_mask;
+    target_ulong large_page_addr[CPU_TLB_LARGE_PAGES];
+    target_ulong large_page_mask[CPU_TLB_LARGE_PAGES];
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
-    /* The next index to use in the tlb victim table.  */
-    size_t vindex;
+    /* The next way to use in each set of the tlb victim table.  */
+    uint8_t vindex[CPU_VTLB_SETS];
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
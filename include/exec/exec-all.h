@@ -410,9 +410,26 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /*
+     * Last destination of this TB's indirect jumps, tried by lookup_tb_ptr
+     * before the jump cache. It is only trusted while ind_epoch matches
+     * tb_ctx_epoch(), since the destination may have been freed since.
+     */
+    struct TranslationBlock *ind_dest;
+    unsigned ind_epoch;
+
+    /*
+     * Execution profile, only maintained while tb_profile_enabled.
+     * The counters are updated without synchronization.
+     */
+    uint64_t exec_count;
+    uint64_t exit_count;
+    unsigned helper_calls;  /* helper calls in the translated code */
 };
 
 extern bool parallel_cpus;
+extern bool tb_profile_enabled;
 
 /* Hide the atomic_read to make code a little easier on the eyes */
 static inline uint32_t tb_cflags(const TranslationBlock *tb)
@@ -487,6 +504,11 @@ void mmap_lock(void);
 void mmap_unlock(void);
 bool have_mmap_lock(void);
 
+/* tb-cache.c */
+void tb_cache_init(const char *dir, const char *exec_path, CPUState *cpu,
+                   const char *cpu_type);
+void tb_cache_save(void);
+
 static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 {
     return addr;
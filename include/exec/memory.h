@@ -129,6 +129,12 @@ typedef struct IOMMUNotifier IOMMUNotifier;
 /* RAM is a persistent kind memory */
 #define RAM_PMEM (1 << 5)
 
+/*
+ * RAM is a private copy-on-write mapping of a file holding the RAM of a
+ * template VM.  The file is opened read-only and never resized.
+ */
+#define RAM_TEMPLATE (1 << 6)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
@@ -368,6 +374,7 @@ struct MemoryRegion {
     bool rom_device;
     bool flush_coalesced_mmio;
     bool global_locking;
+    QemuMutex *lock;
     uint8_t dirty_log_mask;
     bool is_iommu;
     RAMBlock *ram_block;
@@ -390,6 +397,11 @@ struct MemoryRegion {
     int32_t priority;
     QTAILQ_HEAD(, MemoryRegion) subregions;
     QTAILQ_ENTRY(MemoryRegion) subregions_link;
+    /* Aliases of this region, and link in the aliased region's list */
+    QLIST_HEAD(, MemoryRegion) aliased_by;
+    QLIST_ENTRY(MemoryRegion) aliased_by_link;
+    /* Generation of the last topology update that involves the region */
+    unsigned update_gen;
     QTAILQ_HEAD(, CoalescedMemoryRange) coalesced;
     const char *name;
     unsigned ioeventfd_nb;
@@ -423,6 +435,8 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /* Used instead of log_sync by listeners that can only sync everything */
+    void (*log_sync_global)(MemoryListener *listener);
     void (*log_clear)(MemoryListener *listener, MemoryRegionSection *section);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
@@ -458,6 +472,9 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Number of bounce buffers mapped by address_space_map() */
+    unsigned bounce_buffers;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -658,6 +675,8 @@ void memory_region_init_resizeable_ram(MemoryRegion *mr,
  * @ram_flags: Memory region features:
  *             - RAM_SHARED: memory must be mmaped with the MAP_SHARED flag
  *             - RAM_PMEM: the memory is persistent memory
+ *             - RAM_TEMPLATE: @path is an existing template file, mapped
+ *               privately without ever writing to it
  *             Other bits are ignored now.
  * @path: the path in which to allocate the RAM.
  * @errp: pointer to Error*, to store an error if it happens.
@@ -1424,6 +1443,32 @@ void memory_region_add_coalescing(MemoryRegion *mr,
                                   hwaddr offset,
                                   uint64_t size);
 
+/**
+ * memory_region_add_posted_writes: Let writes to a sub-range of a region be
+ *                                  posted.
+ *
+ * Like memory_region_add_coalescing(), for registers such as doorbells whose
+ * writes have side effects that may be deferred: the accelerator can batch
+ * them instead of exiting to QEMU on each one.  Unlike plain coalesced
+ * writes, which may wait until the next access to the region, posted writes
+ * reach the access handlers, in order, once the vCPU that issued them exits
+ * to QEMU and at the latest after about a millisecond.
+ *
+ * @mr: the memory region to be updated.
+ * @offset: the start of the range within the region.
+ * @size: the size of the range.
+ */
+void memory_region_add_posted_writes(MemoryRegion *mr,
+                                     hwaddr offset,
+                                     uint64_t size);
+
+/**
+ * memory_region_have_posted_writes: Return whether any region has a range
+ *                                   set up with
+ *                                   memory_region_add_posted_writes().
+ */
+bool memory_region_have_posted_writes(void);
+
 /**
  * memory_region_clear_coalescing: Disable MMIO coalescing for the region.
  *
@@ -1473,6 +1518,41 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_global_locking(MemoryRegion *mr);
 
+/**
+ * memory_region_set_lock: Declares that accesses to the region are
+ *                         serialized by a device lock instead of the
+ *                         QEMU global lock.
+ *
+ * Accesses to the memory region are processed with @lock held, and
+ * without the QEMU global lock unless the lock is held on when issuing
+ * the access request.  Code that runs under the global lock and touches
+ * the device state used by the access handlers (timers, bottom halves,
+ * reset, ...) must take @lock as well.  The global lock always comes
+ * first in the lock order, so the access handlers must not take it
+ * directly; use memory_region_lock_iothread() instead.
+ *
+ * @mr: the memory region to be updated.
+ * @lock: the lock serializing accesses, or %NULL to go back to the
+ *        global lock.
+ */
+void memory_region_set_lock(MemoryRegion *mr, QemuMutex *lock);
+
+/**
+ * memory_region_lock_iothread: Take the QEMU global lock from an access
+ *                              handler of a region with a device lock.
+ *
+ * For handlers of regions set up with memory_region_set_lock() that need
+ * the QEMU global lock for part of their work, e.g. to raise interrupts.
+ * The device lock is released and taken again after the global lock, so
+ * device state read before the call may have changed.
+ *
+ * Returns: %true if the caller must release the global lock with
+ * qemu_mutex_unlock_iothread() when done, %false if it was already held.
+ *
+ * @mr: the memory region whose access handler is running.
+ */
+bool memory_region_lock_iothread(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -68,6 +68,15 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+
+    /*
+     * With mapped-ram, the pages of the block live at pages_offset in
+     * the migration file and file_bmap tracks which of them hold data;
+     * the bitmap itself is written at bitmap_offset.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
 };
 
 /**
@@ -152,6 +161,8 @@ long qemu_maxrampagesize(void);
  *              or bit-or of following values
  *              - RAM_SHARED: mmap the backing file or device with MAP_SHARED
  *              - RAM_PMEM: the backend @mem_path or @fd is persistent memory
+ *              - RAM_TEMPLATE: the backend @mem_path or @fd holds the RAM of
+ *                a template VM, which is mapped copy-on-write
  *              Other bits are ignored.
  *  @mem_path or @fd: specify the backing file or device
  *  @errp: pointer to Error*, to store an error if it happens
@@ -35,8 +35,16 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
 };
 
 extern TBContext tb_ctx;
 
+/* Changes whenever translation blocks may have been freed */
+static inline unsigned tb_ctx_epoch(void)
+{
+    return atomic_read(&tb_ctx.tb_flush_count) +
+           atomic_read(&tb_ctx.tb_evict_count);
+}
+
 #endif
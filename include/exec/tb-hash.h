@@ -32,7 +32,7 @@
 #define TB_JMP_PAGE_BITS (TB_JMP_CACHE_BITS / 2)
 #define TB_JMP_PAGE_SIZE (1 << TB_JMP_PAGE_BITS)
 #define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
-#define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
+#define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SETS - TB_JMP_PAGE_SIZE)
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
@@ -54,11 +54,35 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 /* In user-mode we can get better hashing because we do not have a TLB */
 static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 {
-    return (pc ^ (pc >> TB_JMP_CACHE_BITS)) & (TB_JMP_CACHE_SIZE - 1);
+    return (pc ^ (pc >> TB_JMP_CACHE_BITS)) & (TB_JMP_CACHE_SETS - 1);
 }
 
 #endif /* CONFIG_SOFTMMU */
 
+/* The hash functions return a set; these are the set's first entry */
+static inline TranslationBlock **tb_jmp_cache_set(CPUState *cpu,
+                                                  unsigned int hash)
+{
+    return &cpu->tb_jmp_cache[hash * TB_JMP_CACHE_WAYS];
+}
+
+/*
+ * Insert @tb as the most recently used entry of its set, moving the
+ * other entries down and dropping the least recently inserted one.
+ * Only called by @cpu's own thread.
+ */
+static inline void tb_jmp_cache_insert(CPUState *cpu, unsigned int hash,
+                                       TranslationBlock *tb)
+{
+    TranslationBlock **set = tb_jmp_cache_set(cpu, hash);
+    int way;
+
+    for (way = TB_JMP_CACHE_WAYS - 1; way > 0; way--) {
+        atomic_set(&set[way], atomic_read(&set[way - 1]));
+    }
+    atomic_set(&set[0], tb);
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc, uint32_t flags,
                       uint32_t cf_mask, uint32_t trace_vcpu_dstate)
@@ -16,35 +16,56 @@
 #include "exec/exec-all.h"
 #include "exec/tb-hash.h"
 
-/* Might cause an exception, so have a longjmp destination ready */
+static inline bool tb_lookup_match(CPUState *cpu, TranslationBlock *tb,
+                                   target_ulong pc, target_ulong cs_base,
+                                   uint32_t flags, uint32_t cf_mask)
+{
+    return tb &&
+           tb->pc == pc &&
+           tb->cs_base == cs_base &&
+           tb->flags == flags &&
+           tb->trace_vcpu_dstate == *cpu->trace_dstate &&
+           (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask;
+}
+
+/*
+ * Might cause an exception, so have a longjmp destination ready.
+ * @hint, if not NULL, is a predicted result that is checked first.
+ */
 static inline TranslationBlock *
 tb_lookup__cpu_state(CPUState *cpu, target_ulong *pc, target_ulong *cs_base,
-                     uint32_t *flags, uint32_t cf_mask)
+                     uint32_t *flags, uint32_t cf_mask,
+                     TranslationBlock *hint)
 {
     CPUArchState *env = (CPUArchState *)cpu->env_ptr;
+    TranslationBlock **set;
     TranslationBlock *tb;
     uint32_t hash;
+    int way;
 
     cpu_get_tb_cpu_state(env, pc, cs_base, flags);
     hash = tb_jmp_cache_hash_func(*pc);
-    tb = atomic_rcu_read(&cpu->tb_jmp_cache[hash]);
+    set = tb_jmp_cache_set(cpu, hash);
 
     cf_mask &= ~CF_CLUSTER_MASK;
     cf_mask |= cpu->cluster_index << CF_CLUSTER_SHIFT;
 
-    if (likely(tb &&
-               tb->pc == *pc &&
-               tb->cs_base == *cs_base &&
-               tb->flags == *flags &&
-               tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               (tb_cflags(tb) & (CF_HASH_MASK | CF_INVALID)) == cf_mask)) {
-        return tb;
+    if (hint && tb_lookup_match(cpu, hint, *pc, *cs_base, *flags, cf_mask)) {
+        return hint;
+    }
+    for (way = 0; way < TB_JMP_CACHE_WAYS; way++) {
+        tb = atomic_rcu_read(&set[way]);
+        if (likely(tb_lookup_match(cpu, tb, *pc, *cs_base, *flags, cf_mask))) {
+            atomic_set(&cpu->tb_jmp_cache_hits, cpu->tb_jmp_cache_hits + 1);
+            return tb;
+        }
     }
+    atomic_set(&cpu->tb_jmp_cache_misses, cpu->tb_jmp_cache_misses + 1);
     tb = tb_htable_lookup(cpu, *pc, *cs_base, *flags, cf_mask);
     if (tb == NULL) {
         return NULL;
     }
-    atomic_set(&cpu->tb_jmp_cache[hash], tb);
+    tb_jmp_cache_insert(cpu, hash, tb);
     return tb;
 }
 
@@ -276,6 +276,18 @@ void free_aml_allocator(void);
  */
 void aml_append(Aml *parent_ctx, Aml *child);
 
+/**
+ * aml_raw:
+ * @data: already encoded AML
+ * @len: length of @data
+ *
+ * Wraps AML that was encoded earlier, so that it can be appended to a
+ * table as is.  With @len 0 this is an empty container: elements appended
+ * to it are encoded into its ->buf, which can be saved and later passed
+ * back to aml_raw().
+ */
+Aml *aml_raw(const uint8_t *data, unsigned len);
+
 /* non block AML object primitives */
 Aml *aml_name(const char *name_format, ...) GCC_FMT_ATTR(1, 2);
 Aml *aml_name_decl(const char *name, Aml *val);
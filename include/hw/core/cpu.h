@@ -269,11 +269,26 @@ struct CPUWatchpoint {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
+struct KVMExitStats;
 
 struct hax_vcpu_state;
 
+/*
+ * The TB jump cache is set-associative: a PC hashes to one of
+ * TB_JMP_CACHE_SETS sets of TB_JMP_CACHE_WAYS entries each.
+ * Both can be overridden at build time, e.g. with
+ * --extra-cflags=-DTB_JMP_CACHE_BITS=14 for guests with a large code
+ * footprint.
+ */
+#ifndef TB_JMP_CACHE_BITS
 #define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#endif
+#ifndef TB_JMP_CACHE_WAYS
+#define TB_JMP_CACHE_WAYS 2
+#endif
+#define TB_JMP_CACHE_SETS (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_SIZE (TB_JMP_CACHE_SETS * TB_JMP_CACHE_WAYS)
 
 /* work queue */
 
@@ -313,6 +328,8 @@ struct qemu_work_item;
  * @running: #true if CPU is currently running (lockless).
  * @has_waiter: #true if a CPU is currently waiting for the cpu_exec_end;
  * valid under cpu_list_lock.
+ * @qom_path: Canonical QOM path, cached when the CPU is added to the CPU
+ * list so that it can be read under cpu_list_lock without the BQL.
  * @created: Indicates whether the CPU thread has been successfully created.
  * @interrupt_request: Indicates a pending interrupt request.
  * @halted: Nonzero if the CPU is in suspended state.
@@ -320,6 +337,8 @@ struct qemu_work_item;
  * @stopped: Indicates the CPU has been artificially stopped.
  * @unplug: Indicates a pending CPU unplug request.
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
+ * @tlb_sync_pending: Number of other vCPUs that still have to complete a
+ *    synced TLB flush issued by this CPU; the CPU does not run until it is 0.
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
  * @can_do_io: Nonzero if memory-mapped IO is safe. Deterministic execution
@@ -340,6 +359,13 @@ struct qemu_work_item;
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
  * @kvm_fd: vCPU file descriptor for KVM.
+ * @kvm_dirty_gfns: Mapping of the vCPU's KVM dirty ring, if enabled.
+ * @kvm_fetch_index: Next dirty ring entry to harvest.
+ * @kvm_dirty_pages: Dirty ring entries harvested so far.
+ * @kvm_dirty_limit_start: Start of the dirty limit window, in microseconds.
+ * @kvm_dirty_limit_base: @kvm_dirty_pages at the start of the window.
+ * @kvm_dirty_limit_queued: A dirty limit sleep is queued as vCPU work.
+ * @kvm_exit_stats: Exit counters and latencies, see query-vcpu-stats.
  * @work_mutex: Lock to prevent multiple access to queued_work_*.
  * @queued_work_first: First asynchronous work pending.
  * @trace_dstate_delayed: Delayed changes to trace_dstate (includes all changes
@@ -364,6 +390,7 @@ struct CPUState {
     HANDLE hThread;
 #endif
     int thread_id;
+    char *qom_path;
     bool running, has_waiter;
     struct QemuCond *halt_cond;
     bool thread_kicked;
@@ -373,6 +400,7 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    int tlb_sync_pending;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
     uint32_t interrupt_request;
@@ -395,6 +423,9 @@ struct CPUState {
 
     /* Accessed in parallel; all accesses must be atomic */
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /* Only written by the vCPU thread */
+    size_t tb_jmp_cache_hits;
+    size_t tb_jmp_cache_misses;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -424,6 +455,13 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
+    uint64_t kvm_dirty_pages;
+    int64_t kvm_dirty_limit_start;
+    uint64_t kvm_dirty_limit_base;
+    bool kvm_dirty_limit_queued;
+    struct KVMExitStats *kvm_exit_stats;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -1023,6 +1061,23 @@ void end_exclusive(void);
  */
 void qemu_init_vcpu(CPUState *cpu);
 
+/**
+ * qemu_wait_vcpu_created:
+ * @cpu: The vCPU to wait for.
+ *
+ * Waits until the thread of @cpu has finished setting it up.  Must be
+ * called with the BQL held.
+ */
+void qemu_wait_vcpu_created(CPUState *cpu);
+
+/**
+ * qemu_wait_all_vcpus_created:
+ *
+ * Waits for all the vCPUs, including those that qemu_init_vcpu() left
+ * to set up in parallel on their own threads.
+ */
+void qemu_wait_all_vcpus_created(void);
+
 #define SSTEP_ENABLE  0x1  /* Enable simulated HW single stepping */
 #define SSTEP_NOIRQ   0x2  /* Do not use IRQ while single stepping */
 #define SSTEP_NOTIMER 0x4  /* Do not Timers while single stepping */
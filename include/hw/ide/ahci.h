@@ -25,6 +25,7 @@
 #define HW_IDE_AHCI_H
 
 #include "hw/sysbus.h"
+#include "sysemu/iothread.h"
 
 typedef struct AHCIDevice AHCIDevice;
 
@@ -48,6 +49,7 @@ typedef struct AHCIState {
     int32_t ports;
     qemu_irq irq;
     AddressSpace *as;
+    IOThread *iothread;
 } AHCIState;
 
 typedef struct AHCIPCIState AHCIPCIState;
@@ -633,6 +633,15 @@ BlockAIOCB *ide_buffered_readv(IDEState *s, int64_t sector_num,
                                QEMUIOVector *iov, int nb_sectors,
                                BlockCompletionFunc *cb, void *opaque);
 void ide_cancel_dma_sync(IDEState *s);
+/*
+ * With the BlockBackend in an IOThread, make a completion callback run in
+ * the main loop instead.  Pass the returned opaque and the updated @cb to
+ * the block layer.
+ */
+void *ide_wrap_completion(BlockBackend *blk, BlockCompletionFunc **cb,
+                          void *opaque);
+/* Cancel @acb, the caller must hold the AioContext of @blk */
+void ide_aio_cancel(BlockBackend *blk, BlockAIOCB *acb);
 
 /* hw/ide/atapi.c */
 void ide_atapi_cmd(IDEState *s);
@@ -86,6 +86,26 @@ struct FWCfgMemState {
  */
 void fw_cfg_add_bytes(FWCfgState *s, uint16_t key, void *data, size_t len);
 
+/**
+ * fw_cfg_add_mapped_file:
+ * @s: fw_cfg device being modified
+ * @key: selector key value for new fw_cfg item
+ * @filename: host file providing the item data
+ * @offset: offset of the item data within the file
+ * @len: location to store the size of the item data
+ * @errp: pointer to a NULL initialized error object
+ *
+ * Add a new fw_cfg item, available by selecting the given key, whose data
+ * is the content of @filename starting at @offset.  The file is mapped
+ * read-only rather than read into memory, so its pages are only faulted
+ * in when the guest fetches the item and are shared with the host page
+ * cache.  The mapping is kept for the lifetime of the fw_cfg device.
+ *
+ * Returns: 0 on success, -1 on error.
+ */
+int fw_cfg_add_mapped_file(FWCfgState *s, uint16_t key, const char *filename,
+                           size_t offset, size_t *len, Error **errp);
+
 /**
  * fw_cfg_add_string:
  * @s: fw_cfg device being modified
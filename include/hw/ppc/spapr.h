@@ -184,6 +184,9 @@ struct SpaprMachineState {
     int htab_save_index;
     bool htab_first_pass;
     int htab_fd;
+    /* HPTE groups written since the migration last looked at them */
+    unsigned long *htab_dirty_map;
+    long htab_dirty_groups;
 
     /* Pending DIMM unplug cache. It is populated when a LMB
      * unplug starts. It can be regenerated if a migration
@@ -771,6 +774,7 @@ int spapr_h_cas_compose_response(SpaprMachineState *sm,
                                  target_ulong addr, target_ulong size,
                                  SpaprOptionVector *ov5_updates);
 void close_htab_fd(SpaprMachineState *spapr);
+void spapr_htab_dirty_map_reset(SpaprMachineState *spapr);
 void spapr_setup_hpt_and_vrma(SpaprMachineState *spapr);
 void spapr_free_hpt(SpaprMachineState *spapr);
 SpaprTceTable *spapr_tce_new_table(DeviceState *owner, uint32_t liobn);
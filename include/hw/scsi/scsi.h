@@ -193,6 +193,9 @@ int scsi_device_get_sense(SCSIDevice *dev, uint8_t *buf, int len, bool fixed);
 int scsi_SG_IO_FROM_DEV(BlockBackend *blk, uint8_t *cmd, uint8_t cmd_size,
                         uint8_t *buf, uint8_t buf_size);
 SCSIDevice *scsi_device_find(SCSIBus *bus, int channel, int target, int lun);
+AioContext *scsi_device_get_aio_context(SCSIDevice *dev);
+int scsi_device_set_aio_context(SCSIDevice *dev, AioContext *ctx,
+                                Error **errp);
 
 /* scsi-generic.c. */
 extern const SCSIReqOps scsi_generic_req_ops;
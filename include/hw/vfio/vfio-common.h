@@ -74,6 +74,9 @@ typedef struct VFIOContainer {
     int error;
     bool initialized;
     unsigned long pgsizes;
+    /* DMA mappings queued to the worker threads, and their first error */
+    int dma_map_pending;
+    int dma_map_error;
     QLIST_HEAD(, VFIOGuestIOMMU) giommu_list;
     QLIST_HEAD(, VFIOHostDMAWindow) hostwin_list;
     QLIST_HEAD(, VFIOGroup) group_list;
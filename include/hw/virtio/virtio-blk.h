@@ -34,6 +34,8 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    /* Colon-separated IOThread ids that virtqueues are spread over */
+    char *iothread_vq_mapping;
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -77,6 +79,9 @@ typedef struct VirtIOBlockReq {
 
 #define VIRTIO_BLK_MAX_MERGE_REQS 32
 
+/* Number of requests taken off a virtqueue at once */
+#define VIRTIO_BLK_POP_BATCH 32
+
 typedef struct MultiReqBuffer {
     VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
     unsigned int num_reqs;
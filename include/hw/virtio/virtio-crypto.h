@@ -97,6 +97,8 @@ typedef struct VirtIOCrypto {
     uint32_t curr_queues;
     size_t config_size;
     uint8_t vhost_started;
+    /* Data requests submitted to the backend but not completed yet */
+    unsigned int inflight;
 } VirtIOCrypto;
 
 #endif /* QEMU_VIRTIO_CRYPTO_H */
@@ -49,6 +49,8 @@ struct virtio_gpu_simple_resource {
     unsigned int iov_cnt;
     uint32_t scanout_bitmask;
     pixman_image_t *image;
+    /* Host copy of the image while @image uses the guest backing */
+    pixman_image_t *host_image;
     uint64_t hostmem;
     QTAILQ_ENTRY(virtio_gpu_simple_resource) next;
 };
@@ -73,6 +75,7 @@ enum virtio_gpu_base_conf_flags {
     VIRTIO_GPU_FLAG_VIRGL_ENABLED = 1,
     VIRTIO_GPU_FLAG_STATS_ENABLED,
     VIRTIO_GPU_FLAG_EDID_ENABLED,
+    VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED,
 };
 
 #define virtio_gpu_virgl_enabled(_cfg) \
@@ -81,6 +84,8 @@ enum virtio_gpu_base_conf_flags {
     (_cfg.flags & (1 << VIRTIO_GPU_FLAG_STATS_ENABLED))
 #define virtio_gpu_edid_enabled(_cfg) \
     (_cfg.flags & (1 << VIRTIO_GPU_FLAG_EDID_ENABLED))
+#define virtio_gpu_zero_copy_enabled(_cfg) \
+    (_cfg.flags & (1 << VIRTIO_GPU_FLAG_ZERO_COPY_ENABLED))
 
 struct virtio_gpu_base_conf {
     uint32_t max_outputs;
@@ -121,6 +121,23 @@ typedef struct VirtioNetRscChain {
     VirtioNetRscStat stat;
 } VirtioNetRscChain;
 
+#define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
+#define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
+
+/* Receive side scaling and hash report state, set up by the guest */
+typedef struct VirtioNetRssData {
+    bool enabled;
+    /* Steer packets by hash (RSS_CONFIG), not only report it */
+    bool redirect;
+    /* VIRTIO_NET_F_HASH_REPORT negotiated, header has hash fields */
+    bool populate_hash;
+    uint32_t hash_types;
+    uint8_t key[VIRTIO_NET_RSS_MAX_KEY_SIZE];
+    uint16_t indirections_len;
+    uint16_t indirections_table[VIRTIO_NET_RSS_MAX_TABLE_LEN];
+    uint16_t default_queue;
+} VirtioNetRssData;
+
 /* Maximum packet size we can receive from tap device: header + 64k */
 #define VIRTIO_NET_MAX_BUFSIZE (sizeof(struct virtio_net_hdr) + (64 * KiB))
 
@@ -133,6 +150,8 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* RX buffers filled while plugged, not yet flushed to the guest */
+    unsigned int rx_pending;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -185,6 +204,9 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    VirtioNetRssData rss_data;
+    struct NetRxPkt *rx_pkt;
+    unsigned int rx_plugged;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -57,9 +57,23 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    /* Colon-separated IOThread ids that request queues are spread over */
+    char *iothread_vq_mapping;
 };
 
 struct VirtIOSCSI;
+struct VirtIOSCSIReq;
+
+/*
+ * Requests completed outside the AioContext that owns their virtqueue are
+ * pushed to the vring from a BH in that AioContext.
+ */
+typedef struct VirtIOSCSIVqCompletions {
+    struct VirtIOSCSI *s;
+    VirtQueue *vq;
+    QemuMutex lock;
+    QTAILQ_HEAD(, VirtIOSCSIReq) reqs;
+} VirtIOSCSIVqCompletions;
 
 typedef struct VirtIOSCSICommon {
     VirtIODevice parent_obj;
@@ -80,7 +94,18 @@ typedef struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* control/event queues and the default for LUNs */
+
+    /*
+     * With iothread-vq-mapping, request queues and LUNs are spread over
+     * several IOThreads.  vq_ctx and vq_completions are indexed by virtqueue
+     * index.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    unsigned next_lun_iothread;
+    AioContext **vq_ctx;
+    VirtIOSCSIVqCompletions *vq_completions;
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -154,7 +179,11 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req);
 void virtio_scsi_push_event(VirtIOSCSI *s, SCSIDevice *dev,
                             uint32_t event, uint32_t reason);
 
+AioContext *virtio_scsi_vq_ctx(VirtIOSCSI *s, VirtQueue *vq);
+void virtio_scsi_flush_vq_completions(VirtIOSCSI *s, VirtQueue *vq);
+
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
@@ -49,6 +49,9 @@ struct QIOChannelTLS {
     QIOChannel *master;
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
+    bool offload_wanted;
+    /* Writes go to the master, the kernel builds the TLS records */
+    bool offload_send;
 };
 
 /**
@@ -132,6 +135,23 @@ void qio_channel_tls_handshake(QIOChannelTLS *ioc,
                                GDestroyNotify destroy,
                                GMainContext *context);
 
+/**
+ * qio_channel_tls_set_kernel_offload:
+ * @ioc: the TLS channel object
+ * @enabled: whether to try kernel TLS
+ *
+ * Ask for the sending direction of the session to be handed
+ * to the kernel once the handshake completes, so that data
+ * is encrypted by the kernel or the NIC rather than by the
+ * TLS library. This only works if @master is a TCP socket
+ * and the host supports kernel TLS for the negotiated cipher;
+ * otherwise the channel silently keeps encrypting itself.
+ *
+ * Must be called before qio_channel_tls_handshake().
+ */
+void qio_channel_tls_set_kernel_offload(QIOChannelTLS *ioc,
+                                        bool enabled);
+
 /**
  * qio_channel_tls_get_session:
  * @ioc: the TLS channel object
@@ -186,6 +186,13 @@ struct VMStateDescription {
     int (*pre_save)(void *opaque);
     int (*post_save)(void *opaque);
     bool (*needed)(void *opaque);
+    /*
+     * With the parallel-device-load capability, the fields and
+     * subsections of this section may be loaded outside the BQL, at the
+     * same time as other such sections of the same priority.  pre_load
+     * and post_load are still called in the main thread, in stream order.
+     */
+    bool parallel_load;
     const VMStateField *fields;
     const VMStateDescription **subsections;
 };
@@ -1106,6 +1113,8 @@ extern const VMStateInfo vmstate_info_qtailq;
 
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id);
+int vmstate_load_state_fields(QEMUFile *f, const VMStateDescription *vmsd,
+                              void *opaque, int version_id);
 int vmstate_save_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, QJSON *vmdesc);
 int vmstate_save_state_v(QEMUFile *f, const VMStateDescription *vmsd,
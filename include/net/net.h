@@ -57,6 +57,7 @@ typedef void (SetOffload)(NetClientState *, int, int, int, int, int);
 typedef void (SetVnetHdrLen)(NetClientState *, int);
 typedef int (SetVnetLE)(NetClientState *, bool);
 typedef int (SetVnetBE)(NetClientState *, bool);
+typedef void (NetIOPlug)(NetClientState *);
 typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 typedef void (NetAnnounce)(NetClientState *);
@@ -81,6 +82,8 @@ typedef struct NetClientInfo {
     SetVnetLE *set_vnet_le;
     SetVnetBE *set_vnet_be;
     NetAnnounce *announce;
+    NetIOPlug *io_plug;
+    NetIOPlug *io_unplug;
 } NetClientInfo;
 
 struct NetClientState {
@@ -147,6 +150,13 @@ ssize_t qemu_sendv_packet(NetClientState *nc, const struct iovec *iov,
                           int iovcnt);
 ssize_t qemu_sendv_packet_async(NetClientState *nc, const struct iovec *iov,
                                 int iovcnt, NetPacketSent *sent_cb);
+/*
+ * Like qemu_sendv_packet_async(), but the buffers must stay valid until
+ * @sent_cb is called if the packet gets queued; they are not copied.
+ */
+ssize_t qemu_sendv_packet_async_nocopy(NetClientState *nc,
+                                       const struct iovec *iov, int iovcnt,
+                                       NetPacketSent *sent_cb);
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
@@ -164,6 +174,12 @@ void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 int qemu_set_vnet_le(NetClientState *nc, bool is_le);
 int qemu_set_vnet_be(NetClientState *nc, bool is_be);
+/*
+ * Bracket a burst of packets sent to @nc.  Between the two calls the
+ * client may queue packets and write them out together on unplug.
+ */
+void qemu_net_io_plug(NetClientState *nc);
+void qemu_net_io_unplug(NetClientState *nc);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
@@ -32,6 +32,12 @@ typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
+/*
+ * The sender keeps the packet buffers valid and unchanged until its sent
+ * callback runs, so a queued packet may reference them instead of taking
+ * a copy.  Ignored for packets sent without a callback.
+ */
+#define QEMU_NET_PACKET_FLAG_NOCOPY (1 << 1)
 
 /* Returns:
  *   >0 - success
@@ -28,4 +28,12 @@ QDict *qdict_from_jsonf_nofail(const char *string, ...)
 QString *qobject_to_json(const QObject *obj);
 QString *qobject_to_json_pretty(const QObject *obj);
 
+/*
+ * Serialize @obj to JSON, passing the text to @write in pieces as it is
+ * generated.  Each piece is NUL-terminated and @len bytes long.
+ */
+typedef void QJSONWriteFunc(void *opaque, const char *buf, size_t len);
+void qobject_to_json_stream(const QObject *obj, bool pretty,
+                            QJSONWriteFunc *write, void *opaque);
+
 #endif /* QJSON_H */
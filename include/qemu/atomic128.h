@@ -79,12 +79,31 @@ static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
 }
 # define HAVE_CMPXCHG128 1
 #else
-/* Fallback definition that must be optimized away, or error.  */
-Int128 QEMU_ERROR("unsupported atomic")
-    atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new);
-# define HAVE_CMPXCHG128 0
+/*
+ * No host instruction: serialize on one of a small set of spinlocks,
+ * chosen by address (see util/atomic128.c).  Unlike the alternative of
+ * cpu_exec_step_atomic, this only stalls vCPUs that operate on nearby
+ * addresses.  The compare-and-swap is atomic with respect to every other
+ * 16-byte operation that goes through here, but not with respect to a
+ * plain store to the same bytes from another thread.
+ */
+Int128 atomic16_cmpxchg_locked(Int128 *ptr, Int128 cmp, Int128 new);
+void atomic128_init(void);
+
+static inline Int128 atomic16_cmpxchg(Int128 *ptr, Int128 cmp, Int128 new)
+{
+    return atomic16_cmpxchg_locked(ptr, cmp, new);
+}
+# define HAVE_CMPXCHG128 1
+# define HAVE_CMPXCHG128_LOCKED 1
 #endif /* Some definition for HAVE_CMPXCHG128 */
 
+#ifndef HAVE_CMPXCHG128_LOCKED
+static inline void atomic128_init(void)
+{
+}
+#endif
+
 
 #if defined(CONFIG_ATOMIC128)
 static inline Int128 atomic16_read(Int128 *ptr)
@@ -132,7 +151,7 @@ static inline void atomic16_set(Int128 *ptr, Int128 val)
 static inline Int128 atomic16_read(Int128 *ptr)
 {
     /* Maybe replace 0 with 0, returning the old value.  */
-    return atomic16_cmpxchg(ptr, 0, 0);
+    return atomic16_cmpxchg(ptr, int128_zero(), int128_zero());
 }
 
 static inline void atomic16_set(Int128 *ptr, Int128 val)
@@ -141,7 +160,7 @@ static inline void atomic16_set(Int128 *ptr, Int128 val)
     do {
         cmp = old;
         old = atomic16_cmpxchg(ptr, cmp, val);
-    } while (old != cmp);
+    } while (int128_ne(old, cmp));
 }
 
 # define HAVE_ATOMIC128 1
@@ -66,6 +66,19 @@ static inline void clear_bit(long nr, unsigned long *addr)
     *p &= ~mask;
 }
 
+/**
+ * clear_bit_atomic - Clears a bit in memory atomically
+ * @nr: Bit to clear
+ * @addr: Address to start counting from
+ */
+static inline void clear_bit_atomic(long nr, unsigned long *addr)
+{
+    unsigned long mask = BIT_MASK(nr);
+    unsigned long *p = addr + BIT_WORD(nr);
+
+    atomic_and(p, ~mask);
+}
+
 /**
  * change_bit - Toggle a bit in memory
  * @nr: Bit to change
@@ -165,6 +178,25 @@ unsigned long find_next_zero_bit(const unsigned long *addr,
                                  unsigned long size,
                                  unsigned long offset);
 
+/**
+ * bitops_count_ones - count the set bits in a memory region
+ * @addr: The address to start counting at
+ * @nwords: The number of unsigned longs to count
+ *
+ * Use bitmap_count_one() instead, unless the size is a whole number
+ * of words.
+ */
+unsigned long bitops_count_ones(const unsigned long *addr,
+                                unsigned long nwords);
+
+/*
+ * find_next_bit, find_next_zero_bit and bitops_count_ones use vector
+ * instructions when the host supports them.  For testing, this switches
+ * to the next less preferred implementation; it returns false when the
+ * scalar code is already in use.
+ */
+bool test_bitops_next_accel(void);
+
 /**
  * find_first_bit - find the first set bit in a memory region
  * @addr: The address to start the search at
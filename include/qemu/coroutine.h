@@ -70,6 +70,20 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
  */
 void qemu_coroutine_enter(Coroutine *coroutine);
 
+/**
+ * Grow the coroutine pool by @additional_pool_size coroutines
+ *
+ * Devices that can keep many requests in flight should call this with
+ * their maximum queue depth, so that requests do not fall off the pool
+ * and allocate a fresh stack each.
+ */
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_pool_size);
+
+/**
+ * Undo a previous qemu_coroutine_increase_pool_batch_size() call
+ */
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removing_pool_size);
+
 /**
  * Transfer control to a coroutine if it's not active (i.e. part of the call
  * stack of the running coroutine). Otherwise, do nothing.
@@ -125,6 +125,19 @@ uint64_t hbitmap_count(const HBitmap *hb);
  */
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count);
 
+/**
+ * hbitmap_set_atomic:
+ * @hb: HBitmap to operate on.
+ * @start: First bit to set (0-based).
+ * @count: Number of bits to set.
+ *
+ * Like hbitmap_set(), but may run concurrently with other calls to
+ * hbitmap_set_atomic() and with readers of @hb.  Anything else that modifies
+ * @hb must be excluded by the caller.  The bit count is updated with 64-bit
+ * atomics, so this must only be used if CONFIG_ATOMIC64 is defined.
+ */
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count);
+
 /**
  * hbitmap_reset:
  * @hb: HBitmap to operate on.
@@ -570,6 +570,42 @@ void qemu_set_tty_echo(int fd, bool echo);
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
                      Error **errp);
 
+typedef struct MemPrealloc MemPrealloc;
+
+/**
+ * os_mem_prealloc_start:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @max_threads: maximum number of threads touching the memory
+ * @affinity: bitmap of host CPUs the threads may run on, or NULL
+ * @affinity_bits: number of bits in @affinity
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Like os_mem_prealloc(), but return as soon as the threads have been
+ * started.  The contents of @area are preserved even if other threads
+ * write to it in the meantime.  Must be called from the main thread.
+ *
+ * Returns: a handle to pass to os_mem_prealloc_finish(), or %NULL
+ * on failure.
+ */
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t sz,
+                                   int max_threads,
+                                   const unsigned long *affinity,
+                                   long affinity_bits, Error **errp);
+
+/**
+ * os_mem_prealloc_finish:
+ * @mp: handle returned by os_mem_prealloc_start()
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Wait for the preallocation started by os_mem_prealloc_start() and
+ * free @mp.  Must be called from the main thread.
+ *
+ * Returns: %true if all of the memory could be allocated.
+ */
+bool os_mem_prealloc_finish(MemPrealloc *mp, Error **errp);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
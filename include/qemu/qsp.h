@@ -14,10 +14,37 @@
 enum QSPSortBy {
     QSP_SORT_BY_TOTAL_WAIT_TIME,
     QSP_SORT_BY_AVG_WAIT_TIME,
+    QSP_SORT_BY_TOTAL_HOLD_TIME,
+    QSP_SORT_BY_AVG_HOLD_TIME,
 };
 
+/*
+ * Hold times are bucketed by powers of two in microseconds: bucket 0 counts
+ * holds shorter than 1us, bucket i counts holds in [2^(i-1), 2^i) us, and the
+ * last bucket also counts everything longer than that.
+ */
+#define QSP_HOLD_HIST_BUCKETS 16
+
+struct QSPReportEntry {
+    const void *obj;
+    char *callsite_at;
+    const char *typename;
+    unsigned int n_objs;
+    uint64_t n_acqs;
+    uint64_t wait_ns;
+    uint64_t n_holds;
+    uint64_t hold_ns;
+    uint64_t hold_hist[QSP_HOLD_HIST_BUCKETS];
+};
+typedef struct QSPReportEntry QSPReportEntry;
+
+typedef void (*QSPReportFunc)(const QSPReportEntry *entry, void *opaque);
+
 void qsp_report(size_t max, enum QSPSortBy sort_by,
                 bool callsite_coalesce);
+void qsp_report_iter(size_t max, enum QSPSortBy sort_by,
+                     bool callsite_coalesce, QSPReportFunc func,
+                     void *opaque);
 
 bool qsp_is_enabled(void);
 void qsp_enable(void);
@@ -66,6 +66,14 @@ struct rcu_reader_data {
 
     /* Data used for registry, protected by rcu_registry_lock */
     QLIST_ENTRY(rcu_reader_data) node;
+
+    /*
+     * call_rcu callbacks staged by this thread, newest first.  Pushed
+     * to only by the thread itself, stolen by the call_rcu thread.
+     */
+    struct rcu_head *call_pending;
+    unsigned call_pending_count;
+    bool registered;
 };
 
 extern __thread struct rcu_reader_data rcu_reader;
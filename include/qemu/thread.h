@@ -30,6 +30,7 @@ void qemu_mutex_unlock_impl(QemuMutex *mutex, const char *file, const int line);
 
 typedef void (*QemuMutexLockFunc)(QemuMutex *m, const char *f, int l);
 typedef int (*QemuMutexTrylockFunc)(QemuMutex *m, const char *f, int l);
+typedef void (*QemuMutexUnlockFunc)(QemuMutex *m, const char *f, int l);
 typedef void (*QemuRecMutexLockFunc)(QemuRecMutex *m, const char *f, int l);
 typedef int (*QemuRecMutexTrylockFunc)(QemuRecMutex *m, const char *f, int l);
 typedef void (*QemuCondWaitFunc)(QemuCond *c, QemuMutex *m, const char *f,
@@ -40,6 +41,7 @@ typedef bool (*QemuCondTimedWaitFunc)(QemuCond *c, QemuMutex *m, int ms,
 extern QemuMutexLockFunc qemu_bql_mutex_lock_func;
 extern QemuMutexLockFunc qemu_mutex_lock_func;
 extern QemuMutexTrylockFunc qemu_mutex_trylock_func;
+extern QemuMutexUnlockFunc qemu_mutex_unlock_func;
 extern QemuRecMutexLockFunc qemu_rec_mutex_lock_func;
 extern QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func;
 extern QemuCondWaitFunc qemu_cond_wait_func;
@@ -50,6 +52,8 @@ extern QemuCondTimedWaitFunc qemu_cond_timedwait_func;
         qemu_mutex_lock_impl(m, __FILE__, __LINE__)
 #define qemu_mutex_trylock__raw(m)                      \
         qemu_mutex_trylock_impl(m, __FILE__, __LINE__)
+#define qemu_mutex_unlock__raw(m)                       \
+        qemu_mutex_unlock_impl(m, __FILE__, __LINE__)
 
 #ifdef __COVERITY__
 /*
@@ -60,6 +64,8 @@ extern QemuCondTimedWaitFunc qemu_cond_timedwait_func;
             qemu_mutex_lock_impl(m, __FILE__, __LINE__);
 #define qemu_mutex_trylock(m)                                           \
             qemu_mutex_trylock_impl(m, __FILE__, __LINE__);
+#define qemu_mutex_unlock(m)                                            \
+            qemu_mutex_unlock_impl(m, __FILE__, __LINE__);
 #define qemu_rec_mutex_lock(m)                                          \
             qemu_rec_mutex_lock_impl(m, __FILE__, __LINE__);
 #define qemu_rec_mutex_trylock(m)                                       \
@@ -79,6 +85,11 @@ extern QemuCondTimedWaitFunc qemu_cond_timedwait_func;
             _f(m, __FILE__, __LINE__);                                  \
         })
 
+#define qemu_mutex_unlock(m) ({                                         \
+            QemuMutexUnlockFunc _f = atomic_read(&qemu_mutex_unlock_func); \
+            _f(m, __FILE__, __LINE__);                                  \
+        })
+
 #define qemu_rec_mutex_lock(m) ({                                       \
             QemuRecMutexLockFunc _f = atomic_read(&qemu_rec_mutex_lock_func); \
             _f(m, __FILE__, __LINE__);                                  \
@@ -101,9 +112,6 @@ extern QemuCondTimedWaitFunc qemu_cond_timedwait_func;
         })
 #endif
 
-#define qemu_mutex_unlock(mutex) \
-        qemu_mutex_unlock_impl(mutex, __FILE__, __LINE__)
-
 static inline void (qemu_mutex_lock)(QemuMutex *mutex)
 {
     qemu_mutex_lock(mutex);
@@ -89,6 +89,10 @@ struct QEMUTimer {
     QEMUTimer *next;
     int attributes;
     int scale;
+    /* position in the timer list's heap, valid while the timer is pending */
+    unsigned int heap_index;
+    /* insertion order, breaks ties between timers with equal expire_time */
+    uint64_t seq;
 };
 
 extern QEMUTimerListGroup main_loop_tlg;
@@ -399,6 +399,15 @@ struct ObjectClass
     ObjectUnparent *unparent;
 
     GHashTable *properties;
+
+    /*
+     * Flattened view of the properties of this class and its ancestors,
+     * valid while properties_cache_version matches the sum of the
+     * properties_version of all classes in the hierarchy.
+     */
+    GHashTable *properties_cache;
+    unsigned properties_version;
+    unsigned properties_cache_version;
 };
 
 /**
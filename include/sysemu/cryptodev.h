@@ -146,6 +146,12 @@ typedef struct CryptoDevBackendSymOpInfo {
     uint8_t data[0];
 } CryptoDevBackendSymOpInfo;
 
+/*
+ * Completion callback of an asynchronous crypto operation, @ret is
+ * VIRTIO_CRYPTO_OK or -VIRTIO_CRYPTO_* as for the synchronous one.
+ */
+typedef void CryptoDevCompletionFunc(void *opaque, int ret);
+
 typedef struct CryptoDevBackendClass {
     ObjectClass parent_class;
 
@@ -161,6 +167,14 @@ typedef struct CryptoDevBackendClass {
     int (*do_sym_op)(CryptoDevBackend *backend,
                      CryptoDevBackendSymOpInfo *op_info,
                      uint32_t queue_index, Error **errp);
+    /*
+     * Optional: start the operation and return, @cb is called from the
+     * main loop once it has finished.  Errors are reported by the backend.
+     */
+    void (*do_sym_op_async)(CryptoDevBackend *backend,
+                            CryptoDevBackendSymOpInfo *op_info,
+                            uint32_t queue_index,
+                            CryptoDevCompletionFunc *cb, void *opaque);
 } CryptoDevBackendClass;
 
 typedef enum CryptoDevBackendOptionsType {
@@ -305,6 +319,26 @@ int cryptodev_backend_crypto_operation(
                  void *opaque,
                  uint32_t queue_index, Error **errp);
 
+/**
+ * cryptodev_backend_crypto_operation_async:
+ * @backend: the cryptodev backend object
+ * @opaque: pointer to a VirtIOCryptoReq object
+ * @queue_index: queue index of cryptodev backend client
+ * @cb: completion callback
+ * @cb_opaque: argument of @cb
+ *
+ * Like cryptodev_backend_crypto_operation(), but backends that support
+ * it run the operation outside of the calling thread.  @cb gets the
+ * result, either before this function returns or later from the main
+ * loop, so several operations can be in flight at the same time.
+ * Errors are reported by the backend.
+ */
+void cryptodev_backend_crypto_operation_async(
+                 CryptoDevBackend *backend,
+                 void *opaque,
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *cb_opaque);
+
 /**
  * cryptodev_backend_set_used:
  * @backend: the cryptodev backend object
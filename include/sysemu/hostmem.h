@@ -45,6 +45,8 @@ struct HostMemoryBackendClass {
  * @parent: opaque parent object container
  * @size: amount of memory backend provides
  * @mr: MemoryRegion representing host memory belonging to backend
+ * @prealloc_threads: number of threads preallocating memory, 0 for default
+ * @prealloc_pending: preallocation running in the background, if any
  */
 struct HostMemoryBackend {
     /* private */
@@ -56,6 +58,8 @@ struct HostMemoryBackend {
     bool prealloc, force_prealloc, is_mapped, share;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
+    uint32_t prealloc_threads;
+    MemPrealloc *prealloc_pending;
 
     MemoryRegion mr;
 };
@@ -68,4 +72,14 @@ bool host_memory_backend_is_mapped(HostMemoryBackend *backend);
 size_t host_memory_backend_pagesize(HostMemoryBackend *memdev);
 char *host_memory_backend_get_name(HostMemoryBackend *backend);
 
+/**
+ * host_memory_backend_prealloc_wait:
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Memory backends created during machine initialization preallocate
+ * their memory in the background.  Wait until all of them are done;
+ * this must happen before the guest may run.
+ */
+void host_memory_backend_prealloc_wait(Error **errp);
+
 #endif
@@ -37,6 +37,13 @@ typedef struct {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Worker thread pool size limits */
+    int64_t thread_pool_min;
+    int64_t thread_pool_max;
+
+    /* Let a kernel thread poll the io_uring submission queue */
+    bool io_uring_sqpoll;
 } IOThread;
 
 #define IOTHREAD(obj) \
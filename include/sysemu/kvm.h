@@ -214,7 +214,10 @@ int kvm_has_pit_state2(void);
 int kvm_has_many_ioeventfds(void);
 int kvm_has_gsi_routing(void);
 int kvm_has_intx_set_mask(void);
+bool kvm_dirty_ring_enabled(void);
+void kvm_dirty_limit_set(uint64_t bytes_per_sec);
 
+int kvm_create_vcpu(CPUState *cpu);
 int kvm_init_vcpu(CPUState *cpu);
 int kvm_cpu_exec(CPUState *cpu);
 int kvm_destroy_vcpu(CPUState *cpu);
@@ -23,14 +23,27 @@ typedef struct KVMSlot
     int old_flags;
     /* Dirty bitmap cache for the slot */
     unsigned long *dirty_bmap;
+    /* Offset of the slot in the ram_addr_t space */
+    ram_addr_t ram_start_offset;
 } KVMSlot;
 
+/* A slot change queued until the end of a memory transaction */
+typedef struct KVMSlotUpdate {
+    MemoryRegionSection section;
+    bool add;
+    /* The slot that the section maps to */
+    KVMSlot slot;
+    /* For removals, the registered slot to remove */
+    KVMSlot *mem;
+    QSIMPLEQ_ENTRY(KVMSlotUpdate) next;
+} KVMSlotUpdate;
+
 typedef struct KVMMemoryListener {
     MemoryListener listener;
-    /* Protects the slots and all inside them */
-    QemuMutex slots_lock;
     KVMSlot *slots;
     int as_id;
+    bool in_transaction;
+    QSIMPLEQ_HEAD(, KVMSlotUpdate) updates;
 } KVMMemoryListener;
 
 #define TYPE_KVM_ACCEL ACCEL_CLASS_NAME("kvm")
@@ -10,6 +10,7 @@
 
 extern bool tcg_allowed;
 void tcg_exec_init(unsigned long tb_size);
+void tcg_perfmap_enable(void);
 #ifdef CONFIG_TCG
 #define tcg_enabled() (tcg_allowed)
 #else
@@ -98,6 +98,14 @@ struct SimpleSpiceDisplay {
     QXLRect dirty;
     int notify;
 
+    /*
+     * Updates released by spice server are pushed to free_updates without
+     * taking the lock, and moved to update_pool by the iothread for reuse.
+     */
+    QSLIST_HEAD(, SimpleSpiceUpdate) free_updates;
+    QSLIST_HEAD(, SimpleSpiceUpdate) update_pool;
+    int update_pool_size;
+
     /*
      * All struct members below this comment can be accessed from
      * both spice server and qemu (iothread) context and any access
@@ -142,7 +150,9 @@ struct SimpleSpiceUpdate {
     QXLImage image;
     QXLCommandExt ext;
     uint8_t *bitmap;
+    size_t bitmap_size;
     QTAILQ_ENTRY(SimpleSpiceUpdate) next;
+    QSLIST_ENTRY(SimpleSpiceUpdate) free_next;
 };
 
 struct SimpleSpiceCursor {
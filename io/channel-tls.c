@@ -22,6 +22,7 @@
 #include "qapi/error.h"
 #include "qemu/module.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 
 
@@ -151,6 +152,26 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer user_data);
 
+static void qio_channel_tls_offload(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc;
+    Error *err = NULL;
+
+    if (!ioc->offload_wanted ||
+        !object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET)) {
+        return;
+    }
+    sioc = QIO_CHANNEL_SOCKET(ioc->master);
+
+    if (qcrypto_tls_session_offload_send(ioc->session, sioc->fd, &err) < 0) {
+        trace_qio_channel_tls_offload_fail(ioc, error_get_pretty(err));
+        error_free(err);
+        return;
+    }
+    ioc->offload_send = true;
+    trace_qio_channel_tls_offload(ioc);
+}
+
 static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
                                            QIOTask *task,
                                            GMainContext *context)
@@ -174,6 +195,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_offload(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -224,6 +246,12 @@ static gboolean qio_channel_tls_handshake_io(QIOChannel *ioc,
     return FALSE;
 }
 
+void qio_channel_tls_set_kernel_offload(QIOChannelTLS *ioc,
+                                        bool enabled)
+{
+    ioc->offload_wanted = enabled;
+}
+
 void qio_channel_tls_handshake(QIOChannelTLS *ioc,
                                QIOTaskFunc func,
                                gpointer opaque,
@@ -299,12 +327,18 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
                                       size_t niov,
                                       int *fds,
                                       size_t nfds,
+                                      int flags,
                                       Error **errp)
 {
     QIOChannelTLS *tioc = QIO_CHANNEL_TLS(ioc);
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->offload_send) {
+        return qio_channel_writev_full(tioc->master, iov, niov,
+                                       NULL, 0, flags, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
@@ -17,6 +17,7 @@
 #include "qemu/module.h"
 #include "block/aio.h"
 #include "block/block.h"
+#include "block/thread-pool.h"
 #include "sysemu/iothread.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-misc.h"
@@ -115,6 +116,7 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
     iothread->thread_id = -1;
     qemu_sem_init(&iothread->init_done_sem, 0);
     /* By default, we don't run gcontext */
@@ -193,6 +195,19 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
         return;
     }
 
+    aio_context_set_thread_pool_params(iothread->ctx,
+                                       iothread->thread_pool_min,
+                                       iothread->thread_pool_max,
+                                       &local_error);
+    if (local_error) {
+        error_propagate(errp, local_error);
+        aio_context_unref(iothread->ctx);
+        iothread->ctx = NULL;
+        return;
+    }
+
+    aio_context_set_io_uring_sqpoll(iothread->ctx, iothread->io_uring_sqpoll);
+
     /* This assumes we are called from a thread with useful CPU affinity for us
      * to inherit.
      */
@@ -212,23 +227,29 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
 typedef struct {
     const char *name;
     ptrdiff_t offset; /* field's byte offset in IOThread struct */
-} PollParamInfo;
+} IOThreadParamInfo;
 
-static PollParamInfo poll_max_ns_info = {
+static IOThreadParamInfo poll_max_ns_info = {
     "poll-max-ns", offsetof(IOThread, poll_max_ns),
 };
-static PollParamInfo poll_grow_info = {
+static IOThreadParamInfo poll_grow_info = {
     "poll-grow", offsetof(IOThread, poll_grow),
 };
-static PollParamInfo poll_shrink_info = {
+static IOThreadParamInfo poll_shrink_info = {
     "poll-shrink", offsetof(IOThread, poll_shrink),
 };
+static IOThreadParamInfo thread_pool_min_info = {
+    "thread-pool-min", offsetof(IOThread, thread_pool_min),
+};
+static IOThreadParamInfo thread_pool_max_info = {
+    "thread-pool-max", offsetof(IOThread, thread_pool_max),
+};
 
-static void iothread_get_poll_param(Object *obj, Visitor *v,
+static void iothread_get_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
 {
     IOThread *iothread = IOTHREAD(obj);
-    PollParamInfo *info = opaque;
+    IOThreadParamInfo *info = opaque;
     int64_t *field = (void *)iothread + info->offset;
 
     visit_type_int64(v, name, field, errp);
@@ -238,7 +259,7 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
 {
     IOThread *iothread = IOTHREAD(obj);
-    PollParamInfo *info = opaque;
+    IOThreadParamInfo *info = opaque;
     int64_t *field = (void *)iothread + info->offset;
     Error *local_err = NULL;
     int64_t value;
@@ -268,23 +289,84 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void iothread_set_thread_pool_param(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    IOThreadParamInfo *info = opaque;
+    int64_t *field = (void *)iothread + info->offset;
+    Error *local_err = NULL;
+    int64_t value, old_value;
+
+    visit_type_int64(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    old_value = *field;
+    *field = value;
+
+    if (iothread->ctx) {
+        aio_context_set_thread_pool_params(iothread->ctx,
+                                           iothread->thread_pool_min,
+                                           iothread->thread_pool_max,
+                                           &local_err);
+        if (local_err) {
+            *field = old_value;
+        }
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+static bool iothread_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return iothread->io_uring_sqpoll;
+}
+
+static void iothread_set_io_uring_sqpoll(Object *obj, bool value, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (iothread->ctx) {
+        error_setg(errp, "io-uring-sqpoll cannot be changed after creation");
+        return;
+    }
+    iothread->io_uring_sqpoll = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
     ucc->complete = iothread_complete;
 
     object_class_property_add(klass, "poll-max-ns", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_max_ns_info, &error_abort);
     object_class_property_add(klass, "poll-grow", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_grow_info, &error_abort);
     object_class_property_add(klass, "poll-shrink", "int",
-                              iothread_get_poll_param,
+                              iothread_get_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-min", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_min_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-max", "int",
+                              iothread_get_param,
+                              iothread_set_thread_pool_param,
+                              NULL, &thread_pool_max_info, &error_abort);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   iothread_get_io_uring_sqpoll,
+                                   iothread_set_io_uring_sqpoll,
+                                   &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -323,6 +405,7 @@ static int query_one_iothread(Object *object, void *opaque)
     IOThreadInfoList *elem;
     IOThreadInfo *info;
     IOThread *iothread;
+    ThreadPool *pool;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
     if (!iothread) {
@@ -335,6 +418,36 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->thread_pool_min = iothread->thread_pool_min;
+    info->thread_pool_max = iothread->thread_pool_max;
+
+    pool = iothread->ctx ? atomic_read(&iothread->ctx->thread_pool) : NULL;
+    if (pool) {
+        ThreadPoolStats stats;
+
+        thread_pool_get_stats(pool, &stats);
+        info->has_thread_pool = true;
+        info->thread_pool = g_new0(ThreadPoolInfo, 1);
+        info->thread_pool->threads = stats.threads;
+        info->thread_pool->idle_threads = stats.idle_threads;
+        info->thread_pool->queue_depth = stats.queue_depth;
+        info->thread_pool->completed = stats.completed;
+        info->thread_pool->total_time_ns = stats.total_ns;
+    }
+
+    if (iothread->ctx) {
+        AioPollStats stats;
+
+        aio_context_get_poll_stats(iothread->ctx, &stats);
+        info->has_poll_stats = true;
+        info->poll_stats = g_new0(IOThreadPollInfo, 1);
+        info->poll_stats->poll_ns = stats.cur_poll_ns;
+        info->poll_stats->hits = stats.poll_hits;
+        info->poll_stats->misses = stats.poll_misses;
+        info->poll_stats->poll_time_ns = stats.poll_ns;
+        info->poll_stats->block_time_ns = stats.block_ns;
+        info->poll_stats->dispatches = stats.dispatches;
+    }
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
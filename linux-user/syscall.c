@@ -11997,3 +11997,28 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
     trace_guest_user_syscall_ret(cpu, num, ret);
     return ret;
 }
+
+/*
+ * Syscalls that only read the time are called millions of times per
+ * second by some language runtimes. They have no effect on the emulation
+ * and cannot block, so a target's syscall helper may issue them directly
+ * from translated code instead of going through cpu_loop.
+ * Returns false if @num needs the regular path.
+ */
+bool do_syscall_fast(void *cpu_env, int num, abi_long arg1, abi_long arg2,
+                     abi_long *ret)
+{
+    switch (num) {
+    case TARGET_NR_gettimeofday:
+#ifdef TARGET_NR_time
+    case TARGET_NR_time:
+#endif
+#ifdef TARGET_NR_clock_gettime
+    case TARGET_NR_clock_gettime:
+#endif
+        *ret = do_syscall(cpu_env, num, arg1, arg2, 0, 0, 0, 0, 0, 0);
+        return true;
+    default:
+        return false;
+    }
+}
@@ -23,6 +23,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace-root.h"
 
@@ -39,6 +40,8 @@
 
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
+static bool memory_region_update_all;
+static unsigned memory_region_update_gen = 1;
 static bool ioeventfd_update_pending;
 bool global_dirty_log;
 
@@ -161,6 +164,7 @@ enum ListenerDirection { Forward, Reverse };
 
 struct CoalescedMemoryRange {
     AddrRange addr;
+    bool posted;
     QTAILQ_ENTRY(CoalescedMemoryRange) link;
 };
 
@@ -1111,26 +1115,62 @@ static void flatviews_init(void)
     }
 }
 
-static void flatviews_reset(void)
+/*
+ * Mark @mr and everything that renders it, i.e. its containers and the
+ * aliases pointing to it, as changed in this generation.
+ */
+static void memory_region_mark_changed(MemoryRegion *mr)
 {
-    AddressSpace *as;
+    MemoryRegion *alias;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
+    for (; mr && mr->update_gen != memory_region_update_gen;
+         mr = mr->container) {
+        mr->update_gen = memory_region_update_gen;
+        QLIST_FOREACH(alias, &mr->aliased_by, aliased_by_link) {
+            memory_region_mark_changed(alias);
+        }
+    }
+}
+
+static void memory_region_schedule_update(MemoryRegion *mr, bool visible)
+{
+    if (visible) {
+        memory_region_mark_changed(mr);
+        memory_region_update_pending = true;
     }
+}
+
+static void flatviews_update(void)
+{
+    GHashTable *old_views = flat_views;
+    AddressSpace *as;
+
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, reusing those of address spaces left untouched */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view = address_space_to_flatview(as);
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        if (view && view->root == physmr && !memory_region_update_all &&
+            as->root->update_gen != memory_region_update_gen) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+        } else {
+            generate_memory_topology(physmr);
+        }
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+    memory_region_update_all = false;
+    memory_region_update_gen++;
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1205,13 +1245,18 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
-            flatviews_reset();
+            flatviews_update();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (ioeventfd_update_pending ||
+                    address_space_to_flatview(as) != old_view) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -1369,6 +1414,7 @@ static void memory_region_initfn(Object *obj)
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
+    QLIST_INIT(&mr->aliased_by);
 
     op = object_property_add(OBJECT(mr), "container",
                              "link<" TYPE_MEMORY_REGION ">",
@@ -1576,7 +1622,13 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
         return MEMTX_DECODE_ERROR;
     }
 
+    if (mr->lock) {
+        qemu_mutex_lock(mr->lock);
+    }
     r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
+    if (mr->lock) {
+        qemu_mutex_unlock(mr->lock);
+    }
     adjust_endianness(mr, pval, op);
     return r;
 }
@@ -1614,6 +1666,7 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
                                          MemTxAttrs attrs)
 {
     unsigned size = memop_size(op);
+    MemTxResult r;
 
     if (!memory_region_access_valid(mr, addr, size, true, attrs)) {
         unassigned_mem_write(mr, addr, data, size);
@@ -1627,20 +1680,26 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
         return MEMTX_OK;
     }
 
+    if (mr->lock) {
+        qemu_mutex_lock(mr->lock);
+    }
     if (mr->ops->write) {
-        return access_with_adjusted_size_aligned(addr, &data, size,
+        r = access_with_adjusted_size_aligned(addr, &data, size,
                                          mr->ops->impl.min_access_size,
                                          mr->ops->impl.max_access_size,
                                          memory_region_write_accessor, mr,
                                          attrs);
     } else {
-        return
-            access_with_adjusted_size_aligned(addr, &data, size,
+        r = access_with_adjusted_size_aligned(addr, &data, size,
                                       mr->ops->impl.min_access_size,
                                       mr->ops->impl.max_access_size,
                                       memory_region_write_with_attrs_accessor,
                                       mr, attrs);
     }
+    if (mr->lock) {
+        qemu_mutex_unlock(mr->lock);
+    }
+    return r;
 }
 
 void memory_region_init_io(MemoryRegion *mr,
@@ -1807,6 +1866,7 @@ void memory_region_init_alias(MemoryRegion *mr,
     memory_region_init(mr, owner, name, size);
     mr->alias = orig;
     mr->alias_offset = offset;
+    QLIST_INSERT_HEAD(&orig->aliased_by, mr, aliased_by_link);
 }
 
 void memory_region_init_rom_nomigrate(MemoryRegion *mr,
@@ -1893,6 +1953,13 @@ static void memory_region_finalize(Object *obj)
     }
     memory_region_transaction_commit();
 
+    QLIST_SAFE_REMOVE(mr, aliased_by_link);
+    while (!QLIST_EMPTY(&mr->aliased_by)) {
+        MemoryRegion *alias = QLIST_FIRST(&mr->aliased_by);
+
+        QLIST_SAFE_REMOVE(alias, aliased_by_link);
+    }
+
     mr->destructor(mr);
     memory_region_clear_coalescing(mr);
     g_free((char *)mr->name);
@@ -2150,7 +2217,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    memory_region_schedule_update(mr, mr->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2176,6 +2243,11 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->log_sync_global) {
+            /* Cannot sync a single region, so sync everything */
+            listener->log_sync_global(listener);
+            continue;
+        }
         if (!listener->log_sync) {
             continue;
         }
@@ -2268,7 +2340,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        memory_region_schedule_update(mr, mr->enabled);
         memory_region_transaction_commit();
     }
 }
@@ -2278,7 +2350,7 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        memory_region_schedule_update(mr, mr->enabled);
         memory_region_transaction_commit();
     }
 }
@@ -2288,7 +2360,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        memory_region_schedule_update(mr, mr->enabled);
         memory_region_transaction_commit();
     }
 }
@@ -2385,16 +2457,64 @@ void memory_region_set_coalescing(MemoryRegion *mr)
     memory_region_add_coalescing(mr, 0, int128_get64(mr->size));
 }
 
-void memory_region_add_coalescing(MemoryRegion *mr,
-                                  hwaddr offset,
-                                  uint64_t size)
+static CoalescedMemoryRange *memory_region_add_coalesced_range(
+    MemoryRegion *mr, hwaddr offset, uint64_t size, bool posted)
 {
     CoalescedMemoryRange *cmr = g_malloc(sizeof(*cmr));
 
     cmr->addr = addrrange_make(int128_make64(offset), int128_make64(size));
+    cmr->posted = posted;
     QTAILQ_INSERT_TAIL(&mr->coalesced, cmr, link);
     memory_region_update_coalesced_range(mr, cmr, true);
     memory_region_set_flush_coalesced(mr);
+    return cmr;
+}
+
+void memory_region_add_coalescing(MemoryRegion *mr,
+                                  hwaddr offset,
+                                  uint64_t size)
+{
+    memory_region_add_coalesced_range(mr, offset, size, false);
+}
+
+/*
+ * Number of posted ranges, and the timer that flushes their writes when
+ * no vCPU exits to do it.
+ */
+#define POSTED_WRITES_FLUSH_NS SCALE_MS
+static unsigned posted_write_ranges;
+static QEMUTimer *posted_writes_timer;
+
+static void posted_writes_flush(void *opaque)
+{
+    qemu_flush_coalesced_mmio_buffer();
+    if (posted_write_ranges) {
+        timer_mod(posted_writes_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                  POSTED_WRITES_FLUSH_NS);
+    }
+}
+
+void memory_region_add_posted_writes(MemoryRegion *mr,
+                                     hwaddr offset,
+                                     uint64_t size)
+{
+    memory_region_add_coalesced_range(mr, offset, size, true);
+
+    if (!posted_writes_timer) {
+        posted_writes_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                           posted_writes_flush, NULL);
+    }
+    if (!posted_write_ranges++) {
+        timer_mod(posted_writes_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                  POSTED_WRITES_FLUSH_NS);
+    }
+}
+
+bool memory_region_have_posted_writes(void)
+{
+    return atomic_read(&posted_write_ranges) != 0;
 }
 
 void memory_region_clear_coalescing(MemoryRegion *mr)
@@ -2412,6 +2532,9 @@ void memory_region_clear_coalescing(MemoryRegion *mr)
         cmr = QTAILQ_FIRST(&mr->coalesced);
         QTAILQ_REMOVE(&mr->coalesced, cmr, link);
         memory_region_update_coalesced_range(mr, cmr, false);
+        if (cmr->posted && !--posted_write_ranges) {
+            timer_del(posted_writes_timer);
+        }
         g_free(cmr);
     }
 }
@@ -2434,6 +2557,26 @@ void memory_region_clear_global_locking(MemoryRegion *mr)
     mr->global_locking = false;
 }
 
+void memory_region_set_lock(MemoryRegion *mr, QemuMutex *lock)
+{
+    mr->lock = lock;
+    mr->global_locking = !lock;
+}
+
+bool memory_region_lock_iothread(MemoryRegion *mr)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+
+    /* The BQL comes first in the lock order */
+    assert(mr->lock);
+    qemu_mutex_unlock(mr->lock);
+    qemu_mutex_lock_iothread();
+    qemu_mutex_lock(mr->lock);
+    return true;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -2529,7 +2672,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_schedule_update(mr, mr->enabled && subregion->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2568,7 +2711,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_schedule_update(mr, mr->enabled && subregion->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2579,7 +2722,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_schedule_update(mr, true);
     memory_region_transaction_commit();
 }
 
@@ -2595,7 +2738,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_schedule_update(mr, true);
     memory_region_transaction_commit();
 }
 
@@ -2632,7 +2775,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    memory_region_schedule_update(mr, mr->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2762,6 +2905,7 @@ void memory_global_dirty_log_start(void)
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_all = true;
     memory_region_transaction_commit();
 }
 
@@ -2772,6 +2916,7 @@ static void memory_global_dirty_log_do_stop(void)
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_all = true;
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -2920,6 +3065,7 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->current_map = NULL;
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
+    as->bounce_buffers = 0;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
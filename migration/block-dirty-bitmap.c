@@ -302,6 +302,11 @@ static int init_dirty_bitmap_migration(void)
                 goto fail;
             }
 
+            if (bdrv_load_dirty_bitmap(bs, bitmap, &local_err) < 0) {
+                error_report_err(local_err);
+                goto fail;
+            }
+
             bdrv_ref(bs);
             bdrv_dirty_bitmap_set_busy(bitmap, true);
 
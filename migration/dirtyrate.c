@@ -0,0 +1,252 @@
+/*
+ * Guest dirty page rate measurement
+ *
+ * A random sample of the pages of every RAMBlock is hashed at the start
+ * and at the end of a time window.  The share of sampled pages whose
+ * contents changed estimates how many pages of the block the guest
+ * dirtied.  Unlike the dirty log this needs no help from the
+ * accelerator and does not slow down the guest, so it can run before
+ * deciding whether and how to migrate.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#include "qapi/error.h"
+#include "qapi/qapi-commands-migration.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "exec/cpu-common.h"
+#include "exec/target_page.h"
+#include "trace.h"
+
+#define DIRTY_RATE_CALC_TIME_MIN        1
+#define DIRTY_RATE_CALC_TIME_MAX        60
+#define DIRTY_RATE_SAMPLE_PAGES_MIN     1
+#define DIRTY_RATE_SAMPLE_PAGES_MAX     16384
+#define DIRTY_RATE_SAMPLE_PAGES_DEFAULT 512
+
+typedef struct {
+    char *idstr;
+    uint64_t size;
+    uint64_t sampled_pages;
+    /* Page numbers of the samples and their hashes at the start */
+    uint64_t *sample_page;
+    uint32_t *sample_hash;
+    uint64_t dirty_sampled_pages;
+    /* False if the block went away or was resized during the window */
+    bool valid;
+} DirtyRateBlock;
+
+typedef struct {
+    /* DirtyRateStatus; the fields below are stable unless 'measuring' */
+    int status;
+    int64_t start_time;
+    int64_t calc_time;
+    int64_t sample_pages;
+    int64_t elapsed_ms;
+    DirtyRateBlock *blocks;
+    int nr_blocks;
+    QemuThread thread;
+} DirtyRateState;
+
+static DirtyRateState dirty_rate_state;
+
+static uint32_t dirty_rate_page_hash(RAMBlock *rb, uint64_t page)
+{
+    size_t page_size = qemu_target_page_size();
+    uint8_t *host = qemu_ram_get_host_addr(rb);
+
+    return crc32(0, host + page * page_size, page_size);
+}
+
+static void dirty_rate_free_blocks(DirtyRateState *ds)
+{
+    int i;
+
+    for (i = 0; i < ds->nr_blocks; i++) {
+        g_free(ds->blocks[i].idstr);
+        g_free(ds->blocks[i].sample_page);
+        g_free(ds->blocks[i].sample_hash);
+    }
+    g_free(ds->blocks);
+    ds->blocks = NULL;
+    ds->nr_blocks = 0;
+}
+
+static int dirty_rate_record_block(RAMBlock *rb, void *opaque)
+{
+    DirtyRateState *ds = opaque;
+    DirtyRateBlock *block;
+    uint64_t pages = qemu_ram_get_used_length(rb) >> qemu_target_page_bits();
+    uint64_t gib = DIV_ROUND_UP(qemu_ram_get_used_length(rb), 1ULL << 30);
+    uint64_t i;
+
+    if (!qemu_ram_is_migratable(rb) || !pages) {
+        return 0;
+    }
+
+    ds->blocks = g_renew(DirtyRateBlock, ds->blocks, ds->nr_blocks + 1);
+    block = &ds->blocks[ds->nr_blocks++];
+    block->idstr = g_strdup(qemu_ram_get_idstr(rb));
+    block->size = qemu_ram_get_used_length(rb);
+    block->sampled_pages = MIN(gib * ds->sample_pages, pages);
+    block->sample_page = g_new(uint64_t, block->sampled_pages);
+    block->sample_hash = g_new(uint32_t, block->sampled_pages);
+    block->dirty_sampled_pages = 0;
+    block->valid = true;
+
+    for (i = 0; i < block->sampled_pages; i++) {
+        uint64_t r = ((uint64_t)g_random_int() << 32) | g_random_int();
+
+        block->sample_page[i] = r % pages;
+        block->sample_hash[i] = dirty_rate_page_hash(rb, block->sample_page[i]);
+    }
+
+    return 0;
+}
+
+/* Called with RCU critical section */
+static void dirty_rate_compare_block(DirtyRateBlock *block)
+{
+    RAMBlock *rb = qemu_ram_block_by_name(block->idstr);
+    uint64_t i;
+
+    if (!rb || qemu_ram_get_used_length(rb) != block->size) {
+        block->valid = false;
+        return;
+    }
+
+    for (i = 0; i < block->sampled_pages; i++) {
+        if (dirty_rate_page_hash(rb, block->sample_page[i]) !=
+            block->sample_hash[i]) {
+            block->dirty_sampled_pages++;
+        }
+    }
+}
+
+static void *dirty_rate_thread(void *opaque)
+{
+    DirtyRateState *ds = opaque;
+    int64_t start, end;
+    int i;
+
+    rcu_register_thread();
+
+    start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_ram_foreach_block(dirty_rate_record_block, ds);
+
+    /* Do not hold the RCU read lock while sleeping */
+    g_usleep(ds->calc_time * G_USEC_PER_SEC);
+
+    rcu_read_lock();
+    for (i = 0; i < ds->nr_blocks; i++) {
+        dirty_rate_compare_block(&ds->blocks[i]);
+    }
+    rcu_read_unlock();
+    end = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    ds->elapsed_ms = MAX(end - start, 1);
+    trace_dirty_rate_measured(ds->nr_blocks, ds->elapsed_ms);
+    atomic_store_release(&ds->status, DIRTY_RATE_STATUS_MEASURED);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void qmp_calc_dirty_rate(int64_t calc_time, bool has_sample_pages,
+                         int64_t sample_pages, Error **errp)
+{
+    DirtyRateState *ds = &dirty_rate_state;
+
+    if (calc_time < DIRTY_RATE_CALC_TIME_MIN ||
+        calc_time > DIRTY_RATE_CALC_TIME_MAX) {
+        error_setg(errp, "calc-time must be between %d and %d seconds",
+                   DIRTY_RATE_CALC_TIME_MIN, DIRTY_RATE_CALC_TIME_MAX);
+        return;
+    }
+    if (!has_sample_pages) {
+        sample_pages = DIRTY_RATE_SAMPLE_PAGES_DEFAULT;
+    } else if (sample_pages < DIRTY_RATE_SAMPLE_PAGES_MIN ||
+               sample_pages > DIRTY_RATE_SAMPLE_PAGES_MAX) {
+        error_setg(errp, "sample-pages must be between %d and %d",
+                   DIRTY_RATE_SAMPLE_PAGES_MIN, DIRTY_RATE_SAMPLE_PAGES_MAX);
+        return;
+    }
+
+    if (atomic_load_acquire(&ds->status) == DIRTY_RATE_STATUS_MEASURING) {
+        error_setg(errp, "A dirty rate measurement is already in progress");
+        return;
+    }
+
+    /* The thread only touches the state while 'measuring' */
+    dirty_rate_free_blocks(ds);
+    ds->start_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) / 1000;
+    ds->calc_time = calc_time;
+    ds->sample_pages = sample_pages;
+    ds->elapsed_ms = 0;
+    atomic_set(&ds->status, DIRTY_RATE_STATUS_MEASURING);
+
+    qemu_thread_create(&ds->thread, "dirtyrate-calc", dirty_rate_thread, ds,
+                       QEMU_THREAD_DETACHED);
+}
+
+DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
+{
+    DirtyRateState *ds = &dirty_rate_state;
+    DirtyRateInfo *info = g_new0(DirtyRateInfo, 1);
+    DirtyRateBlockInfoList *head = NULL, **tail = &head;
+    uint64_t page_size = qemu_target_page_size();
+    uint64_t total_dirty_pages = 0;
+    int i;
+
+    info->status = atomic_load_acquire(&ds->status);
+    info->start_time = ds->start_time;
+    info->calc_time = ds->calc_time;
+    info->page_size = page_size;
+
+    if (info->status != DIRTY_RATE_STATUS_MEASURED) {
+        return info;
+    }
+
+    for (i = 0; i < ds->nr_blocks; i++) {
+        DirtyRateBlock *block = &ds->blocks[i];
+        DirtyRateBlockInfoList *entry;
+        DirtyRateBlockInfo *bi;
+        uint64_t dirty_pages;
+
+        if (!block->valid) {
+            continue;
+        }
+
+        /* Scale the sampled share up to the whole block */
+        dirty_pages = (block->size / page_size) * block->dirty_sampled_pages /
+                      block->sampled_pages;
+        total_dirty_pages += dirty_pages;
+
+        bi = g_new0(DirtyRateBlockInfo, 1);
+        bi->id = g_strdup(block->idstr);
+        bi->size = block->size;
+        bi->sampled_pages = block->sampled_pages;
+        bi->dirty_sampled_pages = block->dirty_sampled_pages;
+        bi->dirty_pages_rate = dirty_pages * 1000 / ds->elapsed_ms;
+
+        entry = g_new0(DirtyRateBlockInfoList, 1);
+        entry->value = bi;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    info->has_dirty_rate = true;
+    info->dirty_rate = total_dirty_pages * page_size * 1000 /
+                       ds->elapsed_ms / MiB;
+    info->has_ramblocks = true;
+    info->ramblocks = head;
+
+    return info;
+}
@@ -0,0 +1,88 @@
+/*
+ * QEMU live migration to and from a file
+ *
+ * Unlike fd: and exec:, the file is opened by QEMU itself, so that
+ * multifd channels can open it again and the mapped-ram format can
+ * write and read pages at fixed offsets.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "channel.h"
+#include "file.h"
+#include "migration.h"
+#include "io/channel-file.h"
+#include "trace.h"
+
+static char *outgoing_filename;
+
+QIOChannel *file_send_channel_create(Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    if (!outgoing_filename) {
+        error_setg(errp, "Migration file name not set!");
+        return NULL;
+    }
+
+    fioc = qio_channel_file_new_path(outgoing_filename, O_WRONLY | O_BINARY,
+                                     0, errp);
+    if (!fioc) {
+        return NULL;
+    }
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-multifd");
+    return QIO_CHANNEL(fioc);
+}
+
+void file_start_outgoing_migration(MigrationState *s, const char *filename,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_outgoing(filename);
+
+    fioc = qio_channel_file_new_path(filename,
+                                     O_CREAT | O_WRONLY | O_TRUNC | O_BINARY,
+                                     0600, errp);
+    if (!fioc) {
+        return;
+    }
+
+    g_free(outgoing_filename);
+    outgoing_filename = g_strdup(filename);
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-outgoing");
+    migration_channel_connect(s, QIO_CHANNEL(fioc), NULL, NULL);
+    object_unref(OBJECT(fioc));
+}
+
+static gboolean file_accept_incoming_migration(QIOChannel *ioc,
+                                               GIOCondition condition,
+                                               gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void file_start_incoming_migration(const char *filename, Error **errp)
+{
+    QIOChannelFile *fioc;
+
+    trace_migration_file_incoming(filename);
+
+    fioc = qio_channel_file_new_path(filename, O_RDONLY | O_BINARY, 0, errp);
+    if (!fioc) {
+        return;
+    }
+
+    qio_channel_set_name(QIO_CHANNEL(fioc), "migration-file-incoming");
+    qio_channel_add_watch_full(QIO_CHANNEL(fioc), G_IO_IN,
+                               file_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
@@ -15,14 +15,18 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/cpus.h"
+#include "sysemu/kvm.h"
 #include "rdma.h"
 #include "ram.h"
 #include "migration/global_state.h"
@@ -86,6 +90,17 @@
 /* The delay time (in ms) between two COLO checkpoints */
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY (200 * 100)
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define DEFAULT_MIGRATE_MULTIFD_COMPRESSION MULTIFD_COMPRESSION_NONE
+/* 0: means nocompress, 1: best speed, ... 9: best compress ratio */
+#define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
+/* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
+#define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+#define DEFAULT_MIGRATE_ZERO_PAGE_DETECTION ZERO_PAGE_DETECTION_MULTIFD
+/* Host pages requested ahead of sequential postcopy faults, 0 disables */
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 0
+#define MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES 1024
+/* MiB/s that each vCPU may dirty with the dirty-limit capability */
+#define DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT 1
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -116,6 +131,8 @@ enum mig_rp_message_type {
     MIG_RP_MSG_REQ_PAGES,    /* data (start: be64, len: be32) */
     MIG_RP_MSG_RECV_BITMAP,  /* send recved_bitmap back to source */
     MIG_RP_MSG_RESUME_ACK,   /* tell source that we are ready to resume */
+    /* Like REQ_PAGES_ID, but sent after the pages that are needed now */
+    MIG_RP_MSG_REQ_PAGES_PREFETCH,
 
     MIG_RP_MSG_MAX
 };
@@ -201,6 +218,8 @@ void migration_incoming_state_destroy(void)
 {
     struct MigrationIncomingState *mis = migration_incoming_get_current();
 
+    postcopy_preempt_incoming_cleanup(mis, true);
+
     if (mis->to_src_file) {
         /* Tell source that we are done */
         migrate_send_rp_shut(mis, qemu_file_get_error(mis->from_src_file) != 0);
@@ -290,19 +309,13 @@ error:
     return ret;
 }
 
-/* Request a range of pages from the source VM at the given
- * start address.
- *   rbname: Name of the RAMBlock to request the page in, if NULL it's the same
- *           as the last request (a name must have been given previously)
- *   Start: Address offset within the RB
- *   Len: Length in bytes required - must be a multiple of pagesize
- */
-int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
-                              ram_addr_t start, size_t len)
+static int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
+                                             enum mig_rp_message_type msg_type,
+                                             const char *rbname,
+                                             ram_addr_t start, size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    enum mig_rp_message_type msg_type;
 
     *(uint64_t *)bufc = cpu_to_be64((uint64_t)start);
     *(uint32_t *)(bufc + 8) = cpu_to_be32((uint32_t)len);
@@ -314,14 +327,44 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
         bufc[msglen++] = rbname_len;
         memcpy(bufc + msglen, rbname, rbname_len);
         msglen += rbname_len;
-        msg_type = MIG_RP_MSG_REQ_PAGES_ID;
-    } else {
-        msg_type = MIG_RP_MSG_REQ_PAGES;
     }
 
     return migrate_send_rp_message(mis, msg_type, msglen, bufc);
 }
 
+/* Request a range of pages from the source VM at the given
+ * start address.
+ *   rbname: Name of the RAMBlock to request the page in, if NULL it's the same
+ *           as the last request (a name must have been given previously)
+ *   Start: Address offset within the RB
+ *   Len: Length in bytes required - must be a multiple of pagesize
+ */
+int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char *rbname,
+                              ram_addr_t start, size_t len)
+{
+    return migrate_send_rp_message_req_pages(mis,
+                                             rbname ? MIG_RP_MSG_REQ_PAGES_ID :
+                                                      MIG_RP_MSG_REQ_PAGES,
+                                             rbname, start, len);
+}
+
+/* Ask the source for pages that the guest is likely to need soon; the
+ * source sends them once the pages requested with
+ * migrate_send_rp_req_pages() are out.
+ *   rbname: Name of the RAMBlock, always needed; the request doesn't
+ *           change the block used by migrate_send_rp_req_pages()
+ *   Start: Address offset within the RB
+ *   Len: Length in bytes required - must be a multiple of pagesize
+ */
+int migrate_send_rp_req_prefetch(MigrationIncomingState *mis,
+                                 const char *rbname,
+                                 ram_addr_t start, size_t len)
+{
+    return migrate_send_rp_message_req_pages(mis,
+                                             MIG_RP_MSG_REQ_PAGES_PREFETCH,
+                                             rbname, start, len);
+}
+
 static bool migration_colo_enabled;
 bool migration_incoming_colo_enabled(void)
 {
@@ -368,6 +411,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -547,6 +592,9 @@ static bool postcopy_try_recover(QEMUFile *f)
     if (mis->state == MIGRATION_STATUS_POSTCOPY_PAUSED) {
         /* Resumed from a paused postcopy migration */
 
+        /* The source sends everything on the main channel from now on */
+        postcopy_preempt_incoming_cleanup(mis, true);
+
         mis->from_src_file = f;
         /* Postcopy has standalone thread to do vm load */
         qemu_file_set_blocking(f, true);
@@ -599,11 +647,19 @@ void migration_ioc_process_incoming(QIOChannel *ioc, Error **errp)
 
         /*
          * Common migration only needs one channel, so we can start
-         * right now.  Multifd needs more than one channel, we wait.
+         * right now.  Multifd needs more than one channel, we wait,
+         * unless the pages are read straight from a mapped-ram file.
          */
-        start_migration = !migrate_use_multifd();
+        start_migration = !migrate_use_multifd() || migrate_mapped_ram();
     } else {
         Error *local_err = NULL;
+
+        if (migrate_postcopy_preempt()) {
+            /* The only other channel is the postcopy preempt channel */
+            postcopy_preempt_new_channel(mis, qemu_fopen_channel_input(ioc));
+            return;
+        }
+
         /* Multiple connections */
         assert(migrate_use_multifd());
         start_migration = multifd_recv_new_channel(ioc, &local_err);
@@ -773,6 +829,18 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->block_incremental = s->parameters.block_incremental;
     params->has_multifd_channels = true;
     params->multifd_channels = s->parameters.multifd_channels;
+    params->has_multifd_compression = true;
+    params->multifd_compression = s->parameters.multifd_compression;
+    params->has_multifd_zlib_level = true;
+    params->multifd_zlib_level = s->parameters.multifd_zlib_level;
+    params->has_multifd_zstd_level = true;
+    params->multifd_zstd_level = s->parameters.multifd_zstd_level;
+    params->has_zero_page_detection = true;
+    params->zero_page_detection = s->parameters.zero_page_detection;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
+    params->has_vcpu_dirty_limit = true;
+    params->vcpu_dirty_limit = s->parameters.vcpu_dirty_limit;
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
     params->has_max_postcopy_bandwidth = true;
@@ -874,6 +942,8 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss = xbzrle_counters.cache_miss;
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit = xbzrle_counters.cache_hit;
+        info->xbzrle_cache->evictions = xbzrle_counters.evictions;
     }
 
     if (migrate_use_compression()) {
@@ -972,10 +1042,11 @@ static bool migrate_caps_check(bool *cap_list,
                                Error **errp)
 {
     MigrationCapabilityStatusList *cap;
-    bool old_postcopy_cap;
+    bool old_postcopy_cap, old_bg_snapshot_cap;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
     old_postcopy_cap = cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM];
+    old_bg_snapshot_cap = cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
 
     for (cap = params; cap; cap = cap->next) {
         cap_list[cap->value->capability] = cap->value->state;
@@ -1030,6 +1101,128 @@ static bool migrate_caps_check(bool *cap_list,
         }
     }
 
+    if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+        if (!cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Postcopy preempt requires postcopy-ram");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Postcopy preempt is not compatible with multifd");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
+            error_setg(errp, "Mapped-ram is not compatible with xbzrle "
+                       "or compression");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            error_setg(errp, "Mapped-ram is not compatible with postcopy");
+            return false;
+        }
+        if (migrate_get_current()->parameters.multifd_compression !=
+            MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "Mapped-ram is not compatible with "
+                       "multifd compression");
+            return false;
+        }
+#ifdef CONFIG_LINUX
+        if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+            error_setg(errp, "Mapped-ram is not compatible with "
+                       "zero copy send");
+            return false;
+        }
+#endif
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_DIRTY_LIMIT]) {
+        if (cap_list[MIGRATION_CAPABILITY_AUTO_CONVERGE]) {
+            error_setg(errp, "Dirty limit is not compatible with "
+                       "auto-converge");
+            return false;
+        }
+        if (!kvm_dirty_ring_enabled()) {
+            error_setg(errp, "Dirty limit requires KVM dirty rings");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_LOCAL_UPDATE]) {
+        /* Both sides run the guest on the same memory after a checkpoint */
+        if (cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            error_setg(errp, "Local update is not compatible with COLO");
+            return false;
+        }
+        if (cap_list[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Local update is not compatible with "
+                       "mapped-ram");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT]) {
+        /*
+         * RAM is saved exactly once while the guest runs, straight from
+         * the write-protected pages; anything that needs the dirty log,
+         * a return path or a second pass over RAM does not fit.
+         */
+        static const MigrationCapability incompatible[] = {
+            MIGRATION_CAPABILITY_POSTCOPY_RAM,
+            MIGRATION_CAPABILITY_POSTCOPY_PREEMPT,
+            MIGRATION_CAPABILITY_DIRTY_BITMAPS,
+            MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME,
+            MIGRATION_CAPABILITY_RETURN_PATH,
+            MIGRATION_CAPABILITY_MULTIFD,
+            MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER,
+            MIGRATION_CAPABILITY_AUTO_CONVERGE,
+            MIGRATION_CAPABILITY_RELEASE_RAM,
+            MIGRATION_CAPABILITY_RDMA_PIN_ALL,
+            MIGRATION_CAPABILITY_COMPRESS,
+            MIGRATION_CAPABILITY_XBZRLE,
+            MIGRATION_CAPABILITY_X_COLO,
+            MIGRATION_CAPABILITY_BLOCK,
+            MIGRATION_CAPABILITY_VALIDATE_UUID,
+            MIGRATION_CAPABILITY_MAPPED_RAM,
+            MIGRATION_CAPABILITY_LOCAL_UPDATE,
+        };
+        int i;
+
+        for (i = 0; i < ARRAY_SIZE(incompatible); i++) {
+            if (cap_list[incompatible[i]]) {
+                error_setg(errp, "Background snapshot is not compatible "
+                           "with %s", MigrationCapability_str(incompatible[i]));
+                return false;
+            }
+        }
+
+        /* Probing userfaultfd is not free, only do it when turning it on */
+        if (!old_bg_snapshot_cap &&
+            (!ram_write_tracking_available() ||
+             !ram_write_tracking_compatible())) {
+            error_setg(errp, "Background snapshot is not supported by the "
+                       "host kernel or by the guest memory backends");
+            return false;
+        }
+    }
+
+#ifdef CONFIG_LINUX
+    if (cap_list[MIGRATION_CAPABILITY_ZERO_COPY_SEND]) {
+        if (!cap_list[MIGRATION_CAPABILITY_MULTIFD]) {
+            error_setg(errp, "Zero copy send requires the multifd capability");
+            return false;
+        }
+        if (migrate_get_current()->parameters.multifd_compression !=
+            MULTIFD_COMPRESSION_NONE) {
+            error_setg(errp, "Zero copy send is not compatible with "
+                       "multifd compression");
+            return false;
+        }
+    }
+#endif
+
     return true;
 }
 
@@ -1166,6 +1359,55 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_multifd_zlib_level &&
+        (params->multifd_zlib_level > 9)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zlib_level",
+                   "is invalid, it should be in the range of 0 to 9");
+        return false;
+    }
+
+    if (params->has_multifd_zstd_level &&
+        (params->multifd_zstd_level > 20)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zstd_level",
+                   "is invalid, it should be in the range of 0 to 20");
+        return false;
+    }
+
+    if (params->has_postcopy_prefetch_pages &&
+        (params->postcopy_prefetch_pages >
+         MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "postcopy_prefetch_pages",
+                   "is invalid, it should be in the range of 0 to "
+                   stringify(MAX_MIGRATE_POSTCOPY_PREFETCH_PAGES));
+        return false;
+    }
+
+    if (params->has_vcpu_dirty_limit &&
+        (params->vcpu_dirty_limit < 1 ||
+         params->vcpu_dirty_limit > INT64_MAX / MiB)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "vcpu_dirty_limit",
+                   "is invalid, it should be a positive number of MiB/s");
+        return false;
+    }
+
+    if (params->has_multifd_compression &&
+        params->multifd_compression != MULTIFD_COMPRESSION_NONE &&
+        migrate_use_zero_copy_send()) {
+        error_setg(errp, "Multifd compression is not compatible with "
+                   "zero copy send");
+        return false;
+    }
+
+    if (params->has_multifd_compression &&
+        params->multifd_compression != MULTIFD_COMPRESSION_NONE &&
+        migrate_mapped_ram()) {
+        error_setg(errp, "Multifd compression is not compatible with "
+                   "mapped-ram");
+        return false;
+    }
+
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
          !is_power_of_2(params->xbzrle_cache_size))) {
@@ -1276,6 +1518,24 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_multifd_channels) {
         dest->multifd_channels = params->multifd_channels;
     }
+    if (params->has_multifd_compression) {
+        dest->multifd_compression = params->multifd_compression;
+    }
+    if (params->has_multifd_zlib_level) {
+        dest->multifd_zlib_level = params->multifd_zlib_level;
+    }
+    if (params->has_multifd_zstd_level) {
+        dest->multifd_zstd_level = params->multifd_zstd_level;
+    }
+    if (params->has_zero_page_detection) {
+        dest->zero_page_detection = params->zero_page_detection;
+    }
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        dest->vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -1372,6 +1632,25 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_multifd_channels) {
         s->parameters.multifd_channels = params->multifd_channels;
     }
+    if (params->has_multifd_compression) {
+        s->parameters.multifd_compression = params->multifd_compression;
+    }
+    if (params->has_multifd_zlib_level) {
+        s->parameters.multifd_zlib_level = params->multifd_zlib_level;
+    }
+    if (params->has_multifd_zstd_level) {
+        s->parameters.multifd_zstd_level = params->multifd_zstd_level;
+    }
+    if (params->has_zero_page_detection) {
+        s->parameters.zero_page_detection = params->zero_page_detection;
+    }
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages =
+            params->postcopy_prefetch_pages;
+    }
+    if (params->has_vcpu_dirty_limit) {
+        s->parameters.vcpu_dirty_limit = params->vcpu_dirty_limit;
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
@@ -1503,6 +1782,21 @@ static void block_cleanup_parameters(MigrationState *s)
     }
 }
 
+static void postcopy_preempt_release(MigrationState *s)
+{
+    QEMUFile *file;
+
+    qemu_mutex_lock(&s->qemu_file_lock);
+    file = s->postcopy_qemufile_src;
+    s->postcopy_qemufile_src = NULL;
+    qemu_mutex_unlock(&s->qemu_file_lock);
+
+    if (file) {
+        qemu_file_shutdown(file);
+        qemu_fclose(file);
+    }
+}
+
 static void migrate_fd_cleanup(MigrationState *s)
 {
     qemu_bh_delete(s->cleanup_bh);
@@ -1522,6 +1816,7 @@ static void migrate_fd_cleanup(MigrationState *s)
         qemu_mutex_lock_iothread();
 
         multifd_save_cleanup();
+        postcopy_preempt_release(s);
         qemu_mutex_lock(&s->qemu_file_lock);
         tmp = s->to_dst_file;
         s->to_dst_file = NULL;
@@ -1617,6 +1912,11 @@ static void migrate_fd_cancel(MigrationState *s)
     if (s->state == MIGRATION_STATUS_CANCELLING && f) {
         qemu_file_shutdown(f);
     }
+    qemu_mutex_lock(&s->qemu_file_lock);
+    if (s->state == MIGRATION_STATUS_CANCELLING && s->postcopy_qemufile_src) {
+        qemu_file_shutdown(s->postcopy_qemufile_src);
+    }
+    qemu_mutex_unlock(&s->qemu_file_lock);
     if (s->state == MIGRATION_STATUS_CANCELLING && s->block_inactive) {
         Error *local_err = NULL;
 
@@ -1932,6 +2232,11 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
     MigrationState *s = migrate_get_current();
     const char *p;
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "Mapped-ram requires a file: migration URI");
+        return;
+    }
+
     if (!migrate_prepare(s, has_blk && blk, has_inc && inc,
                          has_resume && resume, errp)) {
         /* Error detected, put into errp */
@@ -1950,6 +2255,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -2045,6 +2352,60 @@ bool migrate_postcopy_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_postcopy_preempt(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
+bool migrate_background_snapshot(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT];
+}
+
+bool migrate_parallel_device_load(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_PARALLEL_DEVICE_LOAD];
+}
+
+bool migrate_local_update(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_LOCAL_UPDATE];
+}
+
+bool migrate_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_DIRTY_LIMIT];
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -2167,6 +2528,19 @@ bool migrate_use_multifd(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+bool migrate_use_zero_copy_send(void)
+{
+#ifdef CONFIG_LINUX
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_ZERO_COPY_SEND];
+#else
+    return false;
+#endif
+}
+
 bool migrate_pause_before_switchover(void)
 {
     MigrationState *s;
@@ -2186,6 +2560,60 @@ int migrate_multifd_channels(void)
     return s->parameters.multifd_channels;
 }
 
+MultiFDCompression migrate_multifd_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_compression;
+}
+
+int migrate_multifd_zlib_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_zlib_level;
+}
+
+int migrate_multifd_zstd_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.multifd_zstd_level;
+}
+
+ZeroPageDetection migrate_zero_page_detection(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.zero_page_detection;
+}
+
+uint32_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
+uint64_t migrate_vcpu_dirty_limit(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.vcpu_dirty_limit;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -2261,6 +2689,8 @@ static struct rp_cmd_args {
     [MIG_RP_MSG_REQ_PAGES_ID]   = { .len = -1, .name = "REQ_PAGES_ID" },
     [MIG_RP_MSG_RECV_BITMAP]    = { .len = -1, .name = "RECV_BITMAP" },
     [MIG_RP_MSG_RESUME_ACK]     = { .len =  4, .name = "RESUME_ACK" },
+    [MIG_RP_MSG_REQ_PAGES_PREFETCH] = { .len = -1,
+                                        .name = "REQ_PAGES_PREFETCH" },
     [MIG_RP_MSG_MAX]            = { .len = -1, .name = "MAX" },
 };
 
@@ -2270,11 +2700,13 @@ static struct rp_cmd_args {
  * and we don't need to send pages that have already been sent.
  */
 static void migrate_handle_rp_req_pages(MigrationState *ms, const char* rbname,
-                                       ram_addr_t start, size_t len)
+                                       ram_addr_t start, size_t len,
+                                       bool prefetch)
 {
     long our_host_ps = getpagesize();
+    int ret;
 
-    trace_migrate_handle_rp_req_pages(rbname, start, len);
+    trace_migrate_handle_rp_req_pages(rbname, start, len, prefetch);
 
     /*
      * Since we currently insist on matching page sizes, just sanity check
@@ -2288,7 +2720,12 @@ static void migrate_handle_rp_req_pages(MigrationState *ms, const char* rbname,
         return;
     }
 
-    if (ram_save_queue_pages(rbname, start, len)) {
+    if (prefetch) {
+        ret = ram_save_queue_prefetch(rbname, start, len);
+    } else {
+        ret = ram_save_queue_pages(rbname, start, len);
+    }
+    if (ret) {
         mark_source_rp_bad(ms);
     }
 }
@@ -2421,10 +2858,11 @@ retry:
         case MIG_RP_MSG_REQ_PAGES:
             start = ldq_be_p(buf);
             len = ldl_be_p(buf + 8);
-            migrate_handle_rp_req_pages(ms, NULL, start, len);
+            migrate_handle_rp_req_pages(ms, NULL, start, len, false);
             break;
 
         case MIG_RP_MSG_REQ_PAGES_ID:
+        case MIG_RP_MSG_REQ_PAGES_PREFETCH:
             expected_len = 12 + 1; /* header + termination */
 
             if (header_len >= expected_len) {
@@ -2441,7 +2879,8 @@ retry:
                 mark_source_rp_bad(ms);
                 goto out;
             }
-            migrate_handle_rp_req_pages(ms, (char *)&buf[13], start, len);
+            migrate_handle_rp_req_pages(ms, (char *)&buf[13], start, len,
+                                header_type == MIG_RP_MSG_REQ_PAGES_PREFETCH);
             break;
 
         case MIG_RP_MSG_RECV_BITMAP:
@@ -2551,6 +2990,39 @@ static int await_return_path_close_on_source(MigrationState *ms)
  * Switch from normal iteration to postcopy
  * Returns non-0 on error
  */
+/*
+ * Open the postcopy preempt channel to the destination.  Without it the
+ * requested pages are simply sent on the main channel.
+ */
+static void postcopy_preempt_setup(MigrationState *s)
+{
+    Error *local_err = NULL;
+    QIOChannel *ioc;
+
+    if (!migrate_postcopy_preempt()) {
+        return;
+    }
+
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        warn_report("postcopy-preempt is not supported with TLS, "
+                    "requested pages are sent on the main channel");
+        return;
+    }
+
+    ioc = socket_send_channel_create_sync(&local_err);
+    if (!ioc) {
+        warn_report("Cannot open the postcopy preempt channel, "
+                    "requested pages are sent on the main channel: %s",
+                    error_get_pretty(local_err));
+        error_free(local_err);
+        return;
+    }
+
+    qio_channel_set_name(ioc, "migration-postcopy-preempt");
+    s->postcopy_qemufile_src = qemu_fopen_channel_output(ioc);
+    object_unref(OBJECT(ioc));
+}
+
 static int postcopy_start(MigrationState *ms)
 {
     int ret;
@@ -2566,6 +3038,7 @@ static int postcopy_start(MigrationState *ms)
     }
 
     trace_postcopy_start();
+    postcopy_preempt_setup(ms);
     qemu_mutex_lock_iothread();
     trace_postcopy_start_set_run();
 
@@ -2940,6 +3413,12 @@ static MigThrError postcopy_pause(MigrationState *s)
         qemu_file_shutdown(file);
         qemu_fclose(file);
 
+        /*
+         * Requested pages go on the main channel after recovery; the
+         * destination drops its end of the preempt channel too.
+         */
+        postcopy_preempt_release(s);
+
         error_report("Detected IO failure for postcopy. "
                      "Migration paused.");
 
@@ -3152,6 +3631,7 @@ static void migration_iteration_finish(MigrationState *s)
 {
     /* If we enabled cpu throttling for auto-converge, turn it off. */
     cpu_throttle_stop();
+    kvm_dirty_limit_set(0);
 
     qemu_mutex_lock_iothread();
     switch (s->state) {
@@ -3321,6 +3801,139 @@ static void *migration_thread(void *opaque)
     return NULL;
 }
 
+static void bg_migration_vm_start_bh(void *opaque)
+{
+    MigrationState *s = opaque;
+
+    vm_start();
+    s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - s->downtime_start;
+}
+
+/*
+ * Background snapshot thread on the source VM.
+ *
+ * The guest is stopped only long enough to save the device state and to
+ * write protect its RAM; RAM is then saved while the guest runs.  Pages
+ * the guest wants to write are saved out of order and then released, so
+ * every page lands in the stream with the content it had at the start.
+ * The device state is kept in a buffer and appended after RAM, where the
+ * destination expects it.
+ */
+static void *bg_migration_thread(void *opaque)
+{
+    MigrationState *s = opaque;
+    int64_t setup_start = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    QIOChannelBuffer *bioc;
+    QEMUFile *fb;
+
+    rcu_register_thread();
+    object_ref(OBJECT(s));
+
+    qemu_file_set_rate_limit(s->to_dst_file, INT64_MAX);
+
+    bioc = qio_channel_buffer_new(512 * 1024);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "vmstate-buffer");
+    fb = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    update_iteration_initial_status(s);
+
+    qemu_savevm_state_header(s->to_dst_file);
+    qemu_savevm_state_setup(s->to_dst_file);
+
+    s->setup_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) - setup_start;
+    migrate_set_state(&s->state, MIGRATION_STATUS_SETUP,
+                      MIGRATION_STATUS_ACTIVE);
+
+    trace_migration_thread_setup_complete();
+
+    qemu_mutex_lock_iothread();
+    s->downtime_start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    qemu_system_wakeup_request(QEMU_WAKEUP_REASON_OTHER, NULL);
+    s->vm_was_running = runstate_is_running();
+
+    if (global_state_store() ||
+        vm_stop_force_state(RUN_STATE_PAUSED)) {
+        goto fail;
+    }
+
+    cpu_synchronize_all_states();
+    if (qemu_savevm_state_complete_precopy_non_iterable(fb, false, false)) {
+        goto fail;
+    }
+    qemu_fflush(fb);
+    if (qemu_file_get_error(fb)) {
+        goto fail;
+    }
+
+    if (ram_write_tracking_start()) {
+        goto fail;
+    }
+
+    /* Let the main loop restart the guest so this thread can go ahead */
+    if (s->vm_was_running) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                bg_migration_vm_start_bh, s);
+    } else {
+        s->downtime = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                      s->downtime_start;
+    }
+    qemu_mutex_unlock_iothread();
+
+    while (s->state == MIGRATION_STATUS_ACTIVE) {
+        int ret = qemu_savevm_state_iterate(s->to_dst_file, false);
+
+        if (ret > 0) {
+            qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+            qemu_fflush(s->to_dst_file);
+            if (qemu_file_get_error(s->to_dst_file)) {
+                migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                                  MIGRATION_STATUS_FAILED);
+            } else {
+                migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                                  MIGRATION_STATUS_COMPLETED);
+            }
+            break;
+        }
+
+        if (migration_detect_error(s) == MIG_THR_ERR_FATAL) {
+            break;
+        }
+
+        migration_update_counters(s, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    }
+
+    trace_migration_thread_after_loop();
+
+    /*
+     * The stream has been flushed, nothing refers to guest RAM any more;
+     * also releases a guest still blocked on a write if we failed.
+     */
+    ram_write_tracking_stop();
+
+    qemu_mutex_lock_iothread();
+    if (s->state == MIGRATION_STATUS_COMPLETED) {
+        migration_calculate_complete(s);
+    }
+    goto out;
+
+fail:
+    migrate_set_state(&s->state, MIGRATION_STATUS_ACTIVE,
+                      MIGRATION_STATUS_FAILED);
+    if (s->vm_was_running) {
+        vm_start();
+    }
+
+out:
+    migrate_fd_cleanup_schedule(s);
+    qemu_mutex_unlock_iothread();
+
+    qemu_fclose(fb);
+    object_unref(OBJECT(s));
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void migrate_fd_connect(MigrationState *s, Error *error_in)
 {
     int64_t rate_limit;
@@ -3377,8 +3990,13 @@ void migrate_fd_connect(MigrationState *s, Error *error_in)
         migrate_fd_cleanup(s);
         return;
     }
-    qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
-                       QEMU_THREAD_JOINABLE);
+    if (migrate_background_snapshot()) {
+        qemu_thread_create(&s->thread, "bg_snapshot", bg_migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    } else {
+        qemu_thread_create(&s->thread, "live_migration", migration_thread, s,
+                           QEMU_THREAD_JOINABLE);
+    }
     s->migration_thread_running = true;
 }
 
@@ -3445,6 +4063,24 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT8("multifd-channels", MigrationState,
                       parameters.multifd_channels,
                       DEFAULT_MIGRATE_MULTIFD_CHANNELS),
+    DEFINE_PROP_MULTIFD_COMPRESSION("multifd-compression", MigrationState,
+                      parameters.multifd_compression,
+                      DEFAULT_MIGRATE_MULTIFD_COMPRESSION),
+    DEFINE_PROP_UINT8("multifd-zlib-level", MigrationState,
+                      parameters.multifd_zlib_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL),
+    DEFINE_PROP_UINT8("multifd-zstd-level", MigrationState,
+                      parameters.multifd_zstd_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
+                      parameters.zero_page_detection,
+                      DEFAULT_MIGRATE_ZERO_PAGE_DETECTION),
+    DEFINE_PROP_UINT32("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages,
+                      DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
+    DEFINE_PROP_UINT64("vcpu-dirty-limit", MigrationState,
+                      parameters.vcpu_dirty_limit,
+                      DEFAULT_MIGRATE_VCPU_DIRTY_LIMIT),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -3534,6 +4170,12 @@ static void migration_instance_init(Object *obj)
     params->has_x_checkpoint_delay = true;
     params->has_block_incremental = true;
     params->has_multifd_channels = true;
+    params->has_multifd_compression = true;
+    params->has_multifd_zlib_level = true;
+    params->has_multifd_zstd_level = true;
+    params->has_zero_page_detection = true;
+    params->has_postcopy_prefetch_pages = true;
+    params->has_vcpu_dirty_limit = true;
     params->has_xbzrle_cache_size = true;
     params->has_max_postcopy_bandwidth = true;
     params->has_max_cpu_throttle = true;
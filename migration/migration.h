@@ -43,6 +43,17 @@ struct PostcopyBlocktimeContext;
  */
 #define CLEAR_BITMAP_SHIFT_MAX            31
 
+/*
+ * Channels that carry RAM pages in postcopy: the main migration stream,
+ * and the postcopy preempt channel used for pages the destination
+ * faulted on.
+ */
+enum {
+    RAM_CHANNEL_PRECOPY = 0,
+    RAM_CHANNEL_POSTCOPY = 1,
+    RAM_CHANNEL_MAX,
+};
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -75,7 +86,9 @@ struct MigrationIncomingState {
     QemuMutex rp_mutex;    /* We send replies from multiple threads */
     /* RAMBlock of last request sent to source */
     RAMBlock *last_rb;
-    void     *postcopy_tmp_page;
+    /* One page buffer and last received block for each RAM channel */
+    void     *postcopy_tmp_pages[RAM_CHANNEL_MAX];
+    RAMBlock *last_recv_block[RAM_CHANNEL_MAX];
     void     *postcopy_tmp_zero_page;
     /* PostCopyFD's for external userfaultfds & handlers of shared memory */
     GArray   *postcopy_remote_fds;
@@ -103,6 +116,11 @@ struct MigrationIncomingState {
 
     /* List of listening socket addresses  */
     SocketAddressList *socket_address_list;
+
+    /* Postcopy preempt channel and the thread loading pages from it */
+    QEMUFile *postcopy_qemufile_dst;
+    bool have_preempt_thread;
+    QemuThread postcopy_preempt_thread;
 };
 
 MigrationIncomingState *migration_incoming_get_current(void);
@@ -142,6 +160,14 @@ struct MigrationState
      */
     QemuMutex qemu_file_lock;
 
+    /*
+     * Postcopy preempt channel, carrying the pages requested by the
+     * destination.  Only written by the migration thread; NULL if the
+     * capability is off, the channel could not be set up or postcopy
+     * was paused.  Cleared under qemu_file_lock.
+     */
+    QEMUFile *postcopy_qemufile_src;
+
     /*
      * Used to allow urgent requests to override rate limiting.
      */
@@ -287,6 +313,12 @@ bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
 bool migrate_postcopy_ram(void);
+bool migrate_postcopy_preempt(void);
+bool migrate_mapped_ram(void);
+bool migrate_background_snapshot(void);
+bool migrate_parallel_device_load(void);
+bool migrate_local_update(void);
+bool migrate_dirty_limit(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
@@ -294,8 +326,15 @@ bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
+bool migrate_use_zero_copy_send(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
+MultiFDCompression migrate_multifd_compression(void);
+int migrate_multifd_zlib_level(void);
+int migrate_multifd_zstd_level(void);
+ZeroPageDetection migrate_zero_page_detection(void);
+uint32_t migrate_postcopy_prefetch_pages(void);
+uint64_t migrate_vcpu_dirty_limit(void);
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
@@ -323,6 +362,9 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
                           uint32_t value);
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, const char* rbname,
                               ram_addr_t start, size_t len);
+int migrate_send_rp_req_prefetch(MigrationIncomingState *mis,
+                                 const char *rbname,
+                                 ram_addr_t start, size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -1,6 +1,7 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is base on a hash of the page address, each hash value
+ * selects a set of pages that are replaced in LRU order
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -30,11 +31,15 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* Number of pages that can be cached for each hash value */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
     uint64_t it_age;
+    uint64_t it_lru;
     uint8_t *it_data;
 };
 
@@ -43,6 +48,10 @@ struct PageCache {
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t num_ways;
+    size_t num_sets;
+    /* incremented on every hit or insertion, orders the ways by use */
+    uint64_t lru_clock;
 };
 
 PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
@@ -74,8 +83,12 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
+    cache->lru_clock = 0;
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %zu sets of %zu pages\n",
+            cache->num_sets, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -90,6 +103,7 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
+        cache->page_cache[i].it_lru = 0;
         cache->page_cache[i].it_addr = -1;
     }
 
@@ -112,57 +126,91 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+/* Return the first of the num_ways items that can hold @address */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
-}
-
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
-{
-    size_t pos;
+    size_t set;
 
     g_assert(cache);
     g_assert(cache->page_cache);
+    g_assert(cache->num_sets);
+
+    set = (address / cache->page_size) & (cache->num_sets - 1);
+    return &cache->page_cache[set * cache->num_ways];
+}
 
-    pos = cache_get_cache_pos(cache, addr);
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
 
-    return &cache->page_cache[pos];
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_data && set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age)
 {
     CacheItem *it;
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
+        it->it_lru = ++cache->lru_clock;
         return true;
     }
     return false;
 }
 
+/*
+ * Pick the item to store @addr in: the one already holding it, else a
+ * free one, else the least recently used page that is not fresh.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr,
+                                   uint64_t current_age)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    CacheItem *victim = NULL;
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        CacheItem *it = &set[i];
+
+        if (!it->it_data || it->it_addr == addr) {
+            return it;
+        }
+        /* the cache page is fresh, don't replace it */
+        if (it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            continue;
+        }
+        if (!victim || it->it_lru < victim->it_lru) {
+            victim = it;
+        }
+    }
+    return victim;
+}
+
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
 
     CacheItem *it;
+    int ret = 0;
 
-    /* actual update of entry */
-    it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
+    it = cache_get_victim(cache, addr, current_age);
+    if (!it) {
         return -1;
     }
     /* allocate page */
@@ -173,12 +221,15 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             return -1;
         }
         cache->num_items++;
+    } else if (it->it_addr != addr) {
+        ret = 1;
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
 
     it->it_age = current_age;
+    it->it_lru = ++cache->lru_clock;
     it->it_addr = addr;
 
-    return 0;
+    return ret;
 }
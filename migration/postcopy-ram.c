@@ -539,8 +539,17 @@ static void postcopy_balloon_inhibit(bool state)
  */
 int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 {
+    int i;
+
     trace_postcopy_ram_incoming_cleanup_entry();
 
+    /*
+     * The source ends the preempt channel before the main stream, so the
+     * thread only has the last requested pages to place.  It must be gone
+     * before the userfaultfd is.
+     */
+    postcopy_preempt_incoming_cleanup(mis, false);
+
     if (mis->have_fault_thread) {
         Error *local_err = NULL;
 
@@ -579,9 +588,11 @@ int postcopy_ram_incoming_cleanup(MigrationIncomingState *mis)
 
     postcopy_state_set(POSTCOPY_INCOMING_END);
 
-    if (mis->postcopy_tmp_page) {
-        munmap(mis->postcopy_tmp_page, mis->largest_page_size);
-        mis->postcopy_tmp_page = NULL;
+    for (i = 0; i < RAM_CHANNEL_MAX; i++) {
+        if (mis->postcopy_tmp_pages[i]) {
+            munmap(mis->postcopy_tmp_pages[i], mis->largest_page_size);
+            mis->postcopy_tmp_pages[i] = NULL;
+        }
     }
     if (mis->postcopy_tmp_zero_page) {
         munmap(mis->postcopy_tmp_zero_page, mis->largest_page_size);
@@ -869,12 +880,116 @@ static bool postcopy_pause_fault_thread(MigrationIncomingState *mis)
     return true;
 }
 
+/* Largest distance between faults that is taken as a stride, in host pages */
+#define POSTCOPY_PREFETCH_STRIDE_MAX 16
+/* Host pages requested ahead once a stride repeats */
+#define POSTCOPY_PREFETCH_WINDOW_MIN 4
+
+/*
+ * Access pattern detector of the fault thread.  Once two consecutive
+ * faults in a RAMBlock are the same distance apart, the pages further
+ * along that stride are requested as a prefetch.  Every fault that
+ * still follows the stride, including one on a page that was
+ * prefetched but did not arrive in time, doubles the number of pages
+ * requested ahead, up to the postcopy-prefetch-pages parameter.
+ */
+typedef struct PostcopyPrefetch {
+    RAMBlock *rb;
+    /* Host page offset of the last fault and its distance to the one before */
+    int64_t last_offset;
+    int64_t stride;
+    /* Number of strides requested ahead; 0 while there is no pattern */
+    int64_t window;
+    /* First offset along the stride that has not been requested yet */
+    int64_t next_offset;
+} PostcopyPrefetch;
+
+static void postcopy_prefetch_send(MigrationIncomingState *mis, RAMBlock *rb,
+                                   int64_t start, int64_t len)
+{
+    if (!len) {
+        return;
+    }
+    trace_postcopy_prefetch(qemu_ram_get_idstr(rb), start, len);
+    /* Only a hint; a broken return path shows up on the next request */
+    migrate_send_rp_req_prefetch(mis, qemu_ram_get_idstr(rb), start, len);
+}
+
+static void postcopy_prefetch(MigrationIncomingState *mis,
+                              PostcopyPrefetch *pf, RAMBlock *rb,
+                              int64_t offset)
+{
+    uint32_t max = migrate_postcopy_prefetch_pages();
+    int64_t pagesize = qemu_ram_pagesize(rb);
+    int64_t block_len = qemu_ram_get_used_length(rb);
+    int64_t delta = offset - pf->last_offset;
+    int64_t start = 0, len = 0, cur;
+    bool follows = false;
+
+    if (!max) {
+        return;
+    }
+
+    if (rb == pf->rb && pf->stride && delta % pf->stride == 0) {
+        int64_t steps = delta / pf->stride;
+        int64_t ahead = pf->window ?
+                        (pf->next_offset - pf->last_offset) / pf->stride : 1;
+
+        follows = steps >= 1 && steps <= MAX(ahead, 1);
+    }
+
+    if (follows) {
+        pf->window = pf->window ? MIN(pf->window * 2, max) :
+                                  MIN(POSTCOPY_PREFETCH_WINDOW_MIN, max);
+    } else {
+        pf->stride = 0;
+        if (rb == pf->rb && delta &&
+            ABS(delta) <= POSTCOPY_PREFETCH_STRIDE_MAX * pagesize) {
+            pf->stride = delta;
+        }
+        pf->window = 0;
+        pf->next_offset = offset + pf->stride;
+    }
+    pf->rb = rb;
+    pf->last_offset = offset;
+
+    if (!pf->window) {
+        return;
+    }
+
+    /* Pages before next_offset have been requested already */
+    if ((pf->next_offset - offset) / pf->stride < 1) {
+        pf->next_offset = offset + pf->stride;
+    }
+
+    for (cur = pf->next_offset;
+         (cur - offset) / pf->stride <= pf->window;
+         cur += pf->stride) {
+        if (cur < 0 || cur + pagesize > block_len) {
+            break;
+        }
+        if (ramblock_recv_bitmap_test_byte_offset(rb, cur)) {
+            continue;
+        }
+        if (len && cur == start + len) {
+            len += pagesize;
+        } else {
+            postcopy_prefetch_send(mis, rb, start, len);
+            start = cur;
+            len = pagesize;
+        }
+    }
+    postcopy_prefetch_send(mis, rb, start, len);
+    pf->next_offset = cur;
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    PostcopyPrefetch prefetch = { 0 };
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -1030,6 +1145,8 @@ retry:
                     break;
                 }
             }
+
+            postcopy_prefetch(mis, &prefetch, rb, rb_offset);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1241,22 +1358,30 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
                                                                       host));
     } else {
         /* The kernel can't use UFFDIO_ZEROPAGE for hugepages */
-        if (!mis->postcopy_tmp_zero_page) {
-            mis->postcopy_tmp_zero_page = mmap(NULL, mis->largest_page_size,
-                                               PROT_READ | PROT_WRITE,
-                                               MAP_PRIVATE | MAP_ANONYMOUS,
-                                               -1, 0);
-            if (mis->postcopy_tmp_zero_page == MAP_FAILED) {
+        void *zero_page = atomic_read(&mis->postcopy_tmp_zero_page);
+
+        if (!zero_page) {
+            void *old;
+
+            zero_page = mmap(NULL, mis->largest_page_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (zero_page == MAP_FAILED) {
                 int e = errno;
-                mis->postcopy_tmp_zero_page = NULL;
                 error_report("%s: %s mapping large zero page",
                              __func__, strerror(e));
                 return -e;
             }
-            memset(mis->postcopy_tmp_zero_page, '\0', mis->largest_page_size);
+            memset(zero_page, '\0', mis->largest_page_size);
+            /* The postcopy preempt thread may be placing zero pages too */
+            old = atomic_cmpxchg(&mis->postcopy_tmp_zero_page, NULL,
+                                 zero_page);
+            if (old) {
+                munmap(zero_page, mis->largest_page_size);
+                zero_page = old;
+            }
         }
-        return postcopy_place_page(mis, host, mis->postcopy_tmp_zero_page,
-                                   rb);
+        return postcopy_place_page(mis, host, zero_page, rb);
     }
 }
 
@@ -1265,23 +1390,241 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
  * using postcopy_place_page
  * The same address is used repeatedly, postcopy_place_page just takes the
  * backing page away.
+ * Each RAM channel has its own page, as they are loaded by different
+ * threads.
  * Returns: Pointer to allocated page
  *
  */
-void *postcopy_get_tmp_page(MigrationIncomingState *mis)
-{
-    if (!mis->postcopy_tmp_page) {
-        mis->postcopy_tmp_page = mmap(NULL, mis->largest_page_size,
-                             PROT_READ | PROT_WRITE, MAP_PRIVATE |
-                             MAP_ANONYMOUS, -1, 0);
-        if (mis->postcopy_tmp_page == MAP_FAILED) {
-            mis->postcopy_tmp_page = NULL;
+void *postcopy_get_tmp_page(MigrationIncomingState *mis, int channel)
+{
+    if (!mis->postcopy_tmp_pages[channel]) {
+        void *page = mmap(NULL, mis->largest_page_size,
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE |
+                          MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) {
             error_report("%s: %s", __func__, strerror(errno));
             return NULL;
         }
+        mis->postcopy_tmp_pages[channel] = page;
+    }
+
+    return mis->postcopy_tmp_pages[channel];
+}
+
+/*
+ * Write-protect tracking of the source's RAM, for background snapshots:
+ * guest RAM is registered with a userfaultfd in write-protect mode, and
+ * the first write to a page that has not been saved yet blocks until the
+ * migration thread has saved it and lifts the protection.
+ */
+static int wp_ufd = -1;
+
+bool ram_write_tracking_available(void)
+{
+    uint64_t features;
+
+    if (!receive_ufd_features(&features)) {
+        return false;
+    }
+    return features & UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+}
+
+static int wp_open_ufd(void)
+{
+    int ufd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+
+    if (ufd == -1) {
+        error_report("%s: syscall __NR_userfaultfd failed: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+    if (!request_ufd_features(ufd, UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+        close(ufd);
+        return -1;
+    }
+    return ufd;
+}
+
+static int wp_change_protection(int ufd, void *start, uint64_t len, bool wp)
+{
+    struct uffdio_writeprotect wp_struct;
+
+    wp_struct.range.start = (uintptr_t)start;
+    wp_struct.range.len = len;
+    /* Lifting the protection also wakes up the blocked writers */
+    wp_struct.mode = wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    if (ioctl(ufd, UFFDIO_WRITEPROTECT, &wp_struct)) {
+        error_report("%s: UFFDIO_WRITEPROTECT failed: %s", __func__,
+                     strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int wp_register_block(RAMBlock *rb, void *opaque)
+{
+    int ufd = *(int *)opaque;
+    struct uffdio_register reg_struct;
+
+    reg_struct.range.start = (uintptr_t)qemu_ram_get_host_addr(rb);
+    reg_struct.range.len = qemu_ram_get_used_length(rb);
+    reg_struct.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(ufd, UFFDIO_REGISTER, &reg_struct)) {
+        error_report("%s: UFFDIO_REGISTER failed for %s: %s", __func__,
+                     qemu_ram_get_idstr(rb), strerror(errno));
+        return -1;
+    }
+    if (!(reg_struct.ioctls & ((__u64)1 << _UFFDIO_WRITEPROTECT))) {
+        error_report("Write protection is not supported for RAM block %s",
+                     qemu_ram_get_idstr(rb));
+        return -1;
+    }
+    return 0;
+}
+
+static int wp_unregister_block(RAMBlock *rb, void *opaque)
+{
+    int ufd = *(int *)opaque;
+    struct uffdio_range range_struct;
+
+    range_struct.start = (uintptr_t)qemu_ram_get_host_addr(rb);
+    range_struct.len = qemu_ram_get_used_length(rb);
+    if (ioctl(ufd, UFFDIO_UNREGISTER, &range_struct)) {
+        error_report("%s: UFFDIO_UNREGISTER failed for %s: %s", __func__,
+                     qemu_ram_get_idstr(rb), strerror(errno));
+    }
+    return 0;
+}
+
+/*
+ * Write protection only applies to pages that are mapped, so touch every
+ * page first; reading maps the zero page into holes, which is enough.
+ */
+static int wp_populate_block(RAMBlock *rb, void *opaque)
+{
+    uint8_t *host = qemu_ram_get_host_addr(rb);
+    ram_addr_t length = qemu_ram_get_used_length(rb);
+    size_t pagesize = qemu_ram_pagesize(rb);
+    ram_addr_t offset;
+
+    for (offset = 0; offset < length; offset += pagesize) {
+        (void)*(volatile uint8_t *)(host + offset);
+    }
+    return 0;
+}
+
+static int wp_protect_block(RAMBlock *rb, void *opaque)
+{
+    return wp_change_protection(*(int *)opaque, qemu_ram_get_host_addr(rb),
+                                qemu_ram_get_used_length(rb), true);
+}
+
+static int wp_unprotect_block(RAMBlock *rb, void *opaque)
+{
+    wp_change_protection(*(int *)opaque, qemu_ram_get_host_addr(rb),
+                         qemu_ram_get_used_length(rb), false);
+    return 0;
+}
+
+bool ram_write_tracking_compatible(void)
+{
+    int ufd = wp_open_ufd();
+    int ret;
+
+    if (ufd < 0) {
+        return false;
+    }
+    ret = foreach_not_ignored_block(wp_register_block, &ufd);
+    foreach_not_ignored_block(wp_unregister_block, &ufd);
+    close(ufd);
+
+    return !ret;
+}
+
+int ram_write_tracking_start(void)
+{
+    int ufd;
+
+    assert(wp_ufd == -1);
+    ufd = wp_open_ufd();
+    if (ufd < 0) {
+        return -1;
+    }
+
+    /* A page discarded by the balloon would lose its protection */
+    qemu_balloon_inhibit(true);
+    if (foreach_not_ignored_block(wp_populate_block, NULL) ||
+        foreach_not_ignored_block(wp_register_block, &ufd) ||
+        foreach_not_ignored_block(wp_protect_block, &ufd)) {
+        foreach_not_ignored_block(wp_unregister_block, &ufd);
+        close(ufd);
+        qemu_balloon_inhibit(false);
+        return -1;
+    }
+
+    wp_ufd = ufd;
+    trace_ram_write_tracking_start();
+    return 0;
+}
+
+void ram_write_tracking_stop(void)
+{
+    if (wp_ufd == -1) {
+        return;
+    }
+
+    foreach_not_ignored_block(wp_unprotect_block, &wp_ufd);
+    foreach_not_ignored_block(wp_unregister_block, &wp_ufd);
+    close(wp_ufd);
+    wp_ufd = -1;
+    qemu_balloon_inhibit(false);
+    trace_ram_write_tracking_stop();
+}
+
+RAMBlock *ram_write_tracking_poll(ram_addr_t *offset)
+{
+    struct uffd_msg msg;
+    RAMBlock *rb;
+    void *addr;
+    ssize_t ret;
+
+    if (wp_ufd == -1) {
+        return NULL;
+    }
+
+    ret = read(wp_ufd, &msg, sizeof(msg));
+    if (ret != sizeof(msg)) {
+        if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+            error_report("%s: Failed to read write fault: %s", __func__,
+                         strerror(errno));
+        }
+        return NULL;
+    }
+    if (msg.event != UFFD_EVENT_PAGEFAULT ||
+        !(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)) {
+        return NULL;
+    }
+
+    addr = (void *)(uintptr_t)msg.arg.pagefault.address;
+    rb = qemu_ram_block_from_host(addr, false, offset);
+    if (!rb) {
+        error_report("%s: Write fault on unknown address %p", __func__, addr);
+        return NULL;
     }
+    *offset &= ~((ram_addr_t)qemu_ram_pagesize(rb) - 1);
+    trace_ram_write_tracking_poll(qemu_ram_get_idstr(rb), *offset);
 
-    return mis->postcopy_tmp_page;
+    return rb;
+}
+
+int ram_write_tracking_unprotect(RAMBlock *rb, ram_addr_t start,
+                                 ram_addr_t length)
+{
+    if (wp_ufd == -1) {
+        return 0;
+    }
+    return wp_change_protection(wp_ufd, qemu_ram_get_host_addr(rb) + start,
+                                length, false);
 }
 
 #else
@@ -1341,7 +1684,7 @@ int postcopy_place_page_zero(MigrationIncomingState *mis, void *host,
     return -1;
 }
 
-void *postcopy_get_tmp_page(MigrationIncomingState *mis)
+void *postcopy_get_tmp_page(MigrationIncomingState *mis, int channel)
 {
     assert(0);
     return NULL;
@@ -1354,6 +1697,38 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd,
     assert(0);
     return -1;
 }
+
+bool ram_write_tracking_available(void)
+{
+    return false;
+}
+
+bool ram_write_tracking_compatible(void)
+{
+    return false;
+}
+
+int ram_write_tracking_start(void)
+{
+    error_report("%s: No OS support", __func__);
+    return -1;
+}
+
+void ram_write_tracking_stop(void)
+{
+}
+
+RAMBlock *ram_write_tracking_poll(ram_addr_t *offset)
+{
+    return NULL;
+}
+
+int ram_write_tracking_unprotect(RAMBlock *rb, ram_addr_t start,
+                                 ram_addr_t length)
+{
+    assert(0);
+    return -1;
+}
 #endif
 
 /* ------------------------------------------------------------------------- */
@@ -1373,6 +1748,71 @@ void postcopy_fault_thread_notify(MigrationIncomingState *mis)
     }
 }
 
+/*
+ * Load the pages that the source sends on the postcopy preempt channel,
+ * until it ends the channel with RAM_SAVE_FLAG_EOS at the end of
+ * migration or the channel fails.
+ */
+static void *postcopy_preempt_thread(void *opaque)
+{
+    MigrationIncomingState *mis = opaque;
+    int ret;
+
+    rcu_register_thread();
+    trace_postcopy_preempt_thread_entry();
+
+    rcu_read_lock();
+    ret = ram_load_postcopy(mis->postcopy_qemufile_dst, RAM_CHANNEL_POSTCOPY);
+    rcu_read_unlock();
+
+    /*
+     * Nothing to recover here: after a failure the source sends the
+     * requested pages on the main channel.
+     */
+    if (ret) {
+        error_report("%s: postcopy preempt channel failed: %s", __func__,
+                     strerror(-ret));
+    }
+
+    trace_postcopy_preempt_thread_exit(ret);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *f)
+{
+    if (mis->postcopy_qemufile_dst) {
+        error_report("%s: postcopy preempt channel already set up", __func__);
+        qemu_fclose(f);
+        return;
+    }
+
+    trace_postcopy_preempt_new_channel();
+    qemu_file_set_blocking(f, true);
+    mis->postcopy_qemufile_dst = f;
+    qemu_thread_create(&mis->postcopy_preempt_thread, "postcopy/preempt",
+                       postcopy_preempt_thread, mis, QEMU_THREAD_JOINABLE);
+    mis->have_preempt_thread = true;
+}
+
+void postcopy_preempt_incoming_cleanup(MigrationIncomingState *mis,
+                                       bool shutdown)
+{
+    if (!mis->postcopy_qemufile_dst) {
+        return;
+    }
+
+    if (shutdown) {
+        qemu_file_shutdown(mis->postcopy_qemufile_dst);
+    }
+    if (mis->have_preempt_thread) {
+        qemu_thread_join(&mis->postcopy_preempt_thread);
+        mis->have_preempt_thread = false;
+    }
+    qemu_fclose(mis->postcopy_qemufile_dst);
+    mis->postcopy_qemufile_dst = NULL;
+}
+
 /**
  * postcopy_discard_send_init: Called at the start of each RAMBlock before
  *   asking to discard individual ranges.
@@ -102,10 +102,10 @@ typedef enum {
 
 /*
  * Allocate a page of memory that can be mapped at a later point in time
- * using postcopy_place_page
+ * using postcopy_place_page; one for each RAM_CHANNEL_*
  * Returns: Pointer to allocated page
  */
-void *postcopy_get_tmp_page(MigrationIncomingState *mis);
+void *postcopy_get_tmp_page(MigrationIncomingState *mis, int channel);
 
 PostcopyState postcopy_state_get(void);
 /* Set the state and return the old state */
@@ -113,6 +113,18 @@ PostcopyState postcopy_state_set(PostcopyState new_state);
 
 void postcopy_fault_thread_notify(MigrationIncomingState *mis);
 
+/*
+ * Take over a new postcopy preempt channel @f and start the thread
+ * loading the requested pages sent on it
+ */
+void postcopy_preempt_new_channel(MigrationIncomingState *mis, QEMUFile *f);
+/*
+ * Wait for the preempt thread and close its channel; with @shutdown
+ * the channel is shut down first instead of waiting for its end
+ */
+void postcopy_preempt_incoming_cleanup(MigrationIncomingState *mis,
+                                       bool shutdown);
+
 /*
  * To be called once at the start before any device initialisation
  */
@@ -186,4 +198,25 @@ int postcopy_wake_shared(struct PostCopyFD *pcfd, uint64_t client_addr,
 int postcopy_request_shared_page(struct PostCopyFD *pcfd, RAMBlock *rb,
                                  uint64_t client_addr, uint64_t offset);
 
+/*
+ * Write-protect tracking of the source's RAM, used by background
+ * snapshots.
+ */
+/* The host kernel supports write-protect userfaults */
+bool ram_write_tracking_available(void);
+/* Every migratable RAM block can be write-protected */
+bool ram_write_tracking_compatible(void);
+/* Write-protect all of RAM; must be called with the VM stopped */
+int ram_write_tracking_start(void);
+/* Lift the protection from all of RAM and wake up blocked writers */
+void ram_write_tracking_stop(void);
+/*
+ * Returns the block of a page that the guest is waiting to write to,
+ * or NULL if there is none; the offset is aligned to the host page.
+ */
+RAMBlock *ram_write_tracking_poll(ram_addr_t *offset);
+/* Lift the protection from a range once it has been saved */
+int ram_write_tracking_unprotect(RAMBlock *rb, ram_addr_t start,
+                                 ram_addr_t length);
+
 #endif
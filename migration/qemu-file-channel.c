@@ -75,13 +75,23 @@ static ssize_t channel_get_buffer(void *opaque,
                                   uint8_t *buf,
                                   int64_t pos,
                                   size_t size,
+                                  int **fds,
+                                  size_t *nfds,
                                   Error **errp)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    bool fd_pass = qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_FD_PASS);
     ssize_t ret;
 
     do {
-        ret = qio_channel_read(ioc, (char *)buf, size, errp);
+        /*
+         * Ancillary data is dropped by the kernel unless it is asked
+         * for, so always collect the descriptors that may come along.
+         */
+        ret = qio_channel_readv_full(ioc, &iov, 1,
+                                     fd_pass ? fds : NULL,
+                                     fd_pass ? nfds : NULL, errp);
         if (ret < 0) {
             if (ret == QIO_CHANNEL_ERR_BLOCK) {
                 if (qemu_in_coroutine()) {
@@ -146,6 +156,11 @@ static int channel_set_blocking(void *opaque,
     return 0;
 }
 
+static QIOChannel *channel_get_ioc(void *opaque)
+{
+    return QIO_CHANNEL(opaque);
+}
+
 static QEMUFile *channel_get_input_return_path(void *opaque)
 {
     QIOChannel *ioc = QIO_CHANNEL(opaque);
@@ -161,11 +176,12 @@ static QEMUFile *channel_get_output_return_path(void *opaque)
 }
 
 static const QEMUFileOps channel_input_ops = {
-    .get_buffer = channel_get_buffer,
+    .get_buffer_fds = channel_get_buffer,
     .close = channel_close,
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .get_ioc = channel_get_ioc,
 };
 
 
@@ -175,6 +191,7 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .get_ioc = channel_get_ioc,
 };
 
 
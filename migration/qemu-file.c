@@ -53,6 +53,10 @@ struct QEMUFile {
 
     int last_error;
     Error *last_error_obj;
+
+    /* File descriptors received but not yet taken with qemu_get_fd() */
+    int *fds;
+    size_t nfds;
 };
 
 /*
@@ -79,6 +83,140 @@ QEMUFile *qemu_file_get_return_path(QEMUFile *f)
     return f->ops->get_return_path(f->opaque);
 }
 
+/*
+ * Result: the I/O channel backing the QEMUFile
+ *         NULL if the file is not backed by a channel
+ */
+QIOChannel *qemu_file_get_ioc(QEMUFile *f)
+{
+    if (!f->ops->get_ioc) {
+        return NULL;
+    }
+    return f->ops->get_ioc(f->opaque);
+}
+
+/*
+ * Move the I/O position of a file backed by a seekable channel to
+ * @offset.  Pending output is flushed first and buffered input is
+ * dropped.  The position used for accounting (qemu_ftell) is left
+ * alone, as no data went through the file.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int qemu_file_seek(QEMUFile *f, off_t offset, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+
+    if (!ioc) {
+        error_setg(errp, "Migration stream does not support random access");
+        return -1;
+    }
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+        if (qemu_file_get_error(f)) {
+            error_setg(errp, "Unable to flush the migration stream");
+            return -1;
+        }
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    if (qio_channel_io_seek(ioc, offset, SEEK_SET, errp) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Result: the offset in the backing channel that the next byte
+ *         put into or got from the file corresponds to
+ *         (off_t)-1 on error
+ */
+off_t qemu_file_get_offset(QEMUFile *f, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    off_t ret;
+
+    if (!ioc) {
+        error_setg(errp, "Migration stream does not support random access");
+        return -1;
+    }
+
+    qemu_fflush(f);
+    if (qemu_file_get_error(f)) {
+        error_setg(errp, "Unable to flush the migration stream");
+        return -1;
+    }
+
+    ret = qio_channel_io_seek(ioc, 0, SEEK_CUR, errp);
+    if (ret < 0) {
+        return -1;
+    }
+    /* Input that has been read ahead but not consumed yet */
+    return ret - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Send @fd to the other side of a channel that can pass file
+ * descriptors.  The descriptor travels with a single marker byte of
+ * the stream, so qemu_get_fd() must be called at the same point of the
+ * stream on the receiving side.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int qemu_put_fd(QEMUFile *f, int fd, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    uint8_t marker = 0;
+    struct iovec iov = { .iov_base = &marker, .iov_len = 1 };
+
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_FD_PASS)) {
+        error_setg(errp, "Migration stream cannot pass file descriptors");
+        return -1;
+    }
+
+    qemu_fflush(f);
+    if (qemu_file_get_error(f)) {
+        error_setg(errp, "Unable to flush the migration stream");
+        return -1;
+    }
+
+    if (qio_channel_writev_full_all(ioc, &iov, 1, &fd, 1, 0, errp) < 0) {
+        qemu_file_set_error(f, -EIO);
+        return -1;
+    }
+    f->pos++;
+    f->bytes_xfer++;
+    return 0;
+}
+
+/*
+ * Result: the file descriptor sent by qemu_put_fd() at this point of
+ *         the stream, owned by the caller
+ *         -1 on error
+ */
+int qemu_get_fd(QEMUFile *f, Error **errp)
+{
+    int fd;
+
+    if (qemu_get_byte(f) != 0 || qemu_file_get_error(f)) {
+        error_setg(errp, "Expected a file descriptor in the migration stream");
+        return -1;
+    }
+    if (!f->nfds) {
+        error_setg(errp, "No file descriptor was received with the "
+                   "migration stream");
+        return -1;
+    }
+
+    fd = f->fds[0];
+    f->nfds--;
+    memmove(f->fds, f->fds + 1, f->nfds * sizeof(int));
+    return fd;
+}
+
 bool qemu_file_mode_is_not_valid(const char *mode)
 {
     if (mode == NULL ||
@@ -328,8 +466,23 @@ static ssize_t qemu_fill_buffer(QEMUFile *f)
     f->buf_index = 0;
     f->buf_size = pending;
 
-    len = f->ops->get_buffer(f->opaque, f->buf + pending, f->pos,
-                             IO_BUF_SIZE - pending, &local_error);
+    if (f->ops->get_buffer_fds) {
+        int *fds = NULL;
+        size_t nfds = 0;
+
+        len = f->ops->get_buffer_fds(f->opaque, f->buf + pending, f->pos,
+                                     IO_BUF_SIZE - pending, &fds, &nfds,
+                                     &local_error);
+        if (nfds) {
+            f->fds = g_renew(int, f->fds, f->nfds + nfds);
+            memcpy(f->fds + f->nfds, fds, nfds * sizeof(int));
+            f->nfds += nfds;
+        }
+        g_free(fds);
+    } else {
+        len = f->ops->get_buffer(f->opaque, f->buf + pending, f->pos,
+                                 IO_BUF_SIZE - pending, &local_error);
+    }
     if (len > 0) {
         f->buf_size += len;
         f->pos += len;
@@ -376,6 +529,10 @@ int qemu_fclose(QEMUFile *f)
         ret = f->last_error;
     }
     error_free(f->last_error_obj);
+    while (f->nfds) {
+        close(f->fds[--f->nfds]);
+    }
+    g_free(f->fds);
     g_free(f);
     trace_qemu_file_fclose();
     return ret;
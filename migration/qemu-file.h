@@ -27,6 +27,7 @@
 
 #include <zlib.h>
 #include "exec/cpu-common.h"
+#include "io/channel.h"
 
 /* Read a chunk of data from a file at the given position.  The pos argument
  * can be ignored if the file is only be used for streaming.  The number of
@@ -36,6 +37,14 @@ typedef ssize_t (QEMUFileGetBufferFunc)(void *opaque, uint8_t *buf,
                                         int64_t pos, size_t size,
                                         Error **errp);
 
+/* Like QEMUFileGetBufferFunc, but also returns the file descriptors that
+ * arrived along with the data in a newly allocated array.
+ */
+typedef ssize_t (QEMUFileGetBufferFdsFunc)(void *opaque, uint8_t *buf,
+                                           int64_t pos, size_t size,
+                                           int **fds, size_t *nfds,
+                                           Error **errp);
+
 /* Close a file
  *
  * Return negative error number on error, 0 or positive value on success.
@@ -103,13 +112,20 @@ typedef QEMUFile *(QEMURetPathFunc)(void *opaque);
 typedef int (QEMUFileShutdownFunc)(void *opaque, bool rd, bool wr,
                                    Error **errp);
 
+/*
+ * Return the I/O channel backing the QEMUFile, if any
+ */
+typedef QIOChannel *(QEMUFileGetIOCFunc)(void *opaque);
+
 typedef struct QEMUFileOps {
     QEMUFileGetBufferFunc *get_buffer;
+    QEMUFileGetBufferFdsFunc *get_buffer_fds;
     QEMUFileCloseFunc *close;
     QEMUFileSetBlocking *set_blocking;
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileGetIOCFunc *get_ioc;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -159,6 +175,11 @@ void qemu_file_set_error_obj(QEMUFile *f, int ret, Error *err);
 void qemu_file_set_error(QEMUFile *f, int ret);
 int qemu_file_shutdown(QEMUFile *f);
 QEMUFile *qemu_file_get_return_path(QEMUFile *f);
+QIOChannel *qemu_file_get_ioc(QEMUFile *f);
+int qemu_put_fd(QEMUFile *f, int fd, Error **errp);
+int qemu_get_fd(QEMUFile *f, Error **errp);
+int qemu_file_seek(QEMUFile *f, off_t offset, Error **errp);
+off_t qemu_file_get_offset(QEMUFile *f, Error **errp);
 void qemu_fflush(QEMUFile *f);
 void qemu_file_set_blocking(QEMUFile *f, bool block);
 
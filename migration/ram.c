@@ -29,7 +29,11 @@
 #include "qemu/osdep.h"
 #include "cpu.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
@@ -38,6 +42,7 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "migration/register.h"
 #include "migration/misc.h"
 #include "qemu-file.h"
@@ -54,6 +59,7 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/kvm.h"
 #include "qemu/uuid.h"
 #include "savevm.h"
 #include "qemu/iov.h"
@@ -159,10 +165,21 @@ out:
     return ret;
 }
 
+/*
+ * With local-update the destination maps the same file or memfd as the
+ * source, so the contents of the block need not be sent at all.
+ */
+static bool ramblock_is_local_update(RAMBlock *block)
+{
+    return migrate_local_update() && qemu_ram_is_shared(block) &&
+           block->fd >= 0;
+}
+
 static bool ramblock_is_ignored(RAMBlock *block)
 {
     return !qemu_ram_is_migratable(block) ||
-           (migrate_ignore_shared() && qemu_ram_is_shared(block));
+           (migrate_ignore_shared() && qemu_ram_is_shared(block)) ||
+           ramblock_is_local_update(block);
 }
 
 /* Should be holding either ram_list.mutex, or the RCU lock. */
@@ -302,6 +319,9 @@ struct RAMSrcPageRequest {
     QSIMPLEQ_ENTRY(RAMSrcPageRequest) next_req;
 };
 
+/* Prefetch requests kept on the source before dropping the oldest */
+#define RAM_PREFETCH_QUEUE_MAX 64
+
 /* State of RAM for migration */
 struct RAMState {
     /* QEMUFile used for this migration */
@@ -310,6 +330,8 @@ struct RAMState {
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
     RAMBlock *last_sent_block;
+    /* Last block from where we have sent data on the postcopy preempt channel */
+    RAMBlock *last_preempt_block;
     /* Last dirty target page we have sent */
     ram_addr_t last_page;
     /* last ram version we have seen */
@@ -327,6 +349,10 @@ struct RAMState {
     uint64_t bytes_xfer_prev;
     /* number of dirty pages since start_time */
     uint64_t num_dirty_pages_period;
+    /* end of the previous bitmap sync, for MIGRATION_ITERATION */
+    int64_t time_last_sync_us;
+    /* bytes transferred at the end of the previous bitmap sync */
+    uint64_t bytes_xfer_last_sync;
     /* xbzrle misses since the beginning of the period */
     uint64_t xbzrle_cache_miss_prev;
 
@@ -351,6 +377,12 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /*
+     * Pages the destination expects to need soon, sent once
+     * src_page_requests is empty.  Also protected by src_page_req_mutex.
+     */
+    QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_prefetch_requests;
+    unsigned int src_prefetch_count;
 };
 typedef struct RAMState RAMState;
 
@@ -407,6 +439,8 @@ struct PageSearchStatus {
     unsigned long page;
     /* Set once we wrap around */
     bool         complete_round;
+    /* The guest is blocked writing to this page (background snapshot) */
+    bool         write_fault;
 };
 typedef struct PageSearchStatus PageSearchStatus;
 
@@ -583,6 +617,13 @@ exit:
 
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
+/* We reserve 3 bits for compression methods */
+#define MULTIFD_FLAG_COMPRESSION_MASK (7 << 1)
+/* Old senders always used 0 here, which means uncompressed */
+#define MULTIFD_FLAG_NOCOMP (0 << 1)
+#define MULTIFD_FLAG_ZLIB (1 << 1)
+#define MULTIFD_FLAG_ZSTD (2 << 1)
+
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
 
@@ -605,7 +646,10 @@ typedef struct {
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     uint64_t packet_num;
-    uint64_t unused[4];    /* Reserved for future use */
+    /* zero pages, their offsets follow the ones of the pages_used pages */
+    uint32_t zero_pages;
+    uint32_t unused32;     /* Reserved for future use */
+    uint64_t unused[3];    /* Reserved for future use */
     char ramblock[256];
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
@@ -613,6 +657,8 @@ typedef struct {
 typedef struct {
     /* number of used pages */
     uint32_t used;
+    /* how many of the used pages, placed at the end, are zero pages */
+    uint32_t zero_num;
     /* number of allocated pages */
     uint32_t allocated;
     /* global number of generated multifd packets */
@@ -661,8 +707,15 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* bytes queued on this channel, and as of the previous bitmap sync */
+    uint64_t bytes;
+    uint64_t bytes_last_sync;
+    /* zero pages found since the main thread last accounted them */
+    uint64_t zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* used for compression methods */
+    void *data;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -700,8 +753,510 @@ typedef struct {
     uint64_t num_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* used for de-compression methods */
+    void *data;
 } MultiFDRecvParams;
 
+typedef struct {
+    /* Setup for sending side */
+    int (*send_setup)(MultiFDSendParams *p, Error **errp);
+    /* Cleanup for sending side */
+    void (*send_cleanup)(MultiFDSendParams *p);
+    /* Compress the pages and set next_packet_size and the packet flags */
+    int (*send_prepare)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Write the pages after the packet */
+    int (*send_write)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Setup for receiving side */
+    int (*recv_setup)(MultiFDRecvParams *p, Error **errp);
+    /* Cleanup for receiving side */
+    void (*recv_cleanup)(MultiFDRecvParams *p);
+    /* Read and decompress the pages that follow the packet */
+    int (*recv_pages)(MultiFDRecvParams *p, uint32_t used, Error **errp);
+} MultiFDMethods;
+
+static int multifd_check_flags(uint8_t id, uint32_t flags, uint32_t expected,
+                               Error **errp)
+{
+    flags &= MULTIFD_FLAG_COMPRESSION_MASK;
+    if (flags != expected) {
+        error_setg(errp, "multifd %d: received compression flags %x, "
+                   "expected %x; is multifd-compression the same on both "
+                   "sides?", id, flags, expected);
+        return -1;
+    }
+    return 0;
+}
+
+/* Multifd without compression */
+
+static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    if (migrate_use_zero_copy_send() &&
+        !qio_channel_has_feature(p->c, QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY)) {
+        error_setg(errp, "multifd %d: channel does not support zero copy "
+                   "send", p->id);
+        return -1;
+    }
+    return 0;
+}
+
+static void nocomp_send_cleanup(MultiFDSendParams *p)
+{
+}
+
+static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    p->next_packet_size = used * qemu_target_page_size();
+    p->flags |= MULTIFD_FLAG_NOCOMP;
+    return 0;
+}
+
+static int nocomp_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    int flags = 0;
+
+    if (migrate_use_zero_copy_send()) {
+        flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+    }
+    return qio_channel_writev_full_all(p->c, p->pages->iov, used, NULL, 0,
+                                       flags, errp);
+}
+
+static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    return 0;
+}
+
+static void nocomp_recv_cleanup(MultiFDRecvParams *p)
+{
+}
+
+static int nocomp_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    if (multifd_check_flags(p->id, p->flags, MULTIFD_FLAG_NOCOMP, errp)) {
+        return -1;
+    }
+    return qio_channel_readv_all(p->c, p->pages->iov, used, errp);
+}
+
+static MultiFDMethods multifd_nocomp_ops = {
+    .send_setup = nocomp_send_setup,
+    .send_cleanup = nocomp_send_cleanup,
+    .send_prepare = nocomp_send_prepare,
+    .send_write = nocomp_send_write,
+    .recv_setup = nocomp_recv_setup,
+    .recv_cleanup = nocomp_recv_cleanup,
+    .recv_pages = nocomp_recv_pages,
+};
+
+/*
+ * Compressed packets are a single stream per channel: every packet ends
+ * with a sync flush, so the receiver can decompress it on its own but the
+ * dictionary is kept from one packet to the next.  The compressed buffer
+ * is sized for a full packet of incompressible pages.
+ */
+static uint32_t multifd_zbuff_len(void)
+{
+    uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
+
+    return page_count * qemu_target_page_size() * 2;
+}
+
+/* Multifd zlib compression */
+
+struct zlib_data {
+    /* stream for compression */
+    z_stream zs;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+static int zlib_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct zlib_data *z = g_new0(struct zlib_data, 1);
+
+    if (deflateInit(&z->zs, migrate_multifd_zlib_level()) != Z_OK) {
+        error_setg(errp, "multifd %d: deflate init failed", p->id);
+        g_free(z);
+        return -1;
+    }
+    z->zbuff_len = multifd_zbuff_len();
+    z->zbuff = g_malloc(z->zbuff_len);
+    p->data = z;
+    return 0;
+}
+
+static void zlib_send_cleanup(MultiFDSendParams *p)
+{
+    struct zlib_data *z = p->data;
+
+    if (z) {
+        deflateEnd(&z->zs);
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+    }
+}
+
+static int zlib_send_prepare(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct zlib_data *z = p->data;
+    z_stream *zs = &z->zs;
+    uint32_t out_size = 0;
+    uint32_t i;
+    int ret;
+
+    for (i = 0; i < used; i++) {
+        uint32_t available = z->zbuff_len - out_size;
+        int flush = i == used - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+        zs->avail_in = iov[i].iov_len;
+        zs->next_in = iov[i].iov_base;
+        zs->avail_out = available;
+        zs->next_out = z->zbuff + out_size;
+
+        /* deflate() may need several calls to consume all of its input */
+        do {
+            ret = deflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+        if (ret == Z_OK && zs->avail_in) {
+            error_setg(errp, "multifd %d: deflate failed to compress all input",
+                       p->id);
+            return -1;
+        }
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd %d: deflate returned %d instead of Z_OK",
+                       p->id, ret);
+            return -1;
+        }
+        out_size += available - zs->avail_out;
+    }
+    p->next_packet_size = out_size;
+    p->flags |= MULTIFD_FLAG_ZLIB;
+    return 0;
+}
+
+static int zlib_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct zlib_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+static int zlib_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct zlib_data *z = g_new0(struct zlib_data, 1);
+
+    if (inflateInit(&z->zs) != Z_OK) {
+        error_setg(errp, "multifd %d: inflate init failed", p->id);
+        g_free(z);
+        return -1;
+    }
+    z->zbuff_len = multifd_zbuff_len();
+    z->zbuff = g_malloc(z->zbuff_len);
+    p->data = z;
+    return 0;
+}
+
+static void zlib_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct zlib_data *z = p->data;
+
+    if (z) {
+        inflateEnd(&z->zs);
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+    }
+}
+
+static int zlib_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    struct zlib_data *z = p->data;
+    z_stream *zs = &z->zs;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t i;
+    int ret;
+
+    if (multifd_check_flags(p->id, p->flags, MULTIFD_FLAG_ZLIB, errp)) {
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size %" PRIu32 " is bigger "
+                   "than the %" PRIu32 " byte buffer", p->id, in_size,
+                   z->zbuff_len);
+        return -1;
+    }
+    if (qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp) != 0) {
+        return -1;
+    }
+
+    zs->avail_in = in_size;
+    zs->next_in = z->zbuff;
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+        int flush = i == used - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+        zs->avail_out = iov->iov_len;
+        zs->next_out = iov->iov_base;
+
+        do {
+            ret = inflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+        if (ret == Z_OK && zs->avail_out) {
+            error_setg(errp, "multifd %d: inflate generated too few output",
+                       p->id);
+            return -1;
+        }
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd %d: inflate returned %d instead of Z_OK",
+                       p->id, ret);
+            return -1;
+        }
+    }
+    if (zs->avail_in) {
+        error_setg(errp, "multifd %d: %u bytes left after the last page",
+                   p->id, zs->avail_in);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_zlib_ops = {
+    .send_setup = zlib_send_setup,
+    .send_cleanup = zlib_send_cleanup,
+    .send_prepare = zlib_send_prepare,
+    .send_write = zlib_send_write,
+    .recv_setup = zlib_recv_setup,
+    .recv_cleanup = zlib_recv_cleanup,
+    .recv_pages = zlib_recv_pages,
+};
+
+#ifdef CONFIG_ZSTD
+/* Multifd zstd compression */
+
+struct zstd_data {
+    /* stream for compression */
+    ZSTD_CStream *zcs;
+    /* stream for decompression */
+    ZSTD_DStream *zds;
+    /* buffers */
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    /* compressed buffer */
+    uint8_t *zbuff;
+    /* size of compressed buffer */
+    uint32_t zbuff_len;
+};
+
+static int zstd_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct zstd_data *z = g_new0(struct zstd_data, 1);
+    size_t ret;
+
+    z->zcs = ZSTD_createCStream();
+    if (!z->zcs) {
+        error_setg(errp, "multifd %d: zstd createCStream failed", p->id);
+        g_free(z);
+        return -1;
+    }
+    ret = ZSTD_initCStream(z->zcs, migrate_multifd_zstd_level());
+    if (ZSTD_isError(ret)) {
+        error_setg(errp, "multifd %d: initCStream failed with error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        ZSTD_freeCStream(z->zcs);
+        g_free(z);
+        return -1;
+    }
+    z->zbuff_len = multifd_zbuff_len();
+    z->zbuff = g_malloc(z->zbuff_len);
+    p->data = z;
+    return 0;
+}
+
+static void zstd_send_cleanup(MultiFDSendParams *p)
+{
+    struct zstd_data *z = p->data;
+
+    if (z) {
+        ZSTD_freeCStream(z->zcs);
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+    }
+}
+
+static int zstd_send_prepare(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    struct iovec *iov = p->pages->iov;
+    struct zstd_data *z = p->data;
+    uint32_t i;
+    size_t ret;
+
+    z->out.dst = z->zbuff;
+    z->out.size = z->zbuff_len;
+    z->out.pos = 0;
+
+    for (i = 0; i < used; i++) {
+        ZSTD_EndDirective flush = i == used - 1 ? ZSTD_e_flush
+                                                : ZSTD_e_continue;
+
+        z->in.src = iov[i].iov_base;
+        z->in.size = iov[i].iov_len;
+        z->in.pos = 0;
+
+        /*
+         * With ZSTD_e_continue we are done once the input is consumed,
+         * with ZSTD_e_flush once the return value says nothing is left.
+         */
+        do {
+            ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, flush);
+        } while (ret > 0 && !ZSTD_isError(ret) && z->out.pos < z->out.size &&
+                 (z->in.pos < z->in.size || flush == ZSTD_e_flush));
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: compressStream error %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (z->in.pos < z->in.size || (flush == ZSTD_e_flush && ret > 0)) {
+            error_setg(errp, "multifd %d: compressStream buffer too small",
+                       p->id);
+            return -1;
+        }
+    }
+    p->next_packet_size = z->out.pos;
+    p->flags |= MULTIFD_FLAG_ZSTD;
+    return 0;
+}
+
+static int zstd_send_write(MultiFDSendParams *p, uint32_t used, Error **errp)
+{
+    struct zstd_data *z = p->data;
+
+    return qio_channel_write_all(p->c, (void *)z->zbuff, p->next_packet_size,
+                                 errp);
+}
+
+static int zstd_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct zstd_data *z = g_new0(struct zstd_data, 1);
+    size_t ret;
+
+    z->zds = ZSTD_createDStream();
+    if (!z->zds) {
+        error_setg(errp, "multifd %d: zstd createDStream failed", p->id);
+        g_free(z);
+        return -1;
+    }
+    ret = ZSTD_initDStream(z->zds);
+    if (ZSTD_isError(ret)) {
+        error_setg(errp, "multifd %d: initDStream failed with error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        ZSTD_freeDStream(z->zds);
+        g_free(z);
+        return -1;
+    }
+    z->zbuff_len = multifd_zbuff_len();
+    z->zbuff = g_malloc(z->zbuff_len);
+    p->data = z;
+    return 0;
+}
+
+static void zstd_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct zstd_data *z = p->data;
+
+    if (z) {
+        ZSTD_freeDStream(z->zds);
+        g_free(z->zbuff);
+        g_free(z);
+        p->data = NULL;
+    }
+}
+
+static int zstd_recv_pages(MultiFDRecvParams *p, uint32_t used, Error **errp)
+{
+    struct zstd_data *z = p->data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t i;
+    size_t ret;
+
+    if (multifd_check_flags(p->id, p->flags, MULTIFD_FLAG_ZSTD, errp)) {
+        return -1;
+    }
+    if (in_size > z->zbuff_len) {
+        error_setg(errp, "multifd %d: packet size %" PRIu32 " is bigger "
+                   "than the %" PRIu32 " byte buffer", p->id, in_size,
+                   z->zbuff_len);
+        return -1;
+    }
+    if (qio_channel_read_all(p->c, (void *)z->zbuff, in_size, errp) != 0) {
+        return -1;
+    }
+
+    z->in.src = z->zbuff;
+    z->in.size = in_size;
+    z->in.pos = 0;
+
+    for (i = 0; i < used; i++) {
+        struct iovec *iov = &p->pages->iov[i];
+
+        z->out.dst = iov->iov_base;
+        z->out.size = iov->iov_len;
+        z->out.pos = 0;
+
+        do {
+            ret = ZSTD_decompressStream(z->zds, &z->out, &z->in);
+        } while (ret > 0 && !ZSTD_isError(ret) && z->in.pos < z->in.size &&
+                 z->out.pos < z->out.size);
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %d: decompressStream returned %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (z->out.pos < z->out.size) {
+            error_setg(errp, "multifd %d: decompressStream generated too few "
+                       "output", p->id);
+            return -1;
+        }
+    }
+    if (z->in.pos < z->in.size) {
+        error_setg(errp, "multifd %d: %zu bytes left after the last page",
+                   p->id, z->in.size - z->in.pos);
+        return -1;
+    }
+    return 0;
+}
+
+static MultiFDMethods multifd_zstd_ops = {
+    .send_setup = zstd_send_setup,
+    .send_cleanup = zstd_send_cleanup,
+    .send_prepare = zstd_send_prepare,
+    .send_write = zstd_send_write,
+    .recv_setup = zstd_recv_setup,
+    .recv_cleanup = zstd_recv_cleanup,
+    .recv_pages = zstd_recv_pages,
+};
+#endif /* CONFIG_ZSTD */
+
+static MultiFDMethods *multifd_ops[MULTIFD_COMPRESSION__MAX] = {
+    [MULTIFD_COMPRESSION_NONE] = &multifd_nocomp_ops,
+    [MULTIFD_COMPRESSION_ZLIB] = &multifd_zlib_ops,
+#ifdef CONFIG_ZSTD
+    [MULTIFD_COMPRESSION_ZSTD] = &multifd_zstd_ops,
+#endif
+};
+
 static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
 {
     MultiFDInit_t msg;
@@ -798,7 +1353,8 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->version = cpu_to_be32(MULTIFD_VERSION);
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(page_max);
-    packet->pages_used = cpu_to_be32(p->pages->used);
+    packet->pages_used = cpu_to_be32(p->pages->used - p->pages->zero_num);
+    packet->zero_pages = cpu_to_be32(p->pages->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -856,13 +1412,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->pages = multifd_pages_init(packet->pages_alloc);
     }
 
-    p->pages->used = be32_to_cpu(packet->pages_used);
-    if (p->pages->used > packet->pages_alloc) {
+    packet->pages_used = be32_to_cpu(packet->pages_used);
+    packet->zero_pages = be32_to_cpu(packet->zero_pages);
+    if (packet->pages_used > packet->pages_alloc ||
+        packet->zero_pages > packet->pages_alloc - packet->pages_used) {
         error_setg(errp, "multifd: received packet "
-                   "with %d pages and expected maximum pages are %d",
-                   p->pages->used, packet->pages_alloc) ;
+                   "with %d pages (%d zero) and expected maximum pages are %d",
+                   packet->pages_used + packet->zero_pages,
+                   packet->zero_pages, packet->pages_alloc) ;
         return -1;
     }
+    p->pages->used = packet->pages_used + packet->zero_pages;
+    p->pages->zero_num = packet->zero_pages;
 
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
@@ -876,6 +1437,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        packet->ramblock);
             return -1;
         }
+        p->pages->block = block;
     }
 
     for (i = 0; i < p->pages->used; i++) {
@@ -887,7 +1449,22 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        offset, block->max_length);
             return -1;
         }
-        p->pages->iov[i].iov_base = block->host + offset;
+        if (migration_incoming_in_colo_state()) {
+            /*
+             * A COLO checkpoint: the pages go to the cache and are
+             * flushed into the secondary's RAM once the checkpoint is
+             * complete, see colo_flush_ram_cache().
+             */
+            if (!block->colo_cache) {
+                error_setg(errp, "multifd: no COLO cache for ram block %s",
+                           block->idstr);
+                return -1;
+            }
+            set_bit_atomic(offset >> TARGET_PAGE_BITS, block->bmap);
+            p->pages->iov[i].iov_base = block->colo_cache + offset;
+        } else {
+            p->pages->iov[i].iov_base = block->host + offset;
+        }
         p->pages->iov[i].iov_len = TARGET_PAGE_SIZE;
     }
 
@@ -902,6 +1479,8 @@ struct {
     uint64_t packet_num;
     /* send channels ready */
     QemuSemaphore channels_ready;
+    /* multifd ops */
+    MultiFDMethods *ops;
 } *multifd_send_state;
 
 /*
@@ -922,6 +1501,20 @@ struct {
  * false.
  */
 
+/*
+ * Zero pages are only found once a channel looks at the pages, after
+ * ram_save_multifd_page() has counted them as normal ones.  Fix the
+ * counters up when the main thread next takes the channel lock.
+ *
+ * Called with p->mutex held.
+ */
+static void multifd_account_zero_pages(MultiFDSendParams *p)
+{
+    ram_counters.duplicate += p->zero_pages;
+    ram_counters.normal -= p->zero_pages;
+    p->zero_pages = 0;
+}
+
 static int multifd_send_pages(RAMState *rs)
 {
     int i;
@@ -943,6 +1536,7 @@ static int multifd_send_pages(RAMState *rs)
         if (!p->pending_job) {
             p->pending_job++;
             next_channel = (i + 1) % migrate_multifd_channels();
+            multifd_account_zero_pages(p);
             break;
         }
         qemu_mutex_unlock(&p->mutex);
@@ -953,10 +1547,14 @@ static int multifd_send_pages(RAMState *rs)
     p->pages->block = NULL;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->used) * TARGET_PAGE_SIZE + p->packet_len;
+    transferred = ((uint64_t) pages->used) * TARGET_PAGE_SIZE;
+    if (!migrate_mapped_ram()) {
+        transferred += p->packet_len;
+    }
     qemu_file_update_transfer(rs->f, transferred);
     ram_counters.multifd_bytes += transferred;
     ram_counters.transferred += transferred;;
+    p->bytes += transferred;
     qemu_mutex_unlock(&p->mutex);
     qemu_sem_post(&p->sem);
 
@@ -1083,12 +1681,14 @@ static void multifd_send_sync_main(RAMState *rs)
             return;
         }
 
+        multifd_account_zero_pages(p);
         p->packet_num = multifd_send_state->packet_num++;
         p->flags |= MULTIFD_FLAG_SYNC;
         p->pending_job++;
         qemu_file_update_transfer(rs->f, p->packet_len);
         ram_counters.multifd_bytes += p->packet_len;
         ram_counters.transferred += p->packet_len;
+        p->bytes += p->packet_len;
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_post(&p->sem);
     }
@@ -1101,6 +1701,94 @@ static void multifd_send_sync_main(RAMState *rs)
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/*
+ * Move the zero pages to the end of the page array, so that only the
+ * first used - zero_num pages need to be sent with their contents.
+ *
+ * Called with p->mutex held.
+ */
+static void multifd_send_zero_page_detect(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = p->pages;
+    int i = 0;
+    int j = pages->used - 1;
+
+    pages->zero_num = 0;
+    if (migrate_zero_page_detection() != ZERO_PAGE_DETECTION_MULTIFD) {
+        return;
+    }
+
+    while (i <= j) {
+        ram_addr_t offset = pages->offset[i];
+        struct iovec iov = pages->iov[i];
+
+        if (!buffer_is_zero(iov.iov_base, iov.iov_len)) {
+            i++;
+            continue;
+        }
+        pages->offset[i] = pages->offset[j];
+        pages->iov[i] = pages->iov[j];
+        pages->offset[j] = offset;
+        pages->iov[j] = iov;
+        j--;
+    }
+    pages->zero_num = pages->used - i;
+    p->zero_pages += pages->zero_num;
+}
+
+static int mapped_ram_pwritev(QIOChannel *ioc, struct iovec *iov, int niov,
+                              off_t offset, Error **errp)
+{
+    size_t size = iov_size(iov, niov);
+    ssize_t ret = qio_channel_pwritev(ioc, iov, niov, offset, errp);
+
+    if (ret < 0) {
+        return -1;
+    }
+    if (ret != size) {
+        error_setg(errp, "Short write to migration file at offset %lld",
+                   (long long int)offset);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write the pages of a job to their place in a mapped-ram file.  The
+ * normal pages come first in the array; runs of contiguous pages go
+ * out with a single pwritev.  Zero pages are only dropped from the
+ * file bitmap, so that an older copy is not restored.
+ */
+static int multifd_mapped_ram_write(MultiFDSendParams *p, uint32_t used,
+                                    uint32_t normal, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    RAMBlock *block = pages->block;
+    uint32_t i, j;
+
+    for (i = 0; i < normal; i = j) {
+        for (j = i + 1; j < normal && j - i < IOV_MAX; j++) {
+            if (pages->offset[j] != pages->offset[j - 1] + TARGET_PAGE_SIZE) {
+                break;
+            }
+        }
+        if (mapped_ram_pwritev(p->c, &pages->iov[i], j - i,
+                               block->pages_offset + pages->offset[i],
+                               errp) < 0) {
+            return -1;
+        }
+        for (; i < j; i++) {
+            set_bit_atomic(pages->offset[i] >> TARGET_PAGE_BITS,
+                           block->file_bmap);
+        }
+    }
+    for (; i < used; i++) {
+        clear_bit_atomic(pages->offset[i] >> TARGET_PAGE_BITS,
+                         block->file_bmap);
+    }
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -1111,12 +1799,20 @@ static void *multifd_send_thread(void *opaque)
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
+    /* A mapped-ram file has no packets, only pages at fixed offsets */
+    if (!migrate_mapped_ram()) {
+        if (multifd_send_initial_packet(p, &local_err) < 0) {
+            ret = -1;
+            goto out;
+        }
+        /* initial packet */
+        p->num_packets = 1;
+    }
+
+    if (multifd_send_state->ops->send_setup(p, &local_err) < 0) {
         ret = -1;
         goto out;
     }
-    /* initial packet */
-    p->num_packets = 1;
 
     while (true) {
         qemu_sem_wait(&p->sem);
@@ -1124,34 +1820,64 @@ static void *multifd_send_thread(void *opaque)
 
         if (p->pending_job) {
             uint32_t used = p->pages->used;
+            uint32_t normal;
             uint64_t packet_num = p->packet_num;
-            flags = p->flags;
 
-            p->next_packet_size = used * qemu_target_page_size();
+            p->next_packet_size = 0;
+            multifd_send_zero_page_detect(p);
+            normal = used - p->pages->zero_num;
+            if (normal) {
+                ret = multifd_send_state->ops->send_prepare(p, normal,
+                                                            &local_err);
+                if (ret != 0) {
+                    qemu_mutex_unlock(&p->mutex);
+                    break;
+                }
+            }
+            flags = p->flags;
             multifd_send_fill_packet(p);
             p->flags = 0;
             p->num_packets++;
             p->num_pages += used;
             p->pages->used = 0;
+            p->pages->zero_num = 0;
             qemu_mutex_unlock(&p->mutex);
 
             trace_multifd_send(p->id, packet_num, used, flags,
                                p->next_packet_size);
 
-            ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                        p->packet_len, &local_err);
-            if (ret != 0) {
-                break;
+            if (migrate_mapped_ram()) {
+                ret = multifd_mapped_ram_write(p, used, normal, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            } else {
+                ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                            p->packet_len, &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
-            if (used) {
-                ret = qio_channel_writev_all(p->c, p->pages->iov,
-                                             used, &local_err);
+            if (normal && !migrate_mapped_ram()) {
+                ret = multifd_send_state->ops->send_write(p, normal,
+                                                          &local_err);
                 if (ret != 0) {
                     break;
                 }
             }
 
+            /*
+             * Pages written without copying are only safe to resend once
+             * the kernel is done with them, which must happen before the
+             * next dirty bitmap round.
+             */
+            if ((flags & MULTIFD_FLAG_SYNC) &&
+                qio_channel_flush(p->c, &local_err) < 0) {
+                ret = -1;
+                break;
+            }
+
             qemu_mutex_lock(&p->mutex);
             p->pending_job--;
             qemu_mutex_unlock(&p->mutex);
@@ -1184,6 +1910,8 @@ out:
         qemu_sem_post(&multifd_send_state->channels_ready);
     }
 
+    multifd_send_state->ops->send_cleanup(p);
+
     qemu_mutex_lock(&p->mutex);
     p->running = false;
     qemu_mutex_unlock(&p->mutex);
@@ -1194,6 +1922,15 @@ out:
     return NULL;
 }
 
+static void multifd_send_channel_start(MultiFDSendParams *p, QIOChannel *ioc)
+{
+    p->c = ioc;
+    qio_channel_set_delay(p->c, false);
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                       QEMU_THREAD_JOINABLE);
+}
+
 static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -1205,11 +1942,7 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
         migrate_set_error(migrate_get_current(), local_err);
         multifd_save_cleanup();
     } else {
-        p->c = QIO_CHANNEL(sioc);
-        qio_channel_set_delay(p->c, false);
-        p->running = true;
-        qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
-                           QEMU_THREAD_JOINABLE);
+        multifd_send_channel_start(p, sioc);
     }
 }
 
@@ -1227,6 +1960,7 @@ int multifd_save_setup(void)
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
     multifd_send_state->pages = multifd_pages_init(page_count);
     qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
@@ -1242,7 +1976,25 @@ int multifd_save_setup(void)
                       + sizeof(ram_addr_t) * page_count;
         p->packet = g_malloc0(p->packet_len);
         p->name = g_strdup_printf("multifdsend_%d", i);
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (!migrate_mapped_ram()) {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
+    }
+
+    /* Each channel opens the migration file again, once all are set up */
+    if (migrate_mapped_ram()) {
+        for (i = 0; i < thread_count; i++) {
+            MultiFDSendParams *p = &multifd_send_state->params[i];
+            Error *local_err = NULL;
+            QIOChannel *ioc = file_send_channel_create(&local_err);
+
+            if (!ioc) {
+                migrate_set_error(migrate_get_current(), local_err);
+                error_report_err(local_err);
+                return -1;
+            }
+            multifd_send_channel_start(p, ioc);
+        }
     }
     return 0;
 }
@@ -1255,8 +2007,19 @@ struct {
     QemuSemaphore sem_sync;
     /* global number of generated multifd packets */
     uint64_t packet_num;
+    /* multifd ops */
+    MultiFDMethods *ops;
 } *multifd_recv_state;
 
+/*
+ * With mapped-ram the destination reads the pages straight from the
+ * file, so there are no multifd channels to receive from.
+ */
+static bool multifd_recv_use_channels(void)
+{
+    return migrate_use_multifd() && !migrate_mapped_ram();
+}
+
 static void multifd_recv_terminate_threads(Error *err)
 {
     int i;
@@ -1292,7 +2055,7 @@ int multifd_load_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_use_channels()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -1333,7 +2096,7 @@ static void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_use_channels()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1356,6 +2119,36 @@ static void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * Mark the pages of the packet as received.  A zero page that was never
+ * received before still reads as zero on the destination, so it is not
+ * touched at all; only pages that were sent earlier need to be cleared.
+ */
+static void multifd_recv_place_pages(MultiFDRecvParams *p, uint32_t normal,
+                                     uint32_t used)
+{
+    RAMBlock *block = p->pages->block;
+    uint32_t i;
+
+    if (migration_incoming_in_colo_state()) {
+        /* The cache holds the previous checkpoint, zero pages must be set */
+        for (i = normal; i < used; i++) {
+            ram_handle_compressed(p->pages->iov[i].iov_base, 0,
+                                  TARGET_PAGE_SIZE);
+        }
+        return;
+    }
+
+    for (i = 0; i < used; i++) {
+        void *host = p->pages->iov[i].iov_base;
+
+        if (i >= normal && ramblock_recv_bitmap_test(block, host)) {
+            ram_handle_compressed(host, 0, TARGET_PAGE_SIZE);
+        }
+        ramblock_recv_bitmap_set(block, host);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1365,8 +2158,13 @@ static void *multifd_recv_thread(void *opaque)
     trace_multifd_recv_thread_start(p->id);
     rcu_register_thread();
 
+    if (multifd_recv_state->ops->recv_setup(p, &local_err) < 0) {
+        goto out;
+    }
+
     while (true) {
         uint32_t used;
+        uint32_t normal;
         uint32_t flags;
 
         if (p->quit) {
@@ -1390,6 +2188,7 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        normal = used - p->pages->zero_num;
         flags = p->flags;
         trace_multifd_recv(p->id, p->packet_num, used, flags,
                            p->next_packet_size);
@@ -1397,23 +2196,27 @@ static void *multifd_recv_thread(void *opaque)
         p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
 
-        if (used) {
-            ret = qio_channel_readv_all(p->c, p->pages->iov,
-                                        used, &local_err);
+        if (normal) {
+            ret = multifd_recv_state->ops->recv_pages(p, normal, &local_err);
             if (ret != 0) {
                 break;
             }
         }
 
+        multifd_recv_place_pages(p, normal, used);
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
         }
     }
 
+out:
     if (local_err) {
         multifd_recv_terminate_threads(local_err);
     }
+    multifd_recv_state->ops->recv_cleanup(p);
+
     qemu_mutex_lock(&p->mutex);
     p->running = false;
     qemu_mutex_unlock(&p->mutex);
@@ -1430,7 +2233,7 @@ int multifd_load_setup(void)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_use_channels()) {
         return 0;
     }
     thread_count = migrate_multifd_channels();
@@ -1438,6 +2241,7 @@ int multifd_load_setup(void)
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
     atomic_set(&multifd_recv_state->count, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
@@ -1459,7 +2263,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_use_channels()) {
         return true;
     }
 
@@ -1589,8 +2393,10 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 ram_counters.dirty_sync_count);
+    if (cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
+                     ram_counters.dirty_sync_count) == 1) {
+        xbzrle_counters.evictions++;
+    }
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -1620,10 +2426,15 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
                          ram_counters.dirty_sync_count)) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
+            int ret = cache_insert(XBZRLE.cache, current_addr, *current_data,
+                                   ram_counters.dirty_sync_count);
+
+            if (ret == -1) {
                 return -1;
             } else {
+                if (ret == 1) {
+                    xbzrle_counters.evictions++;
+                }
                 /* update *current_data when the page has been
                    inserted into cache */
                 *current_data = get_cached_data(XBZRLE.cache, current_addr);
@@ -1631,6 +2442,7 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
         }
         return -1;
     }
+    xbzrle_counters.cache_hit++;
 
     prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
 
@@ -1765,6 +2577,181 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
                                               &rs->num_dirty_pages_period);
 }
 
+/*
+ * Large RAMBlocks are synced in chunks of this size, and the chunks are
+ * spread over the bitmap sync threads.  It is a multiple of
+ * BITS_PER_LONG pages, so no two chunks touch the same bitmap word.
+ */
+#define BITMAP_SYNC_CHUNK_SIZE      (1ULL << 30)
+#define BITMAP_SYNC_THREADS_MAX     8
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    /* Results, summed up by the migration thread */
+    uint64_t num_dirty;
+    uint64_t real_dirty;
+} BitmapSyncChunk;
+
+typedef struct {
+    QemuThread *threads;
+    int num_threads;
+    bool quit;
+    /* Posted once per thread to start a round */
+    QemuSemaphore sem_start;
+    /* Posted by each thread when it found no more chunks */
+    QemuSemaphore sem_done;
+    BitmapSyncChunk *chunks;
+    int num_chunks;
+    int max_chunks;
+    /* Next chunk to sync, claimed with atomic_fetch_inc */
+    int next_chunk;
+} BitmapSyncState;
+
+static BitmapSyncState *bitmap_sync_state;
+
+static void bitmap_sync_process_chunks(BitmapSyncState *bs)
+{
+    BitmapSyncChunk *chunk;
+    int i;
+
+    rcu_read_lock();
+    while ((i = atomic_fetch_inc(&bs->next_chunk)) < bs->num_chunks) {
+        chunk = &bs->chunks[i];
+        chunk->num_dirty =
+            cpu_physical_memory_sync_dirty_bitmap(chunk->rb, chunk->start,
+                                                  chunk->length,
+                                                  &chunk->real_dirty);
+    }
+    rcu_read_unlock();
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    BitmapSyncState *bs = opaque;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&bs->sem_start);
+        if (atomic_read(&bs->quit)) {
+            break;
+        }
+        bitmap_sync_process_chunks(bs);
+        qemu_sem_post(&bs->sem_done);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static BitmapSyncState *bitmap_sync_setup(void)
+{
+    BitmapSyncState *bs = g_new0(BitmapSyncState, 1);
+    int i;
+
+    /* The migration thread takes its share of chunks too */
+    bs->num_threads = MIN(g_get_num_processors(), BITMAP_SYNC_THREADS_MAX) - 1;
+    bs->threads = g_new0(QemuThread, bs->num_threads);
+    qemu_sem_init(&bs->sem_start, 0);
+    qemu_sem_init(&bs->sem_done, 0);
+
+    for (i = 0; i < bs->num_threads; i++) {
+        qemu_thread_create(bs->threads + i, "bitmap-sync",
+                           bitmap_sync_thread, bs, QEMU_THREAD_JOINABLE);
+    }
+
+    return bs;
+}
+
+static void bitmap_sync_cleanup(void)
+{
+    BitmapSyncState *bs = bitmap_sync_state;
+    int i;
+
+    if (!bs) {
+        return;
+    }
+
+    atomic_set(&bs->quit, true);
+    for (i = 0; i < bs->num_threads; i++) {
+        qemu_sem_post(&bs->sem_start);
+    }
+    for (i = 0; i < bs->num_threads; i++) {
+        qemu_thread_join(bs->threads + i);
+    }
+    qemu_sem_destroy(&bs->sem_start);
+    qemu_sem_destroy(&bs->sem_done);
+    g_free(bs->threads);
+    g_free(bs->chunks);
+    g_free(bs);
+    bitmap_sync_state = NULL;
+}
+
+static void bitmap_sync_add_chunk(BitmapSyncState *bs, RAMBlock *rb,
+                                  ram_addr_t start, ram_addr_t length)
+{
+    BitmapSyncChunk *chunk;
+
+    if (bs->num_chunks == bs->max_chunks) {
+        bs->max_chunks = MAX(bs->max_chunks * 2, 16);
+        bs->chunks = g_renew(BitmapSyncChunk, bs->chunks, bs->max_chunks);
+    }
+
+    chunk = &bs->chunks[bs->num_chunks++];
+    chunk->rb = rb;
+    chunk->start = start;
+    chunk->length = length;
+    chunk->num_dirty = 0;
+    chunk->real_dirty = 0;
+}
+
+/*
+ * Split the RAMBlocks into the chunks of the next sync.  This is the
+ * only part of the merge that needs a stable view of the RAMBlock list.
+ *
+ * Called with RCU critical section
+ */
+static void bitmap_sync_snapshot(BitmapSyncState *bs)
+{
+    RAMBlock *block;
+    ram_addr_t start, length;
+
+    bs->num_chunks = 0;
+    bs->next_chunk = 0;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        for (start = 0; start < block->used_length; start += length) {
+            length = MIN(block->used_length - start, BITMAP_SYNC_CHUNK_SIZE);
+            bitmap_sync_add_chunk(bs, block, start, length);
+        }
+    }
+}
+
+/*
+ * Merge the chunks of the snapshot into the migration bitmaps.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static void bitmap_sync_run(RAMState *rs, BitmapSyncState *bs)
+{
+    int i, threads = MIN(bs->num_threads, bs->num_chunks - 1);
+
+    for (i = 0; i < threads; i++) {
+        qemu_sem_post(&bs->sem_start);
+    }
+    bitmap_sync_process_chunks(bs);
+    for (i = 0; i < threads; i++) {
+        qemu_sem_wait(&bs->sem_done);
+    }
+
+    for (i = 0; i < bs->num_chunks; i++) {
+        rs->migration_dirty_pages += bs->chunks[i].num_dirty;
+        rs->num_dirty_pages_period += bs->chunks[i].real_dirty;
+    }
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1832,12 +2819,72 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 }
 
-static void migration_bitmap_sync(RAMState *rs)
+/*
+ * migration_bitmap_sync: fetch the dirty log and merge it into the
+ * migration bitmaps
+ *
+ * Called with the iothread lock held.  If @unlock_iothread is true, the
+ * lock is dropped while the bitmaps are merged, so that vCPUs are not
+ * stalled by the merge of large guests.
+ *
+ * @rs: current RAM state
+ * @unlock_iothread: whether the iothread lock may be dropped
+ */
+/* Per-channel bytes queued since the previous bitmap sync */
+static MigrationChannelStatsList *multifd_channel_stats(void)
+{
+    MigrationChannelStatsList *head = NULL, **tail = &head;
+    int i;
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+        MigrationChannelStatsList *entry = g_new0(MigrationChannelStatsList, 1);
+
+        entry->value = g_new0(MigrationChannelStats, 1);
+        entry->value->id = p->id;
+        qemu_mutex_lock(&p->mutex);
+        entry->value->transferred = p->bytes - p->bytes_last_sync;
+        p->bytes_last_sync = p->bytes;
+        qemu_mutex_unlock(&p->mutex);
+        *tail = entry;
+        tail = &entry->next;
+    }
+    return head;
+}
+
+static void migration_iteration_event(RAMState *rs, int64_t start_us,
+                                      int64_t end_us, int64_t bql_us,
+                                      uint64_t dirty_pages)
+{
+    MigrationChannelStatsList *channels = NULL;
+    int64_t duration = 0;
+
+    if (rs->time_last_sync_us) {
+        duration = (end_us - rs->time_last_sync_us) / 1000;
+    }
+    if (migrate_use_multifd() && multifd_send_state) {
+        channels = multifd_channel_stats();
+    }
+
+    qapi_event_send_migration_iteration(
+        ram_counters.dirty_sync_count, duration, end_us - start_us, bql_us,
+        dirty_pages, ram_counters.transferred - rs->bytes_xfer_last_sync,
+        ram_counters.remaining, cpu_throttle_get_percentage(),
+        !!channels, channels);
+    qapi_free_MigrationChannelStatsList(channels);
+
+    rs->time_last_sync_us = end_us;
+    rs->bytes_xfer_last_sync = ram_counters.transferred;
+}
+
+static void migration_bitmap_sync(RAMState *rs, bool unlock_iothread)
 {
-    RAMBlock *block;
     int64_t end_time;
     uint64_t bytes_xfer_now;
+    int64_t start_us, end_us, unlock_us = 0, relock_us = 0;
+    uint64_t dirty_pages_start = rs->num_dirty_pages_period, dirty_pages;
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     ram_counters.dirty_sync_count++;
 
     if (!rs->time_last_bitmap_sync) {
@@ -1847,18 +2894,34 @@ static void migration_bitmap_sync(RAMState *rs)
     trace_migration_bitmap_sync_start();
     memory_global_dirty_log_sync();
 
-    qemu_mutex_lock(&rs->bitmap_mutex);
+    if (!bitmap_sync_state) {
+        bitmap_sync_state = bitmap_sync_setup();
+    }
+
     rcu_read_lock();
-    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-        ramblock_sync_dirty_bitmap(rs, block);
+    bitmap_sync_snapshot(bitmap_sync_state);
+    if (unlock_iothread) {
+        unlock_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        qemu_mutex_unlock_iothread();
     }
+
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    bitmap_sync_run(rs, bitmap_sync_state);
     ram_counters.remaining = ram_bytes_remaining();
-    rcu_read_unlock();
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
+    if (unlock_iothread) {
+        qemu_mutex_lock_iothread();
+        relock_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    }
+    rcu_read_unlock();
+
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
+    /* Before the period counters below get reset */
+    dirty_pages = rs->num_dirty_pages_period - dirty_pages_start;
+
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     /* more than 1 second = 1000 millisecons */
@@ -1868,7 +2931,8 @@ static void migration_bitmap_sync(RAMState *rs)
         /* During block migration the auto-converge logic incorrectly detects
          * that ram migration makes no progress. Avoid this by disabling the
          * throttling logic during the bulk phase of block migration. */
-        if (migrate_auto_converge() && !blk_mig_bulk_active()) {
+        if ((migrate_auto_converge() || migrate_dirty_limit()) &&
+            !blk_mig_bulk_active()) {
             /* The following detection logic can be refined later. For now:
                Check to see if the dirtied bytes is 50% more than the approx.
                amount of bytes that just got transferred since the last time we
@@ -1880,7 +2944,11 @@ static void migration_bitmap_sync(RAMState *rs)
                 (++rs->dirty_rate_high_cnt >= 2)) {
                     trace_migration_throttle();
                     rs->dirty_rate_high_cnt = 0;
-                    mig_throttle_guest_down();
+                    if (migrate_dirty_limit()) {
+                        kvm_dirty_limit_set(migrate_vcpu_dirty_limit() * MiB);
+                    } else {
+                        mig_throttle_guest_down();
+                    }
             }
         }
 
@@ -1894,11 +2962,17 @@ static void migration_bitmap_sync(RAMState *rs)
         rs->bytes_xfer_prev = bytes_xfer_now;
     }
     if (migrate_use_events()) {
+        int64_t bql_us;
+
+        end_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+        /* The callers hold the BQL, except while it was dropped above */
+        bql_us = end_us - start_us - (relock_us - unlock_us);
         qapi_event_send_migration_pass(ram_counters.dirty_sync_count);
+        migration_iteration_event(rs, start_us, end_us, bql_us, dirty_pages);
     }
 }
 
-static void migration_bitmap_sync_precopy(RAMState *rs)
+static void migration_bitmap_sync_precopy(RAMState *rs, bool unlock_iothread)
 {
     Error *local_err = NULL;
 
@@ -1910,7 +2984,7 @@ static void migration_bitmap_sync_precopy(RAMState *rs)
         error_report_err(local_err);
     }
 
-    migration_bitmap_sync(rs);
+    migration_bitmap_sync(rs, unlock_iothread);
 
     if (precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC, &local_err)) {
         error_report_err(local_err);
@@ -2335,6 +3409,21 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
 
     do {
         block = unqueue_page(rs, &offset);
+        if (!block && migrate_background_snapshot()) {
+            block = ram_write_tracking_poll(&offset);
+            if (block && !test_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
+                /*
+                 * Already saved; the data may still sit in the file's
+                 * buffer, which points into guest RAM.
+                 */
+                qemu_fflush(rs->f);
+                ram_write_tracking_unprotect(block, offset,
+                                             qemu_ram_pagesize(block));
+                dirty = false;
+                continue;
+            }
+            pss->write_fault = !!block;
+        }
         /*
          * We're sending this page, and since it's postcopy nothing else
          * will dirty it, and we must make sure it doesn't get sent again
@@ -2383,6 +3472,75 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
     return !!block;
 }
 
+/**
+ * unqueue_prefetch_page: gets a page off the prefetch queue
+ *
+ * Returns the block of the page (or NULL if none available)
+ *
+ * @rs: current RAM state
+ * @offset: used to return the offset within the RAMBlock
+ */
+static RAMBlock *unqueue_prefetch_page(RAMState *rs, ram_addr_t *offset)
+{
+    RAMBlock *block = NULL;
+
+    if (QSIMPLEQ_EMPTY_ATOMIC(&rs->src_prefetch_requests)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&rs->src_page_req_mutex);
+    if (!QSIMPLEQ_EMPTY(&rs->src_prefetch_requests)) {
+        struct RAMSrcPageRequest *entry =
+                                QSIMPLEQ_FIRST(&rs->src_prefetch_requests);
+        block = entry->rb;
+        *offset = entry->offset;
+
+        if (entry->len > TARGET_PAGE_SIZE) {
+            entry->len -= TARGET_PAGE_SIZE;
+            entry->offset += TARGET_PAGE_SIZE;
+        } else {
+            memory_region_unref(block->mr);
+            QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+            rs->src_prefetch_count--;
+            g_free(entry);
+        }
+    }
+    qemu_mutex_unlock(&rs->src_page_req_mutex);
+
+    return block;
+}
+
+/**
+ * get_prefetch_page: unqueue a page prefetched by the destination
+ *
+ * Like get_queued_page(), but for the pages the destination asked for
+ * ahead of its faults.  They go on the main channel, in place of the
+ * background search.
+ *
+ * Returns true if a prefetch page is found
+ *
+ * @rs: current RAM state
+ * @pss: data about the state of the current dirty page scan
+ */
+static bool get_prefetch_page(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *block;
+    ram_addr_t offset;
+
+    do {
+        block = unqueue_prefetch_page(rs, &offset);
+    } while (block && !test_bit(offset >> TARGET_PAGE_BITS, block->bmap));
+
+    if (block) {
+        rs->ram_bulk_stage = false;
+        pss->block = block;
+        pss->page = offset >> TARGET_PAGE_BITS;
+        pss->complete_round = false;
+    }
+
+    return !!block;
+}
+
 /**
  * migration_page_queue_free: drop any remaining pages in the ram
  * request queue
@@ -2403,6 +3561,13 @@ static void migration_page_queue_free(RAMState *rs)
         QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
         g_free(mspr);
     }
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_prefetch_requests, next_req,
+                          next_mspr) {
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+        g_free(mspr);
+    }
+    rs->src_prefetch_count = 0;
     rcu_read_unlock();
 }
 
@@ -2440,32 +3605,93 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
     } else {
         ramblock = qemu_ram_block_by_name(rbname);
 
-        if (!ramblock) {
-            /* We shouldn't be asked for a non-existent RAMBlock */
-            error_report("ram_save_queue_pages no block '%s'", rbname);
-            goto err;
-        }
-        rs->last_req_rb = ramblock;
+        if (!ramblock) {
+            /* We shouldn't be asked for a non-existent RAMBlock */
+            error_report("ram_save_queue_pages no block '%s'", rbname);
+            goto err;
+        }
+        rs->last_req_rb = ramblock;
+    }
+    trace_ram_save_queue_pages(ramblock->idstr, start, len);
+    if (start+len > ramblock->used_length) {
+        error_report("%s request overrun start=" RAM_ADDR_FMT " len="
+                     RAM_ADDR_FMT " blocklen=" RAM_ADDR_FMT,
+                     __func__, start, len, ramblock->used_length);
+        goto err;
+    }
+
+    struct RAMSrcPageRequest *new_entry =
+        g_malloc0(sizeof(struct RAMSrcPageRequest));
+    new_entry->rb = ramblock;
+    new_entry->offset = start;
+    new_entry->len = len;
+
+    memory_region_ref(ramblock->mr);
+    qemu_mutex_lock(&rs->src_page_req_mutex);
+    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
+    migration_make_urgent_request();
+    qemu_mutex_unlock(&rs->src_page_req_mutex);
+    rcu_read_unlock();
+
+    return 0;
+
+err:
+    rcu_read_unlock();
+    return -1;
+}
+
+/**
+ * ram_save_queue_prefetch: queue pages the destination expects to need
+ *
+ * These are only a hint: they are sent after the requests queued by
+ * ram_save_queue_pages(), rate limited like the background pages, and
+ * the oldest ones are dropped when too many are pending.
+ *
+ * Returns zero on success or negative on error
+ *
+ * @rbname: Name of the RAMBlock of the request
+ * @start: starting address from the start of the RAMBlock
+ * @len: length (in bytes) to send
+ */
+int ram_save_queue_prefetch(const char *rbname, ram_addr_t start,
+                            ram_addr_t len)
+{
+    struct RAMSrcPageRequest *new_entry, *old_entry = NULL;
+    RAMBlock *ramblock;
+    RAMState *rs = ram_state;
+
+    rcu_read_lock();
+    ramblock = qemu_ram_block_by_name(rbname);
+    if (!ramblock) {
+        error_report("%s no block '%s'", __func__, rbname);
+        goto err;
     }
-    trace_ram_save_queue_pages(ramblock->idstr, start, len);
-    if (start+len > ramblock->used_length) {
+    trace_ram_save_queue_prefetch(ramblock->idstr, start, len);
+    if (start + len > ramblock->used_length) {
         error_report("%s request overrun start=" RAM_ADDR_FMT " len="
                      RAM_ADDR_FMT " blocklen=" RAM_ADDR_FMT,
                      __func__, start, len, ramblock->used_length);
         goto err;
     }
 
-    struct RAMSrcPageRequest *new_entry =
-        g_malloc0(sizeof(struct RAMSrcPageRequest));
+    new_entry = g_new0(struct RAMSrcPageRequest, 1);
     new_entry->rb = ramblock;
     new_entry->offset = start;
     new_entry->len = len;
 
     memory_region_ref(ramblock->mr);
     qemu_mutex_lock(&rs->src_page_req_mutex);
-    QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
-    migration_make_urgent_request();
+    QSIMPLEQ_INSERT_TAIL(&rs->src_prefetch_requests, new_entry, next_req);
+    if (++rs->src_prefetch_count > RAM_PREFETCH_QUEUE_MAX) {
+        old_entry = QSIMPLEQ_FIRST(&rs->src_prefetch_requests);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+        rs->src_prefetch_count--;
+    }
     qemu_mutex_unlock(&rs->src_page_req_mutex);
+    if (old_entry) {
+        memory_region_unref(old_entry->rb->mr);
+        g_free(old_entry);
+    }
     rcu_read_unlock();
 
     return 0;
@@ -2536,6 +3762,77 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
  * @pss: data about the page we want to send
  * @last_stage: if we are at the completion stage
  */
+static bool ram_save_use_multifd(RAMState *rs)
+{
+    return !save_page_use_compression(rs) && migrate_use_multifd();
+}
+
+/*
+ * With multifd, zero pages are found by the send threads instead, unless
+ * zero-page-detection asks for the legacy behaviour.
+ */
+static bool save_zero_page_in_main_thread(RAMState *rs)
+{
+    switch (migrate_zero_page_detection()) {
+    case ZERO_PAGE_DETECTION_NONE:
+        return false;
+    case ZERO_PAGE_DETECTION_MULTIFD:
+        return !ram_save_use_multifd(rs);
+    default:
+        return true;
+    }
+}
+
+/**
+ * ram_save_mapped_ram_page: write a page to its place in a mapped-ram file
+ *
+ * Nothing goes into the stream itself: the page is written at its fixed
+ * offset, by a multifd channel if there are any, and the file bitmap
+ * records whether the file holds its contents.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_ram_page(RAMState *rs, RAMBlock *block,
+                                    ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    Error *local_err = NULL;
+
+    if (save_zero_page_in_main_thread(rs) &&
+        buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        /* The destination's RAM starts out zeroed */
+        clear_bit(page, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    if (ram_save_use_multifd(rs)) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
+    if (qio_channel_pwrite(qemu_file_get_ioc(rs->f), (char *)p,
+                           TARGET_PAGE_SIZE, block->pages_offset + offset,
+                           &local_err) != TARGET_PAGE_SIZE) {
+        if (!local_err) {
+            error_setg(&local_err, "Short write to migration file");
+        }
+        qemu_file_set_error_obj(rs->f, -EIO, local_err);
+        return -1;
+    }
+    set_bit(page, block->file_bmap);
+
+    qemu_update_position(rs->f, TARGET_PAGE_SIZE);
+    qemu_file_update_transfer(rs->f, TARGET_PAGE_SIZE);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
                                 bool last_stage)
 {
@@ -2547,29 +3844,35 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return res;
     }
 
+    if (migrate_mapped_ram()) {
+        return ram_save_mapped_ram_page(rs, block, offset);
+    }
+
     if (save_compress_page(rs, block, offset)) {
         return 1;
     }
 
-    res = save_zero_page(rs, block, offset);
-    if (res > 0) {
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
+    if (save_zero_page_in_main_thread(rs)) {
+        res = save_zero_page(rs, block, offset);
+        if (res > 0) {
+            /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+             * page would be stale
+             */
+            if (!save_page_use_compression(rs)) {
+                XBZRLE_cache_lock();
+                xbzrle_cache_zero_page(rs, block->offset + offset);
+                XBZRLE_cache_unlock();
+            }
+            ram_release_pages(block->idstr, offset, res);
+            return res;
         }
-        ram_release_pages(block->idstr, offset, res);
-        return res;
     }
 
     /*
      * do not use multifd for compression as the first page in the new
      * block should be posted out before sending the compressed page
      */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()) {
+    if (ram_save_use_multifd(rs)) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
@@ -2600,6 +3903,7 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
     int tmppages, pages = 0;
     size_t pagesize_bits =
         qemu_ram_pagesize(pss->block) >> TARGET_PAGE_BITS;
+    unsigned long start_page = pss->page;
 
     if (ramblock_is_ignored(pss->block)) {
         error_report("block %s should not be migrated !", pss->block->idstr);
@@ -2629,6 +3933,82 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss,
 
     /* The offset we leave with is the last one we looked at */
     pss->page--;
+
+    if (pss->write_fault) {
+        /*
+         * Let the blocked guest write go ahead; pages may have been
+         * queued without copying them, so flush them out first.
+         */
+        qemu_fflush(rs->f);
+        pss->write_fault = false;
+        if (ram_write_tracking_unprotect(pss->block,
+                                         start_page << TARGET_PAGE_BITS,
+                                         (pss->page + 1 - start_page) <<
+                                         TARGET_PAGE_BITS)) {
+            return -1;
+        }
+    }
+    return pages;
+}
+
+/*
+ * Returns the postcopy preempt channel if urgent pages should be sent on
+ * it, NULL to send them on the main channel.
+ */
+static QEMUFile *postcopy_preempt_file(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    if (!migrate_postcopy_preempt() || !migration_in_postcopy() ||
+        !s->postcopy_qemufile_src ||
+        qemu_file_get_error(s->postcopy_qemufile_src)) {
+        return NULL;
+    }
+    return s->postcopy_qemufile_src;
+}
+
+/**
+ * ram_save_urgent_host_page: send a page requested by the destination
+ *
+ * The page goes out on the postcopy preempt channel and is flushed
+ * right away, so that it does not wait behind the background pages
+ * queued on the main channel.
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ * @last_stage: if we are at the completion stage
+ * @f: postcopy preempt channel
+ */
+static int ram_save_urgent_host_page(RAMState *rs, PageSearchStatus *pss,
+                                     bool last_stage, QEMUFile *f)
+{
+    QEMUFile *main_f = rs->f;
+    RAMBlock *main_last_block = rs->last_sent_block;
+    int pages, ret;
+
+    /* Each channel has its own RAM_SAVE_FLAG_CONTINUE state */
+    rs->f = f;
+    rs->last_sent_block = rs->last_preempt_block;
+    pages = ram_save_host_page(rs, pss, last_stage);
+    qemu_fflush(f);
+    rs->last_preempt_block = rs->last_sent_block;
+    rs->f = main_f;
+    rs->last_sent_block = main_last_block;
+
+    ret = qemu_file_get_error(f);
+    if (ret) {
+        /*
+         * The page is no longer dirty but may not have reached the
+         * destination.  Fail the main channel too, so that postcopy
+         * pauses and recovery resends whatever was lost; from then on
+         * the main channel is used for everything.
+         */
+        error_report("Postcopy preempt channel failed: %s", strerror(-ret));
+        qemu_file_set_error(main_f, ret);
+        return ret;
+    }
     return pages;
 }
 
@@ -2661,6 +4041,7 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
     pss.block = rs->last_seen_block;
     pss.page = rs->last_page;
     pss.complete_round = false;
+    pss.write_fault = false;
 
     if (!pss.block) {
         pss.block = QLIST_FIRST_RCU(&ram_list.blocks);
@@ -2670,8 +4051,20 @@ static int ram_find_and_save_block(RAMState *rs, bool last_stage)
         again = true;
         found = get_queued_page(rs, &pss);
 
+        if (found) {
+            QEMUFile *preempt_f = postcopy_preempt_file();
+
+            if (preempt_f) {
+                pages = ram_save_urgent_host_page(rs, &pss, last_stage,
+                                                  preempt_f);
+                break;
+            }
+        } else {
+            found = get_prefetch_page(rs, &pss);
+        }
+
         if (!found) {
-            /* priority queue empty, so just search for something dirty */
+            /* priority queues empty, so just search for something dirty */
             found = find_dirty_block(rs, &pss, &again);
         }
 
@@ -2769,7 +4162,9 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against the migration bitmap
      */
-    memory_global_dirty_log_stop();
+    if (!migrate_background_snapshot()) {
+        memory_global_dirty_log_stop();
+    }
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
         g_free(block->clear_bmap);
@@ -2780,8 +4175,15 @@ static void ram_save_cleanup(void *opaque)
         block->unsentmap = NULL;
     }
 
+    /* Ignored blocks also get a (blank) place in a mapped-ram file */
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
+    }
+
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    bitmap_sync_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -3081,7 +4483,7 @@ int ram_postcopy_send_discard_bitmap(MigrationState *ms)
     rcu_read_lock();
 
     /* This should be our last sync, the src is now paused */
-    migration_bitmap_sync(rs);
+    migration_bitmap_sync(rs, false);
 
     /* Easiest way to make sure we don't resume in the middle of a host-page */
     rs->last_seen_block = NULL;
@@ -3235,6 +4637,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->src_prefetch_requests);
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -3298,8 +4701,19 @@ static void ram_init_bitmaps(RAMState *rs)
     rcu_read_lock();
 
     ram_list_init_bitmaps();
-    memory_global_dirty_log_start();
-    migration_bitmap_sync_precopy(rs);
+    /*
+     * A background snapshot saves every page once, as it was when the
+     * snapshot started; write protection takes care of that instead of
+     * dirty logging.
+     */
+    if (!migrate_background_snapshot()) {
+        memory_global_dirty_log_start();
+        /*
+         * The ramlist lock is taken after the iothread lock, keep
+         * holding it
+         */
+        migration_bitmap_sync_precopy(rs, false);
+    }
 
     rcu_read_unlock();
     qemu_mutex_unlock_ramlist();
@@ -3419,6 +4833,80 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
  * @f: QEMUFile where to send the data
  * @opaque: RAMState pointer
  */
+/*
+ * Layout of a RAM block in a mapped-ram file: a header right after the
+ * block's entry in the stream, and the bitmap and pages further on, at
+ * aligned offsets.  The stream carries on after the pages.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+/* version, page_size, bitmap_offset, pages_offset */
+#define MAPPED_RAM_HDR_SIZE (4 + 8 + 8 + 8)
+
+static int mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block,
+                                     Error **errp)
+{
+    unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    off_t header_offset;
+
+    header_offset = qemu_file_get_offset(f, errp);
+    if (header_offset < 0) {
+        return -1;
+    }
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = ROUND_UP(header_offset + MAPPED_RAM_HDR_SIZE,
+                                    MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+    block->pages_offset = ROUND_UP(block->bitmap_offset + bitmap_size,
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    /* Leave room for the bitmap and the pages; they are written in place */
+    return qemu_file_seek(f, block->pages_offset + block->used_length, errp);
+}
+
+/*
+ * Write the file bitmaps once all pages are in place, so that a file
+ * that is only partially written restores nothing.
+ */
+static int mapped_ram_write_bitmaps(RAMState *rs)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    Error *local_err = NULL;
+    RAMBlock *block;
+    int ret = 0;
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+        unsigned long *le_bitmap = bitmap_new(num_pages);
+        ssize_t written;
+
+        bitmap_to_le(le_bitmap, block->file_bmap, num_pages);
+        written = qio_channel_pwrite(ioc, (char *)le_bitmap, bitmap_size,
+                                     block->bitmap_offset, &local_err);
+        g_free(le_bitmap);
+        if (written != bitmap_size) {
+            if (!local_err) {
+                error_setg(&local_err, "Short write of the bitmap of %s",
+                           block->idstr);
+            }
+            qemu_file_set_error_obj(rs->f, -EIO, local_err);
+            ret = -EIO;
+            break;
+        }
+    }
+    rcu_read_unlock();
+
+    return ret;
+}
+
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
@@ -3437,6 +4925,16 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->f = f;
 
+    if (migrate_mapped_ram()) {
+        QIOChannel *ioc = qemu_file_get_ioc(f);
+
+        if (!ioc ||
+            !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+            error_report("Mapped-ram requires a seekable migration file");
+            return -1;
+        }
+    }
+
     rcu_read_lock();
 
     qemu_put_be64(f, ram_bytes_total_common(true) | RAM_SAVE_FLAG_MEM_SIZE);
@@ -3451,6 +4949,27 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         if (migrate_ignore_shared()) {
             qemu_put_be64(f, block->mr->addr);
         }
+        if (migrate_local_update()) {
+            qemu_put_byte(f, ramblock_is_local_update(block));
+            if (ramblock_is_local_update(block)) {
+                Error *local_err = NULL;
+
+                if (qemu_put_fd(f, block->fd, &local_err) < 0) {
+                    error_report_err(local_err);
+                    rcu_read_unlock();
+                    return -1;
+                }
+            }
+        }
+        if (migrate_mapped_ram()) {
+            Error *local_err = NULL;
+
+            if (mapped_ram_setup_ramblock(f, block, &local_err) < 0) {
+                error_report_err(local_err);
+                rcu_read_unlock();
+                return -1;
+            }
+        }
     }
 
     rcu_read_unlock();
@@ -3573,12 +5092,13 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 {
     RAMState **temp = opaque;
     RAMState *rs = *temp;
+    QEMUFile *preempt_f;
     int ret = 0;
 
     rcu_read_lock();
 
-    if (!migration_in_postcopy()) {
-        migration_bitmap_sync_precopy(rs);
+    if (!migration_in_postcopy() && !migrate_background_snapshot()) {
+        migration_bitmap_sync_precopy(rs, false);
     }
 
     ram_control_before_iterate(f, RAM_CONTROL_FINISH);
@@ -3606,9 +5126,19 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
     rcu_read_unlock();
 
     multifd_send_sync_main(rs);
+    if (!ret && migrate_mapped_ram()) {
+        ret = mapped_ram_write_bitmaps(rs);
+    }
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     qemu_fflush(f);
 
+    /* Let the destination's preempt thread finish too */
+    preempt_f = postcopy_preempt_file();
+    if (preempt_f) {
+        qemu_put_be64(preempt_f, RAM_SAVE_FLAG_EOS);
+        qemu_fflush(preempt_f);
+    }
+
     return ret;
 }
 
@@ -3623,11 +5153,11 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
-    if (!migration_in_postcopy() &&
+    if (!migration_in_postcopy() && !migrate_background_snapshot() &&
         remaining_size < max_size) {
         qemu_mutex_lock_iothread();
         rcu_read_lock();
-        migration_bitmap_sync_precopy(rs);
+        migration_bitmap_sync_precopy(rs, true);
         rcu_read_unlock();
         qemu_mutex_unlock_iothread();
         remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
@@ -3682,12 +5212,16 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
  *
  * Returns a pointer from within the RCU-protected ram_list.
  *
+ * @mis: the incoming migration state
  * @f: QEMUFile where to read the data from
  * @flags: Page flags (mostly to see if it's a continuation of previous block)
+ * @channel: the channel we're using, RAM_CHANNEL_*
  */
-static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
+static inline RAMBlock *ram_block_from_stream(MigrationIncomingState *mis,
+                                              QEMUFile *f, int flags,
+                                              int channel)
 {
-    static RAMBlock *block = NULL;
+    RAMBlock *block = mis->last_recv_block[channel];
     char id[256];
     uint8_t len;
 
@@ -3704,6 +5238,7 @@ static inline RAMBlock *ram_block_from_stream(QEMUFile *f, int flags)
     id[len] = 0;
 
     block = qemu_ram_block_by_name(id);
+    mis->last_recv_block[channel] = block;
     if (!block) {
         error_report("Can't find block %s", id);
         return NULL;
@@ -3742,9 +5277,10 @@ static inline void *colo_cache_from_block_offset(RAMBlock *block,
     /*
     * During colo checkpoint, we need bitmap of these migrated pages.
     * It help us to decide which pages in ram cache should be flushed
-    * into VM's RAM later.
+    * into VM's RAM later.  Multifd channels set bits concurrently.
     */
-    if (!test_and_set_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
+    if (!test_bit(offset >> TARGET_PAGE_BITS, block->bmap)) {
+        set_bit_atomic(offset >> TARGET_PAGE_BITS, block->bmap);
         ram_state->migration_dirty_pages++;
     }
     return block->colo_cache + offset;
@@ -4100,19 +5636,21 @@ int ram_postcopy_incoming_init(MigrationIncomingState *mis)
  *
  * Returns 0 for success or -errno in case of error
  *
- * Called in postcopy mode by ram_load().
+ * Called in postcopy mode by ram_load(), and by the postcopy preempt
+ * thread for the pages on the preempt channel.
  * rcu_read_lock is taken prior to this being called.
  *
  * @f: QEMUFile where to send the data
+ * @channel: the channel to use for loading, RAM_CHANNEL_*
  */
-static int ram_load_postcopy(QEMUFile *f)
+int ram_load_postcopy(QEMUFile *f, int channel)
 {
     int flags = 0, ret = 0;
     bool place_needed = false;
     bool matches_target_page_size = false;
     MigrationIncomingState *mis = migration_incoming_get_current();
     /* Temporary page that is later 'placed' */
-    void *postcopy_host_page = postcopy_get_tmp_page(mis);
+    void *postcopy_host_page = postcopy_get_tmp_page(mis, channel);
     void *last_host = NULL;
     bool all_zero = false;
 
@@ -4141,7 +5679,7 @@ static int ram_load_postcopy(QEMUFile *f)
         trace_ram_load_postcopy_loop((uint64_t)addr, flags);
         place_needed = false;
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE)) {
-            block = ram_block_from_stream(f, flags);
+            block = ram_block_from_stream(mis, f, flags, channel);
 
             host = host_from_ram_block_offset(block, addr);
             if (!host) {
@@ -4215,7 +5753,9 @@ static int ram_load_postcopy(QEMUFile *f)
             break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
-            multifd_recv_sync_main();
+            if (channel == RAM_CHANNEL_PRECOPY) {
+                multifd_recv_sync_main();
+            }
             break;
         default:
             error_report("Unknown combination of migration flags: %#x"
@@ -4298,6 +5838,200 @@ static void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+typedef struct {
+    QIOChannel *ioc;
+    RAMBlock *block;
+    unsigned long *bitmap;
+    /* Range of pages to load */
+    unsigned long start;
+    unsigned long end;
+    Error *err;
+    QemuThread thread;
+} MappedRamLoadJob;
+
+static int mapped_ram_pread_all(QIOChannel *ioc, uint8_t *buf, size_t len,
+                                off_t offset, Error **errp)
+{
+    while (len) {
+        ssize_t ret = qio_channel_pread(ioc, (char *)buf, len, offset, errp);
+
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            error_setg(errp, "Unexpected end of migration file at "
+                       "offset %lld", (long long int)offset);
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+/* Read every run of pages that the file holds straight into guest RAM */
+static void *mapped_ram_load_pages(void *opaque)
+{
+    MappedRamLoadJob *job = opaque;
+    RAMBlock *block = job->block;
+    unsigned long set, clear;
+
+    set = find_next_bit(job->bitmap, job->end, job->start);
+    while (set < job->end) {
+        ram_addr_t offset = (ram_addr_t)set << TARGET_PAGE_BITS;
+
+        clear = find_next_zero_bit(job->bitmap, job->end, set);
+        if (mapped_ram_pread_all(job->ioc, block->host + offset,
+                                 (clear - set) << TARGET_PAGE_BITS,
+                                 block->pages_offset + offset,
+                                 &job->err) < 0) {
+            break;
+        }
+        set = find_next_bit(job->bitmap, job->end, clear);
+    }
+    return NULL;
+}
+
+/*
+ * Take over the file or memfd backing @block on the source: the
+ * descriptor is received from the stream and mapped over the local
+ * memory of the block, whose old backing is then released.
+ */
+static int local_update_load_ramblock(QEMUFile *f, RAMBlock *block,
+                                      Error **errp)
+{
+    bool has_fd = qemu_get_byte(f);
+    struct stat st;
+    void *host;
+    int fd;
+
+    if (has_fd != ramblock_is_local_update(block)) {
+        error_setg(errp, "RAM block %s must be backed by a shared file or "
+                   "memfd on both sides for local-update", block->idstr);
+        return -1;
+    }
+    if (!has_fd) {
+        return 0;
+    }
+
+    fd = qemu_get_fd(f, errp);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < block->max_length) {
+        error_setg(errp, "Backing file of RAM block %s is too small",
+                   block->idstr);
+        close(fd);
+        return -1;
+    }
+
+    host = mmap(block->host, block->max_length, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0);
+    if (host == MAP_FAILED) {
+        error_setg_errno(errp, errno, "Unable to map RAM block %s",
+                         block->idstr);
+        close(fd);
+        return -1;
+    }
+
+    trace_local_update_load_ramblock(block->idstr, fd);
+    close(block->fd);
+    block->fd = fd;
+    return 0;
+}
+
+/*
+ * Load the pages of @block from a mapped-ram file.  With multifd, the
+ * block is split into one range per channel and the ranges are read
+ * in parallel; otherwise the main thread reads them all.  The stream
+ * then resumes after the pages of the block.
+ */
+static int mapped_ram_load_ramblock(QEMUFile *f, RAMBlock *block,
+                                    ram_addr_t length, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    unsigned long num_pages = length >> TARGET_PAGE_BITS;
+    size_t bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
+    int nr_jobs = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    MappedRamLoadJob *jobs;
+    unsigned long *le_bitmap, *bitmap;
+    uint32_t version;
+    uint64_t page_size;
+    int i, ret = 0;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    block->bitmap_offset = qemu_get_be64(f);
+    block->pages_offset = qemu_get_be64(f);
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_setg(errp, "Unsupported mapped-ram version %u for block %s",
+                   version, block->idstr);
+        return -1;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_setg(errp, "Mismatched mapped-ram page size for block %s: "
+                   "%" PRIu64 " != %d", block->idstr, page_size,
+                   (int)TARGET_PAGE_SIZE);
+        return -1;
+    }
+    if (!ioc || !qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_setg(errp, "Mapped-ram requires a seekable migration file");
+        return -1;
+    }
+
+    le_bitmap = bitmap_new(num_pages);
+    if (mapped_ram_pread_all(ioc, (uint8_t *)le_bitmap, bitmap_size,
+                             block->bitmap_offset, errp) < 0) {
+        g_free(le_bitmap);
+        return -1;
+    }
+    bitmap = bitmap_new(num_pages);
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+    g_free(le_bitmap);
+
+    jobs = g_new0(MappedRamLoadJob, nr_jobs);
+    for (i = 0; i < nr_jobs; i++) {
+        MappedRamLoadJob *job = &jobs[i];
+
+        job->ioc = ioc;
+        job->block = block;
+        job->bitmap = bitmap;
+        job->start = num_pages * i / nr_jobs;
+        job->end = num_pages * (i + 1) / nr_jobs;
+        if (nr_jobs > 1) {
+            qemu_thread_create(&job->thread, "mapped-ram-load",
+                               mapped_ram_load_pages, job,
+                               QEMU_THREAD_JOINABLE);
+        } else {
+            mapped_ram_load_pages(job);
+        }
+    }
+    for (i = 0; i < nr_jobs; i++) {
+        if (nr_jobs > 1) {
+            qemu_thread_join(&jobs[i].thread);
+        }
+        if (jobs[i].err) {
+            if (!ret) {
+                error_propagate(errp, jobs[i].err);
+                ret = -1;
+            } else {
+                error_free(jobs[i].err);
+            }
+        }
+    }
+    trace_mapped_ram_load_ramblock(block->idstr, nr_jobs,
+                                   bitmap_count_one(bitmap, num_pages));
+    g_free(jobs);
+    g_free(bitmap);
+
+    if (ret) {
+        return ret;
+    }
+    return qemu_file_seek(f, block->pages_offset + length, errp);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -4310,6 +6044,7 @@ static void colo_flush_ram_cache(void)
  */
 static int ram_load_precopy(QEMUFile *f)
 {
+    MigrationIncomingState *mis = migration_incoming_get_current();
     int flags = 0, ret = 0, invalid_flags = 0, len = 0;
     /* ADVISE is earlier, it shows the source has the postcopy capability on */
     bool postcopy_advised = postcopy_is_advised();
@@ -4337,7 +6072,8 @@ static int ram_load_precopy(QEMUFile *f)
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
                      RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(f, flags);
+            RAMBlock *block = ram_block_from_stream(mis, f, flags,
+                                                    RAM_CHANNEL_PRECOPY);
 
             /*
              * After going into COLO, we should load the Page into colo_cache.
@@ -4411,6 +6147,24 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_local_update()) {
+                        Error *local_err = NULL;
+
+                        if (local_update_load_ramblock(f, block,
+                                                       &local_err) < 0) {
+                            error_report_err(local_err);
+                            ret = -EINVAL;
+                        }
+                    }
+                    if (!ret && migrate_mapped_ram()) {
+                        Error *local_err = NULL;
+
+                        if (mapped_ram_load_ramblock(f, block, length,
+                                                     &local_err) < 0) {
+                            error_report_err(local_err);
+                            ret = -EINVAL;
+                        }
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -4496,7 +6250,7 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     rcu_read_lock();
 
     if (postcopy_running) {
-        ret = ram_load_postcopy(f);
+        ret = ram_load_postcopy(f, RAM_CHANNEL_PRECOPY);
     } else {
         ret = ram_load_precopy(f);
     }
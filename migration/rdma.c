@@ -73,12 +73,18 @@
  * Capabilities for negotiation.
  */
 #define RDMA_CAPABILITY_PIN_ALL 0x01
+/*
+ * Register whole RAM blocks once, with on-demand paging instead of
+ * pinning.  Implies the pin-all protocol (one rkey per block).
+ */
+#define RDMA_CAPABILITY_ODP     0x02
 
 /*
  * Add the other flags above to this list of known capabilities
  * as they are introduced.
  */
-static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL;
+static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL |
+                                     RDMA_CAPABILITY_ODP;
 
 #define CHECK_ERROR_STATE() \
     do { \
@@ -339,6 +345,8 @@ typedef struct RDMAContext {
     int current_chunk;
 
     bool pin_all;
+    /* pin_all, but the blocks are registered with IBV_ACCESS_ON_DEMAND */
+    bool odp;
 
     /*
      * infiniband-specific variables for opening the device
@@ -1113,19 +1121,44 @@ static int qemu_rdma_alloc_qp(RDMAContext *rdma)
     return 0;
 }
 
+/*
+ * Whether the device can fault in pages of an MR on demand, both for
+ * the local buffers of RDMA writes and as their target.
+ */
+static bool qemu_rdma_odp_supported(struct ibv_context *verbs)
+{
+#ifdef CONFIG_RDMA_ODP
+    struct ibv_device_attr_ex attr = { 0 };
+    uint32_t need = IBV_ODP_SUPPORT_SEND | IBV_ODP_SUPPORT_WRITE;
+
+    if (!verbs || ibv_query_device_ex(verbs, NULL, &attr)) {
+        return false;
+    }
+    return (attr.odp_caps.general_caps & IBV_ODP_SUPPORT) &&
+           (attr.odp_caps.per_transport_caps.rc_odp_caps & need) == need;
+#else
+    return false;
+#endif
+}
+
 static int qemu_rdma_reg_whole_ram_blocks(RDMAContext *rdma)
 {
     int i;
     RDMALocalBlocks *local = &rdma->local_ram_blocks;
+    int access = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE;
+
+#ifdef CONFIG_RDMA_ODP
+    if (rdma->odp) {
+        access |= IBV_ACCESS_ON_DEMAND;
+    }
+#endif
 
     for (i = 0; i < local->nb_blocks; i++) {
         local->block[i].mr =
             ibv_reg_mr(rdma->pd,
                     local->block[i].local_host_addr,
                     local->block[i].length,
-                    IBV_ACCESS_LOCAL_WRITE |
-                    IBV_ACCESS_REMOTE_WRITE
-                    );
+                    access);
         if (!local->block[i].mr) {
             perror("Failed to register local dest ram block!\n");
             break;
@@ -2477,6 +2510,13 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
         trace_qemu_rdma_connect_pin_all_requested();
         cap.flags |= RDMA_CAPABILITY_PIN_ALL;
     }
+    /*
+     * On-demand paging needs no user opt-in: it gets the speed of pin-all
+     * without its memory cost, so ask for it whenever the device can.
+     */
+    if (qemu_rdma_odp_supported(rdma->verbs)) {
+        cap.flags |= RDMA_CAPABILITY_ODP;
+    }
 
     caps_to_network(&cap);
 
@@ -2522,7 +2562,13 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
         rdma->pin_all = false;
     }
 
+    if (cap.flags & RDMA_CAPABILITY_ODP) {
+        rdma->odp = true;
+        rdma->pin_all = true;
+    }
+
     trace_qemu_rdma_connect_pin_all_outcome(rdma->pin_all);
+    trace_qemu_rdma_odp_state(rdma->odp);
 
     rdma_ack_cm_event(cm_event);
 
@@ -2668,6 +2714,7 @@ static ssize_t qio_channel_rdma_writev(QIOChannel *ioc,
                                        size_t niov,
                                        int *fds,
                                        size_t nfds,
+                                       int flags,
                                        Error **errp)
 {
     QIOChannelRDMA *rioc = QIO_CHANNEL_RDMA(ioc);
@@ -3318,7 +3365,18 @@ static int qemu_rdma_accept(RDMAContext *rdma)
 
     rdma_ack_cm_event(cm_event);
 
+    /* The source only asks for ODP if its own device supports it */
+    if (cap.flags & RDMA_CAPABILITY_ODP) {
+        if (qemu_rdma_odp_supported(verbs)) {
+            rdma->odp = true;
+            rdma->pin_all = true;
+        } else {
+            cap.flags &= ~RDMA_CAPABILITY_ODP;
+        }
+    }
+
     trace_qemu_rdma_accept_pin_state(rdma->pin_all);
+    trace_qemu_rdma_odp_state(rdma->odp);
 
     caps_to_network(&cap);
 
@@ -89,6 +89,9 @@ enum qemu_vm_cmd {
 };
 
 #define MAX_VM_CMD_PACKAGED_SIZE UINT32_MAX
+
+/* Threads loading QEMU_VM_SECTION_BUFFERED sections, with the main thread */
+#define LOADVM_PARALLEL_THREADS 8
 static struct mig_cmd_args {
     ssize_t     len; /* -1 = variable */
     const char *name;
@@ -897,7 +900,8 @@ static void save_section_header(QEMUFile *f, SaveStateEntry *se,
     qemu_put_be32(f, se->section_id);
 
     if (section_type == QEMU_VM_SECTION_FULL ||
-        section_type == QEMU_VM_SECTION_START) {
+        section_type == QEMU_VM_SECTION_START ||
+        section_type == QEMU_VM_SECTION_BUFFERED) {
         /* ID string */
         size_t len = strlen(se->idstr);
         qemu_put_byte(f, len);
@@ -1309,7 +1313,38 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-static
+/*
+ * Write a QEMU_VM_SECTION_BUFFERED section: like QEMU_VM_SECTION_FULL, but
+ * with the length of the device state before it, so that the destination
+ * can queue the state for loading in another thread without parsing it.
+ */
+static int vmstate_save_buffered(QEMUFile *f, SaveStateEntry *se,
+                                 QJSON *vmdesc)
+{
+    QIOChannelBuffer *bioc;
+    QEMUFile *bf;
+    int ret;
+
+    bioc = qio_channel_buffer_new(4096);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-section-buffer");
+    bf = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    ret = vmstate_save(bf, se, vmdesc);
+    qemu_fflush(bf);
+    if (!ret) {
+        ret = qemu_file_get_error(bf);
+    }
+    if (!ret) {
+        save_section_header(f, se, QEMU_VM_SECTION_BUFFERED);
+        qemu_put_be32(f, bioc->usage);
+        qemu_put_buffer(f, bioc->data, bioc->usage);
+    }
+    qemu_fclose(bf);
+
+    return ret;
+}
+
 int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy,
                                                     bool inactivate_disks)
@@ -1338,8 +1373,13 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
         json_prop_str(vmdesc, "name", se->idstr);
         json_prop_int(vmdesc, "instance_id", se->instance_id);
 
-        save_section_header(f, se, QEMU_VM_SECTION_FULL);
-        ret = vmstate_save(f, se, vmdesc);
+        if (se->vmsd && se->vmsd->parallel_load &&
+            migrate_parallel_device_load()) {
+            ret = vmstate_save_buffered(f, se, vmdesc);
+        } else {
+            save_section_header(f, se, QEMU_VM_SECTION_FULL);
+            ret = vmstate_save(f, se, vmdesc);
+        }
         if (ret) {
             qemu_file_set_error(f, ret);
             return ret;
@@ -2206,8 +2246,11 @@ static bool check_section_footer(QEMUFile *f, SaveStateEntry *se)
     return true;
 }
 
-static int
-qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+/*
+ * Read the header of a QEMU_VM_SECTION_START, QEMU_VM_SECTION_FULL or
+ * QEMU_VM_SECTION_BUFFERED section and look up its handler.
+ */
+static int qemu_loadvm_section_header(QEMUFile *f, SaveStateEntry **pse)
 {
     uint32_t instance_id, version_id, section_id;
     SaveStateEntry *se;
@@ -2258,16 +2301,203 @@ qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
         return -EINVAL;
     }
 
+    *pse = se;
+    return 0;
+}
+
+static int
+qemu_loadvm_section_start_full(QEMUFile *f, MigrationIncomingState *mis)
+{
+    SaveStateEntry *se;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = vmstate_load(f, se);
     if (ret < 0) {
         error_report("error while loading state for instance 0x%x of"
-                     " device '%s'", instance_id, idstr);
+                     " device '%s'", se->instance_id, se->idstr);
+        return ret;
+    }
+    if (!check_section_footer(f, se)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+typedef struct LoadvmParallelSection {
+    SaveStateEntry *se;
+    QEMUFile *f;
+    int ret;
+} LoadvmParallelSection;
+
+/*
+ * QEMU_VM_SECTION_BUFFERED sections queued for loading in parallel.  They
+ * all have the same priority; a section of another priority, or any other
+ * kind of section, waits until the queued ones are loaded.
+ */
+typedef struct LoadvmParallel {
+    /* Element type: LoadvmParallelSection */
+    GPtrArray *sections;
+    MigrationPriority priority;
+    /* Index of the next section to be picked by a thread */
+    unsigned int next;
+} LoadvmParallel;
+
+static bool loadvm_section_parallel(SaveStateEntry *se)
+{
+    return migrate_parallel_device_load() &&
+           se->vmsd && se->vmsd->parallel_load &&
+           se->load_version_id >= se->vmsd->minimum_version_id &&
+           se->load_version_id <= se->vmsd->version_id;
+}
+
+static void *loadvm_parallel_thread(void *opaque)
+{
+    LoadvmParallel *lp = opaque;
+    unsigned int i;
+
+    while ((i = atomic_fetch_inc(&lp->next)) < lp->sections->len) {
+        LoadvmParallelSection *ps = g_ptr_array_index(lp->sections, i);
+        SaveStateEntry *se = ps->se;
+
+        ps->ret = vmstate_load_state_fields(ps->f, se->vmsd, se->opaque,
+                                            se->load_version_id);
+    }
+
+    return NULL;
+}
+
+/*
+ * Load the queued sections, then call their post_load hooks in the main
+ * thread, in stream order.
+ */
+static int loadvm_parallel_finish(LoadvmParallel *lp)
+{
+    unsigned int nr = lp->sections->len;
+    unsigned int nr_threads = MIN(nr, LOADVM_PARALLEL_THREADS) - 1;
+    QemuThread *threads;
+    unsigned int i;
+    int ret = 0;
+
+    if (!nr) {
+        return 0;
+    }
+
+    threads = g_new(QemuThread, nr_threads);
+    lp->next = 0;
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&threads[i], "loadvm-device",
+                           loadvm_parallel_thread, lp, QEMU_THREAD_JOINABLE);
+    }
+    loadvm_parallel_thread(lp);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    g_free(threads);
+    trace_loadvm_parallel_finish(nr, nr_threads + 1);
+
+    for (i = 0; i < nr; i++) {
+        LoadvmParallelSection *ps = g_ptr_array_index(lp->sections, i);
+        SaveStateEntry *se = ps->se;
+
+        if (!ret) {
+            ret = ps->ret;
+            if (!ret && se->vmsd->post_load) {
+                ret = se->vmsd->post_load(se->opaque, se->load_version_id);
+            }
+            if (ret < 0) {
+                error_report("error while loading state for instance 0x%x of"
+                             " device '%s'", se->instance_id, se->idstr);
+            }
+        }
+        qemu_fclose(ps->f);
+        g_free(ps);
+    }
+    g_ptr_array_set_size(lp->sections, 0);
+
+    return ret;
+}
+
+static int
+qemu_loadvm_section_buffered(QEMUFile *f, MigrationIncomingState *mis,
+                             LoadvmParallel *lp)
+{
+    LoadvmParallelSection *ps;
+    QIOChannelBuffer *bioc;
+    SaveStateEntry *se;
+    QEMUFile *bf;
+    uint32_t length;
+    int ret;
+
+    ret = qemu_loadvm_section_header(f, &se);
+    if (ret < 0) {
         return ret;
     }
+
+    length = qemu_get_be32(f);
+    trace_qemu_loadvm_state_section_buffered(se->idstr, length);
+
+    bioc = qio_channel_buffer_new(length);
+    qio_channel_set_name(QIO_CHANNEL(bioc), "migration-section-buffer");
+    ret = qemu_get_buffer(f, bioc->data, length);
+    if (ret != length) {
+        object_unref(OBJECT(bioc));
+        error_report("%s: Section receive fail ret=%d length=%u",
+                     se->idstr, ret, length);
+        return (ret < 0) ? ret : -EINVAL;
+    }
+    bioc->usage = length;
+    bf = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
     if (!check_section_footer(f, se)) {
+        qemu_fclose(bf);
         return -EINVAL;
     }
 
+    if (!loadvm_section_parallel(se)) {
+        ret = loadvm_parallel_finish(lp);
+        if (!ret) {
+            ret = vmstate_load(bf, se);
+            if (ret < 0) {
+                error_report("error while loading state for instance 0x%x of"
+                             " device '%s'", se->instance_id, se->idstr);
+            }
+        }
+        qemu_fclose(bf);
+        return ret;
+    }
+
+    if (lp->sections->len && lp->priority != se->vmsd->priority) {
+        ret = loadvm_parallel_finish(lp);
+        if (ret < 0) {
+            qemu_fclose(bf);
+            return ret;
+        }
+    }
+
+    trace_vmstate_load(se->idstr, se->vmsd->name);
+    if (se->vmsd->pre_load) {
+        ret = se->vmsd->pre_load(se->opaque);
+        if (ret) {
+            error_report("error while loading state for instance 0x%x of"
+                         " device '%s'", se->instance_id, se->idstr);
+            qemu_fclose(bf);
+            return ret;
+        }
+    }
+
+    ps = g_new0(LoadvmParallelSection, 1);
+    ps->se = se;
+    ps->f = bf;
+    g_ptr_array_add(lp->sections, ps);
+    lp->priority = se->vmsd->priority;
+
     return 0;
 }
 
@@ -2426,6 +2656,7 @@ static bool postcopy_pause_incoming(MigrationIncomingState *mis)
 
 int qemu_loadvm_state_main(QEMUFile *f, MigrationIncomingState *mis)
 {
+    LoadvmParallel lp = { .sections = g_ptr_array_new() };
     uint8_t section_type;
     int ret = 0;
 
@@ -2439,6 +2670,14 @@ retry:
         }
 
         trace_qemu_loadvm_state_section(section_type);
+        if (section_type != QEMU_VM_SECTION_BUFFERED) {
+            /* Anything else may depend on the queued device state */
+            ret = loadvm_parallel_finish(&lp);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
         switch (section_type) {
         case QEMU_VM_SECTION_START:
         case QEMU_VM_SECTION_FULL:
@@ -2454,6 +2693,12 @@ retry:
                 goto out;
             }
             break;
+        case QEMU_VM_SECTION_BUFFERED:
+            ret = qemu_loadvm_section_buffered(f, mis, &lp);
+            if (ret < 0) {
+                goto out;
+            }
+            break;
         case QEMU_VM_COMMAND:
             ret = loadvm_process_command(f);
             trace_qemu_loadvm_state_section_command(ret);
@@ -2472,6 +2717,9 @@ retry:
     }
 
 out:
+    /* Only sections queued before an error are left */
+    loadvm_parallel_finish(&lp);
+
     if (ret < 0) {
         qemu_file_set_error(f, ret);
 
@@ -2489,6 +2737,7 @@ out:
             goto retry;
         }
     }
+    g_ptr_array_free(lp.sections, true);
     return ret;
 }
 
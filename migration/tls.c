@@ -102,6 +102,7 @@ void migration_tls_channel_process_incoming(MigrationState *s,
 
     trace_migration_tls_incoming_handshake_start();
     qio_channel_set_name(QIO_CHANNEL(tioc), "migration-tls-incoming");
+    qio_channel_tls_set_kernel_offload(tioc, true);
     qio_channel_tls_handshake(tioc,
                               migration_tls_incoming_handshake,
                               NULL,
@@ -157,6 +158,8 @@ void migration_tls_channel_connect(MigrationState *s,
 
     trace_migration_tls_outgoing_handshake_start(hostname);
     qio_channel_set_name(QIO_CHANNEL(tioc), "migration-tls-outgoing");
+    /* The bulk of the stream then skips the userspace TLS code */
+    qio_channel_tls_set_kernel_offload(tioc, true);
     qio_channel_tls_handshake(tioc,
                               migration_tls_outgoing_handshake,
                               s,
@@ -78,7 +78,6 @@ static void vmstate_handle_alloc(void *ptr, const VMStateField *field,
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
-    const VMStateField *field = vmsd->fields;
     int ret = 0;
 
     trace_vmstate_load_state(vmsd->name, version_id);
@@ -108,6 +107,27 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
             return ret;
         }
     }
+    ret = vmstate_load_state_fields(f, vmsd, opaque, version_id);
+    if (ret != 0) {
+        return ret;
+    }
+    if (vmsd->post_load) {
+        ret = vmsd->post_load(opaque, version_id);
+    }
+    trace_vmstate_load_state_end(vmsd->name, "end", ret);
+    return ret;
+}
+
+/*
+ * Load the fields and subsections of @vmsd, without its pre_load and
+ * post_load hooks.  @version_id must already have been validated.
+ */
+int vmstate_load_state_fields(QEMUFile *f, const VMStateDescription *vmsd,
+                              void *opaque, int version_id)
+{
+    const VMStateField *field = vmsd->fields;
+    int ret = 0;
+
     while (field->name) {
         trace_vmstate_load_state_field(vmsd->name, field->name);
         if ((field->field_exists &&
@@ -160,15 +180,7 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
         }
         field++;
     }
-    ret = vmstate_subsection_load(f, vmsd, opaque);
-    if (ret != 0) {
-        return ret;
-    }
-    if (vmsd->post_load) {
-        ret = vmsd->post_load(opaque, version_id);
-    }
-    trace_vmstate_load_state_end(vmsd->name, "end", ret);
-    return ret;
+    return vmstate_subsection_load(f, vmsd, opaque);
 }
 
 static int vmfield_name_num(const VMStateField *start,
@@ -474,6 +474,42 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
 {
     dump_opcount_info();
 }
+
+static void hmp_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    const char *op = qdict_get_try_str(qdict, "op");
+
+    if (!tcg_enabled()) {
+        error_report("TB profiling is only available with accel=tcg");
+        return;
+    }
+    if (op == NULL) {
+        monitor_printf(mon, "tb-profile is %s\n",
+                       tb_profile_enabled ? "on" : "off");
+    } else if (!strcmp(op, "on")) {
+        tb_profile_enable(true);
+    } else if (!strcmp(op, "off")) {
+        tb_profile_enable(false);
+    } else if (!strcmp(op, "reset")) {
+        tb_profile_reset();
+    } else {
+        Error *err = NULL;
+
+        error_setg(&err, QERR_INVALID_PARAMETER, op);
+        hmp_handle_error(mon, &err);
+    }
+}
+
+static void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 10);
+
+    if (!tcg_enabled()) {
+        error_report("TB profiling is only available with accel=tcg");
+        return;
+    }
+    dump_tb_profile(max);
+}
 #endif
 
 static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
@@ -481,9 +517,16 @@ static void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
     int64_t max = qdict_get_try_int(qdict, "max", 10);
     bool mean = qdict_get_try_bool(qdict, "mean", false);
     bool coalesce = !qdict_get_try_bool(qdict, "no_coalesce", false);
+    bool hold = qdict_get_try_bool(qdict, "hold", false);
     enum QSPSortBy sort_by;
 
-    sort_by = mean ? QSP_SORT_BY_AVG_WAIT_TIME : QSP_SORT_BY_TOTAL_WAIT_TIME;
+    if (hold) {
+        sort_by = mean ? QSP_SORT_BY_AVG_HOLD_TIME :
+                         QSP_SORT_BY_TOTAL_HOLD_TIME;
+    } else {
+        sort_by = mean ? QSP_SORT_BY_AVG_WAIT_TIME :
+                         QSP_SORT_BY_TOTAL_WAIT_TIME;
+    }
     qsp_report(max, sort_by, coalesce);
 }
 
@@ -150,13 +150,18 @@ void monitor_flush(Monitor *mon)
     qemu_mutex_unlock(&mon->mon_lock);
 }
 
-/* flush at every end of line */
-int monitor_puts(Monitor *mon, const char *str)
+/*
+ * Flush at every end of line, and also when a long line has accumulated
+ * this much output, unless the chardev is already backed up.
+ */
+#define MONITOR_OUTBUF_FLUSH_SIZE 4096
+
+/* Caller must hold mon->mon_lock */
+int monitor_puts_locked(Monitor *mon, const char *str)
 {
     int i;
     char c;
 
-    qemu_mutex_lock(&mon->mon_lock);
     for (i = 0; str[i]; i++) {
         c = str[i];
         if (c == '\n') {
@@ -167,6 +172,20 @@ int monitor_puts(Monitor *mon, const char *str)
             monitor_flush_locked(mon);
         }
     }
+    if (!mon->out_watch &&
+        qstring_get_length(mon->outbuf) >= MONITOR_OUTBUF_FLUSH_SIZE) {
+        monitor_flush_locked(mon);
+    }
+
+    return i;
+}
+
+int monitor_puts(Monitor *mon, const char *str)
+{
+    int i;
+
+    qemu_mutex_lock(&mon->mon_lock);
+    i = monitor_puts_locked(mon, str);
     qemu_mutex_unlock(&mon->mon_lock);
 
     return i;
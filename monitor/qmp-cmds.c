@@ -18,6 +18,7 @@
 #include "qemu-version.h"
 #include "qemu/cutils.h"
 #include "qemu/option.h"
+#include "qemu/thread.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
 #include "qemu/config-file.h"
@@ -413,3 +414,75 @@ MemoryInfo *qmp_query_memory_size_summary(Error **errp)
 
     return mem_info;
 }
+
+static void qmp_sync_profile_entry(const QSPReportEntry *e, void *opaque)
+{
+    SyncProfileInfoList ***prev = opaque;
+    SyncProfileInfoList *elem = g_new0(SyncProfileInfoList, 1);
+    SyncProfileInfo *info = g_new0(SyncProfileInfo, 1);
+    int i;
+
+    info->type = g_strdup(e->typename);
+    info->call_site = g_strdup(e->callsite_at);
+    info->has_object = e->n_objs <= 1;
+    info->object = (uintptr_t)e->obj;
+    info->objects = MAX(e->n_objs, 1);
+    info->acquisitions = e->n_acqs;
+    info->wait_ns = e->wait_ns;
+    info->holds = e->n_holds;
+    info->hold_ns = e->hold_ns;
+    for (i = QSP_HOLD_HIST_BUCKETS - 1; i >= 0; i--) {
+        uint64List *bucket = g_new0(uint64List, 1);
+
+        bucket->value = e->hold_hist[i];
+        bucket->next = info->hold_histogram;
+        info->hold_histogram = bucket;
+    }
+
+    elem->value = info;
+    **prev = elem;
+    *prev = &elem->next;
+}
+
+SyncProfileInfoList *qmp_query_sync_profile(bool has_max, uint32_t max,
+                                            bool has_sort_by,
+                                            SyncProfileSortBy sort_by,
+                                            bool has_coalesce, bool coalesce,
+                                            bool has_reset, bool reset,
+                                            Error **errp)
+{
+    SyncProfileInfoList *head = NULL;
+    SyncProfileInfoList **prev = &head;
+    enum QSPSortBy qsp_sort_by;
+
+    if (!has_max) {
+        max = 10;
+    }
+    if (!has_coalesce) {
+        coalesce = true;
+    }
+
+    switch (has_sort_by ? sort_by : SYNC_PROFILE_SORT_BY_TOTAL_WAIT) {
+    case SYNC_PROFILE_SORT_BY_AVG_WAIT:
+        qsp_sort_by = QSP_SORT_BY_AVG_WAIT_TIME;
+        break;
+    case SYNC_PROFILE_SORT_BY_TOTAL_HOLD:
+        qsp_sort_by = QSP_SORT_BY_TOTAL_HOLD_TIME;
+        break;
+    case SYNC_PROFILE_SORT_BY_AVG_HOLD:
+        qsp_sort_by = QSP_SORT_BY_AVG_HOLD_TIME;
+        break;
+    default:
+        qsp_sort_by = QSP_SORT_BY_TOTAL_WAIT_TIME;
+        break;
+    }
+
+    if (max) {
+        qsp_report_iter(max, qsp_sort_by, coalesce,
+                        qmp_sync_profile_entry, &prev);
+    }
+    if (has_reset && reset) {
+        qsp_reset();
+    }
+    return head;
+}
@@ -82,18 +82,26 @@ static void monitor_qmp_cleanup_queues(MonitorQMP *mon)
     qemu_mutex_unlock(&mon->qmp_queue_lock);
 }
 
+static void qmp_send_response_write(void *opaque, const char *buf, size_t len)
+{
+    monitor_puts_locked(opaque, buf);
+}
+
 void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
 {
     const QObject *data = QOBJECT(rsp);
-    QString *json;
-
-    json = mon->pretty ? qobject_to_json_pretty(data) : qobject_to_json(data);
-    assert(json != NULL);
 
-    qstring_append_chr(json, '\n');
-    monitor_puts(&mon->common, qstring_get_str(json));
-
-    qobject_unref(json);
+    /*
+     * Serialize straight into the output buffer, which is flushed to the
+     * chardev as it fills, so that large replies need no full-size JSON
+     * copy.  Holding mon_lock throughout keeps responses and events sent
+     * from other threads from being interleaved with this one.
+     */
+    qemu_mutex_lock(&mon->common.mon_lock);
+    qobject_to_json_stream(data, mon->pretty, qmp_send_response_write,
+                           &mon->common);
+    monitor_puts_locked(&mon->common, "\n");
+    qemu_mutex_unlock(&mon->common.mon_lock);
 }
 
 /*
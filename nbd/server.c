@@ -1507,11 +1507,18 @@ NBDExport *nbd_export_new(BlockDriverState *bs, uint64_t dev_offset,
     exp->description = g_strdup(desc);
     exp->nbdflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
+    /*
+     * All clients of an export go through the same BlockBackend: a write is
+     * only acknowledged once it has reached the block layer, and a flush
+     * covers every completed write regardless of the connection it came
+     * from.  That is exactly the consistency NBD_FLAG_CAN_MULTI_CONN asks
+     * for, for writable exports as well.
+     */
+    if (shared) {
+        exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
-        if (shared) {
-            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
-        }
     } else {
         exp->nbdflags |= (NBD_FLAG_SEND_TRIM | NBD_FLAG_SEND_WRITE_ZEROES |
                           NBD_FLAG_SEND_FAST_ZERO);
@@ -1540,6 +1547,10 @@ NBDExport *nbd_export_new(BlockDriverState *bs, uint64_t dev_offset,
             goto fail;
         }
 
+        if (bdrv_load_dirty_bitmap(bs, bm, errp) < 0) {
+            goto fail;
+        }
+
         if (readonly && bdrv_is_writable(bs) &&
             bdrv_dirty_bitmap_enabled(bm)) {
             error_setg(errp,
@@ -1705,6 +1716,84 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Whether the payload of read replies can be handed from the export to the
+ * client socket with sendfile(), without a copy through a bounce buffer.
+ * This needs a plain socket (no TLS) and a block graph without format or
+ * filter drivers that need to look at the data.
+ */
+static bool coroutine_fn nbd_can_sendfile(NBDClient *client)
+{
+    return client->ioc == QIO_CHANNEL(client->sioc) &&
+           blk_co_sendfile(client->exp->blk, 0, 0, client->sioc->fd) == 0;
+}
+
+/*
+ * Send the reply header in @iov followed by @size bytes of the export at
+ * @offset, using sendfile().  @data is only used if sendfile() stops working
+ * half-way and the rest must be read normally.  Once the header is out, a
+ * read error can no longer be reported to the client, so -EIO is returned
+ * and the connection gets dropped.
+ */
+static int coroutine_fn nbd_co_send_iov_sendfile(NBDClient *client,
+                                                 struct iovec *iov,
+                                                 unsigned niov,
+                                                 uint64_t offset,
+                                                 uint8_t *data, size_t size,
+                                                 Error **errp)
+{
+    NBDExport *exp = client->exp;
+    size_t progress = 0;
+    int ret;
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    qio_channel_set_cork(client->ioc, true);
+    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+
+    while (ret == 0 && progress < size) {
+        /*
+         * blk_aio_attached() must not reenter us while we wait for the
+         * block layer
+         */
+        client->send_coroutine = NULL;
+        ret = blk_co_sendfile(exp->blk, offset + exp->dev_offset + progress,
+                              size - progress, client->sioc->fd);
+        if (ret == -EAGAIN || ret > 0) {
+            client->send_coroutine = qemu_coroutine_self();
+            if (ret > 0) {
+                progress += ret;
+            } else {
+                qio_channel_yield(client->ioc, G_IO_OUT);
+            }
+            ret = 0;
+            continue;
+        }
+
+        trace_nbd_co_send_sendfile_fallback(offset + progress,
+                                            size - progress, ret);
+        ret = blk_pread(exp->blk, offset + exp->dev_offset + progress,
+                        data + progress, size - progress);
+        client->send_coroutine = qemu_coroutine_self();
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "reading from file failed");
+            ret = -EIO;
+            break;
+        }
+        ret = qio_channel_write_all(client->ioc, (char *)data + progress,
+                                    size - progress, errp) < 0 ? -EIO : 0;
+        progress = size;
+    }
+
+    qio_channel_set_cork(client->ioc, false);
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t handle)
 {
@@ -1759,12 +1848,17 @@ static int coroutine_fn nbd_co_send_structured_done(NBDClient *client,
     return nbd_co_send_iov(client, iov, 1, errp);
 }
 
+/*
+ * With @use_sendfile, the payload is sent straight from the export and
+ * @data is only a buffer for falling back to a normal read.
+ */
 static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                                                     uint64_t handle,
                                                     uint64_t offset,
                                                     void *data,
                                                     size_t size,
                                                     bool final,
+                                                    bool use_sendfile,
                                                     Error **errp)
 {
     NBDStructuredReadData chunk;
@@ -1780,6 +1874,10 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
                  sizeof(chunk) - sizeof(chunk.h) + size);
     stq_be_p(&chunk.offset, offset);
 
+    if (use_sendfile) {
+        return nbd_co_send_iov_sendfile(client, iov, 1, offset, data, size,
+                                        errp);
+    }
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
@@ -1816,6 +1914,7 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 uint64_t offset,
                                                 uint8_t *data,
                                                 size_t size,
+                                                bool use_sendfile,
                                                 Error **errp)
 {
     int ret = 0;
@@ -1856,15 +1955,17 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
         } else {
-            ret = blk_pread(exp->blk, offset + progress + exp->dev_offset,
-                            data + progress, pnum);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            if (!use_sendfile) {
+                ret = blk_pread(exp->blk, offset + progress + exp->dev_offset,
+                                data + progress, pnum);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
             }
             ret = nbd_co_send_structured_read(client, handle, offset + progress,
                                               data + progress, pnum, final,
-                                              errp);
+                                              use_sendfile, errp);
         }
 
         if (ret < 0) {
@@ -2207,6 +2308,7 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
 {
     int ret;
     NBDExport *exp = client->exp;
+    bool use_sendfile;
 
     assert(request->type == NBD_CMD_READ);
 
@@ -2219,28 +2321,44 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
         }
     }
 
+    use_sendfile = request->len && nbd_can_sendfile(client);
+
     if (client->structured_reply && !(request->flags & NBD_CMD_FLAG_DF) &&
         request->len)
     {
         return nbd_co_send_sparse_read(client, request->handle, request->from,
-                                       data, request->len, errp);
+                                       data, request->len, use_sendfile, errp);
     }
 
-    ret = blk_pread(exp->blk, request->from + exp->dev_offset, data,
-                    request->len);
-    if (ret < 0) {
-        return nbd_send_generic_reply(client, request->handle, ret,
-                                      "reading from file failed", errp);
+    if (!use_sendfile) {
+        ret = blk_pread(exp->blk, request->from + exp->dev_offset, data,
+                        request->len);
+        if (ret < 0) {
+            return nbd_send_generic_reply(client, request->handle, ret,
+                                          "reading from file failed", errp);
+        }
     }
 
     if (client->structured_reply) {
         if (request->len) {
             return nbd_co_send_structured_read(client, request->handle,
                                                request->from, data,
-                                               request->len, true, errp);
+                                               request->len, true,
+                                               use_sendfile, errp);
         } else {
             return nbd_co_send_structured_done(client, request->handle, errp);
         }
+    } else if (use_sendfile) {
+        NBDSimpleReply reply;
+        struct iovec iov[] = {
+            {.iov_base = &reply, .iov_len = sizeof(reply)},
+        };
+
+        trace_nbd_co_send_simple_reply(request->handle, 0,
+                                       nbd_err_lookup(0), request->len);
+        set_be_simple_reply(&reply, 0, request->handle);
+        return nbd_co_send_iov_sendfile(client, iov, 1, request->from, data,
+                                        request->len, errp);
     } else {
         return nbd_co_send_simple_reply(client, request->handle, 0,
                                         data, request->len, errp);
@@ -2478,6 +2596,12 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    /*
+     * Negotiation ran in the main loop; from now on, wait for requests in
+     * the AioContext of the export so that an I/O thread does not need the
+     * main loop for every request.
+     */
+    qio_channel_attach_aio_context(client->ioc, client->exp->ctx);
     nbd_client_receive_next_request(client);
 }
 
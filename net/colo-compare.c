@@ -15,8 +15,10 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/error-report.h"
+#include "qemu/crc32c.h"
 #include "trace.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "net/net.h"
 #include "net/eth.h"
 #include "qom/object_interfaces.h"
@@ -44,6 +46,7 @@ static NotifierList colo_compare_notifiers =
 
 #define COMPARE_READ_LEN_MAX NET_BUFSIZE
 #define MAX_QUEUE_SIZE 1024
+#define MAX_COMPARE_WORKERS 64
 
 #define COLO_COMPARE_FREE_PRIMARY     0x01
 #define COLO_COMPARE_FREE_SECONDARY   0x02
@@ -76,6 +79,10 @@ static int event_unhandled_count;
  *                    |primary |  |secondary    |primary | |secondary
  *                    |packet  |  |packet  +    |packet  | |packet  +
  *                    +--------+  +--------+    +--------+ +--------+
+ *
+ * The connections are sharded over the workers by the hash of their
+ * connection key.  With more than one worker, each of them compares its
+ * connections in a thread of its own.
  */
 typedef struct CompareState {
     Object parent;
@@ -93,13 +100,10 @@ typedef struct CompareState {
     SocketReadState notify_rs;
     bool vnet_hdr;
 
-    /*
-     * Record the connection that through the NIC
-     * Element type: Connection
-     */
-    GQueue conn_list;
-    /* Record the connection without repetition */
-    GHashTable *connection_track_table;
+    struct CompareWorker *workers;
+    uint32_t nr_workers;
+    /* Serializes the packets written to outdev and notify_dev */
+    QemuMutex out_lock;
 
     IOThread *iothread;
     GMainContext *worker_context;
@@ -120,6 +124,38 @@ enum {
     SECONDARY_IN,
 };
 
+typedef struct CompareJob {
+    Packet *pkt;
+    ConnectionKey key;
+    int mode;
+} CompareJob;
+
+/*
+ * Both copies of a connection always go to the same worker, so the
+ * connections of a worker are only ever touched under its conn_lock.
+ */
+typedef struct CompareWorker {
+    CompareState *s;
+    QemuThread thread;
+
+    /* Held while the connections are compared or flushed */
+    QemuMutex conn_lock;
+    /*
+     * Record the connection that through the NIC
+     * Element type: Connection
+     */
+    GQueue conn_list;
+    /* Record the connection without repetition */
+    GHashTable *connection_track_table;
+
+    /* Protects jobs and quit */
+    QemuMutex lock;
+    QemuCond cond;
+    /* Packets waiting for the worker thread, element type: CompareJob */
+    GQueue jobs;
+    bool quit;
+} CompareWorker;
+
 
 static int compare_chr_send(CompareState *s,
                             const uint8_t *buf,
@@ -185,6 +221,31 @@ static void fill_pkt_tcp_info(void *data, uint32_t *max_ack)
     pkt->flags = tcphd->th_flags;
 }
 
+/* Offset of the data compared for a non-TCP packet */
+static uint16_t colo_packet_compare_offset(Packet *pkt)
+{
+    switch (pkt->ip->ip_p) {
+    case IPPROTO_UDP:
+    case IPPROTO_ICMP:
+        return (pkt->ip->ip_hl << 2) + ETH_HLEN + pkt->vnet_hdr_len;
+    default:
+        return pkt->vnet_hdr_len;
+    }
+}
+
+/*
+ * The secondary list is searched for a packet matching each primary
+ * packet, so hash the compared data once and only memcmp() the packets
+ * whose hashes match.
+ */
+static void fill_pkt_payload_hash(Packet *pkt)
+{
+    uint16_t offset = colo_packet_compare_offset(pkt);
+
+    pkt->payload_hash = crc32c(0xffffffff, (uint8_t *)pkt->data + offset,
+                               pkt->size > offset ? pkt->size - offset : 0);
+}
+
 /*
  * Return 1 on success, if return 0 means the
  * packet will be dropped
@@ -199,6 +260,7 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
                                   (GCompareDataFunc)seq_sorter,
                                   NULL);
         } else {
+            fill_pkt_payload_hash(pkt);
             g_queue_push_tail(queue, pkt);
         }
         return 1;
@@ -207,38 +269,37 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
 }
 
 /*
- * Return 0 on success, if return -1 means the pkt
- * is unsupported(arp and ipv6) and will be sent later
+ * Return the packet just read from primary_in or secondary_in, or NULL
+ * if it is unsupported(arp and ipv6) and will be sent later
  */
-static int packet_enqueue(CompareState *s, int mode, Connection **con)
+static Packet *compare_packet_new(CompareState *s, int mode,
+                                  ConnectionKey *key)
 {
-    ConnectionKey key;
-    Packet *pkt = NULL;
-    Connection *conn;
-
-    if (mode == PRIMARY_IN) {
-        pkt = packet_new(s->pri_rs.buf,
-                         s->pri_rs.packet_len,
-                         s->pri_rs.vnet_hdr_len);
-    } else {
-        pkt = packet_new(s->sec_rs.buf,
-                         s->sec_rs.packet_len,
-                         s->sec_rs.vnet_hdr_len);
-    }
+    SocketReadState *rs = mode == PRIMARY_IN ? &s->pri_rs : &s->sec_rs;
+    Packet *pkt;
 
+    pkt = packet_new(rs->buf, rs->packet_len, rs->vnet_hdr_len);
     if (parse_packet_early(pkt)) {
         packet_destroy(pkt, NULL);
-        pkt = NULL;
-        return -1;
+        return NULL;
     }
-    fill_connection_key(pkt, &key);
+    fill_connection_key(pkt, key);
+
+    return pkt;
+}
+
+/* Called with w->conn_lock held */
+static void packet_enqueue(CompareWorker *w, Packet *pkt, ConnectionKey *key,
+                           int mode, Connection **con)
+{
+    Connection *conn;
 
-    conn = connection_get(s->connection_track_table,
-                          &key,
-                          &s->conn_list);
+    conn = connection_get(w->connection_track_table,
+                          key,
+                          &w->conn_list);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&w->conn_list, conn);
         conn->processing = true;
     }
 
@@ -254,8 +315,6 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         }
     }
     *con = conn;
-
-    return 0;
 }
 
 static inline bool after(uint32_t seq1, uint32_t seq2)
@@ -473,8 +532,7 @@ sec:
  */
 static int colo_packet_compare_udp(Packet *spkt, Packet *ppkt)
 {
-    uint16_t network_header_length = ppkt->ip->ip_hl << 2;
-    uint16_t offset = network_header_length + ETH_HLEN + ppkt->vnet_hdr_len;
+    uint16_t offset = colo_packet_compare_offset(ppkt);
 
     trace_colo_compare_main("compare udp");
 
@@ -492,7 +550,8 @@ static int colo_packet_compare_udp(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("UDP: payload size of packets are different");
         return -1;
     }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
+    if (ppkt->payload_hash != spkt->payload_hash ||
+        colo_compare_packet_payload(ppkt, spkt, offset, offset,
                                     ppkt->size - offset)) {
         trace_colo_compare_udp_miscompare("primary pkt size", ppkt->size);
         trace_colo_compare_udp_miscompare("Secondary pkt size", spkt->size);
@@ -514,8 +573,7 @@ static int colo_packet_compare_udp(Packet *spkt, Packet *ppkt)
  */
 static int colo_packet_compare_icmp(Packet *spkt, Packet *ppkt)
 {
-    uint16_t network_header_length = ppkt->ip->ip_hl << 2;
-    uint16_t offset = network_header_length + ETH_HLEN + ppkt->vnet_hdr_len;
+    uint16_t offset = colo_packet_compare_offset(ppkt);
 
     trace_colo_compare_main("compare icmp");
 
@@ -533,7 +591,8 @@ static int colo_packet_compare_icmp(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("ICMP: payload size of packets are different");
         return -1;
     }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
+    if (ppkt->payload_hash != spkt->payload_hash ||
+        colo_compare_packet_payload(ppkt, spkt, offset, offset,
                                     ppkt->size - offset)) {
         trace_colo_compare_icmp_miscompare("primary pkt size",
                                            ppkt->size);
@@ -557,7 +616,7 @@ static int colo_packet_compare_icmp(Packet *spkt, Packet *ppkt)
  */
 static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
 {
-    uint16_t offset = ppkt->vnet_hdr_len;
+    uint16_t offset = colo_packet_compare_offset(ppkt);
 
     trace_colo_compare_main("compare other");
     if (trace_event_get_state_backends(TRACE_COLO_COMPARE_MISCOMPARE)) {
@@ -577,6 +636,9 @@ static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("Other: payload size of packets are different");
         return -1;
     }
+    if (ppkt->payload_hash != spkt->payload_hash) {
+        return -1;
+    }
     return colo_compare_packet_payload(ppkt, spkt, offset, offset,
                                        ppkt->size - offset);
 }
@@ -630,13 +692,21 @@ static int colo_old_packet_check_one_conn(Connection *conn,
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    GList *result = NULL;
+    uint32_t i;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, s,
-                        (GCompareFunc)colo_old_packet_check_one_conn);
+    for (i = 0; i < s->nr_workers && !result; i++) {
+        CompareWorker *w = &s->workers[i];
+
+        qemu_mutex_lock(&w->conn_lock);
+        result = g_queue_find_custom(&w->conn_list, s,
+                            (GCompareFunc)colo_old_packet_check_one_conn);
+        qemu_mutex_unlock(&w->conn_lock);
+    }
 }
 
 static void colo_compare_packet(CompareState *s, Connection *conn,
@@ -711,6 +781,8 @@ static int compare_chr_send(CompareState *s,
         return 0;
     }
 
+    qemu_mutex_lock(&s->out_lock);
+
     if (notify_remote_frame) {
         ret = qemu_chr_fe_write_all(&s->chr_notify_dev,
                                     (uint8_t *)&len,
@@ -753,9 +825,11 @@ static int compare_chr_send(CompareState *s,
         goto err;
     }
 
+    qemu_mutex_unlock(&s->out_lock);
     return 0;
 
 err:
+    qemu_mutex_unlock(&s->out_lock);
     return ret < 0 ? ret : -EIO;
 }
 
@@ -864,7 +938,7 @@ static void colo_compare_timer_del(CompareState *s)
     }
  }
 
-static void colo_flush_packets(void *opaque, void *user_data);
+static void colo_compare_flush(CompareState *s);
 
 static void colo_compare_handle_event(void *opaque)
 {
@@ -872,7 +946,7 @@ static void colo_compare_handle_event(void *opaque)
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush(s);
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -969,6 +1043,39 @@ static void compare_set_vnet_hdr(Object *obj,
     s->vnet_hdr = value;
 }
 
+static void compare_get_workers(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->nr_workers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_workers(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (!value || value > MAX_COMPARE_WORKERS) {
+        error_setg(&local_err, "Property '%s.%s' must be between 1 and %d",
+                   object_get_typename(obj), name, MAX_COMPARE_WORKERS);
+        goto out;
+    }
+    s->nr_workers = value;
+
+out:
+    error_propagate(errp, local_err);
+}
+
 static char *compare_get_notify_dev(Object *obj, Error **errp)
 {
     CompareState *s = COLO_COMPARE(obj);
@@ -984,12 +1091,85 @@ static void compare_set_notify_dev(Object *obj, const char *value, Error **errp)
     s->notify_dev = g_strdup(value);
 }
 
+static void *colo_compare_worker_thread(void *opaque)
+{
+    CompareWorker *w = opaque;
+    GQueue jobs;
+    CompareJob *job;
+    Connection *conn;
+
+    while (true) {
+        qemu_mutex_lock(&w->lock);
+        while (g_queue_is_empty(&w->jobs) && !w->quit) {
+            qemu_cond_wait(&w->cond, &w->lock);
+        }
+        if (w->quit) {
+            qemu_mutex_unlock(&w->lock);
+            break;
+        }
+        qemu_mutex_unlock(&w->lock);
+
+        /*
+         * Take the jobs with conn_lock held, so that a checkpoint flush
+         * finds every packet either still queued or in a connection.
+         */
+        qemu_mutex_lock(&w->conn_lock);
+        qemu_mutex_lock(&w->lock);
+        jobs = w->jobs;
+        g_queue_init(&w->jobs);
+        qemu_mutex_unlock(&w->lock);
+
+        while ((job = g_queue_pop_head(&jobs))) {
+            packet_enqueue(w, job->pkt, &job->key, job->mode, &conn);
+            /* compare packet in the specified connection */
+            colo_compare_connection(conn, w->s);
+            g_free(job);
+        }
+        qemu_mutex_unlock(&w->conn_lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Hand a packet to the worker owning its connection, or compare it right
+ * away in the iothread if there is only one worker.
+ */
+static void colo_compare_dispatch(CompareState *s, Packet *pkt,
+                                  ConnectionKey *key, int mode)
+{
+    CompareWorker *w = &s->workers[connection_key_hash(key) % s->nr_workers];
+    Connection *conn = NULL;
+    CompareJob *job;
+
+    if (s->nr_workers == 1) {
+        qemu_mutex_lock(&w->conn_lock);
+        packet_enqueue(w, pkt, key, mode, &conn);
+        /* compare packet in the specified connection */
+        colo_compare_connection(conn, s);
+        qemu_mutex_unlock(&w->conn_lock);
+        return;
+    }
+
+    job = g_new(CompareJob, 1);
+    job->pkt = pkt;
+    job->key = *key;
+    job->mode = mode;
+
+    qemu_mutex_lock(&w->lock);
+    g_queue_push_tail(&w->jobs, job);
+    qemu_cond_signal(&w->cond);
+    qemu_mutex_unlock(&w->lock);
+}
+
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
-    Connection *conn = NULL;
+    ConnectionKey key;
+    Packet *pkt;
 
-    if (packet_enqueue(s, PRIMARY_IN, &conn)) {
+    pkt = compare_packet_new(s, PRIMARY_IN, &key);
+    if (!pkt) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
                          pri_rs->buf,
@@ -997,21 +1177,21 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
                          pri_rs->vnet_hdr_len,
                          false);
     } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_dispatch(s, pkt, &key, PRIMARY_IN);
     }
 }
 
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
-    Connection *conn = NULL;
+    ConnectionKey key;
+    Packet *pkt;
 
-    if (packet_enqueue(s, SECONDARY_IN, &conn)) {
+    pkt = compare_packet_new(s, SECONDARY_IN, &key);
+    if (!pkt) {
         trace_colo_compare_main("secondary: unsupported packet in");
     } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_dispatch(s, pkt, &key, SECONDARY_IN);
     }
 }
 
@@ -1033,7 +1213,7 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush(s);
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1077,6 +1257,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
 {
     CompareState *s = COLO_COMPARE(uc);
     Chardev *chr;
+    uint32_t i;
 
     if (!s->pri_indev || !s->sec_indev || !s->outdev || !s->iothread) {
         error_setg(errp, "colo compare needs 'primary_in' ,"
@@ -1121,15 +1302,32 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
 
     QTAILQ_INSERT_TAIL(&net_compares, s, next);
 
-    g_queue_init(&s->conn_list);
-
     qemu_mutex_init(&event_mtx);
     qemu_cond_init(&event_complete_cond);
 
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      connection_destroy);
+    s->workers = g_new0(CompareWorker, s->nr_workers);
+    for (i = 0; i < s->nr_workers; i++) {
+        CompareWorker *w = &s->workers[i];
+
+        w->s = s;
+        qemu_mutex_init(&w->conn_lock);
+        g_queue_init(&w->conn_list);
+        w->connection_track_table = g_hash_table_new_full(connection_key_hash,
+                                                          connection_key_equal,
+                                                          g_free,
+                                                          connection_destroy);
+        qemu_mutex_init(&w->lock);
+        qemu_cond_init(&w->cond);
+        g_queue_init(&w->jobs);
+
+        if (s->nr_workers > 1) {
+            char *name = g_strdup_printf("colo-compare-%u", i);
+
+            qemu_thread_create(&w->thread, name, colo_compare_worker_thread,
+                               w, QEMU_THREAD_JOINABLE);
+            g_free(name);
+        }
+    }
 
     colo_compare_iothread(s);
     return;
@@ -1156,6 +1354,40 @@ static void colo_flush_packets(void *opaque, void *user_data)
     }
 }
 
+/* Release the primary packets of all workers and drop the secondary ones */
+static void colo_compare_flush(CompareState *s)
+{
+    GQueue jobs;
+    CompareJob *job;
+    uint32_t i;
+
+    for (i = 0; i < s->nr_workers; i++) {
+        CompareWorker *w = &s->workers[i];
+
+        qemu_mutex_lock(&w->conn_lock);
+        g_queue_foreach(&w->conn_list, colo_flush_packets, s);
+
+        /* Packets not compared yet are newer than those in conn_list */
+        qemu_mutex_lock(&w->lock);
+        jobs = w->jobs;
+        g_queue_init(&w->jobs);
+        qemu_mutex_unlock(&w->lock);
+
+        while ((job = g_queue_pop_head(&jobs))) {
+            if (job->mode == PRIMARY_IN) {
+                compare_chr_send(s,
+                                 job->pkt->data,
+                                 job->pkt->size,
+                                 job->pkt->vnet_hdr_len,
+                                 false);
+            }
+            packet_destroy(job->pkt, NULL);
+            g_free(job);
+        }
+        qemu_mutex_unlock(&w->conn_lock);
+    }
+}
+
 static void colo_compare_class_init(ObjectClass *oc, void *data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
@@ -1188,12 +1420,20 @@ static void colo_compare_init(Object *obj)
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr, NULL);
+
+    s->nr_workers = 1;
+    object_property_add(obj, "workers", "uint32",
+                        compare_get_workers, compare_set_workers,
+                        NULL, NULL, NULL);
+
+    qemu_mutex_init(&s->out_lock);
 }
 
 static void colo_compare_finalize(Object *obj)
 {
     CompareState *s = COLO_COMPARE(obj);
     CompareState *tmp = NULL;
+    uint32_t i;
 
     qemu_chr_fe_deinit(&s->chr_pri_in, false);
     qemu_chr_fe_deinit(&s->chr_sec_in, false);
@@ -1215,13 +1455,30 @@ static void colo_compare_finalize(Object *obj)
         }
     }
 
-    /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    if (s->workers) {
+        for (i = 0; s->nr_workers > 1 && i < s->nr_workers; i++) {
+            CompareWorker *w = &s->workers[i];
 
-    g_queue_clear(&s->conn_list);
+            qemu_mutex_lock(&w->lock);
+            w->quit = true;
+            qemu_cond_signal(&w->cond);
+            qemu_mutex_unlock(&w->lock);
+            qemu_thread_join(&w->thread);
+        }
 
-    if (s->connection_track_table) {
-        g_hash_table_destroy(s->connection_track_table);
+        /* Release all unhandled packets after compare thead exited */
+        colo_compare_flush(s);
+
+        for (i = 0; i < s->nr_workers; i++) {
+            CompareWorker *w = &s->workers[i];
+
+            g_queue_clear(&w->conn_list);
+            g_hash_table_destroy(w->connection_track_table);
+            qemu_mutex_destroy(&w->conn_lock);
+            qemu_mutex_destroy(&w->lock);
+            qemu_cond_destroy(&w->cond);
+        }
+        g_free(s->workers);
     }
 
     if (s->iothread) {
@@ -1230,6 +1487,7 @@ static void colo_compare_finalize(Object *obj)
 
     qemu_mutex_destroy(&event_mtx);
     qemu_cond_destroy(&event_complete_cond);
+    qemu_mutex_destroy(&s->out_lock);
 
     g_free(s->pri_indev);
     g_free(s->sec_indev);
@@ -54,6 +54,8 @@ typedef struct Packet {
     /* record the payload offset(the length that has been compared) */
     uint16_t offset;
     uint8_t flags; /* Flags(aka Control bits) */
+    /* crc32c of the compared data, for non-TCP packets in colo-compare */
+    uint32_t payload_hash;
 } Packet;
 
 typedef struct ConnectionKey {
@@ -23,6 +23,7 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/iov.h"
 #include "qemu/queue.h"
 #include "net/net.h"
 
@@ -38,14 +39,40 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Queued packets normally carry a copy of the payload.  Packets sent
+ * with QEMU_NET_PACKET_FLAG_NOCOPY and a sent callback only carry a copy
+ * of the iovec array; the sender keeps the buffers alive until the
+ * callback runs.
+ *
+ * Packets are allocated from per-queue free lists of a few size classes,
+ * so that a backlog building up and draining does not hit the allocator
+ * for every packet.
  */
 
+static const struct {
+    size_t size;
+    unsigned max_free;
+} net_packet_class[] = {
+    { 2048, 256 },              /* MTU sized frames, iovec arrays */
+    { 16384, 32 },              /* jumbo frames */
+    { NET_BUFSIZE, 8 },         /* GSO frames */
+};
+
+#define NET_PACKET_CLASSES ARRAY_SIZE(net_packet_class)
+
 struct NetPacket {
     QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
+    /* Index in net_packet_class, NET_PACKET_CLASSES if not pooled */
+    unsigned size_class;
+    /* Either &data_iov, or an array stored in data for NOCOPY packets */
+    struct iovec *iov;
+    int iovcnt;
+    struct iovec data_iov;
     uint8_t data[0];
 };
 
@@ -56,6 +83,8 @@ struct NetQueue {
     NetQueueDeliverFunc *deliver;
 
     QTAILQ_HEAD(, NetPacket) packets;
+    QTAILQ_HEAD(, NetPacket) free_packets[NET_PACKET_CLASSES];
+    unsigned nr_free_packets[NET_PACKET_CLASSES];
 
     unsigned delivering : 1;
 };
@@ -63,6 +92,7 @@ struct NetQueue {
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 {
     NetQueue *queue;
+    int i;
 
     queue = g_new0(NetQueue, 1);
 
@@ -72,6 +102,9 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->deliver = deliver;
 
     QTAILQ_INIT(&queue->packets);
+    for (i = 0; i < NET_PACKET_CLASSES; i++) {
+        QTAILQ_INIT(&queue->free_packets[i]);
+    }
 
     queue->delivering = 0;
 
@@ -81,36 +114,61 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
+    int i;
 
     QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         g_free(packet);
     }
 
+    for (i = 0; i < NET_PACKET_CLASSES; i++) {
+        QTAILQ_FOREACH_SAFE(packet, &queue->free_packets[i], entry, next) {
+            QTAILQ_REMOVE(&queue->free_packets[i], packet, entry);
+            g_free(packet);
+        }
+    }
+
     g_free(queue);
 }
 
-static void qemu_net_queue_append(NetQueue *queue,
-                                  NetClientState *sender,
-                                  unsigned flags,
-                                  const uint8_t *buf,
-                                  size_t size,
-                                  NetPacketSent *sent_cb)
+/* Get a packet with room for @size bytes of data */
+static NetPacket *qemu_net_packet_alloc(NetQueue *queue, size_t size)
 {
     NetPacket *packet;
+    unsigned i;
 
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
+    for (i = 0; i < NET_PACKET_CLASSES; i++) {
+        if (size <= net_packet_class[i].size) {
+            break;
+        }
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
-    packet->sender = sender;
-    packet->flags = flags;
-    packet->size = size;
-    packet->sent_cb = sent_cb;
-    memcpy(packet->data, buf, size);
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    if (i == NET_PACKET_CLASSES) {
+        packet = g_malloc(sizeof(NetPacket) + size);
+    } else if (QTAILQ_EMPTY(&queue->free_packets[i])) {
+        packet = g_malloc(sizeof(NetPacket) + net_packet_class[i].size);
+    } else {
+        packet = QTAILQ_FIRST(&queue->free_packets[i]);
+        QTAILQ_REMOVE(&queue->free_packets[i], packet, entry);
+        queue->nr_free_packets[i]--;
+    }
+    packet->size_class = i;
+
+    return packet;
+}
+
+static void qemu_net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    unsigned i = packet->size_class;
+
+    if (i == NET_PACKET_CLASSES ||
+        queue->nr_free_packets[i] >= net_packet_class[i].max_free) {
+        g_free(packet);
+        return;
+    }
+
+    QTAILQ_INSERT_HEAD(&queue->free_packets[i], packet, entry);
+    queue->nr_free_packets[i]++;
 }
 
 void qemu_net_queue_append_iov(NetQueue *queue,
@@ -121,33 +179,51 @@ void qemu_net_queue_append_iov(NetQueue *queue,
                                NetPacketSent *sent_cb)
 {
     NetPacket *packet;
-    size_t max_len = 0;
-    int i;
+    size_t size;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
-    for (i = 0; i < iovcnt; i++) {
-        max_len += iov[i].iov_len;
-    }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    size = iov_size(iov, iovcnt);
+    if ((flags & QEMU_NET_PACKET_FLAG_NOCOPY) && sent_cb) {
+        /* The buffers stay valid until sent_cb, only keep the iovec */
+        packet = qemu_net_packet_alloc(queue, iovcnt * sizeof(*iov));
+        packet->iov = (struct iovec *)packet->data;
+        packet->iovcnt = iovcnt;
+        memcpy(packet->iov, iov, iovcnt * sizeof(*iov));
+    } else {
+        packet = qemu_net_packet_alloc(queue, size);
+        packet->data_iov.iov_base = packet->data;
+        packet->data_iov.iov_len = iov_to_buf(iov, iovcnt, 0,
+                                              packet->data, size);
+        packet->iov = &packet->data_iov;
+        packet->iovcnt = 1;
+    }
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
-    packet->size = 0;
-
-    for (i = 0; i < iovcnt; i++) {
-        size_t len = iov[i].iov_len;
-
-        memcpy(packet->data + packet->size, iov[i].iov_base, len);
-        packet->size += len;
-    }
+    packet->size = size;
 
     queue->nq_count++;
     QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
 }
 
+static void qemu_net_queue_append(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  const uint8_t *buf,
+                                  size_t size,
+                                  NetPacketSent *sent_cb)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size
+    };
+
+    qemu_net_queue_append_iov(queue, sender, flags, &iov, 1, sent_cb);
+}
+
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
                                       NetClientState *sender,
                                       unsigned flags,
@@ -243,7 +319,7 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            qemu_net_packet_free(queue, packet);
         }
     }
 }
@@ -258,11 +334,11 @@ bool qemu_net_queue_flush(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         queue->nq_count--;
 
-        ret = qemu_net_queue_deliver(queue,
-                                     packet->sender,
-                                     packet->flags,
-                                     packet->data,
-                                     packet->size);
+        ret = qemu_net_queue_deliver_iov(queue,
+                                         packet->sender,
+                                         packet->flags,
+                                         packet->iov,
+                                         packet->iovcnt);
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
@@ -273,7 +349,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(queue, packet);
     }
     return true;
 }
@@ -31,6 +31,9 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+#endif
 
 #include "net/net.h"
 #include "clients.h"
@@ -40,6 +43,7 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 
@@ -47,6 +51,9 @@
 
 #include "net/vhost_net.h"
 
+/* Maximum number of packets written with a single io_uring submission */
+#define TAP_BATCH_MAX 64
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -58,9 +65,25 @@ typedef struct TAPState {
     bool using_vnet_hdr;
     bool has_ufo;
     bool enabled;
+    /* A packet in buf is queued by reference, do not read into buf */
+    bool send_pending;
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * While plugged, packets are copied into @batch and written out as a
+     * chain of linked io_uring writes on unplug.  @batch_blocked is set
+     * when the device returned EAGAIN; the rest of the batch then waits
+     * for tap_writable().
+     */
+    struct io_uring *ring;
+    bool ring_failed;
+    bool batch_blocked;
+    unsigned int plugged;
+    unsigned int batch_count;
+    struct iovec batch[TAP_BATCH_MAX];
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -89,12 +112,185 @@ static void tap_write_poll(TAPState *s, bool enable)
     tap_update_fd_handler(s);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_batch_drop(TAPState *s, unsigned int n)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        g_free(s->batch[i].iov_base);
+    }
+    s->batch_count -= n;
+    memmove(s->batch, s->batch + n, s->batch_count * sizeof(s->batch[0]));
+}
+
+static void tap_ring_exit(TAPState *s)
+{
+    if (s->ring) {
+        io_uring_queue_exit(s->ring);
+        g_free(s->ring);
+        s->ring = NULL;
+    }
+}
+
+/*
+ * Submit the queued packets as linked writes, so that they reach the
+ * device in order with one io_uring_enter() call.  Returns the number of
+ * packets written before the first failure; *err is the error of the
+ * failed write, or 0 if it was not attempted because the ring broke.
+ */
+static unsigned int tap_batch_submit(TAPState *s, int *err)
+{
+    struct io_uring *ring = s->ring;
+    struct io_uring_cqe *cqe;
+    unsigned int i, n = s->batch_count, written = n;
+    int submitted, ret;
+
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+        io_uring_prep_writev(sqe, s->fd, &s->batch[i], 1, 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        if (i + 1 < n) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+
+    do {
+        submitted = io_uring_submit(ring);
+    } while (submitted == -EINTR);
+    submitted = MAX(submitted, 0);
+
+    for (i = 0; i < submitted; i++) {
+        do {
+            ret = io_uring_wait_cqe(ring, &cqe);
+        } while (ret == -EINTR);
+        if (ret < 0) {
+            submitted = i;
+            break;
+        }
+        /* Writes after a failed one in the chain complete as -ECANCELED */
+        if (cqe->res < 0 &&
+            (uintptr_t)io_uring_cqe_get_data(cqe) < written) {
+            written = (uintptr_t)io_uring_cqe_get_data(cqe);
+            *err = cqe->res;
+        }
+        io_uring_cqe_seen(ring, cqe);
+    }
+
+    if (submitted < n) {
+        error_report("tap: io_uring submission failed, disabling batching");
+        tap_ring_exit(s);
+        s->ring_failed = true;
+        if (submitted < written) {
+            written = submitted;
+            *err = 0;
+        }
+    }
+    return written;
+}
+
+static void tap_batch_flush(TAPState *s)
+{
+    while (s->batch_count) {
+        unsigned int written = 0;
+        int err = 0;
+
+        if (s->ring) {
+            written = tap_batch_submit(s, &err);
+        } else {
+            ssize_t len;
+
+            do {
+                len = writev(s->fd, &s->batch[0], 1);
+            } while (len == -1 && errno == EINTR);
+            if (len == -1) {
+                err = -errno;
+            } else {
+                written = 1;
+            }
+        }
+        tap_batch_drop(s, written);
+
+        if (err == -EAGAIN) {
+            s->batch_blocked = true;
+            tap_write_poll(s, true);
+            return;
+        }
+        if (err < 0) {
+            /* Like a failed writev() on the unbatched path, drop it */
+            tap_batch_drop(s, 1);
+        }
+    }
+}
+
+static ssize_t tap_batch_queue(TAPState *s, const struct iovec *iov,
+                               int iovcnt)
+{
+    size_t size = iov_size(iov, iovcnt);
+
+    if (s->batch_blocked) {
+        return 0;
+    }
+    if (s->batch_count == TAP_BATCH_MAX) {
+        tap_batch_flush(s);
+        if (s->batch_blocked) {
+            return 0;
+        }
+    }
+
+    /* The caller may reuse the buffers as soon as we return */
+    s->batch[s->batch_count].iov_base = g_malloc(size);
+    s->batch[s->batch_count].iov_len = size;
+    iov_to_buf(iov, iovcnt, 0, s->batch[s->batch_count].iov_base, size);
+    s->batch_count++;
+    return size;
+}
+
+static void tap_io_plug(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (!s->ring && !s->ring_failed) {
+        s->ring = g_new0(struct io_uring, 1);
+        if (io_uring_queue_init(TAP_BATCH_MAX, s->ring, 0) < 0) {
+            g_free(s->ring);
+            s->ring = NULL;
+            s->ring_failed = true;
+        }
+    }
+    if (s->ring) {
+        s->plugged++;
+    }
+}
+
+static void tap_io_unplug(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (!s->plugged) {
+        return;
+    }
+    if (--s->plugged == 0 && !s->batch_blocked) {
+        tap_batch_flush(s);
+    }
+}
+#endif
+
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
 
     tap_write_poll(s, false);
 
+#ifdef CONFIG_LINUX_IO_URING
+    s->batch_blocked = false;
+    tap_batch_flush(s);
+    if (s->batch_blocked) {
+        return;
+    }
+#endif
+
     qemu_flush_queued_packets(&s->nc);
 }
 
@@ -102,6 +298,13 @@ static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt
 {
     ssize_t len;
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Also keep packets behind a blocked batch to preserve ordering */
+    if (s->plugged || s->batch_count) {
+        return tap_batch_queue(s, iov, iovcnt);
+    }
+#endif
+
     do {
         len = writev(s->fd, iov, iovcnt);
     } while (len == -1 && errno == EINTR);
@@ -178,6 +381,7 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 static void tap_send_completed(NetClientState *nc, ssize_t len)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    s->send_pending = false;
     tap_read_poll(s, true);
 }
 
@@ -187,8 +391,11 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    /* Let the peer hand the whole burst to the guest at once */
+    qemu_net_io_plug(s->nc.peer);
+
     while (true) {
-        uint8_t *buf = s->buf;
+        struct iovec iov;
 
         size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
         if (size <= 0) {
@@ -196,12 +403,18 @@ static void tap_send(void *opaque)
         }
 
         if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+            iov.iov_base = s->buf + s->host_vnet_hdr_len;
+            iov.iov_len = size - s->host_vnet_hdr_len;
+        } else {
+            iov.iov_base = s->buf;
+            iov.iov_len = size;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+        /* buf is left alone until tap_send_completed() */
+        size = qemu_sendv_packet_async_nocopy(&s->nc, &iov, 1,
+                                              tap_send_completed);
         if (size == 0) {
+            s->send_pending = true;
             tap_read_poll(s, false);
             break;
         } else if (size < 0) {
@@ -219,6 +432,8 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    qemu_net_io_unplug(s->nc.peer);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -320,6 +535,11 @@ static void tap_cleanup(NetClientState *nc)
 
     qemu_purge_queued_packets(nc);
 
+#ifdef CONFIG_LINUX_IO_URING
+    tap_batch_drop(s, s->batch_count);
+    tap_ring_exit(s);
+#endif
+
     tap_exit_notify(&s->exit, NULL);
     qemu_remove_exit_notifier(&s->exit);
 
@@ -332,7 +552,7 @@ static void tap_cleanup(NetClientState *nc)
 static void tap_poll(NetClientState *nc, bool enable)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
-    tap_read_poll(s, enable);
+    tap_read_poll(s, enable && !s->send_pending);
     tap_write_poll(s, enable);
 }
 
@@ -361,6 +581,10 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+#ifdef CONFIG_LINUX_IO_URING
+    .io_plug = tap_io_plug,
+    .io_unplug = tap_io_unplug,
+#endif
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -24,6 +24,8 @@
 
 #include "qemu/osdep.h"
 #include <getopt.h>
+#include <math.h>
+#include <zlib.h>
 
 #include "qemu-common.h"
 #include "qemu-version.h"
@@ -43,10 +45,14 @@
 #include "qemu/units.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "block/qapi.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
+#include "io/channel-file.h"
 #include "trace/control.h"
 
 #define QEMU_IMG_VERSION "qemu-img version " QEMU_FULL_VERSION \
@@ -70,6 +76,11 @@ enum {
     OPTION_PREALLOCATION = 265,
     OPTION_SHRINK = 266,
     OPTION_SALVAGE = 267,
+    OPTION_ACCESS = 268,
+    OPTION_ZIPF_THETA = 269,
+    OPTION_READ_RATIO = 270,
+    OPTION_SEED = 271,
+    OPTION_IOTHREAD = 272,
 };
 
 typedef enum OutputFormat {
@@ -189,6 +200,8 @@ static void QEMU_NORETURN help(void)
            "Parameters to compare subcommand:\n"
            "  '-f' first image format\n"
            "  '-F' second image format\n"
+           "  '-m' specifies how many coroutines work in parallel during the compare\n"
+           "       process (defaults to 8)\n"
            "  '-s' run in Strict mode - fail on different image size or sector allocation\n"
            "\n"
            "Parameters to dd subcommand:\n"
@@ -1077,6 +1090,13 @@ done:
     return 0;
 }
 
+/*
+ * Compare @buf1 and @buf2 in blocks of this size before going down to
+ * sectors, so that memcmp() and buffer_is_zero() can use wide vector
+ * instructions on the common case of identical or zero data.
+ */
+#define COMPARE_BLOCK_SIZE (64 * KiB)
+
 /*
  * Returns -1 if 'buf' contains only zeroes, otherwise the byte index
  * of the first sector boundary within buf where the sector contains a
@@ -1089,6 +1109,12 @@ static int64_t find_nonzero(const uint8_t *buf, int64_t n)
     int64_t end = QEMU_ALIGN_DOWN(n, BDRV_SECTOR_SIZE);
 
     for (i = 0; i < end; i += BDRV_SECTOR_SIZE) {
+        if (QEMU_IS_ALIGNED(i, COMPARE_BLOCK_SIZE) &&
+            end - i >= COMPARE_BLOCK_SIZE &&
+            buffer_is_zero(buf + i, COMPARE_BLOCK_SIZE)) {
+            i += COMPARE_BLOCK_SIZE - BDRV_SECTOR_SIZE;
+            continue;
+        }
         if (!buffer_is_zero(buf + i, BDRV_SECTOR_SIZE)) {
             return i;
         }
@@ -1210,6 +1236,12 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
     while (i < bytes) {
         int64_t len = MIN(bytes - i, BDRV_SECTOR_SIZE);
 
+        if (!res && bytes - i >= COMPARE_BLOCK_SIZE &&
+            !memcmp(buf1 + i, buf2 + i, COMPARE_BLOCK_SIZE)) {
+            i += COMPARE_BLOCK_SIZE;
+            continue;
+        }
+
         if (!!memcmp(buf1 + i, buf2 + i, len) != res) {
             break;
         }
@@ -1221,43 +1253,292 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 }
 
 #define IO_BUF_SIZE (2 * MiB)
+#define MAX_BUF_SECTORS 32768
+#define MAX_COROUTINES 16
+
+typedef enum ImgCompareAction {
+    COMPARE_SKIP,
+    COMPARE_DATA,
+    COMPARE_EMPTY,
+} ImgCompareAction;
+
+typedef struct ImgCompareState {
+    BlockBackend *blk1, *blk2;
+    const char *filename1, *filename2;
+    int64_t total_size1, total_size2;
+    /* Only the data of blk_over is checked between offset and end */
+    BlockBackend *blk_over;
+    const char *filename_over;
+    int64_t offset;
+    int64_t end;
+    int64_t progress_base;
+    bool strict;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    /*
+     * The first difference or error in image order.  Requests below
+     * result_offset are still completed when another coroutine finds one,
+     * so that the same result is reported as with a sequential compare.
+     */
+    int64_t result_offset;
+    int ret;
+    char *result_msg;
+    bool result_is_error;
+} ImgCompareState;
+
+static void GCC_FMT_ATTR(5, 6)
+compare_set_result(ImgCompareState *s, int64_t offset, int ret,
+                   bool is_error, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (offset >= s->result_offset) {
+        return;
+    }
+
+    g_free(s->result_msg);
+    va_start(ap, fmt);
+    s->result_msg = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    s->result_offset = offset;
+    s->ret = ret;
+    s->result_is_error = is_error;
+}
 
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
  *
- * Intended for use by 'qemu-img compare': Returns 0 in case sectors are
- * filled with 0, 1 if sectors contain non-zero data (this is a comparison
- * failure), and 4 on error (the exit status for read errors), after emitting
- * an error message.
+ * Intended for use by 'qemu-img compare': Records a comparison failure
+ * (exit status 1) in @s if the sectors contain non-zero data, and a read
+ * error (exit status 4) if they cannot be read.
  *
+ * @param s: State of the compare operation
  * @param blk:  BlockBackend for the image
  * @param offset: Starting offset to check
  * @param bytes: Number of bytes to check
  * @param filename: Name of disk file we are checking (logging purpose)
  * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
  */
-static int check_empty_sectors(BlockBackend *blk, int64_t offset,
-                               int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+static void coroutine_fn compare_co_check_empty(ImgCompareState *s,
+                                                BlockBackend *blk,
+                                                int64_t offset, int64_t bytes,
+                                                const char *filename,
+                                                uint8_t *buffer)
 {
-    int ret = 0;
+    int ret;
     int64_t idx;
 
-    ret = blk_pread(blk, offset, buffer, bytes);
+    ret = blk_co_pread(blk, offset, bytes, buffer, 0);
     if (ret < 0) {
-        error_report("Error while reading offset %" PRId64 " of %s: %s",
-                     offset, filename, strerror(-ret));
-        return 4;
+        compare_set_result(s, offset, 4, true,
+                           "Error while reading offset %" PRId64 " of %s: %s",
+                           offset, filename, strerror(-ret));
+        return;
     }
     idx = find_nonzero(buffer, bytes);
     if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
-        return 1;
+        compare_set_result(s, offset + idx, 1, false,
+                           "Content mismatch at offset %" PRId64 "!\n",
+                           offset + idx);
     }
+}
 
-    return 0;
+static void coroutine_fn compare_co_data(ImgCompareState *s, int64_t offset,
+                                         int64_t bytes, uint8_t *buf1,
+                                         uint8_t *buf2)
+{
+    int64_t pnum;
+    int ret;
+
+    ret = blk_co_pread(s->blk1, offset, bytes, buf1, 0);
+    if (ret < 0) {
+        compare_set_result(s, offset, 4, true,
+                           "Error while reading offset %" PRId64 " of %s: %s",
+                           offset, s->filename1, strerror(-ret));
+        return;
+    }
+    ret = blk_co_pread(s->blk2, offset, bytes, buf2, 0);
+    if (ret < 0) {
+        compare_set_result(s, offset, 4, true,
+                           "Error while reading offset %" PRId64 " of %s: %s",
+                           offset, s->filename2, strerror(-ret));
+        return;
+    }
+    ret = compare_buffers(buf1, buf2, bytes, &pnum);
+    if (ret || pnum != bytes) {
+        compare_set_result(s, offset + (ret ? 0 : pnum), 1, false,
+                           "Content mismatch at offset %" PRId64 "!\n",
+                           offset + (ret ? 0 : pnum));
+    }
+}
+
+/*
+ * Query the block status at s->offset and decide how the range that
+ * starts there must be compared.  s->offset is advanced past the range.
+ * Returns false if a difference or error has been recorded instead.
+ *
+ * Called with s->lock held.
+ */
+static bool coroutine_fn compare_next_range(ImgCompareState *s,
+                                            int64_t *offset, int64_t *bytes,
+                                            ImgCompareAction *action,
+                                            BlockBackend **blk,
+                                            const char **filename)
+{
+    int64_t pnum1, pnum2, chunk;
+    int status1, status2;
+    int allocated1, allocated2;
+
+    *offset = s->offset;
+
+    if (s->blk_over) {
+        status1 = bdrv_block_status_above(blk_bs(s->blk_over), NULL,
+                                          *offset, s->end - *offset, &chunk,
+                                          NULL, NULL);
+        if (status1 < 0) {
+            compare_set_result(s, *offset, 3, true,
+                               "Sector allocation test failed for %s",
+                               s->filename_over);
+            return false;
+        }
+        if (status1 & BDRV_BLOCK_ALLOCATED && !(status1 & BDRV_BLOCK_ZERO)) {
+            chunk = MIN(chunk, IO_BUF_SIZE);
+            *action = COMPARE_EMPTY;
+            *blk = s->blk_over;
+            *filename = s->filename_over;
+        } else {
+            *action = COMPARE_SKIP;
+        }
+        goto done;
+    }
+
+    status1 = bdrv_block_status_above(blk_bs(s->blk1), NULL, *offset,
+                                      s->total_size1 - *offset, &pnum1, NULL,
+                                      NULL);
+    if (status1 < 0) {
+        compare_set_result(s, *offset, 3, true,
+                           "Sector allocation test failed for %s",
+                           s->filename1);
+        return false;
+    }
+    allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
+
+    status2 = bdrv_block_status_above(blk_bs(s->blk2), NULL, *offset,
+                                      s->total_size2 - *offset, &pnum2, NULL,
+                                      NULL);
+    if (status2 < 0) {
+        compare_set_result(s, *offset, 3, true,
+                           "Sector allocation test failed for %s",
+                           s->filename2);
+        return false;
+    }
+    allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
+
+    assert(pnum1 && pnum2);
+    chunk = MIN(pnum1, pnum2);
+
+    if (s->strict) {
+        if (status1 != status2) {
+            compare_set_result(s, *offset, 1, false,
+                               "Strict mode: Offset %" PRId64
+                               " block status mismatch!\n", *offset);
+            return false;
+        }
+    }
+    if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
+        /* nothing to do */
+        *action = COMPARE_SKIP;
+    } else if (allocated1 == allocated2) {
+        if (allocated1) {
+            chunk = MIN(chunk, IO_BUF_SIZE);
+            *action = COMPARE_DATA;
+        } else {
+            *action = COMPARE_SKIP;
+        }
+    } else {
+        chunk = MIN(chunk, IO_BUF_SIZE);
+        *action = COMPARE_EMPTY;
+        if (allocated1) {
+            *blk = s->blk1;
+            *filename = s->filename1;
+        } else {
+            *blk = s->blk2;
+            *filename = s->filename2;
+        }
+    }
+
+done:
+    chunk = MIN(chunk, s->end - *offset);
+    *bytes = chunk;
+    s->offset += chunk;
+    return true;
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1, *buf2;
+
+    buf1 = blk_blockalign(s->blk1, IO_BUF_SIZE);
+    buf2 = blk_blockalign(s->blk2, IO_BUF_SIZE);
+
+    s->running_coroutines++;
+    while (1) {
+        int64_t offset, bytes;
+        ImgCompareAction action;
+        BlockBackend *blk = NULL;
+        const char *filename = NULL;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->offset >= s->end || s->offset >= s->result_offset) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        if (!compare_next_range(s, &offset, &bytes, &action, &blk,
+                                &filename)) {
+            qemu_co_mutex_unlock(&s->lock);
+            continue;
+        }
+        qemu_co_mutex_unlock(&s->lock);
+
+        switch (action) {
+        case COMPARE_SKIP:
+            break;
+        case COMPARE_DATA:
+            compare_co_data(s, offset, bytes, buf1, buf2);
+            break;
+        case COMPARE_EMPTY:
+            compare_co_check_empty(s, blk, offset, bytes, filename, buf1);
+            break;
+        }
+        qemu_progress_print(((float) bytes / s->progress_base) * 100, 100);
+    }
+
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
+/*
+ * Compare the range from s->offset to @end with s->num_coroutines
+ * requests in parallel.  Returns true if no difference or error was found.
+ */
+static bool compare_do_compare(ImgCompareState *s, int64_t end)
+{
+    int i;
+
+    s->end = end;
+    for (i = 0; i < s->num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(compare_co_do_compare, s);
+        qemu_coroutine_enter(co);
+    }
+
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+
+    return !s->result_msg;
 }
 
 /*
@@ -1271,22 +1552,18 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
     int64_t total_size;
-    int64_t offset = 0;
-    int64_t chunk;
     int c;
     uint64_t progress_base;
     bool image_opts = false;
     bool force_share = false;
+    long num_coroutines = 8;
+    ImgCompareState s;
 
     cache = BDRV_DEFAULT_CACHE;
     for (;;) {
@@ -1297,7 +1574,7 @@ static int img_compare(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:m:T:pqsU",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1318,6 +1595,15 @@ static int img_compare(int argc, char **argv)
         case 'F':
             fmt2 = optarg;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                ret = 2;
+                goto out4;
+            }
+            break;
         case 'T':
             cache = optarg;
             break;
@@ -1391,11 +1677,7 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1421,131 +1703,53 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+    s = (ImgCompareState) {
+        .blk1           = blk1,
+        .blk2           = blk2,
+        .filename1      = filename1,
+        .filename2      = filename2,
+        .total_size1    = total_size1,
+        .total_size2    = total_size2,
+        .progress_base  = progress_base,
+        .strict         = strict,
+        .num_coroutines = num_coroutines,
+        .result_offset  = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, buf1, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, buf2, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    if (!compare_do_compare(&s, total_size)) {
+        goto result;
     }
 
     if (total_size1 != total_size2) {
-        BlockBackend *blk_over;
-        const char *filename_over;
-
         qprintf(quiet, "Warning: Image size mismatch!\n");
         if (total_size1 > total_size2) {
-            blk_over = blk1;
-            filename_over = filename1;
+            s.blk_over = blk1;
+            s.filename_over = filename1;
         } else {
-            blk_over = blk2;
-            filename_over = filename2;
+            s.blk_over = blk2;
+            s.filename_over = filename2;
         }
 
-        while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
-            if (ret < 0) {
-                ret = 3;
-                error_report("Sector allocation test failed for %s",
-                             filename_over);
-                goto out;
-
-            }
-            if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
-                if (ret) {
-                    goto out;
-                }
-            }
-            offset += chunk;
-            qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+        if (!compare_do_compare(&s, progress_base)) {
+            goto result;
         }
     }
 
     qprintf(quiet, "Images are identical.\n");
     ret = 0;
+    goto out;
+
+result:
+    if (s.result_is_error) {
+        error_report("%s", s.result_msg);
+    } else {
+        qprintf(quiet, "%s", s.result_msg);
+    }
+    g_free(s.result_msg);
+    ret = s.ret;
 
 out:
-    qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1561,12 +1765,11 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
-
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
     int src_num;
+    int64_t src_skip;       /* sectors at the start of src[0] not copied */
     int64_t total_sectors;
     int64_t allocated_sectors;
     int64_t allocated_done;
@@ -1595,13 +1798,22 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+
+    /* Stream format input or output, see IMG_STREAM_MAGIC */
+    QIOChannel *stream_ioc;
+    bool stream_compress;
+    bool stream_eof;
+    int64_t stream_offset;
+    uint64_t stream_seq;
+    uint64_t stream_wr_seq;
+    CoQueue stream_wr_queue;
 } ImgConvertState;
 
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
     *src_cur = 0;
-    *src_cur_offset = 0;
+    *src_cur_offset = -s->src_skip;
     while (sector_num - *src_cur_offset >= s->src_sectors[*src_cur]) {
         *src_cur_offset += s->src_sectors[*src_cur];
         (*src_cur)++;
@@ -1851,55 +2063,333 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
     return 0;
 }
 
-static void coroutine_fn convert_co_do_copy(void *opaque)
+/*
+ * The stream format ("qemu-img convert -O stream" and "-f stream") carries an
+ * image over a pipe: a header, then extent records in ascending offset order,
+ * each followed by its payload, and finally an END record.  All fields are
+ * big endian.  See docs/interop/qemu-img-stream.txt.
+ */
+#define IMG_STREAM_FORMAT       "stream"
+#define IMG_STREAM_MAGIC        "QEMUSTRM"
+#define IMG_STREAM_VERSION      1
+#define IMG_STREAM_MAX_DATA     (MAX_BUF_SECTORS * BDRV_SECTOR_SIZE)
+
+enum {
+    IMG_STREAM_END          = 0,
+    IMG_STREAM_DATA         = 1,
+    IMG_STREAM_DATA_ZLIB    = 2,
+    IMG_STREAM_ZERO         = 3,
+    IMG_STREAM_HOLE         = 4,
+};
+
+typedef struct QEMU_PACKED ImgStreamHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t size;
+} ImgStreamHeader;
+
+typedef struct QEMU_PACKED ImgStreamRecord {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t data_size;
+} ImgStreamRecord;
+
+typedef struct ImgStreamEncodeTask {
+    ImgConvertState *s;
+    int64_t sector_num;
+    int nb_sectors;
+    const uint8_t *buf;
+    enum ImgConvertBlockStatus status;
+    GByteArray *out;
+} ImgStreamEncodeTask;
+
+typedef struct ImgStreamDecodeTask {
+    uint8_t *dst;
+    size_t dst_size;
+    const uint8_t *src;
+    size_t src_size;
+} ImgStreamDecodeTask;
+
+static void img_stream_set_record(ImgStreamRecord *rec, uint32_t type,
+                                  uint64_t offset, uint64_t length,
+                                  uint64_t data_size)
 {
-    ImgConvertState *s = opaque;
-    uint8_t *buf = NULL;
-    int ret, i;
-    int index = -1;
+    rec->type = cpu_to_be32(type);
+    rec->reserved = 0;
+    rec->offset = cpu_to_be64(offset);
+    rec->length = cpu_to_be64(length);
+    rec->data_size = cpu_to_be64(data_size);
+}
 
-    for (i = 0; i < s->num_coroutines; i++) {
-        if (s->co[i] == qemu_coroutine_self()) {
-            index = i;
-            break;
+static void img_stream_append(GByteArray *out, uint32_t type,
+                              uint64_t offset, uint64_t length)
+{
+    ImgStreamRecord rec;
+
+    img_stream_set_record(&rec, type, offset, length, 0);
+    g_byte_array_append(out, (uint8_t *)&rec, sizeof(rec));
+}
+
+static void img_stream_append_data(GByteArray *out, uint64_t offset,
+                                   const uint8_t *buf, size_t len,
+                                   bool compress)
+{
+    size_t start = out->len;
+    ImgStreamRecord rec;
+
+    if (compress) {
+        uLongf zlen = compressBound(len);
+        int ret;
+
+        g_byte_array_set_size(out, start + sizeof(rec) + zlen);
+        ret = compress2(out->data + start + sizeof(rec), &zlen, buf, len,
+                        Z_DEFAULT_COMPRESSION);
+        if (ret == Z_OK && zlen < len) {
+            img_stream_set_record((ImgStreamRecord *)(out->data + start),
+                                  IMG_STREAM_DATA_ZLIB, offset, len, zlen);
+            g_byte_array_set_size(out, start + sizeof(rec) + zlen);
+            return;
         }
+        /* Incompressible, send it as it is */
+        g_byte_array_set_size(out, start);
     }
-    assert(index >= 0);
 
-    s->running_coroutines++;
-    buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+    img_stream_set_record(&rec, IMG_STREAM_DATA, offset, len, len);
+    g_byte_array_append(out, (uint8_t *)&rec, sizeof(rec));
+    g_byte_array_append(out, buf, len);
+}
 
-    while (1) {
-        int n;
-        int64_t sector_num;
-        enum ImgConvertBlockStatus status;
-        bool copy_range;
+/*
+ * Turn one chunk of the source into stream records.  This may run in a worker
+ * thread when compressing, so it must only read @s.
+ */
+static int img_stream_encode(void *opaque)
+{
+    ImgStreamEncodeTask *t = opaque;
+    ImgConvertState *s = t->s;
+    int64_t sector_num = t->sector_num;
+    int nb_sectors = t->nb_sectors;
+    const uint8_t *buf = t->buf;
 
-        qemu_co_mutex_lock(&s->lock);
-        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
-            qemu_co_mutex_unlock(&s->lock);
+    while (nb_sectors > 0) {
+        int n = nb_sectors;
+        uint64_t offset = sector_num << BDRV_SECTOR_BITS;
+        uint64_t bytes;
+
+        switch (t->status) {
+        case BLK_BACKING_FILE:
+            img_stream_append(t->out, IMG_STREAM_HOLE, offset,
+                              (uint64_t)n << BDRV_SECTOR_BITS);
             break;
-        }
-        n = convert_iteration_sectors(s, s->sector_num);
-        if (n < 0) {
-            qemu_co_mutex_unlock(&s->lock);
-            s->ret = n;
+
+        case BLK_DATA:
+            if (!s->min_sparse ||
+                is_allocated_sectors_min(buf, n, &n, s->min_sparse,
+                                         sector_num, s->alignment))
+            {
+                bytes = (uint64_t)n << BDRV_SECTOR_BITS;
+                img_stream_append_data(t->out, offset, buf, bytes,
+                                       s->stream_compress);
+                break;
+            }
+            /* fall-through */
+
+        case BLK_ZERO:
+            img_stream_append(t->out, IMG_STREAM_ZERO, offset,
+                              (uint64_t)n << BDRV_SECTOR_BITS);
             break;
         }
-        /* save current sector and allocation status to local variables */
-        sector_num = s->sector_num;
-        status = s->status;
-        if (!s->min_sparse && s->status == BLK_ZERO) {
-            n = MIN(n, s->buf_sectors);
-        }
-        /* increment global sector counter so that other coroutines can
-         * already continue reading beyond this request */
-        s->sector_num += n;
-        qemu_co_mutex_unlock(&s->lock);
 
-        if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
-            s->allocated_done += n;
-            qemu_progress_print(100.0 * s->allocated_done /
+        sector_num += n;
+        nb_sectors -= n;
+        buf += n * BDRV_SECTOR_SIZE;
+    }
+
+    return 0;
+}
+
+static int img_stream_decode(void *opaque)
+{
+    ImgStreamDecodeTask *t = opaque;
+    uLongf len = t->dst_size;
+
+    if (uncompress(t->dst, &len, t->src, t->src_size) != Z_OK ||
+        len != t->dst_size)
+    {
+        return -EIO;
+    }
+    return 0;
+}
+
+static QIOChannel *img_stream_open(const char *filename, bool write,
+                                   Error **errp)
+{
+    QIOChannelFile *fioc;
+    QIOChannel *ioc;
+
+    if (!strcmp(filename, "-")) {
+        int fd = dup(write ? STDOUT_FILENO : STDIN_FILENO);
+
+        if (fd < 0) {
+            error_setg_errno(errp, errno, "Could not duplicate %s",
+                             write ? "stdout" : "stdin");
+            return NULL;
+        }
+        fioc = qio_channel_file_new_fd(fd);
+    } else {
+        fioc = qio_channel_file_new_path(filename,
+                                         write ? O_WRONLY | O_CREAT | O_TRUNC
+                                               : O_RDONLY,
+                                         0644, errp);
+        if (!fioc) {
+            return NULL;
+        }
+    }
+
+    ioc = QIO_CHANNEL(fioc);
+    qio_channel_set_blocking(ioc, false, NULL);
+    qio_channel_attach_aio_context(ioc, qemu_get_aio_context());
+    return ioc;
+}
+
+static void img_stream_close(QIOChannel *ioc)
+{
+    if (ioc) {
+        /* stdin and stdout share the O_NONBLOCK flag with our parent */
+        qio_channel_detach_aio_context(ioc);
+        qio_channel_set_blocking(ioc, true, NULL);
+        object_unref(OBJECT(ioc));
+    }
+}
+
+static int img_stream_write_header(QIOChannel *ioc, uint64_t size,
+                                   Error **errp)
+{
+    ImgStreamHeader header = {
+        .version        = cpu_to_be32(IMG_STREAM_VERSION),
+        .header_size    = cpu_to_be32(sizeof(header)),
+        .size           = cpu_to_be64(size),
+    };
+
+    memcpy(header.magic, IMG_STREAM_MAGIC, sizeof(header.magic));
+    return qio_channel_write_all(ioc, (char *)&header, sizeof(header), errp);
+}
+
+static int img_stream_read_header(QIOChannel *ioc, int64_t *size,
+                                  Error **errp)
+{
+    ImgStreamHeader header;
+    uint32_t header_size;
+
+    if (qio_channel_read_all(ioc, (char *)&header, sizeof(header), errp) < 0) {
+        return -EIO;
+    }
+
+    if (memcmp(header.magic, IMG_STREAM_MAGIC, sizeof(header.magic))) {
+        error_setg(errp, "Not a qemu-img stream");
+        return -EINVAL;
+    }
+    if (be32_to_cpu(header.version) != IMG_STREAM_VERSION) {
+        error_setg(errp, "Unsupported stream version %" PRIu32,
+                   be32_to_cpu(header.version));
+        return -ENOTSUP;
+    }
+
+    header_size = be32_to_cpu(header.header_size);
+    if (header_size < sizeof(header) || header_size > 64 * KiB) {
+        error_setg(errp, "Invalid stream header size %" PRIu32, header_size);
+        return -EINVAL;
+    }
+    if (header_size > sizeof(header)) {
+        /* Skip fields added by compatible writers */
+        char *ext = g_malloc(header_size - sizeof(header));
+        int ret;
+
+        ret = qio_channel_read_all(ioc, ext, header_size - sizeof(header),
+                                   errp);
+        g_free(ext);
+        if (ret < 0) {
+            return -EIO;
+        }
+    }
+
+    *size = be64_to_cpu(header.size);
+    if (*size < 0 || !QEMU_IS_ALIGNED(*size, BDRV_SECTOR_SIZE)) {
+        error_setg(errp, "Invalid image size in stream header");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int coroutine_fn convert_stream_co_write(ImgConvertState *s,
+                                                GByteArray *records)
+{
+    Error *local_err = NULL;
+
+    if (qio_channel_write_all(s->stream_ioc, (char *)records->data,
+                              records->len, &local_err) < 0) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+    return 0;
+}
+
+static void coroutine_fn convert_co_do_copy(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    uint8_t *buf = NULL;
+    GByteArray *records = NULL;
+    int ret, i;
+    int index = -1;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] == qemu_coroutine_self()) {
+            index = i;
+            break;
+        }
+    }
+    assert(index >= 0);
+
+    s->running_coroutines++;
+    buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+    if (s->stream_ioc) {
+        records = g_byte_array_new();
+    }
+
+    while (1) {
+        int n;
+        int64_t sector_num;
+        enum ImgConvertBlockStatus status;
+        bool copy_range;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        n = convert_iteration_sectors(s, s->sector_num);
+        if (n < 0) {
+            qemu_co_mutex_unlock(&s->lock);
+            s->ret = n;
+            break;
+        }
+        /* save current sector and allocation status to local variables */
+        sector_num = s->sector_num;
+        status = s->status;
+        if (!s->min_sparse && s->status == BLK_ZERO) {
+            n = MIN(n, s->buf_sectors);
+        }
+        /* increment global sector counter so that other coroutines can
+         * already continue reading beyond this request */
+        s->sector_num += n;
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
+            s->allocated_done += n;
+            qemu_progress_print(100.0 * s->allocated_done /
                                         s->allocated_sectors, 0);
         }
 
@@ -1917,6 +2407,28 @@ retry:
             memset(buf, 0x00, n * BDRV_SECTOR_SIZE);
         }
 
+        if (s->stream_ioc && s->ret == -EINPROGRESS) {
+            ImgStreamEncodeTask task = {
+                .s          = s,
+                .sector_num = sector_num,
+                .nb_sectors = n,
+                .buf        = buf,
+                .status     = status,
+                .out        = records,
+            };
+
+            /* Compress before waiting for our turn so that the coroutines
+             * keep several worker threads busy */
+            g_byte_array_set_size(records, 0);
+            if (s->stream_compress) {
+                thread_pool_submit_co(
+                    aio_get_thread_pool(qemu_get_aio_context()),
+                    img_stream_encode, &task);
+            } else {
+                img_stream_encode(&task);
+            }
+        }
+
         if (s->wr_in_order) {
             /* keep writes in order */
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
@@ -1927,7 +2439,9 @@ retry:
         }
 
         if (s->ret == -EINPROGRESS) {
-            if (copy_range) {
+            if (s->stream_ioc) {
+                ret = convert_stream_co_write(s, records);
+            } else if (copy_range) {
                 ret = convert_co_copy_range(s, sector_num, n);
                 if (ret) {
                     s->copy_range = false;
@@ -1962,6 +2476,9 @@ retry:
     }
 
     qemu_vfree(buf);
+    if (records) {
+        g_byte_array_free(records, true);
+    }
     s->co[index] = NULL;
     s->running_coroutines--;
     if (!s->running_coroutines && s->ret == -EINPROGRESS) {
@@ -1970,10 +2487,9 @@ retry:
     }
 }
 
-static int convert_do_copy(ImgConvertState *s)
+static void convert_check_zero_init(ImgConvertState *s)
 {
-    int ret, i, n;
-    int64_t sector_num = 0;
+    int ret;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (s->target_is_new && s->min_sparse && !s->target_has_backing) {
@@ -1990,6 +2506,24 @@ static int convert_do_copy(ImgConvertState *s)
             s->has_zero_init = true;
         }
     }
+}
+
+static int convert_do_copy(ImgConvertState *s)
+{
+    Error *local_err = NULL;
+    int ret, i, n;
+    int64_t sector_num = 0;
+
+    if (s->stream_ioc) {
+        if (img_stream_write_header(s->stream_ioc,
+                                    s->total_sectors * BDRV_SECTOR_SIZE,
+                                    &local_err) < 0) {
+            error_report_err(local_err);
+            return -EIO;
+        }
+    } else {
+        convert_check_zero_init(s);
+    }
 
     /* Allocate buffer for copied data. For compressed images, only one cluster
      * can be copied at a time. */
@@ -2036,10 +2570,253 @@ static int convert_do_copy(ImgConvertState *s)
         }
     }
 
+    if (s->stream_ioc && !s->ret) {
+        ImgStreamRecord rec;
+
+        img_stream_set_record(&rec, IMG_STREAM_END,
+                              s->total_sectors * BDRV_SECTOR_SIZE, 0, 0);
+        if (qio_channel_write_all(s->stream_ioc, (char *)&rec, sizeof(rec),
+                                  &local_err) < 0) {
+            error_report_err(local_err);
+            return -EIO;
+        }
+    }
+
     return s->ret;
 }
 
-#define MAX_BUF_SECTORS 32768
+static int coroutine_fn convert_stream_co_read_record(ImgConvertState *s,
+                                                      uint32_t *type,
+                                                      int64_t *offset,
+                                                      int64_t *bytes,
+                                                      uint64_t *data_size,
+                                                      Error **errp)
+{
+    int64_t size = s->total_sectors * BDRV_SECTOR_SIZE;
+    ImgStreamRecord rec;
+    bool valid;
+
+    if (qio_channel_read_all(s->stream_ioc, (char *)&rec, sizeof(rec),
+                             errp) < 0) {
+        return -EIO;
+    }
+
+    *type = be32_to_cpu(rec.type);
+    *offset = be64_to_cpu(rec.offset);
+    *bytes = be64_to_cpu(rec.length);
+    *data_size = be64_to_cpu(rec.data_size);
+
+    switch (*type) {
+    case IMG_STREAM_END:
+        valid = *offset == size && *bytes == 0 && *data_size == 0;
+        break;
+    case IMG_STREAM_DATA:
+        valid = *bytes > 0 && *bytes <= IMG_STREAM_MAX_DATA &&
+                *data_size == *bytes;
+        break;
+    case IMG_STREAM_DATA_ZLIB:
+        valid = *bytes > 0 && *bytes <= IMG_STREAM_MAX_DATA &&
+                *data_size > 0 && *data_size <= compressBound(*bytes);
+        break;
+    case IMG_STREAM_ZERO:
+    case IMG_STREAM_HOLE:
+        valid = *bytes >= 0 && *data_size == 0;
+        break;
+    default:
+        error_setg(errp, "Unknown extent type %" PRIu32 " in stream", *type);
+        return -EINVAL;
+    }
+
+    /* Extents must be in ascending order and must not overlap */
+    if (!valid || *offset < s->stream_offset || *bytes > size - *offset) {
+        error_setg(errp, "Invalid extent at offset %" PRId64 " in stream",
+                   *offset);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn convert_stream_co_write_extent(ImgConvertState *s,
+                                                       uint32_t type,
+                                                       int64_t offset,
+                                                       int64_t bytes,
+                                                       uint8_t *buf)
+{
+    int ret;
+
+    while (bytes > 0) {
+        int n = MIN(bytes, BDRV_REQUEST_MAX_BYTES);
+
+        switch (type) {
+        case IMG_STREAM_DATA:
+        case IMG_STREAM_DATA_ZLIB:
+            ret = blk_co_pwrite(s->target, offset, n, buf, 0);
+            if (ret < 0) {
+                return ret;
+            }
+            buf += n;
+            break;
+
+        case IMG_STREAM_HOLE:
+            /* Unallocated in the source, let the backing file show through */
+            if (s->target_has_backing) {
+                break;
+            }
+            /* fall-through */
+
+        case IMG_STREAM_ZERO:
+            if (s->has_zero_init) {
+                break;
+            }
+            ret = blk_co_pwrite_zeroes(s->target, offset, n,
+                                       s->min_sparse ? BDRV_REQ_MAY_UNMAP : 0);
+            if (ret < 0) {
+                return ret;
+            }
+            break;
+        }
+
+        offset += n;
+        bytes -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * The records are read one at a time under s->lock, but decompressing and
+ * writing them is done in parallel by all coroutines.  Ranges between two
+ * records are holes.
+ */
+static void coroutine_fn convert_stream_co_do_copy(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    int64_t size = s->total_sectors * BDRV_SECTOR_SIZE;
+    uint8_t *buf, *zbuf = NULL;
+    Error *local_err = NULL;
+    int ret;
+
+    s->running_coroutines++;
+    buf = blk_blockalign(s->target, IMG_STREAM_MAX_DATA);
+
+    while (1) {
+        uint32_t type;
+        int64_t offset, bytes, hole_offset;
+        uint64_t data_size, seq;
+        uint8_t *payload;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS || s->stream_eof) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+
+        ret = convert_stream_co_read_record(s, &type, &offset, &bytes,
+                                            &data_size, &local_err);
+        if (ret == 0 && data_size) {
+            if (type == IMG_STREAM_DATA_ZLIB && !zbuf) {
+                zbuf = g_malloc(compressBound(IMG_STREAM_MAX_DATA));
+            }
+            payload = type == IMG_STREAM_DATA_ZLIB ? zbuf : buf;
+            if (qio_channel_read_all(s->stream_ioc, (char *)payload,
+                                     data_size, &local_err) < 0) {
+                ret = -EIO;
+            }
+        }
+        if (ret < 0) {
+            qemu_co_mutex_unlock(&s->lock);
+            error_report_err(local_err);
+            s->ret = ret;
+            break;
+        }
+
+        hole_offset = s->stream_offset;
+        s->stream_offset = offset + bytes;
+        s->stream_eof = type == IMG_STREAM_END;
+        seq = s->stream_seq++;
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (type == IMG_STREAM_DATA_ZLIB) {
+            ImgStreamDecodeTask task = {
+                .dst        = buf,
+                .dst_size   = bytes,
+                .src        = zbuf,
+                .src_size   = data_size,
+            };
+
+            ret = thread_pool_submit_co(
+                aio_get_thread_pool(qemu_get_aio_context()),
+                img_stream_decode, &task);
+            if (ret < 0) {
+                error_report("Corrupt compressed extent at offset %" PRId64
+                             " in stream", offset);
+                s->ret = ret;
+            }
+        }
+
+        if (s->wr_in_order) {
+            while (s->stream_wr_seq != seq && s->ret == -EINPROGRESS) {
+                qemu_co_queue_wait(&s->stream_wr_queue, NULL);
+            }
+        }
+
+        if (s->ret == -EINPROGRESS) {
+            ret = convert_stream_co_write_extent(s, IMG_STREAM_HOLE,
+                                                 hole_offset,
+                                                 offset - hole_offset, NULL);
+            if (ret >= 0) {
+                ret = convert_stream_co_write_extent(s, type, offset, bytes,
+                                                     buf);
+            }
+            if (ret < 0) {
+                error_report("error while writing offset %" PRId64 ": %s",
+                             hole_offset, strerror(-ret));
+                s->ret = ret;
+            }
+        }
+
+        if (s->wr_in_order) {
+            s->stream_wr_seq = seq + 1;
+            qemu_co_queue_restart_all(&s->stream_wr_queue);
+        }
+
+        if (size) {
+            qemu_progress_print(100.0 * (offset + bytes) / size, 0);
+        }
+    }
+
+    /* Don't leave anybody waiting for a record that will never be written */
+    qemu_co_queue_restart_all(&s->stream_wr_queue);
+
+    qemu_vfree(buf);
+    g_free(zbuf);
+    s->running_coroutines--;
+    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
+        s->ret = 0;
+    }
+}
+
+static int convert_stream_do_copy(ImgConvertState *s)
+{
+    int i;
+
+    convert_check_zero_init(s);
+
+    s->ret = -EINPROGRESS;
+    qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->stream_wr_queue);
+    for (i = 0; i < s->num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(convert_stream_co_do_copy, s);
+        qemu_coroutine_enter(co);
+    }
+
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+
+    return s->ret;
+}
 
 static int img_convert(int argc, char **argv)
 {
@@ -2060,6 +2837,7 @@ static int img_convert(int argc, char **argv)
     int64_t ret = -EINVAL;
     bool force_share = false;
     bool explict_min_sparse = false;
+    bool stream_in, stream_out;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2242,6 +3020,54 @@ static int img_convert(int argc, char **argv)
     s.src_num = argc - optind - 1;
     out_filename = s.src_num >= 1 ? argv[argc - 1] : NULL;
 
+    stream_in = fmt && !strcmp(fmt, IMG_STREAM_FORMAT);
+    stream_out = out_fmt && !strcmp(out_fmt, IMG_STREAM_FORMAT);
+
+    if (stream_in && stream_out) {
+        error_report("Cannot convert a stream into a stream");
+        goto fail_getopt;
+    }
+
+    if (stream_out) {
+        if (skip_create || tgt_image_opts || options) {
+            error_report("-n, -o and --target-image-opts cannot be used with "
+                         "the stream output format");
+            goto fail_getopt;
+        }
+        if (s.copy_range) {
+            error_report("Cannot enable copy offloading when writing a "
+                         "stream");
+            goto fail_getopt;
+        }
+        if (!s.wr_in_order) {
+            error_report("Out of order writes are not possible when writing "
+                         "a stream");
+            goto fail_getopt;
+        }
+        if (progress && out_filename && !strcmp(out_filename, "-")) {
+            error_report("Cannot show progress when writing a stream to "
+                         "stdout");
+            goto fail_getopt;
+        }
+    }
+
+    if (stream_in) {
+        if (s.src_num != 1) {
+            error_report("Only a single stream can be converted at a time");
+            goto fail_getopt;
+        }
+        if (image_opts || snapshot_name || sn_opts) {
+            error_report("--image-opts and -l cannot be used with the stream "
+                         "input format");
+            goto fail_getopt;
+        }
+        if (s.copy_range || s.compressed) {
+            error_report("-C and -c cannot be used with the stream input "
+                         "format");
+            goto fail_getopt;
+        }
+    }
+
     if (options && has_help_option(options)) {
         if (out_fmt) {
             ret = print_block_option_help(out_filename, out_fmt);
@@ -2275,7 +3101,22 @@ static int img_convert(int argc, char **argv)
     s.src = g_new0(BlockBackend *, s.src_num);
     s.src_sectors = g_new(int64_t, s.src_num);
 
-    for (bs_i = 0; bs_i < s.src_num; bs_i++) {
+    if (stream_in) {
+        int64_t size;
+
+        s.stream_ioc = img_stream_open(argv[optind], false, &local_err);
+        if (!s.stream_ioc ||
+            img_stream_read_header(s.stream_ioc, &size, &local_err) < 0) {
+            error_reportf_err(local_err, "Could not read stream %s: ",
+                              argv[optind]);
+            ret = -1;
+            goto out;
+        }
+        s.src_sectors[0] = size / BDRV_SECTOR_SIZE;
+        s.total_sectors = s.src_sectors[0];
+    }
+
+    for (bs_i = 0; !stream_in && bs_i < s.src_num; bs_i++) {
         s.src[bs_i] = img_open(image_opts, argv[optind + bs_i],
                                fmt, src_flags, src_writethrough, s.quiet,
                                force_share);
@@ -2314,6 +3155,27 @@ static int img_convert(int argc, char **argv)
         goto out;
     }
 
+    if (stream_out) {
+        s.stream_ioc = img_stream_open(out_filename, true, &local_err);
+        if (!s.stream_ioc) {
+            error_report_err(local_err);
+            ret = -1;
+            goto out;
+        }
+
+        /* Compression happens per extent in the stream, not per cluster */
+        s.stream_compress = s.compressed;
+        s.compressed = false;
+
+        /* With -B, data unallocated in the source is sent as holes */
+        s.target_has_backing = (bool) out_baseimg;
+        s.target_backing_sectors = -1;
+        s.alignment = MAX(pow2floor(s.min_sparse), 1);
+
+        ret = convert_do_copy(&s);
+        goto out;
+    }
+
     if (!skip_create) {
         /* Find driver and parse its options */
         drv = bdrv_find_format(out_fmt);
@@ -2517,7 +3379,18 @@ static int img_convert(int argc, char **argv)
         s.unallocated_blocks_are_zero = bdi.unallocated_blocks_are_zero;
     }
 
-    ret = convert_do_copy(&s);
+    if (stream_in && s.compressed) {
+        error_report("Cannot write a stream into a format that needs "
+                     "compressed writes");
+        ret = -1;
+        goto out;
+    }
+
+    if (stream_in) {
+        ret = convert_stream_do_copy(&s);
+    } else {
+        ret = convert_do_copy(&s);
+    }
 out:
     if (!ret) {
         qemu_progress_print(100, 0);
@@ -2527,6 +3400,7 @@ out:
     qemu_opts_free(create_opts);
     qemu_opts_del(sn_opts);
     qobject_unref(open_opts);
+    img_stream_close(s.stream_ioc);
     blk_unref(s.target);
     if (s.src) {
         for (bs_i = 0; bs_i < s.src_num; bs_i++) {
@@ -3220,11 +4094,235 @@ static int img_snapshot(int argc, char **argv)
     return 0;
 }
 
+typedef struct ImgRebaseState {
+    BlockBackend *blk;
+    BlockBackend *blk_old_backing;
+    BlockBackend *blk_new_backing;
+    BlockDriverState *prefix_chain_bs;
+    int64_t size;
+    int64_t old_backing_size;
+    int64_t new_backing_size;
+    int64_t offset;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    int ret;
+} ImgRebaseState;
+
+/*
+ * Returns 1 if the first *pnum bytes at @offset of @bs are known to read as
+ * zeroes, 0 if they may contain data, and shortens *pnum to the size of the
+ * range that has this status.
+ */
+static int coroutine_fn rebase_co_is_zero(BlockDriverState *bs,
+                                          int64_t offset, int64_t *pnum)
+{
+    int ret = bdrv_block_status_above(bs, NULL, offset, *pnum, pnum, NULL,
+                                      NULL);
+    if (ret < 0) {
+        error_report("error while reading image metadata: %s",
+                     strerror(-ret));
+        return ret;
+    }
+    return !!(ret & BDRV_BLOCK_ZERO);
+}
+
+/*
+ * Find the range at @offset that must be looked at next and store its size
+ * in *pnum.  Returns 1 if the old and new backing file must be compared in
+ * this range, 0 if it can be skipped and a negative errno on error.
+ * *old_is_zero and *new_is_zero tell whether the old and the new backing
+ * file are known to read as zeroes in the range.
+ *
+ * Called with s->lock held.
+ */
+static int coroutine_fn rebase_co_next_range(ImgRebaseState *s,
+                                             int64_t offset, int64_t *pnum,
+                                             bool *old_is_zero,
+                                             bool *new_is_zero)
+{
+    BlockDriverState *bs = blk_bs(s->blk);
+    int64_t n = MIN(IO_BUF_SIZE, s->size - offset);
+    int ret;
+
+    /* If the cluster is allocated, we don't need to take action */
+    ret = bdrv_is_allocated(bs, offset, n, &n);
+    *pnum = n;
+    if (ret < 0) {
+        error_report("error while reading image metadata: %s",
+                     strerror(-ret));
+        return ret;
+    }
+    if (ret) {
+        return 0;
+    }
+
+    if (s->prefix_chain_bs) {
+        /*
+         * If cluster wasn't changed since prefix_chain, we don't need
+         * to take action
+         */
+        ret = bdrv_is_allocated_above(backing_bs(bs), s->prefix_chain_bs,
+                                      false, offset, n, &n);
+        *pnum = n;
+        if (ret < 0) {
+            error_report("error while reading image metadata: %s",
+                         strerror(-ret));
+            return ret;
+        }
+        if (!ret) {
+            return 0;
+        }
+    }
+
+    /*
+     * Take into consideration that backing files may be smaller than the
+     * COW image, and skip the range if both backing files are known to
+     * read as zeroes.
+     */
+    if (offset >= s->old_backing_size) {
+        *old_is_zero = true;
+    } else {
+        n = MIN(n, s->old_backing_size - offset);
+        ret = rebase_co_is_zero(blk_bs(s->blk_old_backing), offset, &n);
+        if (ret < 0) {
+            return ret;
+        }
+        *old_is_zero = ret;
+    }
+
+    if (!s->blk_new_backing || offset >= s->new_backing_size) {
+        *new_is_zero = true;
+    } else {
+        n = MIN(n, s->new_backing_size - offset);
+        ret = rebase_co_is_zero(blk_bs(s->blk_new_backing), offset, &n);
+        if (ret < 0) {
+            return ret;
+        }
+        *new_is_zero = ret;
+    }
+
+    *pnum = n;
+    return !(*old_is_zero && *new_is_zero);
+}
+
+/*
+ * Compare the range at @offset in the old and new backing file and copy
+ * the parts that differ from the old backing file into the COW file.
+ */
+static int coroutine_fn rebase_co_copy_range(ImgRebaseState *s,
+                                             int64_t offset, int64_t n,
+                                             bool old_is_zero,
+                                             bool new_is_zero,
+                                             uint8_t *buf_old,
+                                             uint8_t *buf_new)
+{
+    int64_t written = 0;
+    int ret;
+
+    if (old_is_zero) {
+        memset(buf_old, 0, n);
+    } else {
+        ret = blk_co_pread(s->blk_old_backing, offset, n, buf_old, 0);
+        if (ret < 0) {
+            error_report("error while reading from old backing file");
+            return ret;
+        }
+        old_is_zero = buffer_is_zero(buf_old, n);
+    }
+
+    if (new_is_zero) {
+        memset(buf_new, 0, n);
+    } else {
+        ret = blk_co_pread(s->blk_new_backing, offset, n, buf_new, 0);
+        if (ret < 0) {
+            error_report("error while reading from new backing file");
+            return ret;
+        }
+    }
+
+    if (old_is_zero && (new_is_zero || buffer_is_zero(buf_new, n))) {
+        return 0;
+    }
+
+    /* If they differ, we need to write to the COW file */
+    while (written < n) {
+        int64_t pnum;
+
+        if (compare_buffers(buf_old + written, buf_new + written,
+                            n - written, &pnum))
+        {
+            if (old_is_zero) {
+                ret = blk_co_pwrite_zeroes(s->blk, offset + written, pnum, 0);
+            } else {
+                ret = blk_co_pwrite(s->blk, offset + written, pnum,
+                                    buf_old + written, 0);
+            }
+            if (ret < 0) {
+                error_report("Error while writing to COW image: %s",
+                    strerror(-ret));
+                return ret;
+            }
+        }
+
+        written += pnum;
+    }
+
+    return 0;
+}
+
+static void coroutine_fn rebase_co_do_rebase(void *opaque)
+{
+    ImgRebaseState *s = opaque;
+    uint8_t *buf_old = blk_blockalign(s->blk, IO_BUF_SIZE);
+    uint8_t *buf_new = blk_blockalign(s->blk, IO_BUF_SIZE);
+    int ret;
+
+    s->running_coroutines++;
+    while (1) {
+        int64_t offset, n;
+        bool old_is_zero, new_is_zero;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret != -EINPROGRESS || s->offset >= s->size) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        offset = s->offset;
+        ret = rebase_co_next_range(s, offset, &n, &old_is_zero,
+                                   &new_is_zero);
+        if (ret < 0) {
+            qemu_co_mutex_unlock(&s->lock);
+            s->ret = ret;
+            break;
+        }
+        /* let other coroutines continue with the next range already */
+        s->offset += n;
+        qemu_co_mutex_unlock(&s->lock);
+
+        if (ret) {
+            ret = rebase_co_copy_range(s, offset, n, old_is_zero, new_is_zero,
+                                       buf_old, buf_new);
+            if (ret < 0) {
+                s->ret = ret;
+                break;
+            }
+        }
+        qemu_progress_print(100.0 * n / s->size, 100);
+    }
+
+    qemu_vfree(buf_old);
+    qemu_vfree(buf_new);
+    s->running_coroutines--;
+    if (!s->running_coroutines && s->ret == -EINPROGRESS) {
+        /* the rebase finished successfully */
+        s->ret = 0;
+    }
+}
+
 static int img_rebase(int argc, char **argv)
 {
     BlockBackend *blk = NULL, *blk_old_backing = NULL, *blk_new_backing = NULL;
-    uint8_t *buf_old = NULL;
-    uint8_t *buf_new = NULL;
     BlockDriverState *bs = NULL, *prefix_chain_bs = NULL;
     char *filename;
     const char *fmt, *cache, *src_cache, *out_basefmt, *out_baseimg;
@@ -3236,6 +4334,7 @@ static int img_rebase(int argc, char **argv)
     bool quiet = false;
     Error *local_err = NULL;
     bool image_opts = false;
+    long num_coroutines = 8;
 
     /* Parse commandline parameters */
     fmt = NULL;
@@ -3251,7 +4350,7 @@ static int img_rebase(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:b:upt:T:qU",
+        c = getopt_long(argc, argv, ":hf:F:b:m:upt:T:qU",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -3275,6 +4374,14 @@ static int img_rebase(int argc, char **argv)
         case 'b':
             out_baseimg = optarg;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                return 1;
+            }
+            break;
         case 'u':
             unsafe = 1;
             break;
@@ -3461,142 +4568,59 @@ static int img_rebase(int argc, char **argv)
      * the image is the same as the original one at any time.
      */
     if (!unsafe) {
-        int64_t size;
-        int64_t old_backing_size = 0;
-        int64_t new_backing_size = 0;
-        uint64_t offset;
-        int64_t n;
-        float local_progress = 0;
-
-        buf_old = blk_blockalign(blk, IO_BUF_SIZE);
-        buf_new = blk_blockalign(blk, IO_BUF_SIZE);
+        ImgRebaseState s = {
+            .blk                = blk,
+            .blk_old_backing    = blk_old_backing,
+            .blk_new_backing    = blk_new_backing,
+            .prefix_chain_bs    = prefix_chain_bs,
+            .num_coroutines     = num_coroutines,
+            .ret                = -EINPROGRESS,
+        };
+        int i;
 
-        size = blk_getlength(blk);
-        if (size < 0) {
+        s.size = blk_getlength(blk);
+        if (s.size < 0) {
             error_report("Could not get size of '%s': %s",
-                         filename, strerror(-size));
+                         filename, strerror(-s.size));
             ret = -1;
             goto out;
         }
         if (blk_old_backing) {
-            old_backing_size = blk_getlength(blk_old_backing);
-            if (old_backing_size < 0) {
+            s.old_backing_size = blk_getlength(blk_old_backing);
+            if (s.old_backing_size < 0) {
                 char backing_name[PATH_MAX];
 
                 bdrv_get_backing_filename(bs, backing_name,
                                           sizeof(backing_name));
                 error_report("Could not get size of '%s': %s",
-                             backing_name, strerror(-old_backing_size));
+                             backing_name, strerror(-s.old_backing_size));
                 ret = -1;
                 goto out;
             }
         }
         if (blk_new_backing) {
-            new_backing_size = blk_getlength(blk_new_backing);
-            if (new_backing_size < 0) {
+            s.new_backing_size = blk_getlength(blk_new_backing);
+            if (s.new_backing_size < 0) {
                 error_report("Could not get size of '%s': %s",
-                             out_baseimg, strerror(-new_backing_size));
+                             out_baseimg, strerror(-s.new_backing_size));
                 ret = -1;
                 goto out;
             }
         }
 
-        if (size != 0) {
-            local_progress = (float)100 / (size / MIN(size, IO_BUF_SIZE));
+        qemu_co_mutex_init(&s.lock);
+        for (i = 0; i < s.num_coroutines; i++) {
+            Coroutine *co = qemu_coroutine_create(rebase_co_do_rebase, &s);
+            qemu_coroutine_enter(co);
         }
 
-        for (offset = 0; offset < size; offset += n) {
-            bool buf_old_is_zero = false;
-
-            /* How many bytes can we handle with the next read? */
-            n = MIN(IO_BUF_SIZE, size - offset);
-
-            /* If the cluster is allocated, we don't need to take action */
-            ret = bdrv_is_allocated(bs, offset, n, &n);
-            if (ret < 0) {
-                error_report("error while reading image metadata: %s",
-                             strerror(-ret));
-                goto out;
-            }
-            if (ret) {
-                continue;
-            }
-
-            if (prefix_chain_bs) {
-                /*
-                 * If cluster wasn't changed since prefix_chain, we don't need
-                 * to take action
-                 */
-                ret = bdrv_is_allocated_above(backing_bs(bs), prefix_chain_bs,
-                                              false, offset, n, &n);
-                if (ret < 0) {
-                    error_report("error while reading image metadata: %s",
-                                 strerror(-ret));
-                    goto out;
-                }
-                if (!ret) {
-                    continue;
-                }
-            }
-
-            /*
-             * Read old and new backing file and take into consideration that
-             * backing files may be smaller than the COW image.
-             */
-            if (offset >= old_backing_size) {
-                memset(buf_old, 0, n);
-                buf_old_is_zero = true;
-            } else {
-                if (offset + n > old_backing_size) {
-                    n = old_backing_size - offset;
-                }
-
-                ret = blk_pread(blk_old_backing, offset, buf_old, n);
-                if (ret < 0) {
-                    error_report("error while reading from old backing file");
-                    goto out;
-                }
-            }
-
-            if (offset >= new_backing_size || !blk_new_backing) {
-                memset(buf_new, 0, n);
-            } else {
-                if (offset + n > new_backing_size) {
-                    n = new_backing_size - offset;
-                }
-
-                ret = blk_pread(blk_new_backing, offset, buf_new, n);
-                if (ret < 0) {
-                    error_report("error while reading from new backing file");
-                    goto out;
-                }
-            }
-
-            /* If they differ, we need to write to the COW file */
-            uint64_t written = 0;
-
-            while (written < n) {
-                int64_t pnum;
-
-                if (compare_buffers(buf_old + written, buf_new + written,
-                                    n - written, &pnum))
-                {
-                    if (buf_old_is_zero) {
-                        ret = blk_pwrite_zeroes(blk, offset + written, pnum, 0);
-                    } else {
-                        ret = blk_pwrite(blk, offset + written,
-                                         buf_old + written, pnum, 0);
-                    }
-                    if (ret < 0) {
-                        error_report("Error while writing to COW image: %s",
-                            strerror(-ret));
-                        goto out;
-                    }
-                }
+        while (s.running_coroutines) {
+            main_loop_wait(false);
+        }
 
-                written += pnum;
-            }
-            qemu_progress_print(local_progress, 100);
+        ret = s.ret;
+        if (ret < 0) {
+            goto out;
         }
     }
 
@@ -3633,8 +4657,6 @@ out:
         blk_unref(blk_old_backing);
         blk_unref(blk_new_backing);
     }
-    qemu_vfree(buf_old);
-    qemu_vfree(buf_new);
 
     blk_unref(blk);
     if (ret) {
@@ -4061,38 +5083,231 @@ static int img_amend(int argc, char **argv)
         goto out;
     }
 
-out:
-    qemu_progress_end();
+out:
+    qemu_progress_end();
+
+out_no_progress:
+    blk_unref(blk);
+    qemu_opts_del(opts);
+    qemu_opts_free(create_opts);
+    g_free(options);
+
+    if (ret) {
+        return 1;
+    }
+    return 0;
+}
+
+typedef enum BenchAccess {
+    BENCH_ACCESS_SEQUENTIAL,
+    BENCH_ACCESS_RANDOM,
+    BENCH_ACCESS_ZIPF,
+} BenchAccess;
+
+/*
+ * Latencies below 2^BENCH_HIST_SUB_BITS ns are counted exactly; above that,
+ * each power of two is split into 2^BENCH_HIST_SUB_BITS buckets, so that
+ * percentiles are accurate to about 3%.
+ */
+#define BENCH_HIST_SUB_BITS 5
+#define BENCH_HIST_BUCKETS ((64 - BENCH_HIST_SUB_BITS + 1) << \
+                            BENCH_HIST_SUB_BITS)
+
+typedef struct BenchLatency {
+    uint64_t requests;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[BENCH_HIST_BUCKETS];
+} BenchLatency;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchRequest {
+    BenchData *b;
+    bool write;
+    int64_t start_ns;
+    QEMUIOVector read_qiov;
+    QEMUIOVector write_qiov;
+} BenchRequest;
+
+struct BenchData {
+    BlockBackend *blk;
+    uint64_t image_size;
+    bool write;
+    int read_ratio;
+    BenchAccess access;
+    GRand *rand;
+    uint64_t nb_blocks;
+    double zipf_theta;
+    double zipf_zetan;
+    double zipf_eta;
+    int bufsize;
+    int step;
+    int nrreq;
+    int n;
+    int flush_interval;
+    bool drain_on_flush;
+    uint8_t *buf;
+    BenchRequest *reqs;
+    BenchRequest **free_reqs;
+    int nb_free_reqs;
+
+    int in_flight;
+    bool in_flush;
+    uint64_t offset;
+    /* Indexed by BenchRequest.write */
+    BenchLatency latency[2];
+};
+
+static void bench_latency_add(BenchLatency *lat, uint64_t ns)
+{
+    int idx;
+
+    if (ns < (1 << BENCH_HIST_SUB_BITS)) {
+        idx = ns;
+    } else {
+        int shift = 63 - clz64(ns) - BENCH_HIST_SUB_BITS;
+
+        idx = ((shift + 1) << BENCH_HIST_SUB_BITS) +
+              ((ns >> shift) & ((1 << BENCH_HIST_SUB_BITS) - 1));
+    }
+    lat->buckets[idx]++;
+
+    if (!lat->requests || ns < lat->min_ns) {
+        lat->min_ns = ns;
+    }
+    lat->max_ns = MAX(lat->max_ns, ns);
+    lat->total_ns += ns;
+    lat->requests++;
+}
+
+/* Return the upper bound of the bucket that contains percentile @p */
+static uint64_t bench_latency_percentile(BenchLatency *lat, double p)
+{
+    uint64_t target = MAX(1, (uint64_t)ceil(lat->requests * p / 100));
+    uint64_t sum = 0;
+    int idx;
+
+    for (idx = 0; idx < BENCH_HIST_BUCKETS; idx++) {
+        sum += lat->buckets[idx];
+        if (sum >= target) {
+            break;
+        }
+    }
+    if (idx < (1 << BENCH_HIST_SUB_BITS)) {
+        return idx;
+    } else {
+        int shift = (idx >> BENCH_HIST_SUB_BITS) - 1;
+        uint64_t low = (uint64_t)((idx & ((1 << BENCH_HIST_SUB_BITS) - 1)) |
+                                  (1 << BENCH_HIST_SUB_BITS)) << shift;
+
+        return MIN(low + (1ULL << shift) - 1, lat->max_ns);
+    }
+}
+
+/*
+ * Zipf distributed ranks, computed as in Gray et al., "Quickly Generating
+ * Billion-Record Synthetic Databases".  Rank 0 is the most frequent one.
+ */
+static void bench_zipf_init(BenchData *b)
+{
+    uint64_t n = b->nb_blocks;
+    double theta = b->zipf_theta;
+    double zeta2 = 1 + pow(0.5, theta);
+    uint64_t i;
+
+    b->zipf_zetan = 0;
+    for (i = 1; i <= n; i++) {
+        b->zipf_zetan += 1 / pow(i, theta);
+    }
+    if (n > 2) {
+        b->zipf_eta = (1 - pow(2.0 / n, 1 - theta)) /
+                      (1 - zeta2 / b->zipf_zetan);
+    }
+}
+
+static uint64_t bench_zipf_next(BenchData *b)
+{
+    double theta = b->zipf_theta;
+    double u = g_rand_double(b->rand);
+    double uz = u * b->zipf_zetan;
+    double eta = b->zipf_eta;
+    uint64_t rank;
+
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, theta)) {
+        return 1;
+    }
+    rank = b->nb_blocks * pow(eta * u - eta + 1, 1 / (1 - theta));
+    return MIN(rank, b->nb_blocks - 1);
+}
+
+static int64_t bench_next_offset(BenchData *b)
+{
+    int64_t offset;
+    uint64_t block;
 
-out_no_progress:
-    blk_unref(blk);
-    qemu_opts_del(opts);
-    qemu_opts_free(create_opts);
-    g_free(options);
+    switch (b->access) {
+    case BENCH_ACCESS_SEQUENTIAL:
+        offset = b->offset;
+        b->offset += b->step;
+        b->offset %= b->image_size;
+        return offset;
+    case BENCH_ACCESS_RANDOM:
+        block = g_rand_double(b->rand) * b->nb_blocks;
+        break;
+    case BENCH_ACCESS_ZIPF:
+        /* Spread the popular blocks over the whole image */
+        block = (bench_zipf_next(b) * 2654435761ULL) % b->nb_blocks;
+        break;
+    default:
+        abort();
+    }
+    return MIN(block, b->nb_blocks - 1) * b->bufsize;
+}
 
-    if (ret) {
-        return 1;
+static bool bench_next_is_write(BenchData *b)
+{
+    if (b->read_ratio == 0 || b->read_ratio == 100) {
+        return b->read_ratio == 0;
     }
-    return 0;
+    return g_rand_int_range(b->rand, 0, 100) >= b->read_ratio;
 }
 
-typedef struct BenchData {
-    BlockBackend *blk;
-    uint64_t image_size;
-    bool write;
-    int bufsize;
-    int step;
-    int nrreq;
-    int n;
-    int flush_interval;
-    bool drain_on_flush;
-    uint8_t *buf;
-    QEMUIOVector *qiov;
+static void bench_cb(void *opaque, int ret);
 
-    int in_flight;
-    bool in_flush;
-    uint64_t offset;
-} BenchData;
+/* Called with the AioContext of b->blk held */
+static void bench_submit(BenchData *b)
+{
+    BlockAIOCB *acb;
+
+    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
+        BenchRequest *req = b->free_reqs[--b->nb_free_reqs];
+        int64_t offset = bench_next_offset(b);
+
+        /* blk_aio_* might look for completed I/Os and kick bench_cb
+         * again, so make sure this operation is counted by in_flight
+         * and b->offset is ready for the next submission.
+         */
+        b->in_flight++;
+        req->write = bench_next_is_write(b);
+        req->start_ns = get_clock();
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->write_qiov, 0,
+                                  bench_cb, req);
+        } else {
+            acb = blk_aio_preadv(b->blk, offset, &req->read_qiov, 0,
+                                 bench_cb, req);
+        }
+        if (!acb) {
+            error_report("Failed to issue request");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4102,69 +5317,214 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
-static void bench_cb(void *opaque, int ret)
+static void bench_drained_flush_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
-    BlockAIOCB *acb;
+    AioContext *ctx = blk_get_aio_context(b->blk);
 
     if (ret < 0) {
-        error_report("Failed request: %s", strerror(-ret));
+        error_report("Failed flush request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
 
-    if (b->in_flush) {
-        /* Just finished a flush with drained queue: Start next requests */
-        assert(b->in_flight == 0);
-        b->in_flush = false;
-    } else if (b->in_flight > 0) {
-        int remaining = b->n - b->in_flight;
+    /* Just finished a flush with drained queue: Start next requests */
+    aio_context_acquire(ctx);
+    assert(b->in_flight == 0);
+    b->in_flush = false;
+    bench_submit(b);
+    aio_context_release(ctx);
+}
+
+static void bench_complete(BenchRequest *req)
+{
+    BenchData *b = req->b;
+    int remaining = b->n - b->in_flight;
+    BlockAIOCB *acb;
 
-        b->n--;
-        b->in_flight--;
+    bench_latency_add(&b->latency[req->write], get_clock() - req->start_ns);
+    b->free_reqs[b->nb_free_reqs++] = req;
 
-        /* Time for flush? Drain queue if requested, then flush */
-        if (b->flush_interval && remaining % b->flush_interval == 0) {
-            if (!b->in_flight || !b->drain_on_flush) {
-                BlockCompletionFunc *cb;
+    b->n--;
+    b->in_flight--;
+    if (b->n == 0) {
+        /* With --iothread, img_bench() waits in AIO_WAIT_WHILE() */
+        aio_wait_kick();
+    }
 
-                if (b->drain_on_flush) {
-                    b->in_flush = true;
-                    cb = bench_cb;
-                } else {
-                    cb = bench_undrained_flush_cb;
-                }
+    /* Time for flush? Drain queue if requested, then flush */
+    if (b->flush_interval && remaining % b->flush_interval == 0) {
+        if (!b->in_flight || !b->drain_on_flush) {
+            BlockCompletionFunc *cb;
 
-                acb = blk_aio_flush(b->blk, cb, b);
-                if (!acb) {
-                    error_report("Failed to issue flush request");
-                    exit(EXIT_FAILURE);
-                }
-            }
             if (b->drain_on_flush) {
-                return;
+                b->in_flush = true;
+                cb = bench_drained_flush_cb;
+            } else {
+                cb = bench_undrained_flush_cb;
+            }
+
+            acb = blk_aio_flush(b->blk, cb, b);
+            if (!acb) {
+                error_report("Failed to issue flush request");
+                exit(EXIT_FAILURE);
             }
         }
+        if (b->drain_on_flush) {
+            return;
+        }
     }
 
-    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
-        /* blk_aio_* might look for completed I/Os and kick bench_cb
-         * again, so make sure this operation is counted by in_flight
-         * and b->offset is ready for the next submission.
-         */
-        b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+    bench_submit(b);
+}
+
+static void bench_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    AioContext *ctx = blk_get_aio_context(req->b->blk);
+
+    if (ret < 0) {
+        error_report("Failed request: %s", strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+
+    aio_context_acquire(ctx);
+    bench_complete(req);
+    aio_context_release(ctx);
+}
+
+static ImageBenchOps *bench_get_ops(BenchLatency *lat, int bufsize,
+                                    int64_t time_ns)
+{
+    ImageBenchOps *ops;
+
+    if (!lat->requests) {
+        return NULL;
+    }
+
+    ops = g_new0(ImageBenchOps, 1);
+    *ops = (ImageBenchOps) {
+        .requests           = lat->requests,
+        .iops               = lat->requests * NANOSECONDS_PER_SECOND /
+                              MAX(time_ns, 1),
+        .bytes_per_second   = (double)lat->requests * bufsize *
+                              NANOSECONDS_PER_SECOND / MAX(time_ns, 1),
+        .min_ns             = lat->min_ns,
+        .mean_ns            = lat->total_ns / lat->requests,
+        .max_ns             = lat->max_ns,
+        .p50_ns             = bench_latency_percentile(lat, 50),
+        .p99_ns             = bench_latency_percentile(lat, 99),
+        .p999_ns            = bench_latency_percentile(lat, 99.9),
+    };
+    return ops;
+}
+
+static void dump_human_bench_ops(const char *name, ImageBenchOps *ops)
+{
+    if (!ops) {
+        return;
+    }
+    printf("%s: %" PRId64 " requests, %" PRId64 " IOPS, %.1f MiB/s\n",
+           name, ops->requests, ops->iops,
+           (double)ops->bytes_per_second / MiB);
+    printf("  latency (us): min %.1f, mean %.1f, max %.1f, "
+           "p50 %.1f, p99 %.1f, p99.9 %.1f\n",
+           ops->min_ns / 1000.0, ops->mean_ns / 1000.0,
+           ops->max_ns / 1000.0, ops->p50_ns / 1000.0,
+           ops->p99_ns / 1000.0, ops->p999_ns / 1000.0);
+}
+
+static void dump_json_image_bench(ImageBench *bench)
+{
+    QString *str;
+    QObject *obj;
+    Visitor *v = qobject_output_visitor_new(&obj);
+
+    visit_type_ImageBench(v, NULL, &bench, &error_abort);
+    visit_complete(v, &obj);
+    str = qobject_to_json_pretty(obj);
+    assert(str != NULL);
+    printf("%s\n", qstring_get_str(str));
+    qobject_unref(obj);
+    visit_free(v);
+    qobject_unref(str);
+}
+
+static ImageBenchRun *bench_run(BenchData *b, int depth, int count,
+                                int64_t offset, unsigned int seed,
+                                OutputFormat output_format)
+{
+    AioContext *ctx = blk_get_aio_context(b->blk);
+    ImageBenchRun *run;
+    int64_t t1, t2;
+    int i;
+
+    b->nrreq = depth;
+    b->n = count;
+    b->offset = offset;
+    b->in_flight = 0;
+    b->in_flush = false;
+    memset(b->latency, 0, sizeof(b->latency));
+    g_rand_set_seed(b->rand, seed);
+
+    b->nb_free_reqs = depth;
+    for (i = 0; i < depth; i++) {
+        b->free_reqs[i] = &b->reqs[i];
+    }
+
+    if (output_format == OFORMAT_HUMAN) {
+        char *type;
+
+        if (b->read_ratio == 0 || b->read_ratio == 100) {
+            type = g_strdup(b->write ? "write" : "read");
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            type = g_strdup_printf("mixed (%d%% read)", b->read_ratio);
         }
-        if (!acb) {
-            error_report("Failed to issue request");
-            exit(EXIT_FAILURE);
+        printf("Sending %d %s requests, %d bytes each, %d in parallel ",
+               b->n, type, b->bufsize, b->nrreq);
+        switch (b->access) {
+        case BENCH_ACCESS_SEQUENTIAL:
+            printf("(starting at offset %" PRId64 ", step size %d)\n",
+                   offset, b->step);
+            break;
+        case BENCH_ACCESS_RANDOM:
+            printf("(random offsets)\n");
+            break;
+        case BENCH_ACCESS_ZIPF:
+            printf("(zipf distributed offsets, theta %g)\n", b->zipf_theta);
+            break;
+        }
+        if (b->flush_interval) {
+            printf("Sending flush every %d requests\n", b->flush_interval);
         }
+        g_free(type);
+    }
+
+    aio_context_acquire(ctx);
+    t1 = get_clock();
+    bench_submit(b);
+    AIO_WAIT_WHILE(ctx, b->n > 0);
+    t2 = get_clock();
+    aio_context_release(ctx);
+
+    run = g_new0(ImageBenchRun, 1);
+    *run = (ImageBenchRun) {
+        .depth      = depth,
+        .requests   = count,
+        .time_ns    = t2 - t1,
+    };
+    run->read = bench_get_ops(&b->latency[false], b->bufsize, t2 - t1);
+    run->has_read = run->read != NULL;
+    run->write = bench_get_ops(&b->latency[true], b->bufsize, t2 - t1);
+    run->has_write = run->write != NULL;
+
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Run completed in %3.3f seconds.\n",
+               (double)run->time_ns / NANOSECONDS_PER_SECOND);
+        dump_human_bench_ops("read", run->read);
+        dump_human_bench_ops("write", run->write);
     }
+
+    return run;
 }
 
 static int img_bench(int argc, char **argv)
@@ -4175,19 +5535,32 @@ static int img_bench(int argc, char **argv)
     bool image_opts = false;
     bool is_write = false;
     int count = 75000;
-    int depth = 64;
+    int default_depth = 64;
+    int *depths = &default_depth;
+    int nb_depths = 1;
+    int max_depth = 0;
     int64_t offset = 0;
     size_t bufsize = 4096;
     int pattern = 0;
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    int read_ratio = -1;
+    BenchAccess access = BENCH_ACCESS_SEQUENTIAL;
+    double zipf_theta = 1.2;
+    unsigned long seed = 0;
+    bool use_iothread = false;
+    IOThread *iothread = NULL;
+    const char *output = NULL;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
+    ImageBench *bench = NULL;
+    ImageBenchRunList **next_run;
+    Error *local_err = NULL;
     int flags = 0;
     bool writethrough = false;
-    struct timeval t1, t2;
     int i;
     bool force_share = false;
     size_t buf_size;
@@ -4200,6 +5573,12 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"access", required_argument, 0, OPTION_ACCESS},
+            {"zipf-theta", required_argument, 0, OPTION_ZIPF_THETA},
+            {"read-ratio", required_argument, 0, OPTION_READ_RATIO},
+            {"seed", required_argument, 0, OPTION_SEED},
+            {"iothread", no_argument, 0, OPTION_IOTHREAD},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:no:qs:S:t:wU", long_options, NULL);
@@ -4230,13 +5609,29 @@ static int img_bench(int argc, char **argv)
         }
         case 'd':
         {
-            unsigned long res;
+            char **list = g_strsplit(optarg, ",", 0);
 
-            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > INT_MAX) {
+            if (depths != &default_depth) {
+                g_free(depths);
+            }
+            nb_depths = g_strv_length(list);
+            depths = g_new(int, MAX(nb_depths, 1));
+            for (i = 0; i < nb_depths; i++) {
+                unsigned long res;
+
+                if (qemu_strtoul(list[i], NULL, 0, &res) < 0 ||
+                    res == 0 || res > INT_MAX) {
+                    nb_depths = 0;
+                    break;
+                }
+                depths[i] = res;
+            }
+            g_strfreev(list);
+            if (nb_depths == 0) {
                 error_report("Invalid queue depth specified");
+                g_free(depths);
                 return 1;
             }
-            depth = res;
             break;
         }
         case 'f':
@@ -4327,6 +5722,48 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_ACCESS:
+            if (!strcmp(optarg, "sequential")) {
+                access = BENCH_ACCESS_SEQUENTIAL;
+            } else if (!strcmp(optarg, "random")) {
+                access = BENCH_ACCESS_RANDOM;
+            } else if (!strcmp(optarg, "zipf")) {
+                access = BENCH_ACCESS_ZIPF;
+            } else {
+                error_report("Invalid access pattern specified");
+                return 1;
+            }
+            break;
+        case OPTION_ZIPF_THETA:
+            if (qemu_strtod_finite(optarg, NULL, &zipf_theta) < 0 ||
+                zipf_theta <= 0 || zipf_theta == 1) {
+                error_report("Invalid zipf theta specified");
+                return 1;
+            }
+            break;
+        case OPTION_READ_RATIO:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read ratio specified");
+                return 1;
+            }
+            read_ratio = res;
+            break;
+        }
+        case OPTION_SEED:
+            if (qemu_strtoul(optarg, NULL, 0, &seed) < 0 || seed > UINT_MAX) {
+                error_report("Invalid seed specified");
+                return 1;
+            }
+            break;
+        case OPTION_IOTHREAD:
+            use_iothread = true;
+            break;
+        case OPTION_OUTPUT:
+            output = optarg;
+            break;
         }
     }
 
@@ -4335,16 +5772,44 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (output && !strcmp(output, "json")) {
+        output_format = OFORMAT_JSON;
+    } else if (output && !strcmp(output, "human")) {
+        output_format = OFORMAT_HUMAN;
+    } else if (output) {
+        error_report("--output must be used with human or json as argument.");
+        ret = -1;
+        goto out;
+    }
+
+    if (read_ratio < 0) {
+        read_ratio = is_write ? 0 : 100;
+    }
+    if (!is_write && read_ratio < 100) {
+        error_report("--read-ratio below 100 is only available in write "
+                     "tests");
+        ret = -1;
+        goto out;
+    }
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
     }
-    if (flush_interval && flush_interval < depth) {
+
+    for (i = 0; i < nb_depths; i++) {
+        max_depth = MAX(max_depth, depths[i]);
+    }
+    if (flush_interval && flush_interval < max_depth) {
         error_report("Flush interval can't be smaller than depth");
         ret = -1;
         goto out;
     }
+    if (access != BENCH_ACCESS_SEQUENTIAL && (offset || step)) {
+        error_report("-o and -S can only be used with sequential access");
+        ret = -1;
+        goto out;
+    }
 
     blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
                    force_share);
@@ -4359,57 +5824,110 @@ static int img_bench(int argc, char **argv)
         goto out;
     }
 
+    /* The thread is created only now so that it need not be stopped if
+     * opening the image fails */
+    if (use_iothread) {
+        iothread = iothread_create("qemu-img-bench-iothread", &error_fatal);
+        ret = blk_set_aio_context(blk, iothread_get_aio_context(iothread),
+                                  &local_err);
+        if (ret < 0) {
+            error_reportf_err(local_err, "Failed to use an I/O thread: ");
+            goto out;
+        }
+    }
+
     data = (BenchData) {
         .blk            = blk,
         .image_size     = image_size,
         .bufsize        = bufsize,
         .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
         .write          = is_write,
+        .read_ratio     = read_ratio,
+        .access         = access,
+        .rand           = g_rand_new(),
+        .nb_blocks      = bufsize ? image_size / bufsize : 0,
+        .zipf_theta     = zipf_theta,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (access != BENCH_ACCESS_SEQUENTIAL) {
+        if (data.nb_blocks == 0) {
+            error_report("The image is smaller than the buffer size");
+            ret = -1;
+            goto out;
+        }
+        if (access == BENCH_ACCESS_ZIPF) {
+            bench_zipf_init(&data);
+        }
     }
 
-    buf_size = data.nrreq * data.bufsize;
+    /* Reads go to the second half of the buffer, so that the pattern of
+     * the writes is kept in mixed tests */
+    buf_size = 2 * (size_t)max_depth * data.bufsize;
     data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
+    memset(data.buf, pattern, buf_size);
 
     blk_register_buf(blk, data.buf, buf_size);
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
+    data.reqs = g_new0(BenchRequest, max_depth);
+    data.free_reqs = g_new(BenchRequest *, max_depth);
+    for (i = 0; i < max_depth; i++) {
+        BenchRequest *req = &data.reqs[i];
+
+        req->b = &data;
+        qemu_iovec_init(&req->write_qiov, 1);
+        qemu_iovec_add(&req->write_qiov,
                        data.buf + i * data.bufsize, data.bufsize);
+        qemu_iovec_init(&req->read_qiov, 1);
+        qemu_iovec_add(&req->read_qiov,
+                       data.buf + (max_depth + i) * data.bufsize,
+                       data.bufsize);
     }
 
-    gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
-
-    while (data.n > 0) {
-        main_loop_wait(false);
+    bench = g_new0(ImageBench, 1);
+    bench->filename = g_strdup(filename);
+    bench->format = g_strdup(bdrv_get_format_name(blk_bs(blk)));
+    next_run = &bench->runs;
+    for (i = 0; i < nb_depths; i++) {
+        *next_run = g_new0(ImageBenchRunList, 1);
+        (*next_run)->value = bench_run(&data, depths[i], count, offset, seed,
+                                       output_format);
+        next_run = &(*next_run)->next;
     }
-    gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    if (output_format == OFORMAT_JSON) {
+        dump_json_image_bench(bench);
+    }
 
 out:
+    if (data.reqs) {
+        for (i = 0; i < max_depth; i++) {
+            qemu_iovec_destroy(&data.reqs[i].read_qiov);
+            qemu_iovec_destroy(&data.reqs[i].write_qiov);
+        }
+    }
+    g_free(data.reqs);
+    g_free(data.free_reqs);
+    if (data.rand) {
+        g_rand_free(data.rand);
+    }
     if (data.buf) {
         blk_unregister_buf(blk, data.buf);
     }
     qemu_vfree(data.buf);
+    qapi_free_ImageBench(bench);
+    if (iothread) {
+        AioContext *ctx = blk_get_aio_context(blk);
+
+        aio_context_acquire(ctx);
+        blk_set_aio_context(blk, qemu_get_aio_context(), &error_abort);
+        aio_context_release(ctx);
+        iothread_destroy(iothread);
+    }
     blk_unref(blk);
+    if (depths != &default_depth) {
+        g_free(depths);
+    }
 
     if (ret) {
         return 1;
@@ -4504,6 +6022,69 @@ static int img_dd_skip(const char *arg,
     return 0;
 }
 
+/*
+ * Copy @bytes bytes starting at @offset of @src to the start of the newly
+ * created @target with the convert engine, so that unallocated and zero
+ * ranges of the source are skipped and several requests are in flight.
+ * @offset and @bytes must be multiples of the sector size.
+ */
+static int img_dd_do_convert(BlockBackend *src, BlockBackend *target,
+                             int64_t offset, int64_t bytes, bool copy_range,
+                             long num_coroutines)
+{
+    BlockDriverState *out_bs = blk_bs(target);
+    BlockDriverInfo bdi;
+    int64_t src_sectors;
+
+    ImgConvertState s = (ImgConvertState) {
+        .src                    = &src,
+        .src_sectors            = &src_sectors,
+        .src_num                = 1,
+        .src_skip               = offset >> BDRV_SECTOR_BITS,
+        .total_sectors          = bytes >> BDRV_SECTOR_BITS,
+        .target                 = target,
+        .target_is_new          = true,
+        .target_backing_sectors = -1,
+        .min_sparse             = 8,
+        .copy_range             = copy_range,
+        .buf_sectors            = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
+        .wr_in_order            = true,
+        .num_coroutines         = num_coroutines,
+        .quiet                  = true,
+    };
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, BDRV_SECTOR_SIZE));
+
+    src_sectors = blk_nb_sectors(src);
+    if (src_sectors < 0) {
+        error_report("Could not get size of input image file: %s",
+                     strerror(-src_sectors));
+        return src_sectors;
+    }
+
+    s.buf_sectors = MIN(MAX_BUF_SECTORS,
+                        MAX(s.buf_sectors,
+                            MAX(out_bs->bl.opt_transfer >> BDRV_SECTOR_BITS,
+                                out_bs->bl.pdiscard_alignment >>
+                                BDRV_SECTOR_BITS)));
+    s.alignment = MAX(pow2floor(s.min_sparse),
+                      DIV_ROUND_UP(out_bs->bl.request_alignment,
+                                   BDRV_SECTOR_SIZE));
+
+    if (bdrv_get_info(out_bs, &bdi) == 0) {
+        s.compressed = bdi.needs_compressed_writes;
+        s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
+        s.unallocated_blocks_are_zero = bdi.unallocated_blocks_are_zero;
+    }
+    if (s.compressed && s.copy_range) {
+        error_report("Cannot enable copy offloading for a format that needs "
+                     "compressed writes");
+        return -ENOTSUP;
+    }
+
+    return convert_do_copy(&s);
+}
+
 static int img_dd(int argc, char **argv)
 {
     int ret = 0;
@@ -4521,6 +6102,8 @@ static int img_dd(int argc, char **argv)
     int64_t size = 0;
     int64_t block_count = 0, out_pos, in_pos;
     bool force_share = false;
+    bool copy_range = false;
+    long num_coroutines = 8;
     struct DdInfo dd = {
         .flags = 0,
         .count = 0,
@@ -4554,7 +6137,7 @@ static int img_dd(int argc, char **argv)
         { 0, 0, 0, 0 }
     };
 
-    while ((c = getopt_long(argc, argv, ":hf:O:U", long_options, NULL))) {
+    while ((c = getopt_long(argc, argv, ":hf:O:CUm:", long_options, NULL))) {
         if (c == EOF) {
             break;
         }
@@ -4574,9 +6157,21 @@ static int img_dd(int argc, char **argv)
         case 'h':
             help();
             break;
+        case 'C':
+            copy_range = true;
+            break;
         case 'U':
             force_share = true;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                ret = -1;
+                goto out;
+            }
+            break;
         case OPTION_OBJECT:
             if (!qemu_opts_parse_noisily(&qemu_object_opts, optarg, true)) {
                 ret = -1;
@@ -4727,6 +6322,19 @@ static int img_dd(int argc, char **argv)
         in_pos = in.offset * in.bsz;
     }
 
+    if (in_pos < size && QEMU_IS_ALIGNED(in_pos | size, BDRV_SECTOR_SIZE)) {
+        qemu_progress_init(false, 1.0);
+        ret = img_dd_do_convert(blk1, blk2, in_pos, size - in_pos,
+                                copy_range, num_coroutines);
+        qemu_progress_end();
+        if (ret < 0) {
+            ret = -1;
+        }
+        goto out;
+    }
+
+    /* Ranges that do not start and end on a sector boundary are copied one
+     * block at a time */
     in.buf = g_new(uint8_t, in.bsz);
 
     for (out_pos = 0; in_pos < size; block_count++) {
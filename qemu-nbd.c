@@ -25,6 +25,7 @@
 #include "qapi/error.h"
 #include "qemu/cutils.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
 #include "block/block_int.h"
 #include "block/nbd.h"
 #include "qemu/main-loop.h"
@@ -62,6 +63,7 @@
 #define QEMU_NBD_OPT_FORK          263
 #define QEMU_NBD_OPT_TLSAUTHZ      264
 #define QEMU_NBD_OPT_PID_FILE      265
+#define QEMU_NBD_OPT_IOTHREAD      266
 
 #define MBR_SIZE 512
 
@@ -76,6 +78,7 @@ static int nb_fds;
 static QIONetListener *server;
 static QCryptoTLSCreds *tlscreds;
 static const char *tlsauthz;
+static IOThread *iothread;
 
 static void usage(const char *name)
 {
@@ -135,9 +138,10 @@ static void usage(const char *name)
 "                            '[ID_OR_NAME]'\n"
 "  -n, --nocache             disable host cache\n"
 "      --cache=MODE          set cache mode (none, writeback, ...)\n"
-"      --aio=MODE            set AIO mode (native or threads)\n"
+"      --aio=MODE            set AIO mode (native, io_uring or threads)\n"
 "      --discard=MODE        set discard mode (ignore, unmap)\n"
 "      --detect-zeroes=MODE  set detect-zeroes mode (off, on, unmap)\n"
+"      --iothread            process requests in a separate I/O thread\n"
 "      --image-opts          treat FILE as a full set of image options\n"
 "\n"
 QEMU_HELP_BOTTOM "\n"
@@ -426,12 +430,42 @@ static void nbd_export_closed(NBDExport *export)
 {
     assert(state == TERMINATING);
     state = TERMINATED;
+    /* With --iothread, this runs outside of the main loop */
+    qemu_notify_event();
 }
 
 static void nbd_update_server_watch(void);
 
+typedef struct NBDClientClosed {
+    NBDClient *client;
+    bool negotiated;
+} NBDClientClosed;
+
+static void nbd_client_closed(NBDClient *client, bool negotiated);
+
+static void nbd_client_closed_bh(void *opaque)
+{
+    NBDClientClosed *closed = opaque;
+
+    nbd_client_closed(closed->client, closed->negotiated);
+    g_free(closed);
+}
+
 static void nbd_client_closed(NBDClient *client, bool negotiated)
 {
+    /* The server state is only touched from the main loop */
+    if (qemu_get_current_aio_context() != qemu_get_aio_context()) {
+        NBDClientClosed *closed = g_new(NBDClientClosed, 1);
+
+        *closed = (NBDClientClosed) {
+            .client     = client,
+            .negotiated = negotiated,
+        };
+        aio_bh_schedule_oneshot(qemu_get_aio_context(), nbd_client_closed_bh,
+                                closed);
+        return;
+    }
+
     nb_fds--;
     if (negotiated && nb_fds == 0 && !persistent && state == RUNNING) {
         state = TERMINATE;
@@ -645,6 +679,7 @@ int main(int argc, char **argv)
         { "trace", required_argument, NULL, 'T' },
         { "fork", no_argument, NULL, QEMU_NBD_OPT_FORK },
         { "pid-file", required_argument, NULL, QEMU_NBD_OPT_PID_FILE },
+        { "iothread", no_argument, NULL, QEMU_NBD_OPT_IOTHREAD },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -672,6 +707,8 @@ int main(int argc, char **argv)
     int old_stderr = -1;
     unsigned socket_activation;
     const char *pid_file_name = NULL;
+    bool use_iothread = false;
+    AioContext *ctx;
 
     /* The client thread uses SIGTERM to interrupt the server.  A signal
      * handler ensures that "qemu-nbd -v -c" exits with a nice status code.
@@ -719,13 +756,9 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
             seen_aio = true;
-            if (!strcmp(optarg, "native")) {
-                flags |= BDRV_O_NATIVE_AIO;
-            } else if (!strcmp(optarg, "threads")) {
-                /* this is the default */
-            } else {
-               error_report("invalid aio mode `%s'", optarg);
-               exit(EXIT_FAILURE);
+            if (bdrv_parse_aio(optarg, &flags) < 0) {
+                error_report("invalid aio mode `%s'", optarg);
+                exit(EXIT_FAILURE);
             }
             break;
         case QEMU_NBD_OPT_DISCARD:
@@ -874,6 +907,9 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_PID_FILE:
             pid_file_name = optarg;
             break;
+        case QEMU_NBD_OPT_IOTHREAD:
+            use_iothread = true;
+            break;
         }
     }
 
@@ -1173,10 +1209,27 @@ int main(int argc, char **argv)
         fd_size = limit;
     }
 
+    /*
+     * The thread is only created now, as it would not survive --fork.
+     * Negotiation and accepting new clients stay in the main loop.
+     */
+    if (use_iothread) {
+        iothread = iothread_create("qemu-nbd-iothread", &error_fatal);
+        ret = blk_set_aio_context(blk, iothread_get_aio_context(iothread),
+                                  &local_err);
+        if (ret < 0) {
+            error_reportf_err(local_err, "Failed to use an I/O thread: ");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ctx = blk_get_aio_context(blk);
+
+    aio_context_acquire(ctx);
     export = nbd_export_new(bs, dev_offset, fd_size, export_name,
                             export_description, bitmap, readonly, shared > 1,
                             nbd_export_closed, writethrough, NULL,
                             &error_fatal);
+    aio_context_release(ctx);
 
     if (device) {
 #if HAVE_NBD_DEVICE
@@ -1217,13 +1270,17 @@ int main(int argc, char **argv)
         main_loop_wait(false);
         if (state == TERMINATE) {
             state = TERMINATING;
+            aio_context_acquire(ctx);
             nbd_export_close(export);
             nbd_export_put(export);
+            aio_context_release(ctx);
             export = NULL;
         }
     } while (state != TERMINATED);
 
+    aio_context_acquire(ctx);
     blk_unref(blk);
+    aio_context_release(ctx);
     if (sockpath) {
         unlink(sockpath);
     }
@@ -35,6 +35,8 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                kvm-dirty-ring-size=n entries of the KVM per-vCPU dirty ring (default: 0, disabled)\n"
+    "                kvm-parallel-vcpu-init=on|off set up the KVM vCPUs in parallel (default: off)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
@@ -79,6 +81,18 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-dirty-ring-size=n
+Track guest dirty memory with per-vCPU KVM dirty rings of @var{n} entries
+instead of the per-memslot dirty bitmaps.  @var{n} must be a power of two;
+the host kernel needs KVM_CAP_DIRTY_LOG_RING.  The default is 0, which keeps
+using dirty bitmaps.  Dirty rings are needed by the @code{dirty-limit}
+migration capability.
+@item kvm-parallel-vcpu-init=on|off
+Create the KVM vCPUs of the machine on their own threads in parallel,
+and finish their architecture setup before the machine starts, instead of
+setting up one vCPU after the other while the machine is built.  This
+shortens the startup of guests with many vCPUs.  Hotplugged vCPUs are
+always set up synchronously.  The default is off.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
@@ -470,6 +484,7 @@ DEF("audiodev", HAS_ARG, QEMU_OPTION_audiodev,
     "-audiodev pa,id=id[,prop[=value][,...]]\n"
     "                server= PulseAudio server address\n"
     "                in|out.name= source/sink device name\n"
+    "                in|out.try-poll= attempt to use poll mode\n"
 #endif
 #ifdef CONFIG_AUDIO_SDL
     "-audiodev sdl,id=id[,prop[=value][,...]]\n"
@@ -630,6 +645,11 @@ Sets the PulseAudio @var{server} to connect to.
 @item in|out.name=@var{sink}
 Use the specified source/sink for recording/playback.
 
+@item in|out.try-poll=on|off
+Run the mixer whenever PulseAudio asks for more playback data or has
+captured data available, instead of on the periodic audio timer.
+Default is on.
+
 @end table
 
 @item -audiodev sdl,id=@var{id}[,@var{prop}[=@var{value}][,...]]
@@ -796,6 +816,33 @@ STEXI
 Set system UUID.
 ETEXI
 
+DEF("thread-policy", HAS_ARG, QEMU_OPTION_thread_policy,
+    "-thread-policy category=vcpu|iothread|worker|rcu|multifd|compress|vnc|emulator\n"
+    "               [,cpus.0=cpu[,cpus.1=cpu...]][,host-nodes.0=node[,...]]\n"
+    "               [,sched-policy=other|batch|idle|fifo|rr][,sched-priority=prio]\n"
+    "                set the host placement of a category of QEMU threads\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -thread-policy category=@var{category}[,cpus.0=@var{cpu}[,...]][,host-nodes.0=@var{node}[,...]][,sched-policy=@var{policy}][,sched-priority=@var{prio}]
+@findex -thread-policy
+Restrict the threads of @var{category} to the given host CPUs and NUMA
+nodes and set their scheduling class.  The categories are @code{vcpu},
+@code{iothread}, @code{worker} (the thread pool), @code{rcu},
+@code{multifd}, @code{compress} (migration compression),
+@code{vnc} and @code{emulator}, which covers the main loop and every
+other thread.  The option can be given once per category, and can be
+changed at runtime with the @code{set-thread-policy} QMP command.  The
+threads and their categories are listed by @code{query-threads}.
+
+For example, to keep housekeeping threads off host CPUs 2-3, which run
+the vCPUs:
+@example
+-thread-policy category=vcpu,cpus.0=2,cpus.1=3 \
+-thread-policy category=emulator,cpus.0=0,cpus.1=1 \
+-thread-policy category=worker,cpus.0=0,cpus.1=1,sched-policy=batch
+@end example
+ETEXI
+
 STEXI
 @end table
 ETEXI
@@ -985,6 +1032,19 @@ Clean unused entries in the L2 and refcount caches. The interval is in seconds.
 The default value is 600 on supporting platforms, and 0 on other platforms.
 Setting it to 0 disables this feature.
 
+@item bitmap-flush-interval
+Write the changed parts of persistent dirty bitmaps to the image in the
+background, so that closing or migrating the image has less to write. The
+interval is in seconds (default: 0, which disables this feature).
+
+@item cache-group
+The ID of a @code{qcow2-cache-group} object. The L2 and refcount caches of all
+qcow2 nodes that name the same group, e.g. all images of a backing chain, share
+its memory budget: the least recently used tables of the whole group are evicted
+first, so that the memory follows the I/O. Unless @option{l2-cache-size} or
+@option{cache-size} are given, the L2 cache of each node may grow up to the
+group budget.
+
 @item pass-discard-request
 Whether discard requests to the qcow2 device should be forwarded to the data
 source (on/off; default: on if discard=unmap is specified, off otherwise)
@@ -1025,7 +1085,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,snapshot=on|off][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -1093,7 +1153,8 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO and Linux io_uring.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -1628,7 +1689,8 @@ DEF("spice", HAS_ARG, QEMU_OPTION_spice,
     "       [,image-compression=[auto_glz|auto_lz|quic|glz|lz|off]]\n"
     "       [,jpeg-wan-compression=[auto|never|always]]\n"
     "       [,zlib-glz-wan-compression=[auto|never|always]]\n"
-    "       [,streaming-video=[off|all|filter]][,disable-copy-paste]\n"
+    "       [,streaming-video=[off|all|filter]][,video-codecs=<codec>]\n"
+    "       [,disable-copy-paste]\n"
     "       [,disable-agent-file-xfer][,agent-mouse=[on|off]]\n"
     "       [,playback-compression=[on|off]][,seamless-migration=[on|off]]\n"
     "       [,gl=[on|off]][,rendernode=<file>]\n"
@@ -1714,6 +1776,13 @@ Default is auto.
 @item streaming-video=[off|all|filter]
 Configure video stream detection.  Default is off.
 
+@item video-codecs=@var{encoder}:@var{codec}[;@var{encoder}:@var{codec}...]
+Set the preferred list of encoders for regions detected as video streams,
+e.g. @code{gstreamer:h264;spice:mjpeg}.  The @code{gstreamer} encoders
+use whatever GStreamer elements are available, including hardware
+encoders such as VA-API; spice-server falls back to the next entry when
+an encoder cannot be used.  Requires spice-server 0.13.2 or newer.
+
 @item agent-mouse=[on|off]
 Enable/disable passing mouse events via vdagent.  Default is on.
 
@@ -1964,6 +2033,14 @@ This can be really helpful to save bandwidth when playing videos. Disabling
 adaptive encodings restores the original static behavior of encodings
 like Tight.
 
+@item encoder-threads=@var{n}
+
+Encode framebuffer updates in @var{n} threads (default 1).  With more
+than one thread, large updates are split into tiles that are encoded in
+parallel when the client uses the raw, hextile or tight encodings.  With
+tight, the client is asked to restart its zlib streams for every tile,
+which costs some compression ratio.
+
 @item share=[allow-exclusive|force-shared|ignore]
 
 Set display sharing policy.  'allow-exclusive' allows clients to ask
@@ -2214,9 +2291,25 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m][,busy-poll=usecs]\n"
+    "                attach to the host interface 'name' with AF_XDP sockets\n"
+    "                bound to its queues 'm' to 'm'+'n'-1 (default: 1 queue from 0)\n"
+    "                use 'mode' to choose the XDP attach mode (default: native,\n"
+    "                falling back to skb)\n"
+    "                use 'force-copy=on' to disable zero-copy\n"
+    "                use 'busy-poll' to busy poll the device instead of waiting\n"
+    "                for interrupts (default: 0, disabled)\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
+#endif
+#ifdef CONFIG_VHOST_NET_VDPA
+    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev\n"
+    "                configure a vhost-vdpa network, establishing a vhost-vdpa\n"
+    "                backend with the character device '/path/to/dev'\n"
 #endif
     "-netdev hubport,id=str,hubid=n[,netdev=nd]\n"
     "                configure a hub port on the hub with ID 'n'\n", QEMU_ARCH_ALL)
@@ -2234,8 +2327,14 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
+#endif
+#ifdef CONFIG_VHOST_NET_VDPA
+    "vhost-vdpa|"
 #endif
     "socket][,option][,...][mac=macaddr]\n"
     "                initialize an on-board / default host NIC (using MAC address\n"
@@ -2657,6 +2756,32 @@ vde_switch -F -sock /tmp/myswitch
 @value{qemu_system} linux.img -nic vde,sock=/tmp/myswitch
 @end example
 
+@item -netdev af-xdp,id=@var{id},ifname=@var{name}[,mode=native|skb][,force-copy=on|off][,queues=@var{n}][,start-queue=@var{m}][,busy-poll=@var{usecs}]
+Configure an AF_XDP backend to connect to the host network interface
+@var{name}.  One AF_XDP socket is bound to each of the @var{n} interface
+queues starting at @var{m}, and packets are exchanged with the kernel through
+a buffer area shared with it, without a copy when the driver supports it.
+Traffic that should reach the guest must be steered to these queues, for
+example with @code{ethtool -N}, because the interface will not see it anymore.
+
+@option{mode} selects how the XDP program is attached; by default native mode
+is tried first and generic (skb) mode is the fallback.  @option{force-copy=on}
+disables zero-copy.  A non-zero @option{busy-poll} makes the kernel busy poll
+the device for received packets for up to @var{usecs} microseconds instead of
+waiting for interrupts; this is most useful together with the
+@code{napi_defer_hard_irqs} and @code{gro_flush_timeout} sysfs knobs.
+
+This option is only available if QEMU has been compiled with AF_XDP support,
+and needs @code{CAP_NET_ADMIN} and @code{CAP_BPF} (or root).
+
+Example:
+@example
+# use queues 0-1 of eth0, steer guest traffic to them with ethtool
+@value{qemu_system} linux.img \
+        -netdev af-xdp,id=n1,ifname=eth0,queues=2 \
+        -device virtio-net-pci,netdev=n1,mq=on
+@end example
+
 @item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off][,queues=n]
 
 Establish a vhost-user netdev, backed by a chardev @var{id}. The chardev should
@@ -2675,6 +2800,26 @@ qemu -m 512 -object memory-backend-file,id=mem,size=512M,mem-path=/hugetlbfs,sha
      -device virtio-net-pci,netdev=net0
 @end example
 
+@item -netdev vhost-vdpa,vhostdev=@var{/path/to/dev}
+
+Establish a vhost-vdpa netdev, backed by the vhost-vdpa character device
+@var{/path/to/dev}, e.g. @file{/dev/vhost-vdpa-0}.  A vDPA device has a
+datapath that complies with the virtio specification, and a vendor specific
+control path.  The virtqueues of the guest's virtio-net device are handed to
+the device, so that packets are processed entirely by the hardware (or by the
+kernel for software vDPA devices) without involving QEMU.  The MAC address,
+link status and MTU are provided by the device.
+
+Only a single queue pair is supported, the guest must not be behind a virtual
+IOMMU, and migration is not supported.
+
+Example:
+@example
+qemu -m 512 \
+     -netdev type=vhost-vdpa,id=net0,vhostdev=/dev/vhost-vdpa-0 \
+     -device virtio-net-pci,netdev=net0
+@end example
+
 @item -netdev hubport,id=@var{id},hubid=@var{hubid}[,netdev=@var{nd}]
 
 Create a hub port on the emulated hub with ID @var{hubid}.
@@ -2715,9 +2860,11 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev null,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev socket,id=id[,host=host],port=port[,to=to][,ipv4][,ipv6][,nodelay][,reconnect=seconds]\n"
     "         [,server][,nowait][,telnet][,websocket][,reconnect=seconds][,mux=on|off]\n"
-    "         [,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID] (tcp)\n"
+    "         [,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID]\n"
+    "         [,outbuf-size=size][,outbuf-drop=on|off] (tcp)\n"
     "-chardev socket,id=id,path=path[,server][,nowait][,telnet][,websocket][,reconnect=seconds]\n"
-    "         [,mux=on|off][,logfile=PATH][,logappend=on|off] (unix)\n"
+    "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
+    "         [,outbuf-size=size][,outbuf-drop=on|off] (unix)\n"
     "-chardev udp,id=id[,host=host],port=port[,localaddr=localaddr]\n"
     "         [,localport=localport][,ipv4][,ipv6][,mux=on|off]\n"
     "         [,logfile=PATH][,logappend=on|off]\n"
@@ -2726,6 +2873,7 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev ringbuf,id=id[,size=size][,logfile=PATH][,logappend=on|off]\n"
     "-chardev file,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
+    "         [,outbuf-size=size][,outbuf-drop=on|off]\n"
     "-chardev pipe,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #ifdef _WIN32
     "-chardev console,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
@@ -2835,6 +2983,12 @@ to a file to record all data transmitted via the backend. The @option{logappend}
 option controls whether the log file will be truncated or appended to when
 opened.
 
+Every backend also supports the @option{outbuf-size} option.  When it is not
+zero, output goes to a buffer of that size, and a separate thread writes it
+to the backend.  A slow file or a socket peer that does not read then no longer
+stalls the guest.  If @option{outbuf-drop} is on, output that does not fit is
+discarded, otherwise the writer waits for room in the buffer.
+
 @end table
 
 The available backends are:
@@ -3799,12 +3953,12 @@ re-inject them.
 ETEXI
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>,rrsnapshot=<snapshot>,rrcompress=on|off]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping\n", QEMU_ARCH_ALL)
 STEXI
-@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot}]
+@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename},rrsnapshot=@var{snapshot},rrcompress=on|off]
 @findex -icount
 Enable virtual instruction counter.  The virtual cpu will execute one
 instruction every 2^@var{N} ns of virtual time.  If @code{auto} is specified
@@ -3841,6 +3995,9 @@ read from this file in replay mode.
 Option rrsnapshot is used to create new vm snapshot named @var{snapshot}
 at the start of execution recording. In replay mode this option is used
 to load the initial VM state.
+
+Option @option{rrcompress=on} compresses the log with zstd while recording.
+Compressed logs are detected automatically in replay mode.
 ETEXI
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
@@ -3941,6 +4098,17 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        write a perf map of translated code\n", QEMU_ARCH_ALL)
+STEXI
+@item -perfmap
+@findex -perfmap
+Write the host address, size and guest PC of every translation block to
+@file{/tmp/perf-@var{pid}.map}, so that @command{perf report} can attribute
+time spent in TCG-generated code to guest code. The guest symbol is added
+when it is known.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
@@ -3951,6 +4119,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                load the migration stream from the given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3969,6 +4139,10 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{filename}
+Load the migration stream from the given file, for example one that was
+written by a "migrate file:@var{filename}" command.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
@@ -4225,7 +4399,7 @@ property must be set.  These objects are placed in the
 
 @table @option
 
-@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
+@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},prealloc-threads=@var{threads},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align},template=@var{on|off}
 
 Creates a memory file backend object, which can be used to back
 the guest RAM with huge pages.
@@ -4266,6 +4440,15 @@ Setting the @option{dump} boolean option to @var{off} excludes the memory from
 core dumps. This feature is also known as MADV_DONTDUMP.
 
 The @option{prealloc} boolean option enables memory preallocation.
+For objects created on the command line, preallocation runs in the
+background while the rest of the machine is set up, and finishes before
+the guest starts.  The threads doing it run on the host CPUs of the
+@option{host-nodes}, if given.
+
+The @option{prealloc-threads} option sets the number of threads used for
+preallocation.  The default, 0, uses as many threads as the machine has
+vCPUs.  The count is limited by the number of host CPUs available to the
+threads.
 
 The @option{host-nodes} option binds the memory range to a list of NUMA host
 nodes.
@@ -4296,6 +4479,26 @@ such cases, users can specify the required alignment via this option.
 The @option{pmem} option specifies whether the backing file specified
 by @option{mem-path} is in host persistent memory that can be accessed
 using the SNIA NVM programming model (e.g. Intel NVDIMM).
+
+Setting the @option{template} boolean option to @var{on} starts guest RAM
+from the contents of an existing file at @option{mem-path}, typically the
+RAM of a paused template VM.  The file is opened read-only and mapped
+copy-on-write, so any number of clones can share its page cache while
+their writes stay private.  @option{template} requires @option{share=off}
+and cannot be combined with preallocation.  A clone is started from the
+template by saving only device state from the template VM, which must
+use @option{share=on} for the same file and stay paused as long as clones
+use it:
+
+@example
+# template VM
+(qemu) migrate_set_capability x-ignore-shared on
+(qemu) migrate "exec:cat > /path/to/template.state"
+
+# clone, with template=on for the same mem-path
+(qemu) migrate_set_capability x-ignore-shared on
+(qemu) migrate_incoming "exec:cat /path/to/template.state"
+@end example
 If @option{pmem} is set to 'on', QEMU will take necessary operations to
 guarantee the persistence of its own writes to @option{mem-path}
 (e.g. in vNVDIMM label emulation and live migration).
@@ -4498,7 +4701,7 @@ Dump the network traffic on netdev @var{dev} to the file specified by
 The file format is libpcap, so it can be analyzed with tools such as tcpdump
 or Wireshark.
 
-@item -object colo-compare,id=@var{id},primary_in=@var{chardevid},secondary_in=@var{chardevid},outdev=@var{chardevid},iothread=@var{id}[,vnet_hdr_support][,notify_dev=@var{id}]
+@item -object colo-compare,id=@var{id},primary_in=@var{chardevid},secondary_in=@var{chardevid},outdev=@var{chardevid},iothread=@var{id}[,vnet_hdr_support][,notify_dev=@var{id}][,workers=@var{n}]
 
 Colo-compare gets packet from primary_in@var{chardevid} and secondary_in@var{chardevid}, than compare primary packet with
 secondary packet. If the packets are same, we will output primary
@@ -4509,6 +4712,9 @@ in another thread. If it has the vnet_hdr_support flag, colo compare
 will send/recv packet with vnet_hdr_len.
 If you want to use Xen COLO, will need the notify_dev to notify Xen
 colo-frame to do checkpoint.
+The connections can be spread over @var{n} compare threads with the
+workers option (1 by default, in which case the comparison runs in the
+iothread).
 
 we must use it with the help of filter-mirror and filter-redirector.
 
@@ -4687,6 +4893,21 @@ contents of @code{iv.b64} to the second secret
          data=$SECRET,iv=$(<iv.b64)
 @end example
 
+@item -object qcow2-cache-group,id=@var{id},size=@var{size}
+
+Create a memory budget of @var{size} bytes that the metadata caches of qcow2
+nodes share. Nodes join the group with the @option{cache-group} option. The
+group is only supported on Linux hosts.
+
+@example
+ # @value{qemu_system} \
+     -object qcow2-cache-group,id=chain0,size=64M \
+     -blockdev driver=qcow2,node-name=base,cache-group=chain0,\
+         file.driver=file,file.filename=base.qcow2 \
+     -blockdev driver=qcow2,node-name=top,cache-group=chain0,backing=base,\
+         file.driver=file,file.filename=top.qcow2
+@end example
+
 @item -object sev-guest,id=@var{id},cbitpos=@var{cbitpos},reduced-phys-bits=@var{val},[sev-device=@var{string},policy=@var{policy},handle=@var{handle},dh-cert-file=@var{file},session-file=@var{file}]
 
 Create a Secure Encrypted Virtualization (SEV) guest object, which can be used
@@ -559,6 +559,147 @@ GuestFileWrite *qmp_guest_file_write(int64_t handle, const char *buf_b64,
     return write_data;
 }
 
+#define QGA_TRANSFER_CHUNK (64 * 1024)
+
+static int64_t guest_file_transfer_read(FILE *fh, int fd, bool has_count,
+                                        int64_t count, Error **errp)
+{
+    guchar *buf = g_malloc(QGA_TRANSFER_CHUNK);
+    int64_t done = 0;
+    size_t len, read_count;
+
+    while (!has_count || done < count) {
+        len = has_count ? MIN(QGA_TRANSFER_CHUNK, count - done)
+                        : QGA_TRANSFER_CHUNK;
+        read_count = fread(buf, 1, len, fh);
+        if (read_count &&
+            qemu_write_full(fd, buf, read_count) != read_count) {
+            error_setg_errno(errp, errno,
+                             "failed to write to transfer channel");
+            done = -1;
+            break;
+        }
+        done += read_count;
+        if (read_count < len) {
+            if (ferror(fh)) {
+                error_setg_errno(errp, errno, "failed to read file");
+                done = -1;
+            }
+            break;
+        }
+    }
+    g_free(buf);
+    return done;
+}
+
+static int64_t guest_file_transfer_write(FILE *fh, int fd, int64_t count,
+                                         Error **errp)
+{
+    guchar *buf = g_malloc(QGA_TRANSFER_CHUNK);
+    int64_t done = 0;
+    ssize_t len;
+
+    while (done < count) {
+        len = read(fd, buf, MIN(QGA_TRANSFER_CHUNK, count - done));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            if (len < 0) {
+                error_setg_errno(errp, errno,
+                                 "failed to read from transfer channel");
+            } else {
+                error_setg(errp, "transfer channel closed after %" PRId64
+                           " bytes", done);
+            }
+            done = -1;
+            break;
+        }
+        if (fwrite(buf, 1, len, fh) != len) {
+            error_setg_errno(errp, errno, "failed to write to file");
+            done = -1;
+            break;
+        }
+        done += len;
+    }
+    g_free(buf);
+    return done;
+}
+
+GuestFileTransfer *qmp_guest_file_transfer(int64_t handle,
+                                           GuestFileTransferDirection direction,
+                                           bool has_count, int64_t count,
+                                           Error **errp)
+{
+    GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
+    GuestFileTransfer *transfer_data = NULL;
+    FILE *fh;
+    int64_t done;
+    int fd, ret;
+
+    if (!gfh) {
+        return NULL;
+    }
+
+    if (has_count && count < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
+                   count);
+        return NULL;
+    }
+    if (direction == GUEST_FILE_TRANSFER_DIRECTION_WRITE && !has_count) {
+        error_setg(errp, QERR_MISSING_PARAMETER, "count");
+        return NULL;
+    }
+
+    fh = gfh->fh;
+
+    /* same rules as guest-file-read and guest-file-write */
+    if (direction == GUEST_FILE_TRANSFER_DIRECTION_READ &&
+        gfh->state == RW_STATE_WRITING) {
+        ret = fflush(fh);
+        if (ret == EOF) {
+            error_setg_errno(errp, errno, "failed to flush file");
+            return NULL;
+        }
+        gfh->state = RW_STATE_NEW;
+    } else if (direction == GUEST_FILE_TRANSFER_DIRECTION_WRITE &&
+               gfh->state == RW_STATE_READING) {
+        ret = fseek(fh, 0, SEEK_CUR);
+        if (ret == -1) {
+            error_setg_errno(errp, errno, "failed to seek file");
+            return NULL;
+        }
+        gfh->state = RW_STATE_NEW;
+    }
+
+    fd = ga_transfer_channel_open(ga_state, errp);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    slog("guest-file-transfer called, handle: %" PRId64 ", direction: %s",
+         handle, GuestFileTransferDirection_str(direction));
+    if (direction == GUEST_FILE_TRANSFER_DIRECTION_READ) {
+        done = guest_file_transfer_read(fh, fd, has_count, count, errp);
+        gfh->state = RW_STATE_READING;
+    } else {
+        done = guest_file_transfer_write(fh, fd, count, errp);
+        gfh->state = RW_STATE_WRITING;
+    }
+    close(fd);
+
+    if (done < 0) {
+        slog("guest-file-transfer failed, handle: %" PRId64, handle);
+    } else {
+        transfer_data = g_new0(GuestFileTransfer, 1);
+        transfer_data->count = done;
+        transfer_data->eof = feof(fh);
+    }
+    clearerr(fh);
+
+    return transfer_data;
+}
+
 struct GuestFileSeek *qmp_guest_file_seek(int64_t handle, int64_t offset,
                                           GuestFileWhence *whence_code,
                                           Error **errp)
@@ -47,6 +47,7 @@ int ga_parse_whence(GuestFileWhence *whence, Error **errp);
 
 #ifndef _WIN32
 void reopen_fd_to_null(int fd);
+int ga_transfer_channel_open(GAState *s, Error **errp);
 #endif
 
 #endif /* GUEST_AGENT_CORE_H */
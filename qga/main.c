@@ -60,6 +60,7 @@
 #define QGA_SENTINEL_BYTE 0xFF
 #define QGA_CONF_DEFAULT CONFIG_QEMU_CONFDIR G_DIR_SEPARATOR_S "qemu-ga.conf"
 #define QGA_RETRY_INTERVAL 5
+#define QGA_TRANSFER_ACCEPT_TIMEOUT 30 /* seconds */
 
 static struct {
     const char *state_dir;
@@ -102,6 +103,9 @@ struct GAState {
     GAConfig *config;
     int socket_activation;
     bool force_exit;
+#ifndef _WIN32
+    int transfer_listen_fd;
+#endif
 };
 
 struct GAState *ga_state;
@@ -263,6 +267,15 @@ QEMU_COPYRIGHT "\n"
 "                    due to an error which may be recoverable in the future\n"
 "                    (virtio-serial driver re-install, serial device hot\n"
 "                    plug/unplug, etc.)\n"
+#ifndef _WIN32
+"  -M, --transfer-method\n"
+"                    transport method of the raw data channel used by\n"
+"                    guest-file-transfer: one of virtio-serial, unix-listen\n"
+"                    or vsock-listen (virtio-serial is the default)\n"
+"  -P, --transfer-path\n"
+"                    device/socket path of the raw data channel; without\n"
+"                    it, guest-file-transfer is disabled\n"
+#endif
 "  -h, --help        display this help and exit\n"
 "\n"
 QEMU_HELP_BOTTOM "\n"
@@ -650,6 +663,91 @@ static gboolean channel_init(GAState *s, const gchar *method, const gchar *path,
     return true;
 }
 
+#ifndef _WIN32
+/*
+ * The transfer channel carries raw file data for guest-file-transfer, next
+ * to the JSON channel.  Listening sockets are set up once at startup, so
+ * the host can connect before it issues the command; a virtio-serial port
+ * is opened for each transfer.
+ */
+static gboolean transfer_channel_init(GAState *s)
+{
+    GAConfig *config = s->config;
+    Error *local_err = NULL;
+    SocketAddress *addr;
+    char *addr_str;
+
+    if (!config->transfer_path ||
+        strcmp(config->transfer_method, "virtio-serial") == 0) {
+        return true;
+    }
+
+    if (strcmp(config->transfer_method, "unix-listen") == 0) {
+        addr_str = g_strdup_printf("unix:%s", config->transfer_path);
+    } else if (strcmp(config->transfer_method, "vsock-listen") == 0) {
+        addr_str = g_strdup_printf("vsock:%s", config->transfer_path);
+    } else {
+        g_critical("unsupported transfer channel method/type: %s",
+                   config->transfer_method);
+        return false;
+    }
+
+    addr = socket_parse(addr_str, &local_err);
+    g_free(addr_str);
+    if (addr) {
+        s->transfer_listen_fd = socket_listen(addr, 1, &local_err);
+        qapi_free_SocketAddress(addr);
+    }
+    if (local_err) {
+        g_critical("%s", error_get_pretty(local_err));
+        error_free(local_err);
+        return false;
+    }
+    qemu_set_block(s->transfer_listen_fd);
+    return true;
+}
+
+int ga_transfer_channel_open(GAState *s, Error **errp)
+{
+    GAConfig *config = s->config;
+    GPollFD pfd;
+    int fd, ret;
+
+    if (!config->transfer_path) {
+        error_setg(errp, "no transfer channel configured");
+        return -1;
+    }
+
+    if (s->transfer_listen_fd < 0) {
+        fd = qemu_open(config->transfer_path, O_RDWR);
+        if (fd < 0) {
+            error_setg_errno(errp, errno, "failed to open transfer channel %s",
+                             config->transfer_path);
+        }
+        return fd;
+    }
+
+    pfd.fd = s->transfer_listen_fd;
+    pfd.events = G_IO_IN;
+    do {
+        ret = g_poll(&pfd, 1, QGA_TRANSFER_ACCEPT_TIMEOUT * 1000);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+        error_setg(errp, "no connection on transfer channel %s",
+                   config->transfer_path);
+        return -1;
+    }
+
+    fd = qemu_accept(s->transfer_listen_fd, NULL, NULL);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "failed to accept transfer connection");
+        return -1;
+    }
+    qemu_set_block(fd);
+    return fd;
+}
+#endif
+
 #ifdef _WIN32
 DWORD WINAPI handle_serial_device_events(DWORD type, LPVOID data)
 {
@@ -956,6 +1054,8 @@ struct GAConfig {
     GLogLevelFlags log_level;
     int dumpconf;
     bool retry_path;
+    char *transfer_method;
+    char *transfer_path;
 };
 
 static void config_load(GAConfig *config)
@@ -1009,6 +1109,14 @@ static void config_load(GAConfig *config)
         config->retry_path =
             g_key_file_get_boolean(keyfile, "general", "retry-path", &gerr);
     }
+    if (g_key_file_has_key(keyfile, "general", "transfer-method", NULL)) {
+        config->transfer_method =
+            g_key_file_get_string(keyfile, "general", "transfer-method", &gerr);
+    }
+    if (g_key_file_has_key(keyfile, "general", "transfer-path", NULL)) {
+        config->transfer_path =
+            g_key_file_get_string(keyfile, "general", "transfer-path", &gerr);
+    }
     if (g_key_file_has_key(keyfile, "general", "blacklist", NULL)) {
         config->bliststr =
             g_key_file_get_string(keyfile, "general", "blacklist", &gerr);
@@ -1072,6 +1180,12 @@ static void config_dump(GAConfig *config)
                            config->log_level == G_LOG_LEVEL_MASK);
     g_key_file_set_boolean(keyfile, "general", "retry-path",
                            config->retry_path);
+    if (config->transfer_path) {
+        g_key_file_set_string(keyfile, "general", "transfer-method",
+                              config->transfer_method);
+        g_key_file_set_string(keyfile, "general", "transfer-path",
+                              config->transfer_path);
+    }
     tmp = list_join(config->blacklist, ',');
     g_key_file_set_string(keyfile, "general", "blacklist", tmp);
     g_free(tmp);
@@ -1090,7 +1204,7 @@ static void config_dump(GAConfig *config)
 
 static void config_parse(GAConfig *config, int argc, char **argv)
 {
-    const char *sopt = "hVvdm:p:l:f:F::b:s:t:Dr";
+    const char *sopt = "hVvdm:p:l:f:F::b:s:t:DrM:P:";
     int opt_ind = 0, ch;
     const struct option lopt[] = {
         { "help", 0, NULL, 'h' },
@@ -1111,6 +1225,8 @@ static void config_parse(GAConfig *config, int argc, char **argv)
 #endif
         { "statedir", 1, NULL, 't' },
         { "retry-path", 0, NULL, 'r' },
+        { "transfer-method", 1, NULL, 'M' },
+        { "transfer-path", 1, NULL, 'P' },
         { NULL, 0, NULL, 0 }
     };
 
@@ -1158,6 +1274,14 @@ static void config_parse(GAConfig *config, int argc, char **argv)
         case 'r':
             config->retry_path = true;
             break;
+        case 'M':
+            g_free(config->transfer_method);
+            config->transfer_method = g_strdup(optarg);
+            break;
+        case 'P':
+            g_free(config->transfer_path);
+            config->transfer_path = g_strdup(optarg);
+            break;
         case 'b': {
             if (is_help_option(optarg)) {
                 qmp_for_each_command(&ga_commands, ga_print_cmd, NULL);
@@ -1215,6 +1339,8 @@ static void config_free(GAConfig *config)
     g_free(config->state_dir);
     g_free(config->channel_path);
     g_free(config->bliststr);
+    g_free(config->transfer_method);
+    g_free(config->transfer_path);
 #ifdef CONFIG_FSFREEZE
     g_free(config->fsfreeze_hook);
 #endif
@@ -1270,6 +1396,9 @@ static GAState *initialize_agent(GAConfig *config, int socket_activation)
     s->state_filepath_isfrozen = g_strdup_printf("%s/qga.state.isfrozen",
                                                  config->state_dir);
     s->frozen = check_is_frozen(s);
+#ifndef _WIN32
+    s->transfer_listen_fd = -1;
+#endif
 
     g_log_set_default_handler(ga_log, s);
     g_log_set_fatal_mask(NULL, G_LOG_LEVEL_ERROR);
@@ -1351,6 +1480,13 @@ static GAState *initialize_agent(GAConfig *config, int socket_activation)
     s->config = config;
     s->socket_activation = socket_activation;
 
+#ifndef _WIN32
+    if (!transfer_channel_init(s)) {
+        g_critical("failed to initialize transfer channel");
+        return NULL;
+    }
+#endif
+
 #ifdef _WIN32
     s->wakeup_event = CreateEvent(NULL, TRUE, FALSE, TEXT("WakeUp"));
     if (s->wakeup_event == NULL) {
@@ -1367,6 +1503,10 @@ static void cleanup_agent(GAState *s)
 {
 #ifdef _WIN32
     CloseHandle(s->wakeup_event);
+#else
+    if (s->transfer_listen_fd >= 0) {
+        close(s->transfer_listen_fd);
+    }
 #endif
     if (s->command_state) {
         ga_command_state_cleanup_all(s->command_state);
@@ -1475,6 +1615,10 @@ int main(int argc, char **argv)
         config->method = g_strdup("virtio-serial");
     }
 
+    if (config->transfer_method == NULL) {
+        config->transfer_method = g_strdup("virtio-serial");
+    }
+
     socket_activation = check_socket_activation();
     if (socket_activation > 1) {
         g_critical("qemu-ga only supports listening on one socket");
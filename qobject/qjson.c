@@ -149,38 +149,128 @@ QDict *qdict_from_jsonf_nofail(const char *string, ...)
     return qdict;
 }
 
+/*
+ * JSON text is produced into a small buffer that is handed to @write
+ * whenever it fills up, so that serializing a large object does not need
+ * a buffer as large as its JSON representation.
+ */
+typedef struct JSONSink {
+    QJSONWriteFunc *write;
+    void *opaque;
+    size_t len;
+    char buf[4096];
+} JSONSink;
+
+static void json_sink_flush(JSONSink *sink)
+{
+    if (sink->len) {
+        sink->buf[sink->len] = '\0';
+        sink->write(sink->opaque, sink->buf, sink->len);
+        sink->len = 0;
+    }
+}
+
+static void json_append(JSONSink *sink, const char *str)
+{
+    size_t len = strlen(str);
+
+    while (len) {
+        size_t n = MIN(len, sizeof(sink->buf) - 1 - sink->len);
+
+        memcpy(sink->buf + sink->len, str, n);
+        sink->len += n;
+        str += n;
+        len -= n;
+        if (sink->len == sizeof(sink->buf) - 1) {
+            json_sink_flush(sink);
+        }
+    }
+}
+
 typedef struct ToJsonIterState
 {
     int indent;
     int pretty;
     int count;
-    QString *str;
+    JSONSink *sink;
 } ToJsonIterState;
 
-static void to_json(const QObject *obj, QString *str, int pretty, int indent);
+static void to_json(const QObject *obj, JSONSink *sink, int pretty, int indent);
+
+static void to_json_str(const char *ptr, JSONSink *sink)
+{
+    int cp;
+    char buf[16];
+    char *end;
+
+    json_append(sink, "\"");
+
+    for (; *ptr; ptr = end) {
+        cp = mod_utf8_codepoint(ptr, 6, &end);
+        switch (cp) {
+        case '\"':
+            json_append(sink, "\\\"");
+            break;
+        case '\\':
+            json_append(sink, "\\\\");
+            break;
+        case '\b':
+            json_append(sink, "\\b");
+            break;
+        case '\f':
+            json_append(sink, "\\f");
+            break;
+        case '\n':
+            json_append(sink, "\\n");
+            break;
+        case '\r':
+            json_append(sink, "\\r");
+            break;
+        case '\t':
+            json_append(sink, "\\t");
+            break;
+        default:
+            if (cp < 0) {
+                cp = 0xFFFD; /* replacement character */
+            }
+            if (cp > 0xFFFF) {
+                /* beyond BMP; need a surrogate pair */
+                snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
+                         0xD800 + ((cp - 0x10000) >> 10),
+                         0xDC00 + ((cp - 0x10000) & 0x3FF));
+            } else if (cp < 0x20 || cp >= 0x7F) {
+                snprintf(buf, sizeof(buf), "\\u%04X", cp);
+            } else {
+                buf[0] = cp;
+                buf[1] = 0;
+            }
+            json_append(sink, buf);
+        }
+    };
+
+    json_append(sink, "\"");
+}
 
 static void to_json_dict_iter(const char *key, QObject *obj, void *opaque)
 {
     ToJsonIterState *s = opaque;
-    QString *qkey;
     int j;
 
     if (s->count) {
-        qstring_append(s->str, s->pretty ? "," : ", ");
+        json_append(s->sink, s->pretty ? "," : ", ");
     }
 
     if (s->pretty) {
-        qstring_append(s->str, "\n");
-        for (j = 0 ; j < s->indent ; j++)
-            qstring_append(s->str, "    ");
+        json_append(s->sink, "\n");
+        for (j = 0; j < s->indent; j++) {
+            json_append(s->sink, "    ");
+        }
     }
 
-    qkey = qstring_from_str(key);
-    to_json(QOBJECT(qkey), s->str, s->pretty, s->indent);
-    qobject_unref(qkey);
+    to_json_str(key, s->sink);
 
-    qstring_append(s->str, ": ");
-    to_json(obj, s->str, s->pretty, s->indent);
+    json_append(s->sink, ": ");
+    to_json(obj, s->sink, s->pretty, s->indent);
     s->count++;
 }
 
@@ -190,86 +280,37 @@ static void to_json_list_iter(QObject *obj, void *opaque)
     int j;
 
     if (s->count) {
-        qstring_append(s->str, s->pretty ? "," : ", ");
+        json_append(s->sink, s->pretty ? "," : ", ");
     }
 
     if (s->pretty) {
-        qstring_append(s->str, "\n");
-        for (j = 0 ; j < s->indent ; j++)
-            qstring_append(s->str, "    ");
+        json_append(s->sink, "\n");
+        for (j = 0; j < s->indent; j++) {
+            json_append(s->sink, "    ");
+        }
     }
 
-    to_json(obj, s->str, s->pretty, s->indent);
+    to_json(obj, s->sink, s->pretty, s->indent);
     s->count++;
 }
 
-static void to_json(const QObject *obj, QString *str, int pretty, int indent)
+static void to_json(const QObject *obj, JSONSink *sink, int pretty, int indent)
 {
     switch (qobject_type(obj)) {
     case QTYPE_QNULL:
-        qstring_append(str, "null");
+        json_append(sink, "null");
         break;
     case QTYPE_QNUM: {
         QNum *val = qobject_to(QNum, obj);
         char *buffer = qnum_to_string(val);
-        qstring_append(str, buffer);
+        json_append(sink, buffer);
         g_free(buffer);
         break;
     }
     case QTYPE_QSTRING: {
         QString *val = qobject_to(QString, obj);
-        const char *ptr;
-        int cp;
-        char buf[16];
-        char *end;
-
-        ptr = qstring_get_str(val);
-        qstring_append(str, "\"");
-
-        for (; *ptr; ptr = end) {
-            cp = mod_utf8_codepoint(ptr, 6, &end);
-            switch (cp) {
-            case '\"':
-                qstring_append(str, "\\\"");
-                break;
-            case '\\':
-                qstring_append(str, "\\\\");
-                break;
-            case '\b':
-                qstring_append(str, "\\b");
-                break;
-            case '\f':
-                qstring_append(str, "\\f");
-                break;
-            case '\n':
-                qstring_append(str, "\\n");
-                break;
-            case '\r':
-                qstring_append(str, "\\r");
-                break;
-            case '\t':
-                qstring_append(str, "\\t");
-                break;
-            default:
-                if (cp < 0) {
-                    cp = 0xFFFD; /* replacement character */
-                }
-                if (cp > 0xFFFF) {
-                    /* beyond BMP; need a surrogate pair */
-                    snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
-                             0xD800 + ((cp - 0x10000) >> 10),
-                             0xDC00 + ((cp - 0x10000) & 0x3FF));
-                } else if (cp < 0x20 || cp >= 0x7F) {
-                    snprintf(buf, sizeof(buf), "\\u%04X", cp);
-                } else {
-                    buf[0] = cp;
-                    buf[1] = 0;
-                }
-                qstring_append(str, buf);
-            }
-        };
 
-        qstring_append(str, "\"");
+        to_json_str(qstring_get_str(val), sink);
         break;
     }
     case QTYPE_QDICT: {
@@ -277,18 +318,19 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         QDict *val = qobject_to(QDict, obj);
 
         s.count = 0;
-        s.str = str;
+        s.sink = sink;
         s.indent = indent + 1;
         s.pretty = pretty;
-        qstring_append(str, "{");
+        json_append(sink, "{");
         qdict_iter(val, to_json_dict_iter, &s);
         if (pretty) {
             int j;
-            qstring_append(str, "\n");
-            for (j = 0 ; j < indent ; j++)
-                qstring_append(str, "    ");
+            json_append(sink, "\n");
+            for (j = 0; j < indent; j++) {
+                json_append(sink, "    ");
+            }
         }
-        qstring_append(str, "}");
+        json_append(sink, "}");
         break;
     }
     case QTYPE_QLIST: {
@@ -296,27 +338,28 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         QList *val = qobject_to(QList, obj);
 
         s.count = 0;
-        s.str = str;
+        s.sink = sink;
         s.indent = indent + 1;
         s.pretty = pretty;
-        qstring_append(str, "[");
+        json_append(sink, "[");
         qlist_iter(val, (void *)to_json_list_iter, &s);
         if (pretty) {
             int j;
-            qstring_append(str, "\n");
-            for (j = 0 ; j < indent ; j++)
-                qstring_append(str, "    ");
+            json_append(sink, "\n");
+            for (j = 0; j < indent; j++) {
+                json_append(sink, "    ");
+            }
         }
-        qstring_append(str, "]");
+        json_append(sink, "]");
         break;
     }
     case QTYPE_QBOOL: {
         QBool *val = qobject_to(QBool, obj);
 
         if (qbool_get_bool(val)) {
-            qstring_append(str, "true");
+            json_append(sink, "true");
         } else {
-            qstring_append(str, "false");
+            json_append(sink, "false");
         }
         break;
     }
@@ -325,11 +368,28 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
     }
 }
 
+void qobject_to_json_stream(const QObject *obj, bool pretty,
+                            QJSONWriteFunc *write, void *opaque)
+{
+    JSONSink sink = {
+        .write = write,
+        .opaque = opaque,
+    };
+
+    to_json(obj, &sink, pretty, 0);
+    json_sink_flush(&sink);
+}
+
+static void to_qstring_write(void *opaque, const char *buf, size_t len)
+{
+    qstring_append(opaque, buf);
+}
+
 QString *qobject_to_json(const QObject *obj)
 {
     QString *str = qstring_new();
 
-    to_json(obj, str, 0, 0);
+    qobject_to_json_stream(obj, false, to_qstring_write, str);
 
     return str;
 }
@@ -338,7 +398,7 @@ QString *qobject_to_json_pretty(const QObject *obj)
 {
     QString *str = qstring_new();
 
-    to_json(obj, str, 1, 0);
+    qobject_to_json_stream(obj, true, to_qstring_write, str);
 
     return str;
 }
@@ -307,6 +307,8 @@ static void type_initialize(TypeImpl *ti)
         ti->class->interfaces = NULL;
         ti->class->properties = g_hash_table_new_full(
             g_str_hash, g_str_equal, g_free, object_property_free);
+        ti->class->properties_cache = NULL;
+        ti->class->properties_version = 0;
 
         for (e = parent->class->interfaces; e; e = e->next) {
             InterfaceClass *iface = e->data;
@@ -1156,6 +1158,7 @@ object_class_property_add(ObjectClass *klass,
     prop->opaque = opaque;
 
     g_hash_table_insert(klass->properties, g_strdup(name), prop);
+    klass->properties_version++;
 
     return prop;
 }
@@ -1207,21 +1210,45 @@ void object_class_property_iter_init(ObjectPropertyIterator *iter,
     iter->nextclass = object_class_get_parent(klass);
 }
 
-ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name,
-                                           Error **errp)
+static GHashTable *object_class_get_properties_cache(ObjectClass *klass)
 {
-    ObjectProperty *prop;
-    ObjectClass *parent_klass;
+    ObjectClass *k;
+    unsigned version = 0;
+
+    for (k = klass; k; k = object_class_get_parent(k)) {
+        version += k->properties_version;
+    }
+    if (klass->properties_cache &&
+        klass->properties_cache_version == version) {
+        return klass->properties_cache;
+    }
+
+    if (klass->properties_cache) {
+        g_hash_table_remove_all(klass->properties_cache);
+    } else {
+        klass->properties_cache = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+
+    /* Walk towards the root, so that properties of ancestors win */
+    for (k = klass; k; k = object_class_get_parent(k)) {
+        GHashTableIter iter;
+        gpointer key, value;
 
-    parent_klass = object_class_get_parent(klass);
-    if (parent_klass) {
-        prop = object_class_property_find(parent_klass, name, NULL);
-        if (prop) {
-            return prop;
+        g_hash_table_iter_init(&iter, k->properties);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_hash_table_insert(klass->properties_cache, key, value);
         }
     }
+    klass->properties_cache_version = version;
+    return klass->properties_cache;
+}
+
+ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name,
+                                           Error **errp)
+{
+    ObjectProperty *prop;
 
-    prop = g_hash_table_lookup(klass->properties, name);
+    prop = g_hash_table_lookup(object_class_get_properties_cache(klass), name);
     if (!prop) {
         error_setg(errp, "Property '.%s' not found", name);
     }
@@ -1584,6 +1611,7 @@ static void object_finalize_child_property(Object *obj, const char *name,
     }
     child->parent = NULL;
     object_unref(child);
+    object_resolve_cache_invalidate();
 }
 
 void object_property_add_child(Object *obj, const char *name,
@@ -1610,6 +1638,7 @@ void object_property_add_child(Object *obj, const char *name,
     op->resolve = object_resolve_child_property;
     object_ref(child);
     child->parent = obj;
+    object_resolve_cache_invalidate();
 
 out:
     g_free(type);
@@ -1846,13 +1875,41 @@ gchar *object_get_canonical_path(Object *obj)
     return path;
 }
 
-Object *object_resolve_path_component(Object *parent, const gchar *part)
+/*
+ * Cache of object_resolve_path_type() results, keyed by type and path.
+ *
+ * Only resolutions that went exclusively through child<> properties are
+ * cached: link targets can be changed without going through QOM.  Adding
+ * or removing a child anywhere in the composition tree drops the whole
+ * cache, so the cached objects are always still alive.
+ */
+#define RESOLVE_CACHE_MAX 1024
+
+typedef struct ResolveCacheEntry {
+    Object *obj;
+    bool ambiguous;
+} ResolveCacheEntry;
+
+static GHashTable *resolve_cache;
+
+static void object_resolve_cache_invalidate(void)
+{
+    if (resolve_cache) {
+        g_hash_table_remove_all(resolve_cache);
+    }
+}
+
+static Object *object_resolve_component(Object *parent, const gchar *part,
+                                        bool *cacheable)
 {
     ObjectProperty *prop = object_property_find(parent, part, NULL);
     if (prop == NULL) {
         return NULL;
     }
 
+    if (!object_property_is_child(prop)) {
+        *cacheable = false;
+    }
     if (prop->resolve) {
         return prop->resolve(parent, prop->opaque, part);
     } else {
@@ -1860,10 +1917,18 @@ Object *object_resolve_path_component(Object *parent, const gchar *part)
     }
 }
 
+Object *object_resolve_path_component(Object *parent, const gchar *part)
+{
+    bool cacheable;
+
+    return object_resolve_component(parent, part, &cacheable);
+}
+
 static Object *object_resolve_abs_path(Object *parent,
                                           gchar **parts,
                                           const char *typename,
-                                          int index)
+                                          int index,
+                                          bool *cacheable)
 {
     Object *child;
 
@@ -1872,27 +1937,30 @@ static Object *object_resolve_abs_path(Object *parent,
     }
 
     if (strcmp(parts[index], "") == 0) {
-        return object_resolve_abs_path(parent, parts, typename, index + 1);
+        return object_resolve_abs_path(parent, parts, typename, index + 1,
+                                       cacheable);
     }
 
-    child = object_resolve_path_component(parent, parts[index]);
+    child = object_resolve_component(parent, parts[index], cacheable);
     if (!child) {
         return NULL;
     }
 
-    return object_resolve_abs_path(child, parts, typename, index + 1);
+    return object_resolve_abs_path(child, parts, typename, index + 1,
+                                   cacheable);
 }
 
 static Object *object_resolve_partial_path(Object *parent,
                                               gchar **parts,
                                               const char *typename,
-                                              bool *ambiguous)
+                                              bool *ambiguous,
+                                              bool *cacheable)
 {
     Object *obj;
     GHashTableIter iter;
     ObjectProperty *prop;
 
-    obj = object_resolve_abs_path(parent, parts, typename, 0);
+    obj = object_resolve_abs_path(parent, parts, typename, 0, cacheable);
 
     g_hash_table_iter_init(&iter, parent->properties);
     while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&prop)) {
@@ -1903,7 +1971,7 @@ static Object *object_resolve_partial_path(Object *parent,
         }
 
         found = object_resolve_partial_path(prop->opaque, parts,
-                                            typename, ambiguous);
+                                            typename, ambiguous, cacheable);
         if (found) {
             if (obj) {
                 *ambiguous = true;
@@ -1925,23 +1993,55 @@ Object *object_resolve_path_type(const char *path, const char *typename,
 {
     Object *obj;
     gchar **parts;
+    gchar *key;
+    ResolveCacheEntry *entry;
+    bool ambiguous = false;
+    bool cacheable = true;
+
+    if (!resolve_cache) {
+        resolve_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, g_free);
+    }
+
+    /* the length prefix keeps the key unambiguous */
+    key = g_strdup_printf("%zu:%s%s", strlen(typename), typename, path);
+    entry = g_hash_table_lookup(resolve_cache, key);
+    if (entry) {
+        g_free(key);
+        if (ambiguousp && path[0] != '/') {
+            *ambiguousp = entry->ambiguous;
+        }
+        return entry->obj;
+    }
 
     parts = g_strsplit(path, "/", 0);
     assert(parts);
 
     if (parts[0] == NULL || strcmp(parts[0], "") != 0) {
-        bool ambiguous = false;
         obj = object_resolve_partial_path(object_get_root(), parts,
-                                          typename, &ambiguous);
+                                          typename, &ambiguous, &cacheable);
         if (ambiguousp) {
             *ambiguousp = ambiguous;
         }
     } else {
-        obj = object_resolve_abs_path(object_get_root(), parts, typename, 1);
+        obj = object_resolve_abs_path(object_get_root(), parts, typename, 1,
+                                      &cacheable);
     }
 
     g_strfreev(parts);
 
+    if (cacheable) {
+        if (g_hash_table_size(resolve_cache) >= RESOLVE_CACHE_MAX) {
+            g_hash_table_remove_all(resolve_cache);
+        }
+        entry = g_new(ResolveCacheEntry, 1);
+        entry->obj = obj;
+        entry->ambiguous = ambiguous;
+        g_hash_table_insert(resolve_cache, key, entry);
+    } else {
+        g_free(key);
+    }
+
     return obj;
 }
 
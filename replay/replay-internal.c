@@ -15,6 +15,13 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -27,6 +34,52 @@ static QemuMutex lock;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * The log is not accessed byte by byte through stdio.  vCPUs fill (or
+ * drain) an in-memory block of REPLAY_BLOCK_SIZE bytes under the replay
+ * mutex, and a helper thread writes full blocks to the file in the
+ * background (record) or reads ahead up to REPLAY_MAX_BLOCKS blocks
+ * (replay).  With compression enabled each block is stored as a zstd
+ * frame preceded by its compressed and uncompressed sizes, both
+ * little-endian 32-bit.
+ *
+ * Offsets handed out to snapshots are logical: the header size plus the
+ * number of uncompressed bytes before the position, so they match file
+ * offsets for uncompressed logs.
+ */
+#define REPLAY_BLOCK_SIZE   (1 << 20)
+#define REPLAY_MAX_BLOCKS   8
+
+typedef struct ReplayBlock {
+    uint8_t *data;
+    size_t len;
+    /* Logical offset of data[0] */
+    uint64_t offset;
+    QSIMPLEQ_ENTRY(ReplayBlock) next;
+} ReplayBlock;
+
+static struct {
+    bool compress;
+    /* Block being filled or drained by the vCPUs, and the read position */
+    ReplayBlock *cur;
+    size_t pos;
+
+    /* The fields below are protected by mutex */
+    QemuThread thread;
+    QemuMutex mutex;
+    QemuCond cond;
+    bool running;
+    bool stop;
+    bool eof;
+    bool error;
+    int nr_queued;
+    QSIMPLEQ_HEAD(, ReplayBlock) queue;
+
+    /* Logical offset of the first block, and of the next one to read */
+    uint64_t start;
+    uint64_t read_offset;
+} replay_io;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -41,11 +94,331 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static ReplayBlock *replay_block_new(uint64_t offset, size_t size)
+{
+    ReplayBlock *blk = g_new0(ReplayBlock, 1);
+
+    blk->data = g_malloc(size);
+    blk->offset = offset;
+    return blk;
+}
+
+static void replay_block_free(ReplayBlock *blk)
+{
+    if (blk) {
+        g_free(blk->data);
+        g_free(blk);
+    }
+}
+
+static bool replay_write_block(ReplayBlock *blk)
+{
+#ifdef CONFIG_ZSTD
+    if (replay_io.compress) {
+        size_t bound = ZSTD_compressBound(blk->len);
+        g_autofree uint8_t *buf = g_malloc(bound + 8);
+        size_t csize = ZSTD_compress(buf + 8, bound, blk->data, blk->len, 1);
+
+        if (ZSTD_isError(csize)) {
+            return false;
+        }
+        stl_le_p(buf, csize);
+        stl_le_p(buf + 4, blk->len);
+        return fwrite(buf, 1, csize + 8, replay_file) == csize + 8;
+    }
+#endif
+    return fwrite(blk->data, 1, blk->len, replay_file) == blk->len;
+}
+
+/* Returns NULL at end of file, and sets *error if that was not clean.  */
+static ReplayBlock *replay_read_block(uint64_t offset, bool *error)
+{
+    ReplayBlock *blk;
+
+#ifdef CONFIG_ZSTD
+    if (replay_io.compress) {
+        g_autofree uint8_t *buf = NULL;
+        uint8_t hdr[8];
+        size_t n = fread(hdr, 1, sizeof(hdr), replay_file);
+        uint32_t csize, size;
+
+        if (n != sizeof(hdr)) {
+            *error = n != 0 || ferror(replay_file);
+            return NULL;
+        }
+        csize = ldl_le_p(hdr);
+        size = ldl_le_p(hdr + 4);
+        if (size > REPLAY_BLOCK_SIZE || csize > ZSTD_compressBound(size)) {
+            *error = true;
+            return NULL;
+        }
+        buf = g_malloc(csize);
+        if (fread(buf, 1, csize, replay_file) != csize) {
+            *error = true;
+            return NULL;
+        }
+        blk = replay_block_new(offset, size);
+        blk->len = ZSTD_decompress(blk->data, size, buf, csize);
+        if (ZSTD_isError(blk->len) || blk->len != size) {
+            replay_block_free(blk);
+            *error = true;
+            return NULL;
+        }
+        return blk;
+    }
+#endif
+    blk = replay_block_new(offset, REPLAY_BLOCK_SIZE);
+    blk->len = fread(blk->data, 1, REPLAY_BLOCK_SIZE, replay_file);
+    if (blk->len == 0) {
+        *error = ferror(replay_file);
+        replay_block_free(blk);
+        return NULL;
+    }
+    return blk;
+}
+
+static void *replay_writer_thread(void *opaque)
+{
+    ReplayBlock *blk;
+    bool ok;
+
+    qemu_mutex_lock(&replay_io.mutex);
+    for (;;) {
+        blk = QSIMPLEQ_FIRST(&replay_io.queue);
+        if (!blk) {
+            if (replay_io.stop) {
+                break;
+            }
+            qemu_cond_wait(&replay_io.cond, &replay_io.mutex);
+            continue;
+        }
+        qemu_mutex_unlock(&replay_io.mutex);
+
+        ok = replay_write_block(blk);
+
+        qemu_mutex_lock(&replay_io.mutex);
+        QSIMPLEQ_REMOVE_HEAD(&replay_io.queue, next);
+        replay_io.nr_queued--;
+        replay_io.error |= !ok;
+        qemu_cond_broadcast(&replay_io.cond);
+        replay_block_free(blk);
+    }
+    qemu_mutex_unlock(&replay_io.mutex);
+    return NULL;
+}
+
+static void *replay_reader_thread(void *opaque)
+{
+    ReplayBlock *blk;
+    bool error = false;
+
+    qemu_mutex_lock(&replay_io.mutex);
+    while (!replay_io.stop) {
+        if (replay_io.eof || replay_io.nr_queued >= REPLAY_MAX_BLOCKS) {
+            qemu_cond_wait(&replay_io.cond, &replay_io.mutex);
+            continue;
+        }
+        qemu_mutex_unlock(&replay_io.mutex);
+
+        blk = replay_read_block(replay_io.read_offset, &error);
+
+        qemu_mutex_lock(&replay_io.mutex);
+        if (blk) {
+            replay_io.read_offset += blk->len;
+            QSIMPLEQ_INSERT_TAIL(&replay_io.queue, blk, next);
+            replay_io.nr_queued++;
+        } else {
+            replay_io.eof = true;
+            replay_io.error = error;
+        }
+        qemu_cond_broadcast(&replay_io.cond);
+    }
+    qemu_mutex_unlock(&replay_io.mutex);
+    return NULL;
+}
+
+static void replay_io_start_thread(void)
+{
+    replay_io.stop = false;
+    replay_io.eof = false;
+    replay_io.running = true;
+    qemu_thread_create(&replay_io.thread, "replay-io",
+                       replay_mode == REPLAY_MODE_RECORD ?
+                       replay_writer_thread : replay_reader_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+}
+
+static void replay_io_stop_thread(void)
+{
+    ReplayBlock *blk;
+
+    if (!replay_io.running) {
+        return;
+    }
+    qemu_mutex_lock(&replay_io.mutex);
+    replay_io.stop = true;
+    qemu_cond_broadcast(&replay_io.cond);
+    qemu_mutex_unlock(&replay_io.mutex);
+    qemu_thread_join(&replay_io.thread);
+    replay_io.running = false;
+
+    /* Drop blocks that were read ahead but not consumed */
+    while ((blk = QSIMPLEQ_FIRST(&replay_io.queue))) {
+        QSIMPLEQ_REMOVE_HEAD(&replay_io.queue, next);
+        replay_block_free(blk);
+    }
+    replay_io.nr_queued = 0;
+}
+
+void replay_io_init(uint64_t offset, bool compress)
+{
+    qemu_mutex_init(&replay_io.mutex);
+    qemu_cond_init(&replay_io.cond);
+    QSIMPLEQ_INIT(&replay_io.queue);
+    replay_io.compress = compress;
+    replay_io.start = offset;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_io.cur = replay_block_new(offset, REPLAY_BLOCK_SIZE);
+    } else {
+        replay_io.cur = replay_block_new(offset, 0);
+        replay_io.read_offset = offset;
+    }
+    replay_io.pos = 0;
+    replay_io_start_thread();
+}
+
+/* Hand the current block over to the writer thread.  */
+static void replay_io_submit(void)
+{
+    ReplayBlock *blk = replay_io.cur;
+    bool error;
+
+    qemu_mutex_lock(&replay_io.mutex);
+    while (replay_io.nr_queued >= REPLAY_MAX_BLOCKS) {
+        qemu_cond_wait(&replay_io.cond, &replay_io.mutex);
+    }
+    QSIMPLEQ_INSERT_TAIL(&replay_io.queue, blk, next);
+    replay_io.nr_queued++;
+    error = replay_io.error;
+    qemu_cond_broadcast(&replay_io.cond);
+    qemu_mutex_unlock(&replay_io.mutex);
+
+    if (error) {
+        replay_write_error();
+    }
+    replay_io.cur = replay_block_new(blk->offset + blk->len,
+                                     REPLAY_BLOCK_SIZE);
+}
+
+/* Move on to the next block read ahead by the reader thread.  */
+static bool replay_io_next(void)
+{
+    ReplayBlock *blk;
+
+    qemu_mutex_lock(&replay_io.mutex);
+    while (!(blk = QSIMPLEQ_FIRST(&replay_io.queue)) && !replay_io.eof) {
+        qemu_cond_wait(&replay_io.cond, &replay_io.mutex);
+    }
+    if (blk) {
+        QSIMPLEQ_REMOVE_HEAD(&replay_io.queue, next);
+        replay_io.nr_queued--;
+        qemu_cond_broadcast(&replay_io.cond);
+    }
+    qemu_mutex_unlock(&replay_io.mutex);
+
+    if (!blk) {
+        return false;
+    }
+    replay_block_free(replay_io.cur);
+    replay_io.cur = blk;
+    replay_io.pos = 0;
+    return true;
+}
+
+void replay_io_finish(void)
+{
+    if (!replay_io.cur) {
+        return;
+    }
+    if (replay_mode == REPLAY_MODE_RECORD && replay_io.cur->len) {
+        replay_io_submit();
+    }
+    replay_io_stop_thread();
+    if (replay_io.error && replay_mode == REPLAY_MODE_RECORD) {
+        replay_write_error();
+    }
+    replay_block_free(replay_io.cur);
+    replay_io.cur = NULL;
+    qemu_cond_destroy(&replay_io.cond);
+    qemu_mutex_destroy(&replay_io.mutex);
+}
+
+bool replay_io_compressed(void)
+{
+    return replay_io.compress;
+}
+
+uint64_t replay_get_log_offset(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        return replay_io.cur->offset + replay_io.cur->len;
+    }
+    return replay_io.cur->offset + replay_io.pos;
+}
+
+void replay_set_log_offset(uint64_t offset)
+{
+    uint64_t block_offset = offset;
+    long file_offset = offset;
+
+    assert(replay_mode == REPLAY_MODE_PLAY);
+    replay_io_stop_thread();
+    clearerr(replay_file);
+    replay_io.error = false;
+
+#ifdef CONFIG_ZSTD
+    if (replay_io.compress) {
+        uint8_t hdr[8];
+
+        /*
+         * Walk the frame headers from the start of the log to find the
+         * block holding OFFSET.
+         */
+        block_offset = replay_io.start;
+        file_offset = replay_io.start;
+        fseek(replay_file, file_offset, SEEK_SET);
+        while (fread(hdr, 1, sizeof(hdr), replay_file) == sizeof(hdr) &&
+               block_offset + ldl_le_p(hdr + 4) <= offset) {
+            block_offset += ldl_le_p(hdr + 4);
+            file_offset += sizeof(hdr) + ldl_le_p(hdr);
+            fseek(replay_file, file_offset, SEEK_SET);
+        }
+        clearerr(replay_file);
+    }
+#endif
+    fseek(replay_file, file_offset, SEEK_SET);
+
+    replay_block_free(replay_io.cur);
+    replay_io.cur = replay_block_new(block_offset, 0);
+    replay_io.pos = 0;
+    replay_io.read_offset = block_offset;
+    replay_io_start_thread();
+
+    if (offset > block_offset) {
+        if (!replay_io_next()) {
+            replay_read_error();
+        }
+        replay_io.pos = offset - block_offset;
+    }
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        replay_io.cur->data[replay_io.cur->len++] = byte;
+        if (replay_io.cur->len == REPLAY_BLOCK_SIZE) {
+            replay_io_submit();
         }
     }
 }
@@ -79,9 +452,38 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size) {
+            ReplayBlock *blk = replay_io.cur;
+            size_t n = MIN(size, REPLAY_BLOCK_SIZE - blk->len);
+
+            memcpy(blk->data + blk->len, buf, n);
+            blk->len += n;
+            buf += n;
+            size -= n;
+            if (blk->len == REPLAY_BLOCK_SIZE) {
+                replay_io_submit();
+            }
+        }
+    }
+}
+
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    while (size) {
+        ReplayBlock *blk = replay_io.cur;
+        size_t n;
+
+        if (replay_io.pos == blk->len) {
+            if (!replay_io_next()) {
+                replay_read_error();
+            }
+            continue;
         }
+        n = MIN(size, blk->len - replay_io.pos);
+        memcpy(buf, blk->data + replay_io.pos, n);
+        replay_io.pos += n;
+        buf += n;
+        size -= n;
     }
 }
 
@@ -89,11 +491,11 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
+        if (likely(replay_io.pos < replay_io.cur->len)) {
+            byte = replay_io.cur->data[replay_io.pos++];
+        } else {
+            replay_get_bytes(&byte, 1);
         }
-        byte = r;
     }
     return byte;
 }
@@ -135,9 +537,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -146,23 +546,28 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
-    if (replay_file) {
-        if (feof(replay_file)) {
-            error_report("replay file is over");
-            qemu_system_vmstop_request_prepare();
-            qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+    bool eof, error;
+
+    if (replay_file && replay_io.pos == replay_io.cur->len) {
+        qemu_mutex_lock(&replay_io.mutex);
+        eof = replay_io.eof && QSIMPLEQ_EMPTY(&replay_io.queue);
+        error = replay_io.error;
+        qemu_mutex_unlock(&replay_io.mutex);
+
+        if (error) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
+        } else if (eof) {
+            error_report("replay file is over");
+            qemu_system_vmstop_request_prepare();
+            qemu_system_vmstop_request(RUN_STATE_PAUSED);
         }
     }
 }
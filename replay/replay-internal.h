@@ -92,6 +92,17 @@ extern ReplayState replay_state;
 /* File for replay writing */
 extern FILE *replay_file;
 
+/*! Starts buffered log I/O at logical offset OFFSET of replay_file. */
+void replay_io_init(uint64_t offset, bool compress);
+/*! Flushes pending log blocks and stops the I/O thread. */
+void replay_io_finish(void);
+/*! Returns true if log blocks are zstd compressed. */
+bool replay_io_compressed(void);
+/*! Returns the logical offset of the current log position. */
+uint64_t replay_get_log_offset(void);
+/*! Moves the replayed log to the specified logical offset. */
+void replay_set_log_offset(uint64_t offset);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
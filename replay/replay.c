@@ -15,6 +15,7 @@
 #include "sysemu/runstate.h"
 #include "replay-internal.h"
 #include "qemu/timer.h"
+#include "qemu/bswap.h"
 #include "qemu/main-loop.h"
 #include "qemu/option.h"
 #include "sysemu/cpus.h"
@@ -23,6 +24,8 @@
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
 #define REPLAY_VERSION              0xe02008
+/* Set in the version of logs whose blocks are zstd compressed */
+#define REPLAY_VERSION_ZSTD         0x1000000
 /* Size of replay log header */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
@@ -243,9 +246,10 @@ bool replay_has_checkpoint(void)
     return res;
 }
 
-static void replay_enable(const char *fname, int mode)
+static void replay_enable(const char *fname, int mode, bool compress)
 {
     const char *fmode = NULL;
+    uint8_t header[HEADER_SIZE];
     assert(!replay_file);
 
     switch (mode) {
@@ -281,13 +285,27 @@ static void replay_enable(const char *fname, int mode)
     if (replay_mode == REPLAY_MODE_RECORD) {
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        unsigned int version = 0;
+
+        if (fread(header, 1, HEADER_SIZE, replay_file) == HEADER_SIZE) {
+            version = ldl_be_p(header);
+        }
+        compress = version & REPLAY_VERSION_ZSTD;
+        if ((version & ~REPLAY_VERSION_ZSTD) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+    }
+#ifndef CONFIG_ZSTD
+    if (compress) {
+        fprintf(stderr, "Replay: zstd compression is not supported "
+                "by this build\n");
+        exit(1);
+    }
+#endif
+
+    replay_io_init(HEADER_SIZE, compress);
+    if (replay_mode == REPLAY_MODE_PLAY) {
         replay_fetch_data_kind();
     }
 
@@ -329,7 +347,7 @@ void replay_configure(QemuOpts *opts)
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
     replay_vmstate_register();
-    replay_enable(fname, mode);
+    replay_enable(fname, mode, qemu_opt_get_bool(opts, "rrcompress", false));
 
 out:
     loc_pop(&loc);
@@ -366,12 +384,21 @@ void replay_finish(void)
     /* finalize the file */
     if (replay_file) {
         if (replay_mode == REPLAY_MODE_RECORD) {
+            uint8_t header[HEADER_SIZE] = { 0 };
+
             /* write end event */
             replay_put_event(EVENT_END);
+            replay_io_finish();
 
             /* write header */
+            stl_be_p(header, REPLAY_VERSION |
+                     (replay_io_compressed() ? REPLAY_VERSION_ZSTD : 0));
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            if (fwrite(header, 1, HEADER_SIZE, replay_file) != HEADER_SIZE) {
+                error_report("replay write error");
+            }
+        } else {
+            replay_io_finish();
         }
 
         fclose(replay_file);
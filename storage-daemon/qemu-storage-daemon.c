@@ -0,0 +1,585 @@
+/*
+ * QEMU storage daemon
+ *
+ * Runs the QEMU block layer without a guest and exports block nodes to
+ * other processes over NBD or vhost-user-blk.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <getopt.h>
+
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qapi/qapi-visit-block-core.h"
+#include "qapi/qmp/qdict.h"
+#include "block/qdict.h"
+#include "qapi/qobject-input-visitor.h"
+#include "qapi/qobject-output-visitor.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/config-file.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "block/block_int.h"
+#include "block/nbd.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/iothread.h"
+#include "qom/object_interfaces.h"
+#include "io/channel-socket.h"
+#include "io/net-listener.h"
+#include "crypto/init.h"
+#include "crypto/tlscreds.h"
+#include "trace/control.h"
+#include "qemu-version.h"
+#include "vhost-user-blk-server.h"
+
+#define QSD_OPT_BLOCKDEV    256
+#define QSD_OPT_OBJECT      257
+#define QSD_OPT_NBD_SERVER  258
+#define QSD_OPT_EXPORT      259
+#define QSD_OPT_PID_FILE    260
+
+typedef struct StorageDaemonNode {
+    BlockDriverState *bs;
+    QTAILQ_ENTRY(StorageDaemonNode) next;
+} StorageDaemonNode;
+
+typedef struct StorageDaemonExport {
+    NBDExport *nbd_exp;
+    VuBlkExport *vu_blk_exp;
+    AioContext *ctx;
+    QTAILQ_ENTRY(StorageDaemonExport) next;
+} StorageDaemonExport;
+
+static QTAILQ_HEAD(, StorageDaemonNode) nodes =
+    QTAILQ_HEAD_INITIALIZER(nodes);
+static QTAILQ_HEAD(, StorageDaemonExport) exports =
+    QTAILQ_HEAD_INITIALIZER(exports);
+
+static QIONetListener *nbd_listener;
+static QCryptoTLSCreds *nbd_tlscreds;
+static char *nbd_tlsauthz;
+
+static bool exit_requested;
+
+static QemuOptsList qemu_object_opts = {
+    .name = "object",
+    .implied_opt_name = "qom-type",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_object_opts.head),
+    .desc = {
+        { }
+    },
+};
+
+static QemuOptsList nbd_server_opts = {
+    .name = "nbd-server",
+    .head = QTAILQ_HEAD_INITIALIZER(nbd_server_opts.head),
+    .desc = {
+        {
+            .name = "path",
+            .type = QEMU_OPT_STRING,
+            .help = "UNIX domain socket to listen on",
+        },
+        {
+            .name = "host",
+            .type = QEMU_OPT_STRING,
+            .help = "interface to listen on",
+        },
+        {
+            .name = "port",
+            .type = QEMU_OPT_STRING,
+            .help = "TCP port to listen on",
+        },
+        {
+            .name = "tls-creds",
+            .type = QEMU_OPT_STRING,
+            .help = "ID of the TLS credentials object",
+        },
+        {
+            .name = "tls-authz",
+            .type = QEMU_OPT_STRING,
+            .help = "ID of the authorization object",
+        },
+        { /* end of list */ }
+    },
+};
+
+static QemuOptsList export_opts = {
+    .name = "export",
+    .implied_opt_name = "type",
+    .head = QTAILQ_HEAD_INITIALIZER(export_opts.head),
+    .desc = {
+        {
+            .name = "type",
+            .type = QEMU_OPT_STRING,
+            .help = "nbd or vhost-user-blk",
+        },
+        {
+            .name = "node-name",
+            .type = QEMU_OPT_STRING,
+            .help = "block node to export",
+        },
+        {
+            .name = "name",
+            .type = QEMU_OPT_STRING,
+            .help = "NBD export name (default: node-name)",
+        },
+        {
+            .name = "path",
+            .type = QEMU_OPT_STRING,
+            .help = "vhost-user-blk UNIX domain socket",
+        },
+        {
+            .name = "writable",
+            .type = QEMU_OPT_BOOL,
+            .help = "allow clients to write (default: off)",
+        },
+        {
+            .name = "iothread",
+            .type = QEMU_OPT_STRING,
+            .help = "ID of the IOThread that processes requests",
+        },
+        { /* end of list */ }
+    },
+};
+
+static void usage(const char *name)
+{
+    (printf) (
+"Usage: %s [OPTIONS]\n"
+"QEMU storage daemon\n"
+"\n"
+"  -h, --help                display this help and exit\n"
+"  -V, --version             output version information and exit\n"
+"\n"
+"  --blockdev [driver=]<driver>[,node-name=<N>][,<prop>=<value>...]\n"
+"                            configure a block backend, with the same\n"
+"                            syntax as blockdev-add or -blockdev\n"
+"  --object <properties>     define a QOM object such as an iothread\n"
+"  --nbd-server path=<socket-path>[,tls-creds=<id>][,tls-authz=<id>]\n"
+"  --nbd-server host=<host>[,port=<port>][,tls-creds=<id>][,tls-authz=<id>]\n"
+"                            start an NBD server for the NBD exports\n"
+"  --export [type=]nbd,node-name=<N>[,name=<export-name>]\n"
+"           [,writable=on|off][,iothread=<id>]\n"
+"                            export a block node over NBD\n"
+"  --export [type=]vhost-user-blk,node-name=<N>,path=<socket-path>\n"
+"           [,writable=on|off][,iothread=<id>]\n"
+"                            export a block node as a vhost-user-blk device\n"
+"  --pid-file=PATH           store the process ID in PATH\n"
+"  -T, --trace [[enable=]<pattern>][,events=<file>][,file=<file>]\n"
+"                            specify tracing options\n"
+"\n"
+"Options are processed in the order they are given, so objects and block\n"
+"nodes must be defined before they are referenced.\n"
+"\n"
+QEMU_HELP_BOTTOM "\n"
+    , name);
+}
+
+static void version(const char *name)
+{
+    printf(
+"%s " QEMU_FULL_VERSION "\n"
+QEMU_COPYRIGHT "\n"
+    , name);
+}
+
+static void termsig_handler(int signum)
+{
+    atomic_set(&exit_requested, true);
+    qemu_notify_event();
+}
+
+static void qsd_blockdev_add(const char *optarg, Error **errp)
+{
+    BlockdevOptions *options = NULL;
+    StorageDaemonNode *node;
+    BlockDriverState *bs;
+    QObject *obj = NULL;
+    Visitor *v;
+    QDict *qdict;
+    Error *local_err = NULL;
+
+    v = qobject_input_visitor_new_str(optarg, "driver", &local_err);
+    if (!v) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    visit_type_BlockdevOptions(v, NULL, &options, &local_err);
+    visit_free(v);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+
+    /* Same as qmp_blockdev_add() */
+    v = qobject_output_visitor_new(&obj);
+    visit_type_BlockdevOptions(v, NULL, &options, &error_abort);
+    visit_complete(v, &obj);
+    visit_free(v);
+    qapi_free_BlockdevOptions(options);
+
+    qdict = qobject_to(QDict, obj);
+    qdict_flatten(qdict);
+
+    if (!qdict_get_try_str(qdict, "node-name")) {
+        error_setg(errp, "'node-name' must be specified for the root node");
+        qobject_unref(qdict);
+        return;
+    }
+
+    qdict_set_default_str(qdict, BDRV_OPT_CACHE_DIRECT, "off");
+    qdict_set_default_str(qdict, BDRV_OPT_CACHE_NO_FLUSH, "off");
+    qdict_set_default_str(qdict, BDRV_OPT_READ_ONLY, "off");
+
+    bs = bdrv_open(NULL, NULL, qdict, 0, errp);
+    if (!bs) {
+        return;
+    }
+
+    node = g_new0(StorageDaemonNode, 1);
+    node->bs = bs;
+    QTAILQ_INSERT_TAIL(&nodes, node, next);
+}
+
+static void nbd_client_closed(NBDClient *client, bool negotiated)
+{
+    nbd_client_put(client);
+}
+
+static void nbd_accept(QIONetListener *listener, QIOChannelSocket *cioc,
+                       gpointer opaque)
+{
+    qio_channel_set_name(QIO_CHANNEL(cioc), "nbd-server");
+    nbd_client_new(cioc, nbd_tlscreds, nbd_tlsauthz, nbd_client_closed);
+}
+
+static QCryptoTLSCreds *nbd_get_tls_creds(const char *id, Error **errp)
+{
+    Object *obj;
+    QCryptoTLSCreds *creds;
+
+    obj = object_resolve_path_component(object_get_objects_root(), id);
+    if (!obj) {
+        error_setg(errp, "No TLS credentials with id '%s'", id);
+        return NULL;
+    }
+    creds = (QCryptoTLSCreds *)
+        object_dynamic_cast(obj, TYPE_QCRYPTO_TLS_CREDS);
+    if (!creds) {
+        error_setg(errp, "Object with id '%s' is not TLS credentials", id);
+        return NULL;
+    }
+
+    if (creds->endpoint != QCRYPTO_TLS_CREDS_ENDPOINT_SERVER) {
+        error_setg(errp, "Expecting TLS credentials with a server endpoint");
+        return NULL;
+    }
+    object_ref(obj);
+    return creds;
+}
+
+static void qsd_nbd_server_start(QemuOpts *opts, Error **errp)
+{
+    const char *path = qemu_opt_get(opts, "path");
+    const char *host = qemu_opt_get(opts, "host");
+    const char *tls_creds = qemu_opt_get(opts, "tls-creds");
+    SocketAddress *saddr;
+    int ret;
+
+    if (nbd_listener) {
+        error_setg(errp, "--nbd-server can only be given once");
+        return;
+    }
+    if (!path == !host) {
+        error_setg(errp, "--nbd-server needs exactly one of path and host");
+        return;
+    }
+
+    saddr = g_new0(SocketAddress, 1);
+    if (path) {
+        saddr->type = SOCKET_ADDRESS_TYPE_UNIX;
+        saddr->u.q_unix.path = g_strdup(path);
+    } else {
+        saddr->type = SOCKET_ADDRESS_TYPE_INET;
+        saddr->u.inet.host = g_strdup(host);
+        saddr->u.inet.port = g_strdup(qemu_opt_get(opts, "port") ?:
+                                      stringify(NBD_DEFAULT_PORT));
+    }
+
+    if (tls_creds) {
+        if (path) {
+            error_setg(errp, "TLS is only supported with IPv4/IPv6");
+            goto out;
+        }
+        nbd_tlscreds = nbd_get_tls_creds(tls_creds, errp);
+        if (!nbd_tlscreds) {
+            goto out;
+        }
+    }
+    nbd_tlsauthz = g_strdup(qemu_opt_get(opts, "tls-authz"));
+
+    nbd_listener = qio_net_listener_new();
+    qio_net_listener_set_name(nbd_listener, "nbd-listener");
+    ret = qio_net_listener_open_sync(nbd_listener, saddr, 1, errp);
+    if (ret < 0) {
+        object_unref(OBJECT(nbd_listener));
+        nbd_listener = NULL;
+        goto out;
+    }
+    qio_net_listener_set_client_func(nbd_listener, nbd_accept, NULL, NULL);
+
+out:
+    qapi_free_SocketAddress(saddr);
+}
+
+static void qsd_export_add(QemuOpts *opts, Error **errp)
+{
+    const char *type = qemu_opt_get(opts, "type");
+    const char *node_name = qemu_opt_get(opts, "node-name");
+    const char *iothread_id = qemu_opt_get(opts, "iothread");
+    bool writable = qemu_opt_get_bool(opts, "writable", false);
+    StorageDaemonExport *exp;
+    BlockDriverState *bs;
+    AioContext *ctx = qemu_get_aio_context();
+    AioContext *old_ctx;
+
+    if (!node_name) {
+        error_setg(errp, "--export needs a node-name");
+        return;
+    }
+    bs = bdrv_find_node(node_name);
+    if (!bs) {
+        error_setg(errp, "Cannot find node '%s'", node_name);
+        return;
+    }
+
+    if (iothread_id) {
+        IOThread *iothread = iothread_by_id(iothread_id);
+
+        if (!iothread) {
+            error_setg(errp, "Cannot find iothread '%s'", iothread_id);
+            return;
+        }
+        ctx = iothread_get_aio_context(iothread);
+    }
+
+    exp = g_new0(StorageDaemonExport, 1);
+    exp->ctx = ctx;
+
+    if (!g_strcmp0(type, "nbd")) {
+        int ret;
+
+        if (!nbd_listener) {
+            error_setg(errp, "NBD exports need --nbd-server");
+            goto fail;
+        }
+        if (qemu_opt_get(opts, "path")) {
+            error_setg(errp, "path is only valid for vhost-user-blk exports");
+            goto fail;
+        }
+
+        old_ctx = bdrv_get_aio_context(bs);
+        aio_context_acquire(old_ctx);
+        ret = bdrv_try_set_aio_context(bs, ctx, errp);
+        aio_context_release(old_ctx);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        aio_context_acquire(ctx);
+        exp->nbd_exp = nbd_export_new(bs, 0, bdrv_getlength(bs),
+                                      qemu_opt_get(opts, "name") ?: node_name,
+                                      NULL, NULL, !writable, true, NULL, false,
+                                      NULL, errp);
+        aio_context_release(ctx);
+        if (!exp->nbd_exp) {
+            goto fail;
+        }
+    } else if (!g_strcmp0(type, "vhost-user-blk")) {
+        const char *path = qemu_opt_get(opts, "path");
+
+        if (!path) {
+            error_setg(errp, "vhost-user-blk exports need a path");
+            goto fail;
+        }
+        if (qemu_opt_get(opts, "name")) {
+            error_setg(errp, "name is only valid for NBD exports");
+            goto fail;
+        }
+
+        exp->vu_blk_exp = vu_blk_export_new(bs, path, writable, ctx, errp);
+        if (!exp->vu_blk_exp) {
+            goto fail;
+        }
+    } else {
+        error_setg(errp, "Unknown export type '%s'", type ?: "");
+        goto fail;
+    }
+
+    QTAILQ_INSERT_TAIL(&exports, exp, next);
+    return;
+
+fail:
+    g_free(exp);
+}
+
+static void qsd_shutdown(void)
+{
+    StorageDaemonExport *exp, *next_exp;
+    StorageDaemonNode *node, *next_node;
+
+    QTAILQ_FOREACH_SAFE(exp, &exports, next, next_exp) {
+        if (exp->vu_blk_exp) {
+            vu_blk_export_free(exp->vu_blk_exp);
+        }
+        QTAILQ_REMOVE(&exports, exp, next);
+        g_free(exp);
+    }
+
+    if (nbd_listener) {
+        qio_net_listener_disconnect(nbd_listener);
+        object_unref(OBJECT(nbd_listener));
+        nbd_listener = NULL;
+    }
+    nbd_export_close_all();
+    if (nbd_tlscreds) {
+        object_unref(OBJECT(nbd_tlscreds));
+    }
+    g_free(nbd_tlsauthz);
+
+    QTAILQ_FOREACH_SAFE(node, &nodes, next, next_node) {
+        AioContext *ctx = bdrv_get_aio_context(node->bs);
+
+        aio_context_acquire(ctx);
+        bdrv_unref(node->bs);
+        aio_context_release(ctx);
+        QTAILQ_REMOVE(&nodes, node, next);
+        g_free(node);
+    }
+
+    job_cancel_sync_all();
+    bdrv_close_all();
+}
+
+int main(int argc, char **argv)
+{
+    const char *sopt = "hVT:";
+    struct option lopt[] = {
+        { "help", no_argument, NULL, 'h' },
+        { "version", no_argument, NULL, 'V' },
+        { "trace", required_argument, NULL, 'T' },
+        { "blockdev", required_argument, NULL, QSD_OPT_BLOCKDEV },
+        { "object", required_argument, NULL, QSD_OPT_OBJECT },
+        { "nbd-server", required_argument, NULL, QSD_OPT_NBD_SERVER },
+        { "export", required_argument, NULL, QSD_OPT_EXPORT },
+        { "pid-file", required_argument, NULL, QSD_OPT_PID_FILE },
+        { NULL, 0, NULL, 0 }
+    };
+    struct sigaction sa_term;
+    const char *pid_file_name = NULL;
+    char *trace_file = NULL;
+    QemuOpts *opts;
+    Object *obj;
+    int ch;
+
+    memset(&sa_term, 0, sizeof(sa_term));
+    sa_term.sa_handler = termsig_handler;
+    sigaction(SIGTERM, &sa_term, NULL);
+    sigaction(SIGINT, &sa_term, NULL);
+    sigaction(SIGHUP, &sa_term, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    error_init(argv[0]);
+    module_call_init(MODULE_INIT_TRACE);
+    qcrypto_init(&error_fatal);
+    module_call_init(MODULE_INIT_QOM);
+    qemu_add_opts(&qemu_trace_opts);
+    qemu_init_exec_dir(argv[0]);
+
+    /* Tracing has to be set up before anything interesting happens */
+    while ((ch = getopt_long(argc, argv, sopt, lopt, NULL)) != -1) {
+        switch (ch) {
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        case 'V':
+            version(argv[0]);
+            exit(EXIT_SUCCESS);
+        case 'T':
+            g_free(trace_file);
+            trace_file = trace_opt_parse(optarg);
+            break;
+        case '?':
+            error_report("Try `%s --help' for more information.", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc) {
+        error_report("Unexpected argument: %s", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!trace_init_backends()) {
+        exit(EXIT_FAILURE);
+    }
+    trace_init_file(trace_file);
+    qemu_set_log(LOG_TRACE);
+
+    qemu_init_main_loop(&error_fatal);
+    bdrv_init();
+    atexit(qsd_shutdown);
+
+    /* Everything else is processed in order in a second pass */
+    optind = 0;
+    while ((ch = getopt_long(argc, argv, sopt, lopt, NULL)) != -1) {
+        switch (ch) {
+        case QSD_OPT_BLOCKDEV:
+            qsd_blockdev_add(optarg, &error_fatal);
+            break;
+        case QSD_OPT_OBJECT:
+            opts = qemu_opts_parse_noisily(&qemu_object_opts, optarg, true);
+            if (!opts) {
+                exit(EXIT_FAILURE);
+            }
+            obj = user_creatable_add_opts(opts, &error_fatal);
+            object_unref(obj);
+            qemu_opts_del(opts);
+            break;
+        case QSD_OPT_NBD_SERVER:
+            opts = qemu_opts_parse_noisily(&nbd_server_opts, optarg, false);
+            if (!opts) {
+                exit(EXIT_FAILURE);
+            }
+            qsd_nbd_server_start(opts, &error_fatal);
+            qemu_opts_del(opts);
+            break;
+        case QSD_OPT_EXPORT:
+            opts = qemu_opts_parse_noisily(&export_opts, optarg, true);
+            if (!opts) {
+                exit(EXIT_FAILURE);
+            }
+            qsd_export_add(opts, &error_fatal);
+            qemu_opts_del(opts);
+            break;
+        case QSD_OPT_PID_FILE:
+            pid_file_name = optarg;
+            break;
+        }
+    }
+
+    if (pid_file_name) {
+        qemu_write_pidfile(pid_file_name, &error_fatal);
+    }
+
+    while (!atomic_read(&exit_requested)) {
+        main_loop_wait(false);
+    }
+
+    return EXIT_SUCCESS;
+}
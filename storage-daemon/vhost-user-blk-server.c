@@ -0,0 +1,670 @@
+/*
+ * vhost-user-blk export for the QEMU storage daemon
+ *
+ * Based on contrib/vhost-user-blk/vhost-user-blk.c, but requests are
+ * processed in coroutines on top of the QEMU block layer and the
+ * vhost-user file descriptors are polled by an AioContext instead of the
+ * glib main loop, so that an export can run in an IOThread.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "block/block.h"
+#include "block/aio-wait.h"
+#include "sysemu/block-backend.h"
+#include "io/channel-socket.h"
+#include "io/net-listener.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "contrib/libvhost-user/libvhost-user.h"
+#include "vhost-user-blk-server.h"
+
+enum {
+    VU_BLK_MAX_QUEUES = 1,
+    VU_BLK_SEG_MAX = 128 - 2,
+    VU_BLK_MAX_DISCARD_SECTORS = 32768,
+    VU_BLK_MAX_WRITE_ZEROES_SECTORS = 32768,
+};
+
+struct virtio_blk_inhdr {
+    unsigned char status;
+};
+
+typedef struct VuBlkWatch {
+    VuBlkExport *exp;
+    int fd;
+    vu_watch_cb cb;
+    void *pvt;
+    QLIST_ENTRY(VuBlkWatch) next;
+} VuBlkWatch;
+
+struct VuBlkExport {
+    VuDev vu_dev;
+    BlockBackend *blk;
+    AioContext *ctx;
+    char *path;
+    bool writable;
+    struct virtio_blk_config blkcfg;
+
+    QIONetListener *listener;
+    QIOChannelSocket *sioc;     /* connected vhost-user master, or NULL */
+    QLIST_HEAD(, VuBlkWatch) watches;
+    unsigned int in_flight;     /* requests being processed */
+    bool disconnecting;
+    bool closing;
+};
+
+typedef struct VuBlkReq {
+    VuVirtqElement elem;
+    VuBlkExport *exp;
+    VuVirtq *vq;
+    struct virtio_blk_inhdr *in;
+    size_t in_len;
+} VuBlkReq;
+
+static void vu_blk_update_listener(VuBlkExport *exp);
+
+/* Runs in the main loop once the connection has been torn down */
+static void vu_blk_disconnect_done_bh(void *opaque)
+{
+    VuBlkExport *exp = opaque;
+
+    object_unref(OBJECT(exp->sioc));
+    exp->sioc = NULL;
+    exp->disconnecting = false;
+    vu_blk_update_listener(exp);
+    aio_wait_kick();
+}
+
+static void vu_blk_disconnect_finish(VuBlkExport *exp)
+{
+    VuBlkWatch *w, *next_w;
+
+    /* vu_deinit() closes the kick fds, so stop polling them first */
+    QLIST_FOREACH_SAFE(w, &exp->watches, next, next_w) {
+        aio_set_fd_handler(exp->ctx, w->fd, true, NULL, NULL, NULL, NULL);
+        QLIST_REMOVE(w, next);
+        g_free(w);
+    }
+
+    /* The socket belongs to exp->sioc, don't let vu_deinit() close it */
+    exp->vu_dev.sock = -1;
+    vu_deinit(&exp->vu_dev);
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            vu_blk_disconnect_done_bh, exp);
+}
+
+static void vu_blk_disconnect_bh(void *opaque)
+{
+    VuBlkExport *exp = opaque;
+
+    aio_context_acquire(exp->ctx);
+    if (exp->in_flight == 0) {
+        vu_blk_disconnect_finish(exp);
+    }
+    /* Otherwise the last request to complete finishes the disconnect */
+    aio_context_release(exp->ctx);
+}
+
+/* Called with exp->ctx acquired */
+static void vu_blk_disconnect(VuBlkExport *exp)
+{
+    if (exp->disconnecting) {
+        return;
+    }
+    exp->disconnecting = true;
+
+    aio_set_fd_handler(exp->ctx, exp->sioc->fd, true, NULL, NULL, NULL,
+                       NULL);
+    /* We may be called from deep inside libvhost-user, defer the rest */
+    aio_bh_schedule_oneshot(exp->ctx, vu_blk_disconnect_bh, exp);
+}
+
+static void vu_blk_panic_cb(VuDev *vu_dev, const char *buf)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+
+    if (buf) {
+        error_report("vhost-user-blk export '%s': %s", exp->path, buf);
+    }
+    vu_blk_disconnect(exp);
+}
+
+static void vu_blk_req_complete(VuBlkReq *req, unsigned char status)
+{
+    VuBlkExport *exp = req->exp;
+    VuDev *vu_dev = &exp->vu_dev;
+
+    req->in->status = status;
+
+    /* The status byte is written as well */
+    vu_queue_push(vu_dev, req->vq, &req->elem, req->in_len + 1);
+    vu_queue_notify(vu_dev, req->vq);
+
+    /* Allocated by vu_queue_pop() */
+    free(req);
+
+    blk_dec_in_flight(exp->blk);
+    if (--exp->in_flight == 0 && exp->disconnecting) {
+        vu_blk_disconnect_finish(exp);
+    }
+}
+
+static bool vu_blk_sect_range_ok(VuBlkExport *exp, uint64_t sector,
+                                 size_t size)
+{
+    uint64_t nb_sectors = size >> BDRV_SECTOR_BITS;
+    uint64_t total_sectors = le64_to_cpu(exp->blkcfg.capacity);
+
+    if (size % BDRV_SECTOR_SIZE) {
+        return false;
+    }
+    if (sector > total_sectors || nb_sectors > total_sectors - sector) {
+        return false;
+    }
+    return true;
+}
+
+static int coroutine_fn
+vu_blk_discard_write_zeroes(VuBlkExport *exp, struct iovec *iov,
+                            unsigned int iovcnt, uint32_t type)
+{
+    struct virtio_blk_discard_write_zeroes desc;
+    uint64_t sector;
+    uint32_t num_sectors;
+    uint32_t flags;
+
+    /* Only one segment is advertised in the config space */
+    if (iov_size(iov, iovcnt) != sizeof(desc) ||
+        iov_to_buf(iov, iovcnt, 0, &desc, sizeof(desc)) != sizeof(desc)) {
+        return VIRTIO_BLK_S_IOERR;
+    }
+
+    sector = le64_to_cpu(desc.sector);
+    num_sectors = le32_to_cpu(desc.num_sectors);
+    flags = le32_to_cpu(desc.flags);
+
+    if (!vu_blk_sect_range_ok(exp, sector,
+                              (uint64_t)num_sectors << BDRV_SECTOR_BITS)) {
+        return VIRTIO_BLK_S_IOERR;
+    }
+
+    if (type == VIRTIO_BLK_T_DISCARD) {
+        if (flags || num_sectors > VU_BLK_MAX_DISCARD_SECTORS) {
+            return VIRTIO_BLK_S_UNSUPP;
+        }
+        if (blk_co_pdiscard(exp->blk, sector << BDRV_SECTOR_BITS,
+                            num_sectors << BDRV_SECTOR_BITS) < 0) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+    } else {
+        BdrvRequestFlags req_flags = 0;
+
+        if (flags & ~VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP ||
+            num_sectors > VU_BLK_MAX_WRITE_ZEROES_SECTORS) {
+            return VIRTIO_BLK_S_UNSUPP;
+        }
+        if (flags & VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP) {
+            req_flags |= BDRV_REQ_MAY_UNMAP;
+        }
+        if (blk_co_pwrite_zeroes(exp->blk, sector << BDRV_SECTOR_BITS,
+                                 num_sectors << BDRV_SECTOR_BITS,
+                                 req_flags) < 0) {
+            return VIRTIO_BLK_S_IOERR;
+        }
+    }
+
+    return VIRTIO_BLK_S_OK;
+}
+
+static void coroutine_fn vu_blk_req_co(void *opaque)
+{
+    VuBlkReq *req = opaque;
+    VuBlkExport *exp = req->exp;
+    VuVirtqElement *elem = &req->elem;
+    struct iovec *in_iov = elem->in_sg;
+    struct iovec *out_iov = elem->out_sg;
+    unsigned int in_num = elem->in_num;
+    unsigned int out_num = elem->out_num;
+    struct virtio_blk_outhdr out;
+    unsigned char status;
+    uint32_t type;
+
+    /* refer to hw/block/virtio-blk.c */
+    if (out_num < 1 || in_num < 1 ||
+        iov_to_buf(out_iov, out_num, 0, &out, sizeof(out)) != sizeof(out) ||
+        in_iov[in_num - 1].iov_len < sizeof(struct virtio_blk_inhdr)) {
+        error_report("vhost-user-blk export '%s': invalid request headers",
+                     exp->path);
+        vu_blk_panic_cb(&exp->vu_dev, NULL);
+        /* Nothing can be completed, just drop the element */
+        free(req);
+        blk_dec_in_flight(exp->blk);
+        if (--exp->in_flight == 0 && exp->disconnecting) {
+            vu_blk_disconnect_finish(exp);
+        }
+        return;
+    }
+    iov_discard_front(&out_iov, &out_num, sizeof(out));
+
+    req->in = in_iov[in_num - 1].iov_base + in_iov[in_num - 1].iov_len -
+              sizeof(struct virtio_blk_inhdr);
+    iov_discard_back(in_iov, &in_num, sizeof(struct virtio_blk_inhdr));
+
+    type = le32_to_cpu(out.type);
+    switch (type & ~VIRTIO_BLK_T_BARRIER) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT: {
+        bool is_write = type & VIRTIO_BLK_T_OUT;
+        uint64_t sector = le64_to_cpu(out.sector);
+        QEMUIOVector qiov;
+        int ret;
+
+        if (is_write) {
+            qemu_iovec_init_external(&qiov, out_iov, out_num);
+        } else {
+            qemu_iovec_init_external(&qiov, in_iov, in_num);
+        }
+
+        if (is_write && !exp->writable) {
+            status = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+        if (!vu_blk_sect_range_ok(exp, sector, qiov.size)) {
+            status = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+
+        if (is_write) {
+            ret = blk_co_pwritev(exp->blk, sector << BDRV_SECTOR_BITS,
+                                 qiov.size, &qiov, 0);
+        } else {
+            ret = blk_co_preadv(exp->blk, sector << BDRV_SECTOR_BITS,
+                                qiov.size, &qiov, 0);
+            req->in_len = qiov.size;
+        }
+        status = ret < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK;
+        break;
+    }
+    case VIRTIO_BLK_T_FLUSH:
+        status = blk_co_flush(exp->blk) < 0 ? VIRTIO_BLK_S_IOERR
+                                            : VIRTIO_BLK_S_OK;
+        break;
+    case VIRTIO_BLK_T_GET_ID: {
+        char id[VIRTIO_BLK_ID_BYTES] = "vhost_user_blk";
+
+        req->in_len = iov_from_buf(in_iov, in_num, 0, id, sizeof(id));
+        status = VIRTIO_BLK_S_OK;
+        break;
+    }
+    case VIRTIO_BLK_T_DISCARD:
+    case VIRTIO_BLK_T_WRITE_ZEROES:
+        if (!exp->writable) {
+            status = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+        status = vu_blk_discard_write_zeroes(exp, out_iov, out_num, type);
+        break;
+    default:
+        status = VIRTIO_BLK_S_UNSUPP;
+        break;
+    }
+
+    vu_blk_req_complete(req, status);
+}
+
+/* Called with exp->ctx acquired */
+static bool vu_blk_process_vq(VuBlkExport *exp, VuVirtq *vq)
+{
+    VuDev *vu_dev = &exp->vu_dev;
+    bool progress = false;
+    VuBlkReq *req;
+
+    while (!exp->disconnecting &&
+           (req = vu_queue_pop(vu_dev, vq, sizeof(VuBlkReq)))) {
+        Coroutine *co;
+
+        req->exp = exp;
+        req->vq = vq;
+        req->in_len = 0;
+
+        exp->in_flight++;
+        blk_inc_in_flight(exp->blk);
+        co = qemu_coroutine_create(vu_blk_req_co, req);
+        qemu_coroutine_enter(co);
+        progress = true;
+    }
+
+    return progress;
+}
+
+static void vu_blk_queue_handler(VuDev *vu_dev, int idx)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+
+    vu_blk_process_vq(exp, vu_get_queue(vu_dev, idx));
+}
+
+static void vu_blk_queue_set_started(VuDev *vu_dev, int idx, bool started)
+{
+    VuVirtq *vq = vu_get_queue(vu_dev, idx);
+
+    vu_set_queue_handler(vu_dev, vq, started ? vu_blk_queue_handler : NULL);
+}
+
+static uint64_t vu_blk_get_features(VuDev *vu_dev)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+    uint64_t features;
+
+    features = 1ull << VIRTIO_BLK_F_SEG_MAX |
+               1ull << VIRTIO_BLK_F_TOPOLOGY |
+               1ull << VIRTIO_BLK_F_BLK_SIZE |
+               1ull << VIRTIO_BLK_F_FLUSH |
+               1ull << VIRTIO_BLK_F_DISCARD |
+               1ull << VIRTIO_BLK_F_WRITE_ZEROES |
+               1ull << VIRTIO_BLK_F_CONFIG_WCE |
+               1ull << VIRTIO_F_VERSION_1 |
+               1ull << VHOST_USER_F_PROTOCOL_FEATURES;
+
+    if (!exp->writable) {
+        features |= 1ull << VIRTIO_BLK_F_RO;
+    }
+
+    return features;
+}
+
+static uint64_t vu_blk_get_protocol_features(VuDev *vu_dev)
+{
+    return 1ull << VHOST_USER_PROTOCOL_F_CONFIG;
+}
+
+static int vu_blk_get_config(VuDev *vu_dev, uint8_t *config, uint32_t len)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+
+    if (len > sizeof(exp->blkcfg)) {
+        return -1;
+    }
+    memcpy(config, &exp->blkcfg, len);
+
+    return 0;
+}
+
+static int vu_blk_set_config(VuDev *vu_dev, const uint8_t *data,
+                             uint32_t offset, uint32_t size, uint32_t flags)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+
+    /* don't support live migration */
+    if (flags != VHOST_SET_CONFIG_TYPE_MASTER) {
+        return -1;
+    }
+
+    if (offset != offsetof(struct virtio_blk_config, wce) || size != 1) {
+        return -1;
+    }
+
+    exp->blkcfg.wce = *data;
+    blk_set_enable_write_cache(exp->blk, exp->blkcfg.wce);
+
+    return 0;
+}
+
+static const VuDevIface vu_blk_iface = {
+    .get_features = vu_blk_get_features,
+    .queue_set_started = vu_blk_queue_set_started,
+    .get_protocol_features = vu_blk_get_protocol_features,
+    .get_config = vu_blk_get_config,
+    .set_config = vu_blk_set_config,
+};
+
+static void vu_blk_watch_read(void *opaque)
+{
+    VuBlkWatch *w = opaque;
+    VuBlkExport *exp = w->exp;
+
+    aio_context_acquire(exp->ctx);
+    w->cb(&exp->vu_dev, VU_WATCH_IN, w->pvt);
+    aio_context_release(exp->ctx);
+}
+
+/*
+ * The only watches libvhost-user sets are for virtqueue kick fds, with the
+ * queue index as their data.  Polling the avail ring lets IOThread polling
+ * pick up new requests without waiting for the guest's kick.
+ */
+static bool vu_blk_watch_poll(void *opaque)
+{
+    VuBlkWatch *w = opaque;
+    VuBlkExport *exp = w->exp;
+    VuDev *vu_dev = &exp->vu_dev;
+    int idx = (intptr_t)w->pvt;
+    bool progress = false;
+    VuVirtq *vq;
+
+    aio_context_acquire(exp->ctx);
+    if (!exp->disconnecting && idx >= 0 && idx < vu_dev->max_queues) {
+        vq = vu_get_queue(vu_dev, idx);
+        if (vu_queue_started(vu_dev, vq) && !vu_queue_empty(vu_dev, vq)) {
+            progress = vu_blk_process_vq(exp, vq);
+        }
+    }
+    aio_context_release(exp->ctx);
+
+    return progress;
+}
+
+static void vu_blk_set_watch(VuDev *vu_dev, int fd, int condition,
+                             vu_watch_cb cb, void *pvt)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+    VuBlkWatch *w;
+
+    assert(condition == VU_WATCH_IN);
+
+    QLIST_FOREACH(w, &exp->watches, next) {
+        if (w->fd == fd) {
+            break;
+        }
+    }
+    if (!w) {
+        w = g_new0(VuBlkWatch, 1);
+        w->exp = exp;
+        w->fd = fd;
+        QLIST_INSERT_HEAD(&exp->watches, w, next);
+    }
+    w->cb = cb;
+    w->pvt = pvt;
+
+    aio_set_fd_handler(exp->ctx, fd, true, vu_blk_watch_read, NULL,
+                       vu_blk_watch_poll, w);
+}
+
+static void vu_blk_remove_watch(VuDev *vu_dev, int fd)
+{
+    VuBlkExport *exp = container_of(vu_dev, VuBlkExport, vu_dev);
+    VuBlkWatch *w;
+
+    QLIST_FOREACH(w, &exp->watches, next) {
+        if (w->fd == fd) {
+            aio_set_fd_handler(exp->ctx, fd, true, NULL, NULL, NULL, NULL);
+            QLIST_REMOVE(w, next);
+            g_free(w);
+            return;
+        }
+    }
+}
+
+static void vu_blk_client_read(void *opaque)
+{
+    VuBlkExport *exp = opaque;
+
+    aio_context_acquire(exp->ctx);
+    if (!vu_dispatch(&exp->vu_dev)) {
+        vu_blk_disconnect(exp);
+    }
+    aio_context_release(exp->ctx);
+}
+
+static void vu_blk_accept(QIONetListener *listener, QIOChannelSocket *sioc,
+                          gpointer opaque)
+{
+    VuBlkExport *exp = opaque;
+    Error *local_err = NULL;
+
+    /* libvhost-user reads vhost-user messages synchronously */
+    if (qio_channel_set_blocking(QIO_CHANNEL(sioc), true, &local_err) < 0) {
+        error_report_err(local_err);
+        return;
+    }
+
+    object_ref(OBJECT(sioc));
+    exp->sioc = sioc;
+    vu_blk_update_listener(exp);
+
+    aio_context_acquire(exp->ctx);
+    if (!vu_init(&exp->vu_dev, VU_BLK_MAX_QUEUES, sioc->fd, vu_blk_panic_cb,
+                 vu_blk_set_watch, vu_blk_remove_watch, &vu_blk_iface)) {
+        aio_context_release(exp->ctx);
+        error_report("vhost-user-blk export '%s': failed to initialize "
+                     "libvhost-user", exp->path);
+        object_unref(OBJECT(sioc));
+        exp->sioc = NULL;
+        vu_blk_update_listener(exp);
+        return;
+    }
+    aio_set_fd_handler(exp->ctx, sioc->fd, true, vu_blk_client_read, NULL,
+                       NULL, exp);
+    aio_context_release(exp->ctx);
+}
+
+/* Only accept a new master while none is connected */
+static void vu_blk_update_listener(VuBlkExport *exp)
+{
+    if (!exp->listener) {
+        return;
+    }
+    if (!exp->closing && !exp->sioc) {
+        qio_net_listener_set_client_func(exp->listener, vu_blk_accept, exp,
+                                         NULL);
+    } else {
+        qio_net_listener_set_client_func(exp->listener, NULL, NULL, NULL);
+    }
+}
+
+static void vu_blk_initialize_config(VuBlkExport *exp, int64_t length)
+{
+    struct virtio_blk_config *config = &exp->blkcfg;
+
+    config->capacity = cpu_to_le64(length >> BDRV_SECTOR_BITS);
+    config->blk_size = cpu_to_le32(BDRV_SECTOR_SIZE);
+    config->seg_max = cpu_to_le32(VU_BLK_SEG_MAX);
+    config->min_io_size = cpu_to_le16(1);
+    config->opt_io_size = cpu_to_le32(1);
+    config->num_queues = cpu_to_le16(VU_BLK_MAX_QUEUES);
+    config->max_discard_sectors = cpu_to_le32(VU_BLK_MAX_DISCARD_SECTORS);
+    config->max_discard_seg = cpu_to_le32(1);
+    config->discard_sector_alignment = cpu_to_le32(1);
+    config->max_write_zeroes_sectors =
+        cpu_to_le32(VU_BLK_MAX_WRITE_ZEROES_SECTORS);
+    config->max_write_zeroes_seg = cpu_to_le32(1);
+    config->wce = blk_enable_write_cache(exp->blk);
+}
+
+VuBlkExport *vu_blk_export_new(BlockDriverState *bs, const char *path,
+                               bool writable, AioContext *ctx, Error **errp)
+{
+    VuBlkExport *exp;
+    SocketAddress addr = {
+        .type = SOCKET_ADDRESS_TYPE_UNIX,
+        .u.q_unix.path = (char *)path,
+    };
+    uint64_t perm = BLK_PERM_CONSISTENT_READ;
+    AioContext *old_ctx;
+    int64_t length;
+    int ret;
+
+    if (writable) {
+        perm |= BLK_PERM_WRITE;
+    }
+
+    exp = g_new0(VuBlkExport, 1);
+    exp->path = g_strdup(path);
+    exp->writable = writable;
+    exp->ctx = ctx;
+    QLIST_INIT(&exp->watches);
+
+    old_ctx = bdrv_get_aio_context(bs);
+    aio_context_acquire(old_ctx);
+    ret = bdrv_try_set_aio_context(bs, ctx, errp);
+    aio_context_release(old_ctx);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    aio_context_acquire(ctx);
+    exp->blk = blk_new(ctx, perm, BLK_PERM_ALL);
+    ret = blk_insert_bs(exp->blk, bs, errp);
+    if (ret < 0) {
+        aio_context_release(ctx);
+        goto fail;
+    }
+    blk_set_enable_write_cache(exp->blk, true);
+
+    length = blk_getlength(exp->blk);
+    aio_context_release(ctx);
+    if (length < 0) {
+        error_setg_errno(errp, -length,
+                         "Failed to determine the image length");
+        goto fail;
+    }
+    vu_blk_initialize_config(exp, length);
+
+    exp->listener = qio_net_listener_new();
+    if (qio_net_listener_open_sync(exp->listener, &addr, 1, errp) < 0) {
+        goto fail;
+    }
+    vu_blk_update_listener(exp);
+
+    return exp;
+
+fail:
+    vu_blk_export_free(exp);
+    return NULL;
+}
+
+void vu_blk_export_free(VuBlkExport *exp)
+{
+    exp->closing = true;
+
+    if (exp->listener) {
+        qio_net_listener_disconnect(exp->listener);
+        object_unref(OBJECT(exp->listener));
+        exp->listener = NULL;
+        unlink(exp->path);
+    }
+
+    if (exp->sioc) {
+        aio_context_acquire(exp->ctx);
+        vu_blk_disconnect(exp);
+        AIO_WAIT_WHILE(exp->ctx, exp->sioc);
+        aio_context_release(exp->ctx);
+    }
+
+    if (exp->blk) {
+        aio_context_acquire(exp->ctx);
+        blk_unref(exp->blk);
+        aio_context_release(exp->ctx);
+    }
+
+    g_free(exp->path);
+    g_free(exp);
+}
@@ -0,0 +1,22 @@
+/*
+ * vhost-user-blk export for the QEMU storage daemon
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef VHOST_USER_BLK_SERVER_H
+#define VHOST_USER_BLK_SERVER_H
+
+typedef struct VuBlkExport VuBlkExport;
+
+/*
+ * Export @bs as a vhost-user-blk device on the UNIX domain socket @path.
+ * Requests are processed in @ctx, which becomes the AioContext of @bs.
+ * One vhost-user master can be connected at a time.
+ */
+VuBlkExport *vu_blk_export_new(BlockDriverState *bs, const char *path,
+                               bool writable, AioContext *ctx, Error **errp);
+void vu_blk_export_free(VuBlkExport *exp);
+
+#endif /* VHOST_USER_BLK_SERVER_H */
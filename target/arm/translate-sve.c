@@ -327,22 +327,87 @@ static bool trans_UQSUB_zzz(DisasContext *s, arg_rrr_esz *a)
     return do_vector3_z(s, tcg_gen_gvec_ussub, a->esz, a->rd, a->rn, a->rm);
 }
 
+/*
+ * Branch to LABEL unless every element of size ESZ is active in PG.
+ * Bits of PG that do not govern an element are ignored, as are the
+ * bits above pred_full_reg_size, which are known to be zero.
+ */
+static void gen_brcond_pred_not_all_true(DisasContext *s, int pg, int esz,
+                                         TCGLabel *label)
+{
+    int psz = pred_full_reg_size(s);
+    TCGv_i64 t = tcg_temp_new_i64();
+    TCGv_i64 acc = tcg_temp_new_i64();
+    int i;
+
+    for (i = 0; i < psz; i += 8) {
+        uint64_t mask = pred_esz_masks[esz];
+
+        if (psz - i < 8) {
+            mask &= MAKE_64BIT_MASK(0, (psz - i) * 8);
+        }
+        tcg_gen_ld_i64(t, cpu_env, pred_full_reg_offset(s, pg) + i);
+        tcg_gen_andi_i64(t, t, mask);
+        if (i == 0) {
+            tcg_gen_xori_i64(acc, t, mask);
+        } else {
+            tcg_gen_xori_i64(t, t, mask);
+            tcg_gen_or_i64(acc, acc, t);
+        }
+    }
+    tcg_gen_brcondi_i64(TCG_COND_NE, acc, 0, label);
+
+    tcg_temp_free_i64(acc);
+    tcg_temp_free_i64(t);
+}
+
 /*
  *** SVE Integer Arithmetic - Binary Predicated Group
  */
 
-static bool do_zpzz_ool(DisasContext *s, arg_rprr_esz *a, gen_helper_gvec_4 *fn)
+static void do_zpzz_ool_expand(DisasContext *s, arg_rprr_esz *a,
+                               gen_helper_gvec_4 *fn)
 {
     unsigned vsz = vec_full_reg_size(s);
+    tcg_gen_gvec_4_ool(vec_full_reg_offset(s, a->rd),
+                       vec_full_reg_offset(s, a->rn),
+                       vec_full_reg_offset(s, a->rm),
+                       pred_full_reg_offset(s, a->pg),
+                       vsz, vsz, 0, fn);
+}
+
+static bool do_zpzz_ool(DisasContext *s, arg_rprr_esz *a, gen_helper_gvec_4 *fn)
+{
     if (fn == NULL) {
         return false;
     }
     if (sve_access_check(s)) {
-        tcg_gen_gvec_4_ool(vec_full_reg_offset(s, a->rd),
-                           vec_full_reg_offset(s, a->rn),
-                           vec_full_reg_offset(s, a->rm),
-                           pred_full_reg_offset(s, a->pg),
-                           vsz, vsz, 0, fn);
+        do_zpzz_ool_expand(s, a, fn);
+    }
+    return true;
+}
+
+/*
+ * As do_zpzz_ool, but expand inline with GVEC_FN when all of PG is true;
+ * with every element active, the merging operation is unpredicated.
+ */
+static bool do_zpzz_gvec(DisasContext *s, arg_rprr_esz *a,
+                         GVecGen3Fn *gvec_fn, gen_helper_gvec_4 *fn)
+{
+    if (sve_access_check(s)) {
+        unsigned vsz = vec_full_reg_size(s);
+        TCGLabel *partial = gen_new_label();
+        TCGLabel *done = gen_new_label();
+
+        gen_brcond_pred_not_all_true(s, a->pg, a->esz, partial);
+        gvec_fn(a->esz, vec_full_reg_offset(s, a->rd),
+                vec_full_reg_offset(s, a->rn),
+                vec_full_reg_offset(s, a->rm), vsz, vsz);
+        tcg_gen_br(done);
+
+        gen_set_label(partial);
+        do_zpzz_ool_expand(s, a, fn);
+        gen_set_label(done);
     }
     return true;
 }
@@ -374,22 +439,32 @@ static bool trans_##NAME##_zpzz(DisasContext *s, arg_rprr_esz *a)         \
     return do_zpzz_ool(s, a, fns[a->esz]);                                \
 }
 
-DO_ZPZZ(AND, and)
-DO_ZPZZ(EOR, eor)
-DO_ZPZZ(ORR, orr)
-DO_ZPZZ(BIC, bic)
+#define DO_ZPZZ_GVEC(NAME, name, gvec) \
+static bool trans_##NAME##_zpzz(DisasContext *s, arg_rprr_esz *a)         \
+{                                                                         \
+    static gen_helper_gvec_4 * const fns[4] = {                           \
+        gen_helper_sve_##name##_zpzz_b, gen_helper_sve_##name##_zpzz_h,   \
+        gen_helper_sve_##name##_zpzz_s, gen_helper_sve_##name##_zpzz_d,   \
+    };                                                                    \
+    return do_zpzz_gvec(s, a, gvec, fns[a->esz]);                         \
+}
+
+DO_ZPZZ_GVEC(AND, and, tcg_gen_gvec_and)
+DO_ZPZZ_GVEC(EOR, eor, tcg_gen_gvec_xor)
+DO_ZPZZ_GVEC(ORR, orr, tcg_gen_gvec_or)
+DO_ZPZZ_GVEC(BIC, bic, tcg_gen_gvec_andc)
 
-DO_ZPZZ(ADD, add)
-DO_ZPZZ(SUB, sub)
+DO_ZPZZ_GVEC(ADD, add, tcg_gen_gvec_add)
+DO_ZPZZ_GVEC(SUB, sub, tcg_gen_gvec_sub)
 
-DO_ZPZZ(SMAX, smax)
-DO_ZPZZ(UMAX, umax)
-DO_ZPZZ(SMIN, smin)
-DO_ZPZZ(UMIN, umin)
+DO_ZPZZ_GVEC(SMAX, smax, tcg_gen_gvec_smax)
+DO_ZPZZ_GVEC(UMAX, umax, tcg_gen_gvec_umax)
+DO_ZPZZ_GVEC(SMIN, smin, tcg_gen_gvec_smin)
+DO_ZPZZ_GVEC(UMIN, umin, tcg_gen_gvec_umin)
 DO_ZPZZ(SABD, sabd)
 DO_ZPZZ(UABD, uabd)
 
-DO_ZPZZ(MUL, mul)
+DO_ZPZZ_GVEC(MUL, mul, tcg_gen_gvec_mul)
 DO_ZPZZ(SMULH, smulh)
 DO_ZPZZ(UMULH, umulh)
 
@@ -416,28 +491,67 @@ static bool trans_UDIV_zpzz(DisasContext *s, arg_rprr_esz *a)
 static bool trans_SEL_zpzz(DisasContext *s, arg_rprr_esz *a)
 {
     if (sve_access_check(s)) {
+        unsigned vsz = vec_full_reg_size(s);
+        TCGLabel *partial = gen_new_label();
+        TCGLabel *done = gen_new_label();
+
+        gen_brcond_pred_not_all_true(s, a->pg, a->esz, partial);
+        tcg_gen_gvec_mov(MO_64, vec_full_reg_offset(s, a->rd),
+                         vec_full_reg_offset(s, a->rn), vsz, vsz);
+        tcg_gen_br(done);
+
+        gen_set_label(partial);
         do_sel_z(s, a->rd, a->rn, a->rm, a->pg, a->esz);
+        gen_set_label(done);
     }
     return true;
 }
 
 #undef DO_ZPZZ
+#undef DO_ZPZZ_GVEC
 
 /*
  *** SVE Integer Arithmetic - Unary Predicated Group
  */
 
+static void do_zpz_ool_expand(DisasContext *s, arg_rpr_esz *a,
+                              gen_helper_gvec_3 *fn)
+{
+    unsigned vsz = vec_full_reg_size(s);
+    tcg_gen_gvec_3_ool(vec_full_reg_offset(s, a->rd),
+                       vec_full_reg_offset(s, a->rn),
+                       pred_full_reg_offset(s, a->pg),
+                       vsz, vsz, 0, fn);
+}
+
 static bool do_zpz_ool(DisasContext *s, arg_rpr_esz *a, gen_helper_gvec_3 *fn)
 {
     if (fn == NULL) {
         return false;
     }
+    if (sve_access_check(s)) {
+        do_zpz_ool_expand(s, a, fn);
+    }
+    return true;
+}
+
+/* As do_zpz_ool, but expand inline with GVEC_FN when all of PG is true.  */
+static bool do_zpz_gvec(DisasContext *s, arg_rpr_esz *a,
+                        GVecGen2Fn *gvec_fn, gen_helper_gvec_3 *fn)
+{
     if (sve_access_check(s)) {
         unsigned vsz = vec_full_reg_size(s);
-        tcg_gen_gvec_3_ool(vec_full_reg_offset(s, a->rd),
-                           vec_full_reg_offset(s, a->rn),
-                           pred_full_reg_offset(s, a->pg),
-                           vsz, vsz, 0, fn);
+        TCGLabel *partial = gen_new_label();
+        TCGLabel *done = gen_new_label();
+
+        gen_brcond_pred_not_all_true(s, a->pg, a->esz, partial);
+        gvec_fn(a->esz, vec_full_reg_offset(s, a->rd),
+                vec_full_reg_offset(s, a->rn), vsz, vsz);
+        tcg_gen_br(done);
+
+        gen_set_label(partial);
+        do_zpz_ool_expand(s, a, fn);
+        gen_set_label(done);
     }
     return true;
 }
@@ -452,13 +566,25 @@ static bool trans_##NAME(DisasContext *s, arg_rpr_esz *a)           \
     return do_zpz_ool(s, a, fns[a->esz]);                           \
 }
 
+#define DO_ZPZ_GVEC(NAME, name, gvec) \
+static bool trans_##NAME(DisasContext *s, arg_rpr_esz *a)           \
+{                                                                   \
+    static gen_helper_gvec_3 * const fns[4] = {                     \
+        gen_helper_sve_##name##_b, gen_helper_sve_##name##_h,       \
+        gen_helper_sve_##name##_s, gen_helper_sve_##name##_d,       \
+    };                                                              \
+    return do_zpz_gvec(s, a, gvec, fns[a->esz]);                    \
+}
+
 DO_ZPZ(CLS, cls)
 DO_ZPZ(CLZ, clz)
 DO_ZPZ(CNT_zpz, cnt_zpz)
 DO_ZPZ(CNOT, cnot)
-DO_ZPZ(NOT_zpz, not_zpz)
-DO_ZPZ(ABS, abs)
-DO_ZPZ(NEG, neg)
+DO_ZPZ_GVEC(NOT_zpz, not_zpz, tcg_gen_gvec_not)
+DO_ZPZ_GVEC(ABS, abs, tcg_gen_gvec_abs)
+DO_ZPZ_GVEC(NEG, neg, tcg_gen_gvec_neg)
+
+#undef DO_ZPZ_GVEC
 
 static bool trans_FABS(DisasContext *s, arg_rpr_esz *a)
 {
@@ -25,6 +25,9 @@
 #include "exec/exec-all.h"
 #include "exec/cpu_ldst.h"
 #include "exec/log.h"
+#ifdef CONFIG_USER_ONLY
+#include "qemu.h"
+#endif
 
 //#define DEBUG_PCALL
 
@@ -973,6 +976,17 @@ static void do_interrupt64(CPUX86State *env, int intno, int is_int,
 void helper_syscall(CPUX86State *env, int next_eip_addend)
 {
     CPUState *cs = env_cpu(env);
+    abi_long ret;
+
+    if (do_syscall_fast(env, env->regs[R_EAX], env->regs[R_EDI],
+                        env->regs[R_ESI], &ret)) {
+        /* on a restart, leave eip on the syscall insn, as cpu_loop does */
+        if (ret != -TARGET_ERESTARTSYS) {
+            env->regs[R_EAX] = ret;
+            env->eip += next_eip_addend;
+        }
+        return;
+    }
 
     cs->exception_index = EXCP_SYSCALL;
     env->exception_next_eip = env->eip + next_eip_addend;
@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -2648,6 +2649,26 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/*
+ * Unconditional direct jump.  A jump forward within the page of the TB
+ * does not end it: translation goes on at the target, so that blocks
+ * linked by such jumps are translated and optimized as one superblock.
+ * Only following forward jumps keeps the code of the TB within
+ * [pc_first, pc_next), which is what page tracking relies on.
+ */
+static void gen_jmp_follow(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if (s->jmp_opt && pc >= s->pc &&
+        (pc & TARGET_PAGE_MASK) == (s->base.pc_first & TARGET_PAGE_MASK) &&
+        !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        s->pc = pc;
+        return;
+    }
+    gen_jmp(s, eip);
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
@@ -2716,6 +2737,8 @@ typedef void (*SSEFunc_0_eppi)(TCGv_ptr env, TCGv_ptr reg_a, TCGv_ptr reg_b,
 typedef void (*SSEFunc_0_ppi)(TCGv_ptr reg_a, TCGv_ptr reg_b, TCGv_i32 val);
 typedef void (*SSEFunc_0_eppt)(TCGv_ptr env, TCGv_ptr reg_a, TCGv_ptr reg_b,
                                TCGv val);
+typedef void (*SSEGVecFunc3)(unsigned vece, uint32_t dofs, uint32_t aofs,
+                             uint32_t bofs, uint32_t oprsz, uint32_t maxsz);
 
 #define SSE_SPECIAL ((void *)1)
 #define SSE_DUMMY ((void *)2)
@@ -3036,6 +3059,102 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/*
+ * Expand the MMX/SSE integer and logical operations that map directly
+ * onto a gvec operation, working on the register file in env.  SIZE is
+ * 8 for MMX and 16 for XMM registers; the upper part of an XMM register
+ * is not touched, as for the legacy SSE encodings.  Return false if the
+ * helper in sse_op_table1 must be used instead.
+ */
+static bool gen_sse_gvec(int b, int op1_offset, int op2_offset, int size)
+{
+    SSEGVecFunc3 fn;
+    unsigned vece = MO_8;
+    TCGCond cond;
+
+    switch (b) {
+    case 0xfc ... 0xfe: /* paddb, paddw, paddd */
+        fn = tcg_gen_gvec_add;
+        vece = b - 0xfc;
+        break;
+    case 0xd4: /* paddq */
+        fn = tcg_gen_gvec_add;
+        vece = MO_64;
+        break;
+    case 0xf8 ... 0xfb: /* psubb, psubw, psubd, psubq */
+        fn = tcg_gen_gvec_sub;
+        vece = b - 0xf8;
+        break;
+    case 0xec ... 0xed: /* paddsb, paddsw */
+        fn = tcg_gen_gvec_ssadd;
+        vece = b - 0xec;
+        break;
+    case 0xdc ... 0xdd: /* paddusb, paddusw */
+        fn = tcg_gen_gvec_usadd;
+        vece = b - 0xdc;
+        break;
+    case 0xe8 ... 0xe9: /* psubsb, psubsw */
+        fn = tcg_gen_gvec_sssub;
+        vece = b - 0xe8;
+        break;
+    case 0xd8 ... 0xd9: /* psubusb, psubusw */
+        fn = tcg_gen_gvec_ussub;
+        vece = b - 0xd8;
+        break;
+    case 0xd5: /* pmullw */
+        fn = tcg_gen_gvec_mul;
+        vece = MO_16;
+        break;
+    case 0xda: /* pminub */
+        fn = tcg_gen_gvec_umin;
+        break;
+    case 0xde: /* pmaxub */
+        fn = tcg_gen_gvec_umax;
+        break;
+    case 0xea: /* pminsw */
+        fn = tcg_gen_gvec_smin;
+        vece = MO_16;
+        break;
+    case 0xee: /* pmaxsw */
+        fn = tcg_gen_gvec_smax;
+        vece = MO_16;
+        break;
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        fn = tcg_gen_gvec_and;
+        break;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        fn = tcg_gen_gvec_or;
+        break;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        fn = tcg_gen_gvec_xor;
+        break;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        /* The destination is the inverted operand.  */
+        tcg_gen_gvec_andc(MO_64, op1_offset, op2_offset, op1_offset,
+                          size, size);
+        return true;
+    case 0x74 ... 0x76: /* pcmpeqb, pcmpeqw, pcmpeqd */
+        cond = TCG_COND_EQ;
+        vece = b - 0x74;
+        goto do_cmp;
+    case 0x64 ... 0x66: /* pcmpgtb, pcmpgtw, pcmpgtd */
+        cond = TCG_COND_GT;
+        vece = b - 0x64;
+    do_cmp:
+        tcg_gen_gvec_cmp(cond, vece, op1_offset, op1_offset, op2_offset,
+                         size, size);
+        return true;
+    default:
+        return false;
+    }
+    fn(vece, op1_offset, op1_offset, op2_offset, size, size);
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4470,6 +4589,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, s->ptr0, s->ptr1, s->A0);
             break;
         default:
+            if (gen_sse_gvec(b, op1_offset, op2_offset, is_xmm ? 16 : 8)) {
+                break;
+            }
             tcg_gen_addi_ptr(s->ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(s->ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, s->ptr0, s->ptr1);
@@ -6585,7 +6707,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
             gen_bnd_jmp(s);
-            gen_jmp(s, tval);
+            gen_jmp_follow(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6615,7 +6737,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        gen_jmp_follow(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6637,7 +6759,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_follow(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -2620,7 +2620,7 @@ int kvmppc_get_htab_fd(bool write, uint64_t index, Error **errp)
 int kvmppc_save_htab(QEMUFile *f, int fd, size_t bufsize, int64_t max_ns)
 {
     int64_t starttime = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-    uint8_t buf[bufsize];
+    uint8_t *buf = g_malloc(bufsize);
     ssize_t rc;
 
     do {
@@ -2628,6 +2628,7 @@ int kvmppc_save_htab(QEMUFile *f, int fd, size_t bufsize, int64_t max_ns)
         if (rc < 0) {
             fprintf(stderr, "Error reading data from KVM HTAB fd: %s\n",
                     strerror(errno));
+            g_free(buf);
             return rc;
         } else if (rc) {
             uint8_t *buffer = buf;
@@ -2652,6 +2653,7 @@ int kvmppc_save_htab(QEMUFile *f, int fd, size_t bufsize, int64_t max_ns)
              && ((max_ns < 0) ||
                  ((qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - starttime) < max_ns)));
 
+    g_free(buf);
     return (rc == 0) ? 1 : 0;
 }
 
@@ -594,6 +594,246 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
+/*
+ * Fields of env accessed with plain ld/st ops are tracked within an
+ * extended basic block, for store-to-load forwarding, removal of
+ * redundant loads and removal of stores that are overwritten before
+ * anything can read them.
+ */
+#define MAX_ENV_INFO 16
+
+struct env_info {
+    intptr_t ofs;
+    unsigned size;
+    TCGTemp *val;   /* temp known to hold the field's value, or NULL */
+    TCGOp *store;   /* last store to the field if not read since, or NULL */
+};
+
+struct env_state {
+    TCGTemp *env;
+    bool dse;       /* whether dead store elimination is possible */
+    int n;
+    struct env_info info[MAX_ENV_INFO];
+};
+
+/* Return the number of bytes accessed by a ld/st op, or 0 */
+static unsigned env_access_size(TCGOp *op, bool *is_store)
+{
+    *is_store = false;
+    switch (op->opc) {
+    case INDEX_op_st8_i32:
+    case INDEX_op_st8_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+        return 1;
+    case INDEX_op_st16_i32:
+    case INDEX_op_st16_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+        return 2;
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+        return 4;
+    case INDEX_op_st_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld_i64:
+        return 8;
+    case INDEX_op_st_vec:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld_vec:
+    case INDEX_op_dupm_vec:
+        return 8 << TCGOP_VECL(op);
+    default:
+        return 0;
+    }
+}
+
+static void env_forget(struct env_state *es, int i)
+{
+    es->info[i] = es->info[--es->n];
+}
+
+/*
+ * Called at the end of a basic block. Anything may read env from here on,
+ * so no store can be removed anymore. If the block ends with a conditional
+ * branch, values held in globals and local temps are still valid on the
+ * fall-through path.
+ */
+static void env_reset(struct env_state *es, bool keep_ebb)
+{
+    int i;
+
+    if (!keep_ebb) {
+        es->n = 0;
+        return;
+    }
+    for (i = es->n - 1; i >= 0; i--) {
+        struct env_info *e = &es->info[i];
+
+        e->store = NULL;
+        if (!e->val || !(e->val->temp_global || e->val->temp_local)) {
+            env_forget(es, i);
+        }
+    }
+}
+
+/* @ts is about to be overwritten */
+static void env_temp_written(struct env_state *es, TCGTemp *ts)
+{
+    int i;
+
+    for (i = es->n - 1; i >= 0; i--) {
+        struct env_info *e = &es->info[i];
+
+        if (e->val == ts) {
+            e->val = NULL;
+            if (!e->store) {
+                env_forget(es, i);
+            }
+        }
+    }
+}
+
+/* Whether a global lives in env at [ofs, ofs + size) */
+static bool env_aliases_global(TCGContext *s, struct env_state *es,
+                               intptr_t ofs, unsigned size)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+        intptr_t gsize = ts->type == TCG_TYPE_I64 ? 8 : 4;
+
+        if (ts->mem_base == es->env &&
+            ts->mem_offset < ofs + size && ofs < ts->mem_offset + gsize) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Track ld/st of env fields. Must be called after env_temp_written() for
+ * the outputs of @op.
+ * Returns a temp that already holds the value loaded by @op, or NULL.
+ */
+static TCGTemp *env_optimize_access(TCGContext *s, struct env_state *es,
+                                    TCGOp *op)
+{
+    bool is_store;
+    unsigned size = env_access_size(op, &is_store);
+    TCGTemp *base, *val;
+    intptr_t ofs;
+    int i;
+
+    if (size == 0) {
+        return NULL;
+    }
+    val = arg_temp(op->args[0]);
+    base = arg_temp(op->args[1]);
+    ofs = op->args[2];
+
+    if (base != es->env || ofs < 0) {
+        /*
+         * Accesses through other pointers might alias env, and negative
+         * offsets reach CPUState fields that other threads write.
+         */
+        for (i = es->n - 1; i >= 0; i--) {
+            es->info[i].store = NULL;
+            if (is_store) {
+                env_forget(es, i);
+            }
+        }
+        return NULL;
+    }
+
+    if (!is_store) {
+        for (i = 0; i < es->n; i++) {
+            struct env_info *e = &es->info[i];
+
+            if (e->ofs < ofs + size && ofs < e->ofs + e->size) {
+                e->store = NULL;
+            }
+        }
+        if (op->opc == INDEX_op_ld_i32 || op->opc == INDEX_op_ld_i64) {
+            for (i = 0; i < es->n; i++) {
+                struct env_info *e = &es->info[i];
+
+                if (e->ofs == ofs && e->size == size && e->val &&
+                    e->val->type == val->type) {
+                    return e->val;
+                }
+            }
+        }
+        if ((op->opc == INDEX_op_ld_i32 || op->opc == INDEX_op_ld_i64) &&
+            es->n < MAX_ENV_INFO) {
+            es->info[es->n++] = (struct env_info) {
+                .ofs = ofs, .size = size, .val = val,
+            };
+        }
+        return NULL;
+    }
+
+    for (i = es->n - 1; i >= 0; i--) {
+        struct env_info *e = &es->info[i];
+
+        if (e->ofs == ofs && e->size == size && e->store) {
+            /* overwritten before anybody could read it */
+            tcg_op_remove(s, e->store);
+            env_forget(es, i);
+        } else if (e->ofs < ofs + size && ofs < e->ofs + e->size) {
+            env_forget(es, i);
+        }
+    }
+    if (es->n < MAX_ENV_INFO) {
+        bool whole = op->opc == INDEX_op_st_i32 || op->opc == INDEX_op_st_i64;
+
+        es->info[es->n++] = (struct env_info) {
+            .ofs = ofs, .size = size,
+            .val = whole ? val : NULL,
+            .store = es->dse && !env_aliases_global(s, es, ofs, size)
+                     ? op : NULL,
+        };
+    }
+    return NULL;
+}
+
+/*
+ * At a conditional branch only the knowledge about globals and local
+ * temps survives: the fall-through path has a single predecessor, but
+ * normal temps are dead at the end of any basic block.
+ */
+static void reset_ebb_temps(TCGContext *s, TCGTempSet *temps_used,
+                            int nb_temps)
+{
+    int i;
+
+    for (i = find_first_bit(temps_used->l, nb_temps); i < nb_temps;
+         i = find_next_bit(temps_used->l, nb_temps, i + 1)) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (!ts->temp_global && !ts->temp_local) {
+            reset_ts(ts);
+            clear_bit(i, temps_used->l);
+        }
+    }
+}
+
 /* Propagate constants and copies, fold constant expressions. */
 void tcg_optimize(TCGContext *s)
 {
@@ -601,6 +841,11 @@ void tcg_optimize(TCGContext *s)
     TCGOp *op, *op_next, *prev_mb = NULL;
     struct tcg_temp_info *infos;
     TCGTempSet temps_used;
+    struct env_state es = {
+        .env = tcgv_ptr_temp(cpu_env),
+        /* indirect globals read env through other pointers */
+        .dse = s->nb_indirects == 0,
+    };
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -646,6 +891,30 @@ void tcg_optimize(TCGContext *s)
             }
         }
 
+        /* Forward and eliminate accesses to env */
+        for (i = 0; i < nb_oargs; i++) {
+            TCGTemp *ts = arg_temp(op->args[i]);
+            if (ts) {
+                env_temp_written(&es, ts);
+            }
+        }
+        if (opc == INDEX_op_call || (def->flags & TCG_OPF_SIDE_EFFECTS)) {
+            /* helpers, guest memory accesses and exits may look at env */
+            env_reset(&es, false);
+        } else if (def->flags & TCG_OPF_BB_END) {
+            env_reset(&es, opc == INDEX_op_brcond_i32 ||
+                           opc == INDEX_op_brcond_i64 ||
+                           opc == INDEX_op_brcond2_i32);
+        } else {
+            TCGTemp *src = env_optimize_access(s, &es, op);
+
+            if (src) {
+                init_ts_info(infos, &temps_used, src);
+                tcg_opt_gen_mov(s, op, op->args[0], temp_arg(src));
+                continue;
+            }
+        }
+
         /* For commutative operations make constant second argument */
         switch (opc) {
         CASE_OP_32_64_VEC(add):
@@ -1478,7 +1747,34 @@ void tcg_optimize(TCGContext *s)
                We trash everything if the operation is the end of a basic
                block, otherwise we only trash the output args.  "mask" is
                the non-zero bits mask for the first output arg.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (opc == INDEX_op_brcond_i32 || opc == INDEX_op_brcond_i64 ||
+                opc == INDEX_op_brcond2_i32) {
+                /* not taken, so the first operand equals the second */
+                bool learn = opc != INDEX_op_brcond2_i32 &&
+                             op->args[2] == TCG_COND_NE &&
+                             arg_is_const(op->args[1]);
+                tcg_target_ulong val = learn ? arg_info(op->args[1])->val : 0;
+
+                /* the fall-through path extends the basic block */
+                reset_ebb_temps(s, &temps_used, nb_temps);
+                if (learn) {
+                    TCGTemp *ts = arg_temp(op->args[0]);
+
+                    if (ts->temp_global || ts->temp_local) {
+                        struct tcg_temp_info *ti = ts_info(ts);
+
+                        reset_ts(ts);
+                        ti->is_const = true;
+                        ti->val = val;
+                        ti->mask = val;
+                        if (TCG_TARGET_REG_BITS > 32 &&
+                            opc == INDEX_op_brcond_i32) {
+                            /* High bits are not compared.  */
+                            ti->mask |= ~0xffffffffull;
+                        }
+                    }
+                }
+            } else if (def->flags & TCG_OPF_BB_END) {
                 bitmap_zero(temps_used.l, nb_temps);
             } else {
         do_reset_output:
@@ -2706,8 +2706,11 @@ void tcg_gen_lookup_and_goto_ptr(void)
 {
     if (TCG_TARGET_HAS_goto_ptr && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
         TCGv_ptr ptr = tcg_temp_new_ptr();
-        gen_helper_lookup_tb_ptr(ptr, cpu_env);
+        TCGv_ptr last = tcg_const_ptr(tcg_ctx->gen_tb);
+
+        gen_helper_lookup_tb_ptr(ptr, cpu_env, last);
         tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+        tcg_temp_free_ptr(last);
         tcg_temp_free_ptr(ptr);
     } else {
         tcg_gen_exit_tb(NULL, 0);
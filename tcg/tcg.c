@@ -187,6 +187,10 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t alloc_seq; /* number of region allocations so far */
+    uint64_t *seq; /* per region: alloc_seq when it was last handed out */
+    size_t *free; /* evicted regions, ready to be handed out again */
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
@@ -549,11 +553,17 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_free) {
+        curr_region = region.free[--region.n_free];
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.seq[curr_region] = ++region.alloc_seq;
     return false;
 }
 
@@ -594,6 +604,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.alloc_seq = 0;
+    region.n_free = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = atomic_read(&tcg_ctxs[i]);
@@ -606,6 +618,84 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return FALSE;
+}
+
+/*
+ * Reclaim the region that was handed out the longest time ago and that no
+ * context is translating into, so that translation can go on without
+ * flushing the whole code cache. @invalidate is called on each of the
+ * region's TBs before the region is made available again.
+ *
+ * Call from a safe-work context.
+ * Returns false if there is no region that can be evicted.
+ */
+bool tcg_region_evict_oldest(void (*invalidate)(TranslationBlock *tb))
+{
+    unsigned int n_ctxs = atomic_read(&n_tcg_ctxs);
+    struct tcg_region_tree *rt;
+    size_t oldest = region.n;
+    void *start, *end;
+    GPtrArray *tbs;
+    unsigned int j;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.current < region.n || region.n_free) {
+        /* a flush or an earlier eviction already made room */
+        qemu_mutex_unlock(&region.lock);
+        return true;
+    }
+    for (i = 0; i < region.n; i++) {
+        bool in_use = false;
+
+        tcg_region_bounds(i, &start, &end);
+        for (j = 0; j < n_ctxs; j++) {
+            if (atomic_read(&tcg_ctxs[j])->code_gen_buffer == start) {
+                in_use = true;
+                break;
+            }
+        }
+        if (!in_use &&
+            (oldest == region.n || region.seq[i] < region.seq[oldest])) {
+            oldest = i;
+        }
+    }
+    if (oldest == region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    tcg_region_bounds(oldest, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + oldest * tree_size;
+    tbs = g_ptr_array_new();
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (i = 0; i < tbs->len; i++) {
+        invalidate(g_ptr_array_index(tbs, i));
+    }
+    g_ptr_array_free(tbs, TRUE);
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    qemu_mutex_lock(&region.lock);
+    region.free[region.n_free++] = oldest;
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
@@ -622,29 +712,37 @@ static size_t tcg_n_regions(void)
 {
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
 #if !defined(CONFIG_USER_ONLY)
     MachineState *ms = MACHINE(qdev_get_machine());
     unsigned int max_cpus = ms->smp.max_cpus;
 #endif
+    unsigned int n_threads = max_cpus;
+
+    /*
+     * A single vCPU thread still gets several regions, so that a full code
+     * cache can be recycled one region at a time instead of being flushed.
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        n_threads = 1;
     }
 
-    /* Try to have more regions than max_cpus, with each region being >= 2 MB */
+    /*
+     * Try to have more regions than vCPU threads, with each region
+     * being >= 2 MB
+     */
     for (i = 8; i > 0; i--) {
         size_t regions_per_thread = i;
         size_t region_size;
 
         region_size = tcg_init_ctx.code_gen_buffer_size;
-        region_size /= max_cpus * regions_per_thread;
+        region_size /= n_threads * regions_per_thread;
 
         if (region_size >= 2 * 1024u * 1024) {
-            return max_cpus * regions_per_thread;
+            return n_threads * regions_per_thread;
         }
     }
     /* If we can't, then just allocate one region per vCPU thread */
-    return max_cpus;
+    return n_threads;
 }
 #endif
 
@@ -713,6 +811,8 @@ void tcg_region_init(void)
     region.end = QEMU_ALIGN_PTR_DOWN(buf + size, page_size);
     /* account for that last guard page */
     region.end -= page_size;
+    region.seq = g_new0(uint64_t, region.n);
+    region.free = g_new(size_t, region.n);
 
     /* set guard pages */
     for (i = 0; i < region.n; i++) {
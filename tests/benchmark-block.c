@@ -0,0 +1,286 @@
+/*
+ * Block layer I/O path benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/resource.h>
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "iothread.h"
+
+#define BENCH_TIME_NS       (2 * NANOSECONDS_PER_SECOND)
+#define BENCH_REQ_SIZE      (4 * KiB)
+#define BENCH_IMG_SIZE      (64 * MiB)
+#define BENCH_NULL_SIZE     "1G"
+
+typedef struct BenchConfig {
+    const char *name;
+    const char *format;         /* NULL to use the protocol driver directly */
+    const char *protocol;       /* null-co, null-aio or file */
+    bool cold_cache;            /* qcow2 with an L2 cache of two slices */
+    bool throttle;              /* throttling with an unreachable limit */
+    bool iothread;
+} BenchConfig;
+
+static const BenchConfig bench_configs[] = {
+    { "null-co", .protocol = "null-co" },
+    { "null-aio", .protocol = "null-aio" },
+    { "raw-null-co", .format = "raw", .protocol = "null-co" },
+    { "raw-file", .format = "raw", .protocol = "file" },
+    { "qcow2-warm", .format = "qcow2", .protocol = "file" },
+    { "qcow2-cold", .format = "qcow2", .protocol = "file",
+      .cold_cache = true },
+    { "throttle-null-co", .protocol = "null-co", .throttle = true },
+    { "throttle-qcow2", .format = "qcow2", .protocol = "file",
+      .throttle = true },
+    { "iothread-null-aio", .protocol = "null-aio", .iothread = true },
+    { "iothread-qcow2", .format = "qcow2", .protocol = "file",
+      .iothread = true },
+};
+
+typedef struct BenchTest {
+    const BenchConfig *cfg;
+    unsigned depth;
+} BenchTest;
+
+typedef struct BenchState {
+    BlockBackend *blk;
+    int64_t size;
+    int64_t deadline;
+    unsigned active;
+
+    /* updated by the workers, which all run in the AioContext of blk */
+    uint64_t requests;
+    int64_t total_lat;
+    int64_t max_lat;
+    int ret;
+} BenchState;
+
+static char *raw_path;
+static char *qcow2_path;
+
+static BlockBackend *bench_open(const BenchConfig *cfg, int flags)
+{
+    QDict *opts = qdict_new();
+    const char *prefix = cfg->format ? "file." : "";
+    char *key;
+
+    if (cfg->format) {
+        qdict_put_str(opts, "driver", cfg->format);
+    }
+    key = g_strdup_printf("%sdriver", prefix);
+    qdict_put_str(opts, key, cfg->protocol);
+    g_free(key);
+
+    if (!strcmp(cfg->protocol, "file")) {
+        key = g_strdup_printf("%sfilename", prefix);
+        qdict_put_str(opts, key, strcmp(cfg->format, "qcow2") ? raw_path
+                                                               : qcow2_path);
+    } else {
+        key = g_strdup_printf("%ssize", prefix);
+        qdict_put_str(opts, key, BENCH_NULL_SIZE);
+    }
+    g_free(key);
+
+    if (cfg->cold_cache) {
+        qdict_put_str(opts, "l2-cache-entry-size", "512");
+        qdict_put_str(opts, "l2-cache-size", "1024");
+    }
+
+    return blk_new_open(NULL, NULL, opts, flags, &error_abort);
+}
+
+/* read the whole image once, so that the caches start out warm */
+static void bench_prime(BlockBackend *blk, int64_t size)
+{
+    uint8_t *buf = blk_blockalign(blk, MiB);
+    int64_t offset;
+
+    for (offset = 0; offset < size; offset += MiB) {
+        g_assert(blk_pread(blk, offset, buf, MIN(MiB, size - offset)) >= 0);
+    }
+    qemu_vfree(buf);
+}
+
+static void coroutine_fn bench_worker(void *opaque)
+{
+    BenchState *b = opaque;
+    uint8_t *buf = blk_blockalign(b->blk, BENCH_REQ_SIZE);
+    uint64_t nr_reqs = b->size / BENCH_REQ_SIZE;
+    uint32_t seed = (uintptr_t)qemu_coroutine_self();
+    QEMUIOVector qiov;
+
+    qemu_iovec_init_buf(&qiov, buf, BENCH_REQ_SIZE);
+
+    while (!b->ret && get_clock() < b->deadline) {
+        int64_t offset, start, lat;
+        int ret;
+
+        seed = seed * 1103515245 + 12345;
+        offset = (seed % nr_reqs) * BENCH_REQ_SIZE;
+
+        start = get_clock();
+        ret = blk_co_preadv(b->blk, offset, BENCH_REQ_SIZE, &qiov, 0);
+        lat = get_clock() - start;
+
+        if (ret < 0) {
+            b->ret = ret;
+            break;
+        }
+        b->requests++;
+        b->total_lat += lat;
+        b->max_lat = MAX(b->max_lat, lat);
+    }
+
+    qemu_vfree(buf);
+    atomic_dec(&b->active);
+    aio_wait_kick();
+}
+
+static int64_t cpu_time_ns(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * NANOSECONDS_PER_SECOND +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+static void test_bench(const void *opaque)
+{
+    const BenchTest *t = opaque;
+    const BenchConfig *cfg = t->cfg;
+    IOThread *iothread = NULL;
+    AioContext *ctx = qemu_get_aio_context();
+    BenchState b = { 0 };
+    int64_t start, elapsed, cpu;
+    unsigned i;
+
+    b.blk = bench_open(cfg, 0);
+    b.size = blk_getlength(b.blk);
+    g_assert(b.size > 0);
+
+    if (cfg->throttle) {
+        ThrottleConfig tcfg;
+
+        throttle_config_init(&tcfg);
+        tcfg.buckets[THROTTLE_OPS_TOTAL].avg = 100000000;
+        blk_io_limits_enable(b.blk, "bench");
+        blk_set_io_limits(b.blk, &tcfg);
+    }
+    if (!cfg->cold_cache) {
+        bench_prime(b.blk, b.size);
+    }
+    if (cfg->iothread) {
+        iothread = iothread_new();
+        ctx = iothread_get_aio_context(iothread);
+        blk_set_aio_context(b.blk, ctx, &error_abort);
+    }
+
+    aio_context_acquire(ctx);
+    b.active = t->depth;
+    cpu = cpu_time_ns();
+    start = get_clock();
+    b.deadline = start + BENCH_TIME_NS;
+    for (i = 0; i < t->depth; i++) {
+        aio_co_enter(ctx, qemu_coroutine_create(bench_worker, &b));
+    }
+    AIO_WAIT_WHILE(ctx, atomic_read(&b.active) > 0);
+    elapsed = get_clock() - start;
+    cpu = cpu_time_ns() - cpu;
+
+    if (iothread) {
+        blk_set_aio_context(b.blk, qemu_get_aio_context(), &error_abort);
+    }
+    aio_context_release(ctx);
+
+    g_assert_cmpint(b.ret, ==, 0);
+    g_assert(b.requests > 0);
+    g_print("%s qd %u: %.0f IOPS, latency avg %.2f us max %.2f us, "
+            "CPU %.2f us/request\n",
+            cfg->name, t->depth,
+            b.requests * (double)NANOSECONDS_PER_SECOND / elapsed,
+            b.total_lat / 1000.0 / b.requests, b.max_lat / 1000.0,
+            cpu / 1000.0 / b.requests);
+
+    if (cfg->throttle) {
+        blk_io_limits_disable(b.blk);
+    }
+    blk_unref(b.blk);
+    if (iothread) {
+        iothread_join(iothread);
+    }
+}
+
+static void bench_create_image(const char *path, const char *format)
+{
+    BenchConfig cfg = { .format = format, .protocol = "file" };
+    BlockBackend *blk;
+    uint8_t *buf;
+    int64_t offset;
+
+    bdrv_img_create(path, format, NULL, NULL, NULL, BENCH_IMG_SIZE, 0, true,
+                    &error_abort);
+
+    /* allocate every cluster, so that reads go through the L2 tables */
+    blk = bench_open(&cfg, BDRV_O_RDWR);
+    buf = blk_blockalign(blk, MiB);
+    memset(buf, 0xa5, MiB);
+    for (offset = 0; offset < BENCH_IMG_SIZE; offset += MiB) {
+        g_assert(blk_pwrite(blk, offset, buf, MiB, 0) >= 0);
+    }
+    qemu_vfree(buf);
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned depths[] = { 1, 16 };
+    const char *dir;
+    size_t i, j;
+    int ret;
+
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* use tmpfs if available, to keep host storage out of the numbers */
+    dir = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : g_get_tmp_dir();
+    raw_path = g_strdup_printf("%s/qemu-benchmark-block-%d.raw", dir,
+                               getpid());
+    qcow2_path = g_strdup_printf("%s/qemu-benchmark-block-%d.qcow2", dir,
+                                 getpid());
+    bench_create_image(raw_path, "raw");
+    bench_create_image(qcow2_path, "qcow2");
+
+    for (i = 0; i < ARRAY_SIZE(bench_configs); i++) {
+        for (j = 0; j < ARRAY_SIZE(depths); j++) {
+            BenchTest *t = g_new(BenchTest, 1);
+            char *name;
+
+            t->cfg = &bench_configs[i];
+            t->depth = depths[j];
+            name = g_strdup_printf("/block/bench/%s/qd%u", t->cfg->name,
+                                   t->depth);
+            g_test_add_data_func_full(name, t, test_bench, g_free);
+            g_free(name);
+        }
+    }
+
+    ret = g_test_run();
+
+    unlink(raw_path);
+    unlink(qcow2_path);
+    g_free(raw_path);
+    g_free(qcow2_path);
+    return ret;
+}
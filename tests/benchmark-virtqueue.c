@@ -0,0 +1,266 @@
+/*
+ * Virtqueue processing benchmark
+ *
+ * Fills a split ring with synthetic virtio-blk requests through qtest and
+ * measures how long the device model takes to pop, complete and push them.
+ * The backend is a null-co drive, so that the numbers are dominated by the
+ * virtqueue code rather than by the block layer.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest-single.h"
+#include "qemu/bswap.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "standard-headers/linux/virtio_blk.h"
+#include "libqos/qgraph.h"
+#include "libqos/virtio-blk.h"
+
+#define BENCH_TIME_NS       (NANOSECONDS_PER_SECOND / 2)
+#define BENCH_TIMEOUT_NS    (30 * NANOSECONDS_PER_SECOND)
+#define BENCH_BASELINE_RUNS 1000
+#define BENCH_SEG_SIZE      512
+
+typedef struct BenchConfig {
+    bool indirect;
+    bool event_idx;
+} BenchConfig;
+
+static const BenchConfig bench_direct = { .indirect = false };
+static const BenchConfig bench_indirect = { .indirect = true };
+static const BenchConfig bench_direct_event_idx = { .event_idx = true };
+static const BenchConfig bench_indirect_event_idx = {
+    .indirect = true, .event_idx = true,
+};
+
+typedef struct BenchState {
+    QVirtioDevice *dev;
+    QVirtQueue *vq;
+    uint64_t avail_ring;        /* guest address of avail->ring[0] */
+    uint16_t *heads;            /* one full ring of avail entries */
+    uint16_t avail_idx;
+} BenchState;
+
+/* the rings are in guest byte order, which need not match the host */
+static uint16_t bench_w(BenchState *b, uint16_t v)
+{
+    return qvirtio_is_big_endian(b->dev) ? cpu_to_be16(v) : cpu_to_le16(v);
+}
+
+static uint32_t bench_l(BenchState *b, uint32_t v)
+{
+    return qvirtio_is_big_endian(b->dev) ? cpu_to_be32(v) : cpu_to_le32(v);
+}
+
+static uint64_t bench_q(BenchState *b, uint64_t v)
+{
+    return qvirtio_is_big_endian(b->dev) ? cpu_to_be64(v) : cpu_to_le64(v);
+}
+
+static void bench_fill_desc(BenchState *b, struct vring_desc *desc,
+                            uint64_t addr, uint32_t len, uint16_t flags,
+                            uint16_t next)
+{
+    desc->addr = bench_q(b, addr);
+    desc->len = bench_l(b, len);
+    desc->flags = bench_w(b, flags);
+    desc->next = bench_w(b, next);
+}
+
+/*
+ * Build a read request of @len descriptors (header, data segments, status)
+ * at @desc.  All requests share the same buffers: with a null-co backend
+ * nothing is ever written to them, and the device does not care.
+ */
+static void bench_fill_chain(BenchState *b, struct vring_desc *desc,
+                             unsigned len, unsigned first, uint64_t req_addr)
+{
+    uint64_t data_addr = req_addr + 16;
+    uint64_t status_addr = data_addr + BENCH_SEG_SIZE;
+    unsigned i;
+
+    bench_fill_desc(b, &desc[0], req_addr, 16, VRING_DESC_F_NEXT, first + 1);
+    for (i = 1; i < len - 1; i++) {
+        bench_fill_desc(b, &desc[i], data_addr, BENCH_SEG_SIZE,
+                        VRING_DESC_F_NEXT | VRING_DESC_F_WRITE,
+                        first + i + 1);
+    }
+    bench_fill_desc(b, &desc[len - 1], status_addr, 1, VRING_DESC_F_WRITE, 0);
+}
+
+/*
+ * Make @count requests available starting at avail_idx, kick the queue
+ * and wait until the device has used all of them.  With @count == 0 the
+ * same qtest commands are issued, but the device finds no new work; this
+ * gives the fixed cost of a round trip that is subtracted from the
+ * measurements.
+ */
+static void bench_batch(BenchState *b, unsigned slots, unsigned count)
+{
+    QTestState *qts = global_qtest;
+    uint16_t start = b->avail_idx % b->vq->size;
+    uint16_t first = MIN(slots, b->vq->size - start);
+    uint16_t target = b->avail_idx + count;
+    int64_t deadline = get_clock() + BENCH_TIMEOUT_NS;
+
+    qtest_memwrite(qts, b->avail_ring + 2 * start, &b->heads[start],
+                   2 * first);
+    if (first < slots) {
+        qtest_memwrite(qts, b->avail_ring, b->heads, 2 * (slots - first));
+    }
+    if (b->vq->event) {
+        /* interrupt only for the last request of the batch */
+        qtest_writew(qts, b->avail_ring + 2 * b->vq->size, target - 1);
+    }
+    qtest_writew(qts, b->vq->avail + 2, target);
+    b->dev->bus->virtqueue_kick(b->dev, b->vq);
+
+    while (qtest_readw(qts, b->vq->used + 2) != target) {
+        g_assert(get_clock() < deadline);
+    }
+    b->avail_idx = target;
+}
+
+static void bench_chain(BenchState *b, QGuestAllocator *alloc,
+                        const BenchConfig *cfg, unsigned len)
+{
+    QTestState *qts = global_qtest;
+    unsigned size = b->vq->size;
+    unsigned batch = size / len;
+    struct vring_desc *desc = g_new0(struct vring_desc, MAX(size, len));
+    struct virtio_blk_outhdr hdr = {
+        .type = bench_l(b, VIRTIO_BLK_T_IN),
+    };
+    uint64_t req_addr, table_addr = 0;
+    int64_t start, elapsed, baseline;
+    uint64_t batches = 0;
+    unsigned i;
+
+    req_addr = guest_alloc(alloc, 16 + BENCH_SEG_SIZE + 1);
+    qtest_memwrite(qts, req_addr, &hdr, sizeof(hdr));
+
+    if (cfg->indirect) {
+        table_addr = guest_alloc(alloc, len * sizeof(struct vring_desc));
+        bench_fill_chain(b, desc, len, 0, req_addr);
+        qtest_memwrite(qts, table_addr, desc, len * sizeof(*desc));
+        memset(desc, 0, len * sizeof(*desc));
+        for (i = 0; i < batch; i++) {
+            bench_fill_desc(b, &desc[i], table_addr,
+                            len * sizeof(struct vring_desc),
+                            VRING_DESC_F_INDIRECT, 0);
+        }
+    } else {
+        for (i = 0; i < batch; i++) {
+            bench_fill_chain(b, &desc[i * len], len, i * len, req_addr);
+        }
+    }
+    qtest_memwrite(qts, b->vq->desc, desc, size * sizeof(*desc));
+    g_free(desc);
+
+    start = get_clock();
+    for (i = 0; i < BENCH_BASELINE_RUNS; i++) {
+        bench_batch(b, batch, 0);
+    }
+    baseline = (get_clock() - start) / BENCH_BASELINE_RUNS;
+
+    start = get_clock();
+    do {
+        unsigned head = b->avail_idx % size;
+
+        /* slot i of the batch points at request i of the descriptor table */
+        for (i = 0; i < batch; i++) {
+            b->heads[(head + i) % size] =
+                bench_w(b, cfg->indirect ? i : i * len);
+        }
+        bench_batch(b, batch, batch);
+        batches++;
+        elapsed = get_clock() - start;
+    } while (elapsed < BENCH_TIME_NS);
+
+    g_print("%s%s chain %u: %.1f ns/request, %.1f ns/descriptor "
+            "(%u requests per kick, %.1f us round trip)\n",
+            cfg->indirect ? "indirect" : "direct",
+            cfg->event_idx ? " event-idx" : "", len,
+            (elapsed / (double)batches - baseline) / batch,
+            (elapsed / (double)batches - baseline) / (batch * len),
+            batch, baseline / 1000.0);
+
+    guest_free(alloc, req_addr);
+    if (table_addr) {
+        guest_free(alloc, table_addr);
+    }
+}
+
+static void bench(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    static const unsigned chain_lengths[] = { 3, 4, 8, 16 };
+    const BenchConfig *cfg = data;
+    QVirtioBlk *blk_if = obj;
+    BenchState b = { .dev = blk_if->vdev };
+    uint32_t features;
+    size_t i;
+
+    if (!g_test_perf()) {
+        g_test_skip("benchmark, run with -m perf");
+        return;
+    }
+
+    features = qvirtio_get_features(b.dev);
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1u << VIRTIO_RING_F_EVENT_IDX) |
+                  (1u << VIRTIO_BLK_F_SCSI));
+    if (cfg->indirect) {
+        features |= 1u << VIRTIO_RING_F_INDIRECT_DESC;
+    }
+    if (cfg->event_idx) {
+        features |= 1u << VIRTIO_RING_F_EVENT_IDX;
+    }
+    qvirtio_set_features(b.dev, features);
+
+    b.vq = qvirtqueue_setup(b.dev, t_alloc, 0);
+    g_assert_cmpint(b.vq->indirect, ==, cfg->indirect);
+    g_assert_cmpint(b.vq->event, ==, cfg->event_idx);
+    b.avail_ring = b.vq->avail + 4;
+    b.heads = g_new0(uint16_t, b.vq->size);
+
+    qvirtio_set_driver_ok(b.dev);
+
+    for (i = 0; i < ARRAY_SIZE(chain_lengths); i++) {
+        if (chain_lengths[i] <= b.vq->size) {
+            bench_chain(&b, t_alloc, cfg, chain_lengths[i]);
+        }
+    }
+
+    g_free(b.heads);
+    qvirtqueue_cleanup(b.dev->bus, b.vq, t_alloc);
+}
+
+static void *bench_setup(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -drive if=none,id=drive0,file=null-co://,"
+                    "file.read-zeroes=off,format=raw ");
+    return arg;
+}
+
+static void register_benchmark_virtqueue(void)
+{
+    QOSGraphTestOptions opts = {
+        .before = bench_setup,
+    };
+
+    opts.arg = (void *)&bench_direct;
+    qos_add_test("bench/direct", "virtio-blk", bench, &opts);
+    opts.arg = (void *)&bench_indirect;
+    qos_add_test("bench/indirect", "virtio-blk", bench, &opts);
+    opts.arg = (void *)&bench_direct_event_idx;
+    qos_add_test("bench/direct-event-idx", "virtio-blk", bench, &opts);
+    opts.arg = (void *)&bench_indirect_event_idx;
+    qos_add_test("bench/indirect-event-idx", "virtio-blk", bench, &opts);
+}
+
+libqos_init(register_benchmark_virtqueue);
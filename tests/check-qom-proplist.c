@@ -29,6 +29,7 @@
 
 
 #define TYPE_DUMMY "qemu-dummy"
+#define TYPE_DUMMY_CHILD "qemu-dummy-child"
 
 typedef struct DummyObject DummyObject;
 typedef struct DummyObjectClass DummyObjectClass;
@@ -176,6 +177,11 @@ static const TypeInfo dummy_info = {
     }
 };
 
+static const TypeInfo dummy_child_info = {
+    .name          = TYPE_DUMMY_CHILD,
+    .parent        = TYPE_DUMMY,
+};
+
 
 /*
  * The following 3 object classes are used to
@@ -624,8 +630,32 @@ static void test_qom_partial_path(void)
     g_assert(!ambiguous);
     g_assert(object_resolve_path("obj1", NULL) == obj1);
 
+    /* removing a child must not leave stale results behind */
     object_unparent(obj2b);
+    ambiguous = false;
+    g_assert(object_resolve_path("obj2", &ambiguous) == obj2a);
+    g_assert(!ambiguous);
+    g_assert(object_resolve_path("/cont1/obj2", NULL) == obj2a);
+
     object_unparent(cont1);
+    g_assert(!object_resolve_path("obj1", NULL));
+    g_assert(!object_resolve_path("/cont1/obj2", NULL));
+}
+
+static void test_dummy_class_property_cache(void)
+{
+    ObjectClass *klass = object_class_by_name(TYPE_DUMMY_CHILD);
+    ObjectClass *parent = object_class_by_name(TYPE_DUMMY);
+
+    g_assert(object_class_property_find(klass, "bv", NULL));
+    g_assert(!object_class_property_find(klass, "late", NULL));
+
+    /* properties added to a parent later on are visible in subclasses */
+    object_class_property_add_bool(parent, "late",
+                                   dummy_get_bv, dummy_set_bv,
+                                   &error_abort);
+    g_assert(object_class_property_find(klass, "late", NULL));
+    g_assert(object_class_property_find(parent, "late", NULL));
 }
 
 int main(int argc, char **argv)
@@ -634,6 +664,7 @@ int main(int argc, char **argv)
 
     module_call_init(MODULE_INIT_QOM);
     type_register_static(&dummy_info);
+    type_register_static(&dummy_child_info);
     type_register_static(&dummy_dev_info);
     type_register_static(&dummy_bus_info);
     type_register_static(&dummy_backend_info);
@@ -646,6 +677,8 @@ int main(int argc, char **argv)
     g_test_add_func("/qom/proplist/iterator", test_dummy_iterator);
     g_test_add_func("/qom/proplist/class_iterator", test_dummy_class_iterator);
     g_test_add_func("/qom/proplist/delchild", test_dummy_delchild);
+    g_test_add_func("/qom/proplist/class_cache",
+                    test_dummy_class_property_cache);
     g_test_add_func("/qom/resolve/partial", test_qom_partial_path);
 
     return g_test_run();
@@ -33,6 +33,9 @@ enum op {
     OP_FMA,
     OP_SQRT,
     OP_CMP,
+    OP_MAX,
+    OP_TO_INT,
+    OP_FROM_INT,
     OP_MAX_NR,
 };
 
@@ -44,6 +47,9 @@ static const char * const op_names[] = {
     [OP_FMA] = "mulAdd",
     [OP_SQRT] = "sqrt",
     [OP_CMP] = "cmp",
+    [OP_MAX] = "max",
+    [OP_TO_INT] = "to_int",
+    [OP_FROM_INT] = "from_int",
     [OP_MAX_NR] = NULL,
 };
 
@@ -163,8 +169,13 @@ static void update_random_ops(int n_ops, enum precision prec)
     }
 }
 
+/*
+ * With @int_range, the operands are kept within the range of int32_t
+ * and given a fractional part, so that conversions to integer neither
+ * overflow nor are exact.
+ */
 static void fill_random(union fp *ops, int n_ops, enum precision prec,
-                        bool no_neg)
+                        bool no_neg, bool int_range)
 {
     int i;
 
@@ -172,6 +183,10 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
         switch (prec) {
         case PREC_SINGLE:
         case PREC_FLOAT32:
+            if (int_range) {
+                ops[i].f = (float)(int32_t)random_ops[i] / 256;
+                break;
+            }
             ops[i].f32 = make_float32(random_ops[i]);
             if (no_neg && float32_is_neg(ops[i].f32)) {
                 ops[i].f32 = float32_chs(ops[i].f32);
@@ -179,6 +194,10 @@ static void fill_random(union fp *ops, int n_ops, enum precision prec,
             break;
         case PREC_DOUBLE:
         case PREC_FLOAT64:
+            if (int_range) {
+                ops[i].d = (double)(int32_t)random_ops[i] / 256;
+                break;
+            }
             ops[i].f64 = make_float64(random_ops[i]);
             if (no_neg && float64_is_neg(ops[i].f64)) {
                 ops[i].f64 = float64_chs(ops[i].f64);
@@ -206,7 +225,7 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
         update_random_ops(n_ops, prec);
         switch (prec) {
         case PREC_SINGLE:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float a = ops[0].f;
@@ -235,13 +254,22 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAX:
+                    res.f = fmaxf(a, b);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = lrintf(a);
+                    break;
+                case OP_FROM_INT:
+                    res.f = (int32_t)random_ops[0];
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_DOUBLE:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 double a = ops[0].d;
@@ -270,13 +298,22 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = isgreater(a, b);
                     break;
+                case OP_MAX:
+                    res.d = fmax(a, b);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = lrint(a);
+                    break;
+                case OP_FROM_INT:
+                    res.d = (int32_t)random_ops[0];
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT32:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float32 a = ops[0].f32;
@@ -305,13 +342,22 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float32_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f32 = float32_maxnum(a, b, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = float32_to_int32(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f32 = int32_to_float32(random_ops[0], &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
             }
             break;
         case PREC_FLOAT64:
-            fill_random(ops, n_ops, prec, no_neg);
+            fill_random(ops, n_ops, prec, no_neg, op == OP_TO_INT);
             t0 = get_clock();
             for (i = 0; i < OPS_PER_ITER; i++) {
                 float64 a = ops[0].f64;
@@ -340,6 +386,15 @@ static void bench(enum precision prec, enum op op, int n_ops, bool no_neg)
                 case OP_CMP:
                     res.u64 = float64_compare_quiet(a, b, &soft_status);
                     break;
+                case OP_MAX:
+                    res.f64 = float64_maxnum(a, b, &soft_status);
+                    break;
+                case OP_TO_INT:
+                    res.u64 = float64_to_int32(a, &soft_status);
+                    break;
+                case OP_FROM_INT:
+                    res.f64 = int32_to_float64(random_ops[0], &soft_status);
+                    break;
                 default:
                     g_assert_not_reached();
                 }
@@ -377,6 +432,9 @@ GEN_BENCH_ALL_TYPES(mul, OP_MUL, 2)
 GEN_BENCH_ALL_TYPES(div, OP_DIV, 2)
 GEN_BENCH_ALL_TYPES(fma, OP_FMA, 3)
 GEN_BENCH_ALL_TYPES(cmp, OP_CMP, 2)
+GEN_BENCH_ALL_TYPES(max, OP_MAX, 2)
+GEN_BENCH_ALL_TYPES(to_int, OP_TO_INT, 1)
+GEN_BENCH_ALL_TYPES(from_int, OP_FROM_INT, 1)
 #undef GEN_BENCH_ALL_TYPES
 
 #define GEN_BENCH_ALL_TYPES_NO_NEG(name, op, n)                         \
@@ -407,6 +465,9 @@ static const bench_func_t bench_funcs[OP_MAX_NR][PREC_MAX_NR] = {
     GEN_BENCH_FUNCS(fma, OP_FMA),
     GEN_BENCH_FUNCS(sqrt, OP_SQRT),
     GEN_BENCH_FUNCS(cmp, OP_CMP),
+    GEN_BENCH_FUNCS(max, OP_MAX),
+    GEN_BENCH_FUNCS(to_int, OP_TO_INT),
+    GEN_BENCH_FUNCS(from_int, OP_FROM_INT),
 };
 
 #undef GEN_BENCH_FUNCS
@@ -14,11 +14,13 @@
 
 #include "libqtest.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qapi/qmp/qjson.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
 #include "qemu/sockets.h"
+#include "io/channel-socket.h"
 #include "chardev/char.h"
 #include "qapi/qapi-visit-sockets.h"
 #include "qapi/qobject-input-visitor.h"
@@ -437,6 +439,35 @@ static void migrate_set_parameter_int(QTestState *who, const char *parameter,
     migrate_check_parameter_int(who, parameter, value);
 }
 
+static char *migrate_get_parameter_str(QTestState *who,
+                                       const char *parameter)
+{
+    QDict *rsp;
+    char *result;
+
+    rsp = wait_command(who, "{ 'execute': 'query-migrate-parameters' }");
+    result = g_strdup(qdict_get_str(rsp, parameter));
+    qobject_unref(rsp);
+    return result;
+}
+
+static void migrate_set_parameter_str(QTestState *who, const char *parameter,
+                                      const char *value)
+{
+    QDict *rsp;
+    char *result;
+
+    rsp = qtest_qmp(who,
+                    "{ 'execute': 'migrate-set-parameters',"
+                    "'arguments': { %s: %s } }",
+                    parameter, value);
+    g_assert(qdict_haskey(rsp, "return"));
+    qobject_unref(rsp);
+    result = migrate_get_parameter_str(who, parameter);
+    g_assert_cmpstr(result, ==, value);
+    g_free(result);
+}
+
 static void migrate_pause(QTestState *who)
 {
     QDict *rsp;
@@ -731,7 +762,8 @@ static void test_deprecated(void)
 
 static int migrate_postcopy_prepare(QTestState **from_ptr,
                                      QTestState **to_ptr,
-                                     bool hide_error)
+                                     bool hide_error,
+                                     bool postcopy_preempt)
 {
     char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
     QTestState *from, *to;
@@ -743,6 +775,10 @@ static int migrate_postcopy_prepare(QTestState **from_ptr,
     migrate_set_capability(from, "postcopy-ram", true);
     migrate_set_capability(to, "postcopy-ram", true);
     migrate_set_capability(to, "postcopy-blocktime", true);
+    if (postcopy_preempt) {
+        migrate_set_capability(from, "postcopy-preempt", true);
+        migrate_set_capability(to, "postcopy-preempt", true);
+    }
 
     /* We want to pick a speed slow enough that the test completes
      * quickly, but that it doesn't complete precopy even on a slow
@@ -783,7 +819,31 @@ static void test_postcopy(void)
 {
     QTestState *from, *to;
 
-    if (migrate_postcopy_prepare(&from, &to, false)) {
+    if (migrate_postcopy_prepare(&from, &to, false, false)) {
+        return;
+    }
+    migrate_postcopy_start(from, to);
+    migrate_postcopy_complete(from, to);
+}
+
+static void test_postcopy_prefetch(void)
+{
+    QTestState *from, *to;
+
+    if (migrate_postcopy_prepare(&from, &to, false, false)) {
+        return;
+    }
+    /* The guest dirties memory sequentially, so the faults have a stride */
+    migrate_set_parameter_int(to, "postcopy-prefetch-pages", 64);
+    migrate_postcopy_start(from, to);
+    migrate_postcopy_complete(from, to);
+}
+
+static void test_postcopy_preempt(void)
+{
+    QTestState *from, *to;
+
+    if (migrate_postcopy_prepare(&from, &to, false, true)) {
         return;
     }
     migrate_postcopy_start(from, to);
@@ -795,7 +855,7 @@ static void test_postcopy_recovery(void)
     QTestState *from, *to;
     char *uri;
 
-    if (migrate_postcopy_prepare(&from, &to, true)) {
+    if (migrate_postcopy_prepare(&from, &to, true, false)) {
         return;
     }
 
@@ -920,6 +980,103 @@ static void test_precopy_unix(void)
     g_free(uri);
 }
 
+static void test_precopy_iteration_events(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp, *data;
+
+    if (test_migrate_start(&from, &to, uri, false, false, NULL, NULL)) {
+        return;
+    }
+
+    /* 1 ms should make it not converge*/
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+    migrate_set_capability(from, "events", true);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    /* The first sync may race with the reply to migrate, wait for another */
+    do {
+        rsp = qtest_qmp_eventwait_ref(from, "MIGRATION_ITERATION");
+        data = qdict_get_qdict(rsp, "data");
+        g_assert(data);
+        g_assert_cmpint(qdict_get_int(data, "pass"), >=, 1);
+        g_assert_cmpint(qdict_get_int(data, "bql-time"), <=,
+                        qdict_get_int(data, "sync-time"));
+        g_assert(qdict_haskey(data, "dirty-pages"));
+        g_assert(qdict_haskey(data, "transferred"));
+        g_assert(!qdict_haskey(data, "multifd-channels"));
+        if (qdict_get_int(data, "pass") > 1) {
+            break;
+        }
+        qobject_unref(rsp);
+    } while (true);
+    /* The guest keeps dirtying memory, so the pass sent some */
+    g_assert_cmpint(qdict_get_int(data, "transferred"), >, 0);
+    qobject_unref(rsp);
+
+    /* 300 ms should converge */
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
+static void test_precopy_parallel_device_load(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, uri, false, false, NULL, NULL)) {
+        return;
+    }
+
+    migrate_set_capability(from, "parallel-device-load", true);
+    migrate_set_capability(to, "parallel-device-load", true);
+
+    /* 1 ms should make it not converge*/
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    /* 300 ms should converge */
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
 #if 0
 /* Currently upset on aarch64 TCG */
 static void test_ignore_shared(void)
@@ -958,6 +1115,39 @@ static void test_ignore_shared(void)
 }
 #endif
 
+static void test_local_update(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, uri, false, true, NULL, NULL)) {
+        return;
+    }
+
+    migrate_set_capability(from, "local-update", true);
+    migrate_set_capability(to, "local-update", true);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* Guest RAM was handed over, not copied */
+    g_assert_cmpint(read_ram_property_int(from, "transferred"), <, 1024 * 1024);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
 static void test_xbzrle(const char *uri)
 {
     QTestState *from, *to;
@@ -1053,6 +1243,91 @@ static void test_precopy_tcp(void)
     g_free(uri);
 }
 
+static void test_multifd_tcp(const char *method, const char *zero_page,
+                             bool zero_copy)
+{
+    char *uri;
+    QDict *rsp;
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, "defer", false, false,
+                           NULL, NULL)) {
+        return;
+    }
+
+    /* 1 ms should make it not converge*/
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+    migrate_set_parameter_str(from, "multifd-compression", method);
+    migrate_set_parameter_str(to, "multifd-compression", method);
+    migrate_set_parameter_str(from, "zero-page-detection", zero_page);
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+    if (zero_copy) {
+        migrate_set_capability(from, "zero-copy-send", true);
+    }
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': 'tcp:127.0.0.1:0' }}");
+    qobject_unref(rsp);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    uri = migrate_get_socket_address(to, "socket-address");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    /* 300ms should converge */
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
+static void test_multifd_tcp_none(void)
+{
+    test_multifd_tcp("none", "multifd", false);
+}
+
+#ifdef QEMU_MSG_ZEROCOPY
+static void test_multifd_tcp_zero_copy(void)
+{
+    test_multifd_tcp("none", "multifd", true);
+}
+#endif
+
+static void test_multifd_tcp_zero_page_legacy(void)
+{
+    test_multifd_tcp("none", "legacy", false);
+}
+
+static void test_multifd_tcp_zlib(void)
+{
+    test_multifd_tcp("zlib", "multifd", false);
+}
+
+#ifdef CONFIG_ZSTD
+static void test_multifd_tcp_zstd(void)
+{
+    test_multifd_tcp("zstd", "multifd", false);
+}
+#endif
+
 static void test_migrate_fd_proto(void)
 {
     QTestState *from, *to;
@@ -1137,6 +1412,158 @@ static void test_migrate_fd_proto(void)
     test_migrate_end(from, to, true);
 }
 
+static void test_mapped_ram_file(bool multifd)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", false, false, NULL, NULL)) {
+        return;
+    }
+
+    /* 1 ms should make it not converge, so pages get written again */
+    migrate_set_parameter_int(from, "downtime-limit", 1);
+    /* 1GB/s */
+    migrate_set_parameter_int(from, "max-bandwidth", 1000000000);
+
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+    if (multifd) {
+        migrate_set_parameter_int(from, "multifd-channels", 4);
+        migrate_set_parameter_int(to, "multifd-channels", 4);
+        migrate_set_capability(from, "multifd", true);
+        migrate_set_capability(to, "multifd", true);
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    /* 300ms should converge */
+    migrate_set_parameter_int(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    /* The file is complete, only now can the destination load it */
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    test_mapped_ram_file(false);
+}
+
+static void test_multifd_file_mapped_ram(void)
+{
+    test_mapped_ram_file(true);
+}
+
+static void test_background_snapshot_file(void)
+{
+    char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", false, false, NULL, NULL)) {
+        return;
+    }
+
+    /* Needs userfaultfd write protection in the host kernel */
+    rsp = qtest_qmp(from, "{ 'execute': 'migrate-set-capabilities',"
+                          "  'arguments': { 'capabilities': [ {"
+                          "    'capability': 'background-snapshot',"
+                          "    'state': true } ] } }");
+    if (!qdict_haskey(rsp, "return")) {
+        g_test_message("Skipping test: background snapshot not supported");
+        qobject_unref(rsp);
+        test_migrate_end(from, to, false);
+        g_free(uri);
+        return;
+    }
+    qobject_unref(rsp);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    /* The source kept running while its RAM was saved */
+    rsp = wait_command(from, "{ 'execute': 'query-status' }");
+    g_assert(qdict_get_bool(rsp, "running"));
+    qobject_unref(rsp);
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    test_migrate_end(from, to, true);
+    cleanup("migfile");
+    g_free(uri);
+}
+
+static void test_dirty_rate(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    QDict *rsp;
+    QList *blocks;
+    const char *status;
+
+    if (test_migrate_start(&from, &to, uri, false, false, NULL, NULL)) {
+        return;
+    }
+
+    /* Wait for the guest to start dirtying its memory */
+    wait_for_serial("src_serial");
+
+    rsp = wait_command(from, "{ 'execute': 'calc-dirty-rate',"
+                             "  'arguments': { 'calc-time': 1 } }");
+    qobject_unref(rsp);
+
+    while (true) {
+        rsp = wait_command(from, "{ 'execute': 'query-dirty-rate' }");
+        status = qdict_get_str(rsp, "status");
+        if (strcmp(status, "measuring")) {
+            break;
+        }
+        qobject_unref(rsp);
+        usleep(1000 * 100);
+    }
+
+    g_assert_cmpstr(status, ==, "measured");
+    g_assert_cmpint(qdict_get_int(rsp, "calc-time"), ==, 1);
+    g_assert(qdict_haskey(rsp, "dirty-rate"));
+    blocks = qdict_get_qlist(rsp, "ramblocks");
+    g_assert(blocks && !qlist_empty(blocks));
+    qobject_unref(rsp);
+
+    /* No migration was started for the measurement */
+    rsp = migrate_query(from);
+    g_assert(!qdict_haskey(rsp, "status"));
+    qobject_unref(rsp);
+
+    test_migrate_end(from, to, false);
+    g_free(uri);
+}
+
 static void do_test_validate_uuid(const char *uuid_arg_src,
                                   const char *uuid_arg_dst,
                                   bool should_fail, bool hide_stderr)
@@ -1247,13 +1674,38 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/postcopy/unix", test_postcopy);
     qtest_add_func("/migration/postcopy/recovery", test_postcopy_recovery);
+    qtest_add_func("/migration/postcopy/preempt", test_postcopy_preempt);
+    qtest_add_func("/migration/postcopy/prefetch", test_postcopy_prefetch);
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
+    qtest_add_func("/migration/local_update", test_local_update);
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
+    qtest_add_func("/migration/multifd/file/mapped-ram",
+                   test_multifd_file_mapped_ram);
+    qtest_add_func("/migration/multifd/tcp/none", test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/zero-page/legacy",
+                   test_multifd_tcp_zero_page_legacy);
+#ifdef QEMU_MSG_ZEROCOPY
+    qtest_add_func("/migration/multifd/tcp/zero-copy",
+                   test_multifd_tcp_zero_copy);
+#endif
+    qtest_add_func("/migration/multifd/tcp/zlib", test_multifd_tcp_zlib);
+#ifdef CONFIG_ZSTD
+    qtest_add_func("/migration/multifd/tcp/zstd", test_multifd_tcp_zstd);
+#endif
+    qtest_add_func("/migration/background-snapshot/file",
+                   test_background_snapshot_file);
+    qtest_add_func("/migration/precopy/iteration-events",
+                   test_precopy_iteration_events);
+    qtest_add_func("/migration/precopy/parallel-device-load",
+                   test_precopy_parallel_device_load);
+    qtest_add_func("/migration/dirty_rate", test_dirty_rate);
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
     qtest_add_func("/migration/validate_uuid_src_not_set",
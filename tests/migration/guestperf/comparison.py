@@ -121,4 +121,33 @@ COMPARISONS = [
         Scenario("compr-xbzrle-cache-50",
                  compression_xbzrle=True, compression_xbzrle_cache=50),
     ]),
+
+
+    # Looking at effect of multifd with varying numbers
+    # of channels
+    Comparison("multifd", scenarios = [
+        Scenario("multifd-channels-1",
+                 multifd=True, multifd_channels=1),
+        Scenario("multifd-channels-2",
+                 multifd=True, multifd_channels=2),
+        Scenario("multifd-channels-4",
+                 multifd=True, multifd_channels=4),
+        Scenario("multifd-channels-8",
+                 multifd=True, multifd_channels=8),
+    ]),
+
+
+    # Looking at the different strategies side by side,
+    # for use with the workload options
+    Comparison("strategies", scenarios = [
+        Scenario("strategy-precopy"),
+        Scenario("strategy-multifd",
+                 multifd=True, multifd_channels=4),
+        Scenario("strategy-xbzrle",
+                 compression_xbzrle=True),
+        Scenario("strategy-compr-mt",
+                 compression_mt=True, compression_mt_threads=4),
+        Scenario("strategy-post-copy",
+                 post_copy=True),
+    ]),
 ]
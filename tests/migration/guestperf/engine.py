@@ -27,6 +27,7 @@ import time
 from guestperf.progress import Progress, ProgressStats
 from guestperf.report import Report
 from guestperf.timings import TimingRecord, Timings
+from guestperf.workload import Workload
 
 sys.path.append(os.path.join(os.path.dirname(__file__),
                              '..', '..', '..', 'python'))
@@ -78,6 +79,14 @@ class Engine(object):
             utime = int(fields[14])
             return TimingRecord(pid, now, 1000 * (stime + utime) / jiffies_per_sec)
 
+    def _migration_cpu_time(self, pid, tid_list):
+        # CPU time of the QEMU process in ms, excluding the vCPU threads
+        # so that the guest workload is not charged to the migration
+        total = self._cpu_timing(pid)._value
+        vcpus = sum([record._value for record in
+                     self._vcpu_timing(pid, tid_list)])
+        return total - vcpus
+
     def _migrate_progress(self, vm):
         info = vm.command("query-migrate")
 
@@ -117,6 +126,12 @@ class Engine(object):
             src_threads.append(vcpu["thread_id"])
 
         # XXX how to get dst timings on remote host ?
+        dst_pid = None
+        dst_threads = []
+        if self._dst_host == "localhost":
+            dst_pid = dst.get_pid()
+            for vcpu in dst.command("query-cpus"):
+                dst_threads.append(vcpu["thread_id"])
 
         if self._verbose:
             print("Sleeping %d seconds for initial guest workload run" % self._sleep)
@@ -172,6 +187,22 @@ class Engine(object):
             resp = dst.command("migrate-set-parameters",
                                decompress_threads=scenario._compression_mt_threads)
 
+        if scenario._multifd:
+            resp = src.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "multifd",
+                                     "state": True }
+                               ])
+            resp = src.command("migrate-set-parameters",
+                               multifd_channels=scenario._multifd_channels)
+            resp = dst.command("migrate-set-capabilities",
+                               capabilities = [
+                                   { "capability": "multifd",
+                                     "state": True }
+                               ])
+            resp = dst.command("migrate-set-parameters",
+                               multifd_channels=scenario._multifd_channels)
+
         if scenario._compression_xbzrle:
             resp = src.command("migrate-set-capabilities",
                                capabilities = [
@@ -187,6 +218,10 @@ class Engine(object):
                                value=(hardware._mem * 1024 * 1024 * 1024 / 100 *
                                       scenario._compression_xbzrle_cache))
 
+        src_cpu_start = self._migration_cpu_time(src_pid, src_threads)
+        if dst_pid is not None:
+            dst_cpu_start = self._migration_cpu_time(dst_pid, dst_threads)
+
         resp = src.command("migrate", uri=connect_uri)
 
         post_copy = False
@@ -216,6 +251,16 @@ class Engine(object):
                 if progress_history[-1] != progress:
                     progress_history.append(progress)
 
+                migration_cpu = {
+                    "src": (self._migration_cpu_time(src_pid, src_threads) -
+                            src_cpu_start),
+                    "dst": None,
+                }
+                if dst_pid is not None:
+                    migration_cpu["dst"] = (
+                        self._migration_cpu_time(dst_pid, dst_threads) -
+                        dst_cpu_start)
+
                 if progress._status == "completed":
                     if self._verbose:
                         print("Sleeping %d seconds for final guest workload run" % self._sleep)
@@ -226,7 +271,8 @@ class Engine(object):
                         src_vcpu_time.extend(self._vcpu_timing(src_pid, src_threads))
                         sleep_secs -= 1
 
-                return [progress_history, src_qemu_time, src_vcpu_time]
+                return [progress_history, src_qemu_time, src_vcpu_time,
+                        migration_cpu]
 
             if self._verbose and (loop % 20) == 0:
                 print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec)" % (
@@ -265,7 +311,7 @@ class Engine(object):
                 resp = src.command("stop")
                 paused = True
 
-    def _get_common_args(self, hardware, tunnelled=False):
+    def _get_common_args(self, hardware, workload, tunnelled=False):
         args = [
             "noapic",
             "edd=off",
@@ -281,6 +327,7 @@ class Engine(object):
             args.append("quiet")
 
         args.append("ramsize=%s" % hardware._mem)
+        args.extend(workload.get_kernel_args())
 
         cmdline = " ".join(args)
         if tunnelled:
@@ -311,14 +358,14 @@ class Engine(object):
 
         return argv
 
-    def _get_src_args(self, hardware):
-        return self._get_common_args(hardware)
+    def _get_src_args(self, hardware, workload):
+        return self._get_common_args(hardware, workload)
 
-    def _get_dst_args(self, hardware, uri):
+    def _get_dst_args(self, hardware, workload, uri):
         tunnelled = False
         if self._dst_host != "localhost":
             tunnelled = True
-        argv = self._get_common_args(hardware, tunnelled)
+        argv = self._get_common_args(hardware, workload, tunnelled)
         return argv + ["-incoming", uri]
 
     @staticmethod
@@ -363,8 +410,10 @@ class Engine(object):
                                             int(match.group(3))))
         return records
 
-    def run(self, hardware, scenario, result_dir=os.getcwd()):
+    def run(self, hardware, scenario, workload=None, result_dir=os.getcwd()):
         abs_result_dir = os.path.join(result_dir, scenario._name)
+        if workload is None:
+            workload = Workload()
 
         if self._transport == "tcp":
             uri = "tcp:%s:9000" % self._dst_host
@@ -387,13 +436,13 @@ class Engine(object):
         srcmonaddr = "/var/tmp/qemu-src-%d-monitor.sock" % os.getpid()
 
         src = QEMUMachine(self._binary,
-                          args=self._get_src_args(hardware),
+                          args=self._get_src_args(hardware, workload),
                           wrapper=self._get_src_wrapper(hardware),
                           name="qemu-src-%d" % os.getpid(),
                           monitor_address=srcmonaddr)
 
         dst = QEMUMachine(self._binary,
-                          args=self._get_dst_args(hardware, uri),
+                          args=self._get_dst_args(hardware, workload, uri),
                           wrapper=self._get_dst_wrapper(hardware),
                           name="qemu-dst-%d" % os.getpid(),
                           monitor_address=dstmonaddr)
@@ -406,6 +455,7 @@ class Engine(object):
             progress_history = ret[0]
             qemu_timings = ret[1]
             vcpu_timings = ret[2]
+            migration_cpu = ret[3]
             if uri[0:5] == "unix:":
                 os.remove(uri[5:])
             if self._verbose:
@@ -419,7 +469,8 @@ class Engine(object):
                           Timings(qemu_timings),
                           Timings(vcpu_timings),
                           self._binary, self._dst_host, self._kernel,
-                          self._initrd, self._transport, self._sleep)
+                          self._initrd, self._transport, self._sleep,
+                          workload, migration_cpu)
         except Exception as e:
             if self._debug:
                 print("Failed: %s" % str(e))
@@ -23,6 +23,7 @@ from guestperf.hardware import Hardware
 from guestperf.scenario import Scenario
 from guestperf.progress import Progress
 from guestperf.timings import Timings
+from guestperf.workload import Workload
 
 class Report(object):
 
@@ -38,7 +39,9 @@ class Report(object):
                  kernel,
                  initrd,
                  transport,
-                 sleep):
+                 sleep,
+                 workload=None,
+                 migration_cpu=None):
 
         self._hardware = hardware
         self._scenario = scenario
@@ -52,6 +55,41 @@ class Report(object):
         self._initrd = initrd
         self._transport = transport
         self._sleep = sleep
+        if workload is None:
+            workload = Workload()
+        self._workload = workload
+        self._migration_cpu = migration_cpu
+
+    def summary(self):
+        # The headline numbers of the run, for comparing runs by script
+        # without digging through the progress history
+        if len(self._progress_history) == 0:
+            return None
+        last = self._progress_history[-1]
+        transferred_gib = last._ram._transferred_bytes / float(1024 ** 3)
+
+        def per_gib(value):
+            if value is None or transferred_gib == 0:
+                return None
+            return value / transferred_gib
+
+        src_cpu = dst_cpu = None
+        if self._migration_cpu is not None:
+            src_cpu = self._migration_cpu["src"]
+            dst_cpu = self._migration_cpu["dst"]
+
+        return {
+            "status": last._status,
+            "total_time_ms": last._duration,
+            "downtime_ms": last._downtime,
+            "setup_time_ms": last._setup_time,
+            "iterations": last._ram._iterations,
+            "transferred_bytes": last._ram._transferred_bytes,
+            "src_cpu_ms": src_cpu,
+            "dst_cpu_ms": dst_cpu,
+            "src_cpu_ms_per_gib": per_gib(src_cpu),
+            "dst_cpu_ms_per_gib": per_gib(dst_cpu),
+        }
 
     def serialize(self):
         return {
@@ -67,6 +105,9 @@ class Report(object):
             "initrd": self._initrd,
             "transport": self._transport,
             "sleep": self._sleep,
+            "workload": self._workload.serialize(),
+            "migration_cpu": self._migration_cpu,
+            "summary": self.summary(),
         }
 
     @classmethod
@@ -83,7 +124,9 @@ class Report(object):
             data["kernel"],
             data["initrd"],
             data["transport"],
-            data["sleep"])
+            data["sleep"],
+            Workload.deserialize(data["workload"]) if "workload" in data else None,
+            data.get("migration_cpu"))
 
     def to_json(self):
         return json.dumps(self.serialize(), indent=4)
@@ -21,6 +21,7 @@ from __future__ import print_function
 
 import argparse
 import fnmatch
+import json
 import os
 import os.path
 import platform
@@ -33,6 +34,7 @@ from guestperf.scenario import Scenario
 from guestperf.comparison import COMPARISONS
 from guestperf.plot import Plot
 from guestperf.report import Report
+from guestperf.workload import Workload
 
 
 class BaseShell(object):
@@ -62,6 +64,12 @@ class BaseShell(object):
         parser.add_argument("--huge-pages", dest="huge_pages", default=False)
         parser.add_argument("--locked-pages", dest="locked_pages", default=False)
 
+        # Workload args
+        parser.add_argument("--working-set", dest="working_set", default=0, type=int)
+        parser.add_argument("--dirty-rate", dest="dirty_rate", default=0, type=int)
+        parser.add_argument("--zero-percent", dest="zero_percent", default=0, type=int)
+        parser.add_argument("--compressible-percent", dest="compressible_percent", default=0, type=int)
+
         self._parser = parser
 
     def get_engine(self, args):
@@ -92,6 +100,15 @@ class BaseShell(object):
                         huge_pages=args.huge_pages,
                         prealloc_pages=args.prealloc_pages)
 
+    def get_workload(self, args):
+        if args.zero_percent + args.compressible_percent > 100:
+            raise Exception("Zero and compressible pages exceed 100%")
+
+        return Workload(working_set=args.working_set,
+                        dirty_rate=args.dirty_rate,
+                        zero_percent=args.zero_percent,
+                        compressible_percent=args.compressible_percent)
+
 
 class Shell(BaseShell):
 
@@ -123,6 +140,11 @@ class Shell(BaseShell):
         parser.add_argument("--compression-xbzrle", dest="compression_xbzrle", default=False, action="store_true")
         parser.add_argument("--compression-xbzrle-cache", dest="compression_xbzrle_cache", default=10, type=int)
 
+        parser.add_argument("--multifd", dest="multifd", default=False, action="store_true")
+        parser.add_argument("--multifd-channels", dest="multifd_channels", default=2, type=int)
+
+        parser.add_argument("--summary", dest="summary", default=False, action="store_true")
+
     def get_scenario(self, args):
         return Scenario(name="perfreport",
                         downtime=args.downtime,
@@ -143,7 +165,10 @@ class Shell(BaseShell):
                         compression_mt_threads=args.compression_mt_threads,
 
                         compression_xbzrle=args.compression_xbzrle,
-                        compression_xbzrle_cache=args.compression_xbzrle_cache)
+                        compression_xbzrle_cache=args.compression_xbzrle_cache,
+
+                        multifd=args.multifd,
+                        multifd_channels=args.multifd_channels)
 
     def run(self, argv):
         args = self._parser.parse_args(argv)
@@ -157,12 +182,17 @@ class Shell(BaseShell):
         scenario = self.get_scenario(args)
 
         try:
-            report = engine.run(hardware, scenario)
+            workload = self.get_workload(args)
+            report = engine.run(hardware, scenario, workload)
+            if args.summary:
+                output = json.dumps(report.summary(), indent=4)
+            else:
+                output = report.to_json()
             if args.output is None:
-                print(report.to_json())
+                print(output)
             else:
                 with open(args.output, "w") as fh:
-                    print(report.to_json(), file=fh)
+                    print(output, file=fh)
             return 0
         except Exception as e:
             print("Error: %s" % str(e), file=sys.stderr)
@@ -192,6 +222,7 @@ class BatchShell(BaseShell):
         hardware = self.get_hardware(args)
 
         try:
+            workload = self.get_workload(args)
             for comparison in COMPARISONS:
                 compdir = os.path.join(args.output, comparison._name)
                 for scenario in comparison._scenarios:
@@ -208,7 +239,7 @@ class BatchShell(BaseShell):
                     filename = os.path.join(dirname, scenario._name + ".json")
                     if not os.path.exists(dirname):
                         os.makedirs(dirname)
-                    report = engine.run(hardware, scenario)
+                    report = engine.run(hardware, scenario, workload)
                     with open(filename, "w") as fh:
                         print(report.to_json(), file=fh)
         except Exception as e:
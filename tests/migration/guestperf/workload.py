@@ -0,0 +1,39 @@
+#
+# Migration test guest workload description
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+
+
+class Workload(object):
+    def __init__(self, working_set=0, dirty_rate=0,
+                 zero_percent=0, compressible_percent=0):
+        self._working_set = working_set # MiB, 0 for all of guest RAM
+        self._dirty_rate = dirty_rate # MiB per second, 0 for no limit
+        self._zero_percent = zero_percent # pages that stay zero
+        self._compressible_percent = compressible_percent # single-byte pages
+
+    def get_kernel_args(self):
+        return [
+            "working-set=%d" % self._working_set,
+            "dirty-rate=%d" % self._dirty_rate,
+            "zero-percent=%d" % self._zero_percent,
+            "compressible-percent=%d" % self._compressible_percent,
+        ]
+
+    def serialize(self):
+        return {
+            "working_set": self._working_set,
+            "dirty_rate": self._dirty_rate,
+            "zero_percent": self._zero_percent,
+            "compressible_percent": self._compressible_percent,
+        }
+
+    @classmethod
+    def deserialize(cls, data):
+        return cls(
+            data["working_set"],
+            data["dirty_rate"],
+            data["zero_percent"],
+            data["compressible_percent"])
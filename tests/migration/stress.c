@@ -134,89 +134,93 @@ static int get_command_arg_ull(const char *name,
 }
 
 
-static int random_bytes(char *buf, size_t len)
+typedef struct StressWorkload {
+    unsigned long long ramsizeMB;       /* RAM allocated by each thread */
+    unsigned long long workingsetMB;    /* part of it that is dirtied */
+    unsigned long long dirtyrateMB;     /* MB/s per thread, 0 for no limit */
+    unsigned int zeropercent;           /* pages that stay all zeroes */
+    unsigned int comppercent;           /* pages filled with a single byte */
+} StressWorkload;
+
+static unsigned long long now(void)
 {
-    int fd;
+    struct timeval tv;
 
-    fd = open("/dev/urandom", O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "%s (%05d): ERROR: cannot open /dev/urandom: %s\n",
-                argv0, gettid(), strerror(errno));
-        return -1;
-    }
+    gettimeofday(&tv, NULL);
 
-    if (read(fd, buf, len) != len) {
-        fprintf(stderr, "%s (%05d): ERROR: cannot read /dev/urandom: %s\n",
-                argv0, gettid(), strerror(errno));
-        close(fd);
-        return -1;
-    }
+    return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
+}
 
-    close(fd);
+/* xorshift64, plenty good enough to defeat compression and XBZRLE */
+static unsigned long long next_random(unsigned long long *state)
+{
+    unsigned long long x = *state;
 
-    return 0;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
 }
 
-
-static unsigned long long now(void)
+/*
+ * Dirty one page according to its class: zero pages get a zero stored
+ * into them, so that they are dirty but still detected as zero pages;
+ * compressible pages are filled with a byte that changes on every pass;
+ * all other pages are overwritten with pseudo-random data.
+ */
+static void dirty_page(const StressWorkload *w, char *page, size_t index,
+                       unsigned int pass, unsigned long long *seed)
 {
-    struct timeval tv;
+    unsigned int class = index % 100;
+    size_t k;
 
-    gettimeofday(&tv, NULL);
-
-    return (tv.tv_sec * 1000ull) + (tv.tv_usec / 1000ull);
+    if (class < w->zeropercent) {
+        *(unsigned long long *)page = 0;
+    } else if (class < w->zeropercent + w->comppercent) {
+        memset(page, (pass % 255) + 1, PAGE_SIZE);
+    } else {
+        for (k = 0; k < PAGE_SIZE; k += sizeof(unsigned long long)) {
+            *(unsigned long long *)(page + k) = next_random(seed);
+        }
+    }
 }
 
-static int stressone(unsigned long long ramsizeMB)
+static int stressone(const StressWorkload *w)
 {
     size_t pagesPerMB = 1024 * 1024 / PAGE_SIZE;
-    char *ram = malloc(ramsizeMB * 1024 * 1024);
-    char *ramptr;
-    size_t i, j, k;
-    char *data = malloc(PAGE_SIZE);
-    char *dataptr;
-    size_t nMB = 0;
-    unsigned long long before, after;
+    char *ram = malloc(w->ramsizeMB * 1024 * 1024);
+    unsigned long long seed = now() ^ ((unsigned long long)gettid() << 32);
+    unsigned long long start, before, after, dirtiedMB = 0;
+    unsigned int pass;
+    size_t i, j, nMB = 0;
 
     if (!ram) {
         fprintf(stderr, "%s (%05d): ERROR: cannot allocate %llu MB of RAM: %s\n",
-                argv0, gettid(), ramsizeMB, strerror(errno));
+                argv0, gettid(), w->ramsizeMB, strerror(errno));
         return -1;
     }
-    if (!data) {
-        fprintf(stderr, "%s (%d): ERROR: cannot allocate %d bytes of RAM: %s\n",
-                argv0, gettid(), PAGE_SIZE, strerror(errno));
-        free(ram);
-        return -1;
-    }
-
-    /* We don't care about initial state, but we do want
-     * to fault it all into RAM, otherwise the first iter
-     * of the loop below will be quite slow. We cna't use
-     * 0x0 as the byte as gcc optimizes that away into a
-     * calloc instead :-) */
-    memset(ram, 0xfe, ramsizeMB * 1024 * 1024);
 
-    if (random_bytes(data, PAGE_SIZE) < 0) {
-        free(ram);
-        free(data);
-        return -1;
+    /*
+     * Fault everything into RAM and give every page its initial
+     * contents; the part outside the working set is never touched
+     * again.
+     */
+    for (i = 0; i < w->ramsizeMB * pagesPerMB; i++) {
+        memset(ram + i * PAGE_SIZE, 0, PAGE_SIZE);
+        dirty_page(w, ram + i * PAGE_SIZE, i, 0, &seed);
     }
 
-    before = now();
-
-    while (1) {
+    start = before = now();
 
-        ramptr = ram;
-        for (i = 0; i < ramsizeMB; i++, nMB++) {
+    for (pass = 1; ; pass++) {
+        for (i = 0; i < w->workingsetMB; i++, nMB++) {
             for (j = 0; j < pagesPerMB; j++) {
-                dataptr = data;
-                for (k = 0; k < PAGE_SIZE; k += sizeof(long long)) {
-                    ramptr += sizeof(long long);
-                    dataptr += sizeof(long long);
-                    *(unsigned long long *)ramptr ^= *(unsigned long long *)dataptr;
-                }
+                size_t index = i * pagesPerMB + j;
+
+                dirty_page(w, ram + index * PAGE_SIZE, index, pass, &seed);
             }
+            dirtiedMB++;
 
             if (nMB == 1024) {
                 after = now();
@@ -225,36 +229,55 @@ static int stressone(unsigned long long ramsizeMB)
                 before = now();
                 nMB = 0;
             }
+
+            if (w->dirtyrateMB) {
+                unsigned long long due = start +
+                    dirtiedMB * 1000 / w->dirtyrateMB;
+                unsigned long long cur = now();
+
+                if (due > cur) {
+                    usleep((due - cur) * 1000);
+                }
+            }
         }
     }
 
-    free(data);
     free(ram);
 }
 
 
 static void *stressthread(void *arg)
 {
-    unsigned long long ramsizeMB = *(unsigned long long *)arg;
-
-    stressone(ramsizeMB);
+    stressone(arg);
 
     return NULL;
 }
 
-static int stress(unsigned long long ramsizeGB, int ncpus)
+static int stress(unsigned long long ramsizeGB, int ncpus,
+                  unsigned long long workingsetMB,
+                  unsigned long long dirtyrateMB,
+                  unsigned int zeropercent, unsigned int comppercent)
 {
     size_t i;
-    unsigned long long ramsizeMB = ramsizeGB * 1024 / ncpus;
+    StressWorkload w = {
+        .ramsizeMB = ramsizeGB * 1024 / ncpus,
+        .zeropercent = zeropercent,
+        .comppercent = comppercent,
+    };
+
+    w.workingsetMB = workingsetMB ? MIN(workingsetMB / ncpus, w.ramsizeMB)
+                                  : w.ramsizeMB;
+    w.workingsetMB = MAX(w.workingsetMB, 1);
+    w.dirtyrateMB = dirtyrateMB ? MAX(dirtyrateMB / ncpus, 1) : 0;
     ncpus--;
 
     for (i = 0; i < ncpus; i++) {
         pthread_t thr;
         pthread_create(&thr, NULL,
-                       stressthread,   &ramsizeMB);
+                       stressthread, &w);
     }
 
-    stressone(ramsizeMB);
+    stressone(&w);
 
     return 0;
 }
@@ -293,16 +316,25 @@ static int mount_all(void)
 int main(int argc, char **argv)
 {
     unsigned long long ramsizeGB = 1;
+    unsigned long long workingsetMB = 0;
+    unsigned long long dirtyrateMB = 0;
+    unsigned long long zeropercent = 0;
+    unsigned long long comppercent = 0;
     char *end;
     int ch;
     int opt_ind = 0;
-    const char *sopt = "hr:c:";
+    const char *sopt = "hr:c:w:d:z:p:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "ramsize", required_argument, NULL, 'r' },
         { "cpus", required_argument, NULL, 'c' },
+        { "working-set", required_argument, NULL, 'w' },
+        { "dirty-rate", required_argument, NULL, 'd' },
+        { "zero-percent", required_argument, NULL, 'z' },
+        { "compressible-percent", required_argument, NULL, 'p' },
         { NULL, 0, NULL, 0 }
     };
+    unsigned long long *ullopt;
     int ret;
     int ncpus = 0;
 
@@ -330,9 +362,27 @@ int main(int argc, char **argv)
             }
             break;
 
+        case 'w':
+        case 'd':
+        case 'z':
+        case 'p':
+            ullopt = ch == 'w' ? &workingsetMB :
+                     ch == 'd' ? &dirtyrateMB :
+                     ch == 'z' ? &zeropercent : &comppercent;
+            errno = 0;
+            *ullopt = strtoll(optarg, &end, 10);
+            if (errno != 0 || *end) {
+                fprintf(stderr, "%s (%05d): ERROR: Cannot parse value %s\n",
+                        argv0, gettid(), optarg);
+                exit_failure();
+            }
+            break;
+
         case '?':
         case 'h':
-            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]\n", argv0);
+            fprintf(stderr, "%s: [--help][--ramsize GB][--cpus N]"
+                    "[--working-set MB][--dirty-rate MB/s]"
+                    "[--zero-percent N][--compressible-percent N]\n", argv0);
             exit_failure();
         }
     }
@@ -344,6 +394,18 @@ int main(int argc, char **argv)
         ret = get_command_arg_ull("ramsize", &ramsizeGB);
         if (ret < 0)
             exit_failure();
+        if (get_command_arg_ull("working-set", &workingsetMB) < 0 ||
+            get_command_arg_ull("dirty-rate", &dirtyrateMB) < 0 ||
+            get_command_arg_ull("zero-percent", &zeropercent) < 0 ||
+            get_command_arg_ull("compressible-percent", &comppercent) < 0) {
+            exit_failure();
+        }
+    }
+
+    if (zeropercent + comppercent > 100) {
+        fprintf(stderr, "%s (%05d): ERROR: zero and compressible pages "
+                "exceed 100%%\n", argv0, gettid());
+        exit_failure();
     }
 
     if (ncpus == 0)
@@ -351,8 +413,13 @@ int main(int argc, char **argv)
 
     fprintf(stdout, "%s (%05d): INFO: RAM %llu GiB across %d CPUs\n",
             argv0, gettid(), ramsizeGB, ncpus);
+    fprintf(stdout, "%s (%05d): INFO: working set %llu MiB, dirty rate %llu "
+            "MiB/s, %llu%% zero and %llu%% compressible pages\n",
+            argv0, gettid(), workingsetMB, dirtyrateMB, zeropercent,
+            comppercent);
 
-    if (stress(ramsizeGB, ncpus) < 0)
+    if (stress(ramsizeGB, ncpus, workingsetMB, dirtyrateMB,
+               zeropercent, comppercent) < 0)
         exit_failure();
 
     exit_success();
@@ -133,6 +133,60 @@ static void test_half_unshuffle64(void)
     }
 }
 
+#define FIND_TEST_WORDS 1024
+
+static unsigned long find_next_slow(const unsigned long *addr,
+                                    unsigned long size, unsigned long offset,
+                                    bool set)
+{
+    for (; offset < size; offset++) {
+        if (test_bit(offset, addr) == set) {
+            return offset;
+        }
+    }
+    return size;
+}
+
+static void test_find_next_one(unsigned long *addr)
+{
+    unsigned long size = g_test_rand_int_range(0, FIND_TEST_WORDS *
+                                                  BITS_PER_LONG + 1);
+    unsigned long offset = g_test_rand_int_range(0, size + 1);
+    unsigned long nwords = g_test_rand_int_range(0, FIND_TEST_WORDS + 1);
+    unsigned long i, count = 0;
+
+    g_assert_cmpint(find_next_bit(addr, size, offset), ==,
+                    find_next_slow(addr, size, offset, true));
+    g_assert_cmpint(find_next_zero_bit(addr, size, offset), ==,
+                    find_next_slow(addr, size, offset, false));
+
+    for (i = 0; i < nwords; i++) {
+        count += ctpopl(addr[i]);
+    }
+    g_assert_cmpint(bitops_count_ones(addr, nwords), ==, count);
+}
+
+static void test_find_next(void)
+{
+    unsigned long *addr = g_new(unsigned long, FIND_TEST_WORDS);
+    int i, j;
+
+    do {
+        for (i = 0; i < 1000; i++) {
+            /* mostly empty or mostly full bitmaps, with a few flipped bits */
+            memset(addr, g_test_rand_bit() ? 0xff : 0,
+                   FIND_TEST_WORDS * sizeof(unsigned long));
+            for (j = g_test_rand_int_range(0, 4); j > 0; j--) {
+                change_bit(g_test_rand_int_range(0, FIND_TEST_WORDS *
+                                                    BITS_PER_LONG), addr);
+            }
+            test_find_next_one(addr);
+        }
+    } while (test_bitops_next_accel());
+
+    g_free(addr);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -142,5 +196,6 @@ int main(int argc, char **argv)
     g_test_add_func("/bitops/half_shuffle64", test_half_shuffle64);
     g_test_add_func("/bitops/half_unshuffle32", test_half_unshuffle32);
     g_test_add_func("/bitops/half_unshuffle64", test_half_unshuffle64);
+    g_test_add_func("/bitops/find_next", test_find_next);
     return g_test_run();
 }
@@ -1233,6 +1233,45 @@ static void char_file_test(void)
     char_file_test_internal(NULL, NULL);
 }
 
+static void char_file_outbuf_test(void)
+{
+    char *tmp_path = g_dir_make_tmp("qemu-test-char.XXXXXX", NULL);
+    char *out = g_build_filename(tmp_path, "out", NULL);
+    char *contents = NULL;
+    ChardevFile file = {
+        .out = out,
+        .base.has_outbuf_size = true,
+        .base.outbuf_size = 8,
+    };
+    ChardevBackend backend = { .type = CHARDEV_BACKEND_KIND_FILE,
+                               .u.file.data = &file };
+    Chardev *chr;
+    gsize length;
+    int ret;
+
+    chr = qemu_chardev_new("outbuf-label", TYPE_CHARDEV_FILE, &backend,
+                           NULL, &error_abort);
+    g_assert_nonnull(chr->outbuf);
+
+    /* Larger than the buffer, so the write has to wait for the thread */
+    ret = qemu_chr_write_all(chr, (uint8_t *)"hello world!", 12);
+    g_assert_cmpint(ret, ==, 12);
+
+    /* Unparenting flushes what is left */
+    object_unparent(OBJECT(chr));
+
+    ret = g_file_get_contents(out, &contents, &length, NULL);
+    g_assert(ret == TRUE);
+    g_assert_cmpint(length, ==, 12);
+    g_assert(strncmp(contents, "hello world!", 12) == 0);
+
+    g_free(contents);
+    g_unlink(out);
+    g_rmdir(tmp_path);
+    g_free(tmp_path);
+    g_free(out);
+}
+
 static void char_null_test(void)
 {
     Error *err = NULL;
@@ -1398,6 +1437,7 @@ int main(int argc, char **argv)
     g_test_add_func("/char/pipe", char_pipe_test);
 #endif
     g_test_add_func("/char/file", char_file_test);
+    g_test_add_func("/char/file-outbuf", char_file_outbuf_test);
 #ifndef _WIN32
     g_test_add_func("/char/file-fifo", char_file_fifo_test);
 #endif
@@ -91,6 +91,54 @@ static void test_io_channel_fd(void)
     object_unref(OBJECT(ioc));
 }
 
+#ifdef CONFIG_PREADV
+static void test_io_channel_file_pwritev(void)
+{
+    QIOChannel *src, *dst;
+    char hello[] = "Hello";
+    char world[] = "World";
+    struct iovec iov[2] = {
+        { .iov_base = hello, .iov_len = 5 },
+        { .iov_base = world, .iov_len = 5 },
+    };
+    char buf[16];
+    ssize_t ret;
+
+    unlink(TEST_FILE);
+    src = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, TEST_MASK,
+                          &error_abort));
+    dst = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_RDONLY | O_BINARY, 0,
+                          &error_abort));
+    g_assert(qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_SEEKABLE));
+    g_assert(qio_channel_has_feature(dst, QIO_CHANNEL_FEATURE_SEEKABLE));
+
+    /* Write out of order; the file position must not move */
+    ret = qio_channel_pwrite(src, world, 5, 4096, &error_abort);
+    g_assert_cmpint(ret, ==, 5);
+    ret = qio_channel_pwritev(src, iov, 2, 0, &error_abort);
+    g_assert_cmpint(ret, ==, 10);
+    g_assert_cmpint(qio_channel_io_seek(src, 0, SEEK_CUR, &error_abort),
+                    ==, 0);
+
+    ret = qio_channel_pread(dst, buf, 10, 0, &error_abort);
+    g_assert_cmpint(ret, ==, 10);
+    g_assert(memcmp(buf, "HelloWorld", 10) == 0);
+    ret = qio_channel_pread(dst, buf, sizeof(buf), 4096, &error_abort);
+    g_assert_cmpint(ret, ==, 5);
+    g_assert(memcmp(buf, "World", 5) == 0);
+    ret = qio_channel_pread(dst, buf, sizeof(buf), 8192, &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+
+    unlink(TEST_FILE);
+    object_unref(OBJECT(src));
+    object_unref(OBJECT(dst));
+}
+#endif /* CONFIG_PREADV */
+
 
 #ifndef _WIN32
 static void test_io_channel_pipe(bool async)
@@ -106,6 +154,7 @@ static void test_io_channel_pipe(bool async)
 
     src = QIO_CHANNEL(qio_channel_file_new_fd(fd[1]));
     dst = QIO_CHANNEL(qio_channel_file_new_fd(fd[0]));
+    g_assert(!qio_channel_has_feature(src, QIO_CHANNEL_FEATURE_SEEKABLE));
 
     test = qio_channel_test_new();
     qio_channel_test_run_threads(test, async, src, dst);
@@ -137,6 +186,9 @@ int main(int argc, char **argv)
     g_test_add_func("/io/channel/file", test_io_channel_file);
     g_test_add_func("/io/channel/file/rdwr", test_io_channel_file_rdwr);
     g_test_add_func("/io/channel/file/fd", test_io_channel_fd);
+#ifdef CONFIG_PREADV
+    g_test_add_func("/io/channel/file/pwritev", test_io_channel_file_pwritev);
+#endif
 #ifndef _WIN32
     g_test_add_func("/io/channel/pipe/sync", test_io_channel_pipe_sync);
     g_test_add_func("/io/channel/pipe/async", test_io_channel_pipe_async);
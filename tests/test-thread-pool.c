@@ -222,6 +222,42 @@ static void do_test_cancel(bool sync)
     }
 }
 
+static void test_stats(void)
+{
+    WorkerTestData data = { .n = 0, .ret = -EINPROGRESS };
+    ThreadPoolStats before, after;
+
+    thread_pool_get_stats(pool, &before);
+
+    data.aiocb = thread_pool_submit_aio(pool, worker_cb, &data,
+                                        done_cb, &data);
+    active = 1;
+    while (data.ret == -EINPROGRESS) {
+        aio_poll(ctx, true);
+    }
+
+    thread_pool_get_stats(pool, &after);
+    g_assert_cmpuint(after.completed, ==, before.completed + 1);
+    g_assert_cmpint(after.queue_depth, ==, 0);
+    g_assert_cmpint(after.threads, >=, 1);
+}
+
+static void test_min_threads(void)
+{
+    ThreadPoolStats stats;
+
+    aio_context_set_thread_pool_params(ctx, 4, 8, &error_abort);
+
+    /* Workers that are still being spawned are counted too */
+    thread_pool_get_stats(pool, &stats);
+    g_assert_cmpint(stats.threads, >=, 4);
+    g_assert_cmpint(stats.threads, <=, 8);
+
+    aio_context_set_thread_pool_params(ctx, 0,
+                                       THREAD_POOL_MAX_THREADS_DEFAULT,
+                                       &error_abort);
+}
+
 static void test_cancel(void)
 {
     do_test_cancel(true);
@@ -243,6 +279,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/stats", test_stats);
+    g_test_add_func("/thread-pool/min-threads", test_min_threads);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
@@ -174,6 +174,78 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_PAGES 256
+
+/* Derive a page from @old_buf with runs of changed bytes of many lengths */
+static int encode_accel_page(int seed, uint8_t *old_buf, uint8_t *new_buf,
+                             uint8_t *compressed)
+{
+    GRand *rand = g_rand_new_with_seed(seed);
+    int dlen = seed % 2 ? PAGE_SIZE : g_rand_int_range(rand, 0, 1024);
+    int i, j;
+
+    memcpy(new_buf, old_buf, PAGE_SIZE);
+    for (i = g_rand_int_range(rand, 0, 64); i > 0; i--) {
+        int start = g_rand_int_range(rand, 0, PAGE_SIZE);
+        int len = g_rand_int_range(rand, 1, 2 << (i % 10));
+
+        for (j = start; j < start + len && j < PAGE_SIZE; j++) {
+            new_buf[j] = old_buf[j] + g_rand_int_range(rand, 0, 2);
+        }
+    }
+    g_rand_free(rand);
+
+    return xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, compressed,
+                                dlen);
+}
+
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE);
+    uint8_t *decoded = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *ref = g_malloc(ACCEL_PAGES * PAGE_SIZE);
+    int ref_len[ACCEL_PAGES];
+    int i, rc;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+
+    /* The preferred encoder gives the reference, check it decodes back */
+    for (i = 0; i < ACCEL_PAGES; i++) {
+        ref_len[i] = encode_accel_page(i, old_buf, new_buf,
+                                       ref + i * PAGE_SIZE);
+        if (ref_len[i] >= 0) {
+            memcpy(decoded, old_buf, PAGE_SIZE);
+            rc = xbzrle_decode_buffer(ref + i * PAGE_SIZE, ref_len[i],
+                                      decoded, PAGE_SIZE);
+            g_assert(rc >= 0);
+            g_assert(memcmp(decoded, new_buf, PAGE_SIZE) == 0);
+        } else {
+            g_assert(ref_len[i] == -1);
+        }
+    }
+
+    /* All the other encoders usable on this host must agree with it */
+    while (test_xbzrle_encode_next_accel()) {
+        for (i = 0; i < ACCEL_PAGES; i++) {
+            rc = encode_accel_page(i, old_buf, new_buf, compressed);
+            g_assert_cmpint(rc, ==, ref_len[i]);
+            if (rc > 0) {
+                g_assert(memcmp(compressed, ref + i * PAGE_SIZE, rc) == 0);
+            }
+        }
+    }
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(decoded);
+    g_free(compressed);
+    g_free(ref);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +258,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
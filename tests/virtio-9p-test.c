@@ -101,6 +101,12 @@ static void v9fs_uint32_read(P9Req *req, uint32_t *val)
     le32_to_cpus(val);
 }
 
+static void v9fs_uint64_read(P9Req *req, uint64_t *val)
+{
+    v9fs_memread(req, val, 8);
+    le64_to_cpus(val);
+}
+
 /* len[2] string[len] */
 static uint16_t v9fs_string_size(const char *string)
 {
@@ -375,6 +381,52 @@ static void v9fs_rlopen(P9Req *req, v9fs_qid *qid, uint32_t *iounit)
     v9fs_req_free(req);
 }
 
+/* size[4] Treaddir tag[2] fid[4] offset[8] count[4] */
+static P9Req *v9fs_treaddir(QVirtio9P *v9p, uint32_t fid, uint64_t offset,
+                            uint32_t count, uint16_t tag)
+{
+    P9Req *req;
+
+    req = v9fs_req_init(v9p, 4 + 8 + 4, P9_TREADDIR, tag);
+    v9fs_uint32_write(req, fid);
+    v9fs_uint64_write(req, offset);
+    v9fs_uint32_write(req, count);
+    v9fs_req_send(req);
+    return req;
+}
+
+/*
+ * size[4] Rreaddir tag[2] count[4] data[count]
+ * data: count*(qid[13] offset[8] type[1] name[s])
+ *
+ * Returns the number of entries, @names gets their names appended and
+ * @offset the offset of the last entry.
+ */
+static uint32_t v9fs_rreaddir(P9Req *req, GPtrArray *names, uint64_t *offset)
+{
+    uint32_t count, nentries = 0;
+    size_t end;
+
+    v9fs_req_recv(req, P9_RREADDIR);
+    v9fs_uint32_read(req, &count);
+    end = req->r_off + count;
+    while (req->r_off < end) {
+        uint16_t len;
+        char *name;
+
+        v9fs_memskip(req, 13);
+        v9fs_uint64_read(req, offset);
+        v9fs_memskip(req, 1);
+        v9fs_string_read(req, &len, &name);
+        g_ptr_array_add(names, g_strndup(name, len));
+        g_free(name);
+        nentries++;
+    }
+    g_assert_cmpint(req->r_off, ==, end);
+    v9fs_req_free(req);
+    return nentries;
+}
+
 /* size[4] Twrite tag[2] fid[4] offset[8] count[4] data[count] */
 static P9Req *v9fs_twrite(QVirtio9P *v9p, uint32_t fid, uint64_t offset,
                           uint32_t count, const void *data, uint16_t tag)
@@ -539,6 +591,92 @@ static void fs_lopen(void *obj, void *data, QGuestAllocator *t_alloc)
     g_free(wnames[0]);
 }
 
+static bool fs_readdir_has_name(GPtrArray *names, const char *name)
+{
+    int i;
+
+    for (i = 0; i < names->len; i++) {
+        if (!strcmp(g_ptr_array_index(names, i), name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fs_readdir_check_names(GPtrArray *names)
+{
+    int i;
+
+    g_assert_cmpint(names->len, ==, QTEST_V9FS_SYNTH_READDIR_NFILES + 2);
+    g_assert(fs_readdir_has_name(names, "."));
+    g_assert(fs_readdir_has_name(names, ".."));
+    for (i = 0; i < QTEST_V9FS_SYNTH_READDIR_NFILES; i++) {
+        char *name = g_strdup_printf(QTEST_V9FS_SYNTH_READDIR_FILE, i);
+
+        g_assert(fs_readdir_has_name(names, name));
+        g_free(name);
+    }
+}
+
+static void fs_readdir_open(QVirtio9P *v9p, QGuestAllocator *t_alloc)
+{
+    char *const wnames[] = { g_strdup(QTEST_V9FS_SYNTH_READDIR_DIR) };
+    P9Req *req;
+
+    fs_attach(v9p, NULL, t_alloc);
+    req = v9fs_twalk(v9p, 0, 1, 1, wnames, 0);
+    v9fs_req_wait_for_reply(req, NULL);
+    v9fs_rwalk(req, NULL, NULL);
+
+    req = v9fs_tlopen(v9p, 1, O_DIRECTORY, 0);
+    v9fs_req_wait_for_reply(req, NULL);
+    v9fs_rlopen(req, NULL, NULL);
+
+    g_free(wnames[0]);
+}
+
+static void fs_readdir(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtio9P *v9p = obj;
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    uint64_t offset = 0;
+    P9Req *req;
+
+    alloc = t_alloc;
+    fs_readdir_open(v9p, t_alloc);
+
+    /* All entries fit in a single response */
+    req = v9fs_treaddir(v9p, 1, 0, P9_MAX_SIZE - P9_IOHDRSZ, 0);
+    v9fs_req_wait_for_reply(req, NULL);
+    v9fs_rreaddir(req, names, &offset);
+
+    fs_readdir_check_names(names);
+    g_ptr_array_free(names, true);
+}
+
+static void fs_readdir_split(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtio9P *v9p = obj;
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    uint64_t offset = 0;
+    P9Req *req;
+
+    alloc = t_alloc;
+    fs_readdir_open(v9p, t_alloc);
+
+    /* Entries that don't fit must be returned by the next request */
+    while (true) {
+        req = v9fs_treaddir(v9p, 1, offset, 256, 0);
+        v9fs_req_wait_for_reply(req, NULL);
+        if (!v9fs_rreaddir(req, names, &offset)) {
+            break;
+        }
+    }
+
+    fs_readdir_check_names(names);
+    g_ptr_array_free(names, true);
+}
+
 static void fs_write(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtio9P *v9p = obj;
@@ -652,6 +790,8 @@ static void register_virtio_9p_test(void)
     qos_add_test("fs/walk/dotdot_from_root", "virtio-9p",
                  fs_walk_dotdot, NULL);
     qos_add_test("fs/lopen/basic", "virtio-9p", fs_lopen, NULL);
+    qos_add_test("fs/readdir/basic", "virtio-9p", fs_readdir, NULL);
+    qos_add_test("fs/readdir/split", "virtio-9p", fs_readdir_split, NULL);
     qos_add_test("fs/write/basic", "virtio-9p", fs_write, NULL);
     qos_add_test("fs/flush/success", "virtio-9p", fs_flush_success,
                  NULL);
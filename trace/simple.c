@@ -30,9 +30,6 @@
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
-
 /*
  * Trace records are written out by a dedicated thread.  The thread waits for
  * records to become available, writes them out, and then waits again.
@@ -45,14 +42,35 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/*
+ * Each thread that emits trace events gets its own ring buffer, so that
+ * producers never share a cache line.  The owner thread is the only writer
+ * of @head and the writeout thread the only writer of @tail; records in
+ * [tail, head) are complete and may be consumed.  Buffers are linked into
+ * trace_thread_bufs when created and are only unlinked (and freed) by the
+ * writeout thread, after their owner has exited and they have been drained.
+ */
+typedef struct TraceThreadBuf TraceThreadBuf;
+struct TraceThreadBuf {
+    TraceThreadBuf *next;
+    unsigned int head;
+    bool busy;              /* a record is being written by the owner */
+    bool dead;              /* the owner has exited */
+    int dropped;
+    /* keep the consumer's index away from the producer's */
+    unsigned int tail QEMU_ALIGNED(64);
+    uint8_t data[TRACE_BUF_LEN] QEMU_ALIGNED(64);
+};
+
+static TraceThreadBuf *trace_thread_bufs;
+static __thread TraceThreadBuf *trace_tbuf;
+static void trace_thread_buf_release(gpointer opaque);
+static GPrivate trace_tbuf_key = G_PRIVATE_INIT(trace_thread_buf_release);
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -76,52 +94,57 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceThreadBuf *tb, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuf *tb, unsigned int idx,
+                                    void *dataptr, size_t size);
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void trace_thread_buf_release(gpointer opaque)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
+    TraceThreadBuf *tb = opaque;
+
+    trace_tbuf = NULL;
+    atomic_store_release(&tb->dead, true);
+}
+
+static TraceThreadBuf *trace_thread_buf_get(void)
+{
+    TraceThreadBuf *tb = trace_tbuf;
+
+    if (likely(tb)) {
+        return tb;
     }
+
+    /* don't use g_malloc, can deadlock when traced */
+    tb = calloc(1, sizeof(*tb));
+    if (!tb) {
+        return NULL;
+    }
+    do {
+        tb->next = atomic_read(&trace_thread_bufs);
+    } while (atomic_cmpxchg(&trace_thread_bufs, tb->next, tb) != tb->next);
+
+    trace_tbuf = tb;
+    g_private_set(&trace_tbuf_key, tb);
+    return tb;
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Read the header of the oldest unconsumed record of a thread buffer
  *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * @tb          Thread buffer
+ * @head        Producer index as sampled by the caller
+ * @record      Trace record header to fill
  *
- * Returns false if the record is not valid.
+ * Returns false if there are no records left before @head.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool peek_trace_record(TraceThreadBuf *tb, unsigned int head,
+                              TraceRecord *record)
 {
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
-
-    if (!(record.event & TRACE_RECORD_VALID)) {
+    if (tb->tail == head) {
         return false;
     }
-
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
+    read_from_buffer(tb, tb->tail, record, sizeof(*record));
     return true;
 }
 
@@ -154,128 +177,219 @@ static void wait_for_trace_records_available(void)
     g_mutex_unlock(&trace_lock);
 }
 
+/* Unlink and free the buffers of exited threads once they are drained */
+static void reap_thread_bufs(void)
+{
+    TraceThreadBuf **prev = &trace_thread_bufs;
+    TraceThreadBuf *tb;
+
+    while ((tb = atomic_read(prev))) {
+        if (!atomic_load_acquire(&tb->dead) ||
+            tb->tail != atomic_load_acquire(&tb->head)) {
+            prev = &tb->next;
+            continue;
+        }
+        /* producers only ever push at the list head */
+        if (prev == &trace_thread_bufs &&
+            atomic_cmpxchg(&trace_thread_bufs, tb, tb->next) != tb) {
+            /* a new buffer was pushed in front of us; look again */
+            prev = &trace_thread_bufs;
+            continue;
+        }
+        if (prev != &trace_thread_bufs) {
+            *prev = tb->next;
+        }
+        free(tb);
+    }
+}
+
 static gpointer writeout_thread(gpointer opaque)
 {
-    TraceRecord *recordptr;
+    TraceRecord *recordptr = NULL;
+    size_t record_size = 0;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
+    unsigned int nbufs;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
 
     for (;;) {
+        TraceThreadBuf *tb;
+
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        /*
+         * Snapshot every thread's producer index, and count the events
+         * that were dropped because a thread buffer was full.
+         */
+        dropped_count = 0;
+        nbufs = 0;
+        for (tb = atomic_load_acquire(&trace_thread_bufs); tb; tb = tb->next) {
+            nbufs++;
+            if (atomic_read(&tb->dropped)) {
+                dropped_count += atomic_xchg(&tb->dropped, 0);
+            }
+        }
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID;
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+        if (nbufs) {
+            TraceThreadBuf **bufs = malloc(nbufs * sizeof(*bufs));
+            unsigned int *heads = malloc(nbufs * sizeof(*heads));
+            unsigned int i, n = 0;
+
+            for (tb = atomic_load_acquire(&trace_thread_bufs); tb && n < nbufs;
+                 tb = tb->next) {
+                bufs[n] = tb;
+                heads[n] = atomic_load_acquire(&tb->head);
+                n++;
+            }
+
+            /*
+             * Merge the records that were complete when we sampled the
+             * heads, oldest first.  Each thread buffer is already sorted.
+             */
+            for (;;) {
+                TraceRecord hdr, best_hdr;
+                int best = -1;
+
+                for (i = 0; i < n; i++) {
+                    if (peek_trace_record(bufs[i], heads[i], &hdr) &&
+                        (best < 0 ||
+                         hdr.timestamp_ns < best_hdr.timestamp_ns)) {
+                        best = i;
+                        best_hdr = hdr;
+                    }
+                }
+                if (best < 0) {
+                    break;
+                }
+
+                tb = bufs[best];
+                if (best_hdr.length > record_size) {
+                    /* don't use g_realloc, can deadlock when traced */
+                    free(recordptr);
+                    record_size = best_hdr.length;
+                    recordptr = malloc(record_size);
+                }
+                read_from_buffer(tb, tb->tail, recordptr, best_hdr.length);
+                atomic_store_release(&tb->tail, tb->tail + best_hdr.length);
+
+                unused = fwrite(&type, sizeof(type), 1, trace_fp);
+                unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
+            }
+
+            free(heads);
+            free(bufs);
         }
 
         fflush(trace_fp);
+        reap_thread_bufs();
     }
     return NULL;
 }
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(trace_tbuf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(trace_tbuf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(trace_tbuf, rec->rec_off, (void *)s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *tb = trace_thread_buf_get();
+    unsigned int idx, rec_off;
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
     uint64_t timestamp_ns = get_clock();
 
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    if (!tb) {
+        return -ENOMEM;
+    }
+
+    /*
+     * A trace event from a signal handler can interrupt a record being
+     * written by the same thread; there is no room for it in that case.
+     */
+    if (tb->busy) {
+        atomic_inc(&tb->dropped);
+        return -ENOSPC;
+    }
+    tb->busy = true;
+    barrier();
+
+    if (tb->head + rec_len - atomic_load_acquire(&tb->tail) > TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        tb->busy = false;
+        atomic_inc(&tb->dropped);
+        return -ENOSPC;
+    }
 
-    idx = old_idx % TRACE_BUF_LEN;
+    idx = tb->head;
 
     rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = write_to_buffer(tb, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(tb, rec_off, &timestamp_ns, sizeof(timestamp_ns));
+    rec_off = write_to_buffer(tb, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(tb, rec_off, &trace_pid, sizeof(trace_pid));
 
     rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    rec->rec_off  = rec_off;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuf *tb, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t len = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(data_ptr, &tb->data[off], len);
+    memcpy(data_ptr + len, tb->data, size - len);
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuf *tb, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
+    unsigned int off = idx % TRACE_BUF_LEN;
+    size_t len = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(&tb->data[off], data_ptr, len);
+    memcpy(tb->data, data_ptr + len, size - len);
+    return idx + size; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    TraceThreadBuf *tb = trace_tbuf;
+
+    /* publish the record to the writeout thread */
+    atomic_store_release(&tb->head, rec->rec_off);
+    barrier();
+    tb->busy = false;
+
+    if (rec->rec_off - atomic_read(&tb->tail) > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
 }
@@ -136,6 +136,9 @@ struct QemuConsole {
     QEMUTimer *ui_timer;
     const GraphicHwOps *hw_ops;
     void *hw;
+    /* updates reported during gfx_update, sent merged at the end */
+    int damage_batch;
+    pixman_region32_t damage;
 
     /* Text console state */
     int width;
@@ -259,13 +262,19 @@ static void gui_setup_refresh(DisplayState *ds)
     ds->have_text = have_text;
 }
 
+static void dpy_gfx_flush_damage(QemuConsole *con);
+
 void graphic_hw_update(QemuConsole *con)
 {
     if (!con) {
         con = active_console;
     }
     if (con && con->hw_ops->gfx_update) {
+        con->damage_batch++;
         con->hw_ops->gfx_update(con->hw);
+        if (--con->damage_batch == 0) {
+            dpy_gfx_flush_damage(con);
+        }
     }
 }
 
@@ -1291,6 +1300,7 @@ static QemuConsole *new_console(DisplayState *ds, console_type_t console_type,
     obj = object_new(TYPE_QEMU_CONSOLE);
     s = QEMU_CONSOLE(obj);
     s->head = head;
+    pixman_region32_init(&s->damage);
     object_property_add_link(obj, "device", TYPE_DEVICE,
                              (Object **)&s->device,
                              object_property_allow_set_link,
@@ -1533,10 +1543,56 @@ int dpy_set_ui_info(QemuConsole *con, QemuUIInfo *info)
     return 0;
 }
 
-void dpy_gfx_update(QemuConsole *con, int x, int y, int w, int h)
+static void dpy_gfx_update_listeners(QemuConsole *con,
+                                     int x, int y, int w, int h)
 {
     DisplayState *s = con->ds;
     DisplayChangeListener *dcl;
+
+    if (!qemu_console_is_visible(con)) {
+        return;
+    }
+    QLIST_FOREACH(dcl, &s->listeners, next) {
+        if (con != (dcl->con ? dcl->con : active_console)) {
+            continue;
+        }
+        if (dcl->ops->dpy_gfx_update) {
+            dcl->ops->dpy_gfx_update(dcl, x, y, w, h);
+        }
+    }
+}
+
+/*
+ * Past this many rectangles, listeners get the bounding box instead, so
+ * that the work done for one device update pass stays bounded.
+ */
+#define CONSOLE_DAMAGE_MAX_RECTS 16
+
+static void dpy_gfx_flush_damage(QemuConsole *con)
+{
+    pixman_box32_t *rects;
+    int i, n;
+
+    if (!pixman_region32_not_empty(&con->damage)) {
+        return;
+    }
+
+    rects = pixman_region32_rectangles(&con->damage, &n);
+    if (n > CONSOLE_DAMAGE_MAX_RECTS) {
+        rects = pixman_region32_extents(&con->damage);
+        n = 1;
+    }
+    for (i = 0; i < n; i++) {
+        dpy_gfx_update_listeners(con, rects[i].x1, rects[i].y1,
+                                 rects[i].x2 - rects[i].x1,
+                                 rects[i].y2 - rects[i].y1);
+    }
+    pixman_region32_fini(&con->damage);
+    pixman_region32_init(&con->damage);
+}
+
+void dpy_gfx_update(QemuConsole *con, int x, int y, int w, int h)
+{
     int width = w;
     int height = h;
 
@@ -1551,17 +1607,14 @@ void dpy_gfx_update(QemuConsole *con, int x, int y, int w, int h)
     w = MIN(w, width - x);
     h = MIN(h, height - y);
 
-    if (!qemu_console_is_visible(con)) {
-        return;
-    }
-    QLIST_FOREACH(dcl, &s->listeners, next) {
-        if (con != (dcl->con ? dcl->con : active_console)) {
-            continue;
-        }
-        if (dcl->ops->dpy_gfx_update) {
-            dcl->ops->dpy_gfx_update(dcl, x, y, w, h);
+    if (con->damage_batch) {
+        if (w > 0 && h > 0) {
+            pixman_region32_union_rect(&con->damage, &con->damage,
+                                       x, y, w, h);
         }
+        return;
     }
+    dpy_gfx_update_listeners(con, x, y, w, h);
 }
 
 void dpy_gfx_update_full(QemuConsole *con)
@@ -1583,6 +1636,9 @@ void dpy_gfx_replace_surface(QemuConsole *con,
 
     assert(old_surface != surface || surface == NULL);
 
+    /* listeners redraw everything on a switch */
+    pixman_region32_fini(&con->damage);
+    pixman_region32_init(&con->damage);
     con->surface = surface;
     QLIST_FOREACH(dcl, &s->listeners, next) {
         if (con != (dcl->con ? dcl->con : active_console)) {
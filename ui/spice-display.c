@@ -115,6 +115,50 @@ void qemu_spice_wakeup(SimpleSpiceDisplay *ssd)
     spice_qxl_wakeup(&ssd->qxl);
 }
 
+#define SPICE_UPDATE_POOL_MAX 64
+
+static SimpleSpiceUpdate *qemu_spice_get_update(SimpleSpiceDisplay *ssd,
+                                                size_t bitmap_size)
+{
+    SimpleSpiceUpdate *update, *next;
+    QSLIST_HEAD(, SimpleSpiceUpdate) released;
+    uint8_t *bitmap;
+    size_t size;
+
+    if (QSLIST_EMPTY(&ssd->update_pool)) {
+        QSLIST_MOVE_ATOMIC(&released, &ssd->free_updates);
+        QSLIST_FOREACH_SAFE(update, &released, free_next, next) {
+            if (ssd->update_pool_size < SPICE_UPDATE_POOL_MAX) {
+                QSLIST_INSERT_HEAD(&ssd->update_pool, update, free_next);
+                ssd->update_pool_size++;
+            } else {
+                g_free(update->bitmap);
+                g_free(update);
+            }
+        }
+    }
+
+    update = QSLIST_FIRST(&ssd->update_pool);
+    if (update) {
+        QSLIST_REMOVE_HEAD(&ssd->update_pool, free_next);
+        ssd->update_pool_size--;
+        bitmap = update->bitmap;
+        size = update->bitmap_size;
+        memset(update, 0, sizeof(*update));
+        update->bitmap = bitmap;
+        update->bitmap_size = size;
+    } else {
+        update = g_new0(SimpleSpiceUpdate, 1);
+    }
+
+    if (update->bitmap_size < bitmap_size) {
+        g_free(update->bitmap);
+        update->bitmap = g_malloc(bitmap_size);
+        update->bitmap_size = bitmap_size;
+    }
+    return update;
+}
+
 static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
                                          QXLRect *rect)
 {
@@ -130,15 +174,14 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
            rect->left, rect->right,
            rect->top, rect->bottom);
 
-    update   = g_malloc0(sizeof(*update));
+    bw       = rect->right - rect->left;
+    bh       = rect->bottom - rect->top;
+
+    update   = qemu_spice_get_update(ssd, bw * bh * 4);
     drawable = &update->drawable;
     image    = &update->image;
     cmd      = &update->ext.cmd;
 
-    bw       = rect->right - rect->left;
-    bh       = rect->bottom - rect->top;
-    update->bitmap = g_malloc(bw * bh * 4);
-
     drawable->bbox            = *rect;
     drawable->clip.type       = SPICE_CLIP_TYPE_NONE;
     drawable->effect          = QXL_EFFECT_OPAQUE;
@@ -183,6 +226,24 @@ static void qemu_spice_create_one_update(SimpleSpiceDisplay *ssd,
     QTAILQ_INSERT_TAIL(&ssd->updates, update, next);
 }
 
+/*
+ * Merge a dirty block with the pending one if they cover the same rows and
+ * are horizontally adjacent, otherwise send the pending one.
+ */
+static void qemu_spice_queue_update(SimpleSpiceDisplay *ssd, QXLRect *pending,
+                                    const QXLRect *rect)
+{
+    if (!qemu_spice_rect_is_empty(pending)) {
+        if (pending->top == rect->top && pending->bottom == rect->bottom &&
+            pending->right == rect->left) {
+            pending->right = rect->right;
+            return;
+        }
+        qemu_spice_create_one_update(ssd, pending);
+    }
+    *pending = *rect;
+}
+
 static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
 {
     static const int blksize = 32;
@@ -191,6 +252,7 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
     int y, yoff1, yoff2, x, xoff, blk, bw;
     int bpp = surface_bytes_per_pixel(ssd->ds);
     uint8_t *guest, *mirror;
+    QXLRect pending = { 0 };
 
     if (qemu_spice_rect_is_empty(&ssd->dirty)) {
         return;
@@ -219,7 +281,7 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
                         .left   = x,
                         .right  = x + bw,
                     };
-                    qemu_spice_create_one_update(ssd, &update);
+                    qemu_spice_queue_update(ssd, &pending, &update);
                     dirty_top[blk] = -1;
                 }
             } else {
@@ -240,10 +302,13 @@ static void qemu_spice_create_update(SimpleSpiceDisplay *ssd)
                 .left   = x,
                 .right  = x + bw,
             };
-            qemu_spice_create_one_update(ssd, &update);
+            qemu_spice_queue_update(ssd, &pending, &update);
             dirty_top[blk] = -1;
         }
     }
+    if (!qemu_spice_rect_is_empty(&pending)) {
+        qemu_spice_create_one_update(ssd, &pending);
+    }
 
     memset(&ssd->dirty, 0, sizeof(ssd->dirty));
 }
@@ -298,12 +363,12 @@ qemu_spice_create_cursor_update(SimpleSpiceDisplay *ssd,
  * Called from spice server thread context (via interface_release_resource)
  * We do *not* hold the global qemu mutex here, so extra care is needed
  * when calling qemu functions.  QEMU interfaces used:
- *    - g_free (underlying glibc free is re-entrant).
+ *    - QSLIST_INSERT_HEAD_ATOMIC, the update is handed back to the
+ *      iothread for reuse by qemu_spice_get_update().
  */
 void qemu_spice_destroy_update(SimpleSpiceDisplay *sdpy, SimpleSpiceUpdate *update)
 {
-    g_free(update->bitmap);
-    g_free(update);
+    QSLIST_INSERT_HEAD_ATOMIC(&sdpy->free_updates, update, free_next);
 }
 
 void qemu_spice_create_host_memslot(SimpleSpiceDisplay *ssd)
@@ -816,6 +816,25 @@ static int tight_init_stream(VncState *vs, int stream_id,
     return 0;
 }
 
+/*
+ * Write the compression control byte for a rectangle whose data goes
+ * through zlib stream @stream_id.  If our side of the stream has been
+ * restarted, ask the client to reset its decompressor too.
+ */
+static void tight_send_stream_control(VncState *vs, int stream_id, int ctl)
+{
+    VncTight *tight = vs->tight;
+
+    if (tight->stream_reset & (1 << stream_id)) {
+        if (tight->stream[stream_id].opaque) {
+            deflateReset(&tight->stream[stream_id]);
+        }
+        tight->stream_reset &= ~(1 << stream_id);
+        ctl |= 1 << stream_id;
+    }
+    vnc_write_u8(vs, ctl);
+}
+
 static void tight_send_compact_size(VncState *vs, size_t len)
 {
     int lpc = 0;
@@ -925,7 +944,7 @@ static int send_full_color_rect(VncState *vs, int x, int y, int w, int h)
     }
 #endif
 
-    vnc_write_u8(vs, stream << 4); /* no flushing, no filter */
+    tight_send_stream_control(vs, stream, stream << 4); /* no filter */
 
     if (vs->tight->pixel24) {
         tight_pack24(vs, vs->tight->tight.buffer, w * h,
@@ -982,7 +1001,8 @@ static int send_mono_rect(VncState *vs, int x, int y,
 
     bytes = DIV_ROUND_UP(w, 8) * h;
 
-    vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
+    tight_send_stream_control(vs, stream,
+                              (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
     vnc_write_u8(vs, VNC_TIGHT_FILTER_PALETTE);
     vnc_write_u8(vs, 1);
 
@@ -1048,7 +1068,8 @@ static bool send_gradient_rect(VncState *vs, int x, int y, int w, int h)
         return send_full_color_rect(vs, x, y, w, h);
     }
 
-    vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
+    tight_send_stream_control(vs, stream,
+                              (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
     vnc_write_u8(vs, VNC_TIGHT_FILTER_GRADIENT);
 
     buffer_reserve(&vs->tight->gradient, w * 3 * sizeof(int));
@@ -1090,7 +1111,8 @@ static int send_palette_rect(VncState *vs, int x, int y,
 
     colors = palette_size(palette);
 
-    vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
+    tight_send_stream_control(vs, stream,
+                              (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
     vnc_write_u8(vs, VNC_TIGHT_FILTER_PALETTE);
     vnc_write_u8(vs, colors - 1);
 
@@ -50,6 +50,14 @@
  * its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * If the display has more than one encoder thread, the worker splits the
+ * job's rectangles into tiles and encodes them together with the encoder
+ * threads, still under the VncDisplay lock.  Each encoder has a private
+ * copy of the client state, and the tiles are put back together in order
+ * once all of them are done.  This is only done for encodings that either
+ * have no state kept across rectangles or, like tight, can tell the client
+ * to restart its zlib streams at the beginning of every tile.
  */
 
 struct VncJobQueue {
@@ -68,6 +76,39 @@ typedef struct VncJobQueue VncJobQueue;
  */
 static VncJobQueue *queue;
 
+#define VNC_TILE_WIDTH  256
+#define VNC_TILE_HEIGHT 128
+
+typedef struct VncTile {
+    VncRect rect;
+    Buffer output;
+    int n;
+} VncTile;
+
+/* Private client state used to encode tiles in one thread */
+typedef struct VncEncoder {
+    VncState vs;
+    VncTight tight;
+    QemuThread thread;
+} VncEncoder;
+
+typedef struct VncEncoderPool {
+    QemuMutex mutex;
+    QemuCond cond;          /* signalled when new tiles are queued */
+    QemuCond done_cond;     /* signalled when the last tile is done */
+    int nthreads;
+    VncEncoder encoder;     /* used by the vnc_worker thread itself */
+
+    /* Current batch, protected by mutex */
+    VncState *orig;
+    VncTile *tiles;
+    int n_tiles;
+    int next_tile;
+    int pending;
+} VncEncoderPool;
+
+static VncEncoderPool *pool;
+
 static void vnc_lock_queue(VncJobQueue *queue)
 {
     qemu_mutex_lock(&queue->mutex);
@@ -201,6 +242,167 @@ static void vnc_async_encoding_end(VncState *orig, VncState *local)
     orig->lossy_rect = local->lossy_rect;
 }
 
+static void vnc_tile_encoding_start(VncState *orig, VncEncoder *encoder)
+{
+    VncState *local = &encoder->vs;
+
+    local->magic = VNC_MAGIC;
+    local->vnc_encoding = orig->vnc_encoding;
+    local->features = orig->features;
+    local->vd = orig->vd;
+    local->lossy_rect = orig->lossy_rect;
+    local->write_pixels = orig->write_pixels;
+    local->client_pf = orig->client_pf;
+    local->client_be = orig->client_be;
+    local->hextile = orig->hextile;
+
+    local->tight = &encoder->tight;
+    local->tight->quality = orig->tight->quality;
+    local->tight->compression = orig->tight->compression;
+    /* Tiles can be decoded in any order relative to our streams */
+    local->tight->stream_reset = 0x0f;
+}
+
+/* Called with pool->mutex held, encodes tiles until none is left */
+static void vnc_encoder_run_locked(VncEncoder *encoder)
+{
+    while (pool->next_tile < pool->n_tiles) {
+        VncTile *tile = &pool->tiles[pool->next_tile++];
+
+        vnc_tile_encoding_start(pool->orig, encoder);
+        qemu_mutex_unlock(&pool->mutex);
+
+        tile->n = vnc_send_framebuffer_update(&encoder->vs,
+                                              tile->rect.x, tile->rect.y,
+                                              tile->rect.w, tile->rect.h);
+        buffer_move(&tile->output, &encoder->vs.output);
+
+        qemu_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) {
+            qemu_cond_signal(&pool->done_cond);
+        }
+    }
+}
+
+static void *vnc_encoder_thread(void *arg)
+{
+    VncEncoder *encoder = arg;
+
+    buffer_init(&encoder->vs.output, "vnc-encoder-output");
+    qemu_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->next_tile == pool->n_tiles) {
+            qemu_cond_wait(&pool->cond, &pool->mutex);
+        }
+        vnc_encoder_run_locked(encoder);
+    }
+    return NULL;
+}
+
+static bool vnc_can_encode_tiles(VncState *vs)
+{
+    if (!pool || vs->vd->encoder_threads <= 1) {
+        return false;
+    }
+
+    /* These keep a single zlib stream that the client cannot reset */
+    switch (vs->vnc_encoding) {
+    case VNC_ENCODING_ZLIB:
+    case VNC_ENCODING_ZRLE:
+    case VNC_ENCODING_ZYWRLE:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static int vnc_count_tiles(VncRect *rect)
+{
+    int cols = DIV_ROUND_UP(rect->x + rect->w, VNC_TILE_WIDTH) -
+               rect->x / VNC_TILE_WIDTH;
+    int rows = DIV_ROUND_UP(rect->y + rect->h, VNC_TILE_HEIGHT) -
+               rect->y / VNC_TILE_HEIGHT;
+
+    return cols * rows;
+}
+
+/*
+ * Encode all rectangles of @job into @vs->output, using the encoder
+ * threads.  Tiles are aligned to VNC_TILE_WIDTH x VNC_TILE_HEIGHT screen
+ * blocks, so that different tiles never update the same lossy_rect cell.
+ */
+static int vnc_encode_tiles(VncState *vs, VncJob *job)
+{
+    VncRectEntry *entry, *tmp;
+    VncTile *tiles;
+    int n_tiles = 0;
+    int i, x, y, n = 0;
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        n_tiles += vnc_count_tiles(&entry->rect);
+    }
+    tiles = g_new0(VncTile, n_tiles);
+
+    i = 0;
+    QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
+        VncRect *r = &entry->rect;
+
+        for (y = r->y; y < r->y + r->h;
+             y = QEMU_ALIGN_DOWN(y, VNC_TILE_HEIGHT) + VNC_TILE_HEIGHT) {
+            int y2 = MIN(QEMU_ALIGN_DOWN(y, VNC_TILE_HEIGHT) + VNC_TILE_HEIGHT,
+                         r->y + r->h);
+
+            for (x = r->x; x < r->x + r->w;
+                 x = QEMU_ALIGN_DOWN(x, VNC_TILE_WIDTH) + VNC_TILE_WIDTH) {
+                int x2 = MIN(QEMU_ALIGN_DOWN(x, VNC_TILE_WIDTH) +
+                             VNC_TILE_WIDTH, r->x + r->w);
+
+                tiles[i].rect.x = x;
+                tiles[i].rect.y = y;
+                tiles[i].rect.w = x2 - x;
+                tiles[i].rect.h = y2 - y;
+                buffer_init(&tiles[i].output, "vnc-tile-output");
+                i++;
+            }
+        }
+        g_free(entry);
+    }
+    assert(i == n_tiles);
+
+    qemu_mutex_lock(&pool->mutex);
+    pool->orig = vs;
+    pool->tiles = tiles;
+    pool->n_tiles = n_tiles;
+    pool->next_tile = 0;
+    pool->pending = n_tiles;
+    qemu_cond_broadcast(&pool->cond);
+
+    vnc_encoder_run_locked(&pool->encoder);
+    while (pool->pending) {
+        qemu_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+
+    pool->orig = NULL;
+    pool->tiles = NULL;
+    pool->n_tiles = pool->next_tile = 0;
+    qemu_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < n_tiles; i++) {
+        if (tiles[i].n >= 0) {
+            n += tiles[i].n;
+        }
+        buffer_move(&vs->output, &tiles[i].output);
+    }
+    g_free(tiles);
+
+    if (vs->vnc_encoding == VNC_ENCODING_TIGHT ||
+        vs->vnc_encoding == VNC_ENCODING_TIGHT_PNG) {
+        /* The client's zlib streams no longer match ours */
+        vs->tight->stream_reset = 0x0f;
+    }
+    return n;
+}
+
 static int vnc_worker_thread_loop(VncJobQueue *queue)
 {
     VncJob *job;
@@ -249,6 +451,10 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     vnc_write_u16(&vs, 0);
 
     vnc_lock_display(job->vs->vd);
+    if (vnc_can_encode_tiles(&vs)) {
+        n_rectangles = vnc_encode_tiles(&vs, job);
+        QLIST_INIT(&job->rectangles);
+    }
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
@@ -343,3 +549,25 @@ void vnc_start_worker_thread(void)
                        QEMU_THREAD_DETACHED);
     queue = q; /* Set global queue */
 }
+
+void vnc_start_encoder_threads(int nthreads)
+{
+    VncEncoder *encoder;
+
+    if (!pool) {
+        pool = g_new0(VncEncoderPool, 1);
+        qemu_mutex_init(&pool->mutex);
+        qemu_cond_init(&pool->cond);
+        qemu_cond_init(&pool->done_cond);
+        buffer_init(&pool->encoder.vs.output, "vnc-encoder-output");
+    }
+
+    /* Threads are shared by all displays and never go away */
+    while (pool->nthreads < nthreads) {
+        encoder = g_new0(VncEncoder, 1);
+        qemu_thread_create(&encoder->thread, "vnc_encoder",
+                           vnc_encoder_thread, encoder,
+                           QEMU_THREAD_DETACHED);
+        pool->nthreads++;
+    }
+}
@@ -3376,6 +3376,9 @@ static QemuOptsList qemu_vnc_opts = {
         },{
             .name = "non-adaptive",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "encoder-threads",
+            .type = QEMU_OPT_NUMBER,
         },{
             .name = "audiodev",
             .type = QEMU_OPT_STRING,
@@ -3942,6 +3945,17 @@ void vnc_display_open(const char *id, Error **errp)
         vd->non_adaptive = true;
     }
 
+    vd->encoder_threads = qemu_opt_get_number(opts, "encoder-threads", 1);
+    if (vd->encoder_threads < 1 ||
+        vd->encoder_threads > VNC_MAX_ENCODER_THREADS) {
+        error_setg(errp, "encoder-threads must be between 1 and %d",
+                   VNC_MAX_ENCODER_THREADS);
+        goto fail;
+    }
+    if (vd->encoder_threads > 1) {
+        vnc_start_encoder_threads(vd->encoder_threads - 1);
+    }
+
     if (tlsauthz) {
         vd->tlsauthzid = g_strdup(tlsauthz);
     } else if (acl) {
@@ -90,6 +90,8 @@ typedef void VncSendHextileTile(VncState *vs,
  * VNC_DIRTY_BITS due to alignment */
 #define VNC_DIRTY_BPL(x) (sizeof((x)->dirty) / VNC_MAX_HEIGHT * BITS_PER_BYTE)
 
+#define VNC_MAX_ENCODER_THREADS 64
+
 #define VNC_STAT_RECT  64
 #define VNC_STAT_COLS (VNC_MAX_WIDTH / VNC_STAT_RECT)
 #define VNC_STAT_ROWS (VNC_MAX_HEIGHT / VNC_STAT_RECT)
@@ -176,6 +178,7 @@ struct VncDisplay
     int ws_subauth; /* Used by websockets */
     bool lossy;
     bool non_adaptive;
+    int encoder_threads;
     QCryptoTLSCreds *tlscreds;
     QAuthZ *tlsauthz;
     char *tlsauthzid;
@@ -203,6 +206,7 @@ typedef struct VncTight {
 #endif
     int levels[4];
     z_stream stream[4];
+    uint8_t stream_reset;   /* streams the client must reset before use */
 } VncTight;
 
 typedef struct VncHextile {
@@ -22,6 +22,10 @@
 #ifdef CONFIG_EPOLL_CREATE1
 #include <sys/epoll.h>
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+#include <poll.h>
+#include <liburing.h>
+#endif
 
 struct AioHandler
 {
@@ -35,6 +39,10 @@ struct AioHandler
     void *opaque;
     bool is_external;
     QLIST_ENTRY(AioHandler) node;
+#ifdef CONFIG_LINUX_IO_URING
+    unsigned io_uring_flags;
+    QSLIST_ENTRY(AioHandler) io_uring_deleted;
+#endif
 };
 
 #ifdef CONFIG_EPOLL_CREATE1
@@ -186,6 +194,267 @@ static bool aio_epoll_check_poll(AioContext *ctx, GPollFD *pfds,
 
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+
+/*
+ * io_uring fd monitoring.  Every handler gets a one-shot IORING_OP_POLL_ADD
+ * request, which is re-armed by the next aio_poll() once the handler has
+ * been dispatched; this keeps the level-triggered semantics of ppoll that
+ * handlers rely on.  Arming, waiting and reaping all happen in the home
+ * thread, so the rings need no locking, and when there is nothing to
+ * submit, looking for completions does not need a system call.
+ *
+ * The kernel holds on to each in-flight request, and the AioHandler it
+ * points to, until it completes.  Such handlers are not freed right away
+ * when they are removed: they go to ctx->io_uring_deleted, where the home
+ * thread cancels the request and frees the handler when the cancellation
+ * completes.  Nobody else touches io_uring_flags: handlers are only freed
+ * by a thread that holds list_lock with a zero count, while the home thread
+ * keeps a count for as long as it uses the ring.
+ */
+
+#define FDMON_IO_URING_ENTRIES  128
+
+enum {
+    FDMON_IO_URING_INFLIGHT = 1,    /* POLL_ADD request submitted */
+    FDMON_IO_URING_FREE = 2,        /* free on completion */
+};
+
+static void fdmon_io_uring_disable(AioContext *ctx)
+{
+    AioHandler *node, *tmp;
+    QSLIST_HEAD(, AioHandler) deleted;
+
+    if (!ctx->io_uring) {
+        return;
+    }
+    io_uring_queue_exit(ctx->io_uring);
+    g_free(ctx->io_uring);
+    ctx->io_uring = NULL;
+
+    QSLIST_MOVE_ATOMIC(&deleted, &ctx->io_uring_deleted);
+    QSLIST_FOREACH_SAFE(node, &deleted, io_uring_deleted, tmp) {
+        g_free(node);
+    }
+}
+
+static void fdmon_io_uring_setup(AioContext *ctx)
+{
+    struct io_uring *ring = g_new0(struct io_uring, 1);
+
+    QSLIST_INIT(&ctx->io_uring_deleted);
+
+    /*
+     * Without IORING_FEAT_NODROP the kernel may drop completions when the
+     * CQ ring overflows, which would lose a POLL_ADD for good.
+     */
+#ifdef IORING_FEAT_NODROP
+    if (io_uring_queue_init(FDMON_IO_URING_ENTRIES, ring, 0) == 0) {
+        if (ring->features & IORING_FEAT_NODROP) {
+            ctx->io_uring = ring;
+            return;
+        }
+        io_uring_queue_exit(ring);
+    }
+#endif
+    g_free(ring);
+}
+
+static bool aio_io_uring_enabled(AioContext *ctx)
+{
+    /* Fall back to ppoll for fine-grained is_external handling */
+    return ctx->io_uring && !aio_external_disabled(ctx);
+}
+
+/* Called instead of g_free() for handlers that have been removed.  */
+static bool fdmon_io_uring_defer_free(AioContext *ctx, AioHandler *node)
+{
+    if (node->io_uring_flags & FDMON_IO_URING_INFLIGHT) {
+        QSLIST_INSERT_HEAD_ATOMIC(&ctx->io_uring_deleted, node,
+                                  io_uring_deleted);
+        return true;
+    }
+    return false;
+}
+
+static struct io_uring_sqe *fdmon_io_uring_get_sqe(AioContext *ctx)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ctx->io_uring);
+    int ret;
+
+    while (!sqe) {
+        /* The SQ ring is full, make room */
+        do {
+            ret = io_uring_submit(ctx->io_uring);
+        } while (ret == -EINTR);
+        assert(ret >= 0);
+
+        sqe = io_uring_get_sqe(ctx->io_uring);
+    }
+    return sqe;
+}
+
+static unsigned poll_events_from_pfd(int pfd_events)
+{
+    return (pfd_events & G_IO_IN ? POLLIN : 0) |
+           (pfd_events & G_IO_OUT ? POLLOUT : 0) |
+           (pfd_events & G_IO_HUP ? POLLHUP : 0) |
+           (pfd_events & G_IO_ERR ? POLLERR : 0);
+}
+
+static int pfd_events_from_poll(int poll_events)
+{
+    return (poll_events & POLLIN ? G_IO_IN : 0) |
+           (poll_events & POLLOUT ? G_IO_OUT : 0) |
+           (poll_events & POLLHUP ? G_IO_HUP : 0) |
+           (poll_events & POLLERR ? G_IO_ERR : 0);
+}
+
+static void fdmon_io_uring_fill_sq_ring(AioContext *ctx)
+{
+    struct io_uring_sqe *sqe;
+    AioHandler *node, *tmp;
+    QSLIST_HEAD(, AioHandler) deleted;
+
+    /* Cancel the requests of removed handlers */
+    QSLIST_MOVE_ATOMIC(&deleted, &ctx->io_uring_deleted);
+    QSLIST_FOREACH_SAFE(node, &deleted, io_uring_deleted, tmp) {
+        if (!(node->io_uring_flags & FDMON_IO_URING_INFLIGHT)) {
+            g_free(node);
+            continue;
+        }
+        if (!(node->io_uring_flags & FDMON_IO_URING_FREE)) {
+            node->io_uring_flags |= FDMON_IO_URING_FREE;
+            sqe = fdmon_io_uring_get_sqe(ctx);
+            io_uring_prep_poll_remove(sqe, node);
+            io_uring_sqe_set_data(sqe, NULL);
+        }
+    }
+
+    /* Re-arm everything that completed since the last wait */
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (node->deleted || !node->pfd.events ||
+            (node->io_uring_flags & FDMON_IO_URING_INFLIGHT) ||
+            !aio_node_check(ctx, node->is_external)) {
+            continue;
+        }
+        node->io_uring_flags |= FDMON_IO_URING_INFLIGHT;
+        sqe = fdmon_io_uring_get_sqe(ctx);
+        io_uring_prep_poll_add(sqe, node->pfd.fd,
+                               poll_events_from_pfd(node->pfd.events));
+        io_uring_sqe_set_data(sqe, node);
+    }
+}
+
+/* Returns the number of handlers that have become ready.  */
+static int fdmon_io_uring_process_cq_ring(AioContext *ctx)
+{
+    struct io_uring_cqe *cqe;
+    unsigned num_cqes = 0;
+    unsigned head;
+    int ready = 0;
+
+    io_uring_for_each_cqe(ctx->io_uring, head, cqe) {
+        AioHandler *node = io_uring_cqe_get_data(cqe);
+
+        num_cqes++;
+
+        /* Timeouts and POLL_REMOVE requests carry no handler */
+        if (!node) {
+            continue;
+        }
+
+        node->io_uring_flags &= ~FDMON_IO_URING_INFLIGHT;
+        if (node->io_uring_flags & FDMON_IO_URING_FREE) {
+            g_free(node);
+            continue;
+        }
+        if (!node->deleted && cqe->res > 0) {
+            node->pfd.revents = pfd_events_from_poll(cqe->res);
+            ready++;
+        }
+    }
+
+    io_uring_cq_advance(ctx->io_uring, num_cqes);
+    return ready;
+}
+
+static int fdmon_io_uring_wait(AioContext *ctx, int64_t timeout)
+{
+    struct __kernel_timespec ts;
+    unsigned wait_nr = 1;
+    int ret;
+
+    if (timeout == 0) {
+        wait_nr = 0;
+    } else if (timeout > 0) {
+        struct io_uring_sqe *sqe = fdmon_io_uring_get_sqe(ctx);
+
+        /* Completes after one other request does, or on expiry */
+        ts = (struct __kernel_timespec) {
+            .tv_sec = timeout / NANOSECONDS_PER_SECOND,
+            .tv_nsec = timeout % NANOSECONDS_PER_SECOND,
+        };
+        io_uring_prep_timeout(sqe, &ts, 1, 0);
+        io_uring_sqe_set_data(sqe, NULL);
+    }
+
+    fdmon_io_uring_fill_sq_ring(ctx);
+
+    /* Does not enter the kernel if there is nothing to submit or wait for */
+    do {
+        ret = io_uring_submit_and_wait(ctx->io_uring, wait_nr);
+    } while (ret == -EINTR);
+    assert(ret >= 0);
+
+    return fdmon_io_uring_process_cq_ring(ctx);
+}
+
+/* Whether aio_poll() must reap completions before dispatching.  */
+static bool fdmon_io_uring_need_wait(AioContext *ctx)
+{
+    return aio_io_uring_enabled(ctx) && io_uring_cq_ready(ctx->io_uring);
+}
+
+#else /* !CONFIG_LINUX_IO_URING */
+
+static void fdmon_io_uring_disable(AioContext *ctx)
+{
+}
+
+static void fdmon_io_uring_setup(AioContext *ctx)
+{
+}
+
+static bool aio_io_uring_enabled(AioContext *ctx)
+{
+    return false;
+}
+
+static bool fdmon_io_uring_defer_free(AioContext *ctx, AioHandler *node)
+{
+    return false;
+}
+
+static int fdmon_io_uring_wait(AioContext *ctx, int64_t timeout)
+{
+    return 0;
+}
+
+static bool fdmon_io_uring_need_wait(AioContext *ctx)
+{
+    return false;
+}
+
+#endif /* !CONFIG_LINUX_IO_URING */
+
+static void aio_free_handler(AioContext *ctx, AioHandler *node)
+{
+    if (!fdmon_io_uring_defer_free(ctx, node)) {
+        g_free(node);
+    }
+}
+
 static AioHandler *find_aio_handler(AioContext *ctx, int fd)
 {
     AioHandler *node;
@@ -298,12 +567,12 @@ void aio_set_fd_handler(AioContext *ctx,
         /* Unregister deleted fd_handler */
         aio_epoll_update(ctx, node, false);
     }
-    qemu_lockcnt_unlock(&ctx->list_lock);
-    aio_notify(ctx);
-
     if (deleted) {
-        g_free(node);
+        /* Under list_lock, so the home thread is not using the ring */
+        aio_free_handler(ctx, node);
     }
+    qemu_lockcnt_unlock(&ctx->list_lock);
+    aio_notify(ctx);
 }
 
 void aio_set_fd_poll(AioContext *ctx, int fd,
@@ -411,10 +680,16 @@ bool aio_pending(AioContext *ctx)
     return result;
 }
 
+static void poll_stats_add(uint64_t *counter, uint64_t value)
+{
+    atomic_set_u64(counter, *counter + value);
+}
+
 static bool aio_dispatch_handlers(AioContext *ctx)
 {
     AioHandler *node, *tmp;
     bool progress = false;
+    uint64_t dispatches = 0;
 
     QLIST_FOREACH_SAFE_RCU(node, &ctx->aio_handlers, node, tmp) {
         int revents;
@@ -427,6 +702,7 @@ static bool aio_dispatch_handlers(AioContext *ctx)
             aio_node_check(ctx, node->is_external) &&
             node->io_read) {
             node->io_read(node->opaque);
+            dispatches++;
 
             /* aio_notify() does not count as progress */
             if (node->opaque != &ctx->notifier) {
@@ -438,18 +714,22 @@ static bool aio_dispatch_handlers(AioContext *ctx)
             aio_node_check(ctx, node->is_external) &&
             node->io_write) {
             node->io_write(node->opaque);
+            dispatches++;
             progress = true;
         }
 
         if (node->deleted) {
             if (qemu_lockcnt_dec_if_lock(&ctx->list_lock)) {
                 QLIST_REMOVE(node, node);
-                g_free(node);
+                aio_free_handler(ctx, node);
                 qemu_lockcnt_inc_and_unlock(&ctx->list_lock);
             }
         }
     }
 
+    if (dispatches) {
+        poll_stats_add(&ctx->poll_stats.dispatches, dispatches);
+    }
     return progress;
 }
 
@@ -531,6 +811,11 @@ static bool run_poll_handlers_once(AioContext *ctx, int64_t *timeout)
         /* Caller handles freeing deleted nodes.  Don't do it here. */
     }
 
+    /* Completions can be reaped by aio_poll() without a system call */
+    if (fdmon_io_uring_need_wait(ctx)) {
+        *timeout = 0;
+    }
+
     return progress;
 }
 
@@ -572,6 +857,10 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns, int64_t *timeout)
         *timeout -= MIN(*timeout, elapsed_time);
     }
 
+    poll_stats_add(&ctx->poll_stats.poll_ns, elapsed_time);
+    poll_stats_add(progress ? &ctx->poll_stats.poll_hits
+                            : &ctx->poll_stats.poll_misses, 1);
+
     trace_run_poll_handlers_end(ctx, progress, *timeout);
     return progress;
 }
@@ -615,6 +904,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     bool progress;
     int64_t timeout;
     int64_t start = 0;
+    int64_t block_start;
 
     assert(in_aio_context_home_thread(ctx));
 
@@ -642,7 +932,15 @@ bool aio_poll(AioContext *ctx, bool blocking)
     /* If polling is allowed, non-blocking aio_poll does not need the
      * system call---a single round of run_poll_handlers_once suffices.
      */
-    if (timeout || atomic_read(&ctx->poll_disable_cnt)) {
+    if (aio_io_uring_enabled(ctx) &&
+        (timeout || atomic_read(&ctx->poll_disable_cnt) ||
+         fdmon_io_uring_need_wait(ctx))) {
+        /* fdmon_io_uring_wait sets revents directly in the handlers */
+        block_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        ret = fdmon_io_uring_wait(ctx, timeout);
+        poll_stats_add(&ctx->poll_stats.block_ns,
+                       qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - block_start);
+    } else if (timeout || atomic_read(&ctx->poll_disable_cnt)) {
         assert(npfd == 0);
 
         /* fill pollfds */
@@ -657,6 +955,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
         }
 
         /* wait until next event */
+        block_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         if (aio_epoll_check_poll(ctx, pollfds, npfd, timeout)) {
             AioHandler epoll_handler;
 
@@ -668,6 +967,8 @@ bool aio_poll(AioContext *ctx, bool blocking)
         } else  {
             ret = qemu_poll_ns(pollfds, npfd, timeout);
         }
+        poll_stats_add(&ctx->poll_stats.block_ns,
+                       qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - block_start);
     }
 
     if (blocking) {
@@ -714,6 +1015,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
             trace_poll_grow(ctx, old, ctx->poll_ns);
         }
+        atomic_set_u64(&ctx->poll_stats.cur_poll_ns, ctx->poll_ns);
     }
 
     /* if we have any readable fds, dispatch event */
@@ -750,10 +1052,12 @@ void aio_context_setup(AioContext *ctx)
         ctx->epoll_available = true;
     }
 #endif
+    fdmon_io_uring_setup(ctx);
 }
 
 void aio_context_destroy(AioContext *ctx)
 {
+    fdmon_io_uring_disable(ctx);
 #ifdef CONFIG_EPOLL_CREATE1
     aio_epoll_disable(ctx);
 #endif
@@ -769,6 +1073,7 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     ctx->poll_ns = 0;
     ctx->poll_grow = grow;
     ctx->poll_shrink = shrink;
+    atomic_set_u64(&ctx->poll_stats.cur_poll_ns, 0);
 
     aio_notify(ctx);
 }
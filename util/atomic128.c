@@ -0,0 +1,70 @@
+/*
+ * Lock-based 16-byte compare-and-swap for hosts without one.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/atomic128.h"
+#include "qemu/thread.h"
+
+#ifdef HAVE_CMPXCHG128_LOCKED
+
+/*
+ * As in atomic64.c, the spinlocks are padded to the host's dcache line
+ * size at run-time.  Hosts without a 16-byte compare-and-swap may well
+ * have many cores, so use more locks than atomic64.c does.
+ */
+static void *lock_array;
+static size_t lock_size;
+
+#define NR_LOCKS 64
+
+static QemuSpin *addr_to_lock(const void *addr)
+{
+    uintptr_t a = (uintptr_t)addr;
+    uintptr_t idx;
+
+    idx = a >> qemu_dcache_linesize_log;
+    idx ^= (idx >> 8) ^ (idx >> 16);
+    idx &= NR_LOCKS - 1;
+    return lock_array + idx * lock_size;
+}
+
+Int128 atomic16_cmpxchg_locked(Int128 *ptr, Int128 cmp, Int128 new)
+{
+    QemuSpin *lock = addr_to_lock(ptr);
+    Int128 old;
+
+    /*
+     * Take any write fault before the lock: for user-only, a SIGSEGV on
+     * a page holding translated code may longjmp out of the helper, and
+     * would then leave the lock held.  PTR is 16-byte aligned, so a
+     * single word is enough to cover the whole operand.
+     */
+    atomic_fetch_or((uint32_t *)ptr, 0);
+
+    qemu_spin_lock(lock);
+    old = *ptr;
+    if (int128_eq(old, cmp)) {
+        *ptr = new;
+    }
+    qemu_spin_unlock(lock);
+    return old;
+}
+
+void atomic128_init(void)
+{
+    int i;
+
+    lock_size = ROUND_UP(sizeof(QemuSpin), qemu_dcache_linesize);
+    lock_array = qemu_memalign(qemu_dcache_linesize, lock_size * NR_LOCKS);
+    for (i = 0; i < NR_LOCKS; i++) {
+        QemuSpin *lock = lock_array + i * lock_size;
+
+        qemu_spin_init(lock);
+    }
+}
+
+#endif /* HAVE_CMPXCHG128_LOCKED */
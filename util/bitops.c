@@ -14,6 +14,277 @@
 #include "qemu/osdep.h"
 #include "qemu/bitops.h"
 
+static unsigned long count_ones_int(const unsigned long *p,
+                                    unsigned long nwords)
+{
+    unsigned long i, result = 0;
+
+    for (i = 0; i < nwords; i++) {
+        result += ctpopl(p[i]);
+    }
+    return result;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/*
+ * Vectorized helpers for scanning large bitmaps, such as the migration
+ * dirty bitmap.  skip_*_words return how many of the first @nwords words
+ * are all zeroes (resp. all ones); they only look at whole blocks of
+ * vectors, so the caller must finish the scan one word at a time.
+ */
+#define BITOPS_ACCEL_MIN_WORDS  (128 / sizeof(unsigned long))
+
+/*
+ * Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static unsigned long skip_zero_words_sse2(const unsigned long *p,
+                                          unsigned long nwords)
+{
+    const __m128i *v = (const __m128i *)p;
+    const __m128i *e = v + nwords * sizeof(unsigned long) / 64 * 4;
+    __m128i zero = _mm_setzero_si128();
+
+    /* Loop over blocks of 64 bytes */
+    for (; v < e; v += 4) {
+        __m128i t = _mm_loadu_si128(v) | _mm_loadu_si128(v + 1) |
+                    _mm_loadu_si128(v + 2) | _mm_loadu_si128(v + 3);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(t, zero)) != 0xFFFF) {
+            break;
+        }
+    }
+    return (v - (const __m128i *)p) * 16 / sizeof(unsigned long);
+}
+
+static unsigned long skip_ones_words_sse2(const unsigned long *p,
+                                          unsigned long nwords)
+{
+    const __m128i *v = (const __m128i *)p;
+    const __m128i *e = v + nwords * sizeof(unsigned long) / 64 * 4;
+    __m128i ones = _mm_set1_epi32(-1);
+
+    for (; v < e; v += 4) {
+        __m128i t = _mm_loadu_si128(v) & _mm_loadu_si128(v + 1) &
+                    _mm_loadu_si128(v + 2) & _mm_loadu_si128(v + 3);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(t, ones)) != 0xFFFF) {
+            break;
+        }
+    }
+    return (v - (const __m128i *)p) * 16 / sizeof(unsigned long);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+/*
+ * As in bufferiszero.c, the includes have to be within the corresponding
+ * push_options region, and the regions have to be ordered with increasing
+ * ISA.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static unsigned long skip_zero_words_avx2(const unsigned long *p,
+                                          unsigned long nwords)
+{
+    const __m256i *v = (const __m256i *)p;
+    const __m256i *e = v + nwords * sizeof(unsigned long) / 128 * 4;
+
+    /* Loop over blocks of 128 bytes */
+    for (; v < e; v += 4) {
+        __m256i t = _mm256_loadu_si256(v) | _mm256_loadu_si256(v + 1) |
+                    _mm256_loadu_si256(v + 2) | _mm256_loadu_si256(v + 3);
+
+        if (!_mm256_testz_si256(t, t)) {
+            break;
+        }
+    }
+    return (v - (const __m256i *)p) * 32 / sizeof(unsigned long);
+}
+
+static unsigned long skip_ones_words_avx2(const unsigned long *p,
+                                          unsigned long nwords)
+{
+    const __m256i *v = (const __m256i *)p;
+    const __m256i *e = v + nwords * sizeof(unsigned long) / 128 * 4;
+    __m256i ones = _mm256_set1_epi32(-1);
+
+    for (; v < e; v += 4) {
+        __m256i t = _mm256_loadu_si256(v) & _mm256_loadu_si256(v + 1) &
+                    _mm256_loadu_si256(v + 2) & _mm256_loadu_si256(v + 3);
+
+        if (!_mm256_testc_si256(t, ones)) {
+            break;
+        }
+    }
+    return (v - (const __m256i *)p) * 32 / sizeof(unsigned long);
+}
+
+/*
+ * Count bits with a nibble lookup table in a vector register; this
+ * beats scalar code unless the compiler may use the POPCNT instruction,
+ * which QEMU is not normally built with.
+ */
+static unsigned long count_ones_avx2(const unsigned long *p,
+                                     unsigned long nwords)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3,
+                                            1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i *v = (const __m256i *)p;
+    unsigned long nvec = nwords * sizeof(unsigned long) / 32;
+    unsigned long done = nvec * 32 / sizeof(unsigned long);
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t sums[4];
+    unsigned long i;
+
+    for (i = 0; i < nvec; i++) {
+        __m256i t = _mm256_loadu_si256(v + i);
+        __m256i lo = _mm256_shuffle_epi8(lookup,
+                                         _mm256_and_si256(t, low_mask));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(
+                                         _mm256_srli_epi16(t, 4), low_mask));
+
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi),
+                                                    _mm256_setzero_si256()));
+    }
+    _mm256_storeu_si256((__m256i *)sums, acc);
+
+    return sums[0] + sums[1] + sums[2] + sums[3] +
+           count_ones_int(p + done, nwords - done);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+static unsigned long skip_words_none(const unsigned long *p,
+                                     unsigned long nwords)
+{
+    return 0;
+}
+
+/*
+ * Note that for test_bitops_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_SKIP_ZERO skip_words_none
+# define INIT_SKIP_ONES skip_words_none
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_SKIP_ZERO skip_zero_words_sse2
+# define INIT_SKIP_ONES skip_ones_words_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static unsigned long (*skip_zero_words)(const unsigned long *, unsigned long) =
+    INIT_SKIP_ZERO;
+static unsigned long (*skip_ones_words)(const unsigned long *, unsigned long) =
+    INIT_SKIP_ONES;
+static unsigned long (*count_ones)(const unsigned long *, unsigned long) =
+    count_ones_int;
+
+static void init_accel(unsigned cache)
+{
+    skip_zero_words = skip_words_none;
+    skip_ones_words = skip_words_none;
+    count_ones = count_ones_int;
+    if (cache & CACHE_SSE2) {
+        skip_zero_words = skip_zero_words_sse2;
+        skip_ones_words = skip_ones_words_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        skip_zero_words = skip_zero_words_avx2;
+        skip_ones_words = skip_ones_words_avx2;
+        count_ones = count_ones_avx2;
+    }
+#endif
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_bitops_next_accel(void)
+{
+    /*
+     * If no bits set, we just tested the scalar code, and there
+     * are no more acceleration options to test.
+     */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#else
+#define BITOPS_ACCEL_MIN_WORDS  ULONG_MAX
+#define skip_zero_words(p, nwords) 0
+#define skip_ones_words(p, nwords) 0
+#define count_ones count_ones_int
+bool test_bitops_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Count the set bits in the first @nwords words at @addr.
+ */
+unsigned long bitops_count_ones(const unsigned long *addr,
+                                unsigned long nwords)
+{
+    return count_ones(addr, nwords);
+}
+
 /*
  * Find the next set bit in a memory region.
  */
@@ -41,6 +312,13 @@ unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
         size -= BITS_PER_LONG;
         result += BITS_PER_LONG;
     }
+    if (size / BITS_PER_LONG >= BITOPS_ACCEL_MIN_WORDS) {
+        unsigned long skip = skip_zero_words(p, size / BITS_PER_LONG);
+
+        p += skip;
+        result += skip * BITS_PER_LONG;
+        size -= skip * BITS_PER_LONG;
+    }
     while (size >= 4*BITS_PER_LONG) {
         unsigned long d1, d2, d3;
         tmp = *p;
@@ -106,6 +384,13 @@ unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size,
         size -= BITS_PER_LONG;
         result += BITS_PER_LONG;
     }
+    if (size / BITS_PER_LONG >= BITOPS_ACCEL_MIN_WORDS) {
+        unsigned long skip = skip_ones_words(p, size / BITS_PER_LONG);
+
+        p += skip;
+        result += skip * BITS_PER_LONG;
+        size -= skip * BITS_PER_LONG;
+    }
     while (size & ~(BITS_PER_LONG-1)) {
         if (~(tmp = *(p++))) {
             goto found_middle;
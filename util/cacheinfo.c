@@ -9,6 +9,7 @@
 #include "qemu/osdep.h"
 #include "qemu/host-utils.h"
 #include "qemu/atomic.h"
+#include "qemu/atomic128.h"
 
 int qemu_icache_linesize = 0;
 int qemu_icache_linesize_log;
@@ -188,4 +189,5 @@ static void __attribute__((constructor)) init_cache_info(void)
     qemu_dcache_linesize_log = ctz32(dsize);
 
     atomic64_init();
+    atomic128_init();
 }
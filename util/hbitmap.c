@@ -12,6 +12,7 @@
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
 #include "qemu/host-utils.h"
+#include "qemu/atomic.h"
 #include "trace.h"
 #include "crypto/hash.h"
 
@@ -50,6 +51,13 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * Large levels are allocated with anonymous mmap(), so that the host only
+ * backs the pages that actually contain set bits.  The code below takes care
+ * never to store to a word that is already zero, and to drop whole levels
+ * instead of clearing them with memset(); this way a mostly clean bitmap of
+ * a huge disk only costs memory for its few dirty regions.  Reading
+ * untouched pages maps the shared zero page and does not make them resident.
  */
 
 struct HBitmap {
@@ -101,6 +109,85 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Levels of at least this many bytes are allocated sparsely */
+#define HBITMAP_SPARSE_LEVEL_BYTES (64 * 1024)
+
+static bool hb_level_is_sparse(uint64_t size)
+{
+#ifdef CONFIG_POSIX
+    return size * sizeof(unsigned long) >= HBITMAP_SPARSE_LEVEL_BYTES;
+#else
+    return false;
+#endif
+}
+
+/* Allocate a zeroed level of @size words */
+static unsigned long *hb_level_alloc(uint64_t size)
+{
+#ifdef CONFIG_POSIX
+    if (hb_level_is_sparse(size)) {
+        void *p = mmap(NULL, size * sizeof(unsigned long),
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+        if (p == MAP_FAILED) {
+            /* Like g_new0(), treat running out of memory as fatal */
+            abort();
+        }
+        return p;
+    }
+#endif
+    return g_new0(unsigned long, size);
+}
+
+static void hb_level_free(unsigned long *level, uint64_t size)
+{
+#ifdef CONFIG_POSIX
+    if (hb_level_is_sparse(size)) {
+        munmap(level, size * sizeof(unsigned long));
+        return;
+    }
+#endif
+    g_free(level);
+}
+
+/* Resize a level from @old to @size words, zeroing any new words */
+static unsigned long *hb_level_realloc(unsigned long *level, uint64_t old,
+                                       uint64_t size)
+{
+    unsigned long *new_level;
+    uint64_t i;
+
+    if (!hb_level_is_sparse(old) && !hb_level_is_sparse(size)) {
+        level = g_renew(unsigned long, level, size);
+        if (size > old) {
+            memset(&level[old], 0, (size - old) * sizeof(*level));
+        }
+        return level;
+    }
+
+    /* Only copy nonzero words so as not to populate clean pages */
+    new_level = hb_level_alloc(size);
+    for (i = 0; i < MIN(old, size); i++) {
+        if (level[i]) {
+            new_level[i] = level[i];
+        }
+    }
+    hb_level_free(level, old);
+    return new_level;
+}
+
+/* Clear @count words starting at @first without touching zero words */
+static void hb_clear_words(unsigned long *first, uint64_t count)
+{
+    uint64_t i;
+
+    for (i = 0; i < count; i++) {
+        if (first[i]) {
+            first[i] = 0;
+        }
+    }
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -402,6 +489,72 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     }
 }
 
+/* Atomic variants of hb_set_elem() and hb_set_between().  @added, if not
+ * NULL, is incremented by the number of bits that were clear before.
+ */
+static inline bool hb_set_elem_atomic(unsigned long *elem, uint64_t start,
+                                      uint64_t last, uint64_t *added)
+{
+    unsigned long mask;
+    unsigned long old;
+
+    assert((last >> BITS_PER_LEVEL) == (start >> BITS_PER_LEVEL));
+    assert(start <= last);
+
+    mask = 2UL << (last & (BITS_PER_LONG - 1));
+    mask -= 1UL << (start & (BITS_PER_LONG - 1));
+    old = atomic_fetch_or(elem, mask);
+    if (added) {
+        *added += ctpopl(mask & ~old);
+    }
+    return (old | mask) != old;
+}
+
+static bool hb_set_between_atomic(HBitmap *hb, int level, uint64_t start,
+                                  uint64_t last, uint64_t *added)
+{
+    size_t pos = start >> BITS_PER_LEVEL;
+    size_t lastpos = last >> BITS_PER_LEVEL;
+    bool changed = false;
+    size_t i;
+
+    for (i = pos; i < lastpos; i++) {
+        uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
+        changed |= hb_set_elem_atomic(&hb->levels[level][i], start, next - 1,
+                                      added);
+        start = next;
+    }
+    changed |= hb_set_elem_atomic(&hb->levels[level][i], start, last, added);
+
+    /* Concurrent setters that change the same word all propagate up, so
+     * the upper layer is complete once the last of them returns.
+     */
+    if (level > 0 && changed) {
+        hb_set_between_atomic(hb, level - 1, pos, lastpos, NULL);
+    }
+    return changed;
+}
+
+void hbitmap_set_atomic(HBitmap *hb, uint64_t start, uint64_t count)
+{
+    uint64_t first;
+    uint64_t last = start + count - 1;
+    uint64_t added = 0;
+
+    trace_hbitmap_set(hb, start, count,
+                      start >> hb->granularity, last >> hb->granularity);
+
+    first = start >> hb->granularity;
+    last >>= hb->granularity;
+    assert(last < hb->size);
+
+    if (hb_set_between_atomic(hb, HBITMAP_LEVELS - 1, first, last, &added) &&
+        hb->meta) {
+        hbitmap_set_atomic(hb->meta, start, count);
+    }
+    atomic_add(&hb->count, added);
+}
+
 /* Resetting works the other way round: propagate up if the new
  * value is zero.
  */
@@ -416,7 +569,9 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
-    *elem &= ~mask;
+    if (*elem & mask) {
+        *elem &= ~mask;
+    }
     return blanked;
 }
 
@@ -451,8 +606,10 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            if (hb->levels[level][i]) {
+                changed = true;
+                hb->levels[level][i] = 0UL;
+            }
         }
     }
 
@@ -495,9 +652,16 @@ void hbitmap_reset_all(HBitmap *hb)
 {
     unsigned int i;
 
-    /* Same as hbitmap_alloc() except for memset() instead of malloc() */
+    /* Same as hbitmap_alloc() except for memset() instead of malloc().
+     * Sparse levels are replaced, which returns their pages to the host.
+     */
     for (i = HBITMAP_LEVELS; --i >= 1; ) {
-        memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        if (hb_level_is_sparse(hb->sizes[i])) {
+            hb_level_free(hb->levels[i], hb->sizes[i]);
+            hb->levels[i] = hb_level_alloc(hb->sizes[i]);
+        } else {
+            memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
+        }
     }
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
@@ -641,7 +805,7 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_clear_words(first, el_count);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -694,7 +858,7 @@ void hbitmap_free(HBitmap *hb)
     unsigned i;
     assert(!hb->meta);
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
-        g_free(hb->levels[i]);
+        hb_level_free(hb->levels[i], hb->sizes[i]);
     }
     g_free(hb);
 }
@@ -715,7 +879,7 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        hb->levels[i] = hb_level_alloc(size);
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -768,11 +932,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
-        hb->levels[i] = g_realloc(hb->levels[i], size * sizeof(unsigned long));
-        if (!shrink) {
-            memset(&hb->levels[i][old], 0x00,
-                   (size - old) * sizeof(*hb->levels[i]));
-        }
+        hb->levels[i] = hb_level_realloc(hb->levels[i], old, size);
     }
     if (hb->meta) {
         hbitmap_truncate(hb->meta, hb->size << hb->granularity);
@@ -852,7 +1012,12 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     assert(a->size == b->size);
     for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+            unsigned long val = a->levels[i][j] | b->levels[i][j];
+
+            /* Don't populate clean pages of a sparse level */
+            if (result->levels[i][j] != val) {
+                result->levels[i][j] = val;
+            }
         }
     }
 
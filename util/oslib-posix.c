@@ -43,6 +43,7 @@
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -56,6 +57,7 @@
 #endif
 
 #include "qemu/mmap-alloc.h"
+#include "qemu/bitmap.h"
 
 #ifdef CONFIG_DEBUG_STACK_USAGE
 #include "qemu/error-report.h"
@@ -69,12 +71,27 @@ struct MemsetThread {
     size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
+    MemPrealloc *mp;
 };
 typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+struct MemPrealloc {
+    MemsetThread *threads;
+    int num_threads;
+    unsigned long *affinity;
+    long affinity_bits;
+    bool failed;
+};
+
+/* The touch_pages thread running on this host thread, if any */
+static __thread MemsetThread *memset_thread;
+
+/*
+ * Several preallocations can be in flight at once, they share one
+ * SIGBUS handler.  Only touched from the main thread.
+ */
+static int memset_sigbus_users;
+static struct sigaction memset_sigbus_oldact;
 
 int qemu_get_thread_id(void)
 {
@@ -388,14 +405,41 @@ char *qemu_get_exec_dir(void)
 
 static void sigbus_handler(int signal)
 {
-    int i;
     if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
-            }
-        }
+        siglongjmp(memset_thread->env, 1);
     }
+
+    /*
+     * Preallocation can run in the background while other threads
+     * fault in guest memory, so do not swallow their SIGBUS: hand it
+     * to the previous handler when the access is retried.
+     */
+    sigaction(SIGBUS, &memset_sigbus_oldact, NULL);
+}
+
+static void memset_thread_set_affinity(MemPrealloc *mp)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t *set;
+    size_t setsize;
+    long cpu;
+
+    if (!mp->affinity) {
+        return;
+    }
+
+    set = CPU_ALLOC(mp->affinity_bits);
+    setsize = CPU_ALLOC_SIZE(mp->affinity_bits);
+    CPU_ZERO_S(setsize, set);
+    for (cpu = find_first_bit(mp->affinity, mp->affinity_bits);
+         cpu < mp->affinity_bits;
+         cpu = find_next_bit(mp->affinity, mp->affinity_bits, cpu + 1)) {
+        CPU_SET_S(cpu, setsize, set);
+    }
+    /* Best effort: if this fails the pages are merely touched from afar */
+    sched_setaffinity(0, setsize, set);
+    CPU_FREE(set);
+#endif
 }
 
 static void *do_touch_pages(void *arg)
@@ -403,114 +447,156 @@ static void *do_touch_pages(void *arg)
     MemsetThread *memset_args = (MemsetThread *)arg;
     sigset_t set, oldset;
 
+    memset_thread_set_affinity(memset_args->mp);
+    memset_thread = memset_args;
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
     if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
+        atomic_set(&memset_args->mp->failed, true);
     } else {
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
         size_t hpagesize = memset_args->hpagesize;
         size_t i;
         for (i = 0; i < numpages; i++) {
+            char val = atomic_read(addr);
+
             /*
-             * Read & write back the same value, so we don't
-             * corrupt existing user/app data that might be
-             * stored.
-             *
-             * 'volatile' to stop compiler optimizing this away
-             * to a no-op
+             * Write back the same value atomically, so we don't
+             * corrupt existing user/app data that might be stored,
+             * nor data that device realize or firmware loading
+             * store while the preallocation runs in the background.
+             * If the exchange fails, somebody else wrote the page
+             * and it is populated already.
              *
              * TODO: get a better solution from kernel so we
              * don't need to write at all so we don't cause
              * wear on the storage backing the region...
              */
-            *(volatile char *)addr = *addr;
+            atomic_cmpxchg(addr, val, val);
             addr += hpagesize;
         }
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    memset_thread = NULL;
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+static inline int get_memset_num_threads(int max_threads,
+                                         const unsigned long *affinity,
+                                         long affinity_bits)
 {
     long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
     int ret = 1;
 
+    if (host_procs > 0 && affinity) {
+        host_procs = MIN(host_procs,
+                         bitmap_count_one(affinity, affinity_bits));
+    }
     if (host_procs > 0) {
-        ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus);
+        ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), max_threads);
     }
     /* In case sysconf() fails, we fall back to single threaded */
-    return ret;
+    return MAX(ret, 1);
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t memory,
+                                   int max_threads,
+                                   const unsigned long *affinity,
+                                   long affinity_bits, Error **errp)
 {
+    MemPrealloc *mp;
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
     size_t numpages_per_thread;
     size_t size_per_thread;
     char *addr = area;
-    int i = 0;
+    int i;
+
+    if (!memset_sigbus_users) {
+        struct sigaction act;
+
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = &sigbus_handler;
+        act.sa_flags = 0;
 
-    memset_thread_failed = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = (numpages / memset_num_threads);
+        if (sigaction(SIGBUS, &act, &memset_sigbus_oldact)) {
+            error_setg_errno(errp, errno,
+                "os_mem_prealloc: failed to install signal handler");
+            return NULL;
+        }
+    }
+    memset_sigbus_users++;
+
+    mp = g_new0(MemPrealloc, 1);
+    if (affinity) {
+        mp->affinity = bitmap_new(affinity_bits);
+        mp->affinity_bits = affinity_bits;
+        bitmap_copy(mp->affinity, affinity, affinity_bits);
+    }
+
+    /* touch pages simultaneously */
+    mp->num_threads = get_memset_num_threads(max_threads, affinity,
+                                             affinity_bits);
+    mp->threads = g_new0(MemsetThread, mp->num_threads);
+    numpages_per_thread = (numpages / mp->num_threads);
     size_per_thread = (hpagesize * numpages_per_thread);
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = (i == (memset_num_threads - 1)) ?
-                                    numpages : numpages_per_thread;
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
+    for (i = 0; i < mp->num_threads; i++) {
+        mp->threads[i].addr = addr;
+        mp->threads[i].numpages = (i == (mp->num_threads - 1)) ?
+                                  numpages : numpages_per_thread;
+        mp->threads[i].hpagesize = hpagesize;
+        mp->threads[i].mp = mp;
+        qemu_thread_create(&mp->threads[i].pgthread, "touch_pages",
+                           do_touch_pages, &mp->threads[i],
                            QEMU_THREAD_JOINABLE);
         addr += size_per_thread;
         numpages -= numpages_per_thread;
     }
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
-    }
-    g_free(memset_thread);
-    memset_thread = NULL;
 
-    return memset_thread_failed;
+    return mp;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+bool os_mem_prealloc_finish(MemPrealloc *mp, Error **errp)
 {
-    int ret;
-    struct sigaction act, oldact;
-    size_t hpagesize = qemu_fd_getpagesize(fd);
-    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    bool failed;
+    int i;
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
+    for (i = 0; i < mp->num_threads; i++) {
+        qemu_thread_join(&mp->threads[i].pgthread);
+    }
+    failed = mp->failed;
+    g_free(mp->threads);
+    g_free(mp->affinity);
+    g_free(mp);
 
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
-        return;
+    if (!--memset_sigbus_users &&
+        sigaction(SIGBUS, &memset_sigbus_oldact, NULL)) {
+        /* Terminate QEMU since it can't recover from error */
+        perror("os_mem_prealloc: failed to reinstall signal handler");
+        exit(1);
     }
 
-    /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    if (failed) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
+        return false;
     }
+    return true;
+}
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     Error **errp)
+{
+    MemPrealloc *mp;
+
+    mp = os_mem_prealloc_start(fd, area, memory, smp_cpus, NULL, 0, errp);
+    if (mp) {
+        os_mem_prealloc_finish(mp, errp);
     }
 }
 
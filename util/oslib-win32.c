@@ -562,6 +562,26 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+struct MemPrealloc {
+    char unused;
+};
+
+MemPrealloc *os_mem_prealloc_start(int fd, char *area, size_t sz,
+                                   int max_threads,
+                                   const unsigned long *affinity,
+                                   long affinity_bits, Error **errp)
+{
+    /* No background threads here, preallocate right away */
+    os_mem_prealloc(fd, area, sz, max_threads, errp);
+    return g_new0(MemPrealloc, 1);
+}
+
+bool os_mem_prealloc_finish(MemPrealloc *mp, Error **errp)
+{
+    g_free(mp);
+    return true;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
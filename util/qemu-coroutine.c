@@ -16,21 +16,30 @@
 #include "trace.h"
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/stats64.h"
 #include "qemu/coroutine.h"
 #include "qemu/coroutine_int.h"
 #include "block/aio.h"
 
 enum {
-    POOL_BATCH_SIZE = 64,
+    POOL_DEFAULT_BATCH_SIZE = 64,
 };
 
 /** Free list to speed up creation */
 static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
+static unsigned int pool_batch_size = POOL_DEFAULT_BATCH_SIZE;
 static unsigned int release_pool_size;
 static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(pool);
 static __thread unsigned int alloc_pool_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
 
+/*
+ * Pool hits are counted per thread and only folded into the global
+ * counter on a miss, so that the fast path stays free of atomics.
+ */
+static Stat64 pool_hits, pool_misses;
+static __thread unsigned int alloc_pool_hits;
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
@@ -49,7 +58,7 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     if (CONFIG_COROUTINE_POOL) {
         co = QSLIST_FIRST(&alloc_pool);
         if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
+            if (release_pool_size > atomic_read(&pool_batch_size)) {
                 /* Slow path; a good place to register the destructor, too.  */
                 if (!coroutine_pool_cleanup_notifier.notify) {
                     coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
@@ -68,10 +77,19 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
         if (co) {
             QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
             alloc_pool_size--;
+            alloc_pool_hits++;
         }
     }
 
     if (!co) {
+        if (CONFIG_COROUTINE_POOL) {
+            stat64_add(&pool_hits, alloc_pool_hits);
+            stat64_add(&pool_misses, 1);
+            alloc_pool_hits = 0;
+            trace_qemu_coroutine_pool_miss(stat64_get(&pool_hits),
+                                           stat64_get(&pool_misses),
+                                           atomic_read(&pool_batch_size));
+        }
         co = qemu_coroutine_new();
     }
 
@@ -86,12 +104,14 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
+        unsigned int batch_size = atomic_read(&pool_batch_size);
+
+        if (release_pool_size < batch_size * 2) {
             QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
             atomic_inc(&release_pool_size);
             return;
         }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
+        if (alloc_pool_size < batch_size) {
             QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
             alloc_pool_size++;
             return;
@@ -202,3 +222,13 @@ AioContext *coroutine_fn qemu_coroutine_get_aio_context(Coroutine *co)
 {
     return co->ctx;
 }
+
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_pool_size)
+{
+    atomic_add(&pool_batch_size, additional_pool_size);
+}
+
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removing_pool_size)
+{
+    atomic_sub(&pool_batch_size, removing_pool_size);
+}
@@ -14,7 +14,18 @@
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
 #include "qemu/notify.h"
+#include "qemu/bitops.h"
+#include "qemu/queue.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-misc.h"
+#include "qapi/clone-visitor.h"
+#include "qapi/qapi-visit-misc.h"
 #include "qemu-thread-common.h"
+#ifdef CONFIG_LINUX
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
 
 static bool name_threads;
 
@@ -488,6 +499,235 @@ static void qemu_thread_atexit_notify(void *arg)
     notifier_list_notify(&thread_exit, NULL);
 }
 
+/*
+ * Registry of the threads created by QEMU and of the policies set for
+ * each category of threads.  Threads are created from constructors, so
+ * this cannot use a QemuMutex.
+ */
+typedef struct QemuThreadEntry {
+    char *name;
+    ThreadCategory category;
+    int tid;
+    QLIST_ENTRY(QemuThreadEntry) next;
+} QemuThreadEntry;
+
+static pthread_mutex_t thread_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static QLIST_HEAD(, QemuThreadEntry) thread_list =
+    QLIST_HEAD_INITIALIZER(thread_list);
+static ThreadPolicy *thread_policy[THREAD_CATEGORY__MAX];
+
+#define THREAD_MAX_CPUS       4096
+#define THREAD_MAX_HOST_NODES 1024
+
+static const struct {
+    const char *prefix;
+    ThreadCategory category;
+} thread_category_prefixes[] = {
+    { "CPU ", THREAD_CATEGORY_VCPU },
+    { "ALL CPUs/", THREAD_CATEGORY_VCPU },
+    { "IO ", THREAD_CATEGORY_IOTHREAD },
+    { "worker", THREAD_CATEGORY_WORKER },
+    { "call_rcu", THREAD_CATEGORY_RCU },
+    { "multifd", THREAD_CATEGORY_MULTIFD },
+    { "compress", THREAD_CATEGORY_COMPRESS },
+    { "decompress", THREAD_CATEGORY_COMPRESS },
+    { "vnc_worker", THREAD_CATEGORY_VNC },
+};
+
+static ThreadCategory qemu_thread_category(const char *name)
+{
+    int i;
+
+    for (i = 0; name && i < ARRAY_SIZE(thread_category_prefixes); i++) {
+        if (g_str_has_prefix(name, thread_category_prefixes[i].prefix)) {
+            return thread_category_prefixes[i].category;
+        }
+    }
+    return THREAD_CATEGORY_EMULATOR;
+}
+
+#ifdef CONFIG_LINUX
+#define QEMU_MPOL_BIND 2
+
+static const int thread_sched_policy[THREAD_SCHED_POLICY__MAX] = {
+    [THREAD_SCHED_POLICY_OTHER] = SCHED_OTHER,
+    [THREAD_SCHED_POLICY_BATCH] = SCHED_BATCH,
+    [THREAD_SCHED_POLICY_IDLE] = SCHED_IDLE,
+    [THREAD_SCHED_POLICY_FIFO] = SCHED_FIFO,
+    [THREAD_SCHED_POLICY_RR] = SCHED_RR,
+};
+
+/*
+ * The memory policy can only be set for the calling thread, so it is
+ * only applied if @tid is the current thread.
+ */
+static int qemu_thread_apply_policy(int tid, ThreadPolicy *policy,
+                                    Error **errp)
+{
+    ThreadSchedPolicy sched = policy->has_sched_policy ?
+                              policy->sched_policy : THREAD_SCHED_POLICY_OTHER;
+    struct sched_param param = { .sched_priority = policy->sched_priority };
+    size_t setsize = CPU_ALLOC_SIZE(THREAD_MAX_CPUS);
+    cpu_set_t *set = CPU_ALLOC(THREAD_MAX_CPUS);
+    uint16List *l;
+    int i, ret;
+
+    CPU_ZERO_S(setsize, set);
+    if (!policy->has_cpus) {
+        for (i = 0; i < THREAD_MAX_CPUS; i++) {
+            CPU_SET_S(i, setsize, set);
+        }
+    }
+    for (l = policy->cpus; l; l = l->next) {
+        CPU_SET_S(l->value, setsize, set);
+    }
+    ret = sched_setaffinity(tid, setsize, set) ? -errno : 0;
+    CPU_FREE(set);
+    if (ret) {
+        error_setg_errno(errp, -ret, "Cannot set the affinity of thread %d",
+                         tid);
+        return ret;
+    }
+
+    if (sched_setscheduler(tid, thread_sched_policy[sched], &param)) {
+        ret = -errno;
+        error_setg_errno(errp, -ret,
+                         "Cannot set the scheduling class of thread %d", tid);
+        return ret;
+    }
+
+    if (policy->has_host_nodes && tid == qemu_get_thread_id()) {
+        unsigned long nodes[BITS_TO_LONGS(THREAD_MAX_HOST_NODES)] = {};
+        unsigned long maxnode = 0;
+
+        for (l = policy->host_nodes; l; l = l->next) {
+            set_bit(l->value, nodes);
+            maxnode = MAX(maxnode, l->value + 1);
+        }
+        if (syscall(SYS_set_mempolicy, QEMU_MPOL_BIND, nodes, maxnode + 1)) {
+            ret = -errno;
+            error_setg_errno(errp, -ret,
+                             "Cannot set the memory policy of thread %d", tid);
+            return ret;
+        }
+    }
+    return 0;
+}
+#else
+static int qemu_thread_apply_policy(int tid, ThreadPolicy *policy,
+                                    Error **errp)
+{
+    error_setg(errp, "Thread policies are not supported on this host");
+    return -ENOSYS;
+}
+#endif
+
+static QemuThreadEntry *qemu_thread_register(char *name)
+{
+    QemuThreadEntry *entry = g_new0(QemuThreadEntry, 1);
+    Error *local_err = NULL;
+    ThreadPolicy *policy;
+
+    entry->name = name;
+    entry->category = qemu_thread_category(name);
+    entry->tid = qemu_get_thread_id();
+
+    pthread_mutex_lock(&thread_list_lock);
+    QLIST_INSERT_HEAD(&thread_list, entry, next);
+    policy = thread_policy[entry->category];
+    if (policy && qemu_thread_apply_policy(entry->tid, policy, &local_err)) {
+        warn_report_err(local_err);
+    }
+    pthread_mutex_unlock(&thread_list_lock);
+    return entry;
+}
+
+static void qemu_thread_unregister(void *opaque)
+{
+    QemuThreadEntry *entry = opaque;
+
+    pthread_mutex_lock(&thread_list_lock);
+    QLIST_REMOVE(entry, next);
+    pthread_mutex_unlock(&thread_list_lock);
+    g_free(entry->name);
+    g_free(entry);
+}
+
+static void __attribute__((constructor)) qemu_thread_register_main(void)
+{
+    qemu_thread_register(g_strdup("main"));
+}
+
+void qmp_set_thread_policy(ThreadPolicy *policy, Error **errp)
+{
+    ThreadSchedPolicy sched = policy->has_sched_policy ?
+                              policy->sched_policy : THREAD_SCHED_POLICY_OTHER;
+    bool realtime = sched == THREAD_SCHED_POLICY_FIFO ||
+                    sched == THREAD_SCHED_POLICY_RR;
+    QemuThreadEntry *entry;
+    uint16List *l;
+
+    for (l = policy->cpus; l; l = l->next) {
+        if (l->value >= THREAD_MAX_CPUS) {
+            error_setg(errp, "CPU %d is out of range", l->value);
+            return;
+        }
+    }
+    for (l = policy->host_nodes; l; l = l->next) {
+        if (l->value >= THREAD_MAX_HOST_NODES) {
+            error_setg(errp, "Host node %d is out of range", l->value);
+            return;
+        }
+    }
+    if (policy->has_cpus && !policy->cpus) {
+        error_setg(errp, "The list of CPUs cannot be empty");
+        return;
+    }
+    if (realtime && (policy->sched_priority < 1 ||
+                     policy->sched_priority > 99)) {
+        error_setg(errp, "sched-priority must be between 1 and 99 for "
+                   "real-time scheduling classes");
+        return;
+    }
+    if (!realtime && policy->sched_priority) {
+        error_setg(errp, "sched-priority is only valid for real-time "
+                   "scheduling classes");
+        return;
+    }
+
+    pthread_mutex_lock(&thread_list_lock);
+    qapi_free_ThreadPolicy(thread_policy[policy->category]);
+    thread_policy[policy->category] = QAPI_CLONE(ThreadPolicy, policy);
+    QLIST_FOREACH(entry, &thread_list, next) {
+        if (entry->category == policy->category &&
+            qemu_thread_apply_policy(entry->tid, policy, errp)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&thread_list_lock);
+}
+
+ThreadInfoList *qmp_query_threads(Error **errp)
+{
+    ThreadInfoList *head = NULL;
+    QemuThreadEntry *entry;
+
+    pthread_mutex_lock(&thread_list_lock);
+    QLIST_FOREACH(entry, &thread_list, next) {
+        ThreadInfoList *elem = g_new0(ThreadInfoList, 1);
+
+        elem->value = g_new0(ThreadInfo, 1);
+        elem->value->name = g_strdup(entry->name);
+        elem->value->category = entry->category;
+        elem->value->thread_id = entry->tid;
+        elem->next = head;
+        head = elem;
+    }
+    pthread_mutex_unlock(&thread_list_lock);
+
+    return head;
+}
+
 typedef struct {
     void *(*start_routine)(void *);
     void *arg;
@@ -499,6 +739,7 @@ static void *qemu_thread_start(void *args)
     QemuThreadArgs *qemu_thread_args = args;
     void *(*start_routine)(void *) = qemu_thread_args->start_routine;
     void *arg = qemu_thread_args->arg;
+    QemuThreadEntry *entry;
     void *r;
 
 #ifdef CONFIG_THREAD_SETNAME_BYTHREAD
@@ -513,11 +754,13 @@ static void *qemu_thread_start(void *args)
 # endif
     }
 #endif
-    g_free(qemu_thread_args->name);
+    entry = qemu_thread_register(qemu_thread_args->name);
     g_free(qemu_thread_args);
+    pthread_cleanup_push(qemu_thread_unregister, entry);
     pthread_cleanup_push(qemu_thread_atexit_notify, NULL);
     r = start_routine(arg);
     pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
     return r;
 }
 
@@ -15,6 +15,8 @@
 #include "qemu-common.h"
 #include "qemu/thread.h"
 #include "qemu/notify.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-misc.h"
 #include "qemu-thread-common.h"
 #include <process.h>
 
@@ -28,6 +30,16 @@ void qemu_thread_naming(bool enable)
     fprintf(stderr, "qemu: thread naming not supported on this host\n");
 }
 
+void qmp_set_thread_policy(ThreadPolicy *policy, Error **errp)
+{
+    error_setg(errp, "Thread policies are not supported on this host");
+}
+
+ThreadInfoList *qmp_query_threads(Error **errp)
+{
+    return NULL;
+}
+
 static void error_exit(int err, const char *msg)
 {
     char *pstr;
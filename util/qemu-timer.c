@@ -64,7 +64,11 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    /* Binary min-heap of pending timers ordered by (expire_time, seq) */
+    QEMUTimer **active_timers;
+    unsigned int nr_active_timers;
+    unsigned int active_timers_size;
+    uint64_t timer_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -115,6 +119,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -169,7 +174,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!atomic_read(&timer_list->active_timers);
+    return !!atomic_read(&timer_list->nr_active_timers);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -182,16 +187,16 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->nr_active_timers) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return false;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timer_list->active_timers[0]->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -213,7 +218,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_active_timers)) {
         return -1;
     }
 
@@ -226,11 +231,11 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->nr_active_timers) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return -1;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timer_list->active_timers[0]->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -242,6 +247,33 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     return delta;
 }
 
+/*
+ * Find the earliest timer in the subtree rooted at heap index @i whose
+ * attributes are all in @attr_mask.  Subtrees whose root is not earlier
+ * than the best candidate so far are pruned, so when the head matches
+ * (the common case) this is O(1).
+ */
+static QEMUTimer *timerlist_first_matching(QEMUTimerList *timer_list,
+                                           unsigned int i, int attr_mask,
+                                           QEMUTimer *best)
+{
+    QEMUTimer *ts;
+
+    if (i >= timer_list->nr_active_timers) {
+        return best;
+    }
+    ts = timer_list->active_timers[i];
+    if (best && ts->expire_time >= best->expire_time) {
+        return best;
+    }
+    if (!(ts->attributes & ~attr_mask)) {
+        /* everything below is later than ts */
+        return ts;
+    }
+    best = timerlist_first_matching(timer_list, 2 * i + 1, attr_mask, best);
+    return timerlist_first_matching(timer_list, 2 * i + 2, attr_mask, best);
+}
+
 /* Calculate the soonest deadline across all timerlists attached
  * to the clock. This is used for the icount timeout so we
  * ignore whether or not the clock should be used in deadline
@@ -262,11 +294,8 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
 
     QLIST_FOREACH(timer_list, &clock->timerlists, list) {
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = timerlist_first_matching(timer_list, 0, attr_mask, NULL);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -379,43 +408,109 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+/*
+ * The active timers are kept in a binary min-heap.  Timers with the same
+ * expire_time are ordered by insertion, so they fire in the same order
+ * as they did with the old sorted list; record/replay depends on that.
+ */
+static inline bool timer_before(QEMUTimer *a, QEMUTimer *b)
 {
-    QEMUTimer **pt, *t;
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            atomic_set(pt, t->next);
+static inline void timer_heap_set(QEMUTimerList *timer_list,
+                                  unsigned int i, QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_sift_up(QEMUTimerList *timer_list, unsigned int i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
+        QEMUTimer *p = timer_list->active_timers[parent];
+
+        if (!timer_before(ts, p)) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, p);
+        i = parent;
     }
+    timer_heap_set(timer_list, i, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timer_heap_sift_down(QEMUTimerList *timer_list, unsigned int i)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->active_timers[i];
+    unsigned int n = timer_list->nr_active_timers;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        unsigned int child = 2 * i + 1;
+        QEMUTimer *c;
+
+        if (child >= n) {
+            break;
+        }
+        c = timer_list->active_timers[child];
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1], c)) {
+            child++;
+            c = timer_list->active_timers[child];
+        }
+        if (!timer_before(c, ts)) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, i, c);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    unsigned int i, last;
+
+    if (ts->expire_time == -1) {
+        return;
     }
+    ts->expire_time = -1;
+
+    i = ts->heap_index;
+    assert(i < timer_list->nr_active_timers &&
+           timer_list->active_timers[i] == ts);
+    last = timer_list->nr_active_timers - 1;
+    atomic_set(&timer_list->nr_active_timers, last);
+    if (i != last) {
+        timer_heap_set(timer_list, i, timer_list->active_timers[last]);
+        /* at most one of these moves the element */
+        timer_heap_sift_up(timer_list, i);
+        timer_heap_sift_down(timer_list, i);
+    }
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    unsigned int n = timer_list->nr_active_timers;
+
+    if (n == timer_list->active_timers_size) {
+        timer_list->active_timers_size = MAX(16, n * 2);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->active_timers_size);
+    }
+
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    atomic_set(pt, ts);
+    ts->seq = timer_list->timer_seq++;
+    timer_list->active_timers[n] = ts;
+    timer_heap_sift_up(timer_list, n);
+    atomic_set(&timer_list->nr_active_timers, n + 1);
 
-    return pt == &timer_list->active_timers;
+    return timer_list->active_timers[0] == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -509,7 +604,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     void *opaque;
     bool need_replay_checkpoint = false;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_active_timers)) {
         return false;
     }
 
@@ -558,7 +653,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while (timer_list->nr_active_timers) {
+        ts = timer_list->active_timers[0];
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -581,9 +677,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
@@ -16,6 +16,14 @@
  * either due to blocking (e.g. cond_wait, mutex_lock) or cache line
  * contention (e.g. mutex_lock, mutex_trylock).
  *
+ * For mutexes (including the BQL) we also profile hold times, i.e. the time
+ * between a successful lock and the matching unlock, which is attributed to
+ * the call site that acquired the lock. Each thread keeps a small stack of
+ * the mutexes it acquired while profiling was enabled; a hold ends on unlock
+ * or when the mutex is released by a condvar wait. Hold times are kept both
+ * as a total and as a log2 histogram, so that rare long critical sections
+ * stand out even when the average is low.
+ *
  * QSP's design focuses on speed and scalability. This is achieved
  * by having threads do their profiling entirely on thread-local data.
  * The appropriate thread-local data is found via a QHT, i.e. a concurrent hash
@@ -64,6 +72,7 @@
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
+#include "qemu/host-utils.h"
 
 enum QSPType {
     QSP_MUTEX,
@@ -85,10 +94,22 @@ struct QSPEntry {
     const QSPCallSite *callsite;
     uint64_t n_acqs;
     uint64_t ns;
+    uint64_t n_holds;
+    uint64_t hold_ns;
+    uint64_t hold_hist[QSP_HOLD_HIST_BUCKETS];
     unsigned int n_objs; /* count of coalesced objs; only used for reporting */
 };
 typedef struct QSPEntry QSPEntry;
 
+/* a mutex acquired by the current thread while profiling was enabled */
+struct QSPHeld {
+    const void *obj;
+    QSPEntry *e;
+    int64_t t0;
+    unsigned int gen;
+};
+typedef struct QSPHeld QSPHeld;
+
 struct QSPSnapshot {
     struct rcu_head rcu;
     struct qht ht;
@@ -98,6 +119,9 @@ typedef struct QSPSnapshot QSPSnapshot;
 /* initial sizing for hash tables */
 #define QSP_INITIAL_SIZE 64
 
+/* max number of nested mutexes per thread whose hold time we track */
+#define QSP_MAX_HELD 16
+
 /* If this file is moved, QSP_REL_PATH should be updated accordingly */
 #define QSP_REL_PATH "util/qsp.c"
 
@@ -107,6 +131,16 @@ static size_t qsp_qemu_path_len;
 /* the address of qsp_thread gives us a unique 'thread ID' */
 static __thread int qsp_thread;
 
+static __thread QSPHeld qsp_held[QSP_MAX_HELD];
+static __thread unsigned int qsp_n_held;
+
+/*
+ * Bumped by qsp_enable(). Mutexes acquired before profiling was last disabled
+ * may still be in a thread's qsp_held stack; the generation lets us ignore
+ * them instead of reporting bogus hold times.
+ */
+static unsigned int qsp_gen;
+
 /*
  * Call sites are the same for all threads, so we track them in a separate hash
  * table to save memory.
@@ -127,6 +161,7 @@ static const char * const qsp_typenames[] = {
 QemuMutexLockFunc qemu_bql_mutex_lock_func = qemu_mutex_lock_impl;
 QemuMutexLockFunc qemu_mutex_lock_func = qemu_mutex_lock_impl;
 QemuMutexTrylockFunc qemu_mutex_trylock_func = qemu_mutex_trylock_impl;
+QemuMutexUnlockFunc qemu_mutex_unlock_func = qemu_mutex_unlock_impl;
 QemuRecMutexLockFunc qemu_rec_mutex_lock_func = qemu_rec_mutex_lock_impl;
 QemuRecMutexTrylockFunc qemu_rec_mutex_trylock_func =
     qemu_rec_mutex_trylock_impl;
@@ -357,7 +392,74 @@ static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
     do_qsp_entry_record(e, delta, true);
 }
 
-#define QSP_GEN_VOID(type_, qsp_t_, func_, impl_)                       \
+static inline unsigned int qsp_hold_bucket(int64_t ns)
+{
+    uint64_t us = ns / 1000;
+
+    if (!us) {
+        return 0;
+    }
+    return MIN(64 - clz64(us), QSP_HOLD_HIST_BUCKETS - 1);
+}
+
+/* as do_qsp_entry_record, @e is only written to by the current thread */
+static void qsp_entry_record_hold(QSPEntry *e, int64_t delta)
+{
+    unsigned int b = qsp_hold_bucket(delta);
+
+    atomic_set_u64(&e->hold_ns, e->hold_ns + delta);
+    atomic_set_u64(&e->n_holds, e->n_holds + 1);
+    atomic_set_u64(&e->hold_hist[b], e->hold_hist[b] + 1);
+}
+
+static void qsp_held_push(const void *obj, QSPEntry *e, int64_t t0)
+{
+    unsigned int gen = atomic_read(&qsp_gen);
+    QSPHeld *h;
+
+    /* everything below a stale entry is stale too */
+    if (qsp_n_held && qsp_held[qsp_n_held - 1].gen != gen) {
+        qsp_n_held = 0;
+    }
+    if (unlikely(qsp_n_held == QSP_MAX_HELD)) {
+        return;
+    }
+    h = &qsp_held[qsp_n_held++];
+    h->obj = obj;
+    h->e = e;
+    h->t0 = t0;
+    h->gen = gen;
+}
+
+static QSPHeld *qsp_held_find(const void *obj)
+{
+    int i;
+
+    /* locks are usually released in LIFO order */
+    for (i = qsp_n_held - 1; i >= 0; i--) {
+        if (qsp_held[i].obj == obj) {
+            return &qsp_held[i];
+        }
+    }
+    return NULL;
+}
+
+static void qsp_held_record(QSPHeld *h, int64_t t1)
+{
+    if (h->gen == atomic_read(&qsp_gen)) {
+        qsp_entry_record_hold(h->e, t1 - h->t0);
+    }
+}
+
+static void qsp_held_remove(QSPHeld *h)
+{
+    QSPHeld *end = &qsp_held[qsp_n_held];
+
+    memmove(h, h + 1, (end - h - 1) * sizeof(*h));
+    qsp_n_held--;
+}
+
+#define QSP_GEN_VOID(type_, qsp_t_, func_, impl_, held_)                \
     static void func_(type_ *obj, const char *file, int line)           \
     {                                                                   \
         QSPEntry *e;                                                    \
@@ -369,9 +471,12 @@ static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
                                                                         \
         e = qsp_entry_get(obj, file, line, qsp_t_);                     \
         qsp_entry_record(e, t1 - t0);                                   \
+        if (held_) {                                                    \
+            qsp_held_push(obj, e, t1);                                  \
+        }                                                               \
     }
 
-#define QSP_GEN_RET1(type_, qsp_t_, func_, impl_)                       \
+#define QSP_GEN_RET1(type_, qsp_t_, func_, impl_, held_)                \
     static int func_(type_ *obj, const char *file, int line)            \
     {                                                                   \
         QSPEntry *e;                                                    \
@@ -384,30 +489,65 @@ static inline void qsp_entry_record(QSPEntry *e, int64_t delta)
                                                                         \
         e = qsp_entry_get(obj, file, line, qsp_t_);                     \
         do_qsp_entry_record(e, t1 - t0, !err);                          \
+        if (held_ && !err) {                                            \
+            qsp_held_push(obj, e, t1);                                  \
+        }                                                               \
         return err;                                                     \
     }
 
-QSP_GEN_VOID(QemuMutex, QSP_BQL_MUTEX, qsp_bql_mutex_lock, qemu_mutex_lock_impl)
-QSP_GEN_VOID(QemuMutex, QSP_MUTEX, qsp_mutex_lock, qemu_mutex_lock_impl)
-QSP_GEN_RET1(QemuMutex, QSP_MUTEX, qsp_mutex_trylock, qemu_mutex_trylock_impl)
+QSP_GEN_VOID(QemuMutex, QSP_BQL_MUTEX, qsp_bql_mutex_lock, qemu_mutex_lock_impl,
+             true)
+QSP_GEN_VOID(QemuMutex, QSP_MUTEX, qsp_mutex_lock, qemu_mutex_lock_impl, true)
+QSP_GEN_RET1(QemuMutex, QSP_MUTEX, qsp_mutex_trylock, qemu_mutex_trylock_impl,
+             true)
 
+/* recursive mutexes can be re-entered, so we do not track their hold times */
 QSP_GEN_VOID(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_lock,
-             qemu_rec_mutex_lock_impl)
+             qemu_rec_mutex_lock_impl, false)
 QSP_GEN_RET1(QemuRecMutex, QSP_REC_MUTEX, qsp_rec_mutex_trylock,
-             qemu_rec_mutex_trylock_impl)
+             qemu_rec_mutex_trylock_impl, false)
 
 #undef QSP_GEN_RET1
 #undef QSP_GEN_VOID
 
+static void qsp_mutex_unlock(QemuMutex *mutex, const char *file, int line)
+{
+    QSPHeld *h = qsp_held_find(mutex);
+
+    if (h) {
+        qsp_held_record(h, get_clock());
+        qsp_held_remove(h);
+    }
+    qemu_mutex_unlock_impl(mutex, file, line);
+}
+
+/*
+ * A condvar wait drops @mutex while sleeping; end the current hold before
+ * waiting and start a new one, for the same call site, once we wake up.
+ */
+static void qsp_held_resume(QSPHeld *h, int64_t t1)
+{
+    if (h) {
+        h->t0 = t1;
+        h->gen = atomic_read(&qsp_gen);
+    }
+}
+
 static void
 qsp_cond_wait(QemuCond *cond, QemuMutex *mutex, const char *file, int line)
 {
     QSPEntry *e;
+    QSPHeld *h;
     int64_t t0, t1;
 
     t0 = get_clock();
+    h = qsp_held_find(mutex);
+    if (h) {
+        qsp_held_record(h, t0);
+    }
     qemu_cond_wait_impl(cond, mutex, file, line);
     t1 = get_clock();
+    qsp_held_resume(h, t1);
 
     e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
     qsp_entry_record(e, t1 - t0);
@@ -418,12 +558,18 @@ qsp_cond_timedwait(QemuCond *cond, QemuMutex *mutex, int ms,
                    const char *file, int line)
 {
     QSPEntry *e;
+    QSPHeld *h;
     int64_t t0, t1;
     bool ret;
 
     t0 = get_clock();
+    h = qsp_held_find(mutex);
+    if (h) {
+        qsp_held_record(h, t0);
+    }
     ret = qemu_cond_timedwait_impl(cond, mutex, ms, file, line);
     t1 = get_clock();
+    qsp_held_resume(h, t1);
 
     e = qsp_entry_get(cond, file, line, QSP_CONDVAR);
     qsp_entry_record(e, t1 - t0);
@@ -437,6 +583,12 @@ bool qsp_is_enabled(void)
 
 void qsp_enable(void)
 {
+    /*
+     * Install the unlock hook first, so that no mutex acquired through
+     * the profiler is released without it.
+     */
+    atomic_inc(&qsp_gen);
+    atomic_set(&qemu_mutex_unlock_func, qsp_mutex_unlock);
     atomic_set(&qemu_mutex_lock_func, qsp_mutex_lock);
     atomic_set(&qemu_mutex_trylock_func, qsp_mutex_trylock);
     atomic_set(&qemu_bql_mutex_lock_func, qsp_bql_mutex_lock);
@@ -455,6 +607,7 @@ void qsp_disable(void)
     atomic_set(&qemu_rec_mutex_trylock_func, qemu_rec_mutex_trylock_impl);
     atomic_set(&qemu_cond_wait_func, qemu_cond_wait_impl);
     atomic_set(&qemu_cond_timedwait_func, qemu_cond_timedwait_impl);
+    atomic_set(&qemu_mutex_unlock_func, qemu_mutex_unlock_impl);
 }
 
 static gint qsp_tree_cmp(gconstpointer ap, gconstpointer bp, gpointer up)
@@ -485,6 +638,25 @@ static gint qsp_tree_cmp(gconstpointer ap, gconstpointer bp, gpointer up)
         }
         break;
     }
+    case QSP_SORT_BY_TOTAL_HOLD_TIME:
+        if (a->hold_ns > b->hold_ns) {
+            return -1;
+        } else if (a->hold_ns < b->hold_ns) {
+            return 1;
+        }
+        break;
+    case QSP_SORT_BY_AVG_HOLD_TIME:
+    {
+        double avg_a = a->n_holds ? a->hold_ns / a->n_holds : 0;
+        double avg_b = b->n_holds ? b->hold_ns / b->n_holds : 0;
+
+        if (avg_a > avg_b) {
+            return -1;
+        } else if (avg_a < avg_b) {
+            return 1;
+        }
+        break;
+    }
     default:
         g_assert_not_reached();
     }
@@ -531,6 +703,7 @@ static void qsp_aggregate(void *p, uint32_t h, void *up)
     const QSPEntry *e = p;
     QSPEntry *agg;
     uint32_t hash;
+    int i;
 
     hash = qsp_entry_no_thread_hash(e);
     agg = qsp_entry_find(ht, e, hash);
@@ -540,6 +713,11 @@ static void qsp_aggregate(void *p, uint32_t h, void *up)
      */
     agg->ns += atomic_read_u64(&e->ns);
     agg->n_acqs += atomic_read_u64(&e->n_acqs);
+    agg->hold_ns += atomic_read_u64(&e->hold_ns);
+    agg->n_holds += atomic_read_u64(&e->n_holds);
+    for (i = 0; i < QSP_HOLD_HIST_BUCKETS; i++) {
+        agg->hold_hist[i] += atomic_read_u64(&e->hold_hist[i]);
+    }
 }
 
 static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
@@ -547,6 +725,7 @@ static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
     struct qht *ht = htp;
     QSPEntry *old = p;
     QSPEntry *new;
+    int i;
 
     new = qht_lookup(ht, old, hash);
     /* entries are never deleted, so we must have this one */
@@ -554,12 +733,18 @@ static void qsp_iter_diff(void *p, uint32_t hash, void *htp)
     /* our reading of the stats happened after the snapshot was taken */
     g_assert(new->n_acqs >= old->n_acqs);
     g_assert(new->ns >= old->ns);
+    g_assert(new->n_holds >= old->n_holds);
 
     new->n_acqs -= old->n_acqs;
     new->ns -= old->ns;
+    new->n_holds -= old->n_holds;
+    new->hold_ns -= old->hold_ns;
+    for (i = 0; i < QSP_HOLD_HIST_BUCKETS; i++) {
+        new->hold_hist[i] -= old->hold_hist[i];
+    }
 
     /* No point in reporting an empty entry */
-    if (new->n_acqs == 0 && new->ns == 0) {
+    if (new->n_acqs == 0 && new->ns == 0 && new->n_holds == 0) {
         bool removed = qht_remove(ht, new, hash);
 
         g_assert(removed);
@@ -578,6 +763,7 @@ static void qsp_iter_callsite_coalesce(void *p, uint32_t h, void *htp)
     QSPEntry *old = p;
     QSPEntry *e;
     uint32_t hash;
+    int i;
 
     hash = qsp_entry_no_thread_obj_hash(old);
     e = qht_lookup(ht, old, hash);
@@ -589,6 +775,11 @@ static void qsp_iter_callsite_coalesce(void *p, uint32_t h, void *htp)
     }
     e->ns += old->ns;
     e->n_acqs += old->n_acqs;
+    e->hold_ns += old->hold_ns;
+    e->n_holds += old->n_holds;
+    for (i = 0; i < QSP_HOLD_HIST_BUCKETS; i++) {
+        e->hold_hist[i] += old->hold_hist[i];
+    }
 }
 
 static void qsp_ht_delete(void *p, uint32_t h, void *htp)
@@ -660,17 +851,6 @@ static char *qsp_at(const QSPCallSite *callsite)
     return g_string_free(s, FALSE);
 }
 
-struct QSPReportEntry {
-    const void *obj;
-    char *callsite_at;
-    const char *typename;
-    double time_s;
-    double ns_avg;
-    uint64_t n_acqs;
-    unsigned int n_objs;
-};
-typedef struct QSPReportEntry QSPReportEntry;
-
 struct QSPReport {
     QSPReportEntry *entries;
     size_t n_entries;
@@ -694,9 +874,11 @@ static gboolean qsp_tree_report(gpointer key, gpointer value, gpointer udata)
     entry->n_objs = e->n_objs;
     entry->callsite_at = qsp_at(e->callsite);
     entry->typename = qsp_typenames[e->callsite->type];
-    entry->time_s = e->ns * 1e-9;
     entry->n_acqs = e->n_acqs;
-    entry->ns_avg = e->n_acqs ? e->ns / e->n_acqs : 0;
+    entry->wait_ns = e->ns;
+    entry->n_holds = e->n_holds;
+    entry->hold_ns = e->hold_ns;
+    memcpy(entry->hold_hist, e->hold_hist, sizeof(entry->hold_hist));
     return FALSE;
 }
 
@@ -724,10 +906,11 @@ static void pr_report(const QSPReport *rep)
     callsite_rspace = callsite_len - strlen("Call site");
 
     qemu_printf("Type               Object  Call site%*s  Wait Time (s)  "
-                "       Count  Average (us)\n", callsite_rspace, "");
+                "       Count  Average (us)  Hold Time (s)  Avg Hold (us)\n",
+                callsite_rspace, "");
 
     /* build a horizontal rule with dashes */
-    n_dashes = 79 + callsite_rspace;
+    n_dashes = 109 + callsite_rspace;
     dashes = g_malloc(n_dashes + 1);
     memset(dashes, '-', n_dashes);
     dashes[n_dashes] = '\0';
@@ -736,6 +919,8 @@ static void pr_report(const QSPReport *rep)
     for (i = 0; i < rep->n_entries; i++) {
         const QSPReportEntry *e = &rep->entries[i];
         GString *s = g_string_new(NULL);
+        double ns_avg = e->n_acqs ? e->wait_ns / e->n_acqs : 0;
+        double hold_avg = e->n_holds ? e->hold_ns / e->n_holds : 0;
 
         g_string_append_printf(s, "%-9s  ", e->typename);
         if (e->n_objs > 1) {
@@ -743,10 +928,12 @@ static void pr_report(const QSPReport *rep)
         } else {
             g_string_append_printf(s, "%14p", e->obj);
         }
-        g_string_append_printf(s, "  %s%*s  %13.5f  %12" PRIu64 "  %12.2f\n",
+        g_string_append_printf(s, "  %s%*s  %13.5f  %12" PRIu64 "  %12.2f"
+                               "  %13.5f  %13.2f\n",
                                e->callsite_at,
                                callsite_len - (int)strlen(e->callsite_at), "",
-                               e->time_s, e->n_acqs, e->ns_avg * 1e-3);
+                               e->wait_ns / 1e9, e->n_acqs, ns_avg / 1e3,
+                               e->hold_ns / 1e9, hold_avg / 1e3);
         qemu_printf("%s", s->str);
         g_string_free(s, TRUE);
     }
@@ -767,26 +954,46 @@ static void report_destroy(QSPReport *rep)
     g_free(rep->entries);
 }
 
-void qsp_report(size_t max, enum QSPSortBy sort_by,
-                bool callsite_coalesce)
+static void report_init(QSPReport *rep, size_t max, enum QSPSortBy sort_by,
+                        bool callsite_coalesce)
 {
     GTree *tree = g_tree_new_full(qsp_tree_cmp, &sort_by, g_free, NULL);
-    QSPReport rep;
 
     qsp_init();
 
-    rep.entries = g_new0(QSPReportEntry, max);
-    rep.n_entries = 0;
-    rep.max_n_entries = max;
+    rep->entries = g_new0(QSPReportEntry, max);
+    rep->n_entries = 0;
+    rep->max_n_entries = max;
 
     qsp_mktree(tree, callsite_coalesce);
-    g_tree_foreach(tree, qsp_tree_report, &rep);
+    g_tree_foreach(tree, qsp_tree_report, rep);
     g_tree_destroy(tree);
+}
 
+void qsp_report(size_t max, enum QSPSortBy sort_by,
+                bool callsite_coalesce)
+{
+    QSPReport rep;
+
+    report_init(&rep, max, sort_by, callsite_coalesce);
     pr_report(&rep);
     report_destroy(&rep);
 }
 
+void qsp_report_iter(size_t max, enum QSPSortBy sort_by,
+                     bool callsite_coalesce, QSPReportFunc func,
+                     void *opaque)
+{
+    QSPReport rep;
+    size_t i;
+
+    report_init(&rep, max, sort_by, callsite_coalesce);
+    for (i = 0; i < rep.n_entries; i++) {
+        func(&rep.entries[i], opaque);
+    }
+    report_destroy(&rep);
+}
+
 static void qsp_snapshot_destroy(QSPSnapshot *snap)
 {
     qht_iter(&snap->ht, qsp_ht_delete, NULL);
@@ -139,9 +139,29 @@ static void wait_for_readers(void)
     QLIST_SWAP(&registry, &qsreaders, node);
 }
 
+/*
+ * Number of grace periods completed by synchronize_rcu, protected by
+ * rcu_sync_lock.
+ */
+static unsigned long rcu_gp_done;
+
 void synchronize_rcu(void)
 {
+    unsigned long gp_snap;
+
+    /*
+     * Order earlier stores against the read of rcu_gp_done.  Once two
+     * more grace periods have completed, at least one of them started
+     * after this point, so there is no need to run another.
+     */
+    smp_mb();
+    gp_snap = atomic_read(&rcu_gp_done);
+
     qemu_mutex_lock(&rcu_sync_lock);
+    if (rcu_gp_done - gp_snap >= 2) {
+        qemu_mutex_unlock(&rcu_sync_lock);
+        return;
+    }
 
     /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
      * Pairs with smp_mb_placeholder() in rcu_read_lock().
@@ -171,12 +191,16 @@ void synchronize_rcu(void)
     }
 
     qemu_mutex_unlock(&rcu_registry_lock);
+    atomic_set(&rcu_gp_done, rcu_gp_done + 1);
     qemu_mutex_unlock(&rcu_sync_lock);
 }
 
 
 #define RCU_CALL_MIN_SIZE        30
 
+/* Callbacks staged by a registered thread before it touches the queue */
+#define RCU_CALL_BATCH_SIZE      16
+
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
@@ -185,13 +209,19 @@ static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
 static QemuEvent rcu_call_ready_event;
 
-static void enqueue(struct rcu_head *node)
+/* Append the chain from @first to @last, whose last->next is NULL.  */
+static void enqueue_chain(struct rcu_head *first, struct rcu_head *last)
 {
     struct rcu_head **old_tail;
 
+    old_tail = atomic_xchg(&tail, &last->next);
+    atomic_mb_set(old_tail, first);
+}
+
+static void enqueue(struct rcu_head *node)
+{
     node->next = NULL;
-    old_tail = atomic_xchg(&tail, &node->next);
-    atomic_mb_set(old_tail, node);
+    enqueue_chain(node, node);
 }
 
 static struct rcu_head *try_dequeue(void)
@@ -234,6 +264,50 @@ retry:
     return node;
 }
 
+/*
+ * Move a chain of staged callbacks, newest first, to the queue in the
+ * order they were staged.
+ */
+static void enqueue_staged(struct rcu_head *node)
+{
+    struct rcu_head *first = NULL, *last = node, *next;
+    int n = 0;
+
+    if (!node) {
+        return;
+    }
+    while (node) {
+        next = node->next;
+        node->next = first;
+        first = node;
+        node = next;
+        n++;
+    }
+    enqueue_chain(first, last);
+    atomic_add(&rcu_call_count, n);
+}
+
+/* Flush the callbacks staged by the current thread.  */
+static void call_rcu_flush_self(void)
+{
+    rcu_reader.call_pending_count = 0;
+    enqueue_staged(atomic_xchg(&rcu_reader.call_pending, NULL));
+}
+
+/* Flush the callbacks staged by all registered threads.  */
+static void call_rcu_flush_all(void)
+{
+    struct rcu_reader_data *index;
+
+    qemu_mutex_lock(&rcu_registry_lock);
+    QLIST_FOREACH(index, &registry, node) {
+        if (atomic_read(&index->call_pending)) {
+            enqueue_staged(atomic_xchg(&index->call_pending, NULL));
+        }
+    }
+    qemu_mutex_unlock(&rcu_registry_lock);
+}
+
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
@@ -242,7 +316,10 @@ static void *call_rcu_thread(void *opaque)
 
     for (;;) {
         int tries = 0;
-        int n = atomic_read(&rcu_call_count);
+        int n;
+
+        call_rcu_flush_all();
+        n = atomic_read(&rcu_call_count);
 
         /* Heuristically wait for a decent number of callbacks to pile up.
          * Fetch rcu_call_count now, we only must process elements that were
@@ -252,6 +329,7 @@ static void *call_rcu_thread(void *opaque)
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
+                call_rcu_flush_all();
                 n = atomic_read(&rcu_call_count);
                 if (n == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
@@ -260,6 +338,7 @@ static void *call_rcu_thread(void *opaque)
                     qemu_event_wait(&rcu_call_ready_event);
                 }
             }
+            call_rcu_flush_all();
             n = atomic_read(&rcu_call_count);
         }
 
@@ -289,7 +368,31 @@ static void *call_rcu_thread(void *opaque)
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_head *old;
+
     node->func = func;
+
+    /*
+     * Registered threads stage callbacks in a thread-local list, which only
+     * the call_rcu thread steals from, and move them to the shared queue
+     * a batch at a time.  The call_rcu thread only needs waking up for the
+     * first callback of a batch.
+     */
+    if (rcu_reader.registered) {
+        do {
+            old = atomic_read(&rcu_reader.call_pending);
+            node->next = old;
+        } while (atomic_cmpxchg(&rcu_reader.call_pending, old, node) != old);
+
+        if (++rcu_reader.call_pending_count >= RCU_CALL_BATCH_SIZE) {
+            call_rcu_flush_self();
+        }
+        if (!old) {
+            qemu_event_set(&rcu_call_ready_event);
+        }
+        return;
+    }
+
     enqueue(node);
     atomic_inc(&rcu_call_count);
     qemu_event_set(&rcu_call_ready_event);
@@ -300,6 +403,7 @@ void rcu_register_thread(void)
     assert(rcu_reader.ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_INSERT_HEAD(&registry, &rcu_reader, node);
+    rcu_reader.registered = true;
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
@@ -307,7 +411,14 @@ void rcu_unregister_thread(void)
 {
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_REMOVE(&rcu_reader, node);
+    rcu_reader.registered = false;
     qemu_mutex_unlock(&rcu_registry_lock);
+
+    /* Nobody else will find our staged callbacks from now on */
+    if (atomic_read(&rcu_reader.call_pending)) {
+        call_rcu_flush_self();
+        qemu_event_set(&rcu_call_ready_event);
+    }
 }
 
 static void rcu_init_complete(void)
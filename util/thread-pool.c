@@ -18,6 +18,7 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
@@ -45,6 +46,9 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
+    /* Time of submission, for the latency statistics.  */
+    int64_t submit_ns;
+
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
@@ -58,7 +62,6 @@ struct ThreadPool {
     QemuMutex lock;
     QemuCond worker_stopped;
     QemuSemaphore sem;
-    int max_threads;
     QEMUBH *new_thread_bh;
 
     /* The following variables are only accessed from one AioContext. */
@@ -70,6 +73,11 @@ struct ThreadPool {
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
+    int min_threads;
+    int max_threads;
+    int queued;          /* requests waiting for a worker */
+    uint64_t completed;
+    uint64_t total_ns;   /* sum of submission-to-completion times */
     bool stopping;
 };
 
@@ -91,26 +99,38 @@ static void *worker_thread(void *opaque)
             ret = qemu_sem_timedwait(&pool->sem, 10000);
             qemu_mutex_lock(&pool->lock);
             pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
+        } while (ret == -1 &&
+                 (!QTAILQ_EMPTY(&pool->request_list) ||
+                  pool->cur_threads <= pool->min_threads));
         if (ret == -1 || pool->stopping) {
             break;
         }
 
         req = QTAILQ_FIRST(&pool->request_list);
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        pool->queued--;
         req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
         ret = req->func(req->arg);
 
         req->ret = ret;
+        qemu_mutex_lock(&pool->lock);
+
+        /* Update the statistics before the completion callback can run */
+        pool->completed++;
+        pool->total_ns += get_clock() - req->submit_ns;
+
         /* Write ret before state.  */
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
         qemu_bh_schedule(pool->completion_bh);
+
+        /* The pool was shrunk by thread_pool_update_params() */
+        if (pool->cur_threads > pool->max_threads) {
+            break;
+        }
     }
 
     pool->cur_threads--;
@@ -219,6 +239,7 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        pool->queued--;
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -252,6 +273,7 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->submit_ns = get_clock();
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
@@ -262,6 +284,7 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         spawn_thread(pool);
     }
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    pool->queued++;
     qemu_mutex_unlock(&pool->lock);
     qemu_sem_post(&pool->sem);
     return &req->common;
@@ -295,6 +318,35 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
+{
+    qemu_mutex_lock(&pool->lock);
+
+    pool->min_threads = ctx->thread_pool_min;
+    pool->max_threads = ctx->thread_pool_max;
+
+    /* Workers above max_threads exit after their current request, and
+     * idle ones above min_threads time out on their own; only growing
+     * the pool needs to be done here.
+     */
+    while (pool->cur_threads < pool->min_threads) {
+        spawn_thread(pool);
+    }
+
+    qemu_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    qemu_mutex_lock(&pool->lock);
+    stats->threads = pool->cur_threads;
+    stats->idle_threads = pool->idle_threads;
+    stats->queue_depth = pool->queued;
+    stats->completed = pool->completed;
+    stats->total_ns = pool->total_ns;
+    qemu_mutex_unlock(&pool->lock);
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
     if (!ctx) {
@@ -307,11 +359,12 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
     qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
     QTAILQ_INIT(&pool->request_list);
+
+    thread_pool_update_params(pool, ctx);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
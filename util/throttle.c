@@ -445,12 +445,25 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
-/* do the accounting for this operation
+static void throttle_bucket_add(LeakyBucket *bkt, double amount)
+{
+    bkt->level = MAX(bkt->level + amount, 0);
+    if (bkt->burst_length > 1) {
+        bkt->burst_level = MAX(bkt->burst_level + amount, 0);
+    }
+}
+
+/* do the accounting for a number of bytes and units at once
+ *
+ * Negative values give back bytes and units that were accounted in
+ * advance and not used; the bucket levels never go below zero.
  *
  * @is_write: the type of operation (read/write)
- * @size:     the size of the operation
+ * @size:     the number of bytes
+ * @units:    the number of units (operations)
  */
-void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
+void throttle_account_units(ThrottleState *ts, bool is_write,
+                            double size, double units)
 {
     const BucketType bucket_types_size[2][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -460,29 +473,31 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
+    for (i = 0; i < 2; i++) {
+        throttle_bucket_add(&ts->cfg.buckets[bucket_types_size[is_write][i]],
+                            size);
+        throttle_bucket_add(&ts->cfg.buckets[bucket_types_units[is_write][i]],
+                            units);
+    }
+}
+
+/* do the accounting for this operation
+ *
+ * @is_write: the type of operation (read/write)
+ * @size:     the size of the operation
+ */
+void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
+{
+    double units = 1.0;
+
     /* if cfg.op_size is defined and smaller than size we compute unit count */
     if (ts->cfg.op_size && size > ts->cfg.op_size) {
         units = (double) size / ts->cfg.op_size;
     }
 
-    for (i = 0; i < 2; i++) {
-        LeakyBucket *bkt;
-
-        bkt = &ts->cfg.buckets[bucket_types_size[is_write][i]];
-        bkt->level += size;
-        if (bkt->burst_length > 1) {
-            bkt->burst_level += size;
-        }
-
-        bkt = &ts->cfg.buckets[bucket_types_units[is_write][i]];
-        bkt->level += units;
-        if (bkt->burst_length > 1) {
-            bkt->burst_level += units;
-        }
-    }
+    throttle_account_units(ts, is_write, size, units);
 }
 
 /* return a ThrottleConfig based on the options in a ThrottleLimits
@@ -21,6 +21,7 @@
 #include "standard-headers/linux/pci_regs.h"
 #include "qemu/event_notifier.h"
 #include "qemu/vfio-helpers.h"
+#include "qemu/iova-tree.h"
 #include "trace.h"
 
 #define QEMU_VFIO_DEBUG 0
@@ -32,13 +33,6 @@
  **/
 #define QEMU_VFIO_IOVA_MAX (1ULL << 39)
 
-typedef struct {
-    /* Page aligned addr. */
-    void *host;
-    size_t size;
-    uint64_t iova;
-} IOVAMapping;
-
 struct QEMUVFIOState {
     QemuMutex lock;
 
@@ -87,8 +81,10 @@ struct QEMUVFIOState {
      **/
     uint64_t low_water_mark;
     uint64_t high_water_mark;
-    IOVAMapping *mappings;
-    int nr_mappings;
+    /* Fixed mappings, keyed by host virtual address: in each DMAMap, @iova
+     * holds the (page aligned) host address and @translated_addr the IOVA
+     * it is mapped to. */
+    IOVATree *mappings;
 };
 
 /**
@@ -416,6 +412,7 @@ static void qemu_vfio_open_common(QEMUVFIOState *s)
     ram_block_notifier_add(&s->ram_notifier);
     s->low_water_mark = QEMU_VFIO_IOVA_MIN;
     s->high_water_mark = QEMU_VFIO_IOVA_MAX;
+    s->mappings = iova_tree_new();
     qemu_ram_foreach_block(qemu_vfio_init_ramblock, s);
 }
 
@@ -436,99 +433,53 @@ QEMUVFIOState *qemu_vfio_open_pci(const char *device, Error **errp)
     return s;
 }
 
-static void qemu_vfio_dump_mapping(IOVAMapping *m)
+static gboolean qemu_vfio_dump_mapping(DMAMap *m)
 {
-    if (QEMU_VFIO_DEBUG) {
-        printf("  vfio mapping %p %" PRIx64 " to %" PRIx64 "\n", m->host,
-               (uint64_t)m->size, (uint64_t)m->iova);
-    }
+    printf("  vfio mapping %p %" PRIx64 " to %" PRIx64 "\n",
+           (void *)(uintptr_t)m->iova, (uint64_t)m->size + 1,
+           (uint64_t)m->translated_addr);
+    return false;
 }
 
 static void qemu_vfio_dump_mappings(QEMUVFIOState *s)
 {
-    int i;
-
     if (QEMU_VFIO_DEBUG) {
         printf("vfio mappings\n");
-        for (i = 0; i < s->nr_mappings; ++i) {
-            qemu_vfio_dump_mapping(&s->mappings[i]);
-        }
+        iova_tree_foreach(s->mappings, qemu_vfio_dump_mapping);
     }
 }
 
 /**
- * Find the mapping entry that contains [host, host + size) and set @index to
- * the position. If no entry contains it, @index is the position _after_ which
- * to insert the new mapping. IOW, it is the index of the largest element that
- * is smaller than @host, or -1 if no entry is.
+ * Find the fixed mapping entry that contains @host, or return NULL if there
+ * is none.  The lookup is O(log n) in the number of mappings.
  */
-static IOVAMapping *qemu_vfio_find_mapping(QEMUVFIOState *s, void *host,
-                                           int *index)
+static DMAMap *qemu_vfio_find_mapping(QEMUVFIOState *s, void *host)
 {
-    IOVAMapping *p = s->mappings;
-    IOVAMapping *q = p ? p + s->nr_mappings - 1 : NULL;
-    IOVAMapping *mid;
     trace_qemu_vfio_find_mapping(s, host);
-    if (!p) {
-        *index = -1;
-        return NULL;
-    }
-    while (true) {
-        mid = p + (q - p) / 2;
-        if (mid == p) {
-            break;
-        }
-        if (mid->host > host) {
-            q = mid;
-        } else if (mid->host < host) {
-            p = mid;
-        } else {
-            break;
-        }
-    }
-    if (mid->host > host) {
-        mid--;
-    } else if (mid < &s->mappings[s->nr_mappings - 1]
-               && (mid + 1)->host <= host) {
-        mid++;
-    }
-    *index = mid - &s->mappings[0];
-    if (mid >= &s->mappings[0] &&
-        mid->host <= host && mid->host + mid->size > host) {
-        assert(mid < &s->mappings[s->nr_mappings]);
-        return mid;
-    }
-    /* At this point *index + 1 is the right position to insert the new
-     * mapping.*/
-    return NULL;
+    return iova_tree_find_address(s->mappings, (uintptr_t)host);
 }
 
 /**
- * Allocate IOVA and and create a new mapping record and insert it in @s.
+ * Create a new mapping record for [host, host + size) at @iova and insert it
+ * in @s.
  */
-static IOVAMapping *qemu_vfio_add_mapping(QEMUVFIOState *s,
-                                          void *host, size_t size,
-                                          int index, uint64_t iova)
+static int qemu_vfio_add_mapping(QEMUVFIOState *s, void *host, size_t size,
+                                 uint64_t iova)
 {
-    int shift;
-    IOVAMapping m = {.host = host, .size = size, .iova = iova};
-    IOVAMapping *insert;
+    DMAMap m = {
+        .iova = (uintptr_t)host,
+        .translated_addr = iova,
+        .size = size - 1,
+        .perm = IOMMU_RW,
+    };
 
     assert(QEMU_IS_ALIGNED(size, getpagesize()));
     assert(QEMU_IS_ALIGNED(s->low_water_mark, getpagesize()));
     assert(QEMU_IS_ALIGNED(s->high_water_mark, getpagesize()));
-    trace_qemu_vfio_new_mapping(s, host, size, index, iova);
-
-    assert(index >= 0);
-    s->nr_mappings++;
-    s->mappings = g_renew(IOVAMapping, s->mappings, s->nr_mappings);
-    insert = &s->mappings[index];
-    shift = s->nr_mappings - index - 1;
-    if (shift) {
-        memmove(insert + 1, insert, shift * sizeof(s->mappings[0]));
-    }
-    *insert = m;
-    return insert;
+    trace_qemu_vfio_new_mapping(s, host, size, iova);
+
+    /* Callers must not map areas overlapping existing fixed mappings. */
+    return iova_tree_insert(s->mappings, &m) == IOVA_OK ? 0 : -EINVAL;
 }
 
 /* Do the DMA mapping with VFIO. */
@@ -552,52 +503,25 @@ static int qemu_vfio_do_mapping(QEMUVFIOState *s, void *host, size_t size,
 }
 
 /**
- * Undo the DMA mapping from @s with VFIO, and remove from mapping list.
+ * Undo the DMA mapping from @s with VFIO, and remove from mapping tree.
  */
-static void qemu_vfio_undo_mapping(QEMUVFIOState *s, IOVAMapping *mapping,
+static void qemu_vfio_undo_mapping(QEMUVFIOState *s, DMAMap *mapping,
                                    Error **errp)
 {
-    int index;
+    DMAMap range = *mapping;
     struct vfio_iommu_type1_dma_unmap unmap = {
         .argsz = sizeof(unmap),
         .flags = 0,
-        .iova = mapping->iova,
-        .size = mapping->size,
+        .iova = mapping->translated_addr,
+        .size = mapping->size + 1,
     };
 
-    index = mapping - s->mappings;
-    assert(mapping->size > 0);
-    assert(QEMU_IS_ALIGNED(mapping->size, getpagesize()));
-    assert(index >= 0 && index < s->nr_mappings);
+    assert(QEMU_IS_ALIGNED(unmap.size, getpagesize()));
     if (ioctl(s->container, VFIO_IOMMU_UNMAP_DMA, &unmap)) {
         error_setg(errp, "VFIO_UNMAP_DMA failed: %d", -errno);
     }
-    memmove(mapping, &s->mappings[index + 1],
-            sizeof(s->mappings[0]) * (s->nr_mappings - index - 1));
-    s->nr_mappings--;
-    s->mappings = g_renew(IOVAMapping, s->mappings, s->nr_mappings);
-}
-
-/* Check if the mapping list is (ascending) ordered. */
-static bool qemu_vfio_verify_mappings(QEMUVFIOState *s)
-{
-    int i;
-    if (QEMU_VFIO_DEBUG) {
-        for (i = 0; i < s->nr_mappings - 1; ++i) {
-            if (!(s->mappings[i].host < s->mappings[i + 1].host)) {
-                fprintf(stderr, "item %d not sorted!\n", i);
-                qemu_vfio_dump_mappings(s);
-                return false;
-            }
-            if (!(s->mappings[i].host + s->mappings[i].size <=
-                  s->mappings[i + 1].host)) {
-                fprintf(stderr, "item %d overlap with next!\n", i);
-                qemu_vfio_dump_mappings(s);
-                return false;
-            }
-        }
-    }
-    return true;
+    /* @mapping is freed by the removal, so use a copy of its range. */
+    iova_tree_remove(s->mappings, &range);
 }
 
 /* Map [host, host + size) area into a contiguous IOVA address space, and store
@@ -609,17 +533,16 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
                       bool temporary, uint64_t *iova)
 {
     int ret = 0;
-    int index;
-    IOVAMapping *mapping;
+    DMAMap *mapping;
     uint64_t iova0;
 
     assert(QEMU_PTR_IS_ALIGNED(host, getpagesize()));
     assert(QEMU_IS_ALIGNED(size, getpagesize()));
     trace_qemu_vfio_dma_map(s, host, size, temporary, iova);
     qemu_mutex_lock(&s->lock);
-    mapping = qemu_vfio_find_mapping(s, host, &index);
+    mapping = qemu_vfio_find_mapping(s, host);
     if (mapping) {
-        iova0 = mapping->iova + ((uint8_t *)host - (uint8_t *)mapping->host);
+        iova0 = mapping->translated_addr + ((uintptr_t)host - mapping->iova);
     } else {
         if (s->high_water_mark - s->low_water_mark + 1 < size) {
             ret = -ENOMEM;
@@ -627,15 +550,15 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
         }
         if (!temporary) {
             iova0 = s->low_water_mark;
-            mapping = qemu_vfio_add_mapping(s, host, size, index + 1, iova0);
-            if (!mapping) {
-                ret = -ENOMEM;
+            ret = qemu_vfio_add_mapping(s, host, size, iova0);
+            if (ret) {
                 goto out;
             }
-            assert(qemu_vfio_verify_mappings(s));
             ret = qemu_vfio_do_mapping(s, host, size, iova0);
             if (ret) {
-                qemu_vfio_undo_mapping(s, mapping, NULL);
+                DMAMap m = { .iova = (uintptr_t)host, .size = size - 1 };
+
+                iova_tree_remove(s->mappings, &m);
                 goto out;
             }
             s->low_water_mark += size;
@@ -682,8 +605,7 @@ int qemu_vfio_dma_reset_temporary(QEMUVFIOState *s)
  * qemu_vfio_dma_map(). */
 void qemu_vfio_dma_unmap(QEMUVFIOState *s, void *host)
 {
-    int index = 0;
-    IOVAMapping *m;
+    DMAMap *m;
 
     if (!host) {
         return;
@@ -691,7 +613,7 @@ void qemu_vfio_dma_unmap(QEMUVFIOState *s, void *host)
 
     trace_qemu_vfio_dma_unmap(s, host);
     qemu_mutex_lock(&s->lock);
-    m = qemu_vfio_find_mapping(s, host, &index);
+    m = qemu_vfio_find_mapping(s, host);
     if (!m) {
         goto out;
     }
@@ -708,14 +630,21 @@ static void qemu_vfio_reset(QEMUVFIOState *s)
 /* Close and free the VFIO resources. */
 void qemu_vfio_close(QEMUVFIOState *s)
 {
-    int i;
+    struct vfio_iommu_type1_dma_unmap unmap = {
+        .argsz = sizeof(unmap),
+        .flags = 0,
+        .iova = QEMU_VFIO_IOVA_MIN,
+    };
 
     if (!s) {
         return;
     }
-    for (i = 0; i < s->nr_mappings; ++i) {
-        qemu_vfio_undo_mapping(s, &s->mappings[i], NULL);
+    /* All fixed mappings live below low_water_mark; drop them at once. */
+    unmap.size = s->low_water_mark - QEMU_VFIO_IOVA_MIN;
+    if (unmap.size && ioctl(s->container, VFIO_IOMMU_UNMAP_DMA, &unmap)) {
+        error_report("VFIO_UNMAP_DMA: %d", -errno);
     }
+    iova_tree_destroy(s->mappings);
     ram_block_notifier_remove(&s->ram_notifier);
     qemu_vfio_reset(s);
     close(s->device);
@@ -77,6 +77,7 @@ int main(int argc, char **argv)
 #include "ui/input.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/numa.h"
+#include "sysemu/hostmem.h"
 #include "exec/gdbstub.h"
 #include "qemu/timer.h"
 #include "chardev/char.h"
@@ -123,8 +124,10 @@ int main(int argc, char **argv)
 #include "sysemu/replay.h"
 #include "qapi/qapi-events-run-state.h"
 #include "qapi/qapi-visit-block-core.h"
+#include "qapi/qapi-visit-misc.h"
 #include "qapi/qapi-visit-ui.h"
 #include "qapi/qapi-commands-block-core.h"
+#include "qapi/qapi-commands-misc.h"
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-ui.h"
 #include "qapi/qmp/qerror.h"
@@ -494,6 +497,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -3043,6 +3049,19 @@ int main(int argc, char **argv, char **envp)
                     QSIMPLEQ_INSERT_TAIL(&bdo_queue, bdo, entry);
                     break;
                 }
+            case QEMU_OPTION_thread_policy:
+                {
+                    ThreadPolicy *policy;
+                    Visitor *v;
+
+                    v = qobject_input_visitor_new_str(optarg, "category",
+                                                      &error_fatal);
+                    visit_type_ThreadPolicy(v, NULL, &policy, &error_fatal);
+                    visit_free(v);
+                    qmp_set_thread_policy(policy, &error_fatal);
+                    qapi_free_ThreadPolicy(policy);
+                    break;
+                }
             case QEMU_OPTION_drive:
                 if (drive_def(optarg) == NULL) {
                     exit(1);
@@ -3668,6 +3687,14 @@ int main(int argc, char **argv, char **envp)
                     exit(1);
                 }
                 break;
+            case QEMU_OPTION_perfmap:
+#ifndef CONFIG_TCG
+                error_report("TCG is disabled");
+                exit(1);
+#else
+                tcg_perfmap_enable();
+#endif
+                break;
             case QEMU_OPTION_icount:
                 icount_opts = qemu_opts_parse_noisily(qemu_find_opts("icount"),
                                                       optarg, true);
@@ -4387,6 +4414,7 @@ int main(int argc, char **argv, char **envp)
     qemu_opts_foreach(qemu_find_opts("device"),
                       device_init_func, NULL, &error_fatal);
 
+    qemu_wait_all_vcpus_created();
     cpu_synchronize_all_post_init();
 
     rom_reset_order_override();
@@ -4444,6 +4472,9 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
 
+    /* Guest RAM is written from here on, and the guest may start */
+    host_memory_backend_prealloc_wait(&error_fatal);
+
     replay_start();
 
     /* This checkpoint is required by replay to separate prior clock